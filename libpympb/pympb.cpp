@@ -894,6 +894,9 @@ void mode_solver::reset_epsilon(geometric_object_list *geometry) {
   // if (!mu_input_file.empty()) {
   // }
 
+  meep_geom::read_epsilon_files(*geometry, meep_geom::material_type_list(),
+                                (meep_geom::material_type)default_material);
+
   meep::master_printf("Initializing epsilon function...\n");
   set_maxwell_dielectric(mdata, mesh, R, G, dielectric_function, mean_epsilon_func,
                          static_cast<void *>(this));
@@ -971,6 +974,40 @@ int mode_solver::get_kpoint_index() { return kpoint_index; }
 
 void mode_solver::set_kpoint_index(int i) { kpoint_index = i; }
 
+/* In a k-point-parallel run, the processes are divided by
+   meep::divide_parallel_processes into num_groups groups, each solving
+   a block of the k-points (every process of a group holds the same
+   solution).  sum_over_kpoint_groups sums data over the groups,
+   counting each group once, and leaves the result on all processes. */
+void mode_solver::sum_over_kpoint_groups(double *data, int size) {
+  std::vector<double> mine(data, data + size);
+  if (!meep::am_master()) std::fill(mine.begin(), mine.end(), 0.0);
+  meep::begin_global_communications();
+  meep::sum_to_all(mine.data(), data, size);
+  meep::end_global_communications();
+}
+
+/* Copy the solver state (eigenvectors, k-point, frequencies) of group
+   from_group to all groups, e.g. so that every process ends a
+   k-point-parallel run with the fields of the last k-point. */
+void mode_solver::share_kpoint_group_fields(int from_group, int num_groups) {
+  if (!mdata) return;
+  meep::begin_global_communications();
+  int np = meep::count_processors();
+  int from = (from_group * np + num_groups - 1) / num_groups; // first process of from_group
+  meep::broadcast(from, (char *)H.data, int(sizeof(scalar) * H.n * H.p));
+  meep::broadcast(from, (char *)freqs.data(), int(sizeof(mpb_real) * freqs.size()));
+  meep::broadcast(from, (double *)&cur_kvector, 3);
+  iterations = meep::broadcast(from, iterations);
+  kpoint_index = meep::broadcast(from, kpoint_index);
+  meep::end_global_communications();
+
+  mpb_real k[3];
+  vector3_to_arr(k, cur_kvector);
+  update_maxwell_data_k(mdata, k, G[0], G[1], G[2]);
+  curfield_reset();
+}
+
 void mode_solver::randomize_fields() {
 
   if (!mdata) { return; }
@@ -98,6 +98,8 @@ struct mode_solver {
   void set_num_bands(int nb);
   int get_kpoint_index();
   void set_kpoint_index(int i);
+  void sum_over_kpoint_groups(double *data, int size);
+  void share_kpoint_group_fields(int from_group, int num_groups);
   void get_epsilon();
   void get_mu();
   void get_epsilon_tensor(int c1, int c2, int imag, int inv);
@@ -23,7 +23,8 @@ adjoint_options={
  'logfile':             None,
  'plot_pause':          0.1,
  'animate_components':  None,
- 'animate_interval':    1.0
+ 'animate_interval':    1.0,
+ 'adjoint_groups':      1
 }
 
 ##################################################
@@ -212,6 +213,7 @@ class DFTCell(object):
         self.dft_obj    = None  # meep DFT object for current simulation
 
         self.EH_cache   = {}    # cache of frequency-domain field data computed in previous simulations
+        self.local_cache= {}    # process-local (ungathered) E-field data saved by save_local_fields
         self.eigencache = {}    # cache of eigenmode field data to avoid redundant recalculationsq
 
         self.name = name
@@ -306,6 +308,24 @@ class DFTCell(object):
     def purge_fields(self, label):
         if label in self.EH_cache:
             del self.EH_cache[label]
+        if label in self.local_cache:
+            del self.local_cache[label]
+
+    ######################################################################
+    # Like save_fields, but keeps only the E-field points owned by this
+    # process, as they are stored in the DFT chunks, without gathering any
+    # arrays; this is the forward data used by the native gradient kernel
+    # in AdjointSolver.eval_gradf. Returns False (saving nothing) for cells
+    # that are not 'fields' cells or whose volume has an empty dimension.
+    ######################################################################
+    def save_local_fields(self, label):
+        if self.celltype!='fields':
+            return False
+        local = mp.dft_fields_local(self.sim.fields, self.dft_obj.swigobj)
+        if local.collapsed:
+            return False
+        self.local_cache[label] = local
+        return True
 
     ######################################################################
     # Return a 1D array (list) of arrays of field amplitudes for all
@@ -509,6 +529,7 @@ class AdjointSolver(object):
         self.sim         = sim
         self.vis         = vis
         self.dfdEps      = None #0.0j*np.zeros(self.dft_cells[-1].slice_dims)
+        self.btable      = None # basis functions tabulated on the design grid
 
         # prefetch names of outputs computed by forward and
         # adjoint solves, for use in writing log files
@@ -521,14 +542,33 @@ class AdjointSolver(object):
     def eval_fq(self, nf=0):
         return self.obj_func.get_fq(self.dft_cells,nf=nf)
 
+    ######################################################################
+    # The gradient is computed chunk-locally in C++ from the process-local
+    # forward data (DFTCell.save_local_fields) and the adjoint DFT chunks,
+    # summing only the gradient vector over processes. The full forward
+    # and adjoint arrays are gathered only when the visualizer needs
+    # dfdEps, or the design cell could not be saved locally.
+    ######################################################################
     def eval_gradf(self, nf=0):
         cell=self.dft_cells[-1] # design cell
+        if self.vis is None and 'forward' in cell.local_cache:
+            gradf=np.zeros(self.basis.dim,dtype=np.complex128)
+            mp._get_dft_gradient(self.sim.fields, cell.local_cache['forward'],
+                                 cell.dft_obj.swigobj, nf, cell.xyzw[3].flatten(),
+                                 self.get_basis_table(cell.xyzw), gradf)
+            return gradf
         EH_forward=cell.get_EH_slices(nf,label='forward')
         EH_adjoint=cell.get_EH_slices(nf) # no label->current simulation
         self.dfdEps=np.sum( [EH_forward[nc]*EH_adjoint[nc]
                                for nc,c in enumerate(cell.components) if c in Exyz], 0 )
         return self.basis.overlap(self.dfdEps,cell.xyzw)
 
+    def get_basis_table(self, xyzw):
+        if self.btable is None:
+            p=[mp.Vector3(xx,yy,zz) for xx in xyzw[0] for yy in xyzw[1] for zz in xyzw[2]]
+            self.btable=np.reshape([self.basis(pp) for pp in p],(len(p),self.basis.dim)).astype(np.float64)
+        return self.btable
+
     #########################################################
     #########################################################
     #########################################################
@@ -641,12 +681,52 @@ class AdjointSolver(object):
         return self.run_until_converged(case='forward')   # returns fq
 
     def adjoint_solve(self):
-        for cell in self.dft_cells:
-            cell.save_fields('forward')
         qweights=self.obj_func.get_partials()
+        ngroups=self.num_adjoint_groups(qweights)
+        # the design cell needs only process-local forward data, unless it
+        # is also an objective cell (its slices then shape adjoint sources)
+        # or the adjoint runs on a different set of processes
+        ndesign=len(self.dft_cells)-1
+        local_design=self.vis is None and ngroups==1 \
+                     and all(qr.ncell!=ndesign for qr in self.obj_func.qrules)
+        for nc, cell in enumerate(self.dft_cells):
+            cell.purge_fields('forward')
+            if nc==ndesign and local_design and cell.save_local_fields('forward'):
+                continue
+            cell.save_fields('forward')
+        if ngroups>1:
+            return self.split_adjoint_solve(qweights, ngroups)
         self.place_adjoint_sources(qweights)
         return self.run_until_converged(case='adjoint')  # returns gradf
 
+    ########################################################
+    # The adjoint sources of the individual objective quantities
+    # depend only on the (saved) forward fields, and the gradient
+    # is linear in their weights; with adjoint_options['adjoint_groups']
+    # > 1 the processes are divided into that many groups, each
+    # running the adjoint solve for its share of the quantities on
+    # its own copy of the structure, and the partial gradients are
+    # summed over all processes afterwards.
+    ########################################################
+    def num_adjoint_groups(self, qweights):
+        nq=sum(1 for qw in qweights if qw!=0.0)
+        return max(1, min(adjoint_options['adjoint_groups'], nq, mp.count_processors())) \
+               if self.vis is None else 1
+
+    def split_adjoint_solve(self, qweights, ngroups):
+        nonzero=[nq for nq,qw in enumerate(qweights) if qw!=0.0]
+        self.sim.reset_meep() # the structure is re-created within each group
+        group=mp.divide_parallel_processes(ngroups)
+        mine=nonzero[group::ngroups]
+        self.place_adjoint_sources([qw if nq in mine else 0.0 for nq,qw in enumerate(qweights)])
+        gradf=np.asarray(self.run_until_converged(case='adjoint'),dtype=np.complex128)
+        self.sim.reset_meep() # free the group's fields before leaving the group
+        if not mp.am_master():
+            gradf[:]=0.0      # count each group's gradient once in the global sum
+        mp.end_divide_parallel()
+        mp._sum_to_all_array(gradf)
+        return gradf
+
     def solve(self, need_gradient=False):
         fq    = self.forward_solve()
         gradf = self.adjoint_solve() if need_gradient else 0
@@ -82,6 +82,7 @@ class OptimizationProblem(ABC):
         adjoint_options['dft_reltol']   = args.dft_reltol
         adjoint_options['dft_timeout']  = args.dft_timeout
         adjoint_options['dft_interval'] = args.dft_interval
+        adjoint_options['adjoint_groups'] = args.adjoint_groups
         adjoint_options['verbosity']    = 'verbose' if args.verbose         \
                                           else 'concise' if args.concise    \
                                           else adjoint_options['verbosity']
@@ -121,6 +122,7 @@ class OptimizationProblem(ABC):
         parser.add_argument('--dft_reltol',   type=float, default=adjoint_options['dft_reltol'],   help='convergence threshold for end of timestepping')
         parser.add_argument('--dft_timeout',  type=float, default=adjoint_options['dft_timeout'],  help='max runtime in units of last_source_time')
         parser.add_argument('--dft_interval', type=float, default=adjoint_options['dft_interval'], help='meep time DFT convergence checks in units of last_source_time')
+        parser.add_argument('--adjoint_groups', type=int, default=adjoint_options['adjoint_groups'], help='number of process groups running adjoint solves concurrently')
 
         #--------------------------------------------------
         # flags affecting outputs from meep computations
@@ -169,6 +169,17 @@ static std::complex<double> py_src_func_wrap(double t, void *f) {
     return ret;
 }
 
+static void py_solve_cw_callback_wrap(meep::fields *f, int ifreq, void *user_data) {
+    (void)f;
+    PyObject *py_ifreq = PyInteger_FromLong(ifreq);
+    PyObject *py_result = PyObject_CallFunctionObjArgs((PyObject*)user_data, py_ifreq, NULL);
+    if (!py_result) {
+        PyErr_PrintEx(0);
+    }
+    Py_DECREF(py_ifreq);
+    Py_XDECREF(py_result);
+}
+
 static meep::vec py_kpoint_func_wrap(double freq, int mode, void *user_data) {
     PyObject *py_freq = PyFloat_FromDouble(freq);
     PyObject *py_mode = PyInteger_FromLong(mode);
@@ -440,12 +451,133 @@ PyObject *_get_dft_array(meep::fields *f, dft_type dft, meep::component c, int n
     return py_arr;
 }
 
+// Read-only NumPy view (no copy) of data owned by a chunk; the view is only
+// valid as long as the chunk keeps that array.
+static PyObject *_chunk_array_view(void *data, int type, int rank, npy_intp *dims,
+                                   npy_intp *strides) {
+    PyObject *arr = PyArray_New(&PyArray_Type, rank, dims, type, strides, data, 0,
+                                NPY_ARRAY_ALIGNED, NULL);
+    if (arr) PyArray_CLEARFLAGS((PyArrayObject *)arr, NPY_ARRAY_WRITEABLE);
+    return arr;
+}
+
+// For each chunk of f owned by this process, a dict with read-only views
+// 're' and 'im' (None for real fields) of fields_chunk::f[c], indexed by the
+// grid points along 'directions', plus the location 'origin' of index 0
+// (including the Yee shift 'yee_shift' of c) and the inclusive index range
+// 'owned_start'..'owned_end' of the points the chunk owns.
+PyObject *_get_field_chunk_views(meep::fields *f, meep::component c) {
+    PyObject *py_list = PyList_New(0);
+    int type = sizeof(meep::realnum) == sizeof(float) ? NPY_FLOAT : NPY_DOUBLE;
+    for (int i = 0; i < f->num_chunks; ++i) {
+        meep::fields_chunk *fc = f->chunks[i];
+        if (!fc->is_mine() || !fc->f[c][0]) continue;
+        const meep::grid_volume &gv = fc->gv;
+        meep::ivec io = gv.little_corner() + gv.iyee_shift(c);
+        meep::ivec os = gv.little_owned_corner(c), oe = gv.big_corner();
+        npy_intp dims[3], strides[3];
+        PyObject *py_dirs = PyList_New(0), *py_start = PyList_New(0), *py_end = PyList_New(0);
+        int rank = 0;
+        LOOP_OVER_DIRECTIONS(gv.dim, d) {
+            dims[rank] = gv.num_direction(d) + 1;
+            strides[rank] = gv.stride(d) * sizeof(meep::realnum);
+            PyObject *py_d = PyInteger_FromLong(static_cast<int>(d));
+            PyObject *py_s = PyInteger_FromLong((os.in_direction(d) - io.in_direction(d)) / 2);
+            PyObject *py_e = PyInteger_FromLong((oe.in_direction(d) - io.in_direction(d)) / 2);
+            PyList_Append(py_dirs, py_d);
+            PyList_Append(py_start, py_s);
+            PyList_Append(py_end, py_e);
+            Py_DECREF(py_d);
+            Py_DECREF(py_s);
+            Py_DECREF(py_e);
+            ++rank;
+        }
+        PyObject *py_re = _chunk_array_view(fc->f[c][0], type, rank, dims, strides);
+        PyObject *py_im = Py_None;
+        if (fc->f[c][1])
+            py_im = _chunk_array_view(fc->f[c][1], type, rank, dims, strides);
+        else
+            Py_INCREF(Py_None);
+        PyObject *py_dict = Py_BuildValue("{s:i,s:N,s:N,s:N,s:N,s:N,s:N,s:N}", "chunk", i,
+                                          "re", py_re, "im", py_im, "directions", py_dirs,
+                                          "origin", vec2py(gv[io], true),
+                                          "yee_shift", vec2py(gv.yee_shift(c), true),
+                                          "owned_start", py_start, "owned_end", py_end);
+        PyList_Append(py_list, py_dict);
+        Py_DECREF(py_dict);
+    }
+    return py_list;
+}
+
+// For each chunk in the list starting at dc, a dict with a read-only view
+// 'dft' of its N x Nomega dft array (as stored, i.e. including any stored
+// weights), its 'component', and the corners 'start', 'end' of its points.
+PyObject *_get_dft_chunk_views(meep::dft_chunk *dc) {
+    PyObject *py_list = PyList_New(0);
+    for (meep::dft_chunk *cur = dc; cur; cur = cur->next_in_dft) {
+        if (!cur->dft || cur->N == 0) continue;
+        cur->flush_dft();
+        npy_intp dims[2] = {npy_intp(cur->N), cur->Nomega};
+        npy_intp strides[2] = {npy_intp(cur->Nomega * sizeof(std::complex<double>)),
+                               sizeof(std::complex<double>)};
+        PyObject *py_dft = _chunk_array_view(cur->dft, NPY_CDOUBLE, 2, dims, strides);
+        PyObject *py_dict = Py_BuildValue("{s:N,s:i,s:N,s:N}", "dft", py_dft,
+                                          "component", static_cast<int>(cur->c),
+                                          "start", vec2py(cur->fc->gv[cur->is], true),
+                                          "end", vec2py(cur->fc->gv[cur->ie], true));
+        PyList_Append(py_list, py_dict);
+        Py_DECREF(py_dict);
+    }
+    return py_list;
+}
+
+// fields::get_dft_gradient for NumPy arrays: weights (num_points) and
+// basis (num_points x num_basis) on the grid of get_dft_array, grad (num_basis)
+void _get_dft_gradient(meep::fields *f, const meep::dft_fields_local &fwd, meep::dft_fields adj,
+                       int num_freq, double *weights, int num_points, double *basis, int nb_points,
+                       int num_basis, std::complex<double> *grad, int num_grad) {
+    if (nb_points != num_points || num_grad != num_basis) {
+        meep::abort("get_dft_gradient: inconsistent weights, basis and gradient array sizes.\n");
+    }
+    f->get_dft_gradient(fwd, adj, num_freq, weights, num_points, basis, num_basis, grad);
+}
+
+// collect the bytes object data of every process on the master, as a list
+// in process order (None on the other processes)
+PyObject *_gather_bytes_to_master(PyObject *data) {
+    if (!PyBytes_Check(data)) {
+        meep::abort("_gather_bytes_to_master: expected a bytes object.\n");
+    }
+    int np = meep::count_processors(), me = meep::my_rank();
+    std::vector<size_t> mine(np, 0), sizes(np, 0);
+    mine[me] = PyBytes_Size(data);
+    meep::sum_to_all(&mine[0], &sizes[0], np);
+
+    PyObject *py_list = meep::am_master() ? PyList_New(np) : NULL;
+    std::vector<char> buf;
+    for (int p = 0; p < np; ++p) {
+        if (p != me && !py_list) continue; // only p and the master take part
+        buf.resize(sizes[p] + 1);
+        if (p == me) memcpy(&buf[0], PyBytes_AsString(data), sizes[p]);
+        meep::send(p, 0, &buf[0], (int)sizes[p]);
+        if (py_list) PyList_SetItem(py_list, p, PyBytes_FromStringAndSize(&buf[0], sizes[p]));
+    }
+    if (py_list) return py_list;
+    Py_RETURN_NONE;
+}
+
+// sum a complex NumPy array over all processes, in place
+void _sum_to_all_array(std::complex<double> *cdata, int size) {
+    std::vector<std::complex<double> > mine(cdata, cdata + size);
+    meep::sum_to_all(size ? &mine[0] : NULL, cdata, size);
+}
+
 size_t _get_dft_data_size(meep::dft_chunk *dc) {
     size_t istart;
     return meep::dft_chunks_Ntotal(dc, &istart) / 2;
 }
 
-void _get_dft_data(meep::dft_chunk *dc, std::complex<meep::realnum> *cdata, int size) {
+void _get_dft_data(meep::dft_chunk *dc, std::complex<double> *cdata, int size) {
     size_t istart;
     size_t n = meep::dft_chunks_Ntotal(dc, &istart) / 2;
     istart /= 2;
@@ -456,6 +588,7 @@ void _get_dft_data(meep::dft_chunk *dc, std::complex<meep::realnum> *cdata, int
 
     for (meep::dft_chunk *cur = dc; cur; cur = cur->next_in_dft) {
         size_t Nchunk = cur->N * cur->Nomega;
+        cur->flush_dft();
         for (size_t i = 0; i < Nchunk; ++i) {
             cdata[i + istart] = cur->dft[i];
         }
@@ -463,7 +596,7 @@ void _get_dft_data(meep::dft_chunk *dc, std::complex<meep::realnum> *cdata, int
     }
 }
 
-void _load_dft_data(meep::dft_chunk *dc, std::complex<meep::realnum> *cdata, int size) {
+void _load_dft_data(meep::dft_chunk *dc, std::complex<double> *cdata, int size) {
     size_t istart;
     size_t n = meep::dft_chunks_Ntotal(dc, &istart) / 2;
     istart /= 2;
@@ -474,9 +607,11 @@ void _load_dft_data(meep::dft_chunk *dc, std::complex<meep::realnum> *cdata, int
 
     for (meep::dft_chunk *cur = dc; cur; cur = cur->next_in_dft) {
         size_t Nchunk = cur->N * cur->Nomega;
+        cur->unshare();
         for (size_t i = 0; i < Nchunk; ++i) {
             cur->dft[i] = cdata[i + istart];
         }
+        cur->discard_pending();
         istart += Nchunk;
     }
 }
@@ -551,10 +686,20 @@ void _get_eigenmode(meep::fields *f, double omega_src, meep::direction d, const
 #endif
 %}
 
-%numpy_typemaps(std::complex<meep::realnum>, NPY_CDOUBLE, int);
 %numpy_typemaps(std::complex<double>, NPY_CDOUBLE, size_t);
 
-%apply (std::complex<meep::realnum> *INPLACE_ARRAY1, int DIM1) {(std::complex<meep::realnum> *cdata, int size)};
+%apply (std::complex<double> *INPLACE_ARRAY1, int DIM1) {(std::complex<double> *cdata, int size)};
+
+// _get_dft_gradient
+%apply (double *IN_ARRAY1, int DIM1) {(double *weights, int num_points)};
+%apply (double *IN_ARRAY2, int DIM1, int DIM2) {(double *basis, int nb_points, int num_basis)};
+%apply (std::complex<double> *INPLACE_ARRAY1, int DIM1) {(std::complex<double> *grad, int num_grad)};
+
+// custom_src_time::set_table
+%apply (std::complex<double> *IN_ARRAY1, size_t DIM1) {(std::complex<double> *values, size_t n)};
+
+// rasterize_GDSII_layer
+%apply (double *INPLACE_ARRAY2, int DIM1, int DIM2) {(double *grid, int nx, int ny)};
 
 // add_volume_source
 %apply (std::complex<double> *INPLACE_ARRAY3, size_t DIM1, size_t DIM2, size_t DIM3) {
@@ -585,9 +730,16 @@ PyObject *_dft_ldos_F(meep::dft_ldos *f);
 PyObject *_dft_ldos_J(meep::dft_ldos *f);
 template<typename dft_type>
 PyObject *_get_dft_array(meep::fields *f, dft_type dft, meep::component c, int num_freq);
+PyObject *_get_field_chunk_views(meep::fields *f, meep::component c);
+PyObject *_get_dft_chunk_views(meep::dft_chunk *dc);
+void _get_dft_gradient(meep::fields *f, const meep::dft_fields_local &fwd, meep::dft_fields adj,
+                       int num_freq, double *weights, int num_points, double *basis, int nb_points,
+                       int num_basis, std::complex<double> *grad, int num_grad);
+void _sum_to_all_array(std::complex<double> *cdata, int size);
+PyObject *_gather_bytes_to_master(PyObject *data);
 size_t _get_dft_data_size(meep::dft_chunk *dc);
-void _get_dft_data(meep::dft_chunk *dc, std::complex<meep::realnum> *cdata, int size);
-void _load_dft_data(meep::dft_chunk *dc, std::complex<meep::realnum> *cdata, int size);
+void _get_dft_data(meep::dft_chunk *dc, std::complex<double> *cdata, int size);
+void _load_dft_data(meep::dft_chunk *dc, std::complex<double> *cdata, int size);
 meep::volume_list *make_volume_list(const meep::volume &v, int c,
                                     std::complex<double> weight,
                                     meep::volume_list *next);
@@ -684,6 +836,7 @@ meep::volume_list *make_volume_list(const meep::volume &v, int c,
             delete[] ((material_data *)$1.material)->medium.H_susceptibilities.items;
         }
         delete[] ((material_data *)$1.material)->epsilon_data;
+        delete[] ((material_data *)$1.material)->epsilon_file;
         delete (material_data *)$1.material;
         geometric_object_destroy($1);
     }
@@ -724,6 +877,7 @@ meep::volume_list *make_volume_list(const meep::volume &v, int c,
             delete[] ((material_data *)$1.items[i].material)->medium.H_susceptibilities.items;
         }
         delete[] ((material_data *)$1.items[i].material)->epsilon_data;
+        delete[] ((material_data *)$1.items[i].material)->epsilon_file;
         delete (material_data *)$1.items[i].material;
         geometric_object_destroy($1.items[i]);
     }
@@ -787,6 +941,33 @@ meep::volume_list *make_volume_list(const meep::volume &v, int c,
 
 }
 
+// Typemap suite for fields::run_steps: a list of step_action objects
+
+%typecheck(SWIG_TYPECHECK_POINTER) (meep::step_action **actions, int num_actions) {
+    $1 = PyList_Check($input);
+}
+
+%typemap(in) (meep::step_action **actions, int num_actions) {
+    if (!PyList_Check($input)) {
+        SWIG_exception_fail(SWIG_TypeError, "Expected a list of meep.step_action objects");
+    }
+    $2 = (int)PyList_Size($input);
+    $1 = new meep::step_action *[$2 > 0 ? $2 : 1];
+    for (int i = 0; i < $2; ++i) {
+        void *tmp_ptr = 0;
+        int tmp_res = SWIG_ConvertPtr(PyList_GetItem($input, i), &tmp_ptr,
+                                      $descriptor(meep::step_action *), 0);
+        if (!SWIG_IsOK(tmp_res)) {
+            SWIG_exception_fail(SWIG_ArgError(tmp_res), "Expected a list of meep.step_action objects");
+        }
+        $1[i] = reinterpret_cast<meep::step_action *>(tmp_ptr);
+    }
+}
+
+%typemap(freearg) (meep::step_action **actions, int num_actions) {
+    delete[] $1;
+}
+
 // Typemap suite for boundary_region
 
 %typecheck(SWIG_TYPECHECK_POINTER) void *pml_profile_data {
@@ -846,6 +1027,7 @@ meep::volume_list *make_volume_list(const meep::volume &v, int c,
         delete[] $1->medium.H_susceptibilities.items;
     }
     delete[] $1->epsilon_data;
+    delete[] $1->epsilon_file;
     delete $1;
 }
 
@@ -1164,6 +1346,7 @@ meep::volume_list *make_volume_list(const meep::volume &v, int c,
                 delete[] $1.items[i]->medium.H_susceptibilities.items;
             }
             delete[] $1.items[i]->epsilon_data;
+            delete[] $1.items[i]->epsilon_file;
         }
         delete[] $1.items;
     }
@@ -1200,6 +1383,26 @@ meep::volume_list *make_volume_list(const meep::volume &v, int c,
     }
 }
 
+// Typemap suite for solve_cw_callback
+
+%typecheck(SWIG_TYPECHECK_POINTER) (meep::solve_cw_callback callback, void *callback_data) {
+    $1 = PyCallable_Check($input) || $input == Py_None;
+}
+
+%typemap(in) (meep::solve_cw_callback callback, void *callback_data) {
+    if ($input == Py_None) {
+        $1 = NULL;
+        $2 = NULL;
+    }
+    else {
+        $1 = py_solve_cw_callback_wrap;
+        $2 = (void*)$input;
+    }
+}
+
+// solve_cw_multi
+%apply (std::complex<double> *IN_ARRAY1, size_t DIM1) {(const std::complex<double> *freqs, size_t nfreqs)};
+
 %apply double *flux {
     double *electric,
     double *magnetic,
@@ -1252,6 +1455,7 @@ meep::volume_list *make_volume_list(const meep::volume &v, int c,
 %ignore is_medium;
 %ignore is_metal;
 %ignore meep::infinity;
+%ignore meep::read_expanded_hdf5; // see read_expanded_hdf5 in simulation.py
 
 %ignore std::vector<meep::volume>::vector(size_type);
 %ignore std::vector<meep::volume>::resize;
@@ -1454,6 +1658,8 @@ PyObject *_get_array_slice_dimensions(meep::fields *f, const meep::volume &where
         display_progress,
         during_sources,
         GDSII_layers,
+        GDSII_prisms,
+        GDSII_rasterize,
         GDSII_vol,
         get_center_and_size,
         get_eigenmode_freqs,
@@ -1499,6 +1705,7 @@ PyObject *_get_array_slice_dimensions(meep::fields *f, const meep::volume &where
         output_hfield_r,
         output_hfield_p,
         output_png,
+        read_expanded_hdf5,
         output_poynting,
         output_poynting_x,
         output_poynting_y,
@@ -1511,6 +1718,7 @@ PyObject *_get_array_slice_dimensions(meep::fields *f, const meep::volume &where
         output_sfield_z,
         output_sfield_r,
         output_sfield_p,
+        parameter_sweep,
         py_v3_to_vec,
         quiet,
         scale_energy_fields,
@@ -1627,6 +1835,9 @@ meep::structure *create_structure_and_set_materials(vector3 cell_size,
       s = existing_s;
     }
     else {
+      if (!split_chunks_evenly && !meep_geom::fragment_stats::has_non_medium_material() &&
+          (num_chunks > 1 || meep::count_processors() > 1))
+        meep_geom::fragment_stats::compute_fragment_grid(gv);
       s = new meep::structure(gv, NULL, br, sym, num_chunks, Courant,
                               use_anisotropic_averaging, tol, maxeval);
     }
@@ -1663,6 +1874,7 @@ meep::structure *create_structure_and_set_materials(vector3 cell_size,
     // Return params to default state
     meep_geom::fragment_stats::resolution = 0;
     meep_geom::fragment_stats::split_chunks_evenly = false;
+    meep_geom::fragment_stats::clear_fragment_grid();
 
     return s;
 }
@@ -17,7 +17,7 @@ import numpy as np
 
 import meep as mp
 from meep.geom import Vector3, init_do_averaging
-from meep.source import EigenModeSource, check_positive
+from meep.source import CustomSource, EigenModeSource, check_positive
 import meep.visualization as vis
 
 
@@ -630,6 +630,7 @@ class Simulation(object):
         self.epsilon_func = epsilon_func
         self.load_structure_file = load_structure
         self.dft_objects = []
+        self._eps_image_cache = None  # (key, array) of the last plot_eps image
         self._is_initialized = False
         self.force_all_components = force_all_components
         self.split_chunks_evenly = split_chunks_evenly
@@ -1021,6 +1022,7 @@ class Simulation(object):
         return stats
 
     def _init_structure(self, k=False):
+        self._eps_image_cache = None
         if mp.cvar.verbosity > 0:
             print('-' * 11)
             print('Initializing structure...')
@@ -1104,6 +1106,7 @@ class Simulation(object):
         return [self.structure.estimated_cost(i) for i in range(mp.count_processors())]
 
     def set_materials(self, geometry=None, default_material=None):
+        self._eps_image_cache = None
         if self.fields:
             self.fields.remove_susceptibilities()
 
@@ -1145,6 +1148,28 @@ class Simulation(object):
             self.structure
         )
 
+    def update_materials(self, vol=None, center=None, size=None, geometry=None):
+        """Re-evaluate the materials only inside the given volume (e.g. a design region
+        whose MATERIAL_USER values changed), keeping the fields, DFT objects and
+        susceptibilities of the current simulation."""
+        if self.structure is None:
+            raise ValueError("Fields must be initialized before calling update_materials")
+        self._eps_image_cache = None
+        absorbers = [bl for bl in self.boundary_layers if type(bl) is Absorber]
+        mp.update_materials_from_geometry(
+            self.structure,
+            geometry if geometry is not None else self.geometry,
+            self._volume_from_kwargs(vol, center, size),
+            self.geometry_center,
+            self.eps_averaging,
+            self.subpixel_tol,
+            self.subpixel_maxeval,
+            self.ensure_periodicity and not not self.k_point,
+            self.default_material,
+            absorbers,
+            self.extra_materials
+        )
+
     def dump_structure(self, fname):
         if self.structure is None:
             raise ValueError("Fields must be initialized before calling dump_structure")
@@ -1153,8 +1178,19 @@ class Simulation(object):
     def load_structure(self, fname):
         if self.structure is None:
             raise ValueError("Fields must be initialized before calling load_structure")
+        self._eps_image_cache = None
         self.structure.load(fname)
 
+    def dump_fields(self, fname):
+        if self.fields is None:
+            raise ValueError("Fields must be initialized before calling dump_fields")
+        self.fields.dump(fname)
+
+    def load_fields(self, fname):
+        if self.fields is None:
+            raise ValueError("Fields must be initialized before calling load_fields")
+        self.fields.load(fname)
+
     def dump_chunk_layout(self, fname):
         if self.structure is None:
             raise ValueError("Fields must be initialized before calling load_structure")
@@ -1300,6 +1336,7 @@ class Simulation(object):
         if self.fields is None:
             self.init_sim()
 
+        self._eps_image_cache = None
         return self.fields.phase_in_material(structure, time)
 
     def set_boundary(self, side, direction, condition):
@@ -1366,6 +1403,7 @@ class Simulation(object):
 
                 def stop_cond(sim):
                     return sim.round_time() >= t0 + stop_time
+                stop_cond._next_time = lambda sim: t0 + stop_time
 
                 cond[i] = stop_cond
 
@@ -1374,10 +1412,18 @@ class Simulation(object):
             else:
                 assert callable(cond[i]), "Stopping condition {} is not an integer or a function".format(cond[i])
 
+        # Between the times at which some condition or step function may act
+        # (see _next_step_time), the fields are stepped by one C++ call, which
+        # also evaluates the native step_actions of the conditions.
         while not any([x(self) for x in cond]):
             for func in step_funcs:
                 _eval_step_func(self, func, 'step')
-            self.fields.step()
+            actions = [a for a in (_step_action(x) for x in cond) if a is not None]
+            tnext = _next_step_time(self, cond + list(step_funcs))
+            nsteps = _MAX_RUN_STEPS
+            if tnext < mp.inf:
+                nsteps = min(nsteps, int(math.ceil((tnext - self.round_time()) / self.fields.dt - 1e-6)))
+            self.fields.run_steps(max(1, nsteps), actions, self.progress_interval)
 
         # Translating the recursive scheme version of run-until into an iterative version
         # (because python isn't tail-call-optimized) means we need one extra iteration to
@@ -1400,14 +1446,23 @@ class Simulation(object):
             cond = [cond]
 
         ts = self.fields.last_source_time()
+
+        def after_sources_cond(c):
+            def f(sim):
+                return c(sim) and sim.round_time() >= ts
+            if hasattr(c, '_next_time'):
+                f._next_time = lambda sim: max(ts, c._next_time(sim))
+            # c creates its step_action on its first call, so _step_action
+            # looks it up through _wrapped_cond rather than copying it here
+            f._wrapped_cond = c
+            return f
+
         new_conds = []
         for i in range(len(cond)):
             if isinstance(cond[i], numbers.Number):
                 new_conds.append((ts - self.round_time()) + cond[i])
             else:
-                def f(sim):
-                    return cond[i](sim) and sim.round_time() >= ts
-                new_conds.append(f)
+                new_conds.append(after_sources_cond(cond[i]))
 
         self._run_until(new_conds, step_funcs)
 
@@ -1458,6 +1513,7 @@ class Simulation(object):
         if self.fields is None:
             self.init_sim()
 
+        self._eps_image_cache = None
         self.structure.set_epsilon(eps, self.eps_averaging, self.subpixel_tol, self.subpixel_maxeval)
 
     def add_source(self, src):
@@ -1467,6 +1523,10 @@ class Simulation(object):
         where = Volume(src.center, src.size, dims=self.dimensions,
                        is_cylindrical=self.is_cylindrical).swigobj
 
+        if isinstance(src.src, CustomSource) and src.src.tabulate:
+            # sources are evaluated at multiples of half a time step
+            src.src._tabulate(self.fields.time(), 0.5 * self.fields.dt)
+
         if isinstance(src, EigenModeSource):
             if src.direction < 0:
                 direction = self.fields.normal_direction(where)
@@ -1823,11 +1883,21 @@ class Simulation(object):
 
         return self.fields.modal_volume_in_box(box)
 
-    def solve_cw(self, tol=1e-8, maxiters=10000, L=2):
+    def solve_cw(self, tol=1e-8, maxiters=10000, L=2, precond_steps=0, precond_shift=0.1):
         if self.fields is None:
             raise RuntimeError('Fields must be initialized before using solve_cw')
         self._evaluate_dft_objects()
-        return self.fields.solve_cw(tol, maxiters, L)
+        return self.fields.solve_cw(tol, maxiters, L, precond_steps, precond_shift)
+
+    def solve_cw_multi(self, frequencies, callback, tol=1e-8, maxiters=10000, L=2, precond_steps=0,
+                       precond_shift=0.1):
+        if self.fields is None:
+            raise RuntimeError('Fields must be initialized before using solve_cw_multi')
+        self._evaluate_dft_objects()
+        freqs = np.asarray(frequencies, dtype=np.complex128)
+        return self.fields.solve_cw_multi(tol, maxiters, freqs, L,
+                                          lambda i: callback(self, frequencies[i]),
+                                          precond_steps, precond_shift)
 
     def _add_fluxish_stuff(self, add_dft_stuff, fcen, df, nfreq, stufflist, *args):
         vol_list = None
@@ -1885,7 +1955,8 @@ class Simulation(object):
         cmd = re.sub(r'\$EPS', self.last_eps_filename, opts)
         return convert_h5(rm_h5, cmd, *step_funcs)
 
-    def get_array(self, component=None, vol=None, center=None, size=None, cmplx=None, arr=None, omega = 0):
+    def get_array(self, component=None, vol=None, center=None, size=None, cmplx=None, arr=None, omega = 0,
+                  master_only=False, stride=None, block_average=False):
         if component is None:
             raise ValueError("component is required")
         if isinstance(component, mp.Volume) or isinstance(component, mp.volume):
@@ -1900,7 +1971,15 @@ class Simulation(object):
 
         _, dirs = mp._get_array_slice_dimensions(self.fields, v, dim_sizes, False, True)
 
-        dims = [s for s in dim_sizes if s != 0]
+        # subsampled by fields.set_output_stride, or by the given stride
+        # (every stride-th point, or the average of each block if
+        # block_average) for this call only
+        saved_stride = None
+        if stride is not None:
+            saved_stride = (self.fields.output_stride, self.fields.output_block_average)
+        else:
+            stride = self.fields.output_stride
+        dims = [(s - 1) // stride + 1 for s in dim_sizes if s != 0]
 
         if cmplx is None:
             cmplx = component < mp.Dielectric and not self.fields.is_real
@@ -1919,10 +1998,16 @@ class Simulation(object):
         else:
             arr = np.zeros(dims, dtype=np.complex128 if cmplx else np.float64)
 
-        if np.iscomplexobj(arr):
-            self.fields.get_complex_array_slice(v, component, arr, omega)
-        else:
-            self.fields.get_array_slice(v, component, arr, omega)
+        if saved_stride is not None:
+            self.fields.set_output_stride(stride, block_average)
+        try:
+            if np.iscomplexobj(arr):
+                self.fields.get_complex_array_slice(v, component, arr, omega, master_only)
+            else:
+                self.fields.get_array_slice(v, component, arr, omega, master_only)
+        finally:
+            if saved_stride is not None:
+                self.fields.set_output_stride(*saved_stride)
 
         return arr
 
@@ -1943,6 +2028,26 @@ class Simulation(object):
         else:
             raise ValueError("Invalid type of dft object: {}".format(dft_swigobj))
 
+    # Read-only NumPy views (no copy, no interpolation, no communication) of
+    # the raw Yee-grid values of component in each chunk owned by this process;
+    # see _get_field_chunk_views in meep.i for the metadata.  The views are
+    # invalidated when the fields are reset or reallocated.
+    def get_field_chunk_views(self, component):
+        if self.fields is None:
+            self.init_sim()
+        return mp._get_field_chunk_views(self.fields, component)
+
+    # Read-only NumPy views of the per-chunk DFT arrays of a DFT object
+    # (flux, fields, force, near2far or energy), for the chunks on this process.
+    def get_dft_chunk_views(self, dft_obj):
+        dft_swigobj = dft_obj.swigobj if hasattr(dft_obj, 'swigobj') else dft_obj
+        views = []
+        for name in ('E', 'H', 'D', 'B', 'F', 'chunks', 'offdiag1', 'offdiag2', 'diag'):
+            chunks = getattr(dft_swigobj, name, None)
+            if chunks is not None:
+                views += mp._get_dft_chunk_views(chunks)
+        return views
+
     def get_source(self, component, vol=None, center=None, size=None):
         if vol is None and center is None and size is None:
             v = self.fields.total_volume()
@@ -2094,6 +2199,7 @@ class Simulation(object):
     def reset_meep(self):
         self.fields = None
         self.structure = None
+        self._eps_image_cache = None
         self.dft_objects = []
         self._is_initialized = False
 
@@ -2129,6 +2235,78 @@ class Simulation(object):
         if self.fields:
             self.fields.print_times()
 
+    def output_step_times(self, fname):
+        if self.fields is None:
+            raise ValueError("Fields must be initialized before calling output_step_times")
+        self.fields.output_step_times(fname)
+
+    _memory_categories = ['fields', 'pml', 'materials', 'polarizations', 'communication', 'sources', 'dft']
+
+    def memory_usage(self):
+        """Return a dict of the bytes allocated for each chunk (as a numpy array
+        indexed by chunk) in each memory category.
+        """
+        if self.fields is None:
+            self.init_sim()
+        ncat = len(self._memory_categories)
+        bytes = np.array(self.fields.memory_usage()).reshape(-1, ncat)
+        return {name: bytes[:, i] for i, name in enumerate(self._memory_categories)}
+
+    def estimate_memory_usage(self):
+        """Predict, before the fields are created, the bytes per process in each
+        memory category (as numpy arrays indexed by process), from the structure
+        and the DFT monitors added so far.
+        """
+        if self.structure is None:
+            self._init_structure(self.k_point)
+        vols = []
+        sizes = []
+        for o in self.dft_objects:
+            for r in o.regions:
+                vols.append(self._volume_from_kwargs(vol=r.where if hasattr(r, 'where') else None,
+                                                     center=r.center, size=r.size))
+                sizes.append(o.nfreqs * o.num_components)
+        is_real = not (self.force_complex_fields or self.k_point or
+                       (self.is_cylindrical and self.m != 0))
+        ncat = len(self._memory_categories)
+        bytes = np.array(self.structure.estimate_memory_usage(is_real, vols, sizes)).reshape(-1, ncat)
+        return {name: bytes[:, i] for i, name in enumerate(self._memory_categories)}
+
+    def start_trace(self, max_events=100000):
+        if self.fields is None:
+            self.init_sim()
+        self.fields.start_trace(max_events)
+
+    def stop_trace(self):
+        if self.fields:
+            self.fields.stop_trace()
+
+    def output_trace(self, fname):
+        if self.fields is None:
+            raise ValueError("Fields must be initialized before calling output_trace")
+        self.fields.output_trace(fname)
+
+    _halo_stats = ['bytes_sent', 'bytes_received', 'messages', 'wait_time']
+
+    def get_halo_stats(self):
+        """Return a dict of the boundary exchanges of this process with each
+        other process, as numpy arrays indexed by [field_type, peer process].
+        """
+        if self.fields is None:
+            raise ValueError("Fields must be initialized before calling get_halo_stats")
+        nstat = len(self._halo_stats)
+        stats = np.array(self.fields.get_halo_stats()).reshape(-1, mp.count_processors(), nstat)
+        return {name: stats[:, :, i] for i, name in enumerate(self._halo_stats)}
+
+    def reset_halo_stats(self):
+        if self.fields:
+            self.fields.reset_halo_stats()
+
+    def print_halo_stats(self):
+        if self.fields is None:
+            raise ValueError("Fields must be initialized before calling print_halo_stats")
+        self.fields.print_halo_stats()
+
     def get_epsilon(self,omega=0):
         return self.get_array(component=mp.Dielectric,omega=omega)
 
@@ -2338,6 +2516,33 @@ def _create_boundary_region_from_boundary_layers(boundary_layers, gv):
 
 # Private step functions
 
+# Step functions and stop conditions that act only at known times have a
+# _next_time(sim) attribute giving the earliest simulation time at which
+# they may act (mp.inf if never, before 'finish'), so that _run_until can
+# step up to that time without calling back into Python; those whose
+# checks are native C++ step_actions also have a _step_action attribute.
+_MAX_RUN_STEPS = 1 << 30
+
+
+def _step_action(cond):
+    # the native step_action of a condition, or of the condition it wraps
+    while cond is not None:
+        action = getattr(cond, '_step_action', None)
+        if action is not None:
+            return action
+        cond = getattr(cond, '_wrapped_cond', None)
+    return None
+
+
+def _next_step_time(sim, funcs):
+    t = mp.inf
+    for f in funcs:
+        if not hasattr(f, '_next_time'):
+            return sim.round_time() # must be evaluated at every step
+        t = min(t, f._next_time(sim))
+    return t
+
+
 def _combine_step_funcs(*step_funcs):
     def _combine(sim, todo):
         for func in step_funcs:
@@ -2365,6 +2570,11 @@ def _when_true_funcs(cond, *step_funcs):
     return _true
 
 
+def _wrapped_next_time(wrapper, step_funcs):
+    wrapper._next_time = lambda sim: _next_step_time(sim, step_funcs)
+    return wrapper
+
+
 # Public step functions
 
 def after_sources(*step_funcs):
@@ -2373,6 +2583,11 @@ def after_sources(*step_funcs):
         if sim.round_time() >= time:
             for func in step_funcs:
                 _eval_step_func(sim, func, todo)
+
+    def _next_time(sim):
+        time = sim.fields.last_source_time()
+        return time if sim.round_time() < time else _next_step_time(sim, step_funcs)
+    _after_sources._next_time = _next_time
     return _after_sources
 
 
@@ -2388,7 +2603,9 @@ def after_sources_and_time(t, *step_funcs):
 def after_time(t, *step_funcs):
     def _after_t(sim):
         return sim.round_time() >= t
-    return _when_true_funcs(_after_t, *step_funcs)
+    _after = _when_true_funcs(_after_t, *step_funcs)
+    _after._next_time = lambda sim: t if sim.round_time() < t else _next_step_time(sim, step_funcs)
+    return _after
 
 
 def at_beginning(*step_funcs):
@@ -2399,6 +2616,7 @@ def at_beginning(*step_funcs):
             for f in step_funcs:
                 _eval_step_func(sim, f, todo)
             closure['done'] = True
+    _beg._next_time = lambda sim: mp.inf if closure['done'] else sim.round_time()
     return _beg
 
 
@@ -2409,6 +2627,7 @@ def at_end(*step_funcs):
                 _eval_step_func(sim, func, 'step')
             for func in step_funcs:
                 _eval_step_func(sim, func, 'finish')
+    _end._next_time = lambda sim: mp.inf
     return _end
 
 
@@ -2421,6 +2640,7 @@ def at_every(dt, *step_funcs):
             for func in step_funcs:
                 _eval_step_func(sim, func, todo)
             closure['tlast'] = t
+    _every._next_time = lambda sim: closure['tlast'] + dt + (-0.5 * sim.fields.dt)
     return _every
 
 
@@ -2432,13 +2652,16 @@ def at_time(t, *step_funcs):
             for f in step_funcs:
                 _eval_step_func(sim, f, todo)
         closure['done'] = closure['done'] or todo == 'step'
+    _at_time._next_time = lambda sim: mp.inf if closure['done'] else sim.round_time()
     return after_time(t, _at_time)
 
 
 def before_time(t, *step_funcs):
     def _before_t(sim):
         return sim.round_time() < t
-    return _when_true_funcs(_before_t, *step_funcs)
+    _before = _when_true_funcs(_before_t, *step_funcs)
+    _before._next_time = lambda sim: _next_step_time(sim, step_funcs) if sim.round_time() < t else mp.inf
+    return _before
 
 
 def during_sources(*step_funcs):
@@ -2453,6 +2676,12 @@ def during_sources(*step_funcs):
             for func in step_funcs:
                 _eval_step_func(sim, func, 'finish')
             closure['finished'] = True
+
+    def _next_time(sim):
+        if sim.round_time() < sim.fields.last_source_time():
+            return _next_step_time(sim, step_funcs)
+        return mp.inf if closure['finished'] else sim.round_time()
+    _during_sources._next_time = _next_time
     return _during_sources
 
 
@@ -2474,7 +2703,7 @@ def in_volume(v, *step_funcs):
         sim.output_volume = v_save
         if eps_save:
             sim.last_eps_filename = eps_save
-    return _in_volume
+    return _wrapped_next_time(_in_volume, step_funcs)
 
 
 def in_point(pt, *step_funcs):
@@ -2498,32 +2727,38 @@ def to_appended(fname, *step_funcs):
             closure['h5'] = None
             sim.output_h5_hook(sim.fields.h5file_name(fname, sim.get_filename_prefix()))
         sim.output_append_h5 = h5save
-    return _to_appended
+    return _wrapped_next_time(_to_appended, step_funcs)
 
 
 def stop_when_fields_decayed(dt, c, pt, decay_by):
+    # the check is a native fields_decay_check, evaluated after every step
+    # by fields.run_steps
+    def _stop(sim):
+        if getattr(_stop, '_step_action', None) is None:
+            v3 = py_v3_to_vec(sim.dimensions, pt, sim.is_cylindrical)
+            _stop._step_action = mp.fields_decay_check(c, v3, dt, decay_by)
+        return _stop._step_action.check(sim.fields)
+    _stop._next_time = lambda sim: mp.inf
+    return _stop
 
-    closure = {
-        'max_abs': 0,
-        'cur_max': 0,
-        't0': 0,
-    }
 
+def stop_when_dft_converged(dt, tol=1e-3, monitors=None):
+    # a native dft_convergence_check of the given DFT objects (by default,
+    # all of those added to the simulation), evaluated every dt
     def _stop(sim):
-        fabs = abs(sim.get_field_point(c, pt)) * abs(sim.get_field_point(c, pt))
-        closure['cur_max'] = max(closure['cur_max'], fabs)
-
-        if sim.round_time() <= dt + closure['t0']:
-            return False
-        else:
-            old_cur = closure['cur_max']
-            closure['cur_max'] = 0
-            closure['t0'] = sim.round_time()
-            closure['max_abs'] = max(closure['max_abs'], old_cur)
-            if closure['max_abs'] != 0 and mp.cvar.verbosity > 0:
-                fmt = "field decay(t = {}): {} / {} = {}"
-                print(fmt.format(sim.meep_time(), old_cur, closure['max_abs'], old_cur / closure['max_abs']))
-            return old_cur <= closure['max_abs'] * decay_by
+        if getattr(_stop, '_step_action', None) is None:
+            check = mp.dft_convergence_check(dt, tol)
+            for o in (sim.dft_objects if monitors is None else monitors):
+                swigobj = o.swigobj if hasattr(o, 'swigobj') else o
+                if isinstance(swigobj, mp.dft_flux):
+                    check.add_flux(swigobj)
+                else:
+                    for name in ('F', 'chunks', 'E', 'H', 'D', 'B', 'offdiag1', 'offdiag2', 'diag'):
+                        if hasattr(swigobj, name):
+                            check.add_chunks(getattr(swigobj, name))
+            _stop._step_action = check
+        return _stop._step_action.check(sim.fields)
+    _stop._next_time = lambda sim: mp.inf
     return _stop
 
 
@@ -2554,11 +2789,15 @@ def stop_on_interrupt():
 
 def synchronized_magnetic(*step_funcs):
     def _sync(sim, todo):
-        sim.fields.synchronize_magnetic_fields()
+        # within in_volume, only synchronize the output volume
+        if sim.output_volume is not None:
+            sim.fields.synchronize_magnetic_fields(sim.output_volume)
+        else:
+            sim.fields.synchronize_magnetic_fields()
         for f in step_funcs:
             _eval_step_func(sim, f, todo)
         sim.fields.restore_magnetic_fields()
-    return _sync
+    return _wrapped_next_time(_sync, step_funcs)
 
 
 def when_true(cond, *step_funcs):
@@ -2577,7 +2816,7 @@ def with_prefix(pre, *step_funcs):
         for f in step_funcs:
             _eval_step_func(sim, f, todo)
         sim.filename_prefix = saved_pre
-    return _with_prefix
+    return _wrapped_next_time(_with_prefix, step_funcs)
 
 
 def display_csv(sim, name, data):
@@ -2599,6 +2838,8 @@ def display_progress(t0, t, dt):
             val4 = (val3 * (t / val1) - val3) if val1 != 0 else 0
             print(msg_fmt.format(val1, t, val2, val3, val4))
             closure['tlast'] = t1
+    # called at least every dt seconds: fields.run_steps returns by then
+    _disp._next_time = lambda sim: mp.inf
     return _disp
 
 
@@ -2658,6 +2899,36 @@ def output_png(compnt, options, rm_h5=True):
     return _output_png
 
 
+def read_expanded_hdf5(fname, dataname):
+    """
+    Read the dataset `dataname` of the HDF5 file `fname` as a NumPy array. A
+    dataset written with `fields.set_output_irreducible()`, which only holds
+    the irreducible part of the cell, is expanded to the full array by its
+    symmetry images.
+    """
+    import h5py
+    with h5py.File(fname, 'r') as f:
+        dset = f[dataname]
+        data = dset[()]
+        if 'meep_irreducible_dims' not in dset.attrs:
+            return data
+        fdims = tuple(int(n) for n in dset.attrs['meep_irreducible_dims'])
+        maps = dset.attrs['meep_irreducible_maps']
+
+    # each image maps the index j of the data to o + M j, with a real phase
+    rank = len(fdims)
+    tshape = data.shape[rank:]  # a trailing time dimension, if any
+    full = np.zeros(fdims + tshape, dtype=data.dtype)
+    idx = np.indices(data.shape[:rank]).reshape(rank, -1)
+    vals = data.reshape((-1,) + tshape)
+    maplen = rank + rank * rank + 1
+    for m in range(0, len(maps), maplen):
+        o = np.array(maps[m:m + rank], dtype=int)
+        M = np.array(maps[m + rank:m + rank + rank * rank], dtype=int).reshape(rank, rank)
+        full[tuple(o[:, None] + M.dot(idx))] = maps[m + maplen - 1] * vals
+    return full
+
+
 def output_epsilon(sim,*step_func_args,**kwargs):
     omega = kwargs.pop('omega', 0.0)
     sim.output_component(mp.Dielectric,omega=omega)
@@ -2942,6 +3213,19 @@ def get_center_and_size(v):
 def GDSII_layers(fname):
     return list(mp.get_GDSII_layers(fname))
 
+def GDSII_prisms(material, fname, layer=-1, zmin=0.0, zmax=0.0, vol=None):
+    if vol is None:
+        return mp.get_GDSII_prisms(material, fname, layer, zmin, zmax)
+    return mp.get_GDSII_prisms(material, fname, layer, zmin, zmax, vol.swigobj)
+
+def GDSII_rasterize(fname, layer, vol, resolution, value=1.0, grid=None):
+    if grid is None:
+        nx = max(1, int(round(vol.size.x * resolution)))
+        ny = max(1, int(round(vol.size.y * resolution)))
+        grid = np.zeros((nx, ny))
+    mp.rasterize_GDSII_layer(fname, layer, vol.swigobj, value, grid)
+    return grid
+
 def GDSII_vol(fname, layer, zmin, zmax):
     meep_vol = mp.get_GDSII_volume(fname, layer, zmin, zmax)
     dims = meep_vol.dim + 1
@@ -2968,3 +3252,55 @@ def quiet(quietval=True):
 
 def verbosity(verbose_val):
     mp.cvar.verbosity = verbose_val
+
+
+# Call func(p) for every p in params, farming the calls out to groups of
+# processes created with divide_parallel_processes, and return the list of
+# results (in the order of params) on the master process (None elsewhere).
+#
+# procs(p), if given, is the number of processes that the job for p should
+# run on (default: the processes divided evenly among the jobs); the jobs
+# are run in phases of equal group size, largest first, so that small jobs
+# get few processes.  Within a phase, groups take the next job from a queue
+# shared by all processes as soon as they finish one (with MPI-3; otherwise
+# the jobs are dealt out to the groups round-robin), in order of decreasing
+# cost(p) if cost is given.  func must create its own Simulation (which only
+# lives within the group), and its results must be picklable; only the
+# results of each group's master are kept.
+def parameter_sweep(func, params, procs=None, cost=None):
+    import pickle
+
+    params = list(params)
+    nprocs = mp.count_processors()
+    default_size = max(1, nprocs // max(1, len(params)))
+    sizes = [max(1, min(nprocs, int(procs(p)))) if procs else default_size for p in params]
+
+    # jobs grouped by the number of groups they divide the processes into
+    phases = {}
+    for j, size in enumerate(sizes):
+        phases.setdefault(nprocs // size, []).append(j)
+
+    results = {}
+    for ngroups in sorted(phases):
+        jobs = phases[ngroups]
+        if cost:
+            jobs = sorted(jobs, key=lambda j: -cost(params[j]))
+        dynamic = mp.shared_counter.supported()
+        counter = mp.shared_counter() if dynamic else None
+        group = mp.divide_parallel_processes(ngroups)
+        n = counter.group_next() if dynamic else group
+        while n < len(jobs):
+            j = jobs[n]
+            result = func(params[j])
+            if mp.am_master():
+                results[j] = result
+            n = counter.group_next() if dynamic else n + ngroups
+        mp.end_divide_parallel()
+        del counter
+
+    gathered = mp._gather_bytes_to_master(pickle.dumps(results, pickle.HIGHEST_PROTOCOL))
+    if gathered is None:
+        return None
+    for data in gathered:
+        results.update(pickle.loads(data))
+    return [results.get(j) for j in range(len(params))]
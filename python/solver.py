@@ -897,13 +897,24 @@ class ModeSolver(object):
 
         print("elapsed time for initialization: {}".format(time.time() - init_time))
 
-        # TODO: Split over multiple processes
-        # k_split = list_split(self.k_points, self.k_split_num, self.k_split_index)
-        k_split = (0, self.k_points)
+        # With k_split_num > 1, the processes are divided into that many groups,
+        # each solving a contiguous block of the k-points (each k-point starting
+        # from the eigenvectors of the previous one), and the results are
+        # gathered afterwards.
+        k_split_num = min(self.k_split_num, mp.count_processors())
+        if k_split_num > 1:
+            self.k_split_index = mp.divide_parallel_processes(k_split_num)
+        else:
+            self.k_split_index = 0
+        if k_split_num > 1:
+            k_split = self.list_split(self.k_points, k_split_num, self.k_split_index)
+        else:
+            k_split = (0, self.k_points)
         self.mode_solver.set_kpoint_index(k_split[0])
+        num_iters_before = len(self.eigensolver_iters)
 
         if self.num_bands > 0:
-            for i, k in enumerate(k_split[1]):
+            for i, k in enumerate(k_split[1], k_split[0]):
                 self.current_k = k
                 solve_kpoint_time = time.time()
                 self.mode_solver.solve_kpoint(k)
@@ -928,12 +939,18 @@ class ModeSolver(object):
                         raise ValueError("Band function should take 1 or 2 arguments. "
                                          "The first must be a ModeSolver instance")
 
-            if len(k_split[1]) > 1:
+            if k_split_num > 1:
+                self.gather_kpoint_groups(k_split_num, k_split[0], num_iters_before)
+
+            if len(self.k_points) > 1:
                 self.output_band_range_data(self.band_range_data)
                 self.gap_list = self.output_gaps(self.band_range_data)
             else:
                 self.gap_list = []
 
+        if k_split_num > 1:
+            mp.end_divide_parallel()
+
         end = time.time() - start
         print("total elapsed time for run: {}".format(end))
         self.total_run_time += end
@@ -941,6 +958,33 @@ class ModeSolver(object):
         self.parity = self.mode_solver.get_parity_string()
         print("done")
 
+    # Combine the results of a k-point-parallel run: every group has filled in
+    # the rows of all_freqs (and the eigensolver iterations) for its own block
+    # of k-points; afterwards all processes have every row, the band ranges over
+    # all k-points, and the fields of the last k-point.
+    def gather_kpoint_groups(self, k_split_num, first, num_iters_before):
+        nk = len(self.k_points)
+        freqs = np.ascontiguousarray(self.all_freqs).reshape(-1)
+        self.mode_solver.sum_over_kpoint_groups(freqs)
+        self.all_freqs = freqs.reshape(nk, self.num_bands)
+
+        iters = np.zeros(nk)
+        local_iters = self.eigensolver_iters[num_iters_before:]
+        iters[first:first + len(local_iters)] = local_iters
+        self.mode_solver.sum_over_kpoint_groups(iters)
+        self.eigensolver_iters = self.eigensolver_iters[:num_iters_before] + list(iters)
+
+        self.band_range_data = []
+        for freqs, k in zip(self.all_freqs, self.k_points):
+            self.band_range_data = self.update_band_range_data(self.band_range_data,
+                                                               list(freqs), k)
+
+        block_size = (nk + k_split_num - 1) // k_split_num
+        self.mode_solver.share_kpoint_group_fields((nk - 1) // block_size, k_split_num)
+        self.current_k = self.k_points[-1]
+        self.freqs = self.get_freqs()
+        self.iterations = self.mode_solver.get_iterations()
+
     def run(self, *band_functions):
         self.run_parity(mp.NO_PARITY, True, *band_functions)
 
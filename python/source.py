@@ -1,5 +1,9 @@
 from __future__ import division
 
+import math
+
+import numpy as np
+
 import meep as mp
 from meep.geom import Vector3, check_nonnegative
 
@@ -71,15 +75,34 @@ class GaussianSource(SourceTime):
 
 class CustomSource(SourceTime):
 
-    def __init__(self, src_func, start_time=-1.0e20, end_time=1.0e20, center_frequency=0, **kwargs):
+    def __init__(self, src_func, start_time=-1.0e20, end_time=1.0e20, center_frequency=0, tabulate=False,
+                 **kwargs):
         super(CustomSource, self).__init__(**kwargs)
         self.src_func = src_func
         self.start_time = start_time
         self.end_time = end_time
         self.center_frequency = center_frequency
+        self.tabulate = tabulate
         self.swigobj = mp.custom_src_time(src_func, start_time, end_time, center_frequency)
         self.swigobj.is_integrated = self.is_integrated
 
+    def _tabulate(self, t0, dt):
+        # Evaluate src_func on the grid t0 + k*dt up to end_time in one call
+        # (falling back to one call per time if src_func is not vectorized),
+        # so that time stepping does not call back into Python.
+        if self.end_time >= 1.0e20:
+            raise ValueError("CustomSource with tabulate=True requires a finite end_time")
+        t0 = dt * math.ceil(max(t0, self.start_time) / dt)
+        n = max(0, int(math.ceil((self.end_time - t0) / dt)) + 3)
+        ts = t0 + dt * np.arange(n)
+        try:
+            vals = np.asarray(self.src_func(ts), dtype=np.complex128)
+            if vals.shape != ts.shape:
+                raise ValueError
+        except (TypeError, ValueError):
+            vals = np.array([self.src_func(t) for t in ts], dtype=np.complex128)
+        self.swigobj.set_table(t0, dt, vals)
+
 
 class EigenModeSource(Source):
 
@@ -151,6 +151,24 @@ class TestBendFlux(unittest.TestCase):
         if mp.with_libGDSII():
             self.run_bend_flux(True)
 
+    def test_gdsii_rasterize(self):
+        if not mp.with_libGDSII():
+            return
+        data_dir = os.path.join(os.path.dirname(os.path.realpath(__file__)), 'data')
+        gdsii_file = os.path.join(data_dir, 'bend-flux.gds')
+        cell = mp.Volume(center=mp.Vector3(), size=mp.Vector3(16, 32))
+        eps = mp.Medium(epsilon=12)
+
+        # within the cell, the bend (of width 1) has arms of length 12 and 27
+        grid = mp.GDSII_rasterize(gdsii_file, 2, cell, 10)
+        self.assertEqual(grid.shape, (160, 320))
+        self.assertAlmostEqual(np.sum(grid) / 100, 39, delta=0.5)
+
+        self.assertEqual(len(mp.GDSII_prisms(eps, gdsii_file, 2, vol=cell)),
+                         len(mp.get_GDSII_prisms(eps, gdsii_file, 2)))
+        far = mp.Volume(center=mp.Vector3(100, 100), size=mp.Vector3(1, 1))
+        self.assertEqual(len(mp.GDSII_prisms(eps, gdsii_file, 2, vol=far)), 0)
+
 
 if __name__ == '__main__':
     unittest.main()
@@ -53,6 +53,29 @@ class TestChunks(unittest.TestCase):
 
         self.assertAlmostEqual(86.90826609300862, mp.get_fluxes(tot_flux)[0])
 
+    def test_bisection_chunk_counts(self):
+        # splitting by cost must give exactly the requested number of chunks,
+        # even for prime counts, and they must tile the cell
+        cell = mp.Vector3(10, 6, 0)
+        susc = mp.Medium(epsilon=2, E_susceptibilities=[mp.LorentzianSusceptibility(frequency=1, gamma=0.1, sigma=1)])
+        geometry = [mp.Block(center=mp.Vector3(-2.5, 1), size=mp.Vector3(5, 4, mp.inf), material=susc)]
+
+        for num_chunks in [7, 11, 13]:
+            sim = mp.Simulation(cell_size=cell, geometry=geometry, resolution=10, num_chunks=num_chunks,
+                                split_chunks_evenly=False)
+            sim.init_sim()
+            vols = sim.structure.get_chunk_volumes()
+            self.assertEqual(len(vols), num_chunks)
+
+            area = 0
+            for i, v in enumerate(vols):
+                area += (v.high.x - v.low.x) * (v.high.y - v.low.y)
+                for w in vols[:i]:
+                    overlap_x = min(v.high.x, w.high.x) - max(v.low.x, w.low.x)
+                    overlap_y = min(v.high.y, w.high.y) - max(v.low.y, w.low.y)
+                    self.assertFalse(overlap_x > 1e-9 and overlap_y > 1e-9)
+            self.assertAlmostEqual(area, cell.x * cell.y)
+
 
 if __name__ == '__main__':
     unittest.main()
@@ -1,5 +1,6 @@
 from __future__ import division
 
+import os
 import unittest
 import meep as mp
 
@@ -307,6 +308,54 @@ class TestFragmentStats(unittest.TestCase):
         self.assertEqual(fs.box.high.z, 0.5)
         self.assertEqual(fs.num_pixels_in_box, 1000)
 
+    def test_cost_split_with_fragment_grid(self):
+        # splitting by cost uses the fragment grid, and the chunk holding the
+        # dispersive half of the cell must be the narrower one
+        susc = mp.Medium(epsilon=2, E_susceptibilities=[mp.LorentzianSusceptibility(frequency=1, gamma=0.1, sigma=1)])
+        geometry = [mp.Block(center=mp.Vector3(-5), size=mp.Vector3(10, mp.inf, mp.inf), material=susc)]
+        sim = mp.Simulation(cell_size=mp.Vector3(20, 1), geometry=geometry, resolution=10, num_chunks=2,
+                            split_chunks_evenly=False)
+        sim.init_sim()
+        vols = sorted(sim.structure.get_chunk_volumes(), key=lambda v: v.low.x)
+        self.assertEqual(len(vols), 2)
+        self.assertLess(vols[0].high.x - vols[0].low.x, vols[1].high.x - vols[1].low.x)
+
+    def test_cost_weights(self):
+        fs = self.get_fragment_stats(mp.Vector3(z=10), mp.Vector3(z=30), 1)
+        stats = mp.fragment_stats
+        defaults_fname = 'fragment_stats-default-weights.txt'
+        weights_fname = 'fragment_stats-weights.txt'
+        self.assertTrue(stats.save_cost_weights(defaults_fname))
+        default_cost = fs.cost()
+
+        try:
+            weights = [0] * stats.NUM_COST_WEIGHTS
+            weights[stats.SUSCEPTIBILITY_COST] = 2
+            weights[stats.PIXEL_COST] = 1
+            if mp.am_master():
+                with open(weights_fname, 'w') as f:
+                    f.write('\n'.join(str(w) for w in weights))
+            mp.all_wait()
+            self.assertTrue(stats.load_cost_weights(weights_fname))
+            self.assertEqual(fs.cost(), fs.num_pixels_in_box + 2 * fs.num_susceptibility_pixels)
+
+            # a truncated profile is rejected and leaves the weights alone
+            if mp.am_master():
+                with open(weights_fname, 'w') as f:
+                    f.write('1 2 3')
+            mp.all_wait()
+            self.assertFalse(stats.load_cost_weights(weights_fname))
+            self.assertEqual(fs.cost(), fs.num_pixels_in_box + 2 * fs.num_susceptibility_pixels)
+        finally:
+            self.assertTrue(stats.load_cost_weights(defaults_fname))
+            mp.all_wait()
+            if mp.am_master():
+                os.remove(defaults_fname)
+                if os.path.exists(weights_fname):
+                    os.remove(weights_fname)
+
+        self.assertEqual(fs.cost(), default_cost)
+
 
 class TestPMLToVolList(unittest.TestCase):
 
@@ -48,6 +48,22 @@ class TestLDOS(unittest.TestCase):
         self.assertEqual(ldos.nfreq, 1)
         self.assertEqual(ldos.dfreq, 0)
 
+    def test_ldos_changed_sources(self):
+        # the source points cached by the Ldos must be gathered again when the
+        # sources are replaced, even by sources at the same points; the LDOS
+        # does not depend on the amplitude
+        ldos = mp.Ldos(self.fcen, 0, 1)
+        self.sim.run(mp.dft_ldos(ldos=ldos), until=0.05)
+        self.sim.change_sources([mp.Source(src=mp.GaussianSource(self.fcen, fwidth=1.0),
+                                           center=mp.Vector3(), component=mp.Ez, amplitude=2)])
+        self.sim.restart_fields()
+        self.sim.run(
+            mp.dft_ldos(ldos=ldos),
+            until_after_sources=mp.stop_when_fields_decayed(50, mp.Ez, mp.Vector3(), 1e-6)
+        )
+
+        self.assertAlmostEqual(self.sim.ldos_data[0], 1.011459560620368, places=5)
+
     def test_invalid_dft_ldos(self):
         with self.assertRaises(ValueError):
             self.sim.run(mp.dft_ldos(mp.Ldos(self.fcen, 0, 1)), until=200)
@@ -1,5 +1,6 @@
 from __future__ import division
 
+import os
 import unittest
 import numpy as np
 import meep as mp
@@ -126,6 +127,76 @@ class TestModeCoeffs(unittest.TestCase):
 
         self.run_mode_coeffs(1, kpoint_func)
 
+    def waveguide_sim(self, nfs, symmetries=[], num_chunks=0):
+        # the waveguide of run_mode_coeffs, excited in its first mode, with a
+        # mode monitor of nf frequencies for each nf in nfs
+        sx, sy, fcen, df = 16, 13, 0.2, 0.1
+        geometry = [mp.Block(mp.Vector3(mp.inf, 1, mp.inf), material=mp.Medium(epsilon=12))]
+        source = mp.EigenModeSource(src=mp.GaussianSource(fcen, fwidth=df), eig_band=1,
+                                    size=mp.Vector3(0, sy - 6), center=mp.Vector3(-0.5 * sx + 3),
+                                    eig_match_freq=True)
+        sim = mp.Simulation(resolution=10, cell_size=mp.Vector3(sx, sy), geometry=geometry,
+                            boundary_layers=[mp.PML(3)], sources=[source], symmetries=symmetries,
+                            num_chunks=num_chunks)
+        region = mp.ModeRegion(center=mp.Vector3(0.5 * sx - 3), size=mp.Vector3(0, sy - 6))
+        mfluxes = [sim.add_mode_monitor(fcen, df, nf, region) for nf in nfs]
+        sim.run(until_after_sources=100)
+        return sim, mfluxes
+
+    def test_eigenmode_cache(self):
+        sim, mfluxes = self.waveguide_sim([1])
+        res = sim.get_eigenmode_coefficients(mfluxes[0], [1, 2])
+
+        # a repeated request reuses the cached modes
+        res_cached = sim.get_eigenmode_coefficients(mfluxes[0], [1, 2])
+        np.testing.assert_array_equal(res_cached.alpha, res.alpha)
+
+        fname = 'mode_coeffs-eigenmode-cache.h5'
+        try:
+            sim.fields.save_eigenmode_cache(fname)
+
+            # without the cache, the modes are solved again (up to their phase)
+            sim.fields.clear_eigenmode_cache()
+            sim.fields.eigenmode_cache_max = 0
+            res_solved = sim.get_eigenmode_coefficients(mfluxes[0], [1, 2])
+            np.testing.assert_allclose(np.abs(res_solved.alpha), np.abs(res.alpha), rtol=1e-4,
+                                       atol=1e-6 * np.abs(res.alpha).max())
+
+            # the saved cache gives the same modes again
+            sim.fields.eigenmode_cache_max = 100
+            sim.fields.load_eigenmode_cache(fname)
+            res_loaded = sim.get_eigenmode_coefficients(mfluxes[0], [1, 2])
+            np.testing.assert_array_equal(res_loaded.alpha, res.alpha)
+        finally:
+            if mp.am_master() and os.path.exists(fname):
+                os.remove(fname)
+
+    def test_warm_started_frequencies(self):
+        # the middle of three warm-started frequencies against a cold solve there
+        sim, mfluxes = self.waveguide_sim([3, 1])
+        res = sim.get_eigenmode_coefficients(mfluxes[0], [1, 2])
+        sim.fields.clear_eigenmode_cache()
+        sim.fields.eigenmode_cache_max = 0
+        res_cold = sim.get_eigenmode_coefficients(mfluxes[1], [1, 2])
+        np.testing.assert_allclose(np.abs(res.alpha[:, 1, :]), np.abs(res_cold.alpha[:, 0, :]),
+                                   rtol=1e-4, atol=1e-6 * np.abs(res.alpha).max())
+
+        # solving the frequencies in turn on each process gives the same coefficients
+        sim.fields.eigenmode_split_freqs = False
+        res_unsplit = sim.get_eigenmode_coefficients(mfluxes[0], [1, 2])
+        np.testing.assert_allclose(np.abs(res_unsplit.alpha), np.abs(res.alpha), rtol=1e-4,
+                                   atol=1e-6 * np.abs(res.alpha).max())
+
+    def test_mode_overlaps_layout(self):
+        # the one-pass mode overlaps do not depend on the symmetry or the chunks
+        sim, mfluxes = self.waveguide_sim([2], symmetries=[mp.Mirror(mp.Y)])
+        res = sim.get_eigenmode_coefficients(mfluxes[0], [1, 2])
+        sim_split, mfluxes_split = self.waveguide_sim([2], num_chunks=4)
+        res_split = sim_split.get_eigenmode_coefficients(mfluxes_split[0], [1, 2])
+        np.testing.assert_allclose(np.abs(res_split.alpha), np.abs(res.alpha), rtol=1e-4,
+                                   atol=1e-6 * np.abs(res.alpha).max())
+        self.assertGreater(np.abs(res.alpha[0, :, 0]).min(), 1e3 * np.abs(res.alpha[1]).max())
+
     def test_eigensource_normalization(self):
         f, p_exp, p_obs=self.run_mode_coeffs(1, None, nf=51, resolution=15)
         #self.assertAlmostEqual(max(p_exp),max(p_obs),places=1)
@@ -370,6 +370,27 @@ class TestModeSolver(unittest.TestCase):
 
         self.check_band_range_data(expected_brd, ms.band_range_data)
 
+    def test_run_te_k_split(self):
+        # With more than one process, k_split_num = 2 solves the two halves of
+        # the k-points in separate process groups; the gathered results must be
+        # those of a serial run, with the last k-point's solution everywhere.
+        ms = self.init_solver()
+        ms.run_te()
+
+        ms_split = self.init_solver()
+        ms_split.k_split_num = 2
+        ms_split.run_te()
+
+        self.assertEqual(len(ms_split.all_freqs), len(ms.k_points))
+        compare_arrays(self, np.array(ms.all_freqs), np.array(ms_split.all_freqs), tol=1e-6)
+        self.check_band_range_data(ms.band_range_data, ms_split.band_range_data)
+        self.check_gap_list(ms.gap_list, ms_split.gap_list)
+        self.assertEqual(len(ms_split.eigensolver_iters), len(ms.k_points))
+        self.assertTrue(all(n > 0 for n in ms_split.eigensolver_iters))
+        self.assertTrue(ms_split.current_k.close(ms.k_points[-1]))
+        compare_arrays(self, np.array(ms.freqs), np.array(ms_split.freqs), tol=1e-6)
+        self.assertAlmostEqual(ms_split.get_epsilon_point(mp.Vector3(0.5, 0.5)), 1.0)
+
     def _test_get_field(self, field):
         ms = self.init_solver()
         ms.run_te()
@@ -119,6 +119,26 @@ class TestSimulation(unittest.TestCase):
     def test_mpi(self):
         self.assertGreater(mp.comm.Get_size(), 1)
 
+    def test_parameter_sweep(self):
+        def run(freq):
+            sources = [mp.Source(mp.GaussianSource(freq, fwidth=0.2), component=mp.Ez,
+                                 center=mp.Vector3())]
+            sim = mp.Simulation(cell_size=mp.Vector3(4, 4), resolution=10, sources=sources,
+                                boundary_layers=[mp.PML(1.0)])
+            sim.run(until=10)
+            return sim.get_field_point(mp.Ez, mp.Vector3(0.5, 0.3))
+
+        freqs = [0.3, 0.4, 0.5]
+        results = mp.parameter_sweep(run, freqs, cost=lambda f: f)
+        expected = [run(f) for f in freqs]
+        squares = mp.parameter_sweep(lambda n: n * n, range(7), procs=lambda n: 1 + n % 2)
+        if mp.am_master():
+            np.testing.assert_allclose(results, expected, rtol=1e-10)
+            self.assertEqual(squares, [n * n for n in range(7)])
+        else:
+            self.assertIsNone(results)
+            self.assertIsNone(squares)
+
     def test_use_output_directory_default(self):
         sim = self.init_simple_simulation()
         sim.use_output_directory()
@@ -166,6 +186,29 @@ class TestSimulation(unittest.TestCase):
 
         self.assertTrue(done[0])
 
+    def test_decay_after_sources(self):
+        # the native check must stop at the same step as the check evaluated
+        # by Python at every step (a plain function, without _next_time)
+        def run(cond):
+            sim = self.init_simple_simulation()
+            sim.run(until_after_sources=cond)
+            return sim.meep_time()
+
+        decay = mp.stop_when_fields_decayed(5, mp.Ez, mp.Vector3(1.5, 0.5), 1e-3)
+        t_python = run(lambda sim: decay(sim))
+        t_native = run(mp.stop_when_fields_decayed(5, mp.Ez, mp.Vector3(1.5, 0.5), 1e-3))
+        self.assertEqual(t_native, t_python)
+
+    def test_dft_converged_after_sources(self):
+        def run(wrap):
+            sim = self.init_simple_simulation()
+            sim.add_flux(1.0, 0.5, 5, mp.FluxRegion(center=mp.Vector3(2), size=mp.Vector3(0, 2)))
+            cond = mp.stop_when_dft_converged(5, 1e-3)
+            sim.run(until_after_sources=(lambda sim: cond(sim)) if wrap else cond)
+            return sim.meep_time()
+
+        self.assertEqual(run(False), run(True))
+
     def test_with_prefix(self):
         sim = self.init_simple_simulation()
         sim.run(mp.with_prefix('test_prefix-', mp.at_end(mp.output_efield_z)), until=200)
@@ -248,6 +291,23 @@ class TestSimulation(unittest.TestCase):
         fp = sim.get_field_point(mp.Ez, mp.Vector3(x=1))
         self.assertAlmostEqual(fp, -0.002989654055823199 + 0j)
 
+    def test_epsilon_input_file_chunks(self):
+        # with several chunks, each process reads only the block of the file
+        # that its chunks need; epsilon must match that from the whole grid
+        eps_input_fname = 'cyl-ellipsoid-eps-ref.h5'
+        eps_input_dir = os.path.join(os.path.abspath(os.path.realpath(os.path.dirname(__file__))),
+                                     '..', '..', 'tests')
+        eps_input_path = os.path.join(eps_input_dir, eps_input_fname)
+
+        sim = self.init_simple_simulation(num_chunks=4, epsilon_input_file=eps_input_path)
+        sim.init_sim()
+        eps_file = sim.get_epsilon()
+
+        with h5py.File(eps_input_path, 'r') as f:
+            sim = self.init_simple_simulation(num_chunks=4, default_material=f['eps'][()])
+        sim.init_sim()
+        np.testing.assert_allclose(eps_file, sim.get_epsilon(), rtol=1e-6)
+
     def test_set_materials(self):
 
         def change_geom(sim):
@@ -383,6 +443,63 @@ class TestSimulation(unittest.TestCase):
     def test_load_dump_chunk_layout_sim(self):
         self._load_dump_structure(chunk_sim=True)
 
+    def test_structure_cache(self):
+        cache_dir = 'simulation-structure-cache'
+        if mp.am_master() and not os.path.exists(cache_dir):
+            os.makedirs(cache_dir)
+        mp.all_wait()
+        mp.set_structure_cache_dir(cache_dir)
+
+        try:
+            eps = []
+            for i in range(2):
+                geometry = [mp.Cylinder(radius=1.3, material=mp.Medium(index=3.5)),
+                            mp.Block(size=mp.Vector3(1, 4, mp.inf), center=mp.Vector3(1.5),
+                                     material=mp.Medium(epsilon=4, D_conductivity=0.1))]
+                sim = mp.Simulation(cell_size=mp.Vector3(6, 6),
+                                    geometry=geometry,
+                                    boundary_layers=[mp.PML(1.0)],
+                                    resolution=10)
+                sim.init_sim()
+                eps.append(sim.get_array(mp.Dielectric, mp.Volume(mp.Vector3(), mp.Vector3(6, 6))))
+                # the first structure is computed and saved, the second one is loaded
+                cached = [f for f in os.listdir(cache_dir) if f.endswith('.h5')]
+                self.assertEqual(len(cached), 1)
+            np.testing.assert_array_equal(eps[0], eps[1])
+        finally:
+            mp.set_structure_cache_dir(None)
+            mp.all_wait()
+            if mp.am_master():
+                shutil.rmtree(cache_dir)
+
+    def test_update_materials(self):
+        def block(eps):
+            return [mp.Block(size=mp.Vector3(2, 2, mp.inf), center=mp.Vector3(1),
+                             material=mp.Medium(epsilon=eps))]
+
+        def make_sim(eps):
+            sources = mp.Source(src=mp.GaussianSource(1, fwidth=0.2), component=mp.Ez,
+                                center=mp.Vector3(-1))
+            return mp.Simulation(cell_size=mp.Vector3(6, 6),
+                                 geometry=block(eps),
+                                 boundary_layers=[mp.PML(1.0)],
+                                 sources=[sources],
+                                 resolution=10)
+
+        cell = mp.Volume(mp.Vector3(), mp.Vector3(6, 6))
+        sim = make_sim(4)
+        sim.run(until=5)
+        fields = sim.fields
+        sim.update_materials(center=mp.Vector3(1), size=mp.Vector3(2, 2), geometry=block(9))
+        self.assertIs(sim.fields, fields)
+
+        # the same materials as a structure initialized with the new block
+        ref = make_sim(9)
+        ref.init_sim()
+        np.testing.assert_allclose(sim.get_array(mp.Dielectric, cell),
+                                   ref.get_array(mp.Dielectric, cell))
+        sim.run(until=10)
+
     def test_get_array_output(self):
         sim = self.init_simple_simulation()
         sim.symmetries = []
@@ -422,6 +539,36 @@ class TestSimulation(unittest.TestCase):
         np.testing.assert_allclose(energy, energy_arr)
         np.testing.assert_allclose(efield, efield_arr)
 
+    def test_chunk_views(self):
+        sources = [mp.Source(mp.GaussianSource(0.5, fwidth=0.4), component=mp.Ez,
+                             center=mp.Vector3(0.3, 0.2))]
+        sim = mp.Simulation(cell_size=mp.Vector3(6, 4), resolution=10, sources=sources,
+                            boundary_layers=[mp.PML(1.0)], num_chunks=4)
+        dft = sim.add_dft_fields([mp.Ez], 0.5, 0.4, 3, center=mp.Vector3(), size=mp.Vector3(4, 2))
+        sim.run(until=10)
+
+        # the views hold the values on the grid points of each chunk
+        views = sim.get_field_chunk_views(mp.Ez)
+        self.assertEqual(len(views), sim.fields.num_chunks)
+        ezmax = max(np.abs(v['re']).max() for v in views)
+        self.assertGreater(ezmax, 0)
+        for v in views:
+            self.assertIsNone(v['im'])
+            self.assertFalse(v['re'].flags.writeable)
+            self.assertEqual(v['directions'], [mp.X, mp.Y])
+            mid = [(s + e) // 2 for s, e in zip(v['owned_start'], v['owned_end'])]
+            for idx in [v['owned_start'], mid]:
+                pt = v['origin'] + mp.Vector3(idx[0], idx[1]) / sim.resolution
+                self.assertAlmostEqual(v['re'][tuple(idx)], sim.get_field_point(mp.Ez, pt).real,
+                                       delta=1e-12 * ezmax)
+
+        # the DFT views are the per-chunk blocks of get_dft_data, in place
+        dft_views = sim.get_dft_chunk_views(dft)
+        self.assertTrue(all(v['component'] == mp.Ez for v in dft_views))
+        self.assertTrue(all(v['dft'].shape[1] == 3 for v in dft_views))
+        np.testing.assert_array_equal(np.concatenate([v['dft'].ravel() for v in dft_views]),
+                                      sim.get_dft_data(dft.swigobj.chunks))
+
     def test_synchronized_magnetic(self):
         # Issue 309
         cell = mp.Vector3(16, 8, 0)
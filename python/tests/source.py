@@ -122,6 +122,44 @@ class TestSourceTypemaps(unittest.TestCase):
 
         self.assertAlmostEqual(fp, -0.021997617628500023 + 0j)
 
+    def test_tabulated_custom_source(self):
+        calls = [0]
+
+        def bump(t):
+            calls[0] += 1
+            return math.exp(-1 / (1 - ((t - 1)**2))) if 0 < t < 2 else 0j
+
+        def vector_bump(t):
+            calls[0] += 1
+            t = np.asarray(t, dtype=float)
+            inside = (t > 0) & (t < 2)
+            s = np.where(inside, t - 1, 0)
+            return np.where(inside, np.exp(-1 / (1 - s**2)), 0)
+
+        def run(src_func, tabulate):
+            src = mp.CustomSource(src_func=src_func, end_time=3, tabulate=tabulate)
+            sources = [mp.Source(src=src, component=mp.Ez, center=mp.Vector3(0.3))]
+            sim = mp.Simulation(cell_size=mp.Vector3(4, 4),
+                                resolution=10,
+                                boundary_layers=[mp.PML(1)],
+                                sources=sources)
+            sim.init_sim()
+            init_calls = calls[0]
+            sim.run(until=5)
+            return sim.get_field_point(mp.Ez, mp.Vector3(-0.4, 0.2)), calls[0] - init_calls
+
+        fp, step_calls = run(bump, False)
+        self.assertGreater(step_calls, 0)
+        self.assertNotEqual(fp, 0)
+
+        # the tabulated source is not called back while stepping, and gives the same fields
+        for src_func in [bump, vector_bump]:
+            calls[0] = 0
+            fp_tab, step_calls = run(src_func, True)
+            self.assertEqual(step_calls, 0)
+            self.assertAlmostEqual(fp_tab, fp, places=12)
+        self.assertEqual(calls[0], 1)
+
 
 def amp_fun(p):
     return p.x + 2 * p.y
@@ -1,4 +1,5 @@
 import unittest
+import numpy as np
 import meep as mp
 
 
@@ -38,6 +39,17 @@ def my_epsilon_func(p):
     return 1.0
 
 
+# the same as my_epsilon_func, for an (N,3) array of points
+def my_epsilon_batch_func(p):
+    x = p[:, 0]
+    y = p[:, 1]
+    eps = np.where((x**2 / (0.5**2) + y**2 / (1.0**2)) < 1.0, 1.0, 3.5)
+    return np.where((x**2 / (3.0**2) + y**2 / (3.0**2)) < 1.0, eps, 1.0)
+
+
+my_epsilon_batch_func.batch = True
+
+
 class TestUserMaterials(unittest.TestCase):
 
     def setUp(self):
@@ -74,6 +86,43 @@ class TestUserMaterials(unittest.TestCase):
 
         self.assertAlmostEqual(fp, -7.895783750440999e-4 + 0j)
 
+    def test_epsilon_batch_func(self):
+        sim = mp.Simulation(cell_size=self.cell,
+                            resolution=self.resolution,
+                            symmetries=self.symmetries,
+                            boundary_layers=self.boundary_layers,
+                            sources=self.sources,
+                            epsilon_func=my_epsilon_batch_func)
+
+        sim.run(until=100)
+        fp = sim.get_field_point(mp.Ez, mp.Vector3(x=1))
+
+        self.assertAlmostEqual(fp, -7.895783750440999e-4 + 0j)
+
+    def test_fallback_stencil(self):
+        def disk_epsilon_func(p):
+            return 12.0 if p.x**2 + p.y**2 < 1.7**2 else 1.0
+
+        def get_eps(do_averaging, stencil=0):
+            disk_epsilon_func.do_averaging = do_averaging
+            mp.set_fallback_stencil(stencil)
+            try:
+                sim = mp.Simulation(cell_size=mp.Vector3(5, 5),
+                                    resolution=self.resolution,
+                                    epsilon_func=disk_epsilon_func)
+                sim.init_sim()
+                return sim.get_array(mp.Dielectric, mp.Volume(mp.Vector3(), mp.Vector3(5, 5)))
+            finally:
+                mp.set_fallback_stencil(0)
+
+        # the stencil average of a user material approximates the adaptive
+        # cubature much better than no averaging at all
+        eps_cubature = get_eps(True)
+        err_stencil = np.amax(np.abs(get_eps(True, 16) - eps_cubature))
+        err_noavg = np.amax(np.abs(get_eps(False) - eps_cubature))
+        self.assertGreater(err_stencil, 0)
+        self.assertLess(err_stencil, 0.1 * err_noavg)
+
     def test_geometric_obj_with_user_material(self):
         geometry = [mp.Cylinder(5, material=my_material_func)]
 
@@ -142,7 +142,29 @@ class TestVisualization(unittest.TestCase):
         if mp.am_master():
             hash_figure(f)
             #self.assertAlmostEqual(hash_figure(f),68926258)
-    
+
+    def test_eps_image_cache(self):
+        # the cached epsilon image must not survive a change of the materials
+        cell = mp.Vector3(4,4)
+        sim = mp.Simulation(cell_size=cell,
+                            geometry=[mp.Block(mp.Vector3(mp.inf,1),material=mp.Medium(epsilon=12))],
+                            resolution=10)
+        f = plt.figure()
+        sim.plot2D(ax=f.gca())
+        if mp.am_master():
+            self.assertAlmostEqual(np.max(sim._eps_image_cache[1]), 12)
+
+        sim.update_materials(center=mp.Vector3(), size=cell,
+                             geometry=[mp.Block(mp.Vector3(mp.inf,1),material=mp.Medium(epsilon=4))])
+        self.assertIsNone(sim._eps_image_cache)
+        f = plt.figure()
+        sim.plot2D(ax=f.gca())
+        if mp.am_master():
+            self.assertAlmostEqual(np.max(sim._eps_image_cache[1]), 4)
+
+        sim.phase_in_material(sim.structure, 10)
+        self.assertIsNone(sim._eps_image_cache)
+
     @unittest.skipIf(call(['which', 'ffmpeg']) != 0, "ffmpeg is not installed")
     def test_animation_output(self):
         # ------------------------- #
@@ -165,6 +165,47 @@ static void py_epsilon_func_wrap(vector3 x, void *user_data, medium_struct *medi
   Py_DECREF(pyret);
 }
 
+// batch epsilon functions take an (n,3) array of points and return an array
+// of shape (n,) (scalar epsilon) or (n,3) (diagonal epsilon)
+static void py_user_material_batch_wrap(size_t n, const vector3 *x, void *user_data,
+                                        vector3 *epsilon_diag) {
+  npy_intp dims[2] = {(npy_intp)n, 3};
+  PyObject *pyx = PyArray_SimpleNew(2, dims, NPY_DOUBLE);
+  double *xdata = (double *)PyArray_DATA((PyArrayObject *)pyx);
+  for (size_t i = 0; i < n; ++i) {
+    xdata[3 * i] = x[i].x;
+    xdata[3 * i + 1] = x[i].y;
+    xdata[3 * i + 2] = x[i].z;
+  }
+
+  PyObject *pyret = PyObject_CallFunctionObjArgs((PyObject *)user_data, pyx, NULL);
+  Py_DECREF(pyx);
+  if (!pyret) { abort_with_stack_trace(); }
+
+  PyArrayObject *pao =
+      (PyArrayObject *)PyArray_FROMANY(pyret, NPY_DOUBLE, 1, 2, NPY_ARRAY_IN_ARRAY);
+  Py_DECREF(pyret);
+  if (!pao) { abort_with_stack_trace(); }
+
+  const double *eps = (const double *)PyArray_DATA(pao);
+  if (PyArray_NDIM(pao) == 1 && (size_t)PyArray_DIM(pao, 0) == n) {
+    for (size_t i = 0; i < n; ++i)
+      epsilon_diag[i].x = epsilon_diag[i].y = epsilon_diag[i].z = eps[i];
+  }
+  else if (PyArray_NDIM(pao) == 2 && (size_t)PyArray_DIM(pao, 0) == n &&
+           PyArray_DIM(pao, 1) == 3) {
+    for (size_t i = 0; i < n; ++i) {
+      epsilon_diag[i].x = eps[3 * i];
+      epsilon_diag[i].y = eps[3 * i + 1];
+      epsilon_diag[i].z = eps[3 * i + 2];
+    }
+  }
+  else {
+    meep::abort("batch material function must return an array of shape (N,) or (N,3)");
+  }
+  Py_DECREF(pao);
+}
+
 static std::string py_class_name_as_string(PyObject *po) {
   PyObject *py_type = PyObject_Type(po);
   PyObject *name = PyObject_GetAttrString(py_type, "__name__");
@@ -426,7 +467,16 @@ static int pymaterial_to_material(PyObject *po, material_type *mt) {
     PyObject *py_do_averaging = PyObject_GetAttrString(po, "do_averaging");
     bool do_averaging = false;
     if (py_do_averaging) { do_averaging = PyObject_IsTrue(py_do_averaging); }
-    if (eps && eps == Py_True) { md = make_user_material(py_epsilon_func_wrap, po, do_averaging); }
+    bool batch = false;
+    if (PyObject_HasAttrString(po, "batch")) {
+      PyObject *py_batch = PyObject_GetAttrString(po, "batch");
+      batch = PyObject_IsTrue(py_batch);
+      Py_XDECREF(py_batch);
+    }
+    if (batch) { md = make_user_batch_material(py_user_material_batch_wrap, po, do_averaging); }
+    else if (eps && eps == Py_True) {
+      md = make_user_material(py_epsilon_func_wrap, po, do_averaging);
+    }
     else {
       md = make_user_material(py_user_material_func_wrap, po, do_averaging);
     }
@@ -450,6 +500,9 @@ static int pymaterial_to_material(PyObject *po, material_type *mt) {
     for (int i = 0; i < PyArray_NDIM(pao); ++i) {
       md->epsilon_dims[i] = (size_t)PyArray_DIMS(pao)[i];
     }
+    for (int i = 0; i < 3; ++i) {
+      md->epsilon_count[i] = md->epsilon_dims[i];
+    }
 
     master_printf("read in %zdx%zdx%zd numpy array for epsilon\n", md->epsilon_dims[0],
                   md->epsilon_dims[1], md->epsilon_dims[2]);
@@ -36,17 +36,21 @@ default_monitor_parameters = {
         'linewidth':2
     }
 
+# 'stride': fetch every stride-th grid point (block-averaged); None picks
+# the stride that matches the on-screen size of the axes
 default_field_parameters = {
         'interpolation':'spline36',
         'cmap':'RdBu',
         'alpha':0.6,
-        'post_process':np.real
+        'post_process':np.real,
+        'stride':None
         }
 
 default_eps_parameters = {
         'interpolation':'spline36',
         'cmap':'binary',
-        'alpha':1.0
+        'alpha':1.0,
+        'stride':None
     }
 
 default_boundary_parameters = {
@@ -202,6 +206,26 @@ def get_2D_dimensions(sim,output_plane):
 # ------------------------------------------------------- #
 # actual plotting routines
 
+# Grid stride for fetching an image of the 2D plane sim_size for the axes
+# ax: the largest stride that still gives at least one grid point per
+# screen pixel, so that the array is decimated by get_array on all
+# processes instead of being downsampled by matplotlib on the master.
+# The axes only exist on the master, which decides for all processes.
+def get_plot_stride(sim,ax,sim_size,stride=None):
+    if stride is not None:
+        return max(1, int(stride))
+    stride = 1
+    if mp.am_master() and ax is not None:
+        try:
+            bbox = ax.get_window_extent()
+            pixels = max(bbox.width, bbox.height)
+        except Exception:
+            pixels = 0
+        npts = max(sim_size.x, sim_size.y, sim_size.z) * sim.resolution
+        if pixels >= 1:
+            stride = max(1, int(npts // pixels))
+    return mp.max_to_all(int(stride))
+
 def plot_volume(sim,ax,volume,output_plane=None,plotting_parameters=None,label=None):
     if not sim._is_initialized:
         sim.init_sim()
@@ -342,9 +366,21 @@ def plot_eps(sim,ax,output_plane=None,eps_parameters=None,omega=0):
     else:
         raise ValueError("A 2D plane has not been specified...")
 
-    eps_data = np.rot90(np.real(sim.get_array(center=center, size=cell_size, component=mp.Dielectric, omega=omega)))
+    # the image is cached until the structure changes (see Simulation); while
+    # a material is being phased in, the structure changes at every step
+    stride = get_plot_stride(sim, ax, sim_size, eps_parameters['stride'])
+    key = (tuple(center), tuple(cell_size), omega, stride)
+    if sim.fields is not None and sim.fields.is_phasing():
+        sim._eps_image_cache = None
+    if sim._eps_image_cache is not None and sim._eps_image_cache[0] == key:
+        eps_data = sim._eps_image_cache[1]
+    else:
+        eps_data = np.rot90(np.real(sim.get_array(center=center, size=cell_size, component=mp.Dielectric,
+                                                  omega=omega, master_only=True,
+                                                  stride=stride, block_average=True)))
+        sim._eps_image_cache = (key, eps_data)
     if mp.am_master():
-        ax.imshow(eps_data, extent=extent, **eps_parameters)
+        ax.imshow(eps_data, extent=extent, **{k:v for k,v in eps_parameters.items() if k!='stride'})
         ax.set_xlabel(xlabel)
         ax.set_ylabel(ylabel)
 
@@ -495,7 +531,9 @@ def plot_fields(sim,ax=None,fields=None,output_plane=None,field_parameters=None)
             extent = [xmin,xmax,ymin,ymax]
             xlabel = 'X'
             ylabel = 'Y'
-        fields = sim.get_array(center=center, size=cell_size, component=fields)
+        stride = get_plot_stride(sim, ax, sim_size, field_parameters['stride'])
+        fields = sim.get_array(center=center, size=cell_size, component=fields,
+                               stride=stride, block_average=True)
     else:
         raise ValueError('Please specify a valid field component (mp.Ex, mp.Ey, ...')
 
@@ -738,6 +776,9 @@ class Animate2D(object):
             if not self.init:
                 filtered_plot2D = filter_dict(self.customization_args, plot2D)
                 ax = sim.plot2D(ax=self.ax,fields=self.fields,**filtered_plot2D)
+                field_parameters = filtered_plot2D.get('field_parameters') or {}
+                sim_center, sim_size = get_2D_dimensions(sim,filtered_plot2D.get('output_plane'))
+                self.stride = get_plot_stride(sim,self.ax,sim_size,field_parameters.get('stride'))
                 # Run the plot modifier functions
                 if self.plot_modifiers:
                     for k in range(len(self.plot_modifiers)):
@@ -749,8 +790,10 @@ class Animate2D(object):
                     self.w, self.h = self.f.get_size_inches()
                 self.init = True
             else:
-                # Update the plot
+                # Update the plot, at the resolution of the first frame
                 filtered_plot_fields= filter_dict(self.customization_args, plot_fields)
+                field_parameters = filtered_plot_fields.get('field_parameters') or {}
+                filtered_plot_fields['field_parameters'] = dict(field_parameters, stride=self.stride)
                 fields = sim.plot_fields(fields=self.fields,**filtered_plot_fields)
                 if mp.am_master():
                     self.ax.images[-1].set_data(fields)
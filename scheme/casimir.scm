@@ -109,6 +109,31 @@
 		    (vector3-x surface-m) (vector3-y surface-m) (vector3-z surface-m)
 		    (list-ref orientation-list s) 1))))))
 
+;The runs for the different source terms of a force computation differ
+;only in their sources (and in the conductivity for E vs. H sources, and m
+;in cylindrical coordinates), so the structure and fields of the previous
+;run are reused whenever the parameters they depend on are unchanged.
+(define casimir-structure-key '())
+(define casimir-fields-key '())
+
+(define (casimir-init-fields)
+  (let ((skey (list geometry geometry-lattice geometry-center resolution
+		    default-material pml-layers symmetries num-chunks Courant
+		    eps-averaging? ensure-periodicity k-point
+		    global-D-conductivity global-B-conductivity))
+	(fkey (list m force-complex-fields? k-point)))
+    (if (or (null? structure) (not (equal? skey casimir-structure-key)))
+	(reset-meep)
+	(if (and (not (null? fields)) (not (equal? fkey casimir-fields-key)))
+	    (begin (delete-meep-fields fields) (set! fields '()))))
+    (if (null? fields)
+	(init-fields)
+	(begin
+	  (restart-fields)
+	  (change-sources! sources)))
+    (set! casimir-structure-key skey)
+    (set! casimir-fields-key fkey)))
+
 ;compute the casimir force for a single n and single polarization
 ;n contains both the side number and the harmonic expansion index
 (define (casimir-force-contrib force-direction integration-vol n Sigma T source-component gt . step-funcs)
@@ -166,8 +191,7 @@
 				  (meep-volume-get-min-corner source-vol)))
 		  (component source-component)
 		  (amp-func (lambda (p) (cos-func p mx my mz source-vol))))))
-    (reset-meep)
-    (init-fields)
+    (casimir-init-fields)
     (let* ((counter 0)
 	   (force-integral 0))
       (define (integrate-function)
@@ -249,8 +273,7 @@
 				  (meep-volume-get-min-corner source-vol)))
 		  (component source-component)
 		  (amp-func (lambda (p) (casimir-bloch-func p gx gy gz source-vol))))))
-    (reset-meep)
-    (init-fields)
+    (casimir-init-fields)
     (let* ((counter 0)
 	   (force-integral 0))
       (define (integrate-function)
@@ -266,3 +289,40 @@
 	(set! counter (+ counter 1)))
       (apply run-until (cons (- T 1) (cons integrate-function step-funcs)))
       force-integral)))
+
+;%%%%%%%%%%%%%%%%%%%%% BATCHED SOURCE TERMS %%%%%%%%%%%%%%%%%%%%%%
+;sum casimir-force-contrib over every n in n-list and every source
+;component in component-list (with gt-list giving the g(t) array for each
+;component, e.g. from make-casimir-g for its field type).  The runs are
+;split round-robin among num-groups groups of processes (via
+;meep-divide-parallel-processes) that run concurrently, and within a group
+;all runs with the same field type reuse one structure.  The total is
+;returned on every process.
+(define (casimir-force-contribs force-direction integration-vol n-list Sigma T
+				component-list gt-list num-groups . step-funcs)
+  (let* ((ngroups (max 1 (min num-groups (meep-count-processors))))
+	 (group (if (> ngroups 1) (meep-divide-parallel-processes ngroups) 0))
+	 (force 0)
+	 (i 0))
+    (map (lambda (c gt)
+	   (map (lambda (n)
+		  (if (= (modulo i ngroups) group)
+		      (set! force
+			    (+ force
+			       (apply casimir-force-contrib
+				      (append (list force-direction integration-vol n
+						    Sigma T c gt)
+					      step-funcs)))))
+		  (set! i (+ i 1)))
+		n-list))
+	 component-list gt-list)
+    (if (> ngroups 1)
+	(let ((mine (exact->inexact (if (zero? (meep-my-rank)) force 0))))
+	  ;the fields belong to this group's communicator
+	  (reset-meep)
+	  (set! casimir-structure-key '())
+	  (meep-begin-global-communications)
+	  (set! force (meep-sum-to-all mine))
+	  (meep-end-global-communications)
+	  (meep-end-divide-parallel)))
+    force))
@@ -22,6 +22,7 @@
 
 #include <vector>
 #include <string>
+#include <algorithm>
 #include "meepgeom.hpp"
 
 #ifdef HAVE_CONFIG_H
@@ -124,17 +125,40 @@ meep::grid_volume set_geometry_from_GDSII(double resolution, const char *GDSIIFi
   return set_geometry_from_GDSII(resolution, GDSIIFile, 0, Layer, zsize);
 }
 
+/*******************************************************************/
+/* true if the XY bounding box of a polygon intersects the XY      */
+/* extent of a volume                                              */
+/*******************************************************************/
+static bool polygon_intersects(const dVec &polygon, const meep::volume &where) {
+  meep::vec max_corner, min_corner;
+  get_polygon_bounding_box(polygon, max_corner, min_corner);
+  return max_corner.in_direction(meep::X) >= where.in_direction_min(meep::X) &&
+         min_corner.in_direction(meep::X) <= where.in_direction_max(meep::X) &&
+         max_corner.in_direction(meep::Y) >= where.in_direction_min(meep::Y) &&
+         min_corner.in_direction(meep::Y) <= where.in_direction_max(meep::Y);
+}
+
 /*******************************************************************/
 /* find all polygons on a given GDSII layer and return a list of   */
 /* geometric_objects describing prisms, all with the same material */
-/* and thickness.                                                  */
+/* and thickness.  If where is non-NULL, polygons whose bounding   */
+/* boxes lie entirely outside its XY extent are skipped.  The     */
+/* prisms are built serially, since make_prism (libctl) is not     */
+/* thread-safe.                                                    */
 /*******************************************************************/
-geometric_object_list get_GDSII_prisms(material_type material, const char *GDSIIFile, int Layer,
-                                       double zmin, double zmax) {
+static geometric_object_list get_GDSII_prisms(material_type material, const char *GDSIIFile,
+                                              int Layer, double zmin, double zmax,
+                                              const meep::volume *where) {
   geometric_object_list prisms = {0, 0};
 
   // fetch all polygons on the given GDSII layer
   PolygonList polygons = libGDSII::GetPolygons(GDSIIFile, Layer);
+  if (where) {
+    size_t n = 0;
+    for (size_t np = 0; np < polygons.size(); np++)
+      if (polygon_intersects(polygons[np], *where)) polygons[n++].swap(polygons[np]);
+    polygons.resize(n);
+  }
   int num_prisms = polygons.size();
   if (num_prisms == 0) return prisms; // no polygons found; TODO: print warning?
 
@@ -142,7 +166,7 @@ geometric_object_list get_GDSII_prisms(material_type material, const char *GDSII
   prisms.num_items = num_prisms;
   prisms.items = new geometric_object[num_prisms];
   for (int np = 0; np < num_prisms; np++) {
-    dVec polygon = polygons[np];
+    const dVec &polygon = polygons[np];
     int num_vertices = polygon.size() / 2;
     vector3 *vertices = new vector3[num_vertices];
     for (int nv = 0; nv < num_vertices; nv++) {
@@ -157,6 +181,76 @@ geometric_object_list get_GDSII_prisms(material_type material, const char *GDSII
   return prisms;
 }
 
+geometric_object_list get_GDSII_prisms(material_type material, const char *GDSIIFile, int Layer,
+                                       double zmin, double zmax) {
+  return get_GDSII_prisms(material, GDSIIFile, Layer, zmin, zmax, NULL);
+}
+
+geometric_object_list get_GDSII_prisms(material_type material, const char *GDSIIFile, int Layer,
+                                       double zmin, double zmax, const meep::volume &where) {
+  return get_GDSII_prisms(material, GDSIIFile, Layer, zmin, zmax, &where);
+}
+
+/*******************************************************************/
+/* rasterize the polygons on a GDSII layer into an nx x ny grid    */
+/* (row-major, x index first) of pixels covering the XY extent of  */
+/* where: pixels whose centers lie inside a polygon (even-odd rule)*/
+/* are set to value, and all others are left unchanged.  This      */
+/* bypasses the geometric-object lookups entirely, e.g. for use as */
+/* a gridded default material.                                     */
+/*******************************************************************/
+void rasterize_GDSII_layer(const char *GDSIIFile, int Layer, const meep::volume &where,
+                           double value, double *grid, int nx, int ny) {
+  if (nx <= 0 || ny <= 0) return;
+  PolygonList polygons = libGDSII::GetPolygons(GDSIIFile, Layer);
+
+  const double x0 = where.in_direction_min(meep::X), y0 = where.in_direction_min(meep::Y);
+  const double dx = where.in_direction(meep::X) / nx, dy = where.in_direction(meep::Y) / ny;
+  if (dx <= 0 || dy <= 0) meep::abort("rasterize_GDSII_layer needs a volume with nonzero XY size");
+
+  // spatial index: the polygons overlapping each band of grid columns
+  const int band_width = 64, num_bands = (nx + band_width - 1) / band_width;
+  std::vector<std::vector<int> > bands(num_bands);
+  for (size_t np = 0; np < polygons.size(); np++) {
+    if (!polygon_intersects(polygons[np], where)) continue;
+    meep::vec max_corner, min_corner;
+    get_polygon_bounding_box(polygons[np], max_corner, min_corner);
+    int b0 = std::max(0, int(floor((min_corner.in_direction(meep::X) - x0) / dx - 0.5)));
+    int b1 = std::min(nx - 1, int(ceil((max_corner.in_direction(meep::X) - x0) / dx - 0.5)));
+    for (int b = b0 / band_width; b <= b1 / band_width; ++b)
+      bands[b].push_back(np);
+  }
+
+  // scanline fill along y for each grid column x; the columns (rows of the
+  // row-major grid) are independent, so they are filled in parallel
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic, 16)
+#endif
+  for (int i = 0; i < nx; ++i) {
+    const double x = x0 + (i + 0.5) * dx;
+    std::vector<double> crossings;
+    const std::vector<int> &band = bands[i / band_width];
+    for (size_t nb = 0; nb < band.size(); ++nb) {
+      const dVec &polygon = polygons[band[nb]];
+      const size_t num_vertices = polygon.size() / 2;
+      crossings.clear();
+      for (size_t nv = 0; nv < num_vertices; ++nv) {
+        size_t nv2 = (nv + 1) % num_vertices;
+        double xa = polygon[2 * nv], ya = polygon[2 * nv + 1];
+        double xb = polygon[2 * nv2], yb = polygon[2 * nv2 + 1];
+        if ((xa <= x) != (xb <= x)) crossings.push_back(ya + (x - xa) / (xb - xa) * (yb - ya));
+      }
+      std::sort(crossings.begin(), crossings.end());
+      for (size_t nc = 0; nc + 1 < crossings.size(); nc += 2) {
+        int j0 = std::max(0, int(ceil((crossings[nc] - y0) / dy - 0.5)));
+        int j1 = std::min(ny - 1, int(floor((crossings[nc + 1] - y0) / dy - 0.5)));
+        for (int j = j0; j <= j1; ++j)
+          grid[i * ny + j] = value;
+      }
+    }
+  }
+}
+
 /*******************************************************************/
 /* like the previous routine, but creates only a single prism,     */
 /* optionally identified by Text; if non-null, only polygons       */
@@ -248,6 +342,24 @@ geometric_object_list get_GDSII_prisms(material_type material, const char *GDSII
   return prisms;
 }
 
+geometric_object_list get_GDSII_prisms(material_type material, const char *GDSIIFile, int Layer,
+                                       double zmin, double zmax, const meep::volume &where) {
+  (void)where;
+  return get_GDSII_prisms(material, GDSIIFile, Layer, zmin, zmax);
+}
+
+void rasterize_GDSII_layer(const char *GDSIIFile, int Layer, const meep::volume &where,
+                           double value, double *grid, int nx, int ny) {
+  (void)GDSIIFile;
+  (void)Layer;
+  (void)where;
+  (void)value;
+  (void)grid;
+  (void)nx;
+  (void)ny;
+  GDSIIError("rasterize_GDSII_layer");
+}
+
 geometric_object get_GDSII_prism(material_type material, const char *GDSIIFile, const char *Text,
                                  int Layer, double zmin, double zmax) {
   (void)material;
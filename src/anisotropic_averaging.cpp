@@ -1,6 +1,11 @@
 #include <math.h>
 
 #include "meep_internals.hpp"
+#include "config.h"
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
 
 /* This file contains routines to compute the "average" or "effective"
    dielectric constant for a pixel, using an anisotropic averaging
@@ -194,7 +199,8 @@ done : {
 }
 
 void structure_chunk::set_chi1inv(component c, material_function &medium,
-                                  bool use_anisotropic_averaging, double tol, int maxeval) {
+                                  bool use_anisotropic_averaging, double tol, int maxeval,
+                                  const volume *where) {
   if (!is_mine() || !gv.has_field(c)) return;
   field_type ft = type(c);
   if (ft != E_stuff && ft != H_stuff) abort("only E or H can have chi");
@@ -204,60 +210,110 @@ void structure_chunk::set_chi1inv(component c, material_function &medium,
 
   const double smoothing_diameter = 1.0; // FIXME: make user-changable?
 
-  // may take a long time in 3d, so prepare to print status messages
-  size_t npixels = 0, ipixel = 0;
-  size_t loop_npixels = 0;
+  // may take a long time in 3d, so prepare to print status messages.
+  // The loop bounds are taken from LOOP_OVER_VOL and flattened into a
+  // single index, so that the pixels can be distributed over threads
+  // with dynamic scheduling (interface pixels needing cubature are far
+  // more expensive than bulk ones) when the medium allows it.
+  ptrdiff_t is1 = 0, is2 = 0, is3 = 0, n1 = 0, n2 = 0, n3 = 0, s1 = 0, s2 = 0, s3 = 0, i0 = 0;
+  direction ld1 = NO_DIRECTION, ld2 = NO_DIRECTION, ld3 = NO_DIRECTION;
   LOOP_OVER_VOL(gv, c, i) {
-    loop_npixels = loop_n1 * loop_n2 * loop_n3;
+    is1 = loop_is1;
+    is2 = loop_is2;
+    is3 = loop_is3;
+    n1 = loop_n1;
+    n2 = loop_n2;
+    n3 = loop_n3;
+    s1 = loop_s1;
+    s2 = loop_s2;
+    s3 = loop_s3;
+    ld1 = direction(loop_d1);
+    ld2 = direction(loop_d2);
+    ld3 = direction(loop_d3);
+    i0 = i;
     goto breakout; // hack to use loop-size computation from LOOP_OVER_VOL
   }
 breakout:
-  npixels += loop_npixels;
+  const ptrdiff_t npixels = n1 * n2 * n3;
+  ptrdiff_t ipixel = 0;
   double last_output_time = wall_time();
 
+  direction dc = component_direction(c);
   FOR_FT_COMPONENTS(ft, c2) if (gv.has_field(c2)) {
     direction d = component_direction(c2);
-    if (!chi1inv[c][d]) chi1inv[c][d] = new realnum[gv.ntot()];
-    if (!chi1inv[c][d]) abort("Memory allocation error.\n");
+    if (!chi1inv[c][d]) {
+      chi1inv[c][d] = new_realnum_array(gv.ntot());
+      if (!chi1inv[c][d]) abort("Memory allocation error.\n");
+      // (points outside where keep their previous, trivial, value)
+      array_fill(chi1inv[c][d], gv.ntot(), d == dc ? 1.0 : 0.0);
+    }
   }
-  direction dc = component_direction(c);
   direction d0 = X, d1 = Y, d2 = Z;
   if (gv.dim == Dcyl) {
     d0 = R;
     d1 = P;
   }
   int idiag = component_index(c);
-  bool trivial[3] = {true, true, true};
+  bool trivial0 = true, trivial1 = true, trivial2 = true;
   double trivial_val[3] = {0, 0, 0};
   trivial_val[idiag] = 1.0;
   ivec shift1(unit_ivec(gv.dim, component_direction(c)) * (ft == E_stuff ? 1 : -1));
-  LOOP_OVER_VOL(gv, c, i) {
+  const bool threaded = medium.thread_safe();
+  (void)threaded;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic, 16) if (threaded) \
+    reduction(&& : trivial0, trivial1, trivial2)
+#endif
+  for (ptrdiff_t k = 0; k < npixels; ++k) {
+    const ptrdiff_t k1 = k / (n2 * n3), k2 = (k / n3) % n2, k3 = k % n3;
+    const ptrdiff_t i = i0 + k1 * s1 + k2 * s2 + k3 * s3;
+    ivec here(gv.dim);
+    here.set_direction(ld1, is1 + 2 * k1);
+    here.set_direction(ld2, is2 + 2 * k2);
+    here.set_direction(ld3, is3 + 2 * k3);
+    if (where && !where->contains(gv[here])) continue;
+
     double chi1invrow[3], chi1invrow_offdiag[3];
-    IVEC_LOOP_ILOC(gv, here);
     medium.eff_chi1inv_row(c, chi1invrow, gv.dV(here, smoothing_diameter), tol, maxeval);
     medium.eff_chi1inv_row(c, chi1invrow_offdiag, gv.dV(here - shift1, smoothing_diameter), tol,
                            maxeval);
     if (chi1inv[c][d0]) {
       chi1inv[c][d0][i] = (d0 == dc) ? chi1invrow[0] : chi1invrow_offdiag[0];
-      trivial[0] = trivial[0] && (chi1inv[c][d0][i] == trivial_val[0]);
+      trivial0 = trivial0 && (chi1inv[c][d0][i] == trivial_val[0]);
     }
     if (chi1inv[c][d1]) {
       chi1inv[c][d1][i] = (d1 == dc) ? chi1invrow[1] : chi1invrow_offdiag[1];
-      trivial[1] = trivial[1] && (chi1inv[c][d1][i] == trivial_val[1]);
+      trivial1 = trivial1 && (chi1inv[c][d1][i] == trivial_val[1]);
     }
     if (chi1inv[c][d2]) {
       chi1inv[c][d2][i] = (d2 == dc) ? chi1invrow[2] : chi1invrow_offdiag[2];
-      trivial[2] = trivial[2] && (chi1inv[c][d2][i] == trivial_val[2]);
+      trivial2 = trivial2 && (chi1inv[c][d2][i] == trivial_val[2]);
     }
 
-    if (verbosity > 0 && (ipixel + 1) % 1000 == 0 &&
+    ptrdiff_t ipix;
+#ifdef HAVE_OPENMP
+#pragma omp atomic capture
+#endif
+    ipix = ++ipixel;
+#ifdef HAVE_OPENMP
+    if (omp_get_thread_num() != 0) continue; // only one thread prints status
+#endif
+    if (verbosity > 0 && ipix % 1000 == 0 &&
         wall_time() > last_output_time + MEEP_MIN_OUTPUT_TIME) {
-      master_printf("subpixel-averaging is %g%% done, %g s remaining\n", ipixel * 100.0 / npixels,
-                    (npixels - ipixel) * (wall_time() - last_output_time) / ipixel);
+      master_printf("subpixel-averaging is %g%% done, %g s remaining\n", ipix * 100.0 / npixels,
+                    (npixels - ipix) * (wall_time() - last_output_time) / ipix);
       last_output_time = wall_time();
     }
-    ++ipixel;
   }
+  if (where) { // only part of the chunk was updated, so check all of it
+    trivial0 = trivial1 = trivial2 = true;
+    LOOP_OVER_VOL(gv, c, i) {
+      if (chi1inv[c][d0]) trivial0 = trivial0 && (chi1inv[c][d0][i] == trivial_val[0]);
+      if (chi1inv[c][d1]) trivial1 = trivial1 && (chi1inv[c][d1][i] == trivial_val[1]);
+      if (chi1inv[c][d2]) trivial2 = trivial2 && (chi1inv[c][d2][i] == trivial_val[2]);
+    }
+  }
+  bool trivial[3] = {trivial0, trivial1, trivial2};
   direction ds[3];
   ds[0] = d0;
   ds[1] = d1;
@@ -265,13 +321,13 @@ breakout:
   for (int i = 0; i < 3; ++i) {
     trivial_chi1inv[c][ds[i]] = trivial[i];
     if (i != idiag && trivial[i]) { // deallocate trivial offdiag
-      delete[] chi1inv[c][ds[i]];
+      array_free(chi1inv[c][ds[i]]);
       chi1inv[c][ds[i]] = 0;
     }
   }
   // only deallocate trivial diag if entire tensor is trivial
   if (trivial[0] && trivial[1] && trivial[2]) {
-    delete[] chi1inv[c][dc];
+    array_free(chi1inv[c][dc]);
     chi1inv[c][dc] = 0;
   }
   medium.unset_volume();
@@ -340,6 +396,7 @@ void structure_chunk::add_susceptibility(material_function &sigma, field_type ft
         delete[] newsus->sigma[c][dc];
         newsus->sigma[c][dc] = 0;
       }
+      newsus->set_sigma_box(c, gv);
     }
 
   // finally, add to the beginning of the chiP list:
@@ -0,0 +1,229 @@
+/* Copyright (C) 2005-2019 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+/* Allocation of the large per-chunk arrays, see array_malloc in meep.hpp. */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+
+#include "meep.hpp"
+#include "config.h"
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+namespace meep {
+
+#define HUGE_PAGE_SIZE ((size_t)2 * 1024 * 1024)
+#define ARRAY_ALIGN 64 // a cache line, also enough for any SIMD loads
+#define ARENA_MAX_BLOCK_ARRAYS 8
+
+static huge_pages_mode huge_pages = NoHugePages;
+
+void set_huge_pages(huge_pages_mode mode) { huge_pages = mode; }
+
+huge_pages_mode get_huge_pages() { return huge_pages; }
+
+/* Each array is preceded by a header recording how to free it; the
+   header fits in the ARRAY_ALIGN bytes before the array. */
+struct array_header {
+  void *base;    // the pointer returned by malloc, posix_memalign or mmap
+  size_t mapped; // the length of the mmap, or 0 if not mmapped
+};
+
+void *array_malloc(size_t nbytes) {
+  const size_t total = nbytes + ARRAY_ALIGN;
+  const bool huge = huge_pages != NoHugePages && total >= HUGE_PAGE_SIZE;
+  char *base = NULL;
+  size_t mapped = 0;
+
+#if defined(HAVE_MMAP) && defined(MAP_HUGETLB)
+  if (huge && huge_pages == ExplicitHugePages) {
+    const size_t len = (total + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+                   -1, 0);
+    if (p != MAP_FAILED) {
+      base = (char *)p;
+      mapped = len;
+    }
+    else { // the hugetlbfs pool is empty or too small
+      static bool warned = false;
+      if (!warned && verbosity > 0)
+        master_printf("warning: no explicit huge pages available, using transparent huge pages\n");
+      warned = true;
+    }
+  }
+#endif
+
+  if (!base) {
+#ifdef HAVE_POSIX_MEMALIGN
+    void *p = NULL;
+    if (posix_memalign(&p, huge ? HUGE_PAGE_SIZE : ARRAY_ALIGN, total)) p = NULL;
+    base = (char *)p;
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+    if (base && huge) madvise(base, total, MADV_HUGEPAGE);
+#endif
+#else
+    (void)huge; // huge pages need page-aligned memory
+    base = (char *)malloc(total + ARRAY_ALIGN);
+#endif
+    if (!base) abort("out of memory allocating %zu bytes", nbytes);
+  }
+
+  char *a = (char *)(((uintptr_t)base + sizeof(array_header) + ARRAY_ALIGN - 1) &
+                     ~(uintptr_t)(ARRAY_ALIGN - 1));
+  array_header *h = (array_header *)a - 1;
+  h->base = base;
+  h->mapped = mapped;
+  return a;
+}
+
+void array_free(void *p) {
+  if (!p) return;
+  const array_header *h = (const array_header *)p - 1;
+#ifdef HAVE_MMAP
+  if (h->mapped) {
+    munmap(h->base, h->mapped);
+    return;
+  }
+#endif
+  free(h->base);
+}
+
+static std::string dft_storage_dir;
+
+void set_dft_storage_dir(const char *dir) { dft_storage_dir = dir ? dir : ""; }
+
+const char *get_dft_storage_dir() {
+  return dft_storage_dir.empty() ? NULL : dft_storage_dir.c_str();
+}
+
+/* A zero-initialized array backed by an unlinked temporary file in dir
+   (shared mapping, so that the kernel writes the dirty pages back to the
+   file instead of keeping them in RAM), freed with array_free.  Falls back
+   to array_malloc if the file cannot be created or mapped. */
+void *array_malloc_file(size_t nbytes, const char *dir) {
+#if defined(HAVE_MMAP) && defined(HAVE_MKSTEMP) && defined(HAVE_FTRUNCATE)
+  const size_t page = 4096;
+  const size_t len = (nbytes + ARRAY_ALIGN + page - 1) / page * page;
+  std::string fname = std::string(dir) + "/meep-XXXXXX";
+  std::vector<char> tmpl(fname.begin(), fname.end());
+  tmpl.push_back('\0');
+  int fd = mkstemp(&tmpl[0]);
+  void *p = MAP_FAILED;
+  if (fd >= 0) {
+    unlink(&tmpl[0]); // the file lives as long as the mapping
+    if (ftruncate(fd, off_t(len)) == 0)
+      p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+  }
+  if (p != MAP_FAILED) {
+#if defined(HAVE_MADVISE) && defined(MADV_SEQUENTIAL)
+    madvise(p, len, MADV_SEQUENTIAL);
+#endif
+    char *a = (char *)p + ARRAY_ALIGN;
+    array_header *h = (array_header *)a - 1;
+    h->base = p;
+    h->mapped = len;
+    return a;
+  }
+  static bool warned = false;
+  if (!warned && verbosity > 0)
+    master_printf("warning: could not map a file in %s, keeping the arrays in memory\n", dir);
+  warned = true;
+#else
+  (void)dir;
+#endif
+  void *a = array_malloc(nbytes);
+  memset(a, 0, nbytes);
+  return a;
+}
+
+/* The first write to each page decides its NUMA node, so these split the
+   arrays among the threads in the same way as the PLOOP_* loops over the
+   chunk (statically, along the slowest-varying direction), unless they are
+   called from a thread already stepping a chunk in a parallel loop. */
+void array_fill(realnum *a, size_t n, realnum value) {
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) if (n >= MEEP_OMP_MIN_LOOP && !omp_in_parallel())
+#endif
+  for (ptrdiff_t i = 0; i < (ptrdiff_t)n; i++)
+    a[i] = value;
+}
+
+void array_copy(realnum *dst, const realnum *src, size_t n) {
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(static) if (n >= MEEP_OMP_MIN_LOOP && !omp_in_parallel())
+#endif
+  for (ptrdiff_t i = 0; i < (ptrdiff_t)n; i++)
+    dst[i] = src[i];
+}
+
+chunk_arena::chunk_arena(size_t n) : n(n), used(0) {
+  const size_t line = ARRAY_ALIGN / sizeof(realnum);
+  stride = (n + line - 1) / line * line;
+  if (stride == 0 || (stride * sizeof(realnum)) % 4096 == 0) stride += line;
+}
+
+chunk_arena::~chunk_arena() {
+  for (size_t i = 0; i < blocks.size(); i++)
+    array_free(blocks[i]);
+}
+
+realnum *chunk_arena::alloc() {
+  if (!free_arrays.empty()) {
+    realnum *a = free_arrays.back();
+    free_arrays.pop_back();
+    return a;
+  }
+  if (blocks.empty() || used == block_arrays.back()) {
+    /* grow geometrically, so that a chunk needs only a few blocks, but
+       with at most ARENA_MAX_BLOCK_ARRAYS per block so that the unused
+       tail of the last block stays small compared to the fields */
+    size_t narrays = 4;
+    for (size_t i = 0; i < block_arrays.size(); i++)
+      narrays = std::max(narrays, block_arrays[i] * 2);
+    narrays = std::min(narrays, size_t(ARENA_MAX_BLOCK_ARRAYS));
+    blocks.push_back(new_realnum_array(narrays * stride));
+    block_arrays.push_back(narrays);
+    used = 0;
+  }
+  return blocks.back() + stride * used++;
+}
+
+void chunk_arena::free(realnum *a) {
+  if (a) free_arrays.push_back(a);
+}
+
+size_t chunk_arena::bytes() const {
+  size_t narrays = 0;
+  for (size_t i = 0; i < block_arrays.size(); i++)
+    narrays += block_arrays[i];
+  return narrays * stride * sizeof(realnum);
+}
+
+} // namespace meep
@@ -46,6 +46,13 @@ typedef struct {
   direction ds[3];
   size_t slice_size;
 
+  // subsampling (fields::set_output_stride) in get_array_slice: the slice
+  // has dimensions odims, with every ostride-th point or (oaverage) the
+  // average over each block of points
+  int ostride;
+  bool oaverage;
+  size_t odims[3];
+
   // if non-null, min_max_loc[0,1] are filled in by get_array_slice_dimensions_chunkloop
   // with the (coordinate-wise) minimum and maximum grid points encountered
   // in looping over the slice region.
@@ -60,6 +67,14 @@ typedef struct {
 
   void *vslice;
 
+  // the slice points computed by this process, as indices into the slice
+  // and their values (real, or real and imaginary parts), to be gathered
+  // onto the master; with a single process (direct), the points are
+  // instead added into vslice as they are computed
+  bool direct;
+  std::vector<size_t> gather_index;
+  std::vector<double> gather_values;
+
   // temporary internal storage buffers
   component *cS;
   cdouble *ph;
@@ -80,6 +95,25 @@ typedef struct {
 
 #define UNUSED(x) (void)x // silence compiler warnings
 
+static void add_slice_value(array_slice_data *data, size_t idx, double x) {
+  if (data->direct) {
+    ((double *)data->vslice)[idx] += x;
+    return;
+  }
+  data->gather_index.push_back(idx);
+  data->gather_values.push_back(x);
+}
+
+static void add_slice_value(array_slice_data *data, size_t idx, cdouble z) {
+  if (data->direct) {
+    ((cdouble *)data->vslice)[idx] += z;
+    return;
+  }
+  data->gather_index.push_back(idx);
+  data->gather_values.push_back(real(z));
+  data->gather_values.push_back(imag(z));
+}
+
 /* passthrough field function equivalent to component_fun in h5fields.cpp */
 static cdouble default_field_func(const cdouble *fields, const vec &loc, void *data_) {
   (void)loc;   // unused
@@ -184,8 +218,8 @@ static void get_source_slice_chunkloop(fields_chunk *fc, int ichnk, component cg
       // local index of the symmetry-child grid point within this
       // slice (that is, if it even lies within the slice)
       for (size_t npt = 0; npt < s->npts; npt++) {
-        cdouble amp = s->A[npt];
-        ptrdiff_t chunk_index = s->index[npt];
+        cdouble amp = s->amplitude(npt);
+        ptrdiff_t chunk_index = s->index_at(npt);
         ivec iloc_parent = fc->gv.iloc(Dielectric, chunk_index);
         ivec iloc_child = S.transform(iloc_parent, sn) + shift;
         if (!in_subgrid(slice_imin, iloc_child, slice_imax)) continue; // source point outside slice
@@ -268,17 +302,17 @@ static void get_array_slice_chunkloop(fields_chunk *fc, int ichnk, component cgr
   // sco="slice chunk offset"
   ptrdiff_t sco = start[0] * dims[1] * dims[2] + start[1] * dims[2] + start[2];
 
+  // strides of the subsampled slice
+  const int os = data->ostride;
+  ptrdiff_t ostr[3] = {1, 1, 1};
+  for (int i = data->rank - 2; i >= 0; --i)
+    ostr[i] = ostr[i + 1] * data->odims[i + 1];
+
   //-----------------------------------------------------------------------//
   // Otherwise proceed to compute the function of field components to be   //
   // tabulated on the slice, exactly as in fields::integrate.              //
   //-----------------------------------------------------------------------//
-  double *slice = 0;
-  cdouble *zslice = 0;
   bool complex_data = (data->rfun == 0);
-  if (complex_data)
-    zslice = (cdouble *)data->vslice;
-  else
-    slice = (double *)data->vslice;
 
   ptrdiff_t *off = data->offsets;
   component *cS = data->cS;
@@ -310,6 +344,25 @@ static void get_array_slice_chunkloop(fields_chunk *fc, int ichnk, component cgr
   // main loop over all grid points owned by this field chunk.
   LOOP_OVER_IVECS(fc->gv, is, ie, idx) {
 
+    // with subsampling, find the index of this point in the slice (and its
+    // weight in the block average), skipping points that are not output
+    ptrdiff_t oidx = 0;
+    double oweight = 1.0;
+    if (os > 1) {
+      IVEC_LOOP_ILOC(fc->gv, iloc);
+      ivec ilocS = S.transform(iloc, sn) + shift;
+      bool skip = false;
+      for (int i = 0; i < data->rank; ++i) {
+        direction d = data->ds[i];
+        size_t g = (ilocS.in_direction(d) - data->min_corner.in_direction(d)) / 2;
+        if (!data->oaverage && g % os) skip = true;
+        oidx += (g / os) * ostr[i];
+        oweight /= std::min(size_t(os), dims[i] - (g / os) * os);
+      }
+      if (skip) continue;
+      if (!data->oaverage) oweight = 1.0;
+    }
+
     // get real-space coordinates of grid point, taking into
     // account the complications of symmetries.
     IVEC_LOOP_LOC(fc->gv, loc);
@@ -359,15 +412,23 @@ static void get_array_slice_chunkloop(fields_chunk *fc, int ichnk, component cgr
       }
     }
 
+    if (os > 1) {
+      if (complex_data)
+        add_slice_value(data, oidx, oweight * data->fun(fields, loc, data->fun_data));
+      else
+        add_slice_value(data, oidx, oweight * data->rfun(fields, loc, data->fun_data));
+      continue;
+    }
+
     // compute the index into the array for this grid point and store the result of the computation
     ptrdiff_t idx2 =
         sco + ((((offset[0] + offset[1] + offset[2]) + loop_i1 * stride[0]) + loop_i2 * stride[1]) +
                loop_i3 * stride[2]);
 
     if (complex_data)
-      zslice[idx2] = data->fun(fields, loc, data->fun_data);
+      add_slice_value(data, idx2, data->fun(fields, loc, data->fun_data));
     else
-      slice[idx2] = data->rfun(fields, loc, data->fun_data);
+      add_slice_value(data, idx2, data->rfun(fields, loc, data->fun_data));
 
   } // LOOP_OVER_IVECS
 }
@@ -473,7 +534,7 @@ int fields::get_array_slice_dimensions(const volume &where, size_t dims[3], dire
 /**********************************************************************/
 void *fields::do_get_array_slice(const volume &where, std::vector<component> components,
                                  field_function fun, field_rfunction rfun, void *fun_data,
-                                 void *vslice, double omega) {
+                                 void *vslice, double omega, bool master_only) {
   am_now_working_on(FieldOutput);
 
   /***************************************************************/
@@ -489,23 +550,29 @@ void *fields::do_get_array_slice(const volume &where, std::vector<component> com
   get_array_slice_dimensions(where, dims, dirs, collapse, snap, 0, &data);
   size_t slice_size = data.slice_size;
 
+  // subsampled slice dimensions: every output_stride-th point from the corner
+  data.ostride = std::max(1, output_stride);
+  data.oaverage = output_block_average;
+  if (data.ostride > 1) {
+    slice_size = 1;
+    for (int i = 0; i < data.rank; ++i)
+      slice_size *= (data.odims[i] = (dims[i] - 1) / data.ostride + 1);
+  }
+
   bool complex_data = (rfun == 0);
-  cdouble *zslice;
-  double *slice;
-  if (vslice == 0) {
-    if (complex_data) {
-      zslice = new cdouble[slice_size];
-      memset(zslice, 0, slice_size * sizeof(cdouble));
-      vslice = (void *)zslice;
-    }
-    else {
-      slice = new double[slice_size];
-      memset(slice, 0, slice_size * sizeof(double));
-      vslice = (void *)slice;
-    }
+  int width = complex_data ? 2 : 1;
+  bool have_slice = am_master() || !master_only;
+  if (vslice == 0 && have_slice) {
+    if (complex_data)
+      vslice = (void *)new cdouble[slice_size];
+    else
+      vslice = (void *)new double[slice_size];
   }
+  // the gathered points (and block averages) are accumulated into the slice
+  if (am_master()) memset(vslice, 0, width * slice_size * sizeof(double));
 
   data.vslice = vslice;
+  data.direct = count_processors() == 1;
   data.fun = fun;
   data.rfun = rfun;
   data.fun_data = fun_data;
@@ -551,9 +618,24 @@ void *fields::do_get_array_slice(const volume &where, std::vector<component> com
   loop_in_chunks(get_array_slice_chunkloop, (void *)&data, where, Centered, true, true);
 
   /***************************************************************/
-  /*consolidate full array on all cores                          */
+  /* gather the points of each process into the full slice on    */
+  /* the master, then (unless master_only) broadcast it in       */
+  /* pieces, as in fields::process_dft_component                 */
   /***************************************************************/
-  vslice = (void *)array_to_all((double *)vslice, (complex_data ? 2 : 1) * slice_size);
+  gather_sum_to_master(data.gather_index.empty() ? 0 : &data.gather_index[0],
+                       data.gather_values.empty() ? 0 : &data.gather_values[0],
+                       data.gather_index.size(), width, am_master() ? (double *)vslice : 0);
+  if (!master_only) {
+    double *dslice = (double *)vslice;
+    ptrdiff_t offset = 0;
+    size_t remaining = width * slice_size;
+    while (remaining != 0) {
+      size_t size = (remaining > BUFSIZE ? BUFSIZE : remaining);
+      broadcast(0, dslice + offset, size);
+      remaining -= size;
+      offset += size;
+    }
+  }
 
   delete[] data.offsets;
   delete[] data.fields;
@@ -568,38 +650,43 @@ void *fields::do_get_array_slice(const volume &where, std::vector<component> com
 /* entry points to get_array_slice                             */
 /***************************************************************/
 double *fields::get_array_slice(const volume &where, std::vector<component> components,
-                                field_rfunction rfun, void *fun_data, double *slice, double omega) {
-  return (double *)do_get_array_slice(where, components, 0, rfun, fun_data, (void *)slice, omega);
+                                field_rfunction rfun, void *fun_data, double *slice, double omega,
+                                bool master_only) {
+  return (double *)do_get_array_slice(where, components, 0, rfun, fun_data, (void *)slice, omega,
+                                      master_only);
 }
 
 cdouble *fields::get_complex_array_slice(const volume &where, std::vector<component> components,
                                          field_function fun, void *fun_data, cdouble *slice,
-                                         double omega) {
-  return (cdouble *)do_get_array_slice(where, components, fun, 0, fun_data, (void *)slice, omega);
+                                         double omega, bool master_only) {
+  return (cdouble *)do_get_array_slice(where, components, fun, 0, fun_data, (void *)slice, omega,
+                                       master_only);
 }
 
-double *fields::get_array_slice(const volume &where, component c, double *slice, double omega) {
+double *fields::get_array_slice(const volume &where, component c, double *slice, double omega,
+                                bool master_only) {
   std::vector<component> components(1);
   components[0] = c;
   return (double *)do_get_array_slice(where, components, 0, default_field_rfunc, 0, (void *)slice,
-                                      omega);
+                                      omega, master_only);
 }
 
 double *fields::get_array_slice(const volume &where, derived_component c, double *slice,
-                                double omega) {
+                                double omega, bool master_only) {
   int nfields;
   component carray[12];
   field_rfunction rfun = derived_component_func(c, gv, nfields, carray);
   std::vector<component> cs(carray, carray + nfields);
-  return (double *)do_get_array_slice(where, cs, 0, rfun, &nfields, (void *)slice, omega);
+  return (double *)do_get_array_slice(where, cs, 0, rfun, &nfields, (void *)slice, omega,
+                                      master_only);
 }
 
 cdouble *fields::get_complex_array_slice(const volume &where, component c, cdouble *slice,
-                                         double omega) {
+                                         double omega, bool master_only) {
   std::vector<component> components(1);
   components[0] = c;
   return (cdouble *)do_get_array_slice(where, components, default_field_func, 0, 0, (void *)slice,
-                                       omega);
+                                       omega, master_only);
 }
 
 cdouble *fields::get_source_slice(const volume &where, component source_slice_component,
@@ -720,12 +807,16 @@ std::vector<double> fields::get_array_metadata(const volume &where, bool collaps
   vec min_max_loc[2]; // extremal points in subgrid
   int rank = get_array_slice_dimensions(where, dims, dirs, false /*collapse_empty_dimensions*/,
                                         snap_empty_dimensions, min_max_loc);
+  // the metadata (and weights) are always for the full grid
+  int stride = output_stride;
+  output_stride = 1;
   int full_rank = rank;
   direction full_dirs[3];
   for (int fr = 0; fr < rank; fr++)
     full_dirs[fr] = dirs[fr];
 
   double *weights = get_array_slice(where, NO_COMPONENT);
+  output_stride = stride;
   if (collapse_empty_dimensions) weights = collapse_array(weights, &rank, dims, dirs, where);
 
   /* get length and endpoints of x,y,z tics arrays */
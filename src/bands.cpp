@@ -198,4 +198,102 @@ int do_harminv(complex<double> *data, int n, double dt, double fmin, double fmax
 #endif
 }
 
+/* The band [fmin,fmax] of width bw is shifted to [bw/2, 3bw/2], so that the
+   decimated sampling rate fs = 1/(D dt) only has to exceed 3bw to keep it
+   alias-free; the default D makes fs >= 6bw.  The Blackman-windowed sinc
+   low-pass cuts off at fs/2, and its length is chosen so that the transition
+   band fits between 1.5bw and fs - 1.5bw (anything above that would fold
+   back into the band). */
+harminv_stream::harminv_stream(int num_probes_, double dt_, double fmin_, double fmax_,
+                               int decimation)
+    : num_probes(num_probes_), dt(dt_), fmin(fmin_), fmax(fmax_), nin(0), nout(0) {
+  if (num_probes < 1) abort("harminv_stream needs at least one probe");
+  if (!(fmax > fmin) || !(dt > 0)) abort("harminv_stream needs fmax > fmin and dt > 0");
+  double bw = fmax - fmin;
+  fshift = fmin - 0.5 * bw;
+  D = decimation > 0 ? decimation : max(1, int(floor(1 / (6 * bw * dt))));
+  double fs = 1 / (D * dt);
+  if (fs <= 3 * bw) abort("harminv_stream decimation %d too large for band width %g", D, bw);
+
+  if (D == 1)
+    L = 1;
+  else
+    L = 2 * int(ceil(2.75 / ((fs - 3 * bw) * dt))) + 1;
+  taps.resize(L);
+  double sum = 0;
+  for (int m = 0; m < L; ++m) {
+    double x = m - 0.5 * (L - 1), arg = pi * fs * dt * x;
+    double w = L == 1 ? 1
+                      : 0.42 - 0.5 * cos(2 * pi * m / (L - 1)) + 0.08 * cos(4 * pi * m / (L - 1));
+    taps[m] = w * (x == 0 ? 1 : sin(arg) / arg);
+    sum += taps[m];
+  }
+  for (int m = 0; m < L; ++m)
+    taps[m] /= sum;
+  buf.assign(size_t(num_probes) * L, 0.0);
+}
+
+void harminv_stream::add(const complex<double> *values) {
+  complex<double> mix = polar(1.0, 2 * pi * fshift * (nin * dt));
+  int pos = int(nin % L);
+  for (int p = 0; p < num_probes; ++p)
+    buf[size_t(p) * L + pos] = values[p] * mix;
+  ++nin;
+  if (nin < size_t(L) || (nin - L) % D != 0) return;
+
+  // output sample n = sum_m taps[m] * (mixed input n - m)
+  for (int p = 0; p < num_probes; ++p) {
+    const complex<double> *b = &buf[size_t(p) * L];
+    complex<double> y = 0;
+    for (int m = 0; m <= pos; ++m)
+      y += taps[m] * b[pos - m];
+    for (int m = pos + 1; m < L; ++m)
+      y += taps[m] * b[L + pos - m];
+    out.push_back(y);
+  }
+  ++nout;
+}
+
+/* Decimated sample j is the filtered signal at input step L-1 + j*D, so a
+   mode a exp(-i w t) of the original data (t = 0 at the first sample) shows
+   up with w' = w - 2 pi fshift and amplitude a H(w') exp(-i w' (L-1) dt),
+   where H(w') = sum_m taps[m] exp(i w' m dt) is the filter response. */
+void harminv_stream::analyze(int maxbands, int *nmodes, complex<double> *amps, double *freq_re,
+                             double *freq_im, double *errors, double spectral_density,
+                             double Q_thresh, double rel_err_thresh, double err_thresh,
+                             double rel_amp_thresh, double amp_thresh) const {
+  size_t n = size_t(num_probes) * maxbands;
+  vector<double> nf_mine(num_probes, 0.0), re_mine(n, 0.0), im_mine(n, 0.0), err_mine(n, 0.0);
+  vector<complex<double> > amps_mine(n, 0.0), data(nout);
+  double bw = fmax - fmin, t0 = (L - 1) * dt;
+
+  for (int p = my_rank(); p < num_probes; p += count_processors()) {
+    if (nout == 0) break;
+    for (size_t j = 0; j < nout; ++j)
+      data[j] = out[j * num_probes + p];
+    size_t i0 = size_t(p) * maxbands;
+    int nf = do_harminv(&data[0], int(nout), D * dt, 0.5 * bw, 1.5 * bw, maxbands, &amps_mine[i0],
+                        &re_mine[i0], &im_mine[i0], &err_mine[i0], spectral_density, Q_thresh,
+                        rel_err_thresh, err_thresh, rel_amp_thresh, amp_thresh);
+    for (int k = 0; k < nf; ++k) {
+      complex<double> w = 2 * pi * complex<double>(re_mine[i0 + k], im_mine[i0 + k]);
+      complex<double> H = 0;
+      for (int m = 0; m < L; ++m)
+        H += taps[m] * exp(complex<double>(0, 1) * w * (m * dt));
+      amps_mine[i0 + k] *= exp(complex<double>(0, 1) * w * t0) / H;
+      re_mine[i0 + k] += fshift;
+    }
+    nf_mine[p] = nf;
+  }
+
+  vector<double> nf_all(num_probes);
+  sum_to_all(&nf_mine[0], &nf_all[0], num_probes);
+  for (int p = 0; p < num_probes; ++p)
+    nmodes[p] = int(nf_all[p]);
+  sum_to_all(&amps_mine[0], amps, int(n));
+  sum_to_all(&re_mine[0], freq_re, int(n));
+  sum_to_all(&im_mine[0], freq_im, int(n));
+  if (errors) sum_to_all(&err_mine[0], errors, int(n));
+}
+
 } // namespace meep
@@ -73,26 +73,52 @@ using namespace std;
 
 namespace meep {
 
-static double dot(size_t n, const realnum *x, const realnum *y) {
+/* The local BLAS-1 kernels are threaded, and inner products that are
+   needed together are summed over processes with a single allreduce,
+   since at scale the allreduce latency rather than the local work
+   dominates. */
+
+static double local_dot(size_t n, const realnum *x, const realnum *y) {
   double sum = 0;
-  for (size_t i = 0; i < n; ++i)
+#ifdef HAVE_OPENMP
+#pragma omp parallel for reduction(+ : sum)
+#endif
+  for (ptrdiff_t i = 0; i < ptrdiff_t(n); ++i)
     sum += x[i] * y[i];
-  return sum_to_all(sum);
+  return sum;
+}
+
+// out[k] = x[k] . y[k] for k < m, with one allreduce
+static void dots(int m, size_t n, realnum *const *x, realnum *const *y, double *out) {
+  double *local = new double[m];
+  for (int k = 0; k < m; ++k)
+    local[k] = local_dot(n, x[k], y[k]);
+  sum_to_all(local, out, m);
+  delete[] local;
+}
+
+static double dot(size_t n, const realnum *x, const realnum *y) {
+  return sum_to_all(local_dot(n, x, y));
 }
 
 static double norm2(size_t n, const realnum *x) {
   // note: we don't just do sqrt(dot(n, x, x)) in order to avoid overflow
-  size_t i;
-  double xmax = 0, scale;
-  long double sum = 0;
-  for (i = 0; i < n; ++i) {
+  double xmax = 0;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for reduction(max : xmax)
+#endif
+  for (ptrdiff_t i = 0; i < ptrdiff_t(n); ++i) {
     double xabs = fabs(x[i]);
     if (xabs > xmax) xmax = xabs;
   }
   xmax = max_to_all(xmax);
   if (xmax == 0) return 0;
-  scale = 1.0 / xmax;
-  for (i = 0; i < n; ++i) {
+  double scale = 1.0 / xmax;
+  long double sum = 0;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for reduction(+ : sum)
+#endif
+  for (ptrdiff_t i = 0; i < ptrdiff_t(n); ++i) {
     double xs = scale * x[i];
     sum += xs * xs;
   }
@@ -100,18 +126,36 @@ static double norm2(size_t n, const realnum *x) {
 }
 
 static void xpay(size_t n, realnum *x, double a, const realnum *y) {
-  for (size_t m = 0; m < n; ++m)
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (ptrdiff_t m = 0; m < ptrdiff_t(n); ++m)
     x[m] += a * y[m];
 }
 
+// x = y - a * x
+static void ymax(size_t n, realnum *x, double a, const realnum *y) {
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (ptrdiff_t m = 0; m < ptrdiff_t(n); ++m)
+    x[m] = y[m] - a * x[m];
+}
+
 #define MEEP_MIN_OUTPUT_TIME 4.0 // output no more often than this many seconds
 
 typedef realnum *prealnum; // grr, ISO C++ forbids new (double*)[...]
 
-/* BiCGSTAB(L) algorithm for the n-by-n problem Ax = b */
-ptrdiff_t bicgstabL(const int L, const size_t n, realnum *x, bicgstab_op A, void *Adata,
-                    const realnum *b, const double tol, int *iters, realnum *work,
-                    const bool quiet) {
+/* BiCGSTAB(L) algorithm for the n-by-n problem Ax = b.
+
+   The minimal-residual part keeps the modified Gram-Schmidt
+   orthogonalization of the original formulation (solving the normal
+   equations instead would square the condition number), but the two
+   inner products of each r[j] with itself and with r[0] share one
+   allreduce. */
+static ptrdiff_t bicgstabL_unpreconditioned(const int L, const size_t n, realnum *x, bicgstab_op A,
+                                            void *Adata, const realnum *b, const double tol,
+                                            int *iters, realnum *work, const bool quiet) {
   if (!work) return (2 * L + 3) * n; // required workspace
 
   prealnum *r = new prealnum[L + 1];
@@ -173,8 +217,7 @@ ptrdiff_t bicgstabL(const int L, const size_t n, realnum *x, bicgstab_op A, void
       double beta = alpha * rho1 / rho;
       rho = rho1;
       for (int i = 0; i <= j; ++i)
-        for (size_t m = 0; m < n; ++m)
-          u[i][m] = r[i][m] - beta * u[i][m];
+        ymax(n, u[i], beta, r[i]);
       A(u[j], u[j + 1], Adata);
       alpha = rho / dot(n, u[j + 1], rtilde);
       for (int i = 0; i <= j; ++i)
@@ -189,8 +232,12 @@ ptrdiff_t bicgstabL(const int L, const size_t n, realnum *x, bicgstab_op A, void
         tau[ij] = dot(n, r[j], r[i]) / sigma[i];
         xpay(n, r[j], -tau[ij], r[i]);
       }
-      sigma[j] = dot(n, r[j], r[j]);
-      gamma_p[j] = dot(n, r[0], r[j]) / sigma[j];
+      // sigma[j] = r[j] . r[j] and r[0] . r[j], in one allreduce
+      realnum *dx[2] = {r[j], r[0]}, *dy[2] = {r[j], r[j]};
+      double d[2];
+      dots(2, n, dx, dy, d);
+      sigma[j] = d[0];
+      gamma_p[j] = d[1] / sigma[j];
     }
 
     omega = gamma[L] = gamma_p[L];
@@ -235,4 +282,52 @@ finish:
   return ierr;
 }
 
+typedef struct {
+  bicgstab_op A, M;
+  void *Adata, *Mdata;
+  realnum *tmp;
+} precond_op_data;
+
+// y = A M^{-1} x
+static void precond_op(const realnum *x, realnum *y, void *data_) {
+  precond_op_data *data = (precond_op_data *)data_;
+  data->M(x, data->tmp, data->Mdata);
+  data->A(data->tmp, y, data->Adata);
+}
+
+ptrdiff_t bicgstabL(const int L, const size_t n, realnum *x, bicgstab_op A, void *Adata,
+                    const realnum *b, const double tol, int *iters, realnum *work,
+                    const bool quiet, bicgstab_op M, void *Mdata) {
+  if (!M) return bicgstabL_unpreconditioned(L, n, x, A, Adata, b, tol, iters, work, quiet);
+  if (!work) return (2 * L + 6) * n; // required workspace
+
+  // solve A M^{-1} y = r0 = b - A x0 for y (starting from 0), then x = x0 + M^{-1} y
+  realnum *r0 = work + (2 * L + 3) * n;
+  realnum *y = r0 + n;
+  precond_op_data data;
+  data.A = A;
+  data.Adata = Adata;
+  data.M = M;
+  data.Mdata = Mdata;
+  data.tmp = y + n;
+  A(x, r0, Adata);
+  for (size_t m = 0; m < n; ++m) {
+    r0[m] = b[m] - r0[m];
+    y[m] = 0;
+  }
+
+  double bnrm = norm2(n, b), r0nrm = norm2(n, r0);
+  if (bnrm == 0.0) bnrm = 1.0;
+  if (r0nrm <= tol * bnrm) {
+    *iters = 0;
+    return 0;
+  }
+
+  ptrdiff_t ierr = bicgstabL_unpreconditioned(L, n, y, precond_op, &data, r0, tol * bnrm / r0nrm,
+                                              iters, work, quiet);
+  M(y, data.tmp, Mdata);
+  xpay(n, x, 1.0, data.tmp);
+  return ierr;
+}
+
 } // namespace meep
@@ -41,12 +41,17 @@ typedef void (*bicgstab_op)(const realnum *x, realnum *y, void *data);
    allocate work = new realnum[nwork], and call it again.
    
    For non-NULL nwork, returns 0 on success, 1 if the maximum number of iterations was reached, and -1
-   if a breakdown in convergence was detected. */
+   if a breakdown in convergence was detected.
+
+   Optionally, M (with data Mdata) applies a preconditioner y = M^{-1} x, which should be a fixed
+   linear operator approximating the inverse of A.  It is applied on the right, i.e. the iteration
+   solves A M^{-1} y = b - A x0 and then sets x = x0 + M^{-1} y, so tol still refers to the true
+   residual |Ax-b|.  The workspace query must pass the same M, which needs 3n more workspace. */
 ptrdiff_t bicgstabL(const int L, const size_t n, realnum *x, bicgstab_op A, void *Adata,
                     const realnum *b, const double tol,
                     int *iters,    // input *iters = max iters, output = actual iters
                     realnum *work, // if you pass work=NULL, bicgstab returns nwork
-                    const bool quiet);
+                    const bool quiet, bicgstab_op M = NULL, void *Mdata = NULL);
 
 } // namespace meep
 
@@ -16,7 +16,9 @@
 */
 
 #include <stdlib.h>
+#include <algorithm>
 #include <complex>
+#include <vector>
 
 #include "meep.hpp"
 #include "meep_internals.hpp"
@@ -31,6 +33,7 @@ void fields::set_boundary(boundary_side b, direction d, boundary_condition cond)
   if (boundaries[b][d] != cond) {
     boundaries[b][d] = cond;
     chunk_connections_valid = false;
+    clear_loop_plans();
   }
 }
 
@@ -92,6 +95,7 @@ vec fields::lattice_vector(direction d) const { return gv[ilattice_vector(d)]; }
 
 void fields::disconnect_chunks() {
   chunk_connections_valid = false;
+  free_boundary_communications();
   for (int i = 0; i < num_chunks; i++) {
     DOCMP {
       FOR_FIELD_TYPES(f) {
@@ -117,6 +121,9 @@ void fields::disconnect_chunks() {
       for (int ip = 0; ip < 3; ++ip)
         comm_sizes[ft][ip][i] = 0;
     }
+    delete[] local_connections[ft];
+    local_connections[ft] = NULL;
+    num_local_connections[ft] = 0;
   }
 }
 
@@ -131,8 +138,11 @@ void fields::connect_chunks() {
     disconnect_chunks();
     find_metals();
     connect_the_chunks();
+    find_local_connections();
+    plan_boundary_communications();
     finished_working();
     chunk_connections_valid = true;
+    if (verbosity > 1) print_comm_matrix_summary();
   }
 }
 
@@ -298,6 +308,49 @@ bool fields_chunk::needs_W_notowned(component c) {
   return false;
 }
 
+/* Each non-owned point of chunk i is owned by at most one chunk, and that
+   chunk almost always touches chunk i, so rather than scanning all chunks for
+   every border point we first try the previous owner and then the neighbor
+   list of chunk i.  Only points mapped through a periodic or symmetry image
+   to a non-adjacent chunk fall back to the full scan. */
+static void find_chunk_neighbors(fields_chunk **chunks, int num_chunks,
+                                 std::vector<std::vector<int> > &neighbors) {
+  neighbors.assign(num_chunks, std::vector<int>());
+  if (num_chunks == 0) return;
+  // symmetry images can map a border point back into the chunk itself
+  for (int i = 0; i < num_chunks; i++)
+    neighbors[i].push_back(i);
+  // sweep along the first direction: sort by the low corner and stop scanning
+  // once the low corner of j is past the (padded) high corner of i
+  const direction d0 = start_at_direction(chunks[0]->gv.dim);
+  std::vector<std::pair<int, int> > order(num_chunks);
+  for (int i = 0; i < num_chunks; i++)
+    order[i] = std::make_pair(chunks[i]->gv.little_corner().in_direction(d0), i);
+  std::sort(order.begin(), order.end());
+  const ivec pad = one_ivec(chunks[0]->gv.dim) * 2;
+  for (int oi = 0; oi < num_chunks; oi++) {
+    const int i = order[oi].second;
+    const ivec lo = chunks[i]->gv.little_corner() - pad, hi = chunks[i]->gv.big_corner() + pad;
+    for (int oj = oi + 1; oj < num_chunks && order[oj].first <= hi.in_direction(d0); oj++) {
+      const int j = order[oj].second;
+      if (chunks[j]->gv.little_corner() <= hi && chunks[j]->gv.big_corner() >= lo) {
+        neighbors[i].push_back(j);
+        neighbors[j].push_back(i);
+      }
+    }
+  }
+}
+
+static int find_owner(const ivec &here, fields_chunk **chunks, int num_chunks,
+                      const std::vector<int> &neighbors, int &last) {
+  if (last >= 0 && chunks[last]->gv.owns(here)) return last;
+  for (size_t k = 0; k < neighbors.size(); k++)
+    if (chunks[neighbors[k]]->gv.owns(here)) return (last = neighbors[k]);
+  for (int j = 0; j < num_chunks; j++)
+    if (chunks[j]->gv.owns(here)) return (last = j);
+  return -1;
+}
+
 void fields::connect_the_chunks() {
   size_t *nc[NUM_FIELD_TYPES][3][2];
   FOR_FIELD_TYPES(f) {
@@ -346,6 +399,10 @@ void fields::connect_the_chunks() {
   FOR_E_AND_H(c) { needs_W_notowned[c] = or_to_all(needs_W_notowned[c]); }
   finished_working();
 
+  std::vector<std::vector<int> > neighbors;
+  find_chunk_neighbors(chunks, num_chunks, neighbors);
+  int last_owner = -1;
+
   for (int i = 0; i < num_chunks; i++) {
     // First count the border elements...
     const grid_volume vi = chunks[i]->gv;
@@ -360,63 +417,67 @@ void fields::connect_the_chunks() {
           component c = corig;
           // We're looking at a border element...
           complex<double> thephase;
-          if (locate_component_point(&c, &here, &thephase) && !on_metal_boundary(here))
-            for (int j = 0; j < num_chunks; j++) {
-              if ((chunks[i]->is_mine() || chunks[j]->is_mine()) && chunks[j]->gv.owns(here) &&
-                  !(is_B(corig) && is_B(c) && B_redundant[5 * i + corig - Bx] &&
-                    B_redundant[5 * j + c - Bx])) {
-                const int pair = j + i * num_chunks;
-                const connect_phase ip = thephase == 1.0
-                                             ? CONNECT_COPY
-                                             : (thephase == -1.0 ? CONNECT_NEGATE : CONNECT_PHASE);
-                {
-                  field_type f = type(c);
-                  const int nn = is_real ? 1 : 2;
-                  nc[f][ip][Incoming][i] += nn;
-                  nc[f][ip][Outgoing][j] += nn;
-                  comm_sizes[f][ip][pair] += nn;
-                }
-                if (needs_W_notowned[corig]) {
-                  field_type f = is_electric(corig) ? WE_stuff : WH_stuff;
-                  const int nn = is_real ? 1 : 2;
-                  nc[f][ip][Incoming][i] += nn;
-                  nc[f][ip][Outgoing][j] += nn;
-                  comm_sizes[f][ip][pair] += nn;
-                }
-                if (is_electric(corig) || is_magnetic(corig)) {
-                  field_type f = is_electric(corig) ? PE_stuff : PH_stuff;
-                  size_t ni = 0, cni = 0;
-                  for (polarization_state *pi = chunks[i]->pol[type(corig)]; pi; pi = pi->next)
-                    for (polarization_state *pj = chunks[j]->pol[type(c)]; pj; pj = pj->next)
-                      if (*pi->s == *pj->s) {
-                        if (pi->data && chunks[i]->is_mine()) {
-                          ni += pi->s->num_internal_notowned_needed(corig, pi->data);
-                          cni += pi->s->num_cinternal_notowned_needed(corig, pi->data);
-                        }
-                        else if (pj->data && chunks[j]->is_mine()) {
-                          ni += pj->s->num_internal_notowned_needed(c, pj->data);
-                          cni += pj->s->num_cinternal_notowned_needed(c, pj->data);
-                        }
+          if (locate_component_point(&c, &here, &thephase) && !on_metal_boundary(here)) {
+            const int j = find_owner(here, chunks, num_chunks, neighbors[i], last_owner);
+            if (j >= 0 && (chunks[i]->is_mine() || chunks[j]->is_mine()) &&
+                !(is_B(corig) && is_B(c) && B_redundant[5 * i + corig - Bx] &&
+                  B_redundant[5 * j + c - Bx])) {
+              const int pair = j + i * num_chunks;
+              const connect_phase ip = thephase == 1.0
+                                           ? CONNECT_COPY
+                                           : (thephase == -1.0 ? CONNECT_NEGATE : CONNECT_PHASE);
+              {
+                field_type f = type(c);
+                const int nn = is_real ? 1 : 2;
+                nc[f][ip][Incoming][i] += nn;
+                nc[f][ip][Outgoing][j] += nn;
+                comm_sizes[f][ip][pair] += nn;
+              }
+              if (needs_W_notowned[corig]) {
+                field_type f = is_electric(corig) ? WE_stuff : WH_stuff;
+                const int nn = is_real ? 1 : 2;
+                nc[f][ip][Incoming][i] += nn;
+                nc[f][ip][Outgoing][j] += nn;
+                comm_sizes[f][ip][pair] += nn;
+              }
+              if (is_electric(corig) || is_magnetic(corig)) {
+                field_type f = is_electric(corig) ? PE_stuff : PH_stuff;
+                size_t ni = 0, cni = 0;
+                for (polarization_state *pi = chunks[i]->pol[type(corig)]; pi; pi = pi->next)
+                  for (polarization_state *pj = chunks[j]->pol[type(c)]; pj; pj = pj->next)
+                    if (*pi->s == *pj->s) {
+                      if (pi->data && chunks[i]->is_mine()) {
+                        ni += pi->s->num_internal_notowned_needed(corig, pi->data);
+                        cni += pi->s->num_cinternal_notowned_needed(corig, pi->data);
                       }
-                  const size_t nn = (is_real ? 1 : 2) * (cni);
-                  nc[f][ip][Incoming][i] += nn;
-                  nc[f][ip][Outgoing][j] += nn;
-                  comm_sizes[f][ip][pair] += nn;
-                  const connect_phase iip = CONNECT_COPY;
-                  nc[f][iip][Incoming][i] += ni;
-                  nc[f][iip][Outgoing][j] += ni;
-                  comm_sizes[f][iip][pair] += ni;
-                }
-              } // if is_mine and owns...
-            }   // loop over j chunks
-        }       // LOOP_OVER_VOL_NOTOWNED
-    }           // FOR_COMPONENTS
+                      else if (pj->data && chunks[j]->is_mine()) {
+                        ni += pj->s->num_internal_notowned_needed(c, pj->data);
+                        cni += pj->s->num_cinternal_notowned_needed(c, pj->data);
+                      }
+                    }
+                const size_t nn = (is_real ? 1 : 2) * (cni);
+                nc[f][ip][Incoming][i] += nn;
+                nc[f][ip][Outgoing][j] += nn;
+                comm_sizes[f][ip][pair] += nn;
+                const connect_phase iip = CONNECT_COPY;
+                nc[f][iip][Incoming][i] += ni;
+                nc[f][iip][Outgoing][j] += ni;
+                comm_sizes[f][iip][pair] += ni;
+              }
+            } // if is_mine and owns...
+          }   // owner chunk j
+        }     // LOOP_OVER_VOL_NOTOWNED
+    }         // FOR_COMPONENTS
 
-    // Allocating comm blocks as we go...
+    // Allocating comm blocks as we go (only needed for pairs between this
+    // process and another one)...
     FOR_FIELD_TYPES(ft) {
       for (int j = 0; j < num_chunks; j++) {
         delete[] comm_blocks[ft][j + i * num_chunks];
-        comm_blocks[ft][j + i * num_chunks] = new realnum[comm_size_tot(ft, j + i * num_chunks)];
+        comm_blocks[ft][j + i * num_chunks] =
+            chunks[i]->is_mine() == chunks[j]->is_mine()
+                ? NULL
+                : new realnum[comm_size_tot(ft, j + i * num_chunks)];
       }
     }
   } // loop over i chunks
@@ -469,82 +530,80 @@ void fields::connect_the_chunks() {
           component c = corig;
           // We're looking at a border element...
           complex<double> thephase;
-          if (locate_component_point(&c, &here, &thephase) && !on_metal_boundary(here))
-            for (int j = 0; j < num_chunks; j++) {
-              if ((chunks[i]->is_mine() || chunks[j]->is_mine()) && chunks[j]->gv.owns(here) &&
-                  !(is_B(corig) && is_B(c) && B_redundant[5 * i + corig - Bx] &&
-                    B_redundant[5 * j + c - Bx])) {
-                const connect_phase ip = thephase == 1.0
-                                             ? CONNECT_COPY
-                                             : (thephase == -1.0 ? CONNECT_NEGATE : CONNECT_PHASE);
-                const ptrdiff_t m = chunks[j]->gv.index(c, here);
-
-                {
-                  field_type f = type(c);
-                  if (ip == CONNECT_PHASE)
-                    chunks[i]->connection_phases[f][wh[f][ip][Incoming][j] / 2] = thephase;
-                  DOCMP {
-                    chunks[i]->connections[f][ip][Incoming][wh[f][ip][Incoming][j]++] =
-                        chunks[i]->f[corig][cmp] + n;
-                    chunks[j]->connections[f][ip][Outgoing][wh[f][ip][Outgoing][j]++] =
-                        chunks[j]->f[c][cmp] + m;
-                  }
+          if (locate_component_point(&c, &here, &thephase) && !on_metal_boundary(here)) {
+            const int j = find_owner(here, chunks, num_chunks, neighbors[i], last_owner);
+            if (j >= 0 && (chunks[i]->is_mine() || chunks[j]->is_mine()) &&
+                !(is_B(corig) && is_B(c) && B_redundant[5 * i + corig - Bx] &&
+                  B_redundant[5 * j + c - Bx])) {
+              const connect_phase ip = thephase == 1.0
+                                           ? CONNECT_COPY
+                                           : (thephase == -1.0 ? CONNECT_NEGATE : CONNECT_PHASE);
+              const ptrdiff_t m = chunks[j]->gv.index(c, here);
+
+              {
+                field_type f = type(c);
+                if (ip == CONNECT_PHASE)
+                  chunks[i]->connection_phases[f][wh[f][ip][Incoming][j] / 2] = thephase;
+                DOCMP {
+                  chunks[i]->connections[f][ip][Incoming][wh[f][ip][Incoming][j]++] =
+                      chunks[i]->f[corig][cmp] + n;
+                  chunks[j]->connections[f][ip][Outgoing][wh[f][ip][Outgoing][j]++] =
+                      chunks[j]->f[c][cmp] + m;
                 }
+              }
 
-                if (needs_W_notowned[corig]) {
-                  field_type f = is_electric(corig) ? WE_stuff : WH_stuff;
-                  if (ip == CONNECT_PHASE)
-                    chunks[i]->connection_phases[f][wh[f][ip][Incoming][j] / 2] = thephase;
-                  DOCMP {
-                    chunks[i]->connections[f][ip][Incoming][wh[f][ip][Incoming][j]++] =
-                        (chunks[i]->f_w[corig][cmp] ? chunks[i]->f_w[corig][cmp]
-                                                    : chunks[i]->f[corig][cmp]) +
-                        n;
-                    chunks[j]->connections[f][ip][Outgoing][wh[f][ip][Outgoing][j]++] =
-                        (chunks[j]->f_w[c][cmp] ? chunks[j]->f_w[c][cmp] : chunks[j]->f[c][cmp]) +
-                        m;
-                  }
+              if (needs_W_notowned[corig]) {
+                field_type f = is_electric(corig) ? WE_stuff : WH_stuff;
+                if (ip == CONNECT_PHASE)
+                  chunks[i]->connection_phases[f][wh[f][ip][Incoming][j] / 2] = thephase;
+                DOCMP {
+                  chunks[i]->connections[f][ip][Incoming][wh[f][ip][Incoming][j]++] =
+                      (chunks[i]->f_w[corig][cmp] ? chunks[i]->f_w[corig][cmp]
+                                                  : chunks[i]->f[corig][cmp]) +
+                      n;
+                  chunks[j]->connections[f][ip][Outgoing][wh[f][ip][Outgoing][j]++] =
+                      (chunks[j]->f_w[c][cmp] ? chunks[j]->f_w[c][cmp] : chunks[j]->f[c][cmp]) + m;
                 }
+              }
 
-                if (is_electric(corig) || is_magnetic(corig)) {
-                  field_type f = is_electric(corig) ? PE_stuff : PH_stuff;
-                  for (polarization_state *pi = chunks[i]->pol[type(corig)]; pi; pi = pi->next)
-                    for (polarization_state *pj = chunks[j]->pol[type(c)]; pj; pj = pj->next)
-                      if (*pi->s == *pj->s) {
-                        polarization_state *po = NULL;
-                        if (pi->data && chunks[i]->is_mine())
-                          po = pi;
-                        else if (pj->data && chunks[j]->is_mine())
-                          po = pj;
-                        if (po) {
-                          const connect_phase iip = CONNECT_COPY;
-                          const size_t ni = po->s->num_internal_notowned_needed(corig, po->data);
-                          for (size_t k = 0; k < ni; ++k) {
-                            chunks[i]->connections[f][iip][Incoming][wh[f][iip][Incoming][j]++] =
-                                po->s->internal_notowned_ptr(k, corig, n, pi->data);
-                            chunks[j]->connections[f][iip][Outgoing][wh[f][iip][Outgoing][j]++] =
-                                po->s->internal_notowned_ptr(k, c, m, pj->data);
-                          }
-                          const size_t cni = po->s->num_cinternal_notowned_needed(corig, po->data);
-                          for (size_t k = 0; k < cni; ++k) {
-                            if (ip == CONNECT_PHASE)
-                              chunks[i]->connection_phases[f][wh[f][ip][Incoming][j] / 2] =
-                                  thephase;
-                            DOCMP {
-                              chunks[i]->connections[f][ip][Incoming][wh[f][ip][Incoming][j]++] =
-                                  po->s->cinternal_notowned_ptr(k, corig, cmp, n, pi->data);
-                              chunks[j]->connections[f][ip][Outgoing][wh[f][ip][Outgoing][j]++] =
-                                  po->s->cinternal_notowned_ptr(k, c, cmp, m, pj->data);
-                            }
+              if (is_electric(corig) || is_magnetic(corig)) {
+                field_type f = is_electric(corig) ? PE_stuff : PH_stuff;
+                for (polarization_state *pi = chunks[i]->pol[type(corig)]; pi; pi = pi->next)
+                  for (polarization_state *pj = chunks[j]->pol[type(c)]; pj; pj = pj->next)
+                    if (*pi->s == *pj->s) {
+                      polarization_state *po = NULL;
+                      if (pi->data && chunks[i]->is_mine())
+                        po = pi;
+                      else if (pj->data && chunks[j]->is_mine())
+                        po = pj;
+                      if (po) {
+                        const connect_phase iip = CONNECT_COPY;
+                        const size_t ni = po->s->num_internal_notowned_needed(corig, po->data);
+                        for (size_t k = 0; k < ni; ++k) {
+                          chunks[i]->connections[f][iip][Incoming][wh[f][iip][Incoming][j]++] =
+                              po->s->internal_notowned_ptr(k, corig, n, pi->data);
+                          chunks[j]->connections[f][iip][Outgoing][wh[f][iip][Outgoing][j]++] =
+                              po->s->internal_notowned_ptr(k, c, m, pj->data);
+                        }
+                        const size_t cni = po->s->num_cinternal_notowned_needed(corig, po->data);
+                        for (size_t k = 0; k < cni; ++k) {
+                          if (ip == CONNECT_PHASE)
+                            chunks[i]->connection_phases[f][wh[f][ip][Incoming][j] / 2] = thephase;
+                          DOCMP {
+                            chunks[i]->connections[f][ip][Incoming][wh[f][ip][Incoming][j]++] =
+                                po->s->cinternal_notowned_ptr(k, corig, cmp, n, pi->data);
+                            chunks[j]->connections[f][ip][Outgoing][wh[f][ip][Outgoing][j]++] =
+                                po->s->cinternal_notowned_ptr(k, c, cmp, m, pj->data);
                           }
                         }
                       }
-                } // is_electric(corig)
-              }   // if is_mine and owns...
-            }     // loop over j chunks
-        }         // LOOP_OVER_VOL_NOTOWNED
-    }             // FOR_COMPONENTS
-  }               // loop over i chunks
+                    }
+              } // is_electric(corig)
+            }   // if is_mine and owns...
+          }     // owner chunk j
+        }       // LOOP_OVER_VOL_NOTOWNED
+    }           // FOR_COMPONENTS
+  }             // loop over i chunks
   FOR_FIELD_TYPES(f) {
     for (int ip = 0; ip < 3; ip++)
       for (int io = 0; io < 2; io++)
@@ -553,6 +612,52 @@ void fields::connect_the_chunks() {
   delete[] B_redundant;
 }
 
+/* Find the connections between pairs of chunks that are both on this
+   process, which step_boundaries copies directly from one chunk's arrays to
+   the other's, without going through comm_blocks.  The starting indices
+   in the connections arrays follow the same ordering as in
+   connect_the_chunks: the Incoming connections of chunk i are ordered by
+   the source chunk j, and the Outgoing connections of chunk j by the
+   destination chunk i. */
+void fields::find_local_connections() {
+  size_t *outgoing = new size_t[3 * num_chunks];
+  FOR_FIELD_TYPES(ft) {
+    delete[] local_connections[ft];
+    local_connections[ft] = NULL;
+    num_local_connections[ft] = 0;
+    for (int pair = 0; pair < num_chunks * num_chunks; pair++)
+      if (comm_size_tot(ft, pair) > 0 && chunks[pair % num_chunks]->is_mine() &&
+          chunks[pair / num_chunks]->is_mine())
+        num_local_connections[ft]++;
+    if (num_local_connections[ft] == 0) continue;
+    local_connections[ft] = new local_connection[num_local_connections[ft]];
+
+    int nl = 0;
+    for (int n = 0; n < 3 * num_chunks; n++)
+      outgoing[n] = 0;
+    for (int i = 0; i < num_chunks; i++) {
+      size_t incoming[3] = {0, 0, 0};
+      for (int j = 0; j < num_chunks; j++) {
+        const int pair = j + i * num_chunks;
+        if (comm_size_tot(ft, pair) > 0 && chunks[i]->is_mine() && chunks[j]->is_mine()) {
+          local_connection &lc = local_connections[ft][nl++];
+          lc.i = i;
+          lc.j = j;
+          for (int ip = 0; ip < 3; ip++) {
+            lc.incoming[ip] = incoming[ip];
+            lc.outgoing[ip] = outgoing[ip * num_chunks + j];
+          }
+        }
+        for (int ip = 0; ip < 3; ip++) {
+          incoming[ip] += comm_sizes[ft][ip][pair];
+          outgoing[ip * num_chunks + j] += comm_sizes[ft][ip][pair];
+        }
+      }
+    }
+  }
+  delete[] outgoing;
+}
+
 void fields_chunk::alloc_extra_connections(field_type f, connect_phase ip, in_or_out io,
                                            size_t num) {
   if (num == 0) return; // No need to go to any bother...
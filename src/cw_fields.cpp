@@ -97,6 +97,46 @@ static void fieldop(const realnum *xr, realnum *yr, void *data_) {
   data->iters++;
 }
 
+/* Complex-shifted preconditioner: with U the time-step operator and
+   z0 = exp(-i omega dt), fieldop is A = (U - z0)/dt, which is singular
+   at the resonances of the structure.  Shifting z0 to z1 = (1 + shift) z0
+   is like solving at a complex frequency (adding loss), and
+
+      (U - z1)^{-1} dt = -(dt/z1) sum_k (U/z1)^k
+
+   converges geometrically since |U/z1| <= 1/(1 + shift).  We apply the
+   first nsteps terms of this series, which is a fixed linear operator. */
+typedef struct {
+  size_t n;
+  fields *f;
+  complex<double> z1;
+  int nsteps;
+  complex<realnum> *y; // scratch
+  int *iters;
+} precond_data;
+
+static void shifted_precond(const realnum *xr, realnum *yr, void *data_) {
+  const complex<realnum> *x = reinterpret_cast<const complex<realnum> *>(xr);
+  complex<realnum> *acc = reinterpret_cast<complex<realnum> *>(yr);
+  precond_data *data = (precond_data *)data_;
+  size_t n = data->n;
+  complex<realnum> *y = data->y;
+  complex<realnum> z1inv = complex<realnum>(1.0 / data->z1);
+  for (size_t i = 0; i < n; ++i)
+    acc[i] = y[i] = x[i];
+  for (int k = 1; k < data->nsteps; ++k) {
+    array_to_fields(y, *data->f);
+    data->f->step();
+    fields_to_array(*data->f, y);
+    for (size_t i = 0; i < n; ++i)
+      acc[i] += (y[i] *= z1inv);
+    (*data->iters)++;
+  }
+  complex<realnum> scale = complex<realnum>(-data->f->dt / data->z1);
+  for (size_t i = 0; i < n; ++i)
+    acc[i] *= scale;
+}
+
 /* Solve for the CW (constant frequency) field response at the given
    frequency to the sources (with amplitude given by the current sources
    at the current time).  The solver halts at a fractional convergence
@@ -106,13 +146,41 @@ static void fieldop(const realnum *xr, realnum *yr, void *data_) {
    The parameter L determines the order of the iterative algorithm
    that is used.  L should always be positive and should normally be
    >= 2.  Larger values of L will often lead to faster convergence, at
-   the expense of more memory and more work per iteration. */
-bool fields::solve_cw(double tol, int maxiters, complex<double> frequency, int L) {
+   the expense of more memory and more work per iteration.
+
+   If precond_steps > 1, the iterations are preconditioned by the
+   operator of a lossy problem (see shifted_precond above), applied
+   approximately with precond_steps - 1 time steps; precond_shift > 0
+   sets the loss (as the fractional growth of exp(-i omega dt)), and
+   larger shifts make the preconditioner converge faster but resemble
+   the actual problem less.  For high-Q problems this can reduce the
+   number of iterations by more than the extra time steps cost. */
+bool fields::solve_cw(double tol, int maxiters, complex<double> frequency, int L,
+                      int precond_steps, double precond_shift) {
+  bool ok = solve_cw_multi(tol, maxiters, &frequency, 1, L, NULL, NULL, precond_steps,
+                           precond_shift);
+  update_dfts();
+  return ok;
+}
+
+/* As solve_cw, but for each of the nfreqs frequencies in turn, calling
+   callback(this, i, callback_data) with the fields holding the solution at
+   freqs[i] (the DFT objects are not updated).  The workspace is allocated
+   once, and each solve starts from the previous solutions, extrapolated
+   linearly in frequency, which is usually much closer to the answer than
+   the fields a single solve_cw starts from.  Returns true if all solves
+   converged. */
+bool fields::solve_cw_multi(double tol, int maxiters, const complex<double> *freqs, size_t nfreqs,
+                            int L, solve_cw_callback callback, void *callback_data,
+                            int precond_steps, double precond_shift) {
   if (is_real) abort("solve_cw is incompatible with use_real_fields()");
   if (L < 1) abort("solve_cw called with L = %d < 1", L);
+  if (precond_steps > 1 && !(precond_shift > 0))
+    abort("solve_cw needs a positive precond_shift, not %g", precond_shift);
+  if (nfreqs == 0) return true;
   int tsave = t; // save time (gets incremented by iterations)
 
-  set_solve_cw_omega(2 * pi * frequency);
+  set_solve_cw_omega(2 * pi * freqs[0]);
 
   step(); // step once to make sure everything is allocated
 
@@ -135,64 +203,102 @@ bool fields::solve_cw(double tol, int maxiters, complex<double> frequency, int L
       }
     }
 
-  size_t nwork = (size_t)bicgstabL(L, N, 0, 0, 0, 0, tol, &maxiters, 0, true);
-  realnum *work = new realnum[nwork + 2 * N];
+  bicgstab_op M = precond_steps > 1 ? shifted_precond : NULL;
+  int maxiters0 = maxiters;
+  size_t nwork = (size_t)bicgstabL(L, N, 0, 0, 0, 0, tol, &maxiters, 0, true, M);
+  // workspace, x, b, previous solution, and preconditioner scratch
+  size_t nextra = nfreqs > 1 ? N : 0;
+  realnum *work = new realnum[nwork + 2 * N + nextra + (M ? N : 0)];
   complex<realnum> *x = reinterpret_cast<complex<realnum> *>(work + nwork);
   complex<realnum> *b = reinterpret_cast<complex<realnum> *>(work + nwork + N);
+  complex<realnum> *xprev = reinterpret_cast<complex<realnum> *>(work + nwork + 2 * N);
 
   fields_to_array(*this, x); // initial guess = initial fields
 
-  // get J amplitudes from current time step
-  zero_fields(); // note that we've saved the fields in x above
-  calc_sources(time());
-  step_source(B_stuff, true);
-  step_boundaries(B_stuff);
-  update_eh(H_stuff);
-  calc_sources(time() + 0.5 * dt);
-  step_source(D_stuff, true);
-  step_boundaries(D_stuff);
-  update_eh(E_stuff);
-  fields_to_array(*this, b);
-  double mdt_inv = -1.0 / dt;
-  for (size_t i = 0; i < N / 2; ++i)
-    b[i] *= mdt_inv;
-  {
-    double bmax = 0;
-    for (size_t i = 0; i < N / 2; ++i) {
-      double babs = abs(b[i]);
-      if (babs > bmax) bmax = babs;
+  bool ok = true;
+  for (size_t k = 0; k < nfreqs; ++k) {
+    complex<double> frequency = freqs[k];
+    if (k > 0) {
+      t = tsave;
+      set_solve_cw_omega(2 * pi * frequency);
+      step(); // same time (and hence source phase) as for the first frequency
+
+      // initial guess: linear extrapolation from the last two solutions
+      complex<realnum> s = 0;
+      if (k > 1 && freqs[k - 1] != freqs[k - 2])
+        s = complex<realnum>((frequency - freqs[k - 1]) / (freqs[k - 1] - freqs[k - 2]));
+      for (size_t i = 0; i < N / 2; ++i) {
+        complex<realnum> xk = x[i];
+        x[i] += s * (xk - xprev[i]);
+        xprev[i] = xk;
+      }
+    }
+
+    // get J amplitudes from current time step
+    zero_fields(); // note that we've saved the fields in x above
+    calc_sources(time());
+    step_source(B_stuff, true);
+    step_boundaries(B_stuff);
+    update_eh(H_stuff);
+    calc_sources(time() + 0.5 * dt);
+    step_source(D_stuff, true);
+    step_boundaries(D_stuff);
+    update_eh(E_stuff);
+    fields_to_array(*this, b);
+    double mdt_inv = -1.0 / dt;
+    for (size_t i = 0; i < N / 2; ++i)
+      b[i] *= mdt_inv;
+    {
+      double bmax = 0;
+      for (size_t i = 0; i < N / 2; ++i) {
+        double babs = abs(b[i]);
+        if (babs > bmax) bmax = babs;
+      }
+      if (max_to_all(bmax) == 0.0) abort("zero current amplitudes in solve_cw");
     }
-    if (max_to_all(bmax) == 0.0) abort("zero current amplitudes in solve_cw");
-  }
 
-  fieldop_data data;
-  data.f = this;
-  data.n = N / 2;
-  data.iomega = ((1.0 - exp(complex<double>(0., -1.) * (2 * pi * frequency) * dt)) * (1.0 / dt));
-  data.iters = 0;
+    fieldop_data data;
+    data.f = this;
+    data.n = N / 2;
+    data.iomega = ((1.0 - exp(complex<double>(0., -1.) * (2 * pi * frequency) * dt)) * (1.0 / dt));
+    data.iters = 0;
 
-  int ierr = (int)bicgstabL(L, N, reinterpret_cast<realnum *>(x), fieldop, &data,
-                            reinterpret_cast<realnum *>(b), tol, &maxiters, work, verbosity == 0);
+    precond_data pdata;
+    pdata.n = N / 2;
+    pdata.f = this;
+    pdata.z1 = (1 + precond_shift) * exp(complex<double>(0., -1.) * (2 * pi * frequency) * dt);
+    pdata.nsteps = precond_steps;
+    pdata.y = reinterpret_cast<complex<realnum> *>(work + nwork + 2 * N + nextra);
+    pdata.iters = &data.iters;
 
-  if (verbosity > 0) {
-    master_printf("Finished solve_cw after %d steps and %d CG iters.\n", data.iters, maxiters);
-    if (ierr) master_printf(" -- CONVERGENCE FAILURE (%d) in solve_cw!\n", ierr);
-  }
+    maxiters = maxiters0;
+    int ierr = (int)bicgstabL(L, N, reinterpret_cast<realnum *>(x), fieldop, &data,
+                              reinterpret_cast<realnum *>(b), tol, &maxiters, work,
+                              verbosity == 0, M, &pdata);
+
+    if (verbosity > 0) {
+      if (nfreqs > 1) master_printf("solve_cw at frequency %g: ", real(frequency));
+      master_printf("Finished solve_cw after %d steps and %d CG iters.\n", data.iters, maxiters);
+      if (ierr) master_printf(" -- CONVERGENCE FAILURE (%d) in solve_cw!\n", ierr);
+    }
+    if (ierr) ok = false;
 
-  array_to_fields(x, *this);
-  step(); // ensure H/B are updated and synced with E/D
+    array_to_fields(x, *this);
+    step(); // ensure H/B are updated and synced with E/D
+    t = tsave;
+
+    if (callback) callback(this, int(k), callback_data);
+  }
 
   delete[] work;
-  t = tsave;
 
   unset_solve_cw_omega();
-  update_dfts();
 
-  return !ierr;
+  return ok;
 }
 
 /* as solve_cw, but infers frequency from sources */
-bool fields::solve_cw(double tol, int maxiters, int L) {
+bool fields::solve_cw(double tol, int maxiters, int L, int precond_steps, double precond_shift) {
   complex<double> freq = 0.0;
   for (src_time *s = sources; s; s = s->next) {
     complex<double> sf = s->frequency();
@@ -201,7 +307,7 @@ bool fields::solve_cw(double tol, int maxiters, int L) {
     if (sf != 0.0) freq = sf;
   }
   if (freq == 0.0) abort("must pass frequency to solve_cw if sources do not specify one");
-  return solve_cw(tol, maxiters, freq, L);
+  return solve_cw(tol, maxiters, freq, L, precond_steps, precond_shift);
 }
 
 } // namespace meep
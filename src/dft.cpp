@@ -20,10 +20,19 @@
 #include <math.h>
 #include <string.h>
 #include <algorithm>
+#include <map>
 
 #include "meep.hpp"
 #include "meep_internals.hpp"
 
+#include "config.h"
+
+#if defined(HAVE_LIBFFTW)
+#include <fftw.h>
+#elif defined(HAVE_LIBFFTW3)
+#include <fftw3.h>
+#endif
+
 using namespace std;
 
 typedef complex<double> cdouble;
@@ -37,12 +46,29 @@ struct dft_chunk_data { // for passing to field::loop_in_chunks as void*
   int Nomega;
   complex<double> stored_weight, extra_weight;
   double dt_factor;
+  int decimation;
   bool include_dV_and_interp_weights;
   bool sqrt_dV_and_interp_weights;
+  bool lazy_averaging;
+  bool use_fft;
   bool empty_dim[5];
   dft_chunk *dft_chunks;
 };
 
+// DFT arrays of at least this many bytes go to the files of set_dft_storage_dir
+#define DFT_FILE_MIN_BYTES ((size_t)1 << 20)
+
+// a zeroed N x Nomega dft array, freed with array_free
+static complex<double> *new_dft_array(size_t n) {
+  const size_t nbytes = n * sizeof(complex<double>);
+  const char *dir = get_dft_storage_dir();
+  if (dir && nbytes >= DFT_FILE_MIN_BYTES) return (complex<double> *)array_malloc_file(nbytes, dir);
+  complex<double> *a = (complex<double> *)array_malloc(nbytes);
+  for (size_t i = 0; i < n; ++i)
+    a[i] = 0.0;
+  return a;
+}
+
 dft_chunk::dft_chunk(fields_chunk *fc_, ivec is_, ivec ie_, vec s0_, vec s1_, vec e0_, vec e1_,
                      double dV0_, double dV1_, component c_, bool use_centered_grid,
                      cdouble phase_factor, ivec shift_, const symmetry &S_, int sn_,
@@ -69,7 +95,8 @@ dft_chunk::dft_chunk(fields_chunk *fc_, ivec is_, ivec ie_, vec s0_, vec s1_, ve
 
   stored_weight = data->stored_weight;
   extra_weight = data->extra_weight;
-  scale = stored_weight * phase_factor * data->dt_factor;
+  decimation = data->decimation;
+  scale = stored_weight * phase_factor * (data->dt_factor * decimation);
 
   /* this is for e.g. computing E x H, where we don't want to
      multiply by the interpolation weights or the grid_volume twice. */
@@ -87,24 +114,82 @@ dft_chunk::dft_chunk(fields_chunk *fc_, ivec is_, ivec ie_, vec s0_, vec s1_, ve
   omega_min = data->omega_min;
   domega = data->domega;
   Nomega = data->Nomega;
-  dft_phase = new complex<realnum>[Nomega];
+  dft_phase = new complex<double>[Nomega];
 
   N = 1;
   LOOP_OVER_DIRECTIONS(is.dim, d) { N *= (ie.in_direction(d) - is.in_direction(d)) / 2 + 1; }
-  dft = new complex<realnum>[N * Nomega];
-  for (size_t i = 0; i < N * Nomega; ++i)
-    dft[i] = 0.0;
+  dft = new_dft_array(N * Nomega);
   for (int i = 0; i < 5; ++i)
     empty_dim[i] = data->empty_dim[i];
 
+  if (include_dV_and_interp_weights) {
+    weights = new double[N];
+    size_t idx_dft = 0;
+    LOOP_OVER_IVECS(fc->gv, is, ie, idx) {
+      (void)idx; // unused
+      double w = IVEC_LOOP_WEIGHT(s0, s1, e0, e1, dV0 + dV1 * loop_i2);
+      weights[idx_dft++] = sqrt_dV_and_interp_weights ? sqrt(w) : w;
+    }
+  }
+  else
+    weights = NULL;
+
+  dft_raw = NULL;
+  Nraw = 0;
+  ravg1 = ravg2 = 0;
+  raw_pending = false;
+  use_fft = data->use_fft;
+  ts_count = 0;
+  ts_numcmp = 0;
+  ts_t0 = ts_dt = 0;
+  if (!use_fft && data->lazy_averaging && (avg1 || weights)) {
+    // extend ie by one point in each averaging direction, in the same order
+    // as yee2cent_offsets, and find the corresponding strides of the raw box
+    const grid_volume &gv = fc->gv;
+    ie_raw = ie;
+    LOOP_OVER_DIRECTIONS(gv.dim, d) {
+      if (avg1 && !gv.iyee_shift(c).in_direction(d))
+        ie_raw.set_direction(d, ie.in_direction(d) + 2);
+    }
+    ptrdiff_t rn[3], rs[3];
+    for (int k = 0; k < 3; ++k)
+      rn[k] = (ie_raw.yucky_val(k) - is.yucky_val(k)) / 2 + 1;
+    rs[2] = 1;
+    rs[1] = rn[2];
+    rs[0] = rn[1] * rn[2];
+    Nraw = rn[0] * rs[0];
+    if (avg1) LOOP_OVER_DIRECTIONS(gv.dim, d) {
+        if (gv.iyee_shift(c).in_direction(d)) continue;
+        for (int k = 0; k < 3; ++k)
+          if (gv.yucky_direction(k) == d) (ravg1 ? ravg2 : ravg1) = rs[k];
+      }
+    dft_raw = new complex<double>[Nraw * Nomega];
+    for (size_t i = 0; i < Nraw * Nomega; ++i)
+      dft_raw[i] = 0.0;
+  }
+  fbuf = new double[2 * (dft_raw ? Nraw : N)];
+
+  dft_owner = NULL;
+  modified = false;
+  for (dft_chunk *cur = fc->dft_chunks; cur; cur = cur->next_in_chunk)
+    if (!cur->dft_owner && !cur->modified && same_accumulation(*cur)) {
+      array_free(dft);
+      dft = cur->dft;
+      dft_owner = cur;
+      break;
+    }
+
   next_in_chunk = fc->dft_chunks;
   fc->dft_chunks = this;
   next_in_dft = data->dft_chunks;
 }
 
 dft_chunk::~dft_chunk() {
-  delete[] dft;
+  if (!dft_owner && !hand_off_dft()) array_free(dft);
   delete[] dft_phase;
+  delete[] weights;
+  delete[] fbuf;
+  delete[] dft_raw;
 
   // delete from fields_chunk list
   dft_chunk *cur = fc->dft_chunks;
@@ -117,6 +202,15 @@ dft_chunk::~dft_chunk() {
   }
 }
 
+double dft_chunk::memory_usage() const {
+  double bytes = Nomega * sizeof(complex<double>); // dft_phase
+  if (!dft_owner) bytes += N * Nomega * sizeof(complex<double>);
+  if (dft_raw) bytes += Nraw * Nomega * sizeof(complex<double>);
+  if (weights) bytes += N * sizeof(double);
+  if (fbuf) bytes += 2 * (dft_raw ? Nraw : N) * sizeof(double);
+  return bytes + ts_data.capacity() * sizeof(double);
+}
+
 void dft_flux::remove() {
   while (E) {
     dft_chunk *nxt = E->next_in_dft;
@@ -171,8 +265,11 @@ dft_chunk *fields::add_dft(component c, const volume &where, double freq_min, do
   data.stored_weight = stored_weight;
   data.extra_weight = extra_weight;
   data.dt_factor = dt / sqrt(2.0 * pi);
+  data.decimation = decimate_dfts ? dft_decimation(freq_max) : 1;
   data.include_dV_and_interp_weights = include_dV_and_interp_weights;
   data.sqrt_dV_and_interp_weights = sqrt_dV_and_interp_weights;
+  data.lazy_averaging = lazy_dft_averaging;
+  data.use_fft = fft_dfts;
   data.empty_dim[0] = data.empty_dim[1] = data.empty_dim[2] = data.empty_dim[3] =
       data.empty_dim[4] = false;
   LOOP_OVER_DIRECTIONS(where.dim, d) { data.empty_dim[d] = where.in_direction(d) == 0; }
@@ -200,64 +297,541 @@ dft_chunk *fields::add_dft_pt(component c, const vec &where, double freq_min, do
   return add_dft(c, where, freq_min, freq_max, Nfreq, false);
 }
 
+/* The dft_chunks of all the chunks are independent (each updates only
+   its own arrays; chunks sharing an array are skipped), so they are
+   updated in parallel.  The work per dft_chunk is very uneven (monitors
+   live in a few chunks, with varying sizes and frequency counts), so the
+   flattened list of dft_chunks is scheduled dynamically, one at a time.
+   As for the other loops over chunks, the threads are only used here when
+   parallel_chunk_loops() prefers threading over chunks. */
 void fields::update_dfts() {
   am_now_working_on(FourierTransforming);
+  double hw_start[MEEP_MAX_HW_COUNTERS + 1];
+  hw_phase_begin(hw_start);
+  vector<dft_chunk *> items;
+  vector<int> item_chunk;
   for (int i = 0; i < num_chunks; i++)
-    if (chunks[i]->is_mine()) chunks[i]->update_dfts(time(), time() - 0.5 * dt);
+    if (chunks[i]->is_mine() && !chunks[i]->doing_solve_cw)
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur; cur = cur->next_in_chunk)
+        if (!cur->dft_owner && t % cur->decimation == 0) {
+          items.push_back(cur);
+          item_chunk.push_back(i);
+        }
+
+  // update_dft may transform the time series recorded so far, and the FFTW
+  // planner must not run in the threads
+  for (size_t k = 0; k < items.size(); ++k)
+    items[k]->plan_time_series();
+
+  const double timeE = time(), timeH = time() - 0.5 * dt;
+  vector<double> item_time(items.size());
+  const bool thread_chunks = parallel_chunk_loops();
+  (void)thread_chunks; // unused without OpenMP
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic, 1) if (thread_chunks)
+#endif
+  for (ptrdiff_t k = 0; k < ptrdiff_t(items.size()); ++k) {
+    const double t0 = wall_time();
+    items[k]->update_dft(is_magnetic(items[k]->c) ? timeH : timeE);
+    item_time[k] = wall_time() - t0;
+  }
+  for (size_t k = 0; k < items.size(); ++k) {
+    chunks[item_chunk[k]]->cost_time += item_time[k];
+    chunks[item_chunk[k]]->phase_time[StepDFTs] += item_time[k];
+  }
+  hw_phase_end(hw_start, StepDFTs);
   finished_working();
 }
 
-void fields_chunk::update_dfts(double timeE, double timeH) {
-  if (doing_solve_cw) return;
-  for (dft_chunk *cur = dft_chunks; cur; cur = cur->next_in_chunk) {
-    cur->update_dft(is_magnetic(cur->c) ? timeH : timeE);
+/* The DFT checkpoint holds the dft arrays of all the dft_chunks, in chunk
+   order and then in the order of each chunk's dft_chunks list, so it can be
+   loaded into fields to which the same DFTs were added in the same order
+   (e.g. by rerunning the same script).  Chunks sharing another chunk's array
+   are skipped, since the sharing is set up again when the DFTs are added. */
+static size_t my_dft_checkpoint_size(fields_chunk **chunks, int num_chunks) {
+  size_t n = 0;
+  for (int i = 0; i < num_chunks; i++)
+    if (chunks[i]->is_mine())
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur; cur = cur->next_in_chunk)
+        if (!cur->dft_owner) n += cur->N * cur->Nomega * 2;
+  return n;
+}
+
+// write the "dft" dataset of the checkpoint (also used by fields::dump)
+void fields::dump_dfts(h5file *file) {
+  for (int i = 0; i < num_chunks; i++)
+    if (chunks[i]->is_mine())
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur; cur = cur->next_in_chunk)
+        cur->flush_dft();
+  size_t my_n = my_dft_checkpoint_size(chunks, num_chunks);
+  size_t my_start = partial_sum_to_all(my_n) - my_n;
+  size_t ntotal = sum_to_all(my_n);
+  if (!ntotal) return;
+  file->create_data("dft", 1, &ntotal, false, false);
+  for (int i = 0; i < num_chunks; i++)
+    if (chunks[i]->is_mine())
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur; cur = cur->next_in_chunk)
+        if (!cur->dft_owner) {
+          size_t Nchunk = cur->N * cur->Nomega * 2;
+          file->write_chunk(1, &my_start, &Nchunk, (double *)cur->dft);
+          my_start += Nchunk;
+        }
+  file->done_writing_chunks();
+  file->prevent_deadlock(); // hackery
+}
+
+void fields::load_dfts(h5file *file) {
+  size_t my_n = my_dft_checkpoint_size(chunks, num_chunks);
+  size_t my_start = partial_sum_to_all(my_n) - my_n;
+  size_t ntotal = sum_to_all(my_n);
+  if (!ntotal) return;
+  int file_rank;
+  size_t file_dims = 0;
+  file->read_size("dft", &file_rank, &file_dims, 1);
+  if (file_rank != 1 || file_dims != ntotal)
+    abort("DFT checkpoint %s does not match the DFTs (%zd vs. %zd)", file->file_name(), file_dims,
+          ntotal);
+  for (int i = 0; i < num_chunks; i++)
+    if (chunks[i]->is_mine())
+      for (dft_chunk *cur = chunks[i]->dft_chunks; cur; cur = cur->next_in_chunk)
+        if (!cur->dft_owner) {
+          size_t Nchunk = cur->N * cur->Nomega * 2;
+          file->read_chunk(1, &my_start, &Nchunk, (double *)cur->dft);
+          cur->discard_pending(); // superseded by the loaded dft
+          cur->modified = true;
+          my_start += Nchunk;
+        }
+  file->prevent_deadlock(); // hackery
+}
+
+void fields::save_dft_checkpoint(const char *filename) {
+  // write to a temporary file that replaces the old checkpoint only once it
+  // is complete, so that a job killed while writing still has the old one
+  char *tmpname = new char[strlen(filename) + 5];
+  sprintf(tmpname, "%s.tmp", filename);
+  if (verbosity > 0)
+    master_printf("saving DFT checkpoint \"%s\" at time step %d...\n", filename, t);
+  {
+    h5file file(tmpname, h5file::WRITE, true);
+    size_t zero = 0, one = 1;
+    double tstep = t;
+    file.create_data("t", 1, &one);
+    if (am_master()) file.write_chunk(1, &zero, &one, &tstep);
+    file.prevent_deadlock(); // hackery
+    dump_dfts(&file);
+  }
+  all_wait();
+  if (am_master() && rename(tmpname, filename))
+    abort("error renaming DFT checkpoint %s to %s", tmpname, filename);
+  delete[] tmpname;
+  all_wait();
+}
+
+int fields::load_dft_checkpoint(const char *filename) {
+  h5file file(filename, h5file::READONLY, true);
+  int file_rank;
+  size_t file_dims = 0, zero = 0, one = 1;
+  double tstep;
+  file.read_size("t", &file_rank, &file_dims, 1);
+  if (file_rank != 1 || file_dims != 1) abort("invalid DFT checkpoint %s", filename);
+  file.read_chunk(1, &zero, &one, &tstep);
+  file.prevent_deadlock(); // hackery
+  load_dfts(&file);
+  return int(tstep);
+}
+
+void fields::checkpoint_dfts(const char *filename, double interval) {
+  delete[] dft_checkpoint_fname;
+  dft_checkpoint_fname = NULL;
+  if (filename) {
+    dft_checkpoint_fname = new char[strlen(filename) + 1];
+    strcpy(dft_checkpoint_fname, filename);
+  }
+  dft_checkpoint_interval = interval;
+  last_dft_checkpoint_wall_time = wall_time();
+}
+
+/* Sampling every k-th step, spectral content at f' aliases to f' + m/(k dt).
+   For linear media the fields contain only the frequencies of the sources,
+   |f'| <= fsrc, so nothing aliases into a monitor band below freq_max as
+   long as 1/(k dt) > freq_max + fsrc, and the decimated sum (times k) is
+   then the same DFT, provided the fields have decayed by the end of the
+   run (truncating them is broadband).  Sources of unknown bandwidth,
+   nonlinear media and noisy susceptibilities (broadband content) disable
+   decimation.  Sources added after the DFT are not taken into account. */
+int fields::dft_decimation(double freq_max) {
+  double fsrc = 0;
+  for (src_time *s = sources; s; s = s->next)
+    fsrc = std::max(fsrc, s->max_frequency());
+
+  bool broadband = false;
+  for (int i = 0; i < num_chunks; i++)
+    if (chunks[i]->is_mine()) {
+      structure_chunk *s = chunks[i]->s;
+      FOR_COMPONENTS(c) {
+        if (s->chi2[c] || s->chi3[c]) broadband = true;
+      }
+      FOR_FIELD_TYPES(ft) {
+        for (susceptibility *chi = s->chiP[ft]; chi; chi = chi->next)
+          if (dynamic_cast<noisy_lorentzian_susceptibility *>(chi)) broadband = true;
+      }
+    }
+  if (or_to_all(broadband) || !sources || fsrc == infinity) return 1;
+
+  const double k = 1.0 / (dt * (fabs(freq_max) + fsrc));
+  return k < 1 ? 1 : int(k);
+}
+
+// number of frequencies accumulated per pass over the points, chosen so that
+// the block of dft_phase stays in L1 while the dft rows stream through
+#define DFT_OMEGA_BLOCK 64
+// bytes of dft rows per tile of points, small enough to stay in L2 during
+// the passes of the frequency blocks over the tile
+#define DFT_TILE_BYTES ((size_t)256 * 1024)
+
+/* Accumulate the outer product of the N field values f (real parts, then
+   imaginary parts if numcmp == 2) with the Nomega phases into d, a tile of
+   points and a block of frequencies at a time, so that the dft array is
+   streamed through memory (or from its file, see set_dft_storage_dir)
+   once and in order.  The complex arithmetic is written out on the
+   interleaved re/im doubles so that the inner loop vectorizes
+   (complex<double> multiplication does not without -ffast-math). */
+static void accumulate_dft(complex<double> *dft, const complex<double> *dft_phase,
+                           const double *f, size_t N, int Nomega, int numcmp) {
+  const double *phase = reinterpret_cast<const double *>(dft_phase);
+  double *d = reinterpret_cast<double *>(dft);
+  const double *fi = f + N;
+  const size_t tile =
+      std::max(DFT_TILE_BYTES / (std::max(Nomega, 1) * sizeof(complex<double>)), (size_t)1);
+  for (size_t n0 = 0; n0 < N; n0 += tile) {
+    const size_t n1 = std::min(n0 + tile, N);
+    for (int i0 = 0; i0 < Nomega; i0 += DFT_OMEGA_BLOCK) {
+      const int i1 = i0 + DFT_OMEGA_BLOCK < Nomega ? i0 + DFT_OMEGA_BLOCK : Nomega;
+      if (numcmp == 2) {
+        for (size_t n = n0; n < n1; ++n) {
+          const double fr = f[n], fim = fi[n];
+          double *dn = d + 2 * (Nomega * n);
+          for (int i = i0; i < i1; ++i) {
+            dn[2 * i] += phase[2 * i] * fr - phase[2 * i + 1] * fim;
+            dn[2 * i + 1] += phase[2 * i] * fim + phase[2 * i + 1] * fr;
+          }
+        }
+      }
+      else {
+        for (size_t n = n0; n < n1; ++n) {
+          const double fr = f[n];
+          double *dn = d + 2 * (Nomega * n);
+          for (int i = 2 * i0; i < 2 * i1; ++i)
+            dn[i] += phase[i] * fr;
+        }
+      }
+    }
   }
 }
 
 void dft_chunk::update_dft(double time) {
   if (!fc->f[c][0]) return;
+  modified = true;
 
   for (int i = 0; i < Nomega; ++i)
     dft_phase[i] = polar(1.0, (omega_min + i * domega) * time) * scale;
 
-  int numcmp = fc->f[c][1] ? 2 : 1;
+  const int numcmp = fc->f[c][1] ? 2 : 1;
 
-  size_t idx_dft = 0;
-  LOOP_OVER_IVECS(fc->gv, is, ie, idx) {
-    double w;
-    if (include_dV_and_interp_weights) {
-      w = IVEC_LOOP_WEIGHT(s0, s1, e0, e1, dV0 + dV1 * loop_i2);
-      if (sqrt_dV_and_interp_weights) w = sqrt(w);
+  if (dft_raw) { // lazy averaging: transform the raw samples, see flush_dft
+    for (int cmp = 0; cmp < numcmp; ++cmp) {
+      const realnum *fcmp = fc->f[c][cmp];
+      double *fb = fbuf + cmp * Nraw;
+      size_t idx_raw = 0;
+      LOOP_OVER_IVECS(fc->gv, is, ie_raw, idx) { fb[idx_raw++] = fcmp[idx]; }
     }
-    else
-      w = 1.0;
-    double f[2]; // real/imag field value at epsilon point
-    if (avg2)
-      for (int cmp = 0; cmp < numcmp; ++cmp)
-        f[cmp] = (w * 0.25) * (fc->f[c][cmp][idx] + fc->f[c][cmp][idx + avg1] +
-                               fc->f[c][cmp][idx + avg2] + fc->f[c][cmp][idx + (avg1 + avg2)]);
-    else if (avg1)
-      for (int cmp = 0; cmp < numcmp; ++cmp)
-        f[cmp] = (w * 0.5) * (fc->f[c][cmp][idx] + fc->f[c][cmp][idx + avg1]);
-    else
-      for (int cmp = 0; cmp < numcmp; ++cmp)
-        f[cmp] = w * fc->f[c][cmp][idx];
+    accumulate_dft(dft_raw, dft_phase, fbuf, Nraw, Nomega, numcmp);
+    raw_pending = true;
+    return;
+  }
 
-    if (numcmp == 2) {
-      complex<realnum> fc(f[0], f[1]);
-      for (int i = 0; i < Nomega; ++i)
-        dft[Nomega * idx_dft + i] += dft_phase[i] * fc;
+  // first gather the averaged, weighted field values into fbuf...
+  for (int cmp = 0; cmp < numcmp; ++cmp) {
+    const realnum *fcmp = fc->f[c][cmp];
+    double *fb = fbuf + cmp * N;
+    size_t idx_dft = 0;
+    if (avg2) {
+      LOOP_OVER_IVECS(fc->gv, is, ie, idx) {
+        fb[idx_dft++] =
+            0.25 * (fcmp[idx] + fcmp[idx + avg1] + fcmp[idx + avg2] + fcmp[idx + (avg1 + avg2)]);
+      }
+    }
+    else if (avg1) {
+      LOOP_OVER_IVECS(fc->gv, is, ie, idx) { fb[idx_dft++] = 0.5 * (fcmp[idx] + fcmp[idx + avg1]); }
     }
     else {
-      realnum fr = f[0];
-      for (int i = 0; i < Nomega; ++i)
-        dft[Nomega * idx_dft + i] += dft_phase[i] * fr;
+      LOOP_OVER_IVECS(fc->gv, is, ie, idx) { fb[idx_dft++] = fcmp[idx]; }
+    }
+    if (weights)
+      for (size_t n = 0; n < N; ++n)
+        fb[n] *= weights[n];
+  }
+
+  if (use_fft) { // record the sample, to be transformed by flush_dft
+    // a new series starts if the sampling is not uniform (or the fields
+    // became complex), so transform what we have so far
+    if (ts_count &&
+        (numcmp != ts_numcmp ||
+         (ts_count > 1 && fabs(time - (ts_t0 + ts_count * ts_dt)) > 1e-6 * ts_dt) ||
+         (ts_count == 1 && time <= ts_t0)))
+      transform_time_series();
+    if (ts_count == 0) {
+      ts_t0 = time;
+      ts_numcmp = numcmp;
+    }
+    else if (ts_count == 1)
+      ts_dt = time - ts_t0;
+    ts_data.insert(ts_data.end(), fbuf, fbuf + numcmp * N);
+    ts_count++;
+    return;
+  }
+
+  // ...then accumulate them over the frequencies
+  accumulate_dft(dft, dft_phase, fbuf, N, Nomega, numcmp);
+}
+
+/* The FFTW planner is not thread-safe (and planning every transform is
+   wasteful), so there is one cached in-place plan per length and sign,
+   executed on each array.  fields::update_dfts creates the plans that
+   update_dft may need before its threaded loop (see plan_time_series). */
+#if defined(HAVE_LIBFFTW) || defined(HAVE_LIBFFTW3)
+typedef fftw_plan fft_plan;
+static map<pair<size_t, int>, fftw_plan> fft_plans;
+#else
+typedef void *fft_plan; // the radix-2 fallback needs no plan
+#endif
+
+static fft_plan get_fft_plan(size_t n, int sign) {
+  fft_plan p = NULL;
+#if defined(HAVE_LIBFFTW) || defined(HAVE_LIBFFTW3)
+#ifdef HAVE_OPENMP
+#pragma omp critical(meep_fftw_planner)
+#endif
+  {
+    fftw_plan &cached = fft_plans[make_pair(n, sign)];
+    if (!cached) {
+#if defined(HAVE_LIBFFTW)
+      cached = fftw_create_plan(int(n), sign < 0 ? FFTW_FORWARD : FFTW_BACKWARD,
+                                FFTW_ESTIMATE | FFTW_IN_PLACE);
+#else
+      // FFTW_ESTIMATE does not touch the array; FFTW_UNALIGNED lets the
+      // plan run on any array with fftw_execute_dft
+      vector<complex<double> > a(n);
+      fftw_complex *pa = reinterpret_cast<fftw_complex *>(&a[0]);
+      cached = fftw_plan_dft_1d(int(n), pa, pa, sign < 0 ? FFTW_FORWARD : FFTW_BACKWARD,
+                                FFTW_ESTIMATE | FFTW_UNALIGNED);
+#endif
+    }
+    p = cached;
+  }
+#else
+  (void)n;
+  (void)sign;
+#endif
+  return p;
+}
+
+/* in-place FFT of length n (a power of 2), with exp(sign * 2 pi i jk/n),
+   using the plan p = get_fft_plan(n, sign) */
+static void fft_inplace(fft_plan p, complex<double> *a, size_t n, int sign) {
+#if defined(HAVE_LIBFFTW)
+  (void)n;
+  (void)sign;
+  fftw_one(p, reinterpret_cast<fftw_complex *>(a), NULL);
+#elif defined(HAVE_LIBFFTW3)
+  (void)n;
+  (void)sign;
+  fftw_execute_dft(p, reinterpret_cast<fftw_complex *>(a), reinterpret_cast<fftw_complex *>(a));
+#else
+  (void)p;
+  // iterative radix-2 Cooley-Tukey
+  for (size_t i = 1, j = 0; i < n; ++i) {
+    size_t bit = n >> 1;
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+    if (i < j) swap(a[i], a[j]);
+  }
+  for (size_t len = 2; len <= n; len <<= 1) {
+    const complex<double> wlen = polar(1.0, sign * 2 * pi / len);
+    for (size_t i = 0; i < n; i += len) {
+      complex<double> w = 1.0;
+      for (size_t j = 0; j < len / 2; ++j) {
+        const complex<double> u = a[i + j], v = a[i + j + len / 2] * w;
+        a[i + j] = u + v;
+        a[i + j + len / 2] = u - v;
+        w *= wlen;
+      }
+    }
+  }
+#endif
+}
+
+// exp(i theta n^2 / 2), with the phase reduced in extended precision
+static complex<double> chirp(double theta, size_t n) {
+  const long double ph = fmodl(0.5L * theta * (long double)n * (long double)n, 2 * (long double)pi);
+  return polar(1.0, double(ph));
+}
+
+// the FFT length of the chirp-z transform of Ns samples to M frequencies
+static size_t time_series_fft_length(size_t Ns, size_t M) {
+  size_t L = 1;
+  while (L < Ns + M - 1)
+    L *= 2;
+  return L;
+}
+
+// create the FFT plans of transform_time_series, see get_fft_plan
+void dft_chunk::plan_time_series() const {
+  if (!use_fft || ts_count == 0) return;
+  const size_t L = time_series_fft_length(ts_count, Nomega);
+  get_fft_plan(L, -1);
+  get_fft_plan(L, +1);
+}
+
+/* Adds scale * sum_n a_n exp(i omega_k t_n), t_n = ts_t0 + n ts_dt, to dft
+   for every point and frequency omega_k = omega_min + k domega, using
+   Bluestein's chirp-z algorithm: with theta = domega ts_dt,
+   kn = (k^2 + n^2 - (k-n)^2) / 2 turns the sum over n into a convolution
+   with the chirp exp(-i theta m^2 / 2), computed by FFTs of length L. */
+void dft_chunk::transform_time_series() const {
+  const size_t Ns = ts_count, M = Nomega;
+  if (Ns == 0) return;
+  const double h = Ns > 1 ? ts_dt : 0.0, theta = domega * h;
+  const size_t L = time_series_fft_length(Ns, M);
+  const fft_plan forward = get_fft_plan(L, -1), backward = get_fft_plan(L, +1);
+
+  // transformed convolution kernel, shared by all the points
+  vector<complex<double> > V(L, 0.0);
+  for (size_t k = 0; k < M; ++k)
+    V[k] = conj(chirp(theta, k));
+  for (size_t n = 1; n < Ns; ++n)
+    V[L - n] = conj(chirp(theta, n));
+  fft_inplace(forward, &V[0], L, -1);
+
+  vector<complex<double> > pre(Ns), post(M);
+  for (size_t n = 0; n < Ns; ++n)
+    pre[n] = polar(1.0, fmod(omega_min * h * n, 2 * pi)) * chirp(theta, n);
+  for (size_t k = 0; k < M; ++k)
+    post[k] = polar(1.0, (omega_min + k * domega) * ts_t0) * chirp(theta, k) * (scale / double(L));
+
+  vector<complex<double> > y(L);
+  const size_t stride = ts_numcmp * N;
+  for (size_t p = 0; p < N; ++p) {
+    for (size_t n = 0; n < Ns; ++n) {
+      const double *s = &ts_data[n * stride];
+      y[n] = pre[n] * complex<double>(s[p], ts_numcmp == 2 ? s[N + p] : 0.0);
     }
+    for (size_t n = Ns; n < L; ++n)
+      y[n] = 0.0;
+    fft_inplace(forward, &y[0], L, -1);
+    for (size_t n = 0; n < L; ++n)
+      y[n] *= V[n];
+    fft_inplace(backward, &y[0], L, +1);
+    for (size_t k = 0; k < M; ++k)
+      dft[Nomega * p + k] += y[k] * post[k];
+  }
+
+  ts_data.clear();
+  ts_count = 0;
+}
+
+/* Since averaging and weighting commute with the Fourier sum, with lazy
+   averaging they are applied here, once per read of the DFT rather than
+   once per step: the averaged, weighted dft_raw is added into dft and
+   dft_raw is reset.  This does not change the value the chunk represents,
+   hence const; every reader of dft must call it first. */
+void dft_chunk::flush_dft() const {
+  if (dft_owner) {
+    dft_owner->flush_dft();
+    return;
+  }
+  transform_time_series();
+  if (!raw_pending) return;
+  const double a = avg2 ? 0.25 : (avg1 ? 0.5 : 1.0);
+  const ptrdiff_t rn2 = (ie_raw.yucky_val(1) - is.yucky_val(1)) / 2 + 1;
+  const ptrdiff_t rn3 = (ie_raw.yucky_val(2) - is.yucky_val(2)) / 2 + 1;
+  size_t idx_dft = 0;
+  LOOP_OVER_IVECS(fc->gv, is, ie, idx) {
+    (void)idx; // unused
+    const complex<double> *r = dft_raw + Nomega * ((loop_i1 * rn2 + loop_i2) * rn3 + loop_i3);
+    complex<double> *d = dft + Nomega * idx_dft;
+    const double w = weights ? a * weights[idx_dft] : a;
+    if (ravg2)
+      for (int i = 0; i < Nomega; ++i)
+        d[i] += w * (r[i] + r[Nomega * ravg1 + i] + r[Nomega * ravg2 + i] +
+                     r[Nomega * (ravg1 + ravg2) + i]);
+    else if (ravg1)
+      for (int i = 0; i < Nomega; ++i)
+        d[i] += w * (r[i] + r[Nomega * ravg1 + i]);
+    else
+      for (int i = 0; i < Nomega; ++i)
+        d[i] += w * r[i];
     idx_dft++;
   }
+  for (size_t i = 0; i < Nraw * Nomega; ++i)
+    dft_raw[i] = 0.0;
+  raw_pending = false;
+}
+
+bool dft_chunk::same_accumulation(const dft_chunk &o) const {
+  if (use_fft || o.use_fft || dft_raw || o.dft_raw) return false;
+  if (c != o.c || !(is == o.is) || !(ie == o.ie) || avg1 != o.avg1 || avg2 != o.avg2) return false;
+  if (Nomega != o.Nomega || omega_min != o.omega_min || domega != o.domega || scale != o.scale ||
+      decimation != o.decimation)
+    return false;
+  if (include_dV_and_interp_weights != o.include_dV_and_interp_weights ||
+      sqrt_dV_and_interp_weights != o.sqrt_dV_and_interp_weights)
+    return false;
+  return !include_dV_and_interp_weights || (s0 == o.s0 && s1 == o.s1 && e0 == o.e0 &&
+                                            e1 == o.e1 && dV0 == o.dV0 && dV1 == o.dV1);
+}
+
+// pass our dft array to the chunks sharing it, returning whether there were any
+bool dft_chunk::hand_off_dft() {
+  dft_chunk *heir = NULL;
+  for (dft_chunk *cur = fc->dft_chunks; cur; cur = cur->next_in_chunk)
+    if (cur->dft_owner == this) {
+      if (!heir) {
+        heir = cur;
+        cur->dft_owner = NULL;
+        cur->modified = modified;
+      }
+      else
+        cur->dft_owner = heir;
+    }
+  return heir != NULL;
+}
+
+void dft_chunk::unshare() {
+  if (dft_owner) dft_owner->flush_dft();
+  if (dft_owner || hand_off_dft()) {
+    complex<double> *d = new_dft_array(N * Nomega);
+    for (size_t i = 0; i < N * Nomega; ++i)
+      d[i] = dft[i];
+    dft = d;
+    dft_owner = NULL;
+  }
+  modified = true; // the callers are about to change dft
+}
+
+void dft_chunk::discard_pending() {
+  if (raw_pending)
+    for (size_t i = 0; i < Nraw * Nomega; ++i)
+      dft_raw[i] = 0.0;
+  raw_pending = false;
+  ts_data.clear();
+  ts_count = 0;
 }
 
 void dft_chunk::scale_dft(complex<double> scale) {
+  unshare();
+  flush_dft();
   for (size_t i = 0; i < N * Nomega; ++i)
     dft[i] *= scale;
   if (next_in_dft) next_in_dft->scale_dft(scale);
@@ -266,6 +840,9 @@ void dft_chunk::scale_dft(complex<double> scale) {
 void dft_chunk::operator-=(const dft_chunk &chunk) {
   if (c != chunk.c || N * Nomega != chunk.N * chunk.Nomega)
     abort("Mismatched chunks in dft_chunk::operator-=");
+  unshare();
+  flush_dft();
+  chunk.flush_dft();
 
   for (size_t i = 0; i < N * Nomega; ++i)
     dft[i] -= chunk.dft[i];
@@ -298,7 +875,8 @@ void save_dft_hdf5(dft_chunk *dft_chunks, const char *name, h5file *file, const
 
   for (dft_chunk *cur = dft_chunks; cur; cur = cur->next_in_dft) {
     size_t Nchunk = cur->N * cur->Nomega * 2;
-    file->write_chunk(1, &istart, &Nchunk, (realnum *)cur->dft);
+    cur->flush_dft();
+    file->write_chunk(1, &istart, &Nchunk, (double *)cur->dft);
     istart += Nchunk;
   }
   file->done_writing_chunks();
@@ -326,7 +904,9 @@ void load_dft_hdf5(dft_chunk *dft_chunks, const char *name, h5file *file, const
 
   for (dft_chunk *cur = dft_chunks; cur; cur = cur->next_in_dft) {
     size_t Nchunk = cur->N * cur->Nomega * 2;
-    file->read_chunk(1, &istart, &Nchunk, (realnum *)cur->dft);
+    cur->unshare();
+    file->read_chunk(1, &istart, &Nchunk, (double *)cur->dft);
+    cur->discard_pending(); // superseded by the loaded dft
     istart += Nchunk;
   }
 }
@@ -362,16 +942,92 @@ double *dft_flux::flux() {
   for (int i = 0; i < Nfreq; ++i)
     F[i] = 0;
   for (dft_chunk *curE = E, *curH = H; curE && curH;
-       curE = curE->next_in_dft, curH = curH->next_in_dft)
+       curE = curE->next_in_dft, curH = curH->next_in_dft) {
+    curE->flush_dft();
+    curH->flush_dft();
     for (size_t k = 0; k < curE->N; ++k)
       for (int i = 0; i < Nfreq; ++i)
         F[i] += real(curE->dft[k * Nfreq + i] * conj(curH->dft[k * Nfreq + i]));
+  }
   double *Fsum = new double[Nfreq];
   sum_to_all(F, Fsum, Nfreq);
   delete[] F;
   return Fsum;
 }
 
+dft_convergence_check::dft_convergence_check(double dt, double tol)
+    : dt(dt), tol(tol), t0(0), change(infinity), num_converged(0) {}
+
+void dft_convergence_check::add_flux(const dft_flux &flux) {
+  monitor m = {flux.E, flux.H, flux.Nfreq};
+  monitors.push_back(m);
+  last.clear();
+}
+
+void dft_convergence_check::add_chunks(dft_chunk *chunks) {
+  // the number of frequencies must be known on every process, even
+  // those without any of the chunks
+  monitor m = {chunks, NULL, max_to_all(chunks ? chunks->Nomega : 0)};
+  monitors.push_back(m);
+  last.clear();
+}
+
+bool dft_convergence_check::do_check(fields &f) {
+  if (f.round_time() < t0 + dt) return false;
+  t0 = f.round_time();
+
+  size_t total = 0;
+  for (size_t m = 0; m < monitors.size(); ++m)
+    total += monitors[m].Nfreq;
+  if (total == 0) return false;
+  std::vector<double> mine(total, 0.0), cur(total);
+  size_t offset = 0;
+  for (size_t m = 0; m < monitors.size(); ++m) {
+    const int Nfreq = monitors[m].Nfreq;
+    double *F = &mine[offset];
+    if (monitors[m].H)
+      for (dft_chunk *curE = monitors[m].E, *curH = monitors[m].H; curE && curH;
+           curE = curE->next_in_dft, curH = curH->next_in_dft) {
+        curE->flush_dft();
+        curH->flush_dft();
+        for (size_t k = 0; k < curE->N; ++k)
+          for (int i = 0; i < Nfreq; ++i)
+            F[i] += real(curE->dft[k * Nfreq + i] * conj(curH->dft[k * Nfreq + i]));
+      }
+    else
+      for (dft_chunk *cur = monitors[m].E; cur; cur = cur->next_in_dft) {
+        cur->flush_dft();
+        for (size_t k = 0; k < cur->N; ++k)
+          for (int i = 0; i < Nfreq; ++i)
+            F[i] += norm(cur->dft[k * Nfreq + i]);
+      }
+    offset += Nfreq;
+  }
+  sum_to_all(&mine[0], &cur[0], int(total));
+
+  const bool have_last = last.size() == total;
+  bool converged = have_last;
+  change = have_last ? 0 : infinity;
+  offset = 0;
+  for (size_t m = 0; m < monitors.size() && have_last; ++m) {
+    double fmax = 0, dmax = 0;
+    for (int i = 0; i < monitors[m].Nfreq; ++i) {
+      fmax = std::max(fmax, fabs(cur[offset + i]));
+      dmax = std::max(dmax, fabs(cur[offset + i] - last[offset + i]));
+    }
+    // a monitor that the fields have not reached yet has not converged
+    const double rel = fmax > 0 ? dmax / fmax : infinity;
+    change = std::max(change, rel);
+    converged = converged && rel <= tol;
+    offset += monitors[m].Nfreq;
+  }
+  last = cur;
+  num_converged = converged ? num_converged + 1 : 0;
+  if (have_last && verbosity > 0)
+    master_printf("DFT convergence(t = %g): relative change %g\n", f.time(), change);
+  return num_converged >= 2;
+}
+
 void dft_flux::save_hdf5(h5file *file, const char *dprefix) {
   save_dft_hdf5(E, cE, file, dprefix);
   file->prevent_deadlock(); // hackery
@@ -475,10 +1131,13 @@ double *dft_energy::electric() {
   for (int i = 0; i < Nfreq; ++i)
     F[i] = 0;
   for (dft_chunk *curE = E, *curD = D; curE && curD;
-       curE = curE->next_in_dft, curD = curD->next_in_dft)
+       curE = curE->next_in_dft, curD = curD->next_in_dft) {
+    curE->flush_dft();
+    curD->flush_dft();
     for (size_t k = 0; k < curE->N; ++k)
       for (int i = 0; i < Nfreq; ++i)
         F[i] += 0.5 * real(conj(curE->dft[k * Nfreq + i]) * curD->dft[k * Nfreq + i]);
+  }
   double *Fsum = new double[Nfreq];
   sum_to_all(F, Fsum, Nfreq);
   delete[] F;
@@ -490,10 +1149,13 @@ double *dft_energy::magnetic() {
   for (int i = 0; i < Nfreq; ++i)
     F[i] = 0;
   for (dft_chunk *curH = H, *curB = B; curH && curB;
-       curH = curH->next_in_dft, curB = curB->next_in_dft)
+       curH = curH->next_in_dft, curB = curB->next_in_dft) {
+    curH->flush_dft();
+    curB->flush_dft();
     for (size_t k = 0; k < curH->N; ++k)
       for (int i = 0; i < Nfreq; ++i)
         F[i] += 0.5 * real(conj(curH->dft[k * Nfreq + i]) * curB->dft[k * Nfreq + i]);
+  }
   double *Fsum = new double[Nfreq];
   sum_to_all(F, Fsum, Nfreq);
   delete[] F;
@@ -688,9 +1350,13 @@ dft_fields fields::add_dft_fields(component *components, int num_components, con
 /***************************************************************/
 cdouble dft_chunk::process_dft_component(int rank, direction *ds, ivec min_corner, ivec max_corner,
                                          int num_freq, h5file *file, double *buffer, int reim,
-                                         cdouble *field_array, void *mode1_data, void *mode2_data,
-                                         int ic_conjugate, bool retain_interp_weights,
-                                         fields *parent) {
+                                         vector<size_t> *array_index,
+                                         vector<cdouble> *array_values, void *mode1_data,
+                                         void *mode2_data, int ic_conjugate,
+                                         bool retain_interp_weights, fields *parent,
+                                         cdouble *direct_array) {
+
+  flush_dft();
 
   /*****************************************************************/
   /* compute the size of the chunk we own and its strides etc.     */
@@ -778,7 +1444,7 @@ cdouble dft_chunk::process_dft_component(int rank, direction *ds, ivec min_corne
       cdouble val = (mode1_data ? mode1val : dft_val);
       buffer[idx2] = reim ? imag(val) : real(val);
     }
-    else if (field_array) {
+    else if (array_values) {
       IVEC_LOOP_ILOC(fc->gv, iloc);         // iloc <-- indices of parent point in Yee grid
       iloc = S.transform(iloc, sn) + shift; // iloc <-- indices of child point in Yee grid
       iloc -= min_corner;                   // iloc <-- 2*(indices of point in DFT array)
@@ -791,7 +1457,12 @@ cdouble dft_chunk::process_dft_component(int rank, direction *ds, ivec min_corne
       int idx2 = 0;
       for (int i = rank - 1, stride = 1; i >= 0; stride *= array_count[i--])
         idx2 += stride * (iloc.in_direction(ds[i]) / 2);
-      field_array[idx2] = interp_w * dft_val;
+      if (direct_array)
+        direct_array[idx2] = interp_w * dft_val;
+      else {
+        array_index->push_back(idx2);
+        array_values->push_back(interp_w * dft_val);
+      }
     }
     else {
       mode1val = conj(mode1val); // conjugated inner product
@@ -808,6 +1479,81 @@ cdouble dft_chunk::process_dft_component(int rank, direction *ds, ivec min_corne
   return integral;
 }
 
+/***************************************************************/
+/* chunk-level pass for fields::get_mode_overlaps: for each of */
+/* the num_modes modes, accumulates over the points of this    */
+/* chunk                                                       */
+/*   flux_sum[m] += < mode_{c_conjugate} | dft_{c} >           */
+/*   mode_sum[m] += < mode_{c_conjugate} | mode_{c} >          */
+/* (mode_sum may be NULL), evaluating each mode component only */
+/* once per point.                                             */
+/***************************************************************/
+void dft_chunk::accumulate_mode_overlaps(int num_freq, component c_conjugate, void **mode_data,
+                                         int num_modes, cdouble *flux_sum, cdouble *mode_sum) {
+  flush_dft();
+
+  vec rshift(shift * (0.5 * fc->gv.inva));
+  component cc = S.transform(c_conjugate, sn), cm = S.transform(c, sn);
+  int chunk_idx = 0;
+  LOOP_OVER_IVECS(fc->gv, is, ie, idx) {
+    IVEC_LOOP_LOC(fc->gv, loc);
+    loc = S.transform(loc, sn) + rshift;
+    double w = IVEC_LOOP_WEIGHT(s0, s1, e0, e1, dV0 + dV1 * loop_i2);
+
+    cdouble dft_val = dft[Nomega * (chunk_idx++) + num_freq] / stored_weight;
+    if (include_dV_and_interp_weights) dft_val /= (sqrt_dV_and_interp_weights ? sqrt(w) : w);
+
+    for (int m = 0; m < num_modes; ++m) {
+      cdouble wmode = w * conj(eigenmode_amplitude(mode_data[m], loc, cc));
+      flux_sum[m] += wmode * dft_val;
+      if (mode_sum) mode_sum[m] += wmode * eigenmode_amplitude(mode_data[m], loc, cm);
+    }
+  }
+}
+
+/***************************************************************/
+/* extremal corners (over all processes) of the chunks in the  */
+/* given lists that store component c, and the rank, dims and  */
+/* directions of the corresponding (uncollapsed) DFT array.    */
+/* *bufsz is set to the size of the largest local chunk.       */
+/***************************************************************/
+static int dft_array_layout(const grid_volume &gv, const volume &v, dft_chunk **chunklists,
+                            int num_chunklists, component c, ivec &min_corner, ivec &max_corner,
+                            size_t dims[3], direction ds[3], size_t *array_size, size_t *bufsz) {
+  const volume *where = &v; // use full volume of fields
+  min_corner = gv.round_vec(where->get_max_corner()) + one_ivec(gv.dim);
+  max_corner = gv.round_vec(where->get_min_corner()) - one_ivec(gv.dim);
+  for (int ncl = 0; ncl < num_chunklists; ncl++)
+    for (dft_chunk *chunk = chunklists[ncl]; chunk; chunk = chunk->next_in_dft) {
+      if (chunk->c != c) continue;
+      ivec isS = chunk->S.transform(chunk->is, chunk->sn) + chunk->shift;
+      ivec ieS = chunk->S.transform(chunk->ie, chunk->sn) + chunk->shift;
+      min_corner = min(min_corner, min(isS, ieS));
+      max_corner = max(max_corner, max(isS, ieS));
+      size_t this_bufsz = 1;
+      LOOP_OVER_DIRECTIONS(chunk->fc->gv.dim, d) {
+        this_bufsz *= (chunk->ie.in_direction(d) - chunk->is.in_direction(d)) / 2 + 1;
+      }
+      if (bufsz) *bufsz = max(*bufsz, this_bufsz);
+    }
+  max_corner = max_to_all(max_corner);
+  min_corner = -max_to_all(-min_corner); // i.e., min_to_all
+
+  int rank = 0;
+  *array_size = 1;
+  LOOP_OVER_DIRECTIONS(gv.dim, d) {
+    if (rank >= 3) abort("too many dimensions in process_dft_component");
+    size_t n = std::max(0, (max_corner.in_direction(d) - min_corner.in_direction(d)) / 2 + 1);
+
+    if (n > 1) {
+      ds[rank] = d;
+      dims[rank++] = n;
+      *array_size *= n;
+    }
+  }
+  return rank;
+}
+
 /***************************************************************/
 /* low-level [actually intermediate-level, since it calls      */
 /* dft_chunk::process_dft_component(), which is the true       */
@@ -852,7 +1598,8 @@ cdouble fields::process_dft_component(dft_chunk **chunklists, int num_chunklists
                                       component c, const char *HDF5FileName, cdouble **pfield_array,
                                       int *array_rank, size_t *array_dims, direction *array_dirs,
                                       void *mode1_data, void *mode2_data, component c_conjugate,
-                                      bool *first_component, bool retain_interp_weights) {
+                                      bool *first_component, bool retain_interp_weights,
+                                      bool master_only) {
 
   /***************************************************************/
   /***************************************************************/
@@ -867,43 +1614,13 @@ cdouble fields::process_dft_component(dft_chunk **chunklists, int num_chunklists
   /***************************************************************/
   /* get statistics on the volume slice **************************/
   /***************************************************************/
-  volume *where = &v; // use full volume of fields
   size_t bufsz = 0;
-  ivec min_corner = gv.round_vec(where->get_max_corner()) + one_ivec(gv.dim);
-  ivec max_corner = gv.round_vec(where->get_min_corner()) - one_ivec(gv.dim);
-  for (int ncl = 0; ncl < num_chunklists; ncl++)
-    for (dft_chunk *chunk = chunklists[ncl]; chunk; chunk = chunk->next_in_dft) {
-      if (chunk->c != c) continue;
-      ivec isS = chunk->S.transform(chunk->is, chunk->sn) + chunk->shift;
-      ivec ieS = chunk->S.transform(chunk->ie, chunk->sn) + chunk->shift;
-      min_corner = min(min_corner, min(isS, ieS));
-      max_corner = max(max_corner, max(isS, ieS));
-      size_t this_bufsz = 1;
-      LOOP_OVER_DIRECTIONS(chunk->fc->gv.dim, d) {
-        this_bufsz *= (chunk->ie.in_direction(d) - chunk->is.in_direction(d)) / 2 + 1;
-      }
-      bufsz = max(bufsz, this_bufsz);
-    }
-  max_corner = max_to_all(max_corner);
-  min_corner = -max_to_all(-min_corner); // i.e., min_to_all
-
-  /***************************************************************/
-  /***************************************************************/
-  /***************************************************************/
-  int rank = 0;
+  ivec min_corner(gv.dim), max_corner(gv.dim);
   size_t dims[3];
   direction ds[3];
   size_t array_size = 1;
-  LOOP_OVER_DIRECTIONS(gv.dim, d) {
-    if (rank >= 3) abort("too many dimensions in process_dft_component");
-    size_t n = std::max(0, (max_corner.in_direction(d) - min_corner.in_direction(d)) / 2 + 1);
-
-    if (n > 1) {
-      ds[rank] = d;
-      dims[rank++] = n;
-      array_size *= n;
-    }
-  }
+  int rank = dft_array_layout(gv, v, chunklists, num_chunklists, c, min_corner, max_corner, dims,
+                              ds, &array_size, &bufsz);
   if (array_rank) {
     *array_rank = rank;
     for (int d = 0; d < rank; d++) {
@@ -920,15 +1637,20 @@ cdouble fields::process_dft_component(dft_chunk **chunklists, int num_chunklists
   /* buffer for process-local contributions to HDF5 output files,*/
   /* like h5_output_data::buf in h5fields.cpp                    */
   /***************************************************************/
-  realnum *buffer = 0;
-  cdouble *field_array = 0;
+  double *buffer = 0;
+  vector<size_t> array_index;
+  vector<cdouble> array_values;
   int reim_max = 0;
   if (HDF5FileName) {
-    buffer = new realnum[bufsz];
+    buffer = new double[bufsz];
     reim_max = 1;
   }
-  else if (pfield_array)
-    *pfield_array = field_array = (array_size ? new cdouble[array_size] : 0);
+  cdouble *field_array = 0, *direct_array = 0;
+  if (!HDF5FileName && pfield_array) {
+    field_array = (array_size && (am_master() || !master_only)) ? new cdouble[array_size] : 0;
+    // with a single process, the points are stored directly into the array
+    if (count_processors() == 1) direct_array = field_array;
+  }
 
   bool append_data = false;
   bool single_precision = false;
@@ -946,32 +1668,39 @@ cdouble fields::process_dft_component(dft_chunk **chunklists, int num_chunklists
     for (int ncl = 0; ncl < num_chunklists; ncl++)
       for (dft_chunk *chunk = chunklists[ncl]; chunk; chunk = chunk->next_in_dft)
         if (chunk->c == c)
-          overlap += chunk->process_dft_component(rank, ds, min_corner, max_corner, num_freq, file,
-                                                  buffer, reim, field_array, mode1_data, mode2_data,
-                                                  ic_conjugate, retain_interp_weights, this);
+          overlap += chunk->process_dft_component(
+              rank, ds, min_corner, max_corner, num_freq, file, buffer, reim,
+              pfield_array ? &array_index : 0, pfield_array ? &array_values : 0, mode1_data,
+              mode2_data, ic_conjugate, retain_interp_weights, this, direct_array);
 
     if (HDF5FileName) {
       file->done_writing_chunks();
       file->prevent_deadlock(); // hackery
       delete file;
     }
-    else if (field_array) {
+    else if (pfield_array) {
 /***************************************************************/
-/* repeatedly call sum_to_all to consolidate full field array  */
-/* on all cores                                                */
+/* gather the points of each process into the full field array */
+/* on the master, then (unless master_only) broadcast it in    */
+/* pieces, so that only the processes that return the array    */
+/* hold it in full                                             */
 /***************************************************************/
 #define BUFSIZE 1 << 16 // use 64k buffer
-      cdouble *buf = new cdouble[BUFSIZE];
-      ptrdiff_t offset = 0;
-      size_t remaining = array_size;
-      while (remaining != 0) {
-        size_t size = (remaining > BUFSIZE ? BUFSIZE : remaining);
-        sum_to_all(field_array + offset, buf, size);
-        memcpy(field_array + offset, buf, size * sizeof(cdouble));
-        remaining -= size;
-        offset += size;
+      if (!direct_array)
+        gather_to_master(array_index.empty() ? 0 : &array_index[0],
+                         array_values.empty() ? 0 : &array_values[0], array_index.size(),
+                         field_array);
+      if (!master_only) {
+        ptrdiff_t offset = 0;
+        size_t remaining = array_size;
+        while (remaining != 0) {
+          size_t size = (remaining > BUFSIZE ? BUFSIZE : remaining);
+          broadcast(0, field_array + offset, size);
+          remaining -= size;
+          offset += size;
+        }
       }
-      delete[] buf;
+      *pfield_array = field_array;
     }
   } // for(int reim=0; reim<=reim_max; reim++)
 
@@ -1031,6 +1760,81 @@ cdouble *fields::get_dft_array(dft_fields fdft, component c, int num_freq, int *
   return collapse_array(array, rank, dims, dirs, fdft.where);
 }
 
+void fields::get_dft_array_points(dft_fields fdft, component c, int num_freq, vector<size_t> &index,
+                                  vector<cdouble> &values) {
+  dft_chunk *chunklists[1];
+  chunklists[0] = fdft.chunks;
+  ivec min_corner(gv.dim), max_corner(gv.dim);
+  size_t dims[3], array_size;
+  direction ds[3];
+  int rank = dft_array_layout(gv, v, chunklists, 1, c, min_corner, max_corner, dims, ds,
+                              &array_size, 0);
+  index.clear();
+  values.clear();
+  if (rank == 0) return;
+  for (int i = 0; i < rank; ++i)
+    if (fdft.where.in_direction(ds[i]) == 0.0)
+      abort("get_dft_array_points: the DFT volume has an empty dimension");
+  for (dft_chunk *chunk = fdft.chunks; chunk; chunk = chunk->next_in_dft)
+    if (chunk->c == c)
+      chunk->process_dft_component(rank, ds, min_corner, max_corner, num_freq, 0, 0, 0, &index,
+                                   &values, 0, 0, (int)c, true, this);
+}
+
+/***************************************************************/
+/* forward fields of an adjoint solve, kept process-locally    */
+/***************************************************************/
+dft_fields_local::dft_fields_local(fields &f, dft_fields fdft) : Nfreq(fdft.Nfreq) {
+  // get_dft_array collapses empty dimensions by summing points that may
+  // belong to different processes; such volumes are not supported here
+  collapsed = false;
+  LOOP_OVER_DIRECTIONS(f.gv.dim, d) {
+    if (fdft.where.in_direction(d) == 0.0 && f.gv.num_direction(d) > 1) collapsed = true;
+  }
+  if (collapsed) return;
+
+  FOR_ELECTRIC_COMPONENTS(c) {
+    if (!f.gv.has_field(c)) continue;
+    cs.push_back(c);
+    for (int nf = 0; nf < Nfreq; ++nf) {
+      index.push_back(vector<size_t>());
+      values.push_back(vector<cdouble>());
+      f.get_dft_array_points(fdft, c, nf, index.back(), values.back());
+    }
+  }
+}
+
+void fields::get_dft_gradient(const dft_fields_local &fwd, dft_fields adj, int num_freq,
+                              const double *weights, int num_points, const double *basis,
+                              int num_basis, cdouble *grad) {
+  if (fwd.collapsed) abort("get_dft_gradient: the DFT volume has an empty dimension");
+  if (num_freq < 0 || num_freq >= fwd.Nfreq || num_freq >= adj.Nfreq)
+    abort("get_dft_gradient: invalid frequency index %d", num_freq);
+
+  vector<cdouble> grad_mine(num_basis, 0.0);
+  vector<size_t> index;
+  vector<cdouble> values;
+  for (size_t ic = 0; ic < fwd.cs.size(); ++ic) {
+    get_dft_array_points(adj, fwd.cs[ic], num_freq, index, values);
+    const vector<size_t> &fwd_index = fwd.index[ic * fwd.Nfreq + num_freq];
+    const vector<cdouble> &fwd_values = fwd.values[ic * fwd.Nfreq + num_freq];
+    // a component without fields in one of the runs (e.g. one that its
+    // sources do not excite) has no DFT chunks there and adds nothing
+    if (index.empty() || fwd_index.empty()) continue;
+    if (index != fwd_index)
+      abort("get_dft_gradient: forward and adjoint DFT points differ (chunk layouts must agree)");
+    for (size_t i = 0; i < index.size(); ++i) {
+      size_t n = index[i];
+      if (n >= (size_t)num_points) abort("get_dft_gradient: too few weights/basis values");
+      cdouble EE = weights[n] * fwd_values[i] * values[i];
+      const double *b = basis + n * num_basis;
+      for (int k = 0; k < num_basis; ++k)
+        grad_mine[k] += EE * b[k];
+    }
+  }
+  sum_to_all(num_basis ? &grad_mine[0] : 0, grad, num_basis);
+}
+
 /***************************************************************/
 /* wrapper around process_dft_component that writes HDF5       */
 /* datasets for all components at all frequencies stored in    */
@@ -1075,7 +1879,7 @@ void fields::output_dft_components(dft_chunk **chunklists, int num_chunklists, v
         size_t dims[3];
         direction dirs[3];
         process_dft_component(chunklists, num_chunklists, num_freq, c, 0, &array, &rank, dims,
-                              dirs);
+                              dirs, 0, 0, Ex, 0, true, true);
         if (rank > 0 && am_master()) {
           array = collapse_array(array, &rank, dims, dirs, dft_volume);
           if (rank == 0) abort("%s:%i: internal error", __FILE__, __LINE__);
@@ -1143,10 +1947,14 @@ void fields::output_mode_fields(void *mode_data, dft_flux flux, const char *HDF5
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
-void fields::get_overlap(void *mode1_data, void *mode2_data, dft_flux flux, int num_freq,
-                         cdouble overlaps[2]) {
-  component cE[2], cH[2];
-  switch (flux.normal_direction) {
+/***************************************************************/
+/* the tangential components whose cross products give the     */
+/* flux through a surface with the given normal direction:     */
+/* the flux is Re[cE[0]^* cH[0] - cE[1]^* cH[1]]               */
+/***************************************************************/
+static void flux_components(const grid_volume &gv, direction normal, component cE[2],
+                            component cH[2]) {
+  switch (normal) {
     case X:
       cE[0] = Ey;
       cH[0] = Hz;
@@ -1179,6 +1987,12 @@ void fields::get_overlap(void *mode1_data, void *mode2_data, dft_flux flux, int
       break;
     default: abort("invalid normal_direction in get_overlap");
   };
+}
+
+void fields::get_overlap(void *mode1_data, void *mode2_data, dft_flux flux, int num_freq,
+                         cdouble overlaps[2]) {
+  component cE[2], cH[2];
+  flux_components(gv, flux.normal_direction, cE, cH);
 
   dft_chunk *chunklists[2];
   chunklists[0] = flux.E;
@@ -1195,9 +2009,57 @@ void fields::get_overlap(void *mode1_data, void *mode2_data, dft_flux flux, int
   overlaps[1] = HyEx - HxEy;
 }
 
+/***************************************************************/
+/* the overlaps of get_mode_flux_overlap (and, if mode_overlaps */
+/* is non-NULL, get_mode_mode_overlap of each mode with itself)*/
+/* for num_modes modes at once, in a single pass over the      */
+/* chunks of the flux region and a single reduction:           */
+/*   flux_overlaps[2*m + 0/1], mode_overlaps[2*m + 0/1]        */
+/* are the overlaps[0/1] of mode_data[m].                      */
+/***************************************************************/
+void fields::get_mode_overlaps(void **mode_data, int num_modes, dft_flux flux, int num_freq,
+                               cdouble *flux_overlaps, cdouble *mode_overlaps) {
+  component cE[2], cH[2];
+  flux_components(gv, flux.normal_direction, cE, cH);
+
+  // sums[2*m + k] are the flux overlaps, sums[2*num_modes + 2*m + k] the mode overlaps
+  int nsums = (mode_overlaps ? 4 : 2) * num_modes;
+  std::vector<cdouble> sums(nsums, 0.0), flux_sum(num_modes), mode_sum(num_modes);
+  dft_chunk *chunklists[2];
+  chunklists[0] = flux.E;
+  chunklists[1] = flux.H;
+  for (int ncl = 0; ncl < 2; ncl++)
+    for (dft_chunk *chunk = chunklists[ncl]; chunk; chunk = chunk->next_in_dft) {
+      // overlaps[0] = <H0|E0> - <H1|E1>, overlaps[1] = <E0|H0> - <E1|H1>
+      int k, j;
+      if (chunk->c == cE[0] || chunk->c == cE[1])
+        k = 0, j = chunk->c == cE[0] ? 0 : 1;
+      else if (chunk->c == cH[0] || chunk->c == cH[1])
+        k = 1, j = chunk->c == cH[0] ? 0 : 1;
+      else
+        continue;
+      double sign = j == 0 ? 1.0 : -1.0;
+      std::fill(flux_sum.begin(), flux_sum.end(), 0.0);
+      std::fill(mode_sum.begin(), mode_sum.end(), 0.0);
+      chunk->accumulate_mode_overlaps(num_freq, k == 0 ? cH[j] : cE[j], mode_data, num_modes,
+                                      &flux_sum[0], mode_overlaps ? &mode_sum[0] : 0);
+      for (int m = 0; m < num_modes; ++m) {
+        sums[2 * m + k] += sign * flux_sum[m];
+        if (mode_overlaps) sums[2 * num_modes + 2 * m + k] += sign * mode_sum[m];
+      }
+    }
+
+  std::vector<cdouble> total(nsums);
+  sum_to_all(&sums[0], &total[0], nsums);
+  for (int n = 0; n < 2 * num_modes; ++n) {
+    flux_overlaps[n] = total[n];
+    if (mode_overlaps) mode_overlaps[n] = total[2 * num_modes + n];
+  }
+}
+
 void fields::get_mode_flux_overlap(void *mode_data, dft_flux flux, int num_freq,
                                    std::complex<double> overlaps[2]) {
-  get_overlap(mode_data, 0, flux, num_freq, overlaps);
+  get_mode_overlaps(&mode_data, 1, flux, num_freq, overlaps, 0);
 }
 
 void fields::get_mode_mode_overlap(void *mode1_data, void *mode2_data, dft_flux flux,
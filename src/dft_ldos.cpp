@@ -17,6 +17,7 @@
 
 #include "meep.hpp"
 #include "meep_internals.hpp"
+#include "config.h"
 
 using namespace std;
 
@@ -33,11 +34,13 @@ dft_ldos::dft_ldos(double freq_min, double freq_max, int Nfreq) {
     domega = (freq_max - freq_min) * 2 * pi / (Nfreq - 1);
     Nomega = Nfreq;
   }
-  Fdft = new complex<realnum>[Nomega];
-  Jdft = new complex<realnum>[Nomega];
+  Fdft = new complex<double>[Nomega];
+  Jdft = new complex<double>[Nomega];
   for (int i = 0; i < Nomega; ++i)
     Fdft[i] = Jdft[i] = 0.0;
   Jsum = 1.0;
+  terms_f = NULL;
+  terms_generation = 0;
 }
 
 // |c|^2
@@ -76,59 +79,94 @@ complex<double> *dft_ldos::J() const {
   return out;
 }
 
+bool dft_ldos::terms_match(const fields &f) const {
+  return terms_f == &f && terms_generation == src_vol::generation;
+}
+
+namespace {
+// appends the indices and amplitudes of the points of a src_vol
+struct ldos_gather {
+  std::vector<ptrdiff_t> &index;
+  std::vector<double> &Ar, &Ai;
+  double Jsum;
+  ldos_gather(std::vector<ptrdiff_t> &index_, std::vector<double> &Ar_, std::vector<double> &Ai_)
+      : index(index_), Ar(Ar_), Ai(Ai_), Jsum(0.0) {}
+  void operator()(ptrdiff_t idx, complex<double> A) {
+    index.push_back(idx);
+    Ar.push_back(real(A));
+    Ai.push_back(imag(A));
+    Jsum += abs(A);
+  }
+};
+} // namespace
+
+void dft_ldos::gather_terms(const fields &f) {
+  terms.clear();
+  pt_index.clear();
+  pt_Ar.clear();
+  pt_Ai.clear();
+  ldos_gather op(pt_index, pt_Ar, pt_Ai);
+  for (int ic = 0; ic < f.num_chunks; ic++)
+    if (f.chunks[ic]->is_mine())
+      for (int is_H = 0; is_H < 2; ++is_H)
+        for (src_vol *sv = f.chunks[ic]->sources[is_H ? B_stuff : D_stuff]; sv; sv = sv->next) {
+          source_term t;
+          t.sv = sv;
+          t.ichunk = ic;
+          t.c = direction_component(is_H ? Hx : Ex, component_direction(sv->c));
+          t.is_H = is_H;
+          t.npts = sv->npts;
+          t.start = pt_index.size();
+          sv->loop_over_points(op);
+          terms.push_back(t);
+        }
+  terms_f = &f;
+  terms_generation = src_vol::generation;
+
+  // Jsum for LDOS normalization purposes, corrected for dV factors
+  Jsum = op.Jsum * sqrt(f.gv.dV(f.gv.icenter(), 1).computational_volume());
+}
+
 void dft_ldos::update(fields &f) {
   complex<double> EJ = 0.0; // integral E * J*
   complex<double> HJ = 0.0; // integral H * J* for magnetic currents
 
   double scale = (f.dt / sqrt(2 * pi));
 
-  // compute Jsum for LDOS normalization purposes
-  // ...don't worry about the tiny inefficiency of recomputing this repeatedly
-  Jsum = 0.0;
-
-  for (int ic = 0; ic < f.num_chunks; ic++)
-    if (f.chunks[ic]->is_mine()) {
-      for (src_vol *sv = f.chunks[ic]->sources[D_stuff]; sv; sv = sv->next) {
-        component c = direction_component(Ex, component_direction(sv->c));
-        realnum *fr = f.chunks[ic]->f[c][0];
-        realnum *fi = f.chunks[ic]->f[c][1];
-        if (fr && fi) // complex E
-          for (size_t j = 0; j < sv->npts; j++) {
-            const ptrdiff_t idx = sv->index[j];
-            const complex<double> A = sv->A[j];
-            EJ += complex<double>(fr[idx], fi[idx]) * conj(A);
-            Jsum += abs(A);
-          }
-        else if (fr) { // E is purely real
-          for (size_t j = 0; j < sv->npts; j++) {
-            const ptrdiff_t idx = sv->index[j];
-            const complex<double> A = sv->A[j];
-            EJ += double(fr[idx]) * conj(A);
-            Jsum += abs(A);
-          }
-        }
+  if (!terms_match(f)) gather_terms(f);
+
+  for (size_t k = 0; k < terms.size(); ++k) {
+    const source_term &t = terms[k];
+    const realnum *fr = f.chunks[t.ichunk]->f[t.c][0], *fi = f.chunks[t.ichunk]->f[t.c][1];
+    if (!fr) continue;
+    const ptrdiff_t *index = pt_index.empty() ? NULL : &pt_index[t.start];
+    const double *Ar = pt_Ar.empty() ? NULL : &pt_Ar[t.start];
+    const double *Ai = pt_Ai.empty() ? NULL : &pt_Ai[t.start];
+    const ptrdiff_t n = ptrdiff_t(t.npts);
+    double FJr = 0, FJi = 0; // sum F * conj(A)
+    if (fi) {
+#ifdef HAVE_OPENMP
+#pragma omp simd reduction(+ : FJr, FJi)
+#endif
+      for (ptrdiff_t j = 0; j < n; ++j) {
+        double Fr = fr[index[j]], Fi = fi[index[j]];
+        FJr += Fr * Ar[j] + Fi * Ai[j];
+        FJi += Fi * Ar[j] - Fr * Ai[j];
       }
-      for (src_vol *sv = f.chunks[ic]->sources[B_stuff]; sv; sv = sv->next) {
-        component c = direction_component(Hx, component_direction(sv->c));
-        realnum *fr = f.chunks[ic]->f[c][0];
-        realnum *fi = f.chunks[ic]->f[c][1];
-        if (fr && fi) // complex H
-          for (size_t j = 0; j < sv->npts; j++) {
-            const ptrdiff_t idx = sv->index[j];
-            const complex<double> A = sv->A[j];
-            HJ += complex<double>(fr[idx], fi[idx]) * conj(A);
-            Jsum += abs(A);
-          }
-        else if (fr) { // H is purely real
-          for (size_t j = 0; j < sv->npts; j++) {
-            const ptrdiff_t idx = sv->index[j];
-            const complex<double> A = sv->A[j];
-            HJ += double(fr[idx]) * conj(A);
-            Jsum += abs(A);
-          }
-        }
+    }
+    else {
+#ifdef HAVE_OPENMP
+#pragma omp simd reduction(+ : FJr, FJi)
+#endif
+      for (ptrdiff_t j = 0; j < n; ++j) {
+        double Fr = fr[index[j]];
+        FJr += Fr * Ar[j];
+        FJi -= Fr * Ai[j];
       }
     }
+    (t.is_H ? HJ : EJ) += complex<double>(FJr, FJi);
+  }
+
   for (int i = 0; i < Nomega; ++i) {
     complex<double> Ephase = polar(1.0, (omega_min + i * domega) * f.time()) * scale;
     complex<double> Hphase = polar(1.0, (omega_min + i * domega) * (f.time() - f.dt / 2)) * scale;
@@ -142,9 +180,6 @@ void dft_ldos::update(fields &f) {
         Jdft[i] += Ephase * f.sources->current();
     }
   }
-
-  // correct for dV factors
-  Jsum *= sqrt(f.gv.dV(f.gv.icenter(), 1).computational_volume());
 }
 
 } // namespace meep
@@ -52,7 +52,7 @@ double fields::energy_in_box(const volume &where) {
 }
 
 double fields::field_energy_in_box(const volume &where) {
-  synchronize_magnetic_fields();
+  synchronize_magnetic_fields(where);
   double cur_step_magnetic_energy = magnetic_energy_in_box(where);
   restore_magnetic_fields();
   return electric_energy_in_box(where) + cur_step_magnetic_energy;
@@ -102,7 +102,7 @@ void fields_chunk::backup_component(component c) {
 
 #define BACKUP(f)                                                                                  \
   if (f[c][cmp]) {                                                                                 \
-    if (!f##_backup[c][cmp]) f##_backup[c][cmp] = new realnum[gv.ntot()];                          \
+    if (!f##_backup[c][cmp]) f##_backup[c][cmp] = arena->alloc();                                  \
     memcpy(f##_backup[c][cmp], f[c][cmp], gv.ntot() * sizeof(realnum));                            \
   }
 
@@ -142,12 +142,94 @@ void fields_chunk::average_with_backup(component c) {
 }
 
 void fields::synchronize_magnetic_fields() {
-  if (synchronized_magnetic_fields++) return; // already synched
+  if (synchronized_magnetic_fields && synched_chunks.empty()) { // already synched
+    synchronized_magnetic_fields++;
+    return;
+  }
+  std::vector<char> all; // empty for all of the chunks
+  if (synchronized_magnetic_fields) { // only a region is synched: redo everywhere
+    const int count = synchronized_magnetic_fields;
+    synchronized_magnetic_fields = 1;
+    restore_magnetic_fields();
+    synchronize_magnetic_chunks(all);
+    synchronized_magnetic_fields = count + 1;
+    return;
+  }
+  synchronize_magnetic_chunks(all);
+  synchronized_magnetic_fields = 1;
+}
+
+namespace {
+// marks the chunks that loop_in_chunks visits
+void mark_chunk(fields_chunk *fc, int ichunk, component cgrid, ivec is, ivec ie, vec s0, vec s1,
+                vec e0, vec e1, double dV0, double dV1, ivec shift, complex<double> shift_phase,
+                const symmetry &S, int sn, void *chunkloop_data) {
+  (void)fc;
+  (void)cgrid;
+  (void)is;
+  (void)ie;
+  (void)s0;
+  (void)s1;
+  (void)e0;
+  (void)e1;
+  (void)dV0;
+  (void)dV1;
+  (void)shift;
+  (void)shift_phase;
+  (void)S;
+  (void)sn;
+  (*(std::vector<char> *)chunkloop_data)[ichunk] = 1;
+}
+} // namespace
+
+/* Only the owned H (and B) points in where need to be synched.  Since
+   step_db(B) at a point only reads E, and update_eh(H) only reads B
+   within a pixel (for off-diagonal mu), it suffices to re-step the
+   chunks within a pixel of where (with the same symmetries and periodic
+   images as loop_in_chunks); the H values just outside of the re-stepped
+   chunks are not valid until restore_magnetic_fields. */
+void fields::synchronize_magnetic_fields(const volume &where) {
+  volume halo(where);
+  LOOP_OVER_DIRECTIONS(gv.dim, d) {
+    halo.set_direction_min(d, where.in_direction_min(d) - gv.inva);
+    halo.set_direction_max(d, where.in_direction_max(d) + gv.inva);
+  }
+  std::vector<char> which(num_chunks, 0);
+  loop_in_chunks(mark_chunk, (void *)&which, halo);
+
+  if (synchronized_magnetic_fields) {
+    bool covered = true; // by the chunks that are already synched
+    if (!synched_chunks.empty())
+      for (int i = 0; i < num_chunks; i++)
+        if (which[i] && !synched_chunks[i]) covered = false;
+    if (and_to_all(covered)) {
+      synchronized_magnetic_fields++;
+      return;
+    }
+    for (int i = 0; i < num_chunks; i++)
+      which[i] = which[i] || synched_chunks[i];
+    const int count = synchronized_magnetic_fields;
+    synchronized_magnetic_fields = 1;
+    restore_magnetic_fields();
+    synchronize_magnetic_chunks(which);
+    synchronized_magnetic_fields = count + 1;
+    return;
+  }
+  synchronize_magnetic_chunks(which);
+  synchronized_magnetic_fields = 1;
+}
+
+/* Back up, re-step by a half step and average the B and H fields of the
+   chunks in which (or of all the chunks if which is empty), regardless of
+   synchronized_magnetic_fields, which the callers update. */
+void fields::synchronize_magnetic_chunks(const std::vector<char> &which) {
+  synched_chunks = which;
   for (int i = 0; i < num_chunks; i++)
-    if (chunks[i]->is_mine()) {
+    if (chunks[i]->is_mine() && (which.empty() || which[i])) {
       FOR_B_COMPONENTS(c) { chunks[i]->backup_component(c); }
       FOR_MAGNETIC_COMPONENTS(c) { chunks[i]->backup_component(c); }
     }
+  step_chunks = which;
   am_now_working_on(Stepping);
   calc_sources(time()); // for B sources
   step_db(B_stuff);
@@ -157,8 +239,9 @@ void fields::synchronize_magnetic_fields() {
   update_eh(H_stuff);
   step_boundaries(H_stuff);
   finished_working();
+  step_chunks.clear();
   for (int i = 0; i < num_chunks; i++)
-    if (chunks[i]->is_mine()) {
+    if (chunks[i]->is_mine() && (which.empty() || which[i])) {
       FOR_B_COMPONENTS(c) { chunks[i]->average_with_backup(c); }
       FOR_MAGNETIC_COMPONENTS(c) { chunks[i]->average_with_backup(c); }
     }
@@ -169,10 +252,16 @@ void fields::restore_magnetic_fields() {
       || --synchronized_magnetic_fields) // not ready to restore yet
     return;
   for (int i = 0; i < num_chunks; i++)
-    if (chunks[i]->is_mine()) {
+    if (chunks[i]->is_mine() && (synched_chunks.empty() || synched_chunks[i])) {
       FOR_B_COMPONENTS(c) { chunks[i]->restore_component(c); }
       FOR_MAGNETIC_COMPONENTS(c) { chunks[i]->restore_component(c); }
     }
+  /* the not-owned points of the other chunks received synched values
+     from the synched chunks, so communicate the restored values */
+  if (!synched_chunks.empty()) {
+    step_boundaries(B_stuff);
+    step_boundaries(H_stuff);
+  }
 }
 
 double fields::thermo_energy_in_box(const volume &where) {
@@ -213,7 +302,7 @@ double fields::flux_in_box_wrongH(direction d, const volume &where) {
 }
 
 double fields::flux_in_box(direction d, const volume &where) {
-  synchronize_magnetic_fields();
+  synchronize_magnetic_fields(where);
   double cur_step_flux = flux_in_box_wrongH(d, where);
   restore_magnetic_fields();
   return cur_step_flux;
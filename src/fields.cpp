@@ -19,6 +19,7 @@
 #include <string.h>
 #include <math.h>
 #include <complex>
+#include <algorithm>
 
 #include "meep.hpp"
 #include "meep_internals.hpp"
@@ -31,6 +32,22 @@ fields::fields(structure *s, double m, double beta, bool zero_fields_near_cylori
     : S(s->S), gv(s->gv), user_volume(s->user_volume), v(s->v), m(m), beta(beta) {
   shared_chunks = s->shared_chunks;
   components_allocated = false;
+  lazy_dft_averaging = false;
+  decimate_dfts = false;
+  fft_dfts = false;
+  dft_checkpoint_fname = NULL;
+  dft_checkpoint_interval = last_dft_checkpoint_wall_time = 0;
+  async_output = false;
+  max_pending_outputs = 2;
+  output_stride = 1;
+  output_block_average = false;
+  output_irreducible = false;
+  mode_cache = NULL;
+  eigenmode_cache_max = 100;
+  eigenmode_split_freqs = true;
+  nan_check_interval = 100;
+  local_reductions = 0;
+  loop_plans = NULL;
   synchronized_magnetic_fields = 0;
   outdir = new char[strlen(s->outdir) + 1];
   strcpy(outdir, s->outdir);
@@ -47,6 +64,9 @@ fields::fields(structure *s, double m, double beta, bool zero_fields_near_cylori
   sources = NULL;
   fluxes = NULL;
   // Time stuff:
+  tracing = false;
+  trace_count = 0;
+  trace_t0 = 0;
   reset_timers();
   last_step_output_wall_time = -1;
 
@@ -65,6 +85,11 @@ fields::fields(structure *s, double m, double beta, bool zero_fields_near_cylori
     comm_blocks[ft] = new realnum_ptr[num_chunks * num_chunks];
     for (int i = 0; i < num_chunks * num_chunks; i++)
       comm_blocks[ft][i] = 0;
+    comm_requests[ft] = NULL;
+    num_comm_requests[ft] = 0;
+    comm_in_progress[ft] = false;
+    local_connections[ft] = NULL;
+    num_local_connections[ft] = 0;
   }
   for (int b = 0; b < 2; b++)
     FOR_DIRECTIONS(d) {
@@ -87,7 +112,24 @@ fields::fields(const fields &thef)
     : S(thef.S), gv(thef.gv), user_volume(thef.user_volume), v(thef.v) {
   shared_chunks = thef.shared_chunks;
   components_allocated = thef.components_allocated;
+  lazy_dft_averaging = thef.lazy_dft_averaging;
+  decimate_dfts = thef.decimate_dfts;
+  fft_dfts = thef.fft_dfts;
+  dft_checkpoint_fname = NULL; // the DFTs themselves are not copied
+  dft_checkpoint_interval = last_dft_checkpoint_wall_time = 0;
+  async_output = thef.async_output;
+  max_pending_outputs = thef.max_pending_outputs;
+  output_stride = thef.output_stride;
+  output_block_average = thef.output_block_average;
+  output_irreducible = thef.output_irreducible;
+  mode_cache = NULL; // the eigenmode cache is not copied
+  eigenmode_cache_max = thef.eigenmode_cache_max;
+  eigenmode_split_freqs = thef.eigenmode_split_freqs;
+  nan_check_interval = thef.nan_check_interval;
+  local_reductions = 0;
+  loop_plans = NULL; // rebuilt on demand
   synchronized_magnetic_fields = thef.synchronized_magnetic_fields;
+  synched_chunks = thef.synched_chunks;
   outdir = new char[strlen(thef.outdir) + 1];
   strcpy(outdir, thef.outdir);
   m = thef.m;
@@ -104,6 +146,9 @@ fields::fields(const fields &thef)
   sources = NULL;
   fluxes = NULL;
   // Time stuff:
+  tracing = false; // the trace is not copied
+  trace_count = 0;
+  trace_t0 = 0;
   reset_timers();
   last_step_output_wall_time = -1;
 
@@ -122,6 +167,11 @@ fields::fields(const fields &thef)
     comm_blocks[ft] = new realnum_ptr[num_chunks * num_chunks];
     for (int i = 0; i < num_chunks * num_chunks; i++)
       comm_blocks[ft][i] = 0;
+    comm_requests[ft] = NULL;
+    num_comm_requests[ft] = 0;
+    comm_in_progress[ft] = false;
+    local_connections[ft] = NULL;
+    num_local_connections[ft] = 0;
   }
   for (int b = 0; b < 2; b++)
     FOR_DIRECTIONS(d) { boundaries[b][d] = thef.boundaries[b][d]; }
@@ -129,6 +179,7 @@ fields::fields(const fields &thef)
 }
 
 fields::~fields() {
+  free_boundary_communications();
   for (int i = 0; i < num_chunks; i++)
     delete chunks[i];
   delete[] chunks;
@@ -138,10 +189,15 @@ fields::~fields() {
     delete[] comm_blocks[ft];
     for (int ip = 0; ip < 3; ip++)
       delete[] comm_sizes[ft][ip];
+    delete[] local_connections[ft];
   }
   delete sources;
   delete fluxes;
   delete[] outdir;
+  delete[] dft_checkpoint_fname;
+  clear_eigenmode_cache();
+  clear_loop_plans();
+  wait_for_async_output();
 }
 
 void fields::use_real_fields() {
@@ -162,24 +218,7 @@ bool fields::have_component(component c) {
 }
 
 fields_chunk::~fields_chunk() {
-  is_real = 0; // So that we can make sure to delete everything...
-  // for mu=1 non-PML regions, H==B to save space/time - don't delete twice!
-  DOCMP2 FOR_H_AND_B(hc, bc) {
-    if (f[hc][cmp] == f[bc][cmp]) f[bc][cmp] = NULL;
-  }
-  DOCMP2 FOR_COMPONENTS(c) {
-    delete[] f[c][cmp];
-    delete[] f_u[c][cmp];
-    delete[] f_w[c][cmp];
-    delete[] f_cond[c][cmp];
-    delete[] f_minus_p[c][cmp];
-    delete[] f_w_prev[c][cmp];
-    delete[] f_backup[c][cmp];
-    delete[] f_u_backup[c][cmp];
-    delete[] f_w_backup[c][cmp];
-    delete[] f_cond_backup[c][cmp];
-  }
-  delete[] f_rderiv_int;
+  delete arena; // all of the field arrays
   FOR_FIELD_TYPES(ft) {
     for (int ip = 0; ip < 3; ip++)
       for (int io = 0; io < 2; io++)
@@ -207,6 +246,105 @@ fields_chunk::~fields_chunk() {
   if (new_s && new_s->refcount-- <= 1) delete new_s; // delete if not shared
 }
 
+// counts the same arrays that the destructor deletes
+void fields_chunk::memory_usage(double *bytes) const {
+  const double n = gv.ntot() * double(sizeof(realnum));
+  DOCMP2 FOR_COMPONENTS(c) {
+    const bool h_is_b =
+        is_magnetic(c) && f[c][cmp] == f[direction_component(Bx, component_direction(c))][cmp];
+    if (f[c][cmp] && !h_is_b) bytes[MemFields] += n;
+    if (f_backup[c][cmp]) bytes[MemFields] += n;
+    if (f_u[c][cmp]) bytes[MemPML] += n;
+    if (f_w[c][cmp]) bytes[MemPML] += n;
+    if (f_cond[c][cmp]) bytes[MemPML] += n;
+    if (f_u_backup[c][cmp]) bytes[MemPML] += n;
+    if (f_w_backup[c][cmp]) bytes[MemPML] += n;
+    if (f_cond_backup[c][cmp]) bytes[MemPML] += n;
+    if (f_minus_p[c][cmp]) bytes[MemPolarizations] += n;
+    if (f_w_prev[c][cmp]) bytes[MemPolarizations] += n;
+  }
+  if (f_rderiv_int) bytes[MemFields] += n;
+  FOR_FIELD_TYPES(ft) {
+    for (polarization_state *p = pol[ft]; p; p = p->next)
+      if (p->data) bytes[MemPolarizations] += p->s->num_internal_data(p->data) * sizeof(realnum);
+    for (int ip = 0; ip < 3; ip++)
+      for (int io = 0; io < 2; io++)
+        bytes[MemCommunication] += num_connections[ft][ip][io] * sizeof(realnum *);
+    bytes[MemCommunication] += num_connections[ft][CONNECT_PHASE][Incoming] / 2 *
+                               sizeof(std::complex<realnum>);
+    bytes[MemCommunication] += num_zeroes[ft] * sizeof(realnum *);
+    for (const src_vol *sv = sources[ft]; sv; sv = sv->next) {
+      if (sv->index) bytes[MemSources] += sv->npts * sizeof(ptrdiff_t);
+      if (sv->A) bytes[MemSources] += sv->npts * sizeof(std::complex<double>);
+      for (int k = 0; k < 3; ++k)
+        if (sv->a[k]) bytes[MemSources] += sv->n[k] * sizeof(std::complex<double>);
+    }
+  }
+  for (const dft_chunk *cur = dft_chunks; cur; cur = cur->next_in_chunk)
+    bytes[MemDFT] += cur->memory_usage();
+  s->memory_usage(bytes);
+}
+
+std::vector<double> fields::memory_usage() {
+  const int n = num_chunks * NUM_MEMORY_CATEGORIES;
+  std::vector<double> bytes_tmp(n, 0.0), bytes(n);
+  for (int i = 0; i < num_chunks; i++)
+    if (chunks[i]->is_mine()) {
+      double *b = &bytes_tmp[i * NUM_MEMORY_CATEGORIES];
+      chunks[i]->memory_usage(b);
+      // the buffers for the pairs with chunks on other processes
+      for (int j = 0; j < num_chunks; j++)
+        if (!chunks[j]->is_mine()) FOR_FIELD_TYPES(ft) {
+            if (comm_blocks[ft][j + i * num_chunks])
+              b[MemCommunication] += comm_size_tot(ft, j + i * num_chunks) * sizeof(realnum);
+            if (comm_blocks[ft][i + j * num_chunks])
+              b[MemCommunication] += comm_size_tot(ft, i + j * num_chunks) * sizeof(realnum);
+          }
+    }
+  sum_to_all(&bytes_tmp[0], &bytes[0], n);
+  return bytes;
+}
+
+static const char *memory_category_name(int cat) {
+  switch (cat) {
+    case MemFields: return "fields";
+    case MemPML: return "PML auxiliary fields";
+    case MemMaterials: return "materials";
+    case MemPolarizations: return "polarizations";
+    case MemCommunication: return "communication";
+    case MemSources: return "sources";
+    case MemDFT: return "DFT";
+  }
+  return "other";
+}
+
+void fields::print_memory_usage() {
+  const std::vector<double> bytes = memory_usage();
+  std::vector<double> total(NUM_MEMORY_CATEGORIES, 0.0), proc(count_processors(), 0.0);
+  double chunk_max = 0;
+  int ichunk_max = 0;
+  for (int i = 0; i < num_chunks; i++) {
+    double chunk = 0;
+    for (int cat = 0; cat < NUM_MEMORY_CATEGORIES; cat++) {
+      total[cat] += bytes[i * NUM_MEMORY_CATEGORIES + cat];
+      chunk += bytes[i * NUM_MEMORY_CATEGORIES + cat];
+    }
+    proc[chunks[i]->n_proc()] += chunk;
+    if (chunk > chunk_max) {
+      chunk_max = chunk;
+      ichunk_max = i;
+    }
+  }
+  const double MB = 1024.0 * 1024.0;
+  master_printf("Memory usage:\n");
+  for (int cat = 0; cat < NUM_MEMORY_CATEGORIES; cat++)
+    if (total[cat] > 0)
+      master_printf("    %21s: %g MB\n", memory_category_name(cat), total[cat] / MB);
+  const int iproc_max = std::max_element(proc.begin(), proc.end()) - proc.begin();
+  master_printf("    largest chunk: %g MB (chunk %d), largest process: %g MB (process %d)\n",
+                chunk_max / MB, ichunk_max, proc[iproc_max] / MB, iproc_max);
+}
+
 fields_chunk::fields_chunk(structure_chunk *the_s, const char *od, double m, double beta,
                            bool zero_fields_near_cylorigin)
     : gv(the_s->gv), v(the_s->v), m(m), zero_fields_near_cylorigin(zero_fields_near_cylorigin),
@@ -215,6 +353,9 @@ fields_chunk::fields_chunk(structure_chunk *the_s, const char *od, double m, dou
   s->refcount++;
   outdir = od;
   new_s = NULL;
+  cost_time = 0;
+  for (int i = 0; i < NUM_STEP_PHASES; ++i)
+    phase_time[i] = 0;
   is_real = 0;
   a = s->a;
   Courant = s->Courant;
@@ -246,6 +387,7 @@ fields_chunk::fields_chunk(structure_chunk *the_s, const char *od, double m, dou
     f_u[c][cmp] = NULL;
     f_w[c][cmp] = NULL;
     f_cond[c][cmp] = NULL;
+    eh_fused[c][cmp] = false;
     f_minus_p[c][cmp] = NULL;
     f_w_prev[c][cmp] = NULL;
     f_backup[c][cmp] = NULL;
@@ -254,6 +396,7 @@ fields_chunk::fields_chunk(structure_chunk *the_s, const char *od, double m, dou
     f_cond_backup[c][cmp] = NULL;
   }
   f_rderiv_int = NULL;
+  arena = new chunk_arena(gv.ntot());
   FOR_FIELD_TYPES(ft) {
     for (int ip = 0; ip < 3; ip++)
       num_connections[ft][ip][Incoming] = num_connections[ft][ip][Outgoing] = 0;
@@ -271,6 +414,9 @@ fields_chunk::fields_chunk(const fields_chunk &thef) : gv(thef.gv), v(thef.v) {
   s = thef.s;
   s->refcount++;
   outdir = thef.outdir;
+  cost_time = thef.cost_time;
+  for (int i = 0; i < NUM_STEP_PHASES; ++i)
+    phase_time[i] = thef.phase_time[i];
   m = thef.m;
   zero_fields_near_cylorigin = thef.zero_fields_near_cylorigin;
   beta = thef.beta;
@@ -302,11 +448,13 @@ fields_chunk::fields_chunk(const fields_chunk &thef) : gv(thef.gv), v(thef.v) {
   doing_solve_cw = thef.doing_solve_cw;
   solve_cw_omega = thef.solve_cw_omega;
   FOR_FIELD_TYPES(ft) { sources[ft] = NULL; }
+  arena = new chunk_arena(gv.ntot());
   FOR_COMPONENTS(c) DOCMP2 {
     f[c][cmp] = NULL;
     f_u[c][cmp] = NULL;
     f_w[c][cmp] = NULL;
     f_cond[c][cmp] = NULL;
+    eh_fused[c][cmp] = false;
     f_backup[c][cmp] = NULL;
     f_u_backup[c][cmp] = NULL;
     f_w_backup[c][cmp] = NULL;
@@ -314,19 +462,19 @@ fields_chunk::fields_chunk(const fields_chunk &thef) : gv(thef.gv), v(thef.v) {
   }
   FOR_COMPONENTS(c) DOCMP {
     if (!is_magnetic(c) && thef.f[c][cmp]) {
-      f[c][cmp] = new realnum[gv.ntot()];
+      f[c][cmp] = arena->alloc();
       memcpy(f[c][cmp], thef.f[c][cmp], sizeof(realnum) * gv.ntot());
     }
     if (thef.f_u[c][cmp]) {
-      f_u[c][cmp] = new realnum[gv.ntot()];
+      f_u[c][cmp] = arena->alloc();
       memcpy(f_u[c][cmp], thef.f_u[c][cmp], sizeof(realnum) * gv.ntot());
     }
     if (thef.f_w[c][cmp]) {
-      f_w[c][cmp] = new realnum[gv.ntot()];
+      f_w[c][cmp] = arena->alloc();
       memcpy(f_w[c][cmp], thef.f_w[c][cmp], sizeof(realnum) * gv.ntot());
     }
     if (thef.f_cond[c][cmp]) {
-      f_cond[c][cmp] = new realnum[gv.ntot()];
+      f_cond[c][cmp] = arena->alloc();
       memcpy(f_cond[c][cmp], thef.f_cond[c][cmp], sizeof(realnum) * gv.ntot());
     }
   }
@@ -334,7 +482,7 @@ fields_chunk::fields_chunk(const fields_chunk &thef) : gv(thef.gv), v(thef.v) {
     if (thef.f[c][cmp] == thef.f[c - Hx + Bx][cmp])
       f[c][cmp] = f[c - Hx + Bx][cmp];
     else if (thef.f[c][cmp]) {
-      f[c][cmp] = new realnum[gv.ntot()];
+      f[c][cmp] = arena->alloc();
       memcpy(f[c][cmp], thef.f[c][cmp], sizeof(realnum) * gv.ntot());
     }
   }
@@ -350,11 +498,11 @@ fields_chunk::fields_chunk(const fields_chunk &thef) : gv(thef.gv), v(thef.v) {
   }
   FOR_COMPONENTS(c) DOCMP2 {
     if (thef.f_minus_p[c][cmp]) {
-      f_minus_p[c][cmp] = new realnum[gv.ntot()];
+      f_minus_p[c][cmp] = arena->alloc();
       memcpy(f_minus_p[c][cmp], thef.f_minus_p[c][cmp], sizeof(realnum) * gv.ntot());
     }
     if (thef.f_w_prev[c][cmp]) {
-      f_w_prev[c][cmp] = new realnum[gv.ntot()];
+      f_w_prev[c][cmp] = arena->alloc();
       memcpy(f_w_prev[c][cmp], thef.f_w_prev[c][cmp], sizeof(realnum) * gv.ntot());
     }
   }
@@ -454,16 +602,14 @@ bool fields_chunk::alloc_f(component c) {
              H fields if needed (if mu != 1 or in PML) in update_eh */
           component bc = direction_component(Bx, component_direction(c));
           if (!f[bc][cmp]) {
-            f[bc][cmp] = new realnum[gv.ntot()];
-            for (size_t i = 0; i < gv.ntot(); i++)
-              f[bc][cmp][i] = 0.0;
+            f[bc][cmp] = arena->alloc();
+            array_fill(f[bc][cmp], gv.ntot(), 0.0);
           }
           f[c][cmp] = f[bc][cmp];
         }
         else {
-          f[c][cmp] = new realnum[gv.ntot()];
-          for (size_t i = 0; i < gv.ntot(); i++)
-            f[c][cmp][i] = 0.0;
+          f[c][cmp] = arena->alloc();
+          array_fill(f[c][cmp], gv.ntot(), 0.0);
         }
       }
     }
@@ -585,7 +731,7 @@ void fields_chunk::use_real_fields() {
     if (f[hc][1] == f[bc][1]) f[bc][1] = NULL;
   }
   FOR_COMPONENTS(c) if (f[c][1]) {
-    delete[] f[c][1];
+    arena->free(f[c][1]);
     f[c][1] = 0;
   }
   if (is_mine()) FOR_FIELD_TYPES(ft) {
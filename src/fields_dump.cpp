@@ -0,0 +1,312 @@
+/* Copyright (C) 2005-2019 Massachusetts Institute of Technology
+%
+%  This program is free software; you can redistribute it and/or modify
+%  it under the terms of the GNU General Public License as published by
+%  the Free Software Foundation; either version 2, or (at your option)
+%  any later version.
+%
+%  This program is distributed in the hope that it will be useful,
+%  but WITHOUT ANY WARRANTY; without even the implied warranty of
+%  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+%  GNU General Public License for more details.
+%
+%  You should have received a copy of the GNU General Public License
+%  along with this program; if not, write to the Free Software Foundation,
+%  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+*/
+
+// Dump/load the time-stepping state of the fields to/from an HDF5 file,
+// for checkpoint/restart.  Like structure::dump, this only works if the
+// number of processors/chunks is the same, and the fields must have been
+// set up in the same way (structure, sources and DFTs) before loading.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "meep.hpp"
+#include "meep_internals.hpp"
+
+using namespace std;
+
+namespace meep {
+
+/* The realnum arrays of a chunk holding time-stepping state: the fields
+   and the auxiliary fields of PML, conductivity and dispersive media. */
+#define NUM_DUMP_ARRAYS 6
+
+static realnum **dump_array(fields_chunk *fc, int k, component c, int cmp) {
+  switch (k) {
+    case 0: return &fc->f[c][cmp];
+    case 1: return &fc->f_u[c][cmp];
+    case 2: return &fc->f_w[c][cmp];
+    case 3: return &fc->f_cond[c][cmp];
+    case 4: return &fc->f_w_prev[c][cmp];
+    default: return &fc->f_minus_p[c][cmp];
+  }
+}
+
+// the H fields are initially the same arrays as the B fields (see alloc_f)
+static bool aliased_array(fields_chunk *fc, int k, component c, int cmp) {
+  return k == 0 && is_magnetic(c) &&
+         fc->f[c][cmp] == fc->f[direction_component(Bx, component_direction(c))][cmp];
+}
+
+#define LAYOUT_INDEX(i, k, c, cmp)                                                                 \
+  ((((i)*NUM_DUMP_ARRAYS + (k)) * NUM_FIELD_COMPONENTS + (c)) * 2 + (cmp))
+
+/* The layout of the dump: for each chunk, array and component, 0 if
+   there is no array, 1 if there is one, or 2 for H arrays shared with B,
+   and for each chunk, field type and polarization the number of realnum
+   values of its internal data (0 if none).  Only this process's chunks
+   are filled in. */
+static void my_dump_layout(fields_chunk **chunks, int num_chunks, int npol_max, size_t *layout,
+                           size_t *pol_layout) {
+  memset(layout, 0, sizeof(size_t) * num_chunks * NUM_DUMP_ARRAYS * NUM_FIELD_COMPONENTS * 2);
+  memset(pol_layout, 0, sizeof(size_t) * num_chunks * NUM_FIELD_TYPES * npol_max);
+  for (int i = 0; i < num_chunks; i++)
+    if (chunks[i]->is_mine()) {
+      for (int k = 0; k < NUM_DUMP_ARRAYS; ++k)
+        FOR_COMPONENTS(c) DOCMP2 {
+          if (*dump_array(chunks[i], k, c, cmp))
+            layout[LAYOUT_INDEX(i, k, c, cmp)] = aliased_array(chunks[i], k, c, cmp) ? 2 : 1;
+        }
+      FOR_FIELD_TYPES(ft) {
+        int j = 0;
+        for (polarization_state *p = chunks[i]->pol[ft]; p; p = p->next, ++j)
+          pol_layout[(i * NUM_FIELD_TYPES + ft) * npol_max + j] = p->s->num_internal_data(p->data);
+      }
+    }
+}
+
+static int max_num_pols(fields_chunk **chunks, int num_chunks) {
+  int npol_max = 1;
+  for (int i = 0; i < num_chunks; i++)
+    FOR_FIELD_TYPES(ft) {
+      int n = 0;
+      for (polarization_state *p = chunks[i]->pol[ft]; p; p = p->next)
+        ++n;
+      npol_max = max(npol_max, n);
+    }
+  return max_to_all(npol_max);
+}
+
+void fields::dump(const char *filename) {
+  if (synchronized_magnetic_fields)
+    abort("fields::dump cannot be called while the magnetic fields are synchronized");
+  if (verbosity > 0)
+    master_printf("creating fields output file \"%s\" at time step %d...\n", filename, t);
+
+  const int npol_max = max_num_pols(chunks, num_chunks);
+  const int nlayout = num_chunks * NUM_DUMP_ARRAYS * NUM_FIELD_COMPONENTS * 2;
+  const int npol_layout = num_chunks * NUM_FIELD_TYPES * npol_max;
+  size_t *my_layout = new size_t[nlayout], *my_pol_layout = new size_t[npol_layout];
+  my_dump_layout(chunks, num_chunks, npol_max, my_layout, my_pol_layout);
+  size_t *layout = new size_t[nlayout], *pol_layout = new size_t[npol_layout];
+  sum_to_all(my_layout, layout, nlayout);
+  sum_to_all(my_pol_layout, pol_layout, npol_layout);
+  delete[] my_layout;
+  delete[] my_pol_layout;
+
+  // determine total dataset sizes and offsets of this process's data
+  size_t my_n = 0, my_npol = 0;
+  for (int i = 0; i < num_chunks; i++)
+    if (chunks[i]->is_mine()) {
+      for (int k = 0; k < NUM_DUMP_ARRAYS; ++k)
+        FOR_COMPONENTS(c) DOCMP2 {
+          if (layout[LAYOUT_INDEX(i, k, c, cmp)] == 1) my_n += chunks[i]->gv.ntot();
+        }
+      for (int j = 0; j < NUM_FIELD_TYPES * npol_max; ++j)
+        my_npol += pol_layout[i * NUM_FIELD_TYPES * npol_max + j];
+    }
+  size_t my_start = partial_sum_to_all(my_n) - my_n, ntotal = sum_to_all(my_n);
+  size_t my_pol_start = partial_sum_to_all(my_npol) - my_npol, npoltotal = sum_to_all(my_npol);
+
+  h5file file(filename, h5file::WRITE, true);
+
+  {
+    size_t info[5] = {size_t(t), size_t(phasein_time), size_t(is_real), size_t(num_chunks),
+                      size_t(npol_max)};
+    size_t len = 5, start = 0;
+    file.create_data("fields_info", 1, &len);
+    if (am_master()) file.write_chunk(1, &start, &len, info);
+    file.prevent_deadlock(); // hackery
+  }
+  {
+    size_t dims[5] = {size_t(num_chunks), NUM_DUMP_ARRAYS, NUM_FIELD_COMPONENTS, 2, 0};
+    size_t start[5] = {0, 0, 0, 0, 0};
+    file.create_data("fields_layout", 4, dims);
+    if (am_master()) file.write_chunk(4, start, dims, layout);
+    file.prevent_deadlock(); // hackery
+    dims[1] = NUM_FIELD_TYPES;
+    dims[2] = npol_max;
+    file.create_data("pol_layout", 3, dims);
+    if (am_master()) file.write_chunk(3, start, dims, pol_layout);
+    file.prevent_deadlock(); // hackery
+  }
+
+  // write the field arrays, in full precision
+  if (ntotal) {
+    file.create_data("fields", 1, &ntotal, false, false);
+    for (int i = 0; i < num_chunks; i++)
+      if (chunks[i]->is_mine()) {
+        size_t ntot = chunks[i]->gv.ntot();
+        for (int k = 0; k < NUM_DUMP_ARRAYS; ++k)
+          FOR_COMPONENTS(c) DOCMP2 {
+            if (layout[LAYOUT_INDEX(i, k, c, cmp)] == 1) {
+              file.write_chunk(1, &my_start, &ntot, *dump_array(chunks[i], k, c, cmp));
+              my_start += ntot;
+            }
+          }
+      }
+    file.done_writing_chunks();
+    file.prevent_deadlock(); // hackery
+  }
+
+  // write the internal data of the polarizations
+  if (npoltotal) {
+    file.create_data("polarizations", 1, &npoltotal, false, false);
+    for (int i = 0; i < num_chunks; i++)
+      if (chunks[i]->is_mine()) FOR_FIELD_TYPES(ft) {
+          for (polarization_state *p = chunks[i]->pol[ft]; p; p = p->next) {
+            size_t n = p->s->num_internal_data(p->data);
+            if (!n) continue;
+            realnum *buf = new realnum[n];
+            p->s->dump_internal_data(p->data, buf);
+            file.write_chunk(1, &my_pol_start, &n, buf);
+            delete[] buf;
+            my_pol_start += n;
+          }
+        }
+    file.done_writing_chunks();
+    file.prevent_deadlock(); // hackery
+  }
+
+  dump_dfts(&file);
+
+  delete[] pol_layout;
+  delete[] layout;
+}
+
+void fields::load(const char *filename) {
+  if (synchronized_magnetic_fields)
+    abort("fields::load cannot be called while the magnetic fields are synchronized");
+  if (verbosity > 0) master_printf("reading fields from file \"%s\"...\n", filename);
+
+  h5file file(filename, h5file::READONLY, true);
+
+  int rank;
+  size_t dims[5] = {0, 0, 0, 0, 0}, start[5] = {0, 0, 0, 0, 0};
+  size_t info[5];
+  file.read_size("fields_info", &rank, dims, 1);
+  if (rank != 1 || dims[0] != 5) abort("fields::load: invalid fields file %s", filename);
+  file.read_chunk(1, start, dims, info);
+  file.prevent_deadlock(); // hackery
+  if (int(info[3]) != num_chunks)
+    abort("fields::load: %s has %d chunks, not %d", filename, int(info[3]), num_chunks);
+  if (int(info[2]) != is_real)
+    abort("fields::load: %s has %s fields", filename, info[2] ? "real" : "complex");
+  const int npol_max = int(info[4]);
+  if (max_num_pols(chunks, num_chunks) > npol_max)
+    abort("fields::load: the susceptibilities do not match %s", filename);
+
+  const int nlayout = num_chunks * NUM_DUMP_ARRAYS * NUM_FIELD_COMPONENTS * 2;
+  const int npol_layout = num_chunks * NUM_FIELD_TYPES * npol_max;
+  size_t *layout = new size_t[nlayout], *pol_layout = new size_t[npol_layout];
+  file.read_size("fields_layout", &rank, dims, 4);
+  if (rank != 4 || size_t(nlayout) != dims[0] * dims[1] * dims[2] * dims[3])
+    abort("fields::load: invalid fields file %s", filename);
+  file.read_chunk(4, start, dims, layout);
+  file.read_size("pol_layout", &rank, dims, 3);
+  if (rank != 3 || size_t(npol_layout) != dims[0] * dims[1] * dims[2])
+    abort("fields::load: invalid fields file %s", filename);
+  file.read_chunk(3, start, dims, pol_layout);
+  file.prevent_deadlock(); // hackery
+
+  // allocate the field components (collectively) and auxiliary arrays of the dump
+  FOR_COMPONENTS(c) {
+    bool needed = false;
+    for (int i = 0; i < num_chunks; i++)
+      DOCMP2 { needed = needed || layout[LAYOUT_INDEX(i, 0, c, cmp)]; }
+    if (needed && gv.has_field(c)) require_component(c);
+  }
+  size_t my_n = 0, my_npol = 0;
+  for (int i = 0; i < num_chunks; i++)
+    if (chunks[i]->is_mine()) {
+      fields_chunk *fc = chunks[i];
+      size_t ntot = fc->gv.ntot();
+      for (int k = 0; k < NUM_DUMP_ARRAYS; ++k)
+        FOR_COMPONENTS(c) DOCMP2 {
+          realnum **a = dump_array(fc, k, c, cmp);
+          size_t have = layout[LAYOUT_INDEX(i, k, c, cmp)];
+          if (have == 1) {
+            if (!*a || aliased_array(fc, k, c, cmp)) *a = fc->arena->alloc();
+            my_n += ntot;
+          }
+          else if (bool(*a) != bool(have) || (have == 2 && !aliased_array(fc, k, c, cmp)))
+            abort("fields::load: the %s fields do not match %s", component_name(c), filename);
+        }
+      FOR_FIELD_TYPES(ft) {
+        int j = 0;
+        for (polarization_state *p = fc->pol[ft]; p; p = p->next, ++j) {
+          size_t n = pol_layout[(i * NUM_FIELD_TYPES + ft) * npol_max + j];
+          if (n && !p->data) {
+            p->data = p->s->new_internal_data(fc->f, fc->gv);
+            if (p->data) p->s->init_internal_data(fc->f, dt, fc->gv, p->data);
+          }
+          if (p->s->num_internal_data(p->data) != n)
+            abort("fields::load: the polarizations do not match %s", filename);
+          my_npol += n;
+        }
+      }
+    }
+  size_t my_start = partial_sum_to_all(my_n) - my_n, ntotal = sum_to_all(my_n);
+  size_t my_pol_start = partial_sum_to_all(my_npol) - my_npol, npoltotal = sum_to_all(my_npol);
+
+  if (ntotal) {
+    file.read_size("fields", &rank, dims, 1);
+    if (rank != 1 || dims[0] != ntotal) abort("fields::load: invalid fields file %s", filename);
+    for (int i = 0; i < num_chunks; i++)
+      if (chunks[i]->is_mine()) {
+        size_t ntot = chunks[i]->gv.ntot();
+        for (int k = 0; k < NUM_DUMP_ARRAYS; ++k)
+          FOR_COMPONENTS(c) DOCMP2 {
+            if (layout[LAYOUT_INDEX(i, k, c, cmp)] == 1) {
+              file.read_chunk(1, &my_start, &ntot, *dump_array(chunks[i], k, c, cmp));
+              my_start += ntot;
+            }
+          }
+      }
+    file.prevent_deadlock(); // hackery
+  }
+
+  if (npoltotal) {
+    file.read_size("polarizations", &rank, dims, 1);
+    if (rank != 1 || dims[0] != npoltotal)
+      abort("fields::load: invalid fields file %s", filename);
+    for (int i = 0; i < num_chunks; i++)
+      if (chunks[i]->is_mine()) FOR_FIELD_TYPES(ft) {
+          for (polarization_state *p = chunks[i]->pol[ft]; p; p = p->next) {
+            size_t n = p->s->num_internal_data(p->data);
+            if (!n) continue;
+            realnum *buf = new realnum[n];
+            file.read_chunk(1, &my_pol_start, &n, buf);
+            p->s->load_internal_data(p->data, buf);
+            delete[] buf;
+            my_pol_start += n;
+          }
+        }
+    file.prevent_deadlock(); // hackery
+  }
+
+  load_dfts(&file);
+
+  t = int(info[0]);
+  phasein_time = int(info[1]);
+  chunk_connections_valid = false; // the connections point into the old arrays
+
+  delete[] pol_layout;
+  delete[] layout;
+}
+
+} // namespace meep
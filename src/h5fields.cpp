@@ -19,11 +19,20 @@
    very similarly to integrate.cpp (using fields::loop_in_chunks). */
 
 #include <algorithm>
+#include <deque>
+#include <vector>
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
 
 #include "meep_internals.hpp"
+#include "config.h"
+
+#ifdef HAVE_LIBPTHREAD
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
 
 using namespace std;
 
@@ -31,16 +40,149 @@ namespace meep {
 
 /***************************************************************************/
 
+/* Asynchronous output (fields::use_async_output): output_hdf5 still
+   computes the output slabs synchronously, but copies them into a job
+   that is written, together with the creation or extension of the
+   dataset, by a background thread.  At most max_pending_outputs jobs are
+   queued (including the one being written); output_hdf5 blocks when the
+   queue is full.  Since HDF5 is not generally thread-safe, every other
+   HDF5 file access (h5file::get_id) first waits for the queue to drain. */
+
+typedef struct {
+  size_t start[3], count[3];
+  realnum *data;
+} h5_output_slab;
+
+typedef struct {
+  h5file *file;
+  char *dataname; // NULL to just delete the file
+  int rank;
+  size_t dims[3], chunk_dims[3];
+  bool append_data, single_precision;
+  vector<h5_output_slab> slabs;
+  vector<double> irr_dims, irr_maps; // attributes of irreducible output, if any
+} h5_output_job;
+
+static void write_irreducible_attrs(h5file *file, const char *dataname,
+                                    const vector<double> &irr_dims,
+                                    const vector<double> &irr_maps);
+
+static void write_output_job(h5_output_job *job) {
+  if (job->dataname) {
+    job->file->create_or_extend_data(job->dataname, job->rank, job->dims, job->append_data,
+                                     job->single_precision, job->chunk_dims);
+    for (size_t i = 0; i < job->slabs.size(); ++i) {
+      job->file->write_chunk(job->rank, job->slabs[i].start, job->slabs[i].count,
+                             job->slabs[i].data);
+      delete[] job->slabs[i].data;
+    }
+    if (!job->irr_maps.empty())
+      write_irreducible_attrs(job->file, job->dataname, job->irr_dims, job->irr_maps);
+    job->file->done_writing_chunks();
+    delete[] job->dataname;
+  }
+  else
+    delete job->file;
+  delete job;
+}
+
+#ifdef HAVE_LIBPTHREAD
+static mutex async_mutex;
+static condition_variable async_cond;
+static deque<h5_output_job *> async_queue;
+static bool async_busy = false; // whether the writer thread is running
+static thread::id async_writer;
+
+static void async_output_thread() {
+  unique_lock<mutex> lock(async_mutex);
+  async_writer = this_thread::get_id();
+  while (!async_queue.empty()) {
+    h5_output_job *job = async_queue.front();
+    lock.unlock();
+    write_output_job(job);
+    lock.lock();
+    async_queue.pop_front(); // only now, so that the queue bounds the staged data
+    async_cond.notify_all();
+  }
+  async_writer = thread::id();
+  async_busy = false;
+  async_cond.notify_all();
+}
+
+static void enqueue_output_job(h5_output_job *job, int max_pending) {
+  unique_lock<mutex> lock(async_mutex);
+  while (async_queue.size() >= size_t(std::max(1, max_pending)))
+    async_cond.wait(lock);
+  async_queue.push_back(job);
+  if (!async_busy) {
+    async_busy = true;
+    thread(async_output_thread).detach(); // exits when the queue is empty
+  }
+}
+
+void wait_for_async_output() {
+  unique_lock<mutex> lock(async_mutex);
+  if (this_thread::get_id() == async_writer) return;
+  while (async_busy)
+    async_cond.wait(lock);
+}
+#else
+static void enqueue_output_job(h5_output_job *job, int max_pending) {
+  (void)max_pending; // unused
+  write_output_job(job);
+}
+
+void wait_for_async_output() {}
+#endif
+
+static bool async_output_enabled(const fields *f) {
+#ifdef HAVE_LIBPTHREAD
+  return f->async_output && count_processors() == 1;
+#else
+  (void)f; // unused
+  return false;
+#endif
+}
+
+/* delete a file opened by output_hdf5, after any pending output to it */
+static void delete_output_file(const fields *f, h5file *file) {
+  if (async_output_enabled(f)) {
+    h5_output_job *job = new h5_output_job;
+    job->file = file;
+    job->dataname = NULL;
+    enqueue_output_job(job, f->max_pending_outputs);
+  }
+  else
+    delete file;
+}
+
+/***************************************************************************/
+
 typedef struct {
   // information related to the HDF5 dataset (its size, etcetera)
   h5file *file;
+  h5_output_job *job; // non-NULL for asynchronous output
   ivec min_corner, max_corner;
-  int num_chunks;
+  int num_chunks, my_num_chunks;
+  size_t extent[5]; // largest chunk size in each direction, for HDF5 chunking
   realnum *buf;
   size_t bufsz;
   int rank;
   direction ds[3];
 
+  // irreducible output (fields::set_output_irreducible): only the chunks
+  // themselves (the identity image of the points each chunk owns)
+  bool irreducible;
+
+  // subsampling (fields::set_output_stride): only every ostride-th point is
+  // output, or with oaverage the averages over ostride^rank blocks, which
+  // are accumulated in avg (the whole output array) since blocks can span
+  // several chunks
+  int ostride;
+  bool oaverage;
+  size_t odims[3];
+  double *avg;
+
   int reim; // whether to output the real or imaginary part
 
   // the function to output and related info (offsets for averaging, etc.)
@@ -77,6 +219,7 @@ static void h5_findsize_chunkloop(fields_chunk *fc, int ichnk, component cgrid,
   UNUSED(dV1);
   UNUSED(shift_phase);
   h5_output_data *data = (h5_output_data *)data_;
+  if (data->irreducible && sn != 0) return;
   ivec isS = S.transform(is, sn) + shift;
   ivec ieS = S.transform(ie, sn) + shift;
   data->min_corner = min(data->min_corner, min(isS, ieS));
@@ -86,6 +229,10 @@ static void h5_findsize_chunkloop(fields_chunk *fc, int ichnk, component cgrid,
   LOOP_OVER_DIRECTIONS(fc->gv.dim, d) {
     bufsz *= (ie.in_direction(d) - is.in_direction(d)) / 2 + 1;
   }
+  LOOP_OVER_DIRECTIONS(fc->gv.dim, d) {
+    size_t n = abs(ieS.in_direction(d) - isS.in_direction(d)) / 2 + 1;
+    data->extent[d] = max(data->extent[d], n);
+  }
   data->bufsz = max(data->bufsz, bufsz);
 }
 
@@ -102,6 +249,7 @@ static void h5_output_chunkloop(fields_chunk *fc, int ichnk, component cgrid, iv
   UNUSED(dV0);
   UNUSED(dV1);
   h5_output_data *data = (h5_output_data *)data_;
+  if (data->irreducible && sn != 0) return;
 
   //-----------------------------------------------------------------------//
   // Find output chunk dimensions and strides, etc.
@@ -137,6 +285,19 @@ static void h5_output_chunkloop(fields_chunk *fc, int ichnk, component cgrid, iv
     if (offset[j]) stride[j] *= -1;
   }
 
+  // with subsampling, the part of the (strided) output covered by this chunk
+  const int os = data->ostride;
+  size_t ostart[3] = {0, 0, 0}, ocount[3] = {1, 1, 1}, ostr[3] = {1, 1, 1};
+  if (os > 1) {
+    for (int i = 0; i < data->rank; ++i) {
+      ostart[i] = (start[i] + os - 1) / os;
+      size_t oend = (start[i] + count[i] - 1) / os + 1;
+      ocount[i] = oend > ostart[i] ? oend - ostart[i] : 0;
+    }
+    for (int i = data->rank - 2; i >= 0; --i)
+      ostr[i] = ostr[i + 1] * (data->oaverage ? data->odims[i + 1] : ocount[i + 1]);
+  }
+
   //-----------------------------------------------------------------------//
   // Compute the function to output, exactly as in fields::integrate,
   // except that here we store its values in a buffer instead of integrating.
@@ -168,6 +329,27 @@ static void h5_output_chunkloop(fields_chunk *fc, int ichnk, component cgrid, iv
 
   vec rshift(shift * (0.5 * fc->gv.inva));
   LOOP_OVER_IVECS(fc->gv, is, ie, idx) {
+    ptrdiff_t oidx = 0;
+    double oweight = 1.0;
+    if (os > 1) { // skip points that are not output, before computing anything
+      IVEC_LOOP_ILOC(fc->gv, iloc);
+      ivec ilocS = S.transform(iloc, sn) + shift;
+      bool skip = false;
+      for (int i = 0; i < data->rank; ++i) {
+        direction d = data->ds[i];
+        size_t g = (ilocS.in_direction(d) - data->min_corner.in_direction(d)) / 2;
+        if (data->oaverage) {
+          size_t n = (data->max_corner.in_direction(d) - data->min_corner.in_direction(d)) / 2 + 1;
+          oidx += (g / os) * ostr[i];
+          oweight /= std::min(size_t(os), n - (g / os) * os); // size of this block
+        }
+        else if (g % os)
+          skip = true;
+        else
+          oidx += (g / os - ostart[i]) * ostr[i];
+      }
+      if (skip) continue;
+    }
     IVEC_LOOP_LOC(fc->gv, loc);
     loc = S.transform(loc, sn) + rshift;
 
@@ -210,17 +392,127 @@ static void h5_output_chunkloop(fields_chunk *fc, int ichnk, component cgrid, iv
     }
 
     complex<double> fun = data->fun(fields, loc, data->fun_data_);
+    double val = data->reim ? imag(fun) : real(fun);
+    if (os > 1) {
+      if (data->oaverage)
+        data->avg[oidx] += oweight * val;
+      else
+        data->buf[oidx] = val;
+      continue;
+    }
     ptrdiff_t idx2 =
         ((((offset[0] + offset[1] + offset[2]) + loop_i1 * stride[0]) + loop_i2 * stride[1]) +
          loop_i3 * stride[2]);
-    data->buf[idx2] = data->reim ? imag(fun) : real(fun);
+    data->buf[idx2] = val;
   }
 
   //-----------------------------------------------------------------------//
 
-  data->file->write_chunk(data->rank, start, count, data->buf);
+  if (os > 1) {
+    if (data->oaverage) return; // written by output_hdf5 once all chunks are summed
+    for (int i = 0; i < data->rank; ++i) {
+      if (ocount[i] == 0) { // no output points in this chunk
+        --data->my_num_chunks; // (padded by output_hdf5 for collective writes)
+        return;
+      }
+      start[i] = ostart[i];
+      count[i] = ocount[i];
+    }
+  }
+
+  if (data->job) {
+    h5_output_slab slab;
+    size_t n = 1;
+    for (int i = 0; i < 3; ++i) {
+      slab.start[i] = start[i];
+      slab.count[i] = count[i];
+      if (i < data->rank) n *= count[i];
+    }
+    slab.data = new realnum[n];
+    memcpy(slab.data, data->buf, n * sizeof(realnum));
+    data->job->slabs.push_back(slab);
+  }
+  else
+    data->file->write_chunk(data->rank, start, count, data->buf);
+}
+
+/***************************************************************************/
+
+/* Irreducible output (fields::set_output_irreducible): with a symmetry S,
+   a dataset of a single component is written only at the points owned by
+   the chunks (the identity image in loop_in_chunks), i.e. the irreducible
+   part of where.  The IRREDUCIBLE_DIMS attribute gives the dimensions of the full
+   array and IRREDUCIBLE_MAPS, for each of the S.multiplicity() images, the
+   offset o[rank], the integer matrix M[rank][rank] (row-major) and the real
+   phase p such that full[o + M j] = p * data[j] for each index j of the
+   dataset (with a trailing time index, if any, left unchanged). */
+
+static const char IRREDUCIBLE_DIMS[] = "meep_irreducible_dims";
+static const char IRREDUCIBLE_MAPS[] = "meep_irreducible_maps";
+
+static void write_irreducible_attrs(h5file *file, const char *dataname,
+                                    const vector<double> &irr_dims,
+                                    const vector<double> &irr_maps) {
+  file->write_attr(dataname, IRREDUCIBLE_DIMS, irr_dims.size(), &irr_dims[0]);
+  file->write_attr(dataname, IRREDUCIBLE_MAPS, irr_maps.size(), &irr_maps[0]);
+}
+
+/* Compute the IRREDUCIBLE_MAPS of component c from the corners of the full
+   and of the irreducible output, returning false if the full output is not
+   just the images of the irreducible one with a real phase: if the full box
+   is not symmetric (where is not), if an image maps c to another component
+   (e.g. Ex to Ey under a rotation) or has a complex phase, or if it does not
+   map the output directions onto themselves. */
+static bool irreducible_maps(const symmetry &S, component c, int rank, const direction *ds,
+                             const size_t *dims, const ivec &full_min, const ivec &full_max,
+                             const ivec &irr_min, const ivec &irr_max, vector<double> &maps) {
+  maps.clear();
+  for (int sn = 0; sn < S.multiplicity(); ++sn) {
+    const ivec a = S.transform(full_min, sn), b = S.transform(full_max, sn);
+    if (min(a, b) != full_min || max(a, b) != full_max) return false;
+
+    complex<double> ph = 1.0;
+    if (c != Dielectric && c != Permeability) {
+      if (S.transform(c, -sn) != c) return false;
+      ph = S.phase_shift(c, sn);
+      if (imag(ph) != 0) return false;
+    }
+
+    // the image of the corner irr_min, and of a step along each output direction
+    const ivec q0 = S.transform(irr_min, sn), q1 = S.transform(irr_max, sn);
+    ivec steps[3];
+    for (int j = 0; j < rank; ++j) {
+      ivec e(zero_ivec(irr_min.dim));
+      e.set_direction(ds[j], 2);
+      steps[j] = S.transform(irr_min + e, sn) - q0;
+    }
+    LOOP_OVER_DIRECTIONS(irr_min.dim, d) {
+      bool output_d = false;
+      for (int j = 0; j < rank; ++j)
+        output_d = output_d || ds[j] == d;
+      if (output_d) continue;
+      if (q0.in_direction(d) != full_min.in_direction(d)) return false;
+      for (int j = 0; j < rank; ++j)
+        if (steps[j].in_direction(d) != 0) return false;
+    }
+    for (int i = 0; i < rank; ++i) {
+      const direction d = ds[i];
+      const int lo = std::min(q0.in_direction(d), q1.in_direction(d));
+      const int hi = std::max(q0.in_direction(d), q1.in_direction(d));
+      if (lo < full_min.in_direction(d) || (hi - full_min.in_direction(d)) / 2 >= int(dims[i]))
+        return false;
+      maps.push_back((q0.in_direction(d) - full_min.in_direction(d)) / 2);
+    }
+    for (int i = 0; i < rank; ++i)
+      for (int j = 0; j < rank; ++j)
+        maps.push_back(steps[j].in_direction(ds[i]) / 2);
+    maps.push_back(real(ph));
+  }
+  return true;
 }
 
+static complex<double> component_fun(const complex<double> *fields, const vec &loc, void *data_);
+
 void fields::output_hdf5(h5file *file, const char *dataname, int num_fields,
                          const component *components, field_function fun, void *fun_data_, int reim,
                          const volume &where, bool append_data, bool single_precision,
@@ -229,22 +521,28 @@ void fields::output_hdf5(h5file *file, const char *dataname, int num_fields,
   h5_output_data data;
 
   data.file = file;
+  data.job = NULL;
   data.min_corner = gv.round_vec(where.get_max_corner()) + one_ivec(gv.dim);
   data.max_corner = gv.round_vec(where.get_min_corner()) - one_ivec(gv.dim);
   data.num_chunks = 0;
   data.bufsz = 0;
+  for (int i = 0; i < 5; ++i)
+    data.extent[i] = 1;
   data.reim = reim;
+  data.irreducible = false;
 
   loop_in_chunks(h5_findsize_chunkloop, (void *)&data, where, Centered, true, true);
 
-  file->prevent_deadlock(); // can't hold a lock since *_to_all is collective
+  const bool async = async_output_enabled(this);
+  if (!async) file->prevent_deadlock(); // can't hold a lock since *_to_all is collective
   data.max_corner = max_to_all(data.max_corner);
   data.min_corner = -max_to_all(-data.min_corner); // i.e., min_to_all
+  data.my_num_chunks = data.num_chunks;
   data.num_chunks = sum_to_all(data.num_chunks);
   if (data.num_chunks == 0 || !(data.min_corner <= data.max_corner)) return; // no data to write;
 
   int rank = 0;
-  size_t dims[3];
+  size_t dims[3], chunk_dims[3];
   LOOP_OVER_DIRECTIONS(gv.dim, d) {
     if (rank >= 3) abort("too many dimensions in output_hdf5");
     size_t n =
@@ -252,12 +550,85 @@ void fields::output_hdf5(h5file *file, const char *dataname, int num_fields,
 
     if (n > 1) {
       data.ds[rank] = d;
+      // align the HDF5 chunks with the largest meep chunk
+      chunk_dims[rank] = max_to_all(int(data.extent[d]));
       dims[rank++] = n;
     }
   }
   data.rank = rank;
 
-  file->create_or_extend_data(dataname, rank, dims, append_data, single_precision);
+  // irreducible output: the same directions, but only for the chunks themselves
+  // (not looping without symmetry, which includes the padding of the chunks,
+  // not updated beyond a mirror plane)
+  vector<double> irr_dims, irr_maps;
+  if (output_irreducible && S.multiplicity() > 1 && rank > 0 && output_stride <= 1 &&
+      num_fields == 1 && fun == component_fun) {
+    h5_output_data idata = data;
+    idata.min_corner = gv.round_vec(where.get_max_corner()) + one_ivec(gv.dim);
+    idata.max_corner = gv.round_vec(where.get_min_corner()) - one_ivec(gv.dim);
+    idata.num_chunks = 0;
+    idata.bufsz = 0;
+    for (int i = 0; i < 5; ++i)
+      idata.extent[i] = 1;
+    idata.irreducible = true;
+    loop_in_chunks(h5_findsize_chunkloop, (void *)&idata, where, Centered, true, true);
+    idata.max_corner = max_to_all(idata.max_corner);
+    idata.min_corner = -max_to_all(-idata.min_corner);
+    if (idata.min_corner <= idata.max_corner &&
+        irreducible_maps(S, components[0], rank, data.ds, dims, data.min_corner,
+                         data.max_corner, idata.min_corner, idata.max_corner, irr_maps)) {
+      for (int i = 0; i < rank; ++i) {
+        const direction d = data.ds[i];
+        irr_dims.push_back(dims[i]);
+        dims[i] = (idata.max_corner.in_direction(d) - idata.min_corner.in_direction(d)) / 2 + 1;
+        chunk_dims[i] = max_to_all(int(idata.extent[d]));
+      }
+      data.min_corner = idata.min_corner;
+      data.max_corner = idata.max_corner;
+      data.bufsz = idata.bufsz;
+      data.my_num_chunks = idata.num_chunks;
+      data.num_chunks = sum_to_all(idata.num_chunks);
+    }
+    else
+      irr_maps.clear();
+  }
+  const bool irreducible = !irr_maps.empty();
+  data.irreducible = irreducible;
+
+  data.ostride = std::max(1, output_stride);
+  data.oaverage = output_block_average;
+  data.avg = NULL;
+  if (data.ostride > 1) {
+    size_t ntot = 1;
+    for (int i = 0; i < rank; ++i) {
+      dims[i] = data.odims[i] = (dims[i] - 1) / data.ostride + 1;
+      chunk_dims[i] = (chunk_dims[i] - 1) / data.ostride + 1;
+      ntot *= dims[i];
+    }
+    if (data.oaverage) {
+      data.avg = new double[ntot];
+      for (size_t i = 0; i < ntot; ++i)
+        data.avg[i] = 0;
+    }
+  }
+
+  if (async) {
+    data.job = new h5_output_job;
+    data.job->file = file;
+    data.job->dataname = new char[strlen(dataname) + 1];
+    strcpy(data.job->dataname, dataname);
+    data.job->rank = rank;
+    for (int i = 0; i < 3; ++i)
+      data.job->dims[i] = i < rank ? dims[i] : 1;
+    data.job->append_data = append_data;
+    data.job->single_precision = single_precision;
+    for (int i = 0; i < 3; ++i)
+      data.job->chunk_dims[i] = i < rank ? chunk_dims[i] : 1;
+    data.job->irr_dims = irr_dims;
+    data.job->irr_maps = irr_maps;
+  }
+  else if (!data.avg) // block averages: created after the collective sum_to_master below
+    file->create_or_extend_data(dataname, rank, dims, append_data, single_precision, chunk_dims);
 
   data.buf = new realnum[data.bufsz];
 
@@ -306,12 +677,61 @@ void fields::output_hdf5(h5file *file, const char *dataname, int num_fields,
 
   loop_in_chunks(h5_output_chunkloop, (void *)&data, where, Centered, true, true);
 
+  if (data.avg) { // block averages: sum the partial sums, and write from the master
+    size_t ntot = 1;
+    for (int i = 0; i < rank; ++i)
+      ntot *= dims[i];
+    double *avg = new double[ntot];
+    sum_to_master(data.avg, avg, int(ntot));
+    if (!async)
+      file->create_or_extend_data(dataname, rank, dims, append_data, single_precision, chunk_dims);
+    delete[] data.buf;
+    data.buf = new realnum[ntot];
+    for (size_t i = 0; i < ntot; ++i)
+      data.buf[i] = avg[i];
+    delete[] avg;
+    delete[] data.avg;
+    data.my_num_chunks = am_master(); // others are padded below for collective writes
+    if (am_master()) {
+      size_t start[3] = {0, 0, 0}, count[3] = {1, 1, 1};
+      for (int i = 0; i < rank; ++i)
+        count[i] = dims[i];
+      if (data.job) {
+        h5_output_slab slab;
+        for (int i = 0; i < 3; ++i) {
+          slab.start[i] = start[i];
+          slab.count[i] = count[i];
+        }
+        slab.data = data.buf;
+        data.buf = NULL;
+        data.job->slabs.push_back(slab);
+      }
+      else
+        file->write_chunk(rank, start, count, data.buf);
+    }
+  }
+
+  if (!async && file->collective_io()) {
+    // collective writes: every process makes the same number of write_chunk calls
+    int max_num_chunks = max_to_all(data.my_num_chunks);
+    size_t start[3] = {0, 0, 0}, count[3] = {0, 0, 0};
+    for (int i = data.my_num_chunks; i < max_num_chunks; ++i)
+      file->write_chunk(rank, start, count, data.buf);
+  }
+
   delete[] data.offsets;
   delete[] data.fields;
   delete[] data.ph;
   delete[] data.cS;
   delete[] data.buf;
-  file->done_writing_chunks();
+  if (async)
+    enqueue_output_job(data.job, max_pending_outputs);
+  else {
+    // before done_writing_chunks, which may release the file: the master reopening it
+    // alone would desynchronize the exclusive-access locking of non-parallel HDF5
+    if (irreducible) write_irreducible_attrs(file, dataname, irr_dims, irr_maps);
+    file->done_writing_chunks();
+  }
   finished_working();
 }
 
@@ -339,7 +759,7 @@ void fields::output_hdf5(const char *dataname, int num_fields, const component *
                 single_precision, omega);
     delete[] dataname2;
   }
-  if (delete_file) delete file;
+  if (delete_file) delete_output_file(this, file);
 }
 
 /***************************************************************************/
@@ -367,7 +787,7 @@ void fields::output_hdf5(const char *dataname, int num_fields, const component *
   output_hdf5(file, dataname, num_fields, components, rintegrand_fun, (void *)&data, 0, where,
               append_data, single_precision, omega);
 
-  if (delete_file) delete file;
+  if (delete_file) delete_output_file(this, file);
 }
 
 /***************************************************************************/
@@ -402,7 +822,7 @@ void fields::output_hdf5(component c, const volume &where, h5file *file, bool ap
                 omega);
   }
 
-  if (delete_file) delete file;
+  if (delete_file) delete_output_file(this, file);
 }
 
 /***************************************************************************/
@@ -455,4 +875,74 @@ h5file *fields::open_h5file(const char *name, h5file::access_mode mode, const ch
   return new h5file(filename, mode, true);
 }
 
+/***************************************************************************/
+
+realnum *read_expanded_hdf5(h5file *file, const char *dataname, int *rank, size_t *dims,
+                            int maxrank) {
+  if (!dataname) abort("read_expanded_hdf5 needs a dataset name");
+  int r;
+  size_t d[4];
+  realnum *data = file->read(dataname, &r, d, 4);
+
+  double fdims[3];
+  const int frank = int(file->read_attr(dataname, IRREDUCIBLE_DIMS, 3, fdims));
+  if (frank == 0) { // an ordinary dataset
+    if (r > maxrank) abort("input array rank is too big");
+    *rank = r;
+    for (int i = 0; i < r; ++i)
+      dims[i] = d[i];
+    return data;
+  }
+  if (frank > 3) abort("invalid %s attribute of %s", IRREDUCIBLE_DIMS, dataname);
+  for (; r < frank; ++r)
+    d[r] = 1; // undo the rank-0 convention of h5file::read
+  if (r > frank + 1) abort("rank mismatch in irreducible dataset %s", dataname);
+  const size_t nt = r > frank ? d[frank] : 1; // time slices of appended data
+  if (r > maxrank) abort("input array rank is too big");
+
+  const size_t nmaps = file->read_attr(dataname, IRREDUCIBLE_MAPS, 0, NULL);
+  const size_t maplen = frank + frank * frank + 1;
+  if (nmaps == 0 || nmaps % maplen) abort("invalid %s attribute of %s", IRREDUCIBLE_MAPS, dataname);
+  vector<double> maps(nmaps);
+  file->read_attr(dataname, IRREDUCIBLE_MAPS, nmaps, &maps[0]);
+
+  size_t nfull = 1, nirr = 1;
+  for (int i = 0; i < frank; ++i) {
+    nfull *= size_t(fdims[i]);
+    nirr *= d[i];
+  }
+  realnum *full = new realnum[nfull * nt];
+  for (size_t i = 0; i < nfull * nt; ++i)
+    full[i] = 0;
+
+  for (size_t m = 0; m < nmaps; m += maplen) {
+    const double *o = &maps[m], *M = &maps[m + frank], phase = maps[m + maplen - 1];
+    for (size_t j = 0; j < nirr; ++j) {
+      ptrdiff_t jj[3], idx = 0;
+      size_t jrest = j;
+      for (int k = frank - 1; k >= 0; --k) { // j is a row-major index
+        jj[k] = ptrdiff_t(jrest % d[k]);
+        jrest /= d[k];
+      }
+      for (int i = 0; i < frank; ++i) {
+        ptrdiff_t ii = ptrdiff_t(o[i]);
+        for (int k = 0; k < frank; ++k)
+          ii += ptrdiff_t(M[i * frank + k]) * jj[k];
+        if (ii < 0 || ii >= ptrdiff_t(fdims[i]))
+          abort("image outside of the full array in irreducible dataset %s", dataname);
+        idx = idx * ptrdiff_t(fdims[i]) + ii;
+      }
+      for (size_t t = 0; t < nt; ++t)
+        full[idx * nt + t] = phase * data[j * nt + t];
+    }
+  }
+  delete[] data;
+
+  *rank = r;
+  for (int i = 0; i < frank; ++i)
+    dims[i] = size_t(fdims[i]);
+  if (r > frank) dims[frank] = nt;
+  return full;
+}
+
 } // namespace meep
\ No newline at end of file
@@ -15,6 +15,7 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <string.h>
@@ -94,6 +95,9 @@ using namespace std;
 
 namespace meep {
 
+static int default_aggregators = 0;   // see set_hdf5_aggregators
+static int default_append_buffer = 1; // see set_hdf5_append_buffer
+
 bool h5file::dataset_exists(const char *name) {
 #if HAVE_HDF5
   hid_t data_id;
@@ -107,16 +111,28 @@ bool h5file::dataset_exists(const char *name) {
 
 // lazy file creation & locking
 void *h5file::get_id() {
+  wait_for_async_output();
   if (HID(id) < 0) {
-    if (parallel) all_wait();
+    CHECK(is_aggregator(), "only the aggregator processes can open the file");
+    if (parallel) wait_writers();
 
 #ifdef HAVE_HDF5
     hid_t access_props = H5Pcreate(H5P_FILE_ACCESS);
 #ifdef HAVE_MPI
 #ifdef HAVE_H5PSET_FAPL_MPIO
-    if (parallel) H5Pset_fapl_mpio(access_props, MPI_COMM_WORLD, MPI_INFO_NULL);
+    if (parallel) {
+      MPI_Info info = MPI_INFO_NULL;
+      if (!mpi_hints.empty()) {
+        MPI_Info_create(&info);
+        for (size_t i = 0; i + 1 < mpi_hints.size(); i += 2)
+          MPI_Info_set(info, mpi_hints[i], mpi_hints[i + 1]);
+      }
+      H5Pset_fapl_mpio(access_props, agg_comm ? *(MPI_Comm *)agg_comm : MPI_COMM_WORLD, info);
+      if (info != MPI_INFO_NULL) MPI_Info_free(&info);
+    }
 #else
-    if (parallel) begin_critical_section(h5io_critical_section_tag);
+    if (parallel)
+      begin_critical_section(agg_stride > 1 ? agg_tag : h5io_critical_section_tag, agg_stride);
 #endif
 #endif
 
@@ -142,7 +158,9 @@ void h5file::close_id() {
 #ifdef HAVE_HDF5
   if (HID(id) >= 0) {
     H5Fclose(HID(id));
-    IF_EXCLUSIVE(if (parallel) end_critical_section(h5io_critical_section_tag++), (void)0);
+    IF_EXCLUSIVE(if (parallel) end_critical_section(
+                     agg_stride > 1 ? agg_tag++ : h5io_critical_section_tag++, agg_stride),
+                 (void)0);
   }
 #endif
   HID(id) = -1;
@@ -161,9 +179,21 @@ h5file::h5file(const char *filename_, access_mode m, bool parallel_) {
   strcpy(filename, filename_);
   mode = m;
   parallel = parallel_;
+  collective = false;
+  chunk_rank = 0;
+  deflate_level = 0;
+  filter_id = 0;
+  agg_stride = 1;
+  agg_tag = 0;
+  agg_comm = NULL;
+  if (parallel && default_aggregators > 0) set_aggregators(default_aggregators);
+  append_buffer = default_append_buffer;
 }
 
 h5file::~h5file() {
+  wait_for_async_output();
+  flush_aggregated();
+  flush_appends();
   close_id();
   if (cur_dataname) free(cur_dataname); // allocated with realloc
   for (h5file::extending_s *cur = extending; cur;) {
@@ -175,11 +205,102 @@ h5file::~h5file() {
   delete[] filename;
   free(cur_id);
   free(id);
+  for (size_t i = 0; i < mpi_hints.size(); ++i)
+    delete[] mpi_hints[i];
+#if defined(HAVE_H5PSET_FAPL_MPIO) && defined(HAVE_MPI)
+  if (agg_comm) {
+    if (*(MPI_Comm *)agg_comm != MPI_COMM_NULL) MPI_Comm_free((MPI_Comm *)agg_comm);
+    delete (MPI_Comm *)agg_comm;
+  }
+#endif
+}
+
+void h5file::set_chunking(int rank, const size_t *chunk_dims) {
+  CHECK(rank >= 0 && rank <= 5, "invalid chunking rank");
+  chunk_rank = rank;
+  for (int i = 0; i < rank; ++i)
+    chunk_hint[i] = chunk_dims[i];
+}
+
+void h5file::set_compression(int deflate_level_, unsigned filter_id_, size_t nparams,
+                             const unsigned *params) {
+  CHECK(deflate_level_ >= 0 && deflate_level_ <= 9, "invalid deflate level");
+  deflate_level = deflate_level_;
+  filter_id = filter_id_;
+  filter_params.assign(params, params + nparams);
+}
+
+bool h5file::collective_io() const {
+#if defined(HAVE_H5PSET_FAPL_MPIO) && defined(HAVE_MPI)
+  return collective && parallel && agg_stride == 1 && count_processors() > 1;
+#else
+  return false;
+#endif
+}
+
+void h5file::set_mpi_hint(const char *key, const char *value) {
+  CHECK(HID(id) < 0, "MPI-IO hints must be set before the file is opened");
+  const char *kv[2] = {key, value};
+  for (int i = 0; i < 2; ++i) {
+    char *s = new char[strlen(kv[i]) + 1];
+    strcpy(s, kv[i]);
+    mpi_hints.push_back(s);
+  }
+}
+
+void set_hdf5_aggregators(int n) { default_aggregators = n; }
+
+void h5file::set_aggregators(int n) {
+  CHECK(HID(id) < 0, "aggregators must be set before the file is opened");
+  const int nprocs = count_processors();
+  agg_stride = (!parallel || n <= 0 || n >= nprocs) ? 1 : (nprocs + n - 1) / n;
+#if defined(HAVE_H5PSET_FAPL_MPIO) && defined(HAVE_MPI)
+  if (agg_comm) {
+    if (*(MPI_Comm *)agg_comm != MPI_COMM_NULL) MPI_Comm_free((MPI_Comm *)agg_comm);
+    delete (MPI_Comm *)agg_comm;
+    agg_comm = NULL;
+  }
+  if (agg_stride > 1) { // parallel HDF5 among the aggregators only
+    MPI_Comm *comm = new MPI_Comm;
+    MPI_Comm_split(MPI_COMM_WORLD, is_aggregator() ? 0 : MPI_UNDEFINED, my_rank(), comm);
+    agg_comm = (void *)comm;
+  }
+#endif
+}
+
+bool h5file::is_aggregator() const { return my_rank() % agg_stride == 0; }
+
+void set_hdf5_append_buffer(int nslices) { default_append_buffer = std::max(1, nslices); }
+
+void h5file::set_append_buffer(int nslices) {
+  append_buffer = std::max(1, nslices);
+}
+
+bool h5file::buffer_appends(const extending_s *cur) const {
+  return cur && append_buffer > 1 && !collective_io();
+}
+
+// collective: write all buffered time slices
+void h5file::flush_appends() {
+  if (mode == READONLY || !is_aggregator()) return;
+  for (extending_s *cur = extending; cur; cur = cur->next)
+    flush_extending(cur);
+}
+
+// barrier among the processes that open the file
+void h5file::wait_writers() {
+  if (agg_stride == 1)
+    all_wait();
+#if defined(HAVE_H5PSET_FAPL_MPIO) && defined(HAVE_MPI)
+  else
+    MPI_Barrier(*(MPI_Comm *)agg_comm);
+#endif
 }
 
 bool h5file::ok() { return (HID(get_id()) >= 0); }
 
 void h5file::remove() {
+  agg_pending.clear();
   close_id();
   if (mode == READWRITE) mode = WRITE; // now need to re-create file
   for (h5file::extending_s *cur = extending; cur;) {
@@ -224,6 +345,11 @@ void h5file::set_cur(const char *dataname, void *data_id) {
   }
 }
 
+#ifdef HAVE_HDF5
+static herr_t find_dataset(hid_t group_id, const char *name, void *d);
+#endif
+
+// dataname == NULL selects the first dataset in the file, as for read()
 void h5file::read_size(const char *dataname, int *rank, size_t *dims, int maxrank) {
 #ifdef HAVE_HDF5
   if (parallel || am_master()) {
@@ -231,6 +357,13 @@ void h5file::read_size(const char *dataname, int *rank, size_t *dims, int maxran
 
     CHECK(file_id >= 0, "error opening HDF5 input file");
 
+    char *dname = 0;
+    if (!dataname) {
+      CHECK(H5Giterate(file_id, "/", NULL, find_dataset, &dname) >= 0 && dname,
+            "cannot find dataset in HDF5 file");
+      dataname = dname;
+    }
+
     if (is_cur(dataname))
       data_id = HID(cur_id);
     else {
@@ -251,6 +384,7 @@ void h5file::read_size(const char *dataname, int *rank, size_t *dims, int maxran
     delete[] maxdims;
     delete[] dims_copy;
     H5Sclose(space_id);
+    delete[] dname;
   }
 
   if (!parallel) {
@@ -284,9 +418,11 @@ static herr_t find_dataset(hid_t group_id, const char *name, void *d) {
 #ifdef HAVE_HDF5
 #define REALNUM_H5T (sizeof(realnum) == sizeof(double) ? H5T_NATIVE_DOUBLE : H5T_NATIVE_FLOAT)
 #define SIZE_T_H5T (sizeof(size_t) == 4 ? H5T_NATIVE_UINT32 : H5T_NATIVE_UINT64)
+#define DOUBLE_H5T H5T_NATIVE_DOUBLE
 #else
 #define REALNUM_H5T 0
 #define SIZE_T_H5T 0
+#define DOUBLE_H5T 0
 #endif
 
 realnum *h5file::read(const char *dataname, int *rank, size_t *dims, int maxrank) {
@@ -409,12 +545,7 @@ char *h5file::read(const char *dataname) {
 
 /* Delete a dataset, if it exists.  In parallel mode, should be called
    by all processors. */
-void h5file::remove_data(const char *dataname) {
-#ifdef HAVE_HDF5
-  hid_t file_id = HID(get_id());
-
-  if (is_cur(dataname)) unset_cur();
-
+void h5file::remove_extending(const char *dataname) {
   if (get_extending(dataname)) { // delete dataname from extending list
     extending_s *prev = 0, *cur = extending;
     for (; cur && strcmp(cur->dataname, dataname); cur = (prev = cur)->next)
@@ -427,6 +558,15 @@ void h5file::remove_data(const char *dataname) {
     delete[] cur->dataname;
     delete cur;
   }
+}
+
+void h5file::remove_data(const char *dataname) {
+#ifdef HAVE_HDF5
+  hid_t file_id = HID(get_id());
+
+  if (is_cur(dataname)) unset_cur();
+
+  remove_extending(dataname);
 
   if (dataset_exists(dataname)) {
     /* this is hackish ...need to pester HDF5 developers to make
@@ -435,7 +575,7 @@ void h5file::remove_data(const char *dataname) {
       H5Gunlink(file_id, dataname); /* delete it */
       H5Fflush(file_id, H5F_SCOPE_GLOBAL);
     }
-    IF_EXCLUSIVE((void)0, if (parallel) all_wait());
+    IF_EXCLUSIVE((void)0, if (parallel) wait_writers());
   }
 #endif
 }
@@ -444,85 +584,119 @@ void h5file::remove_data(const char *dataname) {
    this should be called by *all* processors, even those not writing any
    data. */
 void h5file::create_data(const char *dataname, int rank, const size_t *dims, bool append_data,
-                         bool single_precision) {
+                         bool single_precision, const size_t *chunk_dims) {
 #ifdef HAVE_HDF5
-  int i;
-  hid_t file_id = HID(get_id()), space_id, data_id;
-  int rank1;
-
   CHECK(rank >= 0, "negative rank");
+  flush_aggregated();
 
-  // stupid HDF5 has problems with rank 0
-  rank1 = (rank == 0 && !append_data) ? 1 : rank;
-
-  CHECK(file_id >= 0, "error opening HDF5 output file");
+  if (!is_aggregator()) { // only keep track of the dataset for write_chunk
+    hid_t no_id = -1;
+    unset_cur();
+    remove_extending(dataname);
+    set_cur(dataname, &no_id);
+  }
+  else {
+    int i;
+    hid_t file_id = HID(get_id()), space_id, data_id;
+    int rank1;
 
-  unset_cur();
-  remove_data(dataname); // HDF5 gives error if we H5Dcreate existing dataset
-
-  if (IF_EXCLUSIVE(!parallel || am_master(), 1)) {
-    hsize_t *dims_copy = new hsize_t[rank1 + append_data];
-    hsize_t *maxdims = new hsize_t[rank1 + append_data];
-    hsize_t N = 1;
-    for (i = 0; i < rank; ++i)
-      N *= (maxdims[i] = dims_copy[i] = dims[i]);
-    if (!rank) maxdims[0] = dims_copy[0] = 1;
-    if (append_data) {
-      dims_copy[rank1] = 1;
-      maxdims[rank1] = H5S_UNLIMITED;
-    }
-    space_id = H5Screate_simple(rank1 + append_data, dims_copy, maxdims);
-    delete[] maxdims;
+    // stupid HDF5 has problems with rank 0
+    rank1 = (rank == 0 && !append_data) ? 1 : rank;
 
-    /* For unlimited datasets, we need to specify the size of the
-       "chunks" in which the file data is allocated.  */
-    hid_t prop_id = H5Pcreate(H5P_DATASET_CREATE);
-    if (append_data) {
-      const int blocksize = 128;
-      // make a chunk at least blocksize elements for efficiency
-      dims_copy[rank1] = (blocksize + (N - 1)) / N;
-      H5Pset_chunk(prop_id, rank1 + 1, dims_copy);
-      dims_copy[rank1] = 1;
-    }
+    CHECK(file_id >= 0, "error opening HDF5 output file");
 
-    delete[] dims_copy;
+    unset_cur();
+    remove_data(dataname); // HDF5 gives error if we H5Dcreate existing dataset
 
-    hid_t type_id = single_precision ? H5T_NATIVE_FLOAT : REALNUM_H5T;
+    if (IF_EXCLUSIVE(!parallel || am_master(), 1)) {
+      hsize_t *dims_copy = new hsize_t[rank1 + append_data];
+      hsize_t *maxdims = new hsize_t[rank1 + append_data];
+      hsize_t N = 1;
+      for (i = 0; i < rank; ++i)
+        N *= (maxdims[i] = dims_copy[i] = dims[i]);
+      if (!rank) maxdims[0] = dims_copy[0] = 1;
+      if (append_data) {
+        dims_copy[rank1] = 1;
+        maxdims[rank1] = H5S_UNLIMITED;
+      }
+      space_id = H5Screate_simple(rank1 + append_data, dims_copy, maxdims);
+      delete[] maxdims;
+
+      /* For unlimited or compressed datasets, we need to specify the size
+         of the "chunks" in which the file data is allocated; otherwise we
+         only do so if requested, or if hinted for parallel output.  */
+      hid_t prop_id = H5Pcreate(H5P_DATASET_CREATE);
+      bool filtered = deflate_level > 0 || filter_id > 0;
+      if (chunk_rank == rank && rank > 0)
+        chunk_dims = chunk_hint;
+      else if (!(filtered || (parallel && count_processors() > 1)))
+        chunk_dims = NULL;
+      if (chunk_dims && rank > 0) {
+        hsize_t *cdims = new hsize_t[rank1 + append_data];
+        hsize_t Nc = 1;
+        for (i = 0; i < rank; ++i)
+          Nc *= (cdims[i] = std::max(size_t(1), std::min(chunk_dims[i], dims[i])));
+        if (append_data) cdims[rank1] = append_buffer; // whole flushes of buffered appends
+        H5Pset_chunk(prop_id, rank1 + append_data, cdims);
+        delete[] cdims;
+      }
+      else if (append_data) {
+        const int blocksize = 128;
+        // make a chunk at least blocksize elements for efficiency
+        dims_copy[rank1] = (blocksize + (N - 1)) / N;
+        H5Pset_chunk(prop_id, rank1 + 1, dims_copy);
+        dims_copy[rank1] = 1;
+      }
+      else if (filtered)
+        H5Pset_chunk(prop_id, rank1, dims_copy); // the whole dataset in one chunk
+      if (filter_id > 0)
+        H5Pset_filter(prop_id, H5Z_filter_t(filter_id), H5Z_FLAG_OPTIONAL, filter_params.size(),
+                      filter_params.empty() ? NULL : &filter_params[0]);
+      if (deflate_level > 0) {
+        H5Pset_shuffle(prop_id);
+        H5Pset_deflate(prop_id, deflate_level);
+      }
 
-    data_id = H5Dcreate(file_id, dataname, type_id, space_id, prop_id);
-    if (data_id < 0) abort("Error creating dataset");
+      delete[] dims_copy;
 
-    H5Pclose(prop_id);
-  }
-  else {
-    data_id = H5Dopen(file_id, dataname);
-    CHECK(data_id >= 0, "missing dataset for subsequent processor");
-    space_id = H5Dget_space(data_id);
+      hid_t type_id = single_precision ? H5T_NATIVE_FLOAT : REALNUM_H5T;
 
-    CHECK(rank1 + append_data == H5Sget_simple_extent_ndims(space_id),
-          "file data is inconsistent rank for subsequent processor");
+      data_id = H5Dcreate(file_id, dataname, type_id, space_id, prop_id);
+      if (data_id < 0) abort("Error creating dataset");
 
-    hsize_t *dims_copy = new hsize_t[rank1 + append_data];
-    hsize_t *maxdims = new hsize_t[rank1 + append_data];
-    H5Sget_simple_extent_dims(space_id, dims_copy, maxdims);
-    CHECK(!append_data || maxdims[rank1] == H5S_UNLIMITED,
-          "file data is missing unlimited dimension for append_data");
-    delete[] maxdims;
-    for (i = 0; i < rank; ++i)
-      CHECK(dims[i] == dims_copy[i], "file data is inconsistent size for subsequent processor");
-    if (rank < rank1) CHECK(dims_copy[0] == 1, "rank-0 data is incorrect size");
+      H5Pclose(prop_id);
+    }
+    else {
+      data_id = H5Dopen(file_id, dataname);
+      CHECK(data_id >= 0, "missing dataset for subsequent processor");
+      space_id = H5Dget_space(data_id);
+
+      CHECK(rank1 + append_data == H5Sget_simple_extent_ndims(space_id),
+            "file data is inconsistent rank for subsequent processor");
+
+      hsize_t *dims_copy = new hsize_t[rank1 + append_data];
+      hsize_t *maxdims = new hsize_t[rank1 + append_data];
+      H5Sget_simple_extent_dims(space_id, dims_copy, maxdims);
+      CHECK(!append_data || maxdims[rank1] == H5S_UNLIMITED,
+            "file data is missing unlimited dimension for append_data");
+      delete[] maxdims;
+      for (i = 0; i < rank; ++i)
+        CHECK(dims[i] == dims_copy[i], "file data is inconsistent size for subsequent processor");
+      if (rank < rank1) CHECK(dims_copy[0] == 1, "rank-0 data is incorrect size");
+
+      delete[] dims_copy;
+    }
 
-    delete[] dims_copy;
+    set_cur(dataname, &data_id);
+    H5Sclose(space_id);
   }
 
-  set_cur(dataname, &data_id);
-  H5Sclose(space_id);
-
   if (append_data) {
     extending_s *cur = new extending_s;
     cur->dataname = new char[strlen(dataname) + 1];
     strcpy(cur->dataname, dataname);
     cur->dindex = 0;
+    cur->dflushed = buffer_appends(cur) ? 0 : 1;
     cur->next = extending;
     extending = cur;
   }
@@ -537,11 +711,24 @@ void h5file::create_data(const char *dataname, int rank, const size_t *dims, boo
    all processes. */
 void h5file::extend_data(const char *dataname, int rank, const size_t *dims) {
 #ifdef HAVE_HDF5
+  flush_aggregated();
   extending_s *cur = get_extending(dataname);
   CHECK(cur, "extend_data can only be called on extensible data");
+  if (!is_aggregator() || buffer_appends(cur)) {
+    // the file is only extended when the buffered slices are flushed
+    if (is_aggregator() && cur->dindex + 1 - cur->dflushed >= append_buffer) flush_extending(cur);
+    cur->dindex++;
+    if (!is_cur(dataname)) { // only keep track of the dataset for write_chunk
+      hid_t no_id = -1;
+      unset_cur();
+      set_cur(dataname, &no_id);
+    }
+    return;
+  }
+  flush_extending(cur); // anything buffered before buffering was disabled
 
   hid_t file_id = HID(get_id()), data_id;
-  if (is_cur(dataname))
+  if (is_cur(dataname) && HID(cur_id) >= 0)
     data_id = HID(cur_id);
   else {
     data_id = H5Dopen(file_id, dataname);
@@ -563,7 +750,7 @@ void h5file::extend_data(const char *dataname, int rank, const size_t *dims) {
 
   // Allocate more space along unlimited direction
   cur->dindex++;
-  dims_copy[rank] = cur->dindex + 1;
+  dims_copy[rank] = cur->dflushed = cur->dindex + 1;
   H5Dextend(data_id, dims_copy);
 
   delete[] dims_copy;
@@ -576,11 +763,12 @@ void h5file::extend_data(const char *dataname, int rank, const size_t *dims) {
 /* If append_data is true, dataname is the current dataset, and is
    extensible, then as extend_data; otherwise as create_data. */
 void h5file::create_or_extend_data(const char *dataname, int rank, const size_t *dims,
-                                   bool append_data, bool single_precision) {
+                                   bool append_data, bool single_precision,
+                                   const size_t *chunk_dims) {
   if (get_extending(dataname))
     extend_data(dataname, rank, dims);
   else
-    create_data(dataname, rank, dims, append_data, single_precision);
+    create_data(dataname, rank, dims, append_data, single_precision, chunk_dims);
 }
 
 /*****************************************************************************/
@@ -599,17 +787,19 @@ void h5file::create_or_extend_data(const char *dataname, int rank, const size_t
 
    This function does *not* need to be called on all CPUs (e.g. those
    that have no data can be skipped).
+
+   For extensible data, the chunk is written at time slice dindex, or at
+   nappend consecutive slices from dindex (with the slice index varying
+   fastest in data, as in the file).
 */
-static void _write_chunk(hid_t data_id, h5file::extending_s *cur, int rank,
+static void _write_chunk(hid_t data_id, bool append_data, int dindex, int nappend, int rank,
                          const size_t *chunk_start, const size_t *chunk_dims, hid_t datatype,
-                         void *data) {
+                         void *data, bool collective) {
 #ifdef HAVE_HDF5
   int i;
   bool do_write = true;
   hid_t space_id, mem_space_id;
   int rank1;
-  bool append_data = cur != NULL;
-  int dindex = cur ? cur->dindex : 0;
 
   CHECK(data_id >= 0, "create_data must be called before write_chunk");
 
@@ -641,19 +831,20 @@ static void _write_chunk(hid_t data_id, h5file::extending_s *cur, int rank,
   }
   if (append_data) {
     start[rank1] = dindex;
-    count[rank1] = 1;
+    count[rank1] = nappend;
   }
 
   if (count_prod > 0) {
     H5Sselect_hyperslab(space_id, H5S_SELECT_SET, start, NULL, count, NULL);
-    mem_space_id = H5Screate_simple(!rank1 ? 1 : rank1, count, NULL);
+    mem_space_id = H5Screate_simple(!(rank1 + append_data) ? 1 : rank1 + append_data, count, NULL);
     H5Sselect_all(mem_space_id);
   }
   else { /* this can happen on leftover processes in MPI */
     H5Sselect_none(space_id);
     mem_space_id = H5Scopy(space_id); /* can't create an empty space */
     H5Sselect_none(mem_space_id);
-    do_write = false; /* HDF5 complains about empty dataspaces */
+    do_write = collective; /* HDF5 complains about empty dataspaces, but
+                              collective writes need every process */
   }
 
   delete[] start;
@@ -662,7 +853,17 @@ static void _write_chunk(hid_t data_id, h5file::extending_s *cur, int rank,
   /*******************************************************************/
   /* Write the data, then free all the stuff we've allocated. */
 
-  if (do_write) H5Dwrite(data_id, datatype, mem_space_id, space_id, H5P_DEFAULT, (void *)data);
+  if (do_write) {
+    hid_t xfer_id = H5P_DEFAULT;
+#ifdef HAVE_H5PSET_FAPL_MPIO
+    if (collective) {
+      xfer_id = H5Pcreate(H5P_DATASET_XFER);
+      H5Pset_dxpl_mpio(xfer_id, H5FD_MPIO_COLLECTIVE);
+    }
+#endif
+    H5Dwrite(data_id, datatype, mem_space_id, space_id, xfer_id, (void *)data);
+    if (xfer_id != H5P_DEFAULT) H5Pclose(xfer_id);
+  }
 
   H5Sclose(mem_space_id);
   H5Sclose(space_id);
@@ -671,20 +872,206 @@ static void _write_chunk(hid_t data_id, h5file::extending_s *cur, int rank,
 #endif
 }
 
+/* Packed chunks, for aggregated output (set_aggregators) and buffered
+   appends (set_append_buffer): records of four ints (the data type: 0 =
+   realnum, 1 = size_t, 2 = double, the rank, the time slice dindex for
+   extensible data, and padding), the chunk start and dims, and the data
+   padded to a multiple of 8 bytes (to keep the records aligned). */
+#define AGG_PADDED(nbytes) (((nbytes) + 7) & ~size_t(7))
+
+static size_t packed_type_size(int type) {
+  return type == 0 ? sizeof(realnum) : (type == 1 ? sizeof(size_t) : sizeof(double));
+}
+
+static hid_t packed_type_h5t(int type) {
+  return type == 0 ? REALNUM_H5T : (type == 1 ? SIZE_T_H5T : DOUBLE_H5T);
+}
+
+typedef struct {
+  int type, rank, dindex;
+  const size_t *chunk_start, *chunk_dims;
+  char *data;
+  size_t count; // number of elements
+} packed_chunk;
+
+// unpack the record at buf, returning its size
+static size_t unpack_chunk(char *buf, packed_chunk &c) {
+  const int *header = (const int *)buf;
+  c.type = header[0];
+  c.rank = header[1];
+  c.dindex = header[2];
+  const int rank1 = c.rank ? c.rank : 1;
+  c.chunk_start = (const size_t *)(buf + 4 * sizeof(int));
+  c.chunk_dims = c.chunk_start + rank1;
+  c.data = (char *)(c.chunk_dims + rank1);
+  c.count = 1;
+  for (int i = 0; i < rank1; ++i)
+    c.count *= c.chunk_dims[i];
+  return c.data - buf + AGG_PADDED(c.count * packed_type_size(c.type));
+}
+
+void h5file::pack_chunk(std::vector<char> &buf, int type, int rank, int dindex,
+                        const size_t *chunk_start, const size_t *chunk_dims, const void *data) {
+  const int rank1 = rank ? rank : 1;
+  size_t n = 1;
+  for (int i = 0; i < rank1; ++i)
+    n *= chunk_dims[i];
+  if (n == 0) return;
+  const size_t size = packed_type_size(type);
+  const int header[4] = {type, rank, dindex, 0};
+  const char *parts[4] = {(const char *)header, (const char *)chunk_start,
+                          (const char *)chunk_dims, (const char *)data};
+  const size_t sizes[4] = {sizeof(header), rank1 * sizeof(size_t), rank1 * sizeof(size_t),
+                           n * size};
+  for (int i = 0; i < 4; ++i)
+    buf.insert(buf.end(), parts[i], parts[i] + sizes[i]);
+  buf.resize(buf.size() + AGG_PADDED(n * size) - n * size);
+}
+
+// write (or buffer, for buffered appends) a chunk of the current dataset on an aggregator
+void h5file::write_packed(int type, int rank, int dindex, const size_t *chunk_start,
+                          const size_t *chunk_dims, void *data, bool collective) {
+  extending_s *cur = get_extending(cur_dataname);
+  if (buffer_appends(cur))
+    pack_chunk(cur->pending, type, rank, dindex, chunk_start, chunk_dims, data);
+  else
+    _write_chunk(HID(cur_id), cur != NULL, dindex, 1, rank, chunk_start, chunk_dims,
+                 packed_type_h5t(type), data, collective);
+}
+
 void h5file::write_chunk(int rank, const size_t *chunk_start, const size_t *chunk_dims,
                          realnum *data) {
-  _write_chunk(HID(cur_id), get_extending(cur_dataname), rank, chunk_start, chunk_dims, REALNUM_H5T,
-               (void *)data);
+  extending_s *cur = get_extending(cur_dataname);
+  int dindex = cur ? cur->dindex : 0;
+  if (!is_aggregator())
+    pack_chunk(agg_pending, 0, rank, dindex, chunk_start, chunk_dims, data);
+  else
+    write_packed(0, rank, dindex, chunk_start, chunk_dims, data, collective_io());
 }
 
 void h5file::write_chunk(int rank, const size_t *chunk_start, const size_t *chunk_dims,
                          size_t *data) {
-  _write_chunk(HID(cur_id), get_extending(cur_dataname), rank, chunk_start, chunk_dims, SIZE_T_H5T,
-               (void *)data);
+  extending_s *cur = get_extending(cur_dataname);
+  int dindex = cur ? cur->dindex : 0;
+  if (!is_aggregator())
+    pack_chunk(agg_pending, 1, rank, dindex, chunk_start, chunk_dims, data);
+  else
+    write_packed(1, rank, dindex, chunk_start, chunk_dims, data, collective_io());
+}
+
+#if MEEP_SINGLE
+// double-precision data (e.g. DFT fields) is converted to the dataset type by HDF5
+void h5file::write_chunk(int rank, const size_t *chunk_start, const size_t *chunk_dims,
+                         double *data) {
+  extending_s *cur = get_extending(cur_dataname);
+  int dindex = cur ? cur->dindex : 0;
+  if (!is_aggregator())
+    pack_chunk(agg_pending, 2, rank, dindex, chunk_start, chunk_dims, data);
+  else
+    write_packed(2, rank, dindex, chunk_start, chunk_dims, data, collective_io());
+}
+#endif
+
+/* Aggregated output (set_aggregators): the chunks of a non-aggregator
+   process are packed into agg_pending, which flush_aggregated sends to the
+   aggregator to be written.  Collective (within each group of processes
+   sharing an aggregator). */
+void h5file::flush_aggregated() {
+  if (agg_stride == 1) return;
+  const int me = my_rank(), nprocs = count_processors();
+  const int agg = me - me % agg_stride;
+  if (me != agg) {
+    int n = int(agg_pending.size());
+    send(me, agg, (char *)&n, sizeof(int));
+    if (n) send(me, agg, &agg_pending[0], n);
+    agg_pending.clear();
+    return;
+  }
+  std::vector<char> buf;
+  for (int p = me + 1; p < std::min(me + agg_stride, nprocs); ++p) {
+    int n = 0;
+    send(p, me, (char *)&n, sizeof(int));
+    if (!n) continue;
+    buf.resize(n);
+    send(p, me, &buf[0], n);
+    packed_chunk c;
+    for (size_t pos = 0; pos < size_t(n);) {
+      pos += unpack_chunk(&buf[pos], c);
+      write_packed(c.type, c.rank, c.dindex, c.chunk_start, c.chunk_dims, c.data, false);
+    }
+  }
+}
+
+/* Write the buffered slices of an extensible dataset (set_append_buffer),
+   extending it first.  Chunks at the same position in consecutive slices
+   are written together, as a single hyperslab. */
+void h5file::flush_extending(extending_s *cur) {
+#ifdef HAVE_HDF5
+  if (cur->pending.empty() && cur->dflushed > cur->dindex) return;
+
+  hid_t data_id;
+  if (is_cur(cur->dataname) && HID(cur_id) >= 0)
+    data_id = HID(cur_id);
+  else {
+    data_id = H5Dopen(HID(get_id()), cur->dataname);
+    set_cur(cur->dataname, &data_id);
+  }
+  CHECK(data_id >= 0, "missing extensible dataset");
+
+  hid_t space_id = H5Dget_space(data_id);
+  int rank1 = H5Sget_simple_extent_ndims(space_id);
+  hsize_t *dims = new hsize_t[rank1];
+  H5Sget_simple_extent_dims(space_id, dims, NULL);
+  H5Sclose(space_id);
+  if (dims[rank1 - 1] < hsize_t(cur->dindex + 1)) {
+    dims[rank1 - 1] = cur->dindex + 1;
+    H5Dextend(data_id, dims);
+  }
+  delete[] dims;
+
+  std::vector<packed_chunk> chunks;
+  packed_chunk c;
+  for (size_t pos = 0; pos < cur->pending.size(); chunks.push_back(c))
+    pos += unpack_chunk(&cur->pending[pos], c);
+  std::vector<bool> done(chunks.size(), false);
+  std::vector<char> buf;
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    if (done[i]) continue;
+    const packed_chunk &c0 = chunks[i];
+    const int rank1 = c0.rank ? c0.rank : 1;
+    std::vector<size_t> group(1, i); // same chunk in consecutive slices
+    for (size_t j = i + 1; j < chunks.size(); ++j) {
+      const packed_chunk &c1 = chunks[j];
+      if (!done[j] && c1.type == c0.type && c1.rank == c0.rank &&
+          c1.dindex == chunks[group.back()].dindex + 1 &&
+          !memcmp(c1.chunk_start, c0.chunk_start, 2 * rank1 * sizeof(size_t))) {
+        group.push_back(j);
+        done[j] = true;
+      }
+    }
+    const size_t size = packed_type_size(c0.type), nappend = group.size();
+    char *data = c0.data;
+    if (nappend > 1) { // interleave the slices, with the slice index varying fastest
+      buf.resize(c0.count * nappend * size);
+      for (size_t t = 0; t < nappend; ++t)
+        for (size_t k = 0; k < c0.count; ++k)
+          memcpy(&buf[(k * nappend + t) * size], chunks[group[t]].data + k * size, size);
+      data = &buf[0];
+    }
+    _write_chunk(data_id, true, c0.dindex, int(nappend), c0.rank, c0.chunk_start, c0.chunk_dims,
+                 packed_type_h5t(c0.type), data, false);
+  }
+
+  cur->pending.clear();
+  cur->dflushed = cur->dindex + 1;
+#else
+  (void)cur;
+#endif
 }
 
 // collective call after completing all write_chunk calls
 void h5file::done_writing_chunks() {
+  flush_aggregated();
   /* hackery: in order to not deadlock when writing extensible datasets
      with a non-parallel version of HDF5, we need to close the file
      and release the lock after writing extensible chunks  ...here,
@@ -701,16 +1088,48 @@ void h5file::write(const char *dataname, int rank, const size_t *dims, realnum *
     for (int i = 0; i < rank; i++)
       start[i] = 0;
     create_data(dataname, rank, dims, false, single_precision);
-    if (am_master()) write_chunk(rank, start, dims, data);
+    if (am_master())
+      write_chunk(rank, start, dims, data);
+    else if (collective_io()) { // empty write, since collective writes need all processes
+      size_t *zero = new size_t[rank + 1];
+      for (int i = 0; i <= rank; i++)
+        zero[i] = 0;
+      write_chunk(rank, start, zero, data);
+      delete[] zero;
+    }
+    done_writing_chunks();
+    unset_cur();
+    delete[] start;
+  }
+}
+
+#if MEEP_SINGLE
+void h5file::write(const char *dataname, int rank, const size_t *dims, double *data,
+                   bool single_precision) {
+  if (parallel || am_master()) {
+    size_t *start = new size_t[rank + 1];
+    for (int i = 0; i < rank; i++)
+      start[i] = 0;
+    create_data(dataname, rank, dims, false, single_precision);
+    if (am_master())
+      write_chunk(rank, start, dims, data);
+    else if (collective_io()) { // empty write, since collective writes need all processes
+      size_t *zero = new size_t[rank + 1];
+      for (int i = 0; i <= rank; i++)
+        zero[i] = 0;
+      write_chunk(rank, start, zero, data);
+      delete[] zero;
+    }
     done_writing_chunks();
     unset_cur();
     delete[] start;
   }
 }
+#endif
 
 void h5file::write(const char *dataname, const char *data) {
 #ifdef HAVE_HDF5
-  if (IF_EXCLUSIVE(am_master(), parallel || am_master())) {
+  if (is_aggregator() && IF_EXCLUSIVE(am_master(), (parallel || am_master()))) {
     hid_t file_id = HID(get_id()), type_id, data_id, space_id;
 
     CHECK(file_id >= 0, "error opening HDF5 output file");
@@ -734,6 +1153,70 @@ void h5file::write(const char *dataname, const char *data) {
 #endif
 }
 
+void h5file::write_attr(const char *dataname, const char *attrname, size_t n,
+                        const double *vals) {
+#ifdef HAVE_HDF5
+  if (is_aggregator() && IF_EXCLUSIVE(am_master(), (parallel || am_master()))) {
+    hid_t file_id = HID(get_id()), data_id, space_id, attr_id;
+
+    CHECK(file_id >= 0, "error opening HDF5 output file");
+    CHECK(dataset_exists(dataname), "missing dataset in HDF5 file");
+
+    data_id = H5Dopen(file_id, dataname);
+    SUPPRESS_HDF5_ERRORS(H5Adelete(data_id, attrname)); // H5Acreate fails if it exists
+
+    hsize_t dims[1] = {n};
+    space_id = H5Screate_simple(1, dims, NULL);
+    attr_id = H5Acreate(data_id, attrname, H5T_NATIVE_DOUBLE, space_id, H5P_DEFAULT);
+    H5Awrite(attr_id, H5T_NATIVE_DOUBLE, (void *)vals);
+
+    H5Aclose(attr_id);
+    H5Sclose(space_id);
+    H5Dclose(data_id);
+  }
+#else
+  (void)dataname;
+  (void)attrname;
+  (void)n;
+  (void)vals;
+  abort("not compiled with HDF5, required for HDF5 output");
+#endif
+}
+
+size_t h5file::read_attr(const char *dataname, const char *attrname, size_t nmax, double *vals) {
+  int n = 0;
+#ifdef HAVE_HDF5
+  if (parallel || am_master()) {
+    hid_t file_id = HID(get_id()), data_id, attr_id;
+
+    CHECK(file_id >= 0, "error opening HDF5 input file");
+    CHECK(dataset_exists(dataname), "missing dataset in HDF5 file");
+
+    data_id = H5Dopen(file_id, dataname);
+    SUPPRESS_HDF5_ERRORS(attr_id = H5Aopen_name(data_id, attrname));
+    if (attr_id >= 0) {
+      hid_t space_id = H5Aget_space(attr_id);
+      n = int(H5Sget_simple_extent_npoints(space_id));
+      H5Sclose(space_id);
+      if (size_t(n) <= nmax) H5Aread(attr_id, H5T_NATIVE_DOUBLE, (void *)vals);
+      H5Aclose(attr_id);
+    }
+    H5Dclose(data_id);
+  }
+
+  if (!parallel) {
+    n = broadcast(0, n);
+    if (size_t(n) <= nmax) broadcast(0, vals, n);
+  }
+#else
+  (void)dataname;
+  (void)attrname;
+  (void)nmax;
+  (void)vals;
+#endif
+  return size_t(n);
+}
+
 /*****************************************************************************/
 
 /* Inverse of write_chunk, above.  The caller must first get the
@@ -812,4 +1295,11 @@ void h5file::read_chunk(int rank, const size_t *chunk_start, const size_t *chunk
   _read_chunk(HID(cur_id), rank, chunk_start, chunk_dims, SIZE_T_H5T, (void *)data);
 }
 
+#if MEEP_SINGLE
+void h5file::read_chunk(int rank, const size_t *chunk_start, const size_t *chunk_dims,
+                        double *data) {
+  _read_chunk(HID(cur_id), rank, chunk_start, chunk_dims, DOUBLE_H5T, (void *)data);
+}
+#endif
+
 } // namespace meep
@@ -193,8 +193,12 @@ complex<double> fields::integrate(int num_fvals, const component *components,
   delete[] data.ph;
   delete[] data.cS;
 
-  if (maxabs) *maxabs = max_to_all(data.maxabs);
-  data.sum = sum_to_all(data.sum);
+  if (!local_reductions) {
+    if (maxabs) *maxabs = max_to_all(data.maxabs);
+    data.sum = sum_to_all(data.sum);
+  }
+  else if (maxabs)
+    *maxabs = data.maxabs;
 
   return complex<double>(real(data.sum), imag(data.sum));
 }
@@ -282,8 +282,12 @@ complex<double> fields::integrate2(const fields &fields2, int num_fvals1,
   delete[] data.ph;
   delete[] data.cS;
 
-  if (maxabs) *maxabs = max_to_all(data.maxabs);
-  data.sum = sum_to_all(data.sum);
+  if (!local_reductions) {
+    if (maxabs) *maxabs = max_to_all(data.maxabs);
+    data.sum = sum_to_all(data.sum);
+  }
+  else if (maxabs)
+    *maxabs = data.maxabs;
 
   return complex<double>(real(data.sum), imag(data.sum));
 }
@@ -18,6 +18,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <deque>
+#include <vector>
 
 #include "meep.hpp"
 #include "meep_internals.hpp"
@@ -213,7 +215,7 @@ void chunkloop_field_components::update_values(ptrdiff_t idx) {
     ptrdiff_t ofs1 = offsets[2 * nc], ofs2 = offsets[2 * nc + 1];
     double favg[2] = {0.0, 0.0}; // real, imag parts
     for (int reim = 0; reim < 2; reim++) {
-      const double *fgrid = fc->f[cparent][reim];
+      const realnum *fgrid = fc->f[cparent][reim];
       if (!fgrid) continue;
       favg[reim] =
           0.25 * (fgrid[idx] + fgrid[idx + ofs1] + fgrid[idx + ofs2] + fgrid[idx + ofs1 + ofs2]);
@@ -250,6 +252,67 @@ static ivec vec2diel_ceil(const vec &pt, double a, const ivec &equal_shift) {
 
 static inline int iabs(int i) { return (i < 0 ? -i : i); }
 
+/* A loop plan records the chunkloop calls that loop_in_chunks makes
+   for a given WHERE, grid and flags: everything except the bloch phase,
+   which is recomputed from the lattice shift on each use so that plans
+   stay valid when k changes.  fields::loop_plans keeps the most
+   recently used plans, so that loops over the same volume on every
+   time step (flux_in_box, field_energy_in_box, integrate, ...) skip
+   the intersection and boundary-weight computations.  The plans depend
+   on the chunks, the symmetry and the boundary conditions, and are
+   discarded by set_boundary. */
+struct chunkloop_call {
+  int i, sn;
+  component cS;
+  ivec is, ie, shifti, ishift;
+  vec s0, s1, e0, e1;
+  double dV0, dV1;
+};
+
+struct loop_plan {
+  volume where;
+  component cgrid;
+  bool use_symmetry, snap_empty_dimensions;
+  std::vector<chunkloop_call> calls;
+
+  loop_plan(const volume &where, component cgrid, bool use_symmetry, bool snap_empty_dimensions)
+      : where(where), cgrid(cgrid), use_symmetry(use_symmetry),
+        snap_empty_dimensions(snap_empty_dimensions) {}
+};
+
+struct loop_plan_cache {
+  static const size_t max_plans = 16;
+  std::deque<loop_plan> plans; // least recently used first
+
+  const loop_plan *lookup(const volume &where, component cgrid, bool use_symmetry,
+                          bool snap_empty_dimensions) {
+    for (size_t i = 0; i < plans.size(); ++i) {
+      const loop_plan &p = plans[i];
+      if (p.where == where && p.cgrid == cgrid && p.use_symmetry == use_symmetry &&
+          p.snap_empty_dimensions == snap_empty_dimensions) {
+        if (i + 1 < plans.size()) { // move to the back
+          plans.push_back(p);
+          plans.erase(plans.begin() + i);
+        }
+        return &plans.back();
+      }
+    }
+    return NULL;
+  }
+
+  const loop_plan *insert(const loop_plan &p) {
+    plans.push_back(p);
+    while (plans.size() > max_plans)
+      plans.pop_front();
+    return &plans.back();
+  }
+};
+
+void fields::clear_loop_plans() {
+  delete loop_plans;
+  loop_plans = NULL;
+}
+
 /* Integration weights at boundaries (c.f. long comment at top).   */
 /* This code was formerly part of loop_in_chunks, now refactored   */
 /* as a separate routine so we can call it from get_array_metadata.*/
@@ -347,6 +410,26 @@ void fields::loop_in_chunks(field_chunkloop chunkloop, void *chunkloop_data, con
 
   if (cgrid == Permeability) cgrid = Centered;
 
+  const loop_plan *plan =
+      loop_plans ? loop_plans->lookup(where, cgrid, use_symmetry, snap_empty_dimensions) : NULL;
+  if (!plan) {
+    if (!loop_plans) loop_plans = new loop_plan_cache;
+    plan = loop_plans->insert(make_loop_plan(where, cgrid, use_symmetry, snap_empty_dimensions));
+  }
+
+  for (size_t n = 0; n < plan->calls.size(); ++n) {
+    const chunkloop_call &call = plan->calls[n];
+    complex<double> ph = 1.0;
+    LOOP_OVER_DIRECTIONS(gv.dim, d) { ph *= pow(eikna[d], call.ishift.in_direction(d)); }
+    chunkloop(chunks[call.i], call.i, call.cS, call.is, call.ie, call.s0, call.s1, call.e0,
+              call.e1, call.dV0, call.dV1, call.shifti, ph, S, call.sn, chunkloop_data);
+  }
+}
+
+loop_plan fields::make_loop_plan(const volume &where, component cgrid, bool use_symmetry,
+                                 bool snap_empty_dimensions) {
+  loop_plan plan(where, cgrid, use_symmetry, snap_empty_dimensions);
+
   /*
     We handle looping on an arbitrary component grid by shifting
     to the centered grid and then shifting back.  The looping
@@ -407,13 +490,11 @@ void fields::loop_in_chunks(field_chunkloop chunkloop, void *chunkloop_data, con
     // loop over lattice shifts
     ivec ishift(min_ishift);
     do {
-      complex<double> ph = 1.0;
       vec shift(gv.dim, 0.0);
       ivec shifti(gv.dim, 0);
       LOOP_OVER_DIRECTIONS(gv.dim, d) {
         shift.set_direction(d, L.in_direction(d) * ishift.in_direction(d));
         shifti.set_direction(d, iL.in_direction(d) * ishift.in_direction(d));
-        ph *= pow(eikna[d], ishift.in_direction(d));
       }
 
       for (int i = 0; i < num_chunks; ++i) {
@@ -504,8 +585,21 @@ void fields::loop_in_chunks(field_chunkloop chunkloop, void *chunkloop_data, con
                    fabs((S.transform(chunks[i]->gv[isc], sn) + shift - yee_c).in_direction(R));
           }
 
-          chunkloop(chunks[i], i, cS, isc - iyee_cS, iec - iyee_cS, s0c, s1c, e0c, e1c, dV0, dV1,
-                    shifti, ph, S, sn, chunkloop_data);
+          chunkloop_call call;
+          call.i = i;
+          call.sn = sn;
+          call.cS = cS;
+          call.is = isc - iyee_cS;
+          call.ie = iec - iyee_cS;
+          call.shifti = shifti;
+          call.ishift = ishift;
+          call.s0 = s0c;
+          call.s1 = s1c;
+          call.e0 = e0c;
+          call.e1 = e1c;
+          call.dV0 = dV0;
+          call.dV1 = dV1;
+          plan.calls.push_back(call);
         }
       }
 
@@ -518,6 +612,7 @@ void fields::loop_in_chunks(field_chunkloop chunkloop, void *chunkloop_data, con
       }
     } while (ishift != min_ishift);
   }
+  return plan;
 }
 
 } // namespace meep
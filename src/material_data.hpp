@@ -146,6 +146,11 @@ struct medium_struct {
 // describe the material properties at point x
 typedef void (*user_material_func)(vector3 x, void *user_data, medium_struct *medium);
 
+// batch variant of user_material_func: fills epsilon_diag[i] for the n
+// points x[i] in a single call (all other medium properties are vacuum)
+typedef void (*user_material_batch_func)(size_t n, const vector3 *x, void *user_data,
+                                         vector3 *epsilon_diag);
+
 // the various types of materials are as follows:
 //  MEDIUM:        material properties independent of position. In
 //                 this case the 'medium' field below is
@@ -172,19 +177,31 @@ struct material_data {
   medium_struct medium;
 
   // these fields used only if which_subclass==MATERIAL_USER
+  // (user_batch_func, if non-NULL, is used instead of user_func)
   user_material_func user_func;
+  user_material_batch_func user_batch_func;
   void *user_data;
   bool do_averaging;
 
   // these fields used only if which_subclass==MATERIAL_FILE
+  // epsilon_data holds the block of the epsilon_dims grid of size epsilon_count
+  // starting at epsilon_start (wrapping around periodically).  If epsilon_file
+  // ("fname.h5:dataname") is non-NULL, the block is read on demand by
+  // read_epsilon_files, and is only the part needed by this process's chunks.
   meep::realnum *epsilon_data;
   size_t epsilon_dims[3];
+  size_t epsilon_start[3];
+  size_t epsilon_count[3];
+  char *epsilon_file;
 
   material_data()
-      : which_subclass(MEDIUM), medium(), user_func(NULL), user_data(NULL), epsilon_data(NULL) {
-    epsilon_dims[0] = 0;
-    epsilon_dims[1] = 0;
-    epsilon_dims[2] = 0;
+      : which_subclass(MEDIUM), medium(), user_func(NULL), user_batch_func(NULL), user_data(NULL),
+        epsilon_data(NULL), epsilon_file(NULL) {
+    for (int i = 0; i < 3; ++i) {
+      epsilon_dims[i] = 0;
+      epsilon_start[i] = 0;
+      epsilon_count[i] = 0;
+    }
   }
 };
 
@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <math.h>
 
 #include "meep/vec.hpp"
@@ -34,7 +35,11 @@ namespace meep {
    single precision (since the errors are not dominated by roundoff).
    However, we will default to using double-precision for large
    arrays, as the factor of two in memory and the moderate increase
-   in speed currently don't seem worth the loss of precision. */
+   in speed currently don't seem worth the loss of precision.
+   Accumulated quantities, such as the DFT fields in dft_chunk and
+   dft_ldos, are always stored in double precision, so that the
+   Fourier-transformed outputs do not lose accuracy even when the
+   time-stepping is done in single precision. */
 #define MEEP_SINGLE 0 // 1 for single precision, 0 for double
 #if MEEP_SINGLE
 typedef float realnum;
@@ -46,6 +51,37 @@ typedef double realnum;
 
 extern int verbosity; // if 0, suppress all non-error messages from Meep; 1 is default, 2 is debug output
 
+/* The large per-chunk arrays (the fields, the material arrays and the
+   polarization data) are allocated with array_malloc and freed with
+   array_free (see array_alloc.cpp), aligned to cache lines and, if
+   requested by set_huge_pages, backed by 2 MB pages to reduce TLB misses
+   in the 3d loops.  array_malloc does not initialize the memory: the
+   operating system places each page on the NUMA node of the thread that
+   first writes it, so the arrays should be initialized with array_fill or
+   array_copy, which divide the array among the OpenMP threads like the
+   PLOOP_* macros do (or run serially in the thread stepping the chunk,
+   inside a parallel loop over chunks). */
+enum huge_pages_mode {
+  NoHugePages,          // ordinary pages (default)
+  TransparentHugePages, // ask the kernel for transparent huge pages (madvise)
+  ExplicitHugePages     // use the reserved hugetlbfs pool, falling back to transparent
+};
+void set_huge_pages(huge_pages_mode mode);
+huge_pages_mode get_huge_pages();
+void *array_malloc(size_t nbytes);
+void array_free(void *p);
+/* The DFT accumulators (dft_chunk::dft) of at least a megabyte are backed
+   by memory-mapped temporary files in the directory set by
+   set_dft_storage_dir (NULL, the default, to keep them in memory), e.g. on
+   a node-local SSD when they do not fit in RAM; set it before adding the
+   DFTs.  array_malloc_file returns such a zero-initialized array. */
+void set_dft_storage_dir(const char *dir);
+const char *get_dft_storage_dir();
+void *array_malloc_file(size_t nbytes, const char *dir);
+void array_fill(realnum *a, size_t n, realnum value);
+void array_copy(realnum *dst, const realnum *src, size_t n);
+inline realnum *new_realnum_array(size_t n) { return (realnum *)array_malloc(n * sizeof(realnum)); }
+
 const double pi = 3.141592653589793238462643383276;
 
 const double infinity = HUGE_VAL;
@@ -75,6 +111,7 @@ public:
       sigma[c][d] = NULL;
       trivial_sigma[c][d] = true;
     }
+    FOR_COMPONENTS(c) have_sigma_box[c] = false;
   }
   susceptibility(const susceptibility &s) {
     id = s.id;
@@ -84,6 +121,11 @@ public:
       sigma[c][d] = NULL;
       trivial_sigma[c][d] = true;
     }
+    FOR_COMPONENTS(c) {
+      have_sigma_box[c] = s.have_sigma_box[c];
+      sigma_lo[c] = s.sigma_lo[c];
+      sigma_hi[c] = s.sigma_hi[c];
+    }
   }
   virtual susceptibility *clone() const;
   virtual ~susceptibility() {
@@ -155,6 +197,21 @@ public:
     return 0;
   }
 
+  /* For fields::dump and fields::load: the time-stepping state held in
+     the internal data, as num_internal_data(data) realnum values. */
+  virtual size_t num_internal_data(void *data) const {
+    (void)data;
+    return 0;
+  }
+  virtual void dump_internal_data(void *data, realnum *buf) const {
+    (void)data;
+    (void)buf;
+  }
+  virtual void load_internal_data(void *data, const realnum *buf) const {
+    (void)data;
+    (void)buf;
+  }
+
   /* The following methods are used in boundaries.cpp to set up any
      extra communications that may be necessary at chunk boundaries
      for the internal data of a susceptibility's polarization
@@ -221,6 +278,17 @@ public:
      0 and the other != 0.) */
   bool trivial_sigma[NUM_FIELD_COMPONENTS][5];
 
+  /* If have_sigma_box[c], then the diagonal sigma[c][component_direction(c)]
+     is zero outside of the box sigma_lo[c]..sigma_hi[c] of the chunk's
+     grid_volume, so that update_P can skip the rest of the chunk, where the
+     polarization stays zero.  This is set by set_sigma_box whenever sigma
+     is set up (e.g. in structure_chunk::add_susceptibility). */
+  bool have_sigma_box[NUM_FIELD_COMPONENTS];
+  ivec sigma_lo[NUM_FIELD_COMPONENTS], sigma_hi[NUM_FIELD_COMPONENTS];
+  void set_sigma_box(component c, const grid_volume &gv);
+  // the owned points of c in the sigma box, returning false if there are none
+  bool owned_sigma_box(component c, const grid_volume &gv, ivec &is, ivec &ie) const;
+
 private:
   static int cur_id; // unique id to assign to next susceptibility object
   int id;            // id for this object and its clones, for comparison purposes
@@ -251,6 +319,10 @@ public:
   virtual void init_internal_data(realnum *W[NUM_FIELD_COMPONENTS][2], double dt,
                                   const grid_volume &gv, void *data) const;
   virtual void *copy_internal_data(void *data) const;
+  virtual size_t num_internal_data(void *data) const;
+  virtual void dump_internal_data(void *data, realnum *buf) const;
+  virtual void load_internal_data(void *data, const realnum *buf) const;
+  virtual void delete_internal_data(void *data) const;
 
   virtual int num_cinternal_notowned_needed(component c, void *P_internal_data) const;
   virtual realnum *cinternal_notowned_ptr(int inotowned, component c, int cmp, int n,
@@ -259,6 +331,15 @@ public:
   virtual void dump_params(h5file *h5f, size_t *start);
   virtual int get_num_params() { return 4; }
 
+  // update_P and subtract_P for npoles Lorentzians at once (see susceptibility.cpp)
+  static void update_P_poles(int npoles, const lorentzian_susceptibility *const *s,
+                             void *const *P_internal_data, realnum *W[NUM_FIELD_COMPONENTS][2],
+                             realnum *W_prev[NUM_FIELD_COMPONENTS][2], double dt,
+                             const grid_volume &gv);
+  static void subtract_P_poles(field_type ft, int npoles, void *const *P_internal_data,
+                               realnum *f[NUM_FIELD_COMPONENTS][2],
+                               realnum *f_minus_p[NUM_FIELD_COMPONENTS][2]);
+
 protected:
   double omega_0, gamma;
   bool no_omega_0_denominator;
@@ -298,6 +379,10 @@ public:
   virtual void init_internal_data(realnum *W[NUM_FIELD_COMPONENTS][2], double dt,
                                   const grid_volume &gv, void *data) const;
   virtual void *copy_internal_data(void *data) const;
+  virtual size_t num_internal_data(void *data) const;
+  virtual void dump_internal_data(void *data, realnum *buf) const;
+  virtual void load_internal_data(void *data, const realnum *buf) const;
+  virtual void delete_internal_data(void *data) const;
 
   virtual bool needs_P(component c, int cmp, realnum *W[NUM_FIELD_COMPONENTS][2]) const;
   virtual void update_P(realnum *W[NUM_FIELD_COMPONENTS][2],
@@ -345,6 +430,9 @@ public:
   virtual void init_internal_data(realnum *W[NUM_FIELD_COMPONENTS][2], double dt,
                                   const grid_volume &gv, void *data) const;
   virtual void *copy_internal_data(void *data) const;
+  virtual size_t num_internal_data(void *data) const;
+  virtual void dump_internal_data(void *data, realnum *buf) const;
+  virtual void load_internal_data(void *data, const realnum *buf) const;
   virtual void delete_internal_data(void *data) const;
 
   virtual int num_cinternal_notowned_needed(component c, void *P_internal_data) const;
@@ -360,6 +448,13 @@ public:
   virtual bool needs_W_prev() const { return true; }
 
 protected:
+  bool population_box(const grid_volume &gv, const void *P_internal_data, ivec &is,
+                      ivec &ie) const;
+  void update_N(ptrdiff_t i, realnum *Nold, const void *P_internal_data,
+                realnum *W[NUM_FIELD_COMPONENTS][2], realnum *W_prev[NUM_FIELD_COMPONENTS][2],
+                const component cdot[3], const ptrdiff_t o1[3], const ptrdiff_t o2[3],
+                double dt) const;
+
   int L;           // number of atom levels
   int T;           // number of optical transitions
   realnum *Gamma;  // LxL matrix of relaxation rates Gamma[i*L+j] from i -> j
@@ -372,6 +467,23 @@ protected:
 
 class grace;
 
+// default number of aggregator processes for new parallel h5file objects
+// (see h5file::set_aggregators)
+void set_hdf5_aggregators(int n);
+// default number of time slices buffered per extensible dataset for new
+// h5file objects (see h5file::set_append_buffer)
+void set_hdf5_append_buffer(int nslices);
+
+// h5fields.cpp: block until all asynchronous output (fields::use_async_output)
+// has been written; called automatically before any other HDF5 file access
+void wait_for_async_output();
+
+// h5fields.cpp: read a dataset written by output_hdf5, expanding it to the
+// full array if it was written with fields::set_output_irreducible (the
+// arguments and result are as for h5file::read)
+realnum *read_expanded_hdf5(h5file *file, const char *dataname, int *rank, size_t *dims,
+                            int maxrank);
+
 // h5file.cpp: HDF5 file I/O.  Most users, if they use this
 // class at all, will only use the constructor to open the file, and
 // will otherwise use the fields::output_hdf5 functions.
@@ -387,22 +499,42 @@ public:
   realnum *read(const char *dataname, int *rank, size_t *dims, int maxrank);
   void write(const char *dataname, int rank, const size_t *dims, realnum *data,
              bool single_precision = true);
+#if MEEP_SINGLE
+  void write(const char *dataname, int rank, const size_t *dims, double *data,
+             bool single_precision = true);
+#endif
 
   char *read(const char *dataname);
   void write(const char *dataname, const char *data);
 
+  /* Double-valued attributes of an existing dataset.  write_attr replaces any
+     attribute of the same name (in parallel mode, all processes must call it
+     with the same values); read_attr reads at most nmax values and returns
+     the attribute's length, or 0 if it doesn't exist. */
+  void write_attr(const char *dataname, const char *attrname, size_t n, const double *vals);
+  size_t read_attr(const char *dataname, const char *attrname, size_t nmax, double *vals);
+
+  /* chunk_dims (if non-NULL) suggests the HDF5 chunk size of the dataset,
+     e.g. to align it with the parallel decomposition; it is only used for
+     parallel output or with compression, and set_chunking overrides it. */
   void create_data(const char *dataname, int rank, const size_t *dims, bool append_data = false,
-                   bool single_precision = true);
+                   bool single_precision = true, const size_t *chunk_dims = NULL);
   void extend_data(const char *dataname, int rank, const size_t *dims);
   void create_or_extend_data(const char *dataname, int rank, const size_t *dims, bool append_data,
-                             bool single_precision);
+                             bool single_precision, const size_t *chunk_dims = NULL);
   void write_chunk(int rank, const size_t *chunk_start, const size_t *chunk_dims, realnum *data);
   void write_chunk(int rank, const size_t *chunk_start, const size_t *chunk_dims, size_t *data);
+#if MEEP_SINGLE
+  void write_chunk(int rank, const size_t *chunk_start, const size_t *chunk_dims, double *data);
+#endif
   void done_writing_chunks();
 
   void read_size(const char *dataname, int *rank, size_t *dims, int maxrank);
   void read_chunk(int rank, const size_t *chunk_start, const size_t *chunk_dims, realnum *data);
   void read_chunk(int rank, const size_t *chunk_start, const size_t *chunk_dims, size_t *data);
+#if MEEP_SINGLE
+  void read_chunk(int rank, const size_t *chunk_start, const size_t *chunk_dims, double *data);
+#endif
 
   void remove();
   void remove_data(const char *dataname);
@@ -412,10 +544,57 @@ public:
   void prevent_deadlock(); // hackery for exclusive mode
   bool dataset_exists(const char *name);
 
+  /* Tuning of datasets created from now on: the HDF5 chunk size (rank 0
+     to restore the default), and compression with deflate (level 1-9, or
+     0 for none) and/or an arbitrary HDF5 filter (e.g. szip or a ZFP plugin)
+     given by its id and parameters. */
+  void set_chunking(int rank, const size_t *chunk_dims);
+  void set_compression(int deflate_level, unsigned filter_id = 0, size_t nparams = 0,
+                       const unsigned *params = NULL);
+  /* Collective MPI-IO writes (with parallel HDF5 only).  All processes must
+     then make the same number of write_chunk calls per dataset (possibly
+     with empty chunks); fields::output_hdf5 does so. */
+  void use_collective_io(bool b = true) { collective = b; }
+  bool collective_io() const;
+  // MPI-IO hints (e.g. "striping_factor"), used when the file is opened
+  void set_mpi_hint(const char *key, const char *value);
+  /* N-to-M output: only n "aggregator" processes (every stride-th one) open
+     the file; the others ship their write_chunk data to their aggregator in
+     done_writing_chunks (or the next create_data).  Collective, and only
+     for writing.  0 (the default, see set_hdf5_aggregators) disables it. */
+  void set_aggregators(int n);
+  bool is_aggregator() const;
+  /* Appends to extensible datasets (create_or_extend_data with append_data)
+     are buffered in memory and written nslices time slices at a time, with
+     a single extend and one write per chunk, instead of an extend and a
+     small write per slice.  1 (the default, see set_hdf5_append_buffer)
+     disables buffering; it is also disabled for collective_io().  The
+     buffers are flushed on destruction, or by flush_appends (collective);
+     they must be flushed before the datasets are read back. */
+  void set_append_buffer(int nslices);
+  void flush_appends();
+
 private:
   access_mode mode;
   char *filename;
   bool parallel;
+  bool collective;
+  int chunk_rank, deflate_level;
+  size_t chunk_hint[5];
+  unsigned filter_id;
+  std::vector<unsigned> filter_params;
+  std::vector<char *> mpi_hints; // alternating keys and values
+  int agg_stride, agg_tag;
+  void *agg_comm;                // MPI_Comm of the aggregators, with parallel HDF5
+  std::vector<char> agg_pending; // chunks not yet sent to our aggregator
+  int append_buffer;
+  void flush_aggregated();
+  void pack_chunk(std::vector<char> &buf, int type, int rank, int dindex,
+                  const size_t *chunk_start, const size_t *chunk_dims, const void *data);
+  void write_packed(int type, int rank, int dindex, const size_t *chunk_start,
+                    const size_t *chunk_dims, void *data, bool collective);
+  void remove_extending(const char *dataname);
+  void wait_writers();
 
   bool is_cur(const char *dataname);
   void unset_cur();
@@ -437,9 +616,15 @@ public:
   struct extending_s {
     int dindex;
     char *dataname;
+    int dflushed;              // slices [0, dflushed) are written to the file
+    std::vector<char> pending; // buffered chunks of the later slices
     struct extending_s *next;
   } * extending;
   extending_s *get_extending(const char *dataname) const;
+
+private:
+  bool buffer_appends(const extending_s *cur) const;
+  void flush_extending(extending_s *cur);
 };
 
 typedef double (*pml_profile_func)(double u, void *func_data);
@@ -466,6 +651,10 @@ public:
   virtual void set_volume(const volume &v) { (void)v; }
   virtual void unset_volume(void) {} // unrestrict the grid_volume
 
+  /* true if eff_chi1inv_row may be called concurrently from several
+     threads (between set_volume and unset_volume) */
+  virtual bool thread_safe() { return false; }
+
   virtual double chi1p1(field_type ft, const vec &r) {
     (void)ft;
     (void)r;
@@ -562,6 +751,18 @@ public:
 
 class structure;
 
+// categories of the memory reported by fields::memory_usage
+enum memory_category {
+  MemFields,        // E, D, H, B and their synchronize_magnetic_fields backups
+  MemPML,           // PML and conductivity auxiliary fields
+  MemMaterials,     // chi1inv, chi2, chi3, conductivities and PML profiles
+  MemPolarizations, // susceptibility sigma arrays, polarization data and D-P/B-P
+  MemCommunication, // chunk connections and comm_blocks
+  MemSources,       // src_vol point lists and amplitudes
+  MemDFT,           // dft_chunk accumulators and buffers
+  NUM_MEMORY_CATEGORIES
+};
+
 class structure_chunk {
 public:
   double a, Courant, dt; // res. a, Courant num., and timestep dt=Courant/a
@@ -571,27 +772,37 @@ public:
   realnum *conductivity[NUM_FIELD_COMPONENTS][5];
   realnum *condinv[NUM_FIELD_COMPONENTS][5]; // cache of 1/(1+conduct*dt/2)
   bool condinv_stale;                        // true if condinv needs to be recomputed
-  double *sig[5], *kap[5], *siginv[5];       // conductivity array for uPML
-  int sigsize[5];                            // conductivity array size
+  /* bounding box of the owned points of component c where chi2 or chi3 is nonzero (empty if
+     !(nonlinear_lo[c] <= nonlinear_hi[c])); update_eh only does the Kerr update inside it */
+  ivec nonlinear_lo[NUM_FIELD_COMPONENTS], nonlinear_hi[NUM_FIELD_COMPONENTS];
+  bool nonlinear_box_stale; // true if nonlinear_lo/hi need to be recomputed
+  /* uPML profiles, stored as 1d tables indexed by the (doubled) grid coordinate along
+     each direction: sigsize[d] == 2*gv.num_direction(d)+2 in a direction with PML in
+     this chunk, and a single trivial entry (sigsize[d] == 1) otherwise. */
+  double *sig[5], *kap[5], *siginv[5]; // conductivity array for uPML
+  int sigsize[5];                      // conductivity array size
   grid_volume gv; // integer grid_volume that could be bigger than non-overlapping v below
   volume v;
   susceptibility *chiP[NUM_FIELD_TYPES]; // only E_stuff and H_stuff are used
-  double cost;  // The cost of this chunk's grid_volume as computed by split_by_cost and fragment_stats
+  // The cost of this chunk's grid_volume as computed by split_by_bisection and fragment_stats
+  double cost;
 
   int refcount; // reference count of objects using this structure_chunk
 
   ~structure_chunk();
   structure_chunk(const grid_volume &gv, const volume &vol_limit, double Courant, int proc_num);
   structure_chunk(const structure_chunk *);
+  // if where is non-NULL, only points inside it are (re)computed
   void set_chi1inv(component c, material_function &eps, bool use_anisotropic_averaging, double tol,
-                   int maxeval);
+                   int maxeval, const volume *where = NULL);
   bool has_chi(component c, direction d) const;
   bool has_chisigma(component c, direction d) const;
   bool has_chi1inv(component c, direction d) const;
-  void set_conductivity(component c, material_function &eps);
+  void set_conductivity(component c, material_function &eps, const volume *where = NULL);
   void update_condinv();
-  void set_chi3(component c, material_function &eps);
-  void set_chi2(component c, material_function &eps);
+  void update_nonlinear_box();
+  void set_chi3(component c, material_function &eps, const volume *where = NULL);
+  void set_chi2(component c, material_function &eps, const volume *where = NULL);
   void use_pml(direction, double dx, double boundary_loc, double Rasymptotic, double mean_stretch,
                pml_profile_func pml_profile, void *pml_profile_data, double pml_profile_integral,
                double pml_profile_integral_u);
@@ -604,6 +815,8 @@ public:
   int is_mine() const { return the_is_mine; }
 
   void remove_susceptibilities();
+  // add the bytes allocated by this chunk to bytes[memory_category]
+  void memory_usage(double *bytes) const;
 
   // monitor.cpp
   double get_chi1inv_at_pt(component, direction, int idx, double omega = 0) const;
@@ -726,11 +939,18 @@ public:
             const boundary_region &br = boundary_region(), const symmetry &s = meep::identity(),
             int num_chunks = 0, double Courant = 0.5, bool use_anisotropic_averaging = false,
             double tol = DEFAULT_SUBPIXEL_TOL, int maxeval = DEFAULT_SUBPIXEL_MAXEVAL);
-  structure(const structure *);
+  structure(const structure *); // copies share chunks until one of them is modified
+                                // (or copy them if the original has shared_chunks)
   structure(const structure &);
 
   void set_materials(material_function &mat, bool use_anisotropic_averaging = true,
                      double tol = DEFAULT_SUBPIXEL_TOL, int maxeval = DEFAULT_SUBPIXEL_MAXEVAL);
+  // re-evaluate chi1inv, conductivity, chi2 and chi3 only inside where (and
+  // only in the chunks intersecting it), e.g. after a design region changed;
+  // susceptibilities are left alone.  With shared_chunks, fields see the change.
+  void update_materials(material_function &mat, const volume &where,
+                        bool use_anisotropic_averaging = true, double tol = DEFAULT_SUBPIXEL_TOL,
+                        int maxeval = DEFAULT_SUBPIXEL_MAXEVAL);
   void set_chi1inv(component c, material_function &eps, bool use_anisotropic_averaging = true,
                    double tol = DEFAULT_SUBPIXEL_TOL, int maxeval = DEFAULT_SUBPIXEL_MAXEVAL);
   bool has_chi(component c, direction d) const;
@@ -762,6 +982,16 @@ public:
   void print_layout(void) const;
   std::vector<grid_volume> get_chunk_volumes() const;
   std::vector<int> get_chunk_owners() const;
+  /* Predict the memory, as [process * NUM_MEMORY_CATEGORIES + category] on
+     all processes, of fields for this structure before they are created:
+     the allocated structure chunks plus all of the E/D/H/B components of
+     the grid (and PML and polarization arrays where needed).  Each of the
+     dft_vols[i] is assumed to hold dft_sizes[i] complex values per point
+     (frequencies times components).  Communication and sources are not
+     included. */
+  std::vector<double>
+  estimate_memory_usage(bool is_real, const std::vector<volume> &dft_vols = std::vector<volume>(),
+                        const std::vector<int> &dft_sizes = std::vector<int>()) const;
 
   // structure_dump.cpp
   void dump(const char *filename);
@@ -769,6 +999,8 @@ public:
   void load(const char *filename);
   void load_chunk_layout(const char *filename, boundary_region &br);
   void load_chunk_layout(const std::vector<grid_volume> &gvs, boundary_region &br);
+  void load_chunk_layout(const std::vector<grid_volume> &gvs, const std::vector<int> &owners,
+                         boundary_region &br);
 
   // monitor.cpp
   double get_chi1inv(component, direction, const ivec &origloc, double omega = 0,
@@ -804,6 +1036,10 @@ class src_vol;
 class fields;
 class fields_chunk;
 class flux_vol;
+struct eigenmode_cache;
+struct loop_plan;
+struct loop_plan_cache;
+class step_action;
 
 // Time-dependence of a current source, intended to be overridden by
 // subclasses.  current() and dipole() are be related by
@@ -871,6 +1107,9 @@ public:
   }
   virtual std::complex<double> frequency() const { return 0.0; }
   virtual void set_frequency(std::complex<double> f) { (void)f; }
+  // frequency above which the spectrum is negligible (infinity if unknown),
+  // used to choose the DFT decimation factor
+  virtual double max_frequency() const { return infinity; }
 
 private:
   double current_time;
@@ -892,6 +1131,7 @@ public:
   virtual bool is_equal(const src_time &t) const;
   virtual std::complex<double> frequency() const { return freq; }
   virtual void set_frequency(std::complex<double> f) { freq = real(f); }
+  virtual double max_frequency() const;
   std::complex<double> fourier_transform(const double f);
 
 private:
@@ -923,7 +1163,8 @@ class custom_src_time : public src_time {
 public:
   custom_src_time(std::complex<double> (*func)(double t, void *), void *data, double st = -infinity,
                   double et = infinity, std::complex<double> f = 0)
-      : func(func), data(data), freq(f), start_time(float(st)), end_time(float(et)) {}
+      : func(func), data(data), freq(f), start_time(float(st)), end_time(float(et)), table_t0(0),
+        table_dt(0) {}
   virtual ~custom_src_time() {}
 
   virtual std::complex<double> current(double time, double dt) const {
@@ -934,8 +1175,10 @@ public:
   }
   virtual std::complex<double> dipole(double time) const {
     float rtime = float(time);
-    if (rtime >= start_time && rtime <= end_time)
-      return func(time, data);
+    if (rtime >= start_time && rtime <= end_time) {
+      std::complex<double> val;
+      return table_lookup(time, val) ? val : func(time, data);
+    }
     else
       return 0.0;
   }
@@ -945,11 +1188,19 @@ public:
   virtual std::complex<double> frequency() const { return freq; }
   virtual void set_frequency(std::complex<double> f) { freq = f; }
 
+  // supply func(t0 + k*dt) for k = 0..n-1, which dipole() then uses instead of
+  // calling func at those times (e.g. to avoid a Python callback per time step)
+  void set_table(double t0, double dt, std::complex<double> *values, size_t n);
+
 private:
+  bool table_lookup(double time, std::complex<double> &val) const;
+
   std::complex<double> (*func)(double t, void *);
   void *data;
   std::complex<double> freq;
   double start_time, end_time;
+  std::vector<std::complex<double> > table;
+  double table_t0, table_dt;
 };
 
 class monitor_point {
@@ -982,6 +1233,94 @@ public:
                double fmin, double fmax, int maxbands);
 };
 
+// A set of field probes, equivalent to calling fields::get_field(c, loc)
+// for each registered (c, loc), but with the point location, interpolation
+// weights and symmetry phases worked out once in add() and a single
+// collective reduction per get() for all probes.  add() is not collective;
+// it must be called with the same arguments on all processes.  The Bloch
+// phases are those at the time of add().
+class field_probes {
+public:
+  field_probes(const fields *f);
+
+  // register component c (a field component, not a derived one) at loc,
+  // returning its index in the values of get()
+  size_t add(component c, const vec &loc);
+  size_t size() const { return num_probes; }
+
+  // values[i] = current value of probe i, for i < size()
+  void get(std::complex<double> *values) const;
+
+private:
+  struct term {
+    size_t probe;
+    int ichunk;
+    component c;
+    ptrdiff_t idx;
+    std::complex<double> w;
+  };
+  const fields *f;
+  size_t num_probes;
+  std::vector<term> terms; // this process's contributions to the probes
+};
+
+// An action evaluated natively after each time step of fields::run_steps,
+// so that the common step functions (decay checks, probe sampling) do not
+// need a round trip through the front end at every step.
+class step_action {
+public:
+  step_action() : last_t(-1), stopped(false) {}
+  virtual ~step_action() {}
+
+  // evaluate the action at the current time step, at most once per step
+  // (later calls at the same step return the same result); returns true
+  // if the run should stop
+  bool check(fields &f);
+
+protected:
+  virtual bool do_check(fields &f) = 0;
+
+private:
+  int last_t;
+  bool stopped;
+};
+
+// true once |F(pt)|^2 of component c has decayed, over a window of length
+// dt, by decay_by relative to its maximum so far (as stop_when_fields_decayed)
+class fields_decay_check : public step_action {
+public:
+  fields_decay_check(component c, const vec &pt, double dt, double decay_by);
+
+protected:
+  bool do_check(fields &f);
+
+private:
+  component c;
+  vec pt;
+  double dt, decay_by;
+  double max_abs, cur_max, t0;
+};
+
+// records the values of a set of probes every `every` time steps
+class probe_recorder : public step_action {
+public:
+  probe_recorder(const field_probes &probes, int every = 1);
+
+  size_t num_samples() const { return times.size(); }
+  double time(size_t i) const { return times[i]; }
+  // the values of the probes at sample i (probes.size() of them)
+  const std::complex<double> *sample(size_t i) const { return &values[i * probes.size()]; }
+
+protected:
+  bool do_check(fields &f);
+
+private:
+  const field_probes &probes;
+  int every;
+  std::vector<double> times;
+  std::vector<std::complex<double> > values;
+};
+
 // dft.cpp
 // this should normally only be created with fields::add_dft
 class dft_chunk {
@@ -992,17 +1331,27 @@ public:
   ~dft_chunk();
 
   void update_dft(double time);
+  // bytes allocated by this chunk (not counting a dft array shared with dft_owner)
+  double memory_usage() const;
 
   void scale_dft(std::complex<double> scale);
 
   // chunk-by-chunk helper routine called by
-  // fields::process_dft_component
+  // fields::process_dft_component; the array points are appended to
+  // array_index/array_values, or stored in direct_array if it is non-NULL
   std::complex<double> process_dft_component(int rank, direction *ds, ivec min_corner,
                                              ivec max_corner, int num_freq, h5file *file,
                                              double *buffer, int reim,
-                                             std::complex<double> *field_array, void *mode1_data,
-                                             void *mode2_data, int ic_conjugate,
-                                             bool retain_interp_weights, fields *parent);
+                                             std::vector<size_t> *array_index,
+                                             std::vector<std::complex<double> > *array_values,
+                                             void *mode1_data, void *mode2_data, int ic_conjugate,
+                                             bool retain_interp_weights, fields *parent,
+                                             std::complex<double> *direct_array = NULL);
+  // chunk-by-chunk helper routine called by
+  // fields::get_mode_overlaps
+  void accumulate_mode_overlaps(int num_freq, component c_conjugate, void **mode_data,
+                                int num_modes, std::complex<double> *flux_sum,
+                                std::complex<double> *mode_sum);
 
   void operator-=(const dft_chunk &chunk);
 
@@ -1013,7 +1362,7 @@ public:
   component c; // component to DFT (possibly transformed by symmetry)
 
   size_t N;                   // number of spatial points (on epsilon grid)
-  std::complex<realnum> *dft; // N x Nomega array of DFT values.
+  std::complex<double> *dft;  // N x Nomega array of DFT values.
 
   class dft_chunk *next_in_chunk; // per-fields_chunk list of DFT chunks
   class dft_chunk *next_in_dft;   // next for this particular DFT vol./component
@@ -1064,10 +1413,64 @@ public:
   int sn;
 
   // cache of exp(iwt) * scale, of length Nomega
-  std::complex<realnum> *dft_phase;
+  std::complex<double> *dft_phase;
+
+  // interpolation and volume weights of the N points, computed once at
+  // construction (NULL if !include_dV_and_interp_weights)
+  double *weights;
+  // N (or 2N for complex fields) averaged and weighted field values,
+  // gathered at each step before the accumulation over frequencies
+  double *fbuf;
+
+  // With fields::lazy_dft_averaging, the DFT is accumulated on the raw
+  // Yee-grid samples of the Nraw points in the box is..ie_raw (the points
+  // that avg1/avg2 reach from is..ie), and flush_dft() adds their averaged,
+  // weighted sum into dft when it is read.  dft_raw is NULL otherwise.
+  std::complex<double> *dft_raw;
+  size_t Nraw;
+  ivec ie_raw;
+  ptrdiff_t ravg1, ravg2;   // avg1, avg2 as offsets in the raw box
+  mutable bool raw_pending; // whether dft_raw holds unflushed contributions
+
+  // With fields::fft_dfts, update_dft only records the gathered field values
+  // (ts_numcmp x N doubles per sample, ts_count samples at times
+  // ts_t0 + n * ts_dt) and flush_dft transforms them to the Nomega
+  // frequencies at once by a chirp-z transform, in O(N L log L) for
+  // L >= ts_count + Nomega rather than O(N ts_count Nomega).
+  bool use_fft;
+  mutable std::vector<double> ts_data;
+  mutable size_t ts_count;
+  mutable int ts_numcmp;
+  double ts_t0, ts_dt;
+  void transform_time_series() const;
+  void plan_time_series() const; // before transform_time_series in threads
+
+  // add any pending contributions (dft_raw, time series) into dft; must be
+  // called before reading dft
+  void flush_dft() const;
+  // drop any pending contributions, e.g. when dft is overwritten
+  void discard_pending();
+
+  // A chunk with the same component, points, frequencies, scale and weights
+  // as an existing chunk of fc (e.g. the E fields of a flux plane and of a
+  // mode monitor in the same place) shares its dft array instead of
+  // accumulating it again, as long as that array is still all zeros (not
+  // modified); dft_owner is then the chunk that updates it (NULL for
+  // unshared chunks and owners).  On deletion an owner hands the array to
+  // one of its sharers, and a chunk is unshared (copy-on-write) before
+  // anything else (scaling, subtraction, loading) modifies its dft.
+  dft_chunk *dft_owner;
+  bool modified; // whether dft has been accumulated into, loaded or changed
+  bool same_accumulation(const dft_chunk &o) const;
+  bool hand_off_dft();
+  void unshare();
 
   ptrdiff_t avg1, avg2; // index offsets for average to get epsilon grid
 
+  // the DFT is updated only on steps that are multiples of decimation (with
+  // the scale multiplied accordingly), see fields::dft_decimation
+  int decimation;
+
   int vc; // component descriptor from the original volume
 };
 
@@ -1110,6 +1513,35 @@ public:
   bool use_symmetry;
 };
 
+// true once the DFTs of a set of monitors have converged (a native
+// alternative to stop_when_fields_decayed): every dt time units, each
+// monitored spectrum (the flux of a dft_flux, or the integral of |F|^2 over
+// the points of any other list of dft_chunks, at each frequency) is compared
+// with its value at the previous check, and the run stops when the largest
+// change of every monitor, relative to its largest value, has been at most
+// tol at two consecutive checks.  All monitors are reduced in one sum_to_all.
+class dft_convergence_check : public step_action {
+public:
+  dft_convergence_check(double dt, double tol);
+  void add_flux(const dft_flux &flux);
+  void add_chunks(dft_chunk *chunks); // a list linked by next_in_dft
+  // the largest relative change over the monitors at the last check
+  double max_change() const { return change; }
+
+protected:
+  bool do_check(fields &f);
+
+private:
+  struct monitor {
+    dft_chunk *E, *H; // the flux Re[E* H], or |E|^2 if H == NULL
+    int Nfreq;
+  };
+  std::vector<monitor> monitors;
+  std::vector<double> last; // the spectra at the previous check
+  double dt, tol, t0, change;
+  int num_converged; // consecutive checks within tol
+};
+
 // dft.cpp (normally created with fields::add_dft_energy)
 class dft_energy {
 public:
@@ -1194,6 +1626,13 @@ public:
   realnum *get_farfields_array(const volume &where, int &rank, size_t *dims, size_t &N,
                                double resolution);
 
+  /* like get_farfields_array, but only computes the npoints far-field points
+     starting at point_start (in the flattened grid) that are assigned to
+     this process, i.e. the returned array is 6 x 2 x npoints x Nfreq.  The
+     points are partitioned along the first non-singleton grid dimension. */
+  realnum *get_farfields_chunk(const volume &where, int &rank, size_t *dims, size_t &N,
+                               double resolution, size_t &point_start, size_t &npoints);
+
   /* output far fields on a grid to an HDF5 file */
   void save_farfields(const char *fname, const char *prefix, const volume &where,
                       double resolution);
@@ -1221,6 +1660,16 @@ public:
   direction periodic_d[2];
   int periodic_n[2];
   double periodic_k[2], period[2];
+
+private:
+  double *gather_near_sources(size_t &nsources);
+  void farfield_from_sources(std::complex<double> *EH, const vec &x, const double *sources,
+                             size_t nsources);
+
+public:
+  // use the far-zone (Fraunhofer) approximation of the Green's functions,
+  // much cheaper but only valid far from the near-field surface (see green3d_far)
+  bool far_zone;
 };
 
 /* Class to compute local-density-of-states spectra: the power spectrum
@@ -1243,9 +1692,28 @@ public:
   std::complex<double> *J() const; // returns Jdft
 
 private:
-  std::complex<realnum> *Fdft; // Nomega array of field * J*(x) DFT values
-  std::complex<realnum> *Jdft; // Nomega array of J(t) DFT values
-  double Jsum;                 // sum of |J| over all points
+  std::complex<double> *Fdft; // Nomega array of field * J*(x) DFT values
+  std::complex<double> *Jdft; // Nomega array of J(t) DFT values
+  double Jsum;                // sum of |J| over all points
+
+  // The source points of this process's chunks, gathered on the first update
+  // (and again whenever the sources change): term k is the src_vol sv, whose
+  // npts points are at [start, start+npts) of pt_index and pt_A[ri].
+  struct source_term {
+    const src_vol *sv;
+    int ichunk;
+    component c; // field component (E or H) multiplying the current
+    bool is_H;
+    size_t npts, start;
+  };
+  std::vector<source_term> terms;
+  std::vector<ptrdiff_t> pt_index;
+  std::vector<double> pt_Ar, pt_Ai;
+  const fields *terms_f;   // the fields that terms was gathered from,
+  size_t terms_generation; // at this src_vol::generation
+  bool terms_match(const fields &f) const;
+  void gather_terms(const fields &f);
+
 public:
   double omega_min, domega;
   int Nomega;
@@ -1266,6 +1734,21 @@ public:
   volume where;
 };
 
+// dft.cpp: the electric-field points of a dft_fields object that are owned
+// by this process, as get_dft_array would gather them, copied so that they
+// outlive the fields (e.g. the forward fields of an adjoint solve); see
+// fields::get_dft_gradient
+class dft_fields_local {
+public:
+  dft_fields_local(fields &f, dft_fields fdft);
+
+  int Nfreq;
+  bool collapsed; // where has an empty dimension: no points are stored
+  std::vector<component> cs;
+  std::vector<std::vector<size_t> > index;                  // [ic * Nfreq + nf]
+  std::vector<std::vector<std::complex<double> > > values; // [ic * Nfreq + nf]
+};
+
 enum in_or_out { Incoming = 0, Outgoing };
 enum connect_phase { CONNECT_PHASE = 0, CONNECT_NEGATE = 1, CONNECT_COPY = 2 };
 
@@ -1276,6 +1759,45 @@ typedef struct polarization_state_s {
   struct polarization_state_s *next; // linked list
 } polarization_state;
 
+// sub-phases of fields::step that are timed separately for each chunk
+// (see fields::output_step_times); the PML and conductivity updates are
+// done in the same loops as the curl and constitutive updates, and so
+// are included in those phases
+enum step_phase {
+  StepCurl,           // step_db: D/B = D/B + dt * curl H/E
+  StepConstitutive,   // update_eh: E/H from D/B
+  StepPolarizations,  // update_pols: all of the susceptibilities
+  StepSources,        // step_source
+  StepDFTs,           // update_dfts
+  NUM_STEP_PHASES
+};
+
+/* The realnum arrays of a fields_chunk (the fields, the PML and
+   conductivity auxiliaries, the backups, f_w_prev and f_minus_p) all have
+   gv.ntot() elements, so they are carved out of a few large blocks (from
+   array_malloc) rather than allocated separately.  Each array starts on a
+   cache line, and consecutive arrays are offset by an extra cache line
+   when their size is a multiple of 4 kB, so that the several arrays read
+   by one loop do not map to the same cache sets.  The arrays are laid out
+   in the order they are first allocated, i.e. roughly in the order of the
+   components in the step kernels; freed arrays are reused by the next
+   allocation. */
+class chunk_arena {
+public:
+  chunk_arena(size_t n);
+  ~chunk_arena();
+  realnum *alloc(); // an uninitialized array of n realnums
+  void free(realnum *a);
+  size_t bytes() const; // the total size of the blocks
+
+private:
+  size_t n, stride;           // stride in realnums between consecutive arrays
+  std::vector<realnum *> blocks;
+  std::vector<size_t> block_arrays; // capacity of each block, in arrays
+  size_t used;                // arrays handed out from the last block
+  std::vector<realnum *> free_arrays;
+};
+
 class fields_chunk {
 public:
   realnum *f[NUM_FIELD_COMPONENTS][2]; // fields at current time
@@ -1301,8 +1823,13 @@ public:
 
   realnum *f_rderiv_int; // cache of helper field for 1/r d(rf)/dr derivative
 
+  chunk_arena *arena; // holds all of the arrays above
+
   dft_chunk *dft_chunks;
 
+  double cost_time; // wall time spent stepping this chunk, for fields::get_chunk_costs
+  double phase_time[NUM_STEP_PHASES]; // breakdown of the same time, for fields::get_step_times
+
   realnum **zeroes[NUM_FIELD_TYPES]; // Holds pointers to metal points.
   size_t num_zeroes[NUM_FIELD_TYPES];
   realnum **connections[NUM_FIELD_TYPES][CONNECT_COPY + 1][Outgoing + 1];
@@ -1353,7 +1880,11 @@ public:
   void set_output_directory(const char *name);
 
   double count_volume(component);
+  bool fields_are_finite() const;
+  // add the bytes allocated by this chunk, and its structure chunk, to bytes[memory_category]
+  void memory_usage(double *bytes) const;
   friend class fields;
+  friend class fields_batch;
 
   int n_proc() const { return s->n_proc(); };
   int is_mine() const { return s->is_mine(); };
@@ -1395,6 +1926,10 @@ private:
   void phase_in_material(structure_chunk *s);
   void phase_material(int phasein_time);
   bool step_db(field_type ft);
+  bool can_fuse_eh(component dc, int cmp) const;
+  // E/H components already updated by a fused step_db sweep, which
+  // the following update_eh then skips (see step_db.cpp)
+  bool eh_fused[NUM_FIELD_COMPONENTS][2];
   void step_source(field_type ft, bool including_integrated);
   bool update_pols(field_type ft);
   void calc_sources(double time);
@@ -1405,9 +1940,6 @@ private:
   void initialize_with_nth_tm(int n, double kz);
   // boundaries.cpp
   void alloc_extra_connections(field_type, connect_phase, in_or_out, size_t);
-  // dft.cpp
-  void update_dfts(double timeE, double timeH);
-
   void changing_structure();
 };
 
@@ -1424,6 +1956,18 @@ enum time_sink {
   Other
 };
 
+// statistics of the boundary (halo) exchanges with each peer process, see fields::get_halo_stats
+enum halo_stat { HaloBytesSent, HaloBytesReceived, HaloMessages, HaloWaitTime, NUM_HALO_STATS };
+
+// an interval recorded by fields::start_trace
+struct trace_event {
+  enum kind_t { Phase, Exchange, Wait } kind; // a time_sink, or the comms of a field_type
+  int what;     // the time_sink (Phase) or field_type (Exchange, Wait)
+  int peer;     // the other process of an Exchange
+  size_t bytes; // bytes sent to + received from peer in an Exchange
+  double start, end; // wall_time() relative to the start of the trace
+};
+
 typedef void (*field_chunkloop)(fields_chunk *fc, int ichunk, component cgrid, ivec is, ivec ie,
                                 vec s0, vec s1, vec e0, vec e1, double dV0, double dV1, ivec shift,
                                 std::complex<double> shift_phase, const symmetry &S, int sn,
@@ -1466,8 +2010,20 @@ public:
 /* frequency freq for eigenmode calculations                   */
 /***************************************************************/
 typedef vec (*kpoint_func)(double freq, int mode, void *user_data);
+typedef void (*solve_cw_callback)(fields *f, int ifreq, void *data);
+
+/***************************************************************/
+/* amplitude function for add_volume_source evaluated over a   */
+/* whole box of grid points at once: A[(i0*n[1]+i1)*n[2]+i2]   */
+/* is the amplitude at p0 + i0*dp[0] + i1*dp[1] + i2*dp[2]     */
+/* (positions relative to the center of the source volume)     */
+/***************************************************************/
+typedef void (*amplitude_box_function)(void *data, const vec &p0, const vec dp[3],
+                                       const size_t n[3], std::complex<double> *A);
 
 class fields {
+  friend class field_probes;
+
 public:
   int num_chunks;
   bool shared_chunks;
@@ -1488,6 +2044,24 @@ public:
       sum += comm_sizes[f][ip][pair];
     return sum;
   }
+  // persistent boundary-communication requests (MPI_Request arrays) for
+  // the non-empty pairs, planned in connect_chunks, and whether they are active
+  void *comm_requests[NUM_FIELD_TYPES];
+  int num_comm_requests[NUM_FIELD_TYPES];
+  bool comm_in_progress[NUM_FIELD_TYPES];
+  // the peer process, size in bytes and direction of each of the comm_requests
+  std::vector<int> comm_request_peer[NUM_FIELD_TYPES];
+  std::vector<size_t> comm_request_bytes[NUM_FIELD_TYPES];
+  std::vector<char> comm_request_is_send[NUM_FIELD_TYPES];
+  // chunk pairs (j -> i) that are both on this process, whose connections
+  // are copied directly rather than through comm_blocks, along with the
+  // starting indices of the pair in the Incoming/Outgoing connections
+  struct local_connection {
+    int i, j;
+    size_t incoming[CONNECT_COPY + 1], outgoing[CONNECT_COPY + 1];
+  };
+  local_connection *local_connections[NUM_FIELD_TYPES];
+  int num_local_connections[NUM_FIELD_TYPES];
 
   double a, dt; // The resolution a and timestep dt=Courant/a
   grid_volume gv, user_volume;
@@ -1500,6 +2074,40 @@ public:
   boundary_condition boundaries[2][5];
   char *outdir;
   bool components_allocated;
+  // whether DFTs added from now on average and weight lazily (dft_chunk::dft_raw)
+  bool lazy_dft_averaging;
+  // whether DFTs added from now on are decimated in time (dft_chunk::decimation)
+  bool decimate_dfts;
+  // whether DFTs added from now on record time series transformed at the end
+  // by FFT (dft_chunk::use_fft), for many frequencies on small volumes
+  bool fft_dfts;
+  // periodic checkpointing of the DFTs (checkpoint_dfts), NULL if disabled
+  char *dft_checkpoint_fname;
+  double dft_checkpoint_interval, last_dft_checkpoint_wall_time;
+  // whether output_hdf5 leaves the HDF5 writes to a background thread,
+  // with at most max_pending_outputs datasets staged in memory
+  bool async_output;
+  int max_pending_outputs;
+  // subsampling of output_hdf5 and get_array_slice: every output_stride-th
+  // point along each direction, or the average over each block of points
+  int output_stride;
+  bool output_block_average;
+  // whether output_hdf5 writes component datasets only on the irreducible
+  // domain of the symmetry (see set_output_irreducible)
+  bool output_irreducible;
+  // solutions of get_eigenmode (NULL until the first one), reused for
+  // repeated solves and as starting guesses at nearby frequencies; at most
+  // eigenmode_cache_max are kept (0 disables the cache)
+  eigenmode_cache *mode_cache;
+  int eigenmode_cache_max;
+  // every nan_check_interval steps (0 = never), step() checks that the
+  // fields owned by this process are finite, aborting otherwise
+  int nan_check_interval;
+  // recently used loop_in_chunks plans (NULL until the first loop)
+  loop_plan_cache *loop_plans;
+  // whether get_eigenmode_coefficients spreads its MPB solves for different
+  // frequencies over the processes (otherwise the master solves all of them)
+  bool eigenmode_split_freqs;
 
   // fields.cpp methods:
   fields(structure *, double m = 0, double beta = 0, bool zero_fields_near_cylorigin = true);
@@ -1517,6 +2125,48 @@ public:
   double time_spent_on(time_sink);
   double mean_time_spent_on(time_sink);
   void print_times();
+  // record (in a ring buffer of the last max_events intervals on each
+  // process) the time_sink phases and the boundary exchanges with each
+  // peer process, until stop_trace; output_trace writes the events of all
+  // processes in the Chrome trace-event JSON format (for chrome://tracing
+  // or Perfetto).  These must be called on all processes.
+  void start_trace(size_t max_events = 100000);
+  void stop_trace();
+  void output_trace(const char *fname);
+  // measured stepping (+DFT) time of each chunk since the fields were created, on all processes
+  std::vector<double> get_chunk_costs();
+  // chunk owners (for structure::load_chunk_layout) that balance the measured chunk costs
+  std::vector<int> choose_chunk_owners();
+  // compare the measured chunk costs with those predicted by split_by_bisection
+  void print_chunk_costs();
+  // bytes allocated for each chunk (including its structure chunk) in each
+  // memory_category, on all processes, as [chunk * NUM_MEMORY_CATEGORIES + category]
+  std::vector<double> memory_usage();
+  // print the totals of memory_usage for each category, and the largest chunk and process
+  void print_memory_usage();
+  // the boundary exchanges of this process with each peer process since the fields were
+  // created (or reset_halo_stats), as [(field_type * count_processors() + peer) *
+  // NUM_HALO_STATS + halo_stat]; the MPI_Waitall time is attributed to the peers
+  // in the order in which their messages complete
+  std::vector<double> get_halo_stats() const { return halo_stats; }
+  void reset_halo_stats();
+  // print the halo statistics of each process, summed over the field types
+  void print_halo_stats();
+  // the boundary data of each chunk pair (from j to i), summed over the field
+  // types, in bytes per time step, as [j + i * num_chunks] (collective)
+  std::vector<double> get_comm_matrix() const;
+  // print the totals of get_comm_matrix within and between the processes
+  void print_comm_matrix_summary() const;
+  // measured time of each step_phase in each chunk, on all processes,
+  // as [chunk * NUM_STEP_PHASES + phase]
+  std::vector<double> get_step_times();
+  // time of step_boundaries for each field_type on each process, on all
+  // processes, as [process * NUM_FIELD_TYPES + field_type]
+  std::vector<double> get_boundary_times();
+  // write the per-chunk and per-process step timings, along with their
+  // min/mean/max over the processes, to fname as JSON (if fname ends
+  // in .json) or else as CSV
+  void output_step_times(const char *fname);
   // boundaries.cpp
   void set_boundary(boundary_side, direction, boundary_condition);
   void use_bloch(direction d, double k) { use_bloch(d, (std::complex<double>)k); }
@@ -1551,6 +2201,26 @@ public:
                    bool single_precision = false, const char *prefix = 0, double omega = 0);
   h5file *open_h5file(const char *name, h5file::access_mode mode = h5file::WRITE,
                       const char *prefix = NULL, bool timestamp = false);
+  // asynchronous output (only with a single process, and if compiled with
+  // pthreads; otherwise output_hdf5 remains synchronous)
+  void use_async_output(bool b = true, int max_pending = 2) {
+    async_output = b;
+    max_pending_outputs = max_pending;
+  }
+  // output only every stride-th grid point (in each direction) of the output
+  // volume, starting at its corner, or (block_average) the average of each
+  // stride x stride x ... block; points that are not output are never computed
+  void set_output_stride(int stride, bool block_average = false) {
+    if (stride < 1) abort("invalid output stride %d", stride);
+    output_stride = stride;
+    output_block_average = block_average;
+  }
+  // with a symmetry, output_hdf5 of a single component (or of epsilon/mu)
+  // writes only the points stored by the chunks, with attributes describing
+  // the symmetry images; read_expanded_hdf5 rebuilds the full array.  Outputs
+  // for which this is not possible (e.g. a where that is not symmetric, or a
+  // component mixed with others by a rotation) are written in full as usual.
+  void set_output_irreducible(bool b = true) { output_irreducible = b; }
   const char *h5file_name(const char *name, const char *prefix = NULL, bool timestamp = false);
 
   // array_slice.cpp methods
@@ -1588,23 +2258,30 @@ public:
   // of the correct size.
   // otherwise, a new buffer is allocated and returned; it
   // must eventually be caller-deallocated via delete[].
+  // with set_output_stride(s), the slice dimensions are
+  // (n-1)/s+1 for the n returned by get_array_slice_dimensions.
+  // if master_only, the slice is only assembled on the master process;
+  // elsewhere, slice is left untouched (and NULL is returned if slice==0).
   double *get_array_slice(const volume &where, std::vector<component> components,
                           field_rfunction rfun, void *fun_data, double *slice = 0,
-                          double omega = 0);
+                          double omega = 0, bool master_only = false);
 
   std::complex<double> *get_complex_array_slice(const volume &where,
                                                 std::vector<component> components,
                                                 field_function fun, void *fun_data,
-                                                std::complex<double> *slice = 0, double omega = 0);
+                                                std::complex<double> *slice = 0, double omega = 0,
+                                                bool master_only = false);
 
   // alternative entry points for when you have no field
   // function, i.e. you want just a single component or
   // derived component.)
-  double *get_array_slice(const volume &where, component c, double *slice = 0, double omega = 0);
+  double *get_array_slice(const volume &where, component c, double *slice = 0, double omega = 0,
+                          bool master_only = false);
   double *get_array_slice(const volume &where, derived_component c, double *slice = 0,
-                          double omega = 0);
+                          double omega = 0, bool master_only = false);
   std::complex<double> *get_complex_array_slice(const volume &where, component c,
-                                                std::complex<double> *slice = 0, double omega = 0);
+                                                std::complex<double> *slice = 0, double omega = 0,
+                                                bool master_only = false);
 
   // like get_array_slice, but for *sources* instead of fields
   std::complex<double> *get_source_slice(const volume &where, component source_slice_component,
@@ -1613,7 +2290,7 @@ public:
   // master routine for all above entry points
   void *do_get_array_slice(const volume &where, std::vector<component> components,
                            field_function fun, field_rfunction rfun, void *fun_data, void *vslice,
-                           double omega = 0);
+                           double omega = 0, bool master_only = false);
 
   /* fetch and return coordinates and integration weights of grid points covered by an array slice,
    */
@@ -1625,6 +2302,12 @@ public:
   double last_step_output_wall_time;
   int last_step_output_t;
   void step();
+  // take up to nsteps steps, evaluating each of the actions after every
+  // step, and stop early once one of them requests it or (if
+  // max_wall_time > 0) after max_wall_time seconds; returns the number of
+  // steps taken
+  int run_steps(int nsteps, step_action **actions = NULL, int num_actions = 0,
+                double max_wall_time = 0);
 
   // when comparing times, e.g. for source cutoffs, it
   // is useful to round to float to avoid gratuitous sensitivity
@@ -1633,8 +2316,13 @@ public:
   inline double time() const { return t * dt; };
 
   // cw_fields.cpp:
-  bool solve_cw(double tol, int maxiters, std::complex<double> frequency, int L = 2);
-  bool solve_cw(double tol = 1e-8, int maxiters = 10000, int L = 2);
+  bool solve_cw(double tol, int maxiters, std::complex<double> frequency, int L = 2,
+                int precond_steps = 0, double precond_shift = 0.1);
+  bool solve_cw(double tol = 1e-8, int maxiters = 10000, int L = 2, int precond_steps = 0,
+                double precond_shift = 0.1);
+  bool solve_cw_multi(double tol, int maxiters, const std::complex<double> *freqs, size_t nfreqs,
+                      int L = 2, solve_cw_callback callback = 0, void *callback_data = 0,
+                      int precond_steps = 0, double precond_shift = 0.1);
 
   // sources.cpp:
   double last_source_time();
@@ -1652,6 +2340,8 @@ public:
                          std::complex<double> A(const vec &), std::complex<double> amp = 1.0);
   void add_volume_source(component c, const src_time &src, const volume &,
                          std::complex<double> amp = 1.0);
+  void add_volume_source(component c, const src_time &src, const volume &,
+                         amplitude_box_function A, void *A_data, std::complex<double> amp);
   void require_component(component c);
 
   // mpb.cpp
@@ -1681,6 +2371,11 @@ public:
                                   std::complex<double> *coeffs, double *vgrp,
                                   kpoint_func user_kpoint_func = 0, void *user_kpoint_data = 0,
                                   vec *kpoints = 0, vec *kdom = 0);
+  void clear_eigenmode_cache();
+  // save/load the eigenmode cache to/from an HDF5 file, so that later runs
+  // on the same structure can reuse it (loaded entries are merged)
+  void save_eigenmode_cache(const char *filename);
+  void load_eigenmode_cache(const char *filename);
 
   // initialize.cpp:
   void initialize_field(component, std::complex<double> f(const vec &));
@@ -1695,8 +2390,17 @@ public:
   void loop_in_chunks(field_chunkloop chunkloop, void *chunkloop_data, const volume &where,
                       component cgrid = Centered, bool use_symmetry = true,
                       bool snap_unit_dims = false);
+  void clear_loop_plans();
 
   // integrate.cpp
+
+  // Between begin_local_reductions and end_local_reductions, integrate,
+  // integrate2 and everything built on them linearly (max_abs, flux_in_box,
+  // the *energy_in_box functions, ...) return this process's partial
+  // result without any communication; the caller combines them, e.g. with
+  // a reduction_batch.  Calls may be nested.
+  void begin_local_reductions() { ++local_reductions; }
+  void end_local_reductions() { --local_reductions; }
   std::complex<double> integrate(int num_fields, const component *components, field_function fun,
                                  void *fun_data_, const volume &where, double *maxabs = 0);
   double integrate(int num_fields, const component *components, field_rfunction fun,
@@ -1726,6 +2430,10 @@ public:
                      std::complex<double> extra_weight = 1.0, bool use_centered_grid = true,
                      int vc = 0);
   dft_chunk *add_dft_pt(component c, const vec &where, double freq_min, double freq_max, int Nfreq);
+  void use_lazy_dft_averaging(bool b = true) { lazy_dft_averaging = b; }
+  void use_dft_decimation(bool b = true) { decimate_dfts = b; }
+  void use_fft_dfts(bool b = true) { fft_dfts = b; }
+  int dft_decimation(double freq_max);
   dft_chunk *add_dft(const volume_list *where, double freq_min, double freq_max, int Nfreq,
                      bool include_dV = true);
   void update_dfts();
@@ -1757,7 +2465,24 @@ public:
                                              size_t *dims = 0, direction *dirs = 0,
                                              void *mode1_data = 0, void *mode2_data = 0,
                                              component c_conjugate = Ex, bool *first_component = 0,
-                                             bool retain_interp_weights = true);
+                                             bool retain_interp_weights = true,
+                                             bool master_only = false);
+
+  // save/load the accumulated data of all DFTs, e.g. to survive a killed job;
+  // load_dft_checkpoint requires the same DFTs to have been added in the
+  // same order, and returns the time step of the checkpoint
+  void save_dft_checkpoint(const char *filename);
+  int load_dft_checkpoint(const char *filename);
+  // save_dft_checkpoint(filename) every interval seconds of wall-clock time
+  // while stepping (filename = NULL to stop)
+  void checkpoint_dfts(const char *filename, double interval);
+
+  // fields_dump.cpp: save/load the complete time-stepping state (fields,
+  // auxiliary PML fields, polarizations, DFTs and time step), for restarting
+  // a run; load requires the same chunk layout, and the same sources and
+  // DFTs added in the same order
+  void dump(const char *filename);
+  void load(const char *filename);
 
   // output DFT fields to HDF5 file
   void output_dft_components(dft_chunk **chunklists, int num_chunklists, volume dft_volume,
@@ -1779,6 +2504,21 @@ public:
   std::complex<double> *get_dft_array(dft_near2far n2f, component c, int num_freq, int *rank,
                                       size_t dims[3]);
 
+  // the process-local points of get_dft_array(fdft, c, num_freq), without
+  // gathering them: index into the (uncollapsed) array, and value
+  void get_dft_array_points(dft_fields fdft, component c, int num_freq,
+                            std::vector<size_t> &index,
+                            std::vector<std::complex<double> > &values);
+
+  // adjoint gradient over the design region of adj:
+  //   grad[k] = sum_n weights[n] sum_{c electric} fwd_c[n] adj_c[n] basis[n*num_basis + k]
+  // where n runs over the num_points points of the array returned by
+  // get_dft_array; each process sums its own points, and only grad is
+  // summed over processes
+  void get_dft_gradient(const dft_fields_local &fwd, dft_fields adj, int num_freq,
+                        const double *weights, int num_points, const double *basis,
+                        int num_basis, std::complex<double> *grad);
+
   // overlap integrals between eigenmode fields and DFT flux fields
   void get_overlap(void *mode1_data, void *mode2_data, dft_flux flux, int num_freq,
                    std::complex<double> overlaps[2]);
@@ -1786,6 +2526,12 @@ public:
                              std::complex<double> overlaps[2]);
   void get_mode_mode_overlap(void *mode1_data, void *mode2_data, dft_flux flux,
                              std::complex<double> overlaps[2]);
+  // get_mode_flux_overlap, and optionally get_mode_mode_overlap of each mode
+  // with itself, for num_modes modes in one pass and one reduction:
+  // the overlaps of mode_data[m] are {flux,mode}_overlaps[2*m + 0/1]
+  void get_mode_overlaps(void **mode_data, int num_modes, dft_flux flux, int num_freq,
+                         std::complex<double> *flux_overlaps,
+                         std::complex<double> *mode_overlaps = 0);
 
   dft_energy add_dft_energy(const volume_list *where, double freq_min, double freq_max, int Nfreq);
 
@@ -1812,6 +2558,9 @@ public:
 
   // energy_and_flux.cpp
   void synchronize_magnetic_fields();
+  // synchronize H and B only in where (the fields elsewhere are left at the
+  // half time step), by re-stepping just the chunks within a pixel of where
+  void synchronize_magnetic_fields(const volume &where);
   void restore_magnetic_fields();
   double energy_in_box(const volume &);
   double electric_energy_in_box(const volume &);
@@ -1839,6 +2588,8 @@ public:
   double max_eps() const;
   // step.cpp
   void step_boundaries(field_type);
+  void step_boundaries_start(field_type);
+  void step_boundaries_finish(field_type);
 
   bool nosize_direction(direction d) const;
   direction normal_direction(const volume &where) const;
@@ -1852,32 +2603,72 @@ public:
   void unset_solve_cw_omega();
 
 private:
+  int local_reductions; // see begin_local_reductions
   int synchronized_magnetic_fields; // count number of nested synchs
+  std::vector<char> synched_chunks;  // the chunks that are synched (empty for all)
+  std::vector<char> step_chunks;     // the chunks stepped by step_db etc. (empty for all)
   double last_wall_time;
 #define MEEP_TIMING_STACK_SZ 10
   time_sink working_on, was_working_on[MEEP_TIMING_STACK_SZ];
   double times_spent[Other + 1];
+  double boundary_times[NUM_FIELD_TYPES]; // see get_boundary_times
+  std::vector<double> halo_stats;         // see get_halo_stats
+#define MEEP_MAX_HW_COUNTERS 5
+  // time.cpp: hardware counters (only with PAPI), and the wall time in the
+  // last entry, of each time_sink and then of each step_phase; see print_times
+  double hw_counts[Other + 1 + NUM_STEP_PHASES][MEEP_MAX_HW_COUNTERS + 1];
+  double hw_last[MEEP_MAX_HW_COUNTERS + 1]; // values at the last time_sink switch
+  void hw_sink_switch(time_sink s);
+  void hw_phase_begin(double *start);
+  void hw_phase_end(const double *start, step_phase p);
+  void print_hw_counters();
+  // time.cpp: see start_trace
+  bool tracing;
+  std::vector<trace_event> trace_events; // ring buffer
+  size_t trace_count;                    // total events recorded, >= trace_events.size() if wrapped
+  double trace_t0, comm_start_time[NUM_FIELD_TYPES];
+  void record_trace(trace_event::kind_t kind, int what, double start, double end, int peer = -1,
+                    size_t bytes = 0);
   // fields.cpp
   void figure_out_step_plan();
+  // dft.cpp
+  void dump_dfts(h5file *file);
+  void load_dfts(h5file *file);
   // boundaries.cpp
   bool chunk_connections_valid;
   void find_metals();
   void disconnect_chunks();
   void connect_chunks();
   void connect_the_chunks(); // Intended to be ultra-private...
+  void find_local_connections();
   bool on_metal_boundary(const ivec &);
   ivec ilattice_vector(direction) const;
   bool locate_point_in_user_volume(ivec *, std::complex<double> *phase) const;
   void locate_volume_source_in_user_volume(const vec p1, const vec p2, vec newp1[8], vec newp2[8],
                                            std::complex<double> kphase[8], int &ncopies) const;
   // mympi.cpp
-  void boundary_communications(field_type);
+  void plan_boundary_communications();
+  void free_boundary_communications();
+  void start_boundary_communications(field_type);
+  void finish_boundary_communications(field_type);
+  // energy_and_flux.cpp
+  void synchronize_magnetic_chunks(const std::vector<char> &which);
   // step.cpp
+  bool parallel_chunk_loops() const;
+  bool steps_chunk(int i) const {
+    return chunks[i]->is_mine() && (step_chunks.empty() || step_chunks[i]);
+  }
+  int step_begin();
+  void step_end(int save_synchronized_magnetic_fields);
+  friend class fields_batch;
   void phase_material();
   void step_db(field_type ft);
   void step_source(field_type ft, bool including_integrated = false);
   void update_pols(field_type ft);
   void calc_sources(double tim);
+  // loop_in_chunks.cpp
+  loop_plan make_loop_plan(const volume &where, component cgrid, bool use_symmetry,
+                           bool snap_empty_dimensions);
 
 public:
   // monitor.cpp
@@ -1892,6 +2683,30 @@ public:
   void reset_timers();
 };
 
+// Several independent fields objects (e.g. for different Bloch k or
+// cylindrical m) built from the same structure, which share its
+// structure_chunks, time-stepped together.  Each sweep over the chunks
+// updates chunk i of all the fields before moving on to chunk i+1, so
+// that the shared material arrays (chi1inv, conductivities, ...) of a
+// chunk are read from memory once per step for all of the fields.
+// Everything else (sources, boundaries, fluxes, DFTs) is per fields.
+class fields_batch {
+public:
+  fields_batch(fields **fs, int num_fields);
+  ~fields_batch() { delete[] fs; }
+
+  void step();
+  // take nsteps steps of all of the fields
+  void run_steps(int nsteps);
+
+private:
+  fields **fs;
+  int num_fields;
+  bool parallel_chunk_loops() const;
+  enum chunk_update { STEP_DB, UPDATE_EH, UPDATE_POLS };
+  void update_chunks(chunk_update what, field_type ft);
+};
+
 class flux_vol {
 public:
   flux_vol(fields *f_, direction d_, const volume &where_) : where(where_) {
@@ -1944,6 +2759,40 @@ int do_harminv(std::complex<double> *data, int n, double dt, double fmin, double
                double spectral_density = 1.1, double Q_thresh = 50, double rel_err_thresh = 1e20,
                double err_thresh = 0.01, double rel_amp_thresh = -1, double amp_thresh = -1);
 
+// Streaming front end for do_harminv on one or more probe signals: each
+// sample is mixed down so that [fmin,fmax] sits just above zero frequency,
+// low-pass filtered and decimated as it arrives, so only about
+// 6*(fmax-fmin)*dt of the samples are ever stored.  analyze() then runs
+// harminv on the decimated series (one probe per process, round-robin)
+// and maps the modes back to the original frequencies and amplitudes.
+class harminv_stream {
+public:
+  // decimation = 0 picks the largest factor that keeps the band alias-free
+  harminv_stream(int num_probes, double dt, double fmin, double fmax, int decimation = 0);
+
+  // append one sample per probe (values[0..num_probes-1]) at the next time step
+  void add(const std::complex<double> *values);
+
+  int decimation() const { return D; }
+  size_t num_samples() const { return nout; } // decimated samples per probe
+
+  // Results for probe p are in entries [p*maxbands, p*maxbands+nmodes[p]) of
+  // the output arrays, and are returned on all processes.  The thresholds
+  // are those of do_harminv, applied to the decimated data.
+  void analyze(int maxbands, int *nmodes, std::complex<double> *amps, double *freq_re,
+               double *freq_im, double *errors = NULL, double spectral_density = 1.1,
+               double Q_thresh = 50, double rel_err_thresh = 1e20, double err_thresh = 0.01,
+               double rel_amp_thresh = -1, double amp_thresh = -1) const;
+
+private:
+  int num_probes, D, L;
+  double dt, fmin, fmax, fshift;
+  std::vector<double> taps;               // low-pass FIR, length L
+  std::vector<std::complex<double> > buf; // last L mixed samples per probe (circular)
+  std::vector<std::complex<double> > out; // decimated samples, num_probes per output step
+  size_t nin, nout;
+};
+
 std::complex<double> *
 make_casimir_gfunc(double T, double dt, double sigma, field_type ft,
                    std::complex<double> (*eps_func)(std::complex<double> omega) = 0,
@@ -1961,6 +2810,15 @@ void set_random_seed(unsigned long seed);
 double uniform_random(double a, double b);          // uniform random in [a,b]
 double gaussian_random(double mean, double stddev); // normal random with given mean and stddev
 int random_int(int a, int b);                       // uniform random in [a,b)
+/* counter-based random numbers, which depend only on the key and the counter
+   (with no state), for reproducible parallel random numbers */
+unsigned long counter_random_seed(); // seed from set_random_seed, the same on all processes
+void counter_random(const uint32_t key[2], const uint32_t counter[4], uint32_t r[4]);
+double counter_gaussian_random(const uint32_t key[2], const uint32_t counter[4], double mean,
+                               double stddev);
+// n normal random numbers for the counters {counter[0],counter[1],counter[2],i}, 0 <= i < n
+void counter_gaussian_randoms(const uint32_t key[2], const uint32_t counter[3], size_t n,
+                              double *g, double mean, double stddev);
 
 // Bessel function (in initialize.cpp)
 double BesselJ(int m, double kr);
@@ -1972,6 +2830,11 @@ void green2d(std::complex<double> *EH, const vec &x, double freq, double eps, do
              const vec &x0, component c0, std::complex<double> f0);
 void green3d(std::complex<double> *EH, const vec &x, double freq, double eps, double mu,
              const vec &x0, component c0, std::complex<double> f0);
+// far-zone approximations of the above, valid for |x| >> wavelength, |x0|
+void green2d_far(std::complex<double> *EH, const vec &x, double freq, double eps, double mu,
+                 const vec &x0, component c0, std::complex<double> f0);
+void green3d_far(std::complex<double> *EH, const vec &x, double freq, double eps, double mu,
+                 const vec &x0, component c0, std::complex<double> f0);
 
 // non-class methods for working with mpb eigenmode data
 //
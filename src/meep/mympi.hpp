@@ -21,6 +21,7 @@
 #include <complex>
 #include <stddef.h>
 #include <stdexcept>
+#include <vector>
 
 namespace meep {
 
@@ -50,11 +51,14 @@ void abort(const char *fmt, ...) PRINTF_ATTR(1, 2);
 void all_wait();
 int count_processors();
 int my_rank();
+// node[i] = node (shared-memory domain) of process i, numbered by its lowest process
+void process_nodes(int *node);
 bool am_really_master();
 inline int am_master() { return my_rank() == 0; }
 bool with_mpi();
 
 void send(int from, int to, double *data, int size = 1);
+void send(int from, int to, char *data, int size);
 void broadcast(int from, double *data, int size);
 void broadcast(int from, char *data, int size);
 void broadcast(int from, int *data, int size);
@@ -74,10 +78,16 @@ void sum_to_all(const double *in, double *out, int size);
 void sum_to_master(const float *in, float *out, int size);
 void sum_to_master(const double *in, double *out, int size);
 void sum_to_all(const float *in, double *out, int size);
+void sum_to_all(const float *in, float *out, int size);
 void sum_to_all(const std::complex<float> *in, std::complex<double> *out, int size);
 void sum_to_all(const std::complex<double> *in, std::complex<double> *out, int size);
 void sum_to_master(const std::complex<float> *in, std::complex<float> *out, int size);
 void sum_to_master(const std::complex<double> *in, std::complex<double> *out, int size);
+void gather_to_master(const size_t *index, const std::complex<double> *data, size_t n,
+                      std::complex<double> *out);
+void gather_sum_to_master(const size_t *index, const double *data, size_t n, int width,
+                          double *out);
+double *gather_to_all(const double *in, size_t n, size_t &ntot);
 long double sum_to_all(long double);
 std::complex<double> sum_to_all(std::complex<double> in);
 std::complex<long double> sum_to_all(std::complex<long double> in);
@@ -93,6 +103,36 @@ void bw_or_to_all(const size_t *in, size_t *out, int size);
 bool and_to_all(bool in);
 void and_to_all(const int *in, int *out, int size);
 
+// Completes several reductions together: add the local partial results
+// (e.g. of diagnostics computed between fields::begin_local_reductions and
+// end_local_reductions), then start() and finish() perform one allreduce
+// for all the sums and one for all the maxima.  With MPI-3, start() is
+// non-blocking, so other work can be done before finish().
+class reduction_batch {
+public:
+  reduction_batch();
+  ~reduction_batch();
+
+  // the return value is the index of the result after finish()
+  int add_sum(double x);
+  int add_sum(std::complex<double> x);
+  int add_max(double x);
+
+  void start();
+  void finish();
+
+  double sum(int i) const { return sums[i]; }
+  std::complex<double> complex_sum(int i) const {
+    return std::complex<double>(sums[i], sums[i + 1]);
+  }
+  double max(int i) const { return maxs[i]; }
+
+private:
+  std::vector<double> sums_in, sums, maxs_in, maxs;
+  void *requests; // MPI requests of a started non-blocking reduction
+  bool started;
+};
+
 // IO routines:
 void master_printf(const char *fmt, ...) PRINTF_ATTR(1, 2);
 void debug_printf(const char *fmt, ...) PRINTF_ATTR(1, 2);
@@ -100,8 +140,8 @@ void master_fprintf(FILE *f, const char *fmt, ...) PRINTF_ATTR(2, 3);
 FILE *master_fopen(const char *name, const char *mode);
 void master_fclose(FILE *f);
 
-void begin_critical_section(int tag);
-void end_critical_section(int tag);
+void begin_critical_section(int tag, int stride = 1);
+void end_critical_section(int tag, int stride = 1);
 
 int divide_parallel_processes(int numgroups);
 void begin_global_communications(void);
@@ -110,6 +150,27 @@ void end_divide_parallel(void);
 
 int my_global_rank(void);
 
+// A counter held by global process 0 that any process can fetch and
+// increment without the participation of the others, e.g. a job queue
+// shared by the groups of divide_parallel_processes (each group taking
+// the next job with group_next when it finishes one).  Construction and
+// destruction are collective over all processes, outside of any group.
+// Requires MPI-3 in parallel runs (see supported()).
+class shared_counter {
+public:
+  shared_counter(int start = 0);
+  ~shared_counter();
+
+  int next();       // the current value, which is then incremented
+  int group_next(); // next() by the master of the group, broadcast to it
+
+  static bool supported();
+
+private:
+  int value;
+  void *win; // MPI window exposing value (on process 0)
+};
+
 } /* namespace meep */
 
 #endif /* MEEP_MY_MPI_H */
@@ -249,6 +249,78 @@ component first_field_component(field_type ft);
          loop_ibound++)                                                                            \
   S1LOOP_OVER_IVECS(gv, loop_notowned_is, loop_notowned_ie, idx)
 
+// The following work identically to the LOOP_* and S1LOOP_* macros above,
+// except that when Meep is compiled with OpenMP the two outer loops are
+// divided among the threads (the inner loop is left intact so that it can
+// still be vectorized).  Like S1LOOP_*, these should only be used where
+// the loop iterations are independent, and the loop body must not write to
+// any variable declared outside the loop except through the idx index.
+// (Small loops, below MEEP_OMP_MIN_LOOP points, are not parallelized since
+// the cost of starting the threads would dominate.)  Nested inside another
+// OpenMP parallel region (e.g. a parallel loop over chunks), these loops
+// are executed serially by the calling thread.
+#define MEEP_OMP_MIN_LOOP 4096
+#ifdef _OPENMP
+#define MEEP_OMP_LOOP_BIG (loop_n1 * loop_n2 * loop_n3 >= MEEP_OMP_MIN_LOOP)
+#define MEEP_OMP_LOOP                                                                              \
+  _Pragma("omp parallel for collapse(2) schedule(static) if (MEEP_OMP_LOOP_BIG)")
+#else
+#define MEEP_OMP_LOOP
+#endif
+
+#define PLOOP_OVER_IVECS(gv, is, ie, idx)                                                          \
+  for (ptrdiff_t loop_is1 = (is).yucky_val(0), loop_is2 = (is).yucky_val(1),                       \
+                 loop_is3 = (is).yucky_val(2), loop_n1 = ((ie).yucky_val(0) - loop_is1) / 2 + 1,   \
+                 loop_n2 = ((ie).yucky_val(1) - loop_is2) / 2 + 1,                                 \
+                 loop_n3 = ((ie).yucky_val(2) - loop_is3) / 2 + 1,                                 \
+                 loop_d1 = (gv).yucky_direction(0), loop_d2 = (gv).yucky_direction(1),             \
+                 loop_d3 = (gv).yucky_direction(2),                                                \
+                 loop_s1 = (gv).stride((meep::direction)loop_d1),                                  \
+                 loop_s2 = (gv).stride((meep::direction)loop_d2),                                  \
+                 loop_s3 = (gv).stride((meep::direction)loop_d3),                                  \
+                 idx0 = (is - (gv).little_corner()).yucky_val(0) / 2 * loop_s1 +                   \
+                        (is - (gv).little_corner()).yucky_val(1) / 2 * loop_s2 +                   \
+                        (is - (gv).little_corner()).yucky_val(2) / 2 * loop_s3,                    \
+                 loop_once = 1;                                                                    \
+       loop_once; loop_once = 0)                                                                   \
+    MEEP_OMP_LOOP                                                                                  \
+  for (ptrdiff_t loop_i1 = 0; loop_i1 < loop_n1; loop_i1++)                                        \
+    for (ptrdiff_t loop_i2 = 0; loop_i2 < loop_n2; loop_i2++)                                      \
+      for (ptrdiff_t idx = idx0 + loop_i1 * loop_s1 + loop_i2 * loop_s2, loop_i3 = 0;              \
+           loop_i3 < loop_n3; loop_i3++, idx += loop_s3)
+
+#define PLOOP_OVER_VOL_OWNED(gv, c, idx)                                                           \
+  PLOOP_OVER_IVECS(gv, (gv).little_owned_corner(c), (gv).big_corner(), idx)
+
+#define PLOOP_OVER_VOL_OWNED0(gv, c, idx)                                                          \
+  PLOOP_OVER_IVECS(gv, (gv).little_owned_corner0(c), (gv).big_corner(), idx)
+
+#define PS1LOOP_OVER_IVECS(gv, is, ie, idx)                                                        \
+  for (ptrdiff_t loop_is1 = (is).yucky_val(0), loop_is2 = (is).yucky_val(1),                       \
+                 loop_is3 = (is).yucky_val(2), loop_n1 = ((ie).yucky_val(0) - loop_is1) / 2 + 1,   \
+                 loop_n2 = ((ie).yucky_val(1) - loop_is2) / 2 + 1,                                 \
+                 loop_n3 = ((ie).yucky_val(2) - loop_is3) / 2 + 1,                                 \
+                 loop_d1 = (gv).yucky_direction(0), loop_d2 = (gv).yucky_direction(1),             \
+                 loop_s1 = (gv).stride((meep::direction)loop_d1),                                  \
+                 loop_s2 = (gv).stride((meep::direction)loop_d2), loop_s3 = 1,                     \
+                 idx0 = (is - (gv).little_corner()).yucky_val(0) / 2 * loop_s1 +                   \
+                        (is - (gv).little_corner()).yucky_val(1) / 2 * loop_s2 +                   \
+                        (is - (gv).little_corner()).yucky_val(2) / 2 * loop_s3,                    \
+                 loop_once = 1;                                                                    \
+       loop_once; loop_once = 0)                                                                   \
+    MEEP_OMP_LOOP                                                                                  \
+  for (ptrdiff_t loop_i1 = 0; loop_i1 < loop_n1; loop_i1++)                                        \
+    for (ptrdiff_t loop_i2 = 0; loop_i2 < loop_n2; loop_i2++)                                      \
+      IVDEP                                                                                        \
+  for (ptrdiff_t idx = idx0 + loop_i1 * loop_s1 + loop_i2 * loop_s2, loop_i3 = 0;                  \
+       loop_i3 < loop_n3; loop_i3++, idx++)
+
+#define PS1LOOP_OVER_VOL_OWNED(gv, c, idx)                                                         \
+  PS1LOOP_OVER_IVECS(gv, (gv).little_owned_corner(c), (gv).big_corner(), idx)
+
+#define PS1LOOP_OVER_VOL_OWNED0(gv, c, idx)                                                        \
+  PS1LOOP_OVER_IVECS(gv, (gv).little_owned_corner0(c), (gv).big_corner(), idx)
+
 #define IVEC_LOOP_AT_BOUNDARY                                                                      \
   ((loop_s1 != 0 && (loop_i1 == 0 || loop_i1 == loop_n1 - 1)) ||                                   \
    (loop_s2 != 0 && (loop_i2 == 0 || loop_i2 == loop_n2 - 1)) ||                                   \
@@ -411,7 +483,7 @@ inline direction component_direction(int c) {
     return component_direction(component(c));
 }
 inline component direction_component(component c, direction d) {
-  component start_point;
+  component start_point = Ex;
   if (is_electric(c))
     start_point = Ex;
   else if (is_magnetic(c))
@@ -435,7 +507,7 @@ inline component direction_component(component c, direction d) {
   return Ex; // This is never reached.
 }
 inline derived_component direction_component(derived_component c, direction d) {
-  derived_component start_point;
+  derived_component start_point = Sx;
   if (is_poynting(c))
     start_point = Sx;
   else if (is_energydensity(c) && d == NO_DIRECTION)
@@ -827,6 +899,7 @@ public:
   volume(const vec &vec1, const vec &vec2);
   volume(const vec &pt);
   volume(const volume &vol);
+  volume &operator=(const volume &vol);
   void set_direction_min(direction d, double val) { min_corner.set_direction(d, val); };
   void set_direction_max(direction d, double val) { max_corner.set_direction(d, val); };
   double in_direction_min(direction d) const { return min_corner.in_direction(d); };
@@ -990,6 +1063,7 @@ public:
   grid_volume split_by_effort(int num, int which, int Ngv = 0, const grid_volume *v = NULL,
                               double *effort = NULL) const;
   std::vector<grid_volume> split_into_n(int n) const;
+  void split_by_bisection(int n, std::vector<grid_volume> &result) const;
   grid_volume split_at_fraction(bool want_high, int numer, int bestd = -1, int bestlen = 1) const;
   double get_cost() const;
   grid_volume halve(direction d) const;
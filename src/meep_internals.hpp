@@ -16,6 +16,7 @@
 */
 
 #include <string.h>
+#include <typeinfo>
 #include "meep.hpp"
 
 namespace meep {
@@ -36,6 +37,12 @@ static inline int my_round(double x) { return int(floor(fabs(x) + 0.5) * (x < 0
 
 inline int small_r_metal(int m) { return m - 1; }
 
+// whether p is a plain Lorentzian (or Drude) pole with allocated data, which
+// update_pols and update_eh handle together with the other such poles
+inline bool is_fused_pole(const polarization_state *p) {
+  return p->data && typeid(*p->s) == typeid(lorentzian_susceptibility);
+}
+
 inline int rmin_bulk(int m) {
   int r = 1 + small_r_metal(m);
   if (r < 1) r = 1;
@@ -45,32 +52,93 @@ inline int rmin_bulk(int m) {
 class src_vol {
 public:
   src_vol(component cc, src_time *st, size_t n, ptrdiff_t *ind, std::complex<double> *amps);
+  src_vol(component cc, src_time *st, ptrdiff_t i0, const ptrdiff_t nbox[3],
+          const ptrdiff_t sbox[3], std::complex<double> *amps);
   src_vol(const src_vol &sv);
   ~src_vol() {
+    ++generation;
     delete next;
     delete[] index;
     delete[] A;
+    for (int k = 0; k < 3; ++k)
+      delete[] a[k];
   }
 
   src_time *t;
-  ptrdiff_t *index;        // list of locations of sources in grid (indices)
+  ptrdiff_t *index;        // list of locations of sources in grid (indices), or NULL for a box
   size_t npts;             // number of points in list
   component c;             // field component the source applies to
-  std::complex<double> *A; // list of amplitudes
+  std::complex<double> *A; // list of amplitudes, or NULL if separable
 
-  std::complex<double> dipole(size_t j) { return A[j] * t->dipole(); }
-  std::complex<double> current(size_t j) { return A[j] * t->current(); }
+  /* Box-shaped sources (index == NULL) store point j = (j1*n[1] + j2)*n[2] + j3
+     at grid index idx0 + j1*stride[0] + j2*stride[1] + j3*stride[2], and if the
+     amplitudes factor (A == NULL) then A_j = a[0][j1] * a[1][j2] * a[2][j3]. */
+  ptrdiff_t idx0, n[3], stride[3];
+  std::complex<double> *a[3];
+
+  ptrdiff_t index_at(size_t j) const {
+    if (index) return index[j];
+    const ptrdiff_t j3 = j % n[2], j12 = j / n[2];
+    return idx0 + (j12 / n[1]) * stride[0] + (j12 % n[1]) * stride[1] + j3 * stride[2];
+  }
+  std::complex<double> amplitude(size_t j) const {
+    if (A) return A[j];
+    const ptrdiff_t j3 = j % n[2], j12 = j / n[2];
+    return a[0][j12 / n[1]] * a[1][j12 % n[1]] * a[2][j3];
+  }
+
+  std::complex<double> dipole(size_t j) { return amplitude(j) * t->dipole(); }
+  std::complex<double> current(size_t j) { return amplitude(j) * t->current(); }
   void update(double time, double dt) { t->update(time, dt); }
 
+  // call op(index_at(j), amplitude(j)) for all j, using strided loops for boxes
+  template <class OP> void loop_over_points(OP &op) const {
+    if (index) {
+      for (size_t j = 0; j < npts; ++j)
+        op(index[j], A[j]);
+      return;
+    }
+    size_t j = 0;
+    for (ptrdiff_t j1 = 0; j1 < n[0]; ++j1)
+      for (ptrdiff_t j2 = 0; j2 < n[1]; ++j2) {
+        ptrdiff_t idx = idx0 + j1 * stride[0] + j2 * stride[1];
+        if (A)
+          for (ptrdiff_t j3 = 0; j3 < n[2]; ++j3, idx += stride[2])
+            op(idx, A[j++]);
+        else {
+          const std::complex<double> a12 = a[0][j1] * a[1][j2];
+          for (ptrdiff_t j3 = 0; j3 < n[2]; ++j3, idx += stride[2])
+            op(idx, a12 * a[2][j3]);
+        }
+      }
+  }
+
+  // fr[i] -= Re(scale * w[i] * A_j) and fi[i] -= Im(...) at the source points;
+  // w and fi may be NULL
+  void subtract_from(realnum *fr, realnum *fi, std::complex<double> scale,
+                     const realnum *w = NULL) const;
+
   bool operator==(const src_vol &sv) const {
     // note: don't compare sv.A, since this is used to see if we can just
     // add one source's amplitudes to another in src_vol::add_to
-    return sv.npts == npts && sv.c == c && sv.t == t &&
-           memcmp(sv.index, index, npts * sizeof(ptrdiff_t)) == 0;
+    if (sv.npts != npts || sv.c != c || sv.t != t || !sv.index != !index) return false;
+    if (!index)
+      return sv.idx0 == idx0 && memcmp(sv.n, n, sizeof(n)) == 0 &&
+             memcmp(sv.stride, stride, sizeof(stride)) == 0;
+    return memcmp(sv.index, index, npts * sizeof(ptrdiff_t)) == 0;
   }
 
   src_vol *add_to(src_vol *others);
   src_vol *next;
+
+  // incremented whenever a src_vol is created, deleted or has its amplitudes
+  // changed, so that caches of the source points (dft_ldos) can tell that
+  // they are stale even if a new src_vol reuses the address of an old one
+  static size_t generation;
+
+private:
+  bool factor_amplitudes();
+  void expand_amplitudes();
 };
 
 const int num_bandpts = 32;
@@ -86,12 +154,22 @@ void step_curl(realnum *f, component c, const realnum *g1, const realnum *g2, pt
                const double *sigu, const double *kapu, const double *siginvu, double dt,
                const realnum *cnd, const realnum *cndinv, realnum *fcnd);
 
+void step_fused_curl(realnum *f, realnum *fe, component c, const realnum *g1, const realnum *g2,
+                     ptrdiff_t s1, ptrdiff_t s2, const grid_volume &gv, double dtdx,
+                     const realnum *u);
+
 void step_update_EDHB(realnum *f, component fc, const grid_volume &gv, const realnum *g,
                       const realnum *g1, const realnum *g2, const realnum *u, const realnum *u1,
                       const realnum *u2, ptrdiff_t s, ptrdiff_t s1, ptrdiff_t s2,
                       const realnum *chi2, const realnum *chi3, realnum *fw, direction dsigw,
                       const double *sigw, const double *kapw);
 
+void step_nonlinear_EDHB(realnum *f, const grid_volume &gv, const ivec &is, const ivec &ie,
+                         const realnum *g, const realnum *g1, const realnum *g2,
+                         const realnum *u, const realnum *u1, const realnum *u2, ptrdiff_t s,
+                         ptrdiff_t s1, ptrdiff_t s2, const realnum *chi2, const realnum *chi3,
+                         realnum *fw, direction dsigw, const double *sigw, const double *kapw);
+
 void step_beta(realnum *f, component c, const realnum *g, const grid_volume &gv, double betadt,
                direction dsig, const double *siginv, realnum *fu, direction dsigu,
                const double *siginvu, const realnum *cndinv, realnum *fcnd);
@@ -105,12 +183,23 @@ void step_curl_stride1(realnum *f, component c, const realnum *g1, const realnum
                        const double *sigu, const double *kapu, const double *siginvu, double dt,
                        const realnum *cnd, const realnum *cndinv, realnum *fcnd);
 
+void step_fused_curl_stride1(realnum *f, realnum *fe, component c, const realnum *g1,
+                             const realnum *g2, ptrdiff_t s1, ptrdiff_t s2, const grid_volume &gv,
+                             double dtdx, const realnum *u);
+
 void step_update_EDHB_stride1(realnum *f, component fc, const grid_volume &gv, const realnum *g,
                               const realnum *g1, const realnum *g2, const realnum *u,
                               const realnum *u1, const realnum *u2, ptrdiff_t s, ptrdiff_t s1,
                               ptrdiff_t s2, const realnum *chi2, const realnum *chi3, realnum *fw,
                               direction dsigw, const double *sigw, const double *kapw);
 
+void step_nonlinear_EDHB_stride1(realnum *f, const grid_volume &gv, const ivec &is,
+                                 const ivec &ie, const realnum *g, const realnum *g1,
+                                 const realnum *g2, const realnum *u, const realnum *u1,
+                                 const realnum *u2, ptrdiff_t s, ptrdiff_t s1, ptrdiff_t s2,
+                                 const realnum *chi2, const realnum *chi3, realnum *fw,
+                                 direction dsigw, const double *sigw, const double *kapw);
+
 void step_beta_stride1(realnum *f, component c, const realnum *g, const grid_volume &gv,
                        double betadt, direction dsig, const double *siginv, realnum *fu,
                        direction dsigu, const double *siginvu, const realnum *cndinv,
@@ -132,6 +221,14 @@ void step_beta_stride1(realnum *f, component c, const realnum *g, const grid_vol
                 siginvu, dt, cnd, cndinv, fcnd);                                                   \
   } while (0)
 
+#define STEP_FUSED_CURL(f, fe, c, g1, g2, s1, s2, gv, dtdx, u)                                     \
+  do {                                                                                             \
+    if (LOOPS_ARE_STRIDE1(gv))                                                                     \
+      step_fused_curl_stride1(f, fe, c, g1, g2, s1, s2, gv, dtdx, u);                              \
+    else                                                                                           \
+      step_fused_curl(f, fe, c, g1, g2, s1, s2, gv, dtdx, u);                                      \
+  } while (0)
+
 #define STEP_UPDATE_EDHB(f, fc, gv, g, g1, g2, u, u1, u2, s, s1, s2, chi2, chi3, fw, dsigw, sigw,  \
                          kapw)                                                                     \
   do {                                                                                             \
@@ -143,6 +240,17 @@ void step_beta_stride1(realnum *f, component c, const realnum *g, const grid_vol
                        kapw);                                                                      \
   } while (0)
 
+#define STEP_NONLINEAR_EDHB(f, gv, is, ie, g, g1, g2, u, u1, u2, s, s1, s2, chi2, chi3, fw, dsigw, \
+                           sigw, kapw)                                                             \
+  do {                                                                                             \
+    if (LOOPS_ARE_STRIDE1(gv))                                                                     \
+      step_nonlinear_EDHB_stride1(f, gv, is, ie, g, g1, g2, u, u1, u2, s, s1, s2, chi2, chi3, fw,  \
+                                  dsigw, sigw, kapw);                                              \
+    else                                                                                           \
+      step_nonlinear_EDHB(f, gv, is, ie, g, g1, g2, u, u1, u2, s, s1, s2, chi2, chi3, fw, dsigw,   \
+                          sigw, kapw);                                                             \
+  } while (0)
+
 #define STEP_BETA(f, c, g, gv, betadt, dsig, siginv, fu, dsigu, siginvu, cndinv, fcnd)             \
   do {                                                                                             \
     if (LOOPS_ARE_STRIDE1(gv))                                                                     \
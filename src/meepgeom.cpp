@@ -15,8 +15,18 @@
 */
 
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+#include <sys/stat.h>
 #include "meepgeom.hpp"
 
+#include "config.h"
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
 namespace meep_geom {
 
 #define master_printf meep::master_printf
@@ -92,7 +102,8 @@ bool material_type_equal(const material_type m1, const material_type m2) {
     case material_data::MATERIAL_FILE:
     case material_data::PERFECT_METAL: return true;
     case material_data::MATERIAL_USER:
-      return m1->user_func == m2->user_func && m1->user_data == m2->user_data;
+      return m1->user_func == m2->user_func && m1->user_batch_func == m2->user_batch_func &&
+             m1->user_data == m2->user_data;
     case material_data::MEDIUM: return medium_struct_equal(&(m1->medium), &(m2->medium));
     default: return false;
   }
@@ -279,6 +290,53 @@ bool is_metal(meep::field_type ft, const material_type *material) {
     }
 }
 
+/* Helpers for epsilon-file grids, which may be only partly read into memory
+   (see read_epsilon_files). */
+
+// coordinates of p scaled to [0,1] over the cell, as used for interpolation
+static vector3 file_coordinates(vector3 p) {
+  const vector3 size = geometry_lattice.size;
+  vector3 r;
+  r.x = size.x == 0 ? 0 : 0.5 + (p.x - geometry_center.x) / size.x;
+  r.y = size.y == 0 ? 0 : 0.5 + (p.y - geometry_center.y) / size.y;
+  r.z = size.z == 0 ? 0 : 0.5 + (p.z - geometry_center.z) / size.z;
+  return r;
+}
+
+// grid index x (of n) and interpolation neighbor x2 with weight dx for the
+// scaled coordinate r, exactly as in meep::linear_interpolate
+static void file_grid_index(meep::realnum r, int n, int &x, int &x2, meep::realnum &dx) {
+  if (r < 0.0)
+    r = -r;
+  else if (r > 1.0)
+    r = 1.0 - r;
+  x = meep::pmod(int(r * n), n);
+  dx = r * n - x - 0.5;
+  x2 = meep::pmod((dx >= 0.0 ? x + 1 : x - 1), n);
+  dx = fabs(dx);
+}
+
+static bool file_block_is_full(const material_data *md) {
+  for (int i = 0; i < 3; ++i)
+    if (md->epsilon_start[i] != 0 || md->epsilon_count[i] != md->epsilon_dims[i]) return false;
+  return true;
+}
+
+// position of grid index x (of n) in a periodic block [start, start+count),
+// clamped to the nearest edge of the block for points outside it
+static size_t file_block_index(size_t x, size_t n, size_t start, size_t count) {
+  size_t i = (x + n - start) % n;
+  if (i >= count) i = i - (count - 1) < n - i ? count - 1 : 0;
+  return i;
+}
+
+static meep::realnum file_block_value(const material_data *md, int x, int y, int z) {
+  size_t i = file_block_index(x, md->epsilon_dims[0], md->epsilon_start[0], md->epsilon_count[0]);
+  size_t j = file_block_index(y, md->epsilon_dims[1], md->epsilon_start[1], md->epsilon_count[1]);
+  size_t k = file_block_index(z, md->epsilon_dims[2], md->epsilon_start[2], md->epsilon_count[2]);
+  return md->epsilon_data[(i * md->epsilon_count[1] + j) * md->epsilon_count[2] + k];
+}
+
 // return material of the point p from the file (assumed already read)
 void epsilon_file_material(material_data *md, vector3 p) {
   default_material = (void *)md;
@@ -288,15 +346,28 @@ void epsilon_file_material(material_data *md, vector3 p) {
 
   if (!(md->epsilon_data)) return;
   medium_struct *mm = &(md->medium);
-  double rx =
-      geometry_lattice.size.x == 0 ? 0 : 0.5 + (p.x - geometry_center.x) / geometry_lattice.size.x;
-  double ry =
-      geometry_lattice.size.y == 0 ? 0 : 0.5 + (p.y - geometry_center.y) / geometry_lattice.size.y;
-  double rz =
-      geometry_lattice.size.z == 0 ? 0 : 0.5 + (p.z - geometry_center.z) / geometry_lattice.size.z;
-  mm->epsilon_diag.x = mm->epsilon_diag.y = mm->epsilon_diag.z =
-      meep::linear_interpolate(rx, ry, rz, md->epsilon_data, md->epsilon_dims[0],
-                               md->epsilon_dims[1], md->epsilon_dims[2], 1);
+  vector3 r = file_coordinates(p);
+  meep::realnum eps;
+  if (file_block_is_full(md))
+    eps = meep::linear_interpolate(r.x, r.y, r.z, md->epsilon_data, md->epsilon_dims[0],
+                                   md->epsilon_dims[1], md->epsilon_dims[2], 1);
+  else {
+    // same interpolation as meep::linear_interpolate, in the partial block
+    int x, y, z, x2, y2, z2;
+    meep::realnum dx, dy, dz;
+    file_grid_index(r.x, md->epsilon_dims[0], x, x2, dx);
+    file_grid_index(r.y, md->epsilon_dims[1], y, y2, dy);
+    file_grid_index(r.z, md->epsilon_dims[2], z, z2, dz);
+#define D(x, y, z) file_block_value(md, x, y, z)
+    eps = (((D(x, y, z) * (1.0 - dx) + D(x2, y, z) * dx) * (1.0 - dy) +
+            (D(x, y2, z) * (1.0 - dx) + D(x2, y2, z) * dx) * dy) *
+               (1.0 - dz) +
+           ((D(x, y, z2) * (1.0 - dx) + D(x2, y, z2) * dx) * (1.0 - dy) +
+            (D(x, y2, z2) * (1.0 - dx) + D(x2, y2, z2) * dx) * dy) *
+               dz);
+#undef D
+  }
+  mm->epsilon_diag.x = mm->epsilon_diag.y = mm->epsilon_diag.z = eps;
   mm->epsilon_offdiag.x.re = mm->epsilon_offdiag.y.re = mm->epsilon_offdiag.z.re = 0;
 }
 
@@ -328,6 +399,8 @@ public:
 
   virtual void set_volume(const meep::volume &v);
   virtual void unset_volume(void);
+  virtual bool thread_safe();
+  void set_resolution(double a) { batch_h = 0.5 / a; }
 
   bool has_chi(meep::component c, int p);
   virtual bool has_chi3(meep::component c);
@@ -358,6 +431,32 @@ public:
 
 private:
   void get_material_pt(material_type &material, const meep::vec &r);
+  void eval_user_material(material_type md, const meep::vec &r);
+  bool batch_lookup(material_type md, const meep::vec &r, vector3 &eps);
+
+  // Batch user materials are evaluated a whole row of the half-pixel grid
+  // (along the innermost loop direction) at a time, and the most recent
+  // rows are kept here; lookups off the grid fall back to single points.
+  struct batch_row {
+    material_type mat;
+    int key[2]; // half-pixel indices in the other directions
+    int lo;     // half-pixel index of eps[0] along the row
+    std::vector<vector3> eps;
+  };
+  std::vector<batch_row> batch_rows;
+  double batch_h; // half-pixel spacing, or 0 if unknown
+  meep::volume batch_vol;
+
+  // The set_volume box is also split into tiles of about tile_pixels pixels
+  // per side (when the resolution is known), each with its own tree of the
+  // few objects overlapping it, so that lookups in a chunk's loop descend a
+  // small tree; boxes straddling tiles fall back to the larger trees.
+  std::vector<geom_box_tree> tile_trees;
+  geom_box tiles_box;
+  int tiles_n[3];
+  void make_tiles(const geom_box &box);
+  void destroy_tiles();
+  geom_box_tree tree_at(const geom_box &b);
 
   material_type_list extra_materials;
   pol *current_pol;
@@ -366,7 +465,8 @@ private:
 /***********************************************************************/
 
 geom_epsilon::geom_epsilon(geometric_object_list g, material_type_list mlist,
-                           const meep::volume &v) {
+                           const meep::volume &v)
+    : batch_h(0), batch_vol(v) {
   geometry = g; // don't bother making a copy, only used in one place
   extra_materials = mlist;
   current_pol = NULL;
@@ -411,6 +511,7 @@ geom_epsilon::geom_epsilon(geometric_object_list g, material_type_list mlist,
 
 geom_epsilon::~geom_epsilon() {
   unset_volume();
+  destroy_tiles();
   destroy_geom_box_tree(geometry_tree);
   FOR_DIRECTIONS(d) FOR_SIDES(b) {
     if (cond[d][b].prof) delete[] cond[d][b].prof;
@@ -448,9 +549,95 @@ void geom_epsilon::unset_volume(void) {
 
 void geom_epsilon::set_volume(const meep::volume &v) {
   unset_volume();
+  batch_vol = v;
+  batch_rows.clear();
 
   geom_box box = gv2box(v);
   restricted_tree = create_geom_box_tree0(geometry, box);
+  make_tiles(box);
+}
+
+static const int tile_pixels = 16;
+
+void geom_epsilon::make_tiles(const geom_box &box) {
+  if (!tile_trees.empty() && vector3_equal(box.low, tiles_box.low) &&
+      vector3_equal(box.high, tiles_box.high))
+    return; // same volume as before (e.g. the next component)
+  destroy_tiles();
+  if (batch_h <= 0) return;
+  const double tile_width = tile_pixels * 2 * batch_h;
+  double lo[3] = {box.low.x, box.low.y, box.low.z}, hi[3] = {box.high.x, box.high.y, box.high.z};
+  size_t ntiles = 1;
+  for (int k = 0; k < 3; ++k) {
+    tiles_n[k] = std::max(1, int(ceil((hi[k] - lo[k]) / tile_width)));
+    ntiles *= tiles_n[k];
+  }
+  if (ntiles == 1) return; // restricted_tree is already as small
+  tiles_box = box;
+  tile_trees.resize(ntiles);
+  for (int i0 = 0; i0 < tiles_n[0]; ++i0)
+    for (int i1 = 0; i1 < tiles_n[1]; ++i1)
+      for (int i2 = 0; i2 < tiles_n[2]; ++i2) {
+        int i[3] = {i0, i1, i2};
+        double tlo[3], thi[3];
+        for (int k = 0; k < 3; ++k) {
+          double w = (hi[k] - lo[k]) / tiles_n[k];
+          tlo[k] = lo[k] + i[k] * w;
+          thi[k] = i[k] == tiles_n[k] - 1 ? hi[k] : lo[k] + (i[k] + 1) * w;
+        }
+        geom_box tile = {{tlo[0], tlo[1], tlo[2]}, {thi[0], thi[1], thi[2]}};
+        tile_trees[(i0 * tiles_n[1] + i1) * tiles_n[2] + i2] =
+            create_geom_box_tree0(geometry, tile);
+      }
+}
+
+void geom_epsilon::destroy_tiles() {
+  for (size_t i = 0; i < tile_trees.size(); ++i)
+    destroy_geom_box_tree(tile_trees[i]);
+  tile_trees.clear();
+}
+
+static bool box_contains(const geom_box &outer, const geom_box &b) {
+  return b.low.x >= outer.low.x && b.low.y >= outer.low.y && b.low.z >= outer.low.z &&
+         b.high.x <= outer.high.x && b.high.y <= outer.high.y && b.high.z <= outer.high.z;
+}
+
+// smallest available tree that is exact for all points in b
+geom_box_tree geom_epsilon::tree_at(const geom_box &b) {
+  if (!tile_trees.empty() && box_contains(tiles_box, b)) {
+    double lo[3] = {tiles_box.low.x, tiles_box.low.y, tiles_box.low.z};
+    double hi[3] = {tiles_box.high.x, tiles_box.high.y, tiles_box.high.z};
+    double blo[3] = {b.low.x, b.low.y, b.low.z};
+    int i[3];
+    for (int k = 0; k < 3; ++k) {
+      double w = (hi[k] - lo[k]) / tiles_n[k];
+      i[k] = w > 0 ? std::min(tiles_n[k] - 1, int((blo[k] - lo[k]) / w)) : 0;
+    }
+    geom_box_tree t = tile_trees[(i[0] * tiles_n[1] + i[1]) * tiles_n[2] + i[2]];
+    if (box_contains(t->b, b)) return t;
+  }
+  if (box_contains(restricted_tree->b, b)) return restricted_tree;
+  return geometry_tree;
+}
+
+// user-function and file materials overwrite their medium at each point,
+// so lookups are only thread-safe if every material is a constant medium
+static bool materials_thread_safe(geometric_object_list g) {
+  for (int i = 0; i < g.num_items; ++i) {
+    if (is_variable(g.items[i].material) || is_file(g.items[i].material)) return false;
+    if (g.items[i].which_subclass == geometric_object::COMPOUND_GEOMETRIC_OBJECT &&
+        !materials_thread_safe(
+            g.items[i].subclass.compound_geometric_object_data->component_objects))
+      return false;
+  }
+  return true;
+}
+
+bool geom_epsilon::thread_safe() {
+  if (is_variable(default_material) || is_file(default_material)) return false;
+  for (int i = 0; i < extra_materials.num_items; ++i)
+    if (is_variable(extra_materials.items[i]) || is_file(extra_materials.items[i])) return false;
+  return materials_thread_safe(geometry);
 }
 
 static void material_epsmu(meep::field_type ft, material_type material, symmetric_matrix *epsmu,
@@ -519,8 +706,10 @@ static void material_epsmu(meep::field_type ft, material_type material, symmetri
 void geom_epsilon::get_material_pt(material_type &material, const meep::vec &r) {
   vector3 p = vec_to_vector3(r);
   boolean inobject;
-  material =
-      (material_type)material_of_unshifted_point_in_tree_inobject(p, restricted_tree, &inobject);
+  geom_box pb = {p, p};
+  geom_box_tree t = restricted_tree;
+  if (!tile_trees.empty() && box_contains(tiles_box, pb)) t = tree_at(pb);
+  material = (material_type)material_of_unshifted_point_in_tree_inobject(p, t, &inobject);
   material_data *md = material;
 
   switch (md->which_subclass) {
@@ -537,11 +726,7 @@ void geom_epsilon::get_material_pt(material_type &material, const meep::vec &r)
     // Note that we initialize the medium to vacuum, so that
     // the user's function only needs to fill in whatever is
     // different from vacuum.
-    case material_data::MATERIAL_USER:
-      md->medium = medium_struct();
-      md->user_func(p, md->user_data, &(md->medium));
-      check_offdiag(&md->medium);
-      return;
+    case material_data::MATERIAL_USER: eval_user_material(md, r); return;
 
     // position-independent material or metal: there is nothing to do
     case material_data::MEDIUM:
@@ -551,6 +736,67 @@ void geom_epsilon::get_material_pt(material_type &material, const meep::vec &r)
   };
 }
 
+void geom_epsilon::eval_user_material(material_type md, const meep::vec &r) {
+  md->medium = medium_struct();
+  if (md->user_batch_func) {
+    vector3 eps;
+    if (!batch_lookup(md, r, eps)) {
+      vector3 p = vec_to_vector3(r);
+      md->user_batch_func(1, &p, md->user_data, &eps);
+    }
+    md->medium.epsilon_diag = eps;
+  }
+  else {
+    md->user_func(vec_to_vector3(r), md->user_data, &(md->medium));
+    check_offdiag(&md->medium);
+  }
+}
+
+bool geom_epsilon::batch_lookup(material_type md, const meep::vec &r, vector3 &eps) {
+  if (batch_h <= 0) return false;
+  const meep::direction rd = r.dim == meep::D2 ? meep::Y : meep::Z;
+  int key[2] = {0, 0}, nkey = 0, ir = 0;
+  LOOP_OVER_DIRECTIONS(r.dim, d) {
+    double x = r.in_direction(d) / batch_h, xi = floor(x + 0.5);
+    if (fabs(x - xi) > 1e-6) return false; // not on the half-pixel grid
+    if (d == rd)
+      ir = int(xi);
+    else
+      key[nkey++] = int(xi);
+  }
+
+  for (size_t i = batch_rows.size(); i-- > 0;) {
+    const batch_row &row = batch_rows[i];
+    if (row.mat == md && row.key[0] == key[0] && row.key[1] == key[1] && ir >= row.lo &&
+        ir < row.lo + int(row.eps.size())) {
+      eps = row.eps[ir - row.lo];
+      return true;
+    }
+  }
+
+  // evaluate the whole row within the current volume in one call
+  int lo = int(ceil(batch_vol.in_direction_min(rd) / batch_h - 1e-6));
+  int hi = int(floor(batch_vol.in_direction_max(rd) / batch_h + 1e-6));
+  if (ir < lo || ir > hi) return false;
+  std::vector<vector3> pts(hi - lo + 1);
+  meep::vec q(r);
+  for (int j = lo; j <= hi; ++j) {
+    q.set_direction(rd, j * batch_h);
+    pts[j - lo] = vec_to_vector3(q);
+  }
+  if (batch_rows.size() >= 16) batch_rows.erase(batch_rows.begin());
+  batch_row row;
+  row.mat = md;
+  row.key[0] = key[0];
+  row.key[1] = key[1];
+  row.lo = lo;
+  row.eps.resize(pts.size());
+  md->user_batch_func(pts.size(), &pts[0], md->user_data, &row.eps[0]);
+  batch_rows.push_back(row);
+  eps = batch_rows.back().eps[ir - lo];
+  return true;
+}
+
 // returns trace of the tensor diagonal
 double geom_epsilon::chi1p1(meep::field_type ft, const meep::vec &r) {
   symmetric_matrix chi1p1, chi1p1_inv;
@@ -737,7 +983,7 @@ void geom_epsilon::eff_chi1inv_matrix(meep::component c, symmetric_matrix *chi1i
     return;
   }
 
-  if (!get_front_object(v, geometry_tree, p, &o, shiftby, mat, mat_behind)) {
+  if (!get_front_object(v, tree_at(gv2box(v)), p, &o, shiftby, mat, mat_behind)) {
     get_material_pt(mat, v.center());
     if (mat && mat->which_subclass == material_data::MATERIAL_USER && mat->do_averaging) {
       fallback = true;
@@ -852,67 +1098,88 @@ void geom_epsilon::eff_chi1inv_matrix(meep::component c, symmetric_matrix *chi1i
   sym_matrix_invert(chi1inv_matrix, &meps);
 }
 
-static int eps_ever_negative = 0;
-static meep::field_type func_ft = meep::E_stuff;
+// integrand data for fallback_chi1inv_row, kept off globals so that
+// several threads can average pixels concurrently
+struct eps_func_data {
+  geom_epsilon *geomeps;
+  meep::field_type ft;
+  bool eps_ever_negative;
+};
 
-#ifdef CTL_HAS_COMPLEX_INTEGRATION
-static cnumber ceps_func(int n, number *x, void *geomeps_) {
-  geom_epsilon *geomeps = (geom_epsilon *)geomeps_;
+// epsilon at the integration point x[0..n-1], with the cylindrical weight s
+static double eps_func_point(int n, const number *x, eps_func_data *data, double &s) {
   vector3 p = {0, 0, 0};
+  s = 1;
   p.x = x[0];
   p.y = n > 1 ? x[1] : 0;
   p.z = n > 2 ? x[2] : 0;
-  double s = 1;
   if (dim == meep::Dcyl) {
     double py = p.y;
     p.y = p.z;
     p.z = py;
     s = p.x;
   }
+  double ep = data->geomeps->chi1p1(data->ft, vector3_to_vec(p));
+  if (ep < 0) data->eps_ever_negative = true;
+  return ep;
+}
+
+#ifdef CTL_HAS_COMPLEX_INTEGRATION
+static cnumber ceps_func(int n, number *x, void *data_) {
+  double s;
+  double ep = eps_func_point(n, x, (eps_func_data *)data_, s);
   cnumber ret;
-  double ep = geomeps->chi1p1(func_ft, vector3_to_vec(p));
-  if (ep < 0) eps_ever_negative = 1;
   ret.re = ep * s;
   ret.im = s / ep;
   return ret;
 }
 #else
-static number eps_func(int n, number *x, void *geomeps_) {
-  geom_epsilon *geomeps = (geom_epsilon *)geomeps_;
-  vector3 p = {0, 0, 0};
-  double s = 1;
-  p.x = x[0];
-  p.y = n > 1 ? x[1] : 0;
-  p.z = n > 2 ? x[2] : 0;
-  if (dim == meep::Dcyl) {
-    double py = p.y;
-    p.y = p.z;
-    p.z = py;
-    s = p.x;
-  }
-  double ep = geomeps->chi1p1(func_ft, vector3_to_vec(p));
-  if (ep < 0) eps_ever_negative = 1;
+static number eps_func(int n, number *x, void *data_) {
+  double s;
+  double ep = eps_func_point(n, x, (eps_func_data *)data_, s);
   return ep * s;
 }
-static number inveps_func(int n, number *x, void *geomeps_) {
-  geom_epsilon *geomeps = (geom_epsilon *)geomeps_;
-  vector3 p = {0, 0, 0};
-  double s = 1;
-  p.x = x[0];
-  p.y = n > 1 ? x[1] : 0;
-  p.z = n > 2 ? x[2] : 0;
-  if (dim == meep::Dcyl) {
-    double py = p.y;
-    p.y = p.z;
-    p.z = py;
-    s = p.x;
-  }
-  double ep = geomeps->chi1p1(func_ft, vector3_to_vec(p));
-  if (ep < 0) eps_ever_negative = 1;
+static number inveps_func(int n, number *x, void *data_) {
+  double s;
+  double ep = eps_func_point(n, x, (eps_func_data *)data_, s);
   return s / ep;
 }
 #endif
 
+/* If nonzero, fallback_chi1inv_row replaces the adaptive cubature by a
+   midpoint rule on a fixed stencil of fallback_stencil^n points per pixel:
+   a cheaper but less accurate average for smoothly varying or density-based
+   materials (the interface normal still comes from normal_vector). */
+static int fallback_stencil = 0;
+
+void set_fallback_stencil(int npoints) {
+  if (npoints < 0) meep::abort("invalid fallback stencil size %d", npoints);
+  fallback_stencil = npoints;
+}
+
+// integrals of eps and 1/eps over [xmin,xmax] by the midpoint rule
+static void stencil_integrals(int n, const number *xmin, const number *xmax, int ns,
+                              eps_func_data *data, double &ieps, double &iinveps) {
+  int npts = 1;
+  double dvol = 1;
+  for (int k = 0; k < n; ++k) {
+    npts *= ns;
+    dvol *= (xmax[k] - xmin[k]) / ns;
+  }
+  ieps = iinveps = 0;
+  for (int i = 0; i < npts; ++i) {
+    number x[3];
+    for (int k = 0, j = i; k < n; ++k, j /= ns)
+      x[k] = xmin[k] + (j % ns + 0.5) * (xmax[k] - xmin[k]) / ns;
+    double s;
+    double ep = eps_func_point(n, x, data, s);
+    ieps += ep * s;
+    iinveps += s / ep;
+  }
+  ieps *= dvol;
+  iinveps *= dvol;
+}
+
 // fallback meaneps using libctl's adaptive cubature routine
 void geom_epsilon::fallback_chi1inv_row(meep::component c, double chi1inv_row[3],
                                         const meep::volume &v, double tol, int maxeval) {
@@ -972,23 +1239,29 @@ void geom_epsilon::fallback_chi1inv_row(meep::component c, double chi1inv_row[3]
   for (int i = 0; i < n; ++i)
     vol *= xmax[i] - xmin[i];
   if (dim == meep::Dcyl) vol *= (xmin[0] + xmax[0]) * 0.5;
-  eps_ever_negative = 0;
-  func_ft = meep::type(c);
+  eps_func_data data = {this, meep::type(c), false};
   double meps, minveps;
+  if (fallback_stencil > 0) {
+    stencil_integrals(n, xmin, xmax, fallback_stencil, &data, meps, minveps);
+    meps /= vol;
+    minveps /= vol;
+  }
+  else {
 #ifdef CTL_HAS_COMPLEX_INTEGRATION
-  cnumber ret = cadaptive_integration(ceps_func, xmin, xmax, n, (void *)this, 0, tol, maxeval,
-                                      &esterr, &errflag);
-  meps = ret.re / vol;
-  minveps = ret.im / vol;
+    cnumber ret = cadaptive_integration(ceps_func, xmin, xmax, n, (void *)&data, 0, tol, maxeval,
+                                        &esterr, &errflag);
+    meps = ret.re / vol;
+    minveps = ret.im / vol;
 #else
-  meps = adaptive_integration(eps_func, xmin, xmax, n, (void *)this, 0, tol, maxeval, &esterr,
-                              &errflag) /
-         vol;
-  minveps = adaptive_integration(inveps_func, xmin, xmax, n, (void *)this, 0, tol, maxeval, &esterr,
-                                 &errflag) /
-            vol;
+    meps = adaptive_integration(eps_func, xmin, xmax, n, (void *)&data, 0, tol, maxeval, &esterr,
+                                &errflag) /
+           vol;
+    minveps = adaptive_integration(inveps_func, xmin, xmax, n, (void *)&data, 0, tol, maxeval,
+                                   &esterr, &errflag) /
+              vol;
 #endif
-  if (eps_ever_negative) // averaging negative eps causes instability
+  }
+  if (data.eps_ever_negative) // averaging negative eps causes instability
     minveps = 1.0 / (meps = eps(v.center()));
 
   {
@@ -1209,11 +1482,7 @@ void geom_epsilon::sigma_row(meep::component c, double sigrow[3], const meep::ve
   material_type mat =
       (material_type)material_of_unshifted_point_in_tree_inobject(p, restricted_tree, &inobject);
 
-  if (mat->which_subclass == material_data::MATERIAL_USER) {
-    mat->medium = medium_struct();
-    mat->user_func(p, mat->user_data, &(mat->medium));
-    check_offdiag(&mat->medium);
-  }
+  if (mat->which_subclass == material_data::MATERIAL_USER) eval_user_material(mat, r);
 
   sigrow[0] = sigrow[1] = sigrow[2] = 0.0;
 
@@ -1472,12 +1741,248 @@ void add_absorbing_layer(absorber_list alist, double thickness, int direction, i
 /***************************************************************/
 /***************************************************************/
 /***************************************************************/
-void set_materials_from_geometry(meep::structure *s, geometric_object_list g, vector3 center,
-                                 bool use_anisotropic_averaging, double tol, int maxeval,
-                                 bool _ensure_periodicity,
-                                 material_type _default_material, absorber_list alist,
-                                 material_type_list extra_materials) {
-  // set global variables in libctlgeom based on data fields in s
+/***************************************************************/
+/* optional on-disk cache of initialized structures: the file  */
+/* written by structure::dump is reused whenever everything    */
+/* that set_materials_from_geometry depends on hashes the same */
+/***************************************************************/
+static char *structure_cache_dir = NULL;
+
+void set_structure_cache_dir(const char *dir) {
+  delete[] structure_cache_dir;
+  structure_cache_dir = NULL;
+  if (dir && *dir) {
+    structure_cache_dir = new char[strlen(dir) + 1];
+    strcpy(structure_cache_dir, dir);
+  }
+}
+
+// 64-bit FNV-1a hash of the inputs; cacheable is cleared by anything
+// that cannot be hashed (user material functions) or reloaded by
+// structure::load (multilevel susceptibilities).
+struct structure_hash {
+  uint64_t h;
+  bool cacheable;
+
+  structure_hash() : h(14695981039346656037ULL), cacheable(true) {}
+  void add(const void *data, size_t n) {
+    const unsigned char *p = (const unsigned char *)data;
+    for (size_t i = 0; i < n; ++i) {
+      h ^= p[i];
+      h *= 1099511628211ULL;
+    }
+  }
+  void add(double x) { add(&x, sizeof(double)); }
+  void add(int i) { add(&i, sizeof(int)); }
+  // size and modification time of the file "fname.h5:dataname", as seen by the master
+  void add_file_stamp(const char *spec) {
+    size_t stamp[2] = {0, 0};
+    if (meep::am_master()) {
+      std::string fname(spec);
+      if (fname.rfind(':') != std::string::npos) fname.erase(fname.rfind(':'));
+      struct stat st;
+      if (stat(fname.c_str(), &st) == 0) {
+        stamp[0] = st.st_size;
+        stamp[1] = st.st_mtime;
+      }
+    }
+    meep::broadcast(0, stamp, 2);
+    add(stamp, sizeof(stamp));
+  }
+  void add(vector3 v) {
+    add(v.x);
+    add(v.y);
+    add(v.z);
+  }
+  void add(cvector3 v) {
+    add(v.x.re);
+    add(v.x.im);
+    add(v.y.re);
+    add(v.y.im);
+    add(v.z.re);
+    add(v.z.im);
+  }
+  void add(const susceptibility_list &sl) {
+    add(sl.num_items);
+    for (int i = 0; i < sl.num_items; ++i) {
+      const susceptibility &sus = sl.items[i];
+      if (!sus.transitions.empty()) cacheable = false;
+      add(sus.sigma_offdiag);
+      add(sus.sigma_diag);
+      add(sus.bias);
+      add(sus.frequency);
+      add(sus.gamma);
+      add(sus.alpha);
+      add(sus.noise_amp);
+      add((int)sus.drude);
+      add((int)sus.saturated_gyrotropy);
+    }
+  }
+  void add(const material_type m) {
+    add((int)m->which_subclass);
+    switch (m->which_subclass) {
+      case material_data::MATERIAL_USER: cacheable = false; break;
+      case material_data::PERFECT_METAL: break;
+      case material_data::MATERIAL_FILE:
+        if (m->epsilon_file) { // the data may not be read yet, and differs between processes
+          add(m->epsilon_file, strlen(m->epsilon_file));
+          add_file_stamp(m->epsilon_file);
+        }
+        else {
+          for (int i = 0; i < 3; ++i)
+            add(&m->epsilon_dims[i], sizeof(size_t));
+          if (m->epsilon_data)
+            add(m->epsilon_data, sizeof(meep::realnum) * m->epsilon_dims[0] * m->epsilon_dims[1] *
+                                     m->epsilon_dims[2]);
+        }
+        // the medium is also used
+        // fallthrough
+      case material_data::MEDIUM:
+        const medium_struct &md = m->medium;
+        add(md.epsilon_diag);
+        add(md.epsilon_offdiag);
+        add(md.mu_diag);
+        add(md.mu_offdiag);
+        add(md.E_susceptibilities);
+        add(md.H_susceptibilities);
+        add(md.E_chi2_diag);
+        add(md.E_chi3_diag);
+        add(md.H_chi2_diag);
+        add(md.H_chi3_diag);
+        add(md.D_conductivity_diag);
+        add(md.B_conductivity_diag);
+        break;
+    }
+  }
+  void add(const geometric_object_list &g) {
+    add(g.num_items);
+    for (int i = 0; i < g.num_items; ++i) {
+      const geometric_object &o = g.items[i];
+      add((material_type)o.material);
+      add(o.center);
+      add((int)o.which_subclass);
+      switch (o.which_subclass) {
+        case geometric_object::SPHERE: add(o.subclass.sphere_data->radius); break;
+        case geometric_object::CYLINDER: {
+          const cylinder *cyl = o.subclass.cylinder_data;
+          add(cyl->axis);
+          add(cyl->radius);
+          add(cyl->height);
+          add((int)cyl->which_subclass);
+          if (cyl->which_subclass == cylinder::CONE) add(cyl->subclass.cone_data->radius2);
+          if (cyl->which_subclass == cylinder::WEDGE) {
+            add(cyl->subclass.wedge_data->wedge_angle);
+            add(cyl->subclass.wedge_data->wedge_start);
+          }
+          break;
+        }
+        case geometric_object::BLOCK: {
+          const block *blk = o.subclass.block_data;
+          add(blk->e1);
+          add(blk->e2);
+          add(blk->e3);
+          add(blk->size);
+          add((int)blk->which_subclass);
+          break;
+        }
+        case geometric_object::PRISM: {
+          const prism *prsm = o.subclass.prism_data;
+          add(prsm->vertices.num_items);
+          for (int j = 0; j < prsm->vertices.num_items; ++j)
+            add(prsm->vertices.items[j]);
+          add(prsm->height);
+          add(prsm->axis);
+          break;
+        }
+        case geometric_object::COMPOUND_GEOMETRIC_OBJECT:
+          add(o.subclass.compound_geometric_object_data->component_objects);
+          break;
+        default: cacheable = false; break;
+      }
+    }
+  }
+};
+
+// Return the cache file name for this structure (to be deleted by the caller),
+// or NULL if the structure should not be cached.
+static char *structure_cache_filename(meep::structure *s, geometric_object_list g,
+                                      vector3 center, bool use_anisotropic_averaging, double tol,
+                                      int maxeval, bool _ensure_periodicity,
+                                      material_type _default_material, absorber_list alist,
+                                      material_type_list extra_materials) {
+  if (!structure_cache_dir) return NULL;
+  structure_hash h;
+  const char *version = "structure-cache-1";
+  h.add(version, strlen(version));
+
+  // geometry and materials
+  h.add(g);
+  h.add(_default_material);
+  h.add(extra_materials.num_items);
+  for (int i = 0; i < extra_materials.num_items; ++i)
+    h.add(extra_materials.items[i]);
+  h.add(center);
+
+  // grid, symmetry and chunk layout (structure::load requires the same chunks)
+  const meep::grid_volume &gv = s->gv;
+  h.add((int)gv.dim);
+  h.add(gv.a);
+  h.add(s->Courant);
+  LOOP_OVER_DIRECTIONS(gv.dim, d) {
+    h.add(gv.origin_in_direction(d));
+    h.add(gv.num_direction(d));
+    h.add(s->user_volume.num_direction(d));
+  }
+  h.add(s->S.multiplicity());
+  for (int n = 0; n < s->S.multiplicity(); ++n) {
+    meep::vec o = s->S.transform(gv.surroundings().get_min_corner(), n);
+    LOOP_OVER_DIRECTIONS(gv.dim, d) { h.add(o.in_direction(d)); }
+    FOR_COMPONENTS(c) {
+      std::complex<double> ph = s->S.phase_shift(c, n);
+      h.add(real(ph));
+      h.add(imag(ph));
+    }
+  }
+  h.add(meep::count_processors());
+  h.add(s->num_chunks);
+  for (int i = 0; i < s->num_chunks; ++i) {
+    const meep::grid_volume &cgv = s->chunks[i]->gv;
+    LOOP_OVER_DIRECTIONS(cgv.dim, d) {
+      h.add(cgv.origin_in_direction(d));
+      h.add(cgv.num_direction(d));
+    }
+    h.add(s->chunks[i]->n_proc());
+  }
+
+  // averaging and absorber parameters; absorber profiles are sampled
+  h.add((int)use_anisotropic_averaging);
+  h.add(tol);
+  h.add(maxeval);
+  h.add(fallback_stencil);
+  h.add((int)_ensure_periodicity);
+  if (alist) {
+    h.add((int)alist->size());
+    for (absorber_list_type::iterator layer = alist->begin(); layer != alist->end(); layer++) {
+      h.add(layer->thickness);
+      h.add(layer->direction);
+      h.add(layer->side);
+      h.add(layer->R_asymptotic);
+      h.add(layer->mean_stretch);
+      for (int j = 0; j <= 16; ++j)
+        h.add(layer->pml_profile(j / 16.0, layer->pml_profile_data));
+    }
+  }
+
+  if (!h.cacheable) return NULL;
+  size_t len = strlen(structure_cache_dir) + 64;
+  char *fname = new char[len];
+  snprintf(fname, len, "%s/structure-%016llx.h5", structure_cache_dir, (unsigned long long)h.h);
+  return fname;
+}
+
+// set global variables in libctlgeom based on data fields in s
+static void init_geometry_globals(meep::structure *s, vector3 center, bool _ensure_periodicity,
+                                  material_type _default_material) {
   geom_initialize();
   geometry_center = center;
 
@@ -1487,8 +1992,7 @@ void set_materials_from_geometry(meep::structure *s, geometric_object_list g, ve
   }
   default_material = _default_material;
   ensure_periodicity = _ensure_periodicity;
-  meep::grid_volume gv = s->gv;
-  double resolution = gv.a;
+  double resolution = s->gv.a;
 
   int sim_dims = 3;
   vector3 size = {0.0, 0.0, 0.0};
@@ -1519,44 +2023,103 @@ void set_materials_from_geometry(meep::structure *s, geometric_object_list g, ve
 
   geometry_lattice.size = size;
   geometry_edge = vector3_to_vec(size) * 0.5;
+}
+
+static void set_absorber_profiles(geom_epsilon &geps, const meep::grid_volume &gv,
+                                  absorber_list alist) {
+  if (!alist) return;
+  for (absorber_list_type::iterator layer = alist->begin(); layer != alist->end(); layer++) {
+    LOOP_OVER_DIRECTIONS(gv.dim, d) {
+      if (layer->direction != ALL_DIRECTIONS && layer->direction != d) continue;
+      FOR_SIDES(b) {
+        if (layer->side != ALL_SIDES && layer->side != b) continue;
+        pml_profile_thunk mythunk;
+        mythunk.func = layer->pml_profile;
+        mythunk.func_data = layer->pml_profile_data;
+        geps.set_cond_profile(d, b, layer->thickness, gv.inva * 0.5, pml_profile_wrapper,
+                              (void *)&mythunk, layer->R_asymptotic);
+      }
+    }
+  }
+}
+
+void set_materials_from_geometry(meep::structure *s, geometric_object_list g, vector3 center,
+                                 bool use_anisotropic_averaging, double tol, int maxeval,
+                                 bool _ensure_periodicity,
+                                 material_type _default_material, absorber_list alist,
+                                 material_type_list extra_materials) {
+  init_geometry_globals(s, center, _ensure_periodicity, _default_material);
+  meep::grid_volume gv = s->gv;
 
   if (meep::verbosity > 0) {
+    vector3 size = geometry_lattice.size;
     master_printf("Working in %s dimensions.\n", meep::dimension_name(s->gv.dim));
     master_printf("Computational cell is %g x %g x %g with resolution %g\n", size.x, size.y, size.z,
-                  resolution);
+                  gv.a);
   }
 
-  geom_epsilon geps(g, extra_materials, gv.pad().surroundings());
-
-  /***************************************************************/
-  /***************************************************************/
-  /***************************************************************/
-  if (alist) {
-    for (absorber_list_type::iterator layer = alist->begin(); layer != alist->end(); layer++) {
-      LOOP_OVER_DIRECTIONS(gv.dim, d) {
-        if (layer->direction != ALL_DIRECTIONS && layer->direction != d) continue;
-        FOR_SIDES(b) {
-          if (layer->side != ALL_SIDES && layer->side != b) continue;
-          pml_profile_thunk mythunk;
-          mythunk.func = layer->pml_profile;
-          mythunk.func_data = layer->pml_profile_data;
-          geps.set_cond_profile(d, b, layer->thickness, gv.inva * 0.5, pml_profile_wrapper,
-                                (void *)&mythunk, layer->R_asymptotic);
-        }
+  char *cache_file =
+      structure_cache_filename(s, g, center, use_anisotropic_averaging, tol, maxeval,
+                               _ensure_periodicity, _default_material, alist, extra_materials);
+  if (cache_file) {
+    bool hit = false;
+    if (meep::am_master()) {
+      FILE *f = fopen(cache_file, "rb");
+      if (f) {
+        hit = true;
+        fclose(f);
       }
     }
+    if (meep::broadcast(0, hit)) {
+      s->remove_susceptibilities();
+      s->load(cache_file);
+      delete[] cache_file;
+      if (meep::verbosity > 0) master_printf("-----------\n");
+      return;
+    }
   }
 
-  /***************************************************************/
-  /***************************************************************/
-  /***************************************************************/
+  read_epsilon_files(g, extra_materials, _default_material, s);
+  geom_epsilon geps(g, extra_materials, gv.pad().surroundings());
+  geps.set_resolution(gv.a);
+  set_absorber_profiles(geps, gv, alist);
+
   s->set_materials(geps, use_anisotropic_averaging, tol, maxeval);
   s->remove_susceptibilities();
   geps.add_susceptibilities(s);
 
+  if (cache_file) {
+    // write to a temporary name so that an interrupted dump is never reused
+    std::string tmp = std::string(cache_file) + ".tmp";
+    s->dump(tmp.c_str());
+    meep::all_wait();
+    if (meep::am_master() && rename(tmp.c_str(), cache_file))
+      master_printf("warning: could not create structure cache file %s\n", cache_file);
+    delete[] cache_file;
+  }
+
   if (meep::verbosity > 0) master_printf("-----------\n");
 }
 
+void update_materials_from_geometry(meep::structure *s, geometric_object_list g,
+                                    const meep::volume &where, vector3 center,
+                                    bool use_anisotropic_averaging, double tol, int maxeval,
+                                    bool _ensure_periodicity, material_type _default_material,
+                                    absorber_list alist, material_type_list extra_materials) {
+  init_geometry_globals(s, center, _ensure_periodicity, _default_material);
+  meep::grid_volume gv = s->gv;
+  double tstart = meep::wall_time();
+
+  read_epsilon_files(g, extra_materials, _default_material, s);
+  geom_epsilon geps(g, extra_materials, gv.pad().surroundings());
+  geps.set_resolution(gv.a);
+  set_absorber_profiles(geps, gv, alist);
+  s->update_materials(geps, where, use_anisotropic_averaging, tol, maxeval);
+
+  if (meep::verbosity > 0)
+    master_printf("time for update_materials = %g s\n", meep::wall_time() - tstart);
+}
+
 /***************************************************************/
 /* convenience routines for creating materials of various types*/
 /***************************************************************/
@@ -1568,6 +2131,16 @@ material_type make_dielectric(double epsilon) {
   return md;
 }
 
+material_type make_user_batch_material(user_material_batch_func user_batch_func, void *user_data,
+                                       bool do_averaging) {
+  material_data *md = new material_data();
+  md->which_subclass = material_data::MATERIAL_USER;
+  md->user_batch_func = user_batch_func;
+  md->user_data = user_data;
+  md->do_averaging = do_averaging;
+  return md;
+}
+
 material_type make_user_material(user_material_func user_func, void *user_data, bool do_averaging) {
   material_data *md = new material_data();
   md->which_subclass = material_data::MATERIAL_USER;
@@ -1584,24 +2157,157 @@ material_type make_file_material(const char *eps_input_file) {
   md->which_subclass = material_data::MATERIAL_FILE;
 
   md->epsilon_dims[0] = md->epsilon_dims[1] = md->epsilon_dims[2] = 1;
-  if (eps_input_file && eps_input_file[0]) { // file specified
-    char *fname = new char[strlen(eps_input_file) + 1];
-    strcpy(fname, eps_input_file);
-    // parse epsilon-input-file as "fname.h5:dataname"
-    char *dataname = strrchr(fname, ':');
-    if (dataname) *(dataname++) = 0;
-    meep::h5file eps_file(fname, meep::h5file::READONLY, false);
-    int rank; // ignored since rank < 3 is equivalent to singleton dims
-    md->epsilon_data = eps_file.read(dataname, &rank, md->epsilon_dims, 3);
-    if (meep::verbosity > 0)
-      master_printf("read in %zdx%zdx%zd epsilon-input-file \"%s\"\n", md->epsilon_dims[0],
-                    md->epsilon_dims[1], md->epsilon_dims[2], eps_input_file);
-    delete[] fname;
+  if (eps_input_file && eps_input_file[0]) { // file specified, read by read_epsilon_files
+    md->epsilon_file = new char[strlen(eps_input_file) + 1];
+    strcpy(md->epsilon_file, eps_input_file);
   }
 
   return md;
 }
 
+// mark in need[] the grid indices used to interpolate at scaled
+// coordinates r0 <= r <= r1, sampling finer than the half-pixel steps
+// at which the indices change
+static void mark_file_indices(double r0, double r1, std::vector<bool> &need) {
+  const int n = need.size();
+  for (double r = r0;; r += 0.25 / n) {
+    int x, x2;
+    meep::realnum dx;
+    file_grid_index(std::min(r, r1), n, x, x2, dx);
+    need[x] = need[x2] = true;
+    if (r >= r1) break;
+  }
+}
+
+// the smallest periodic range [start, start+count) containing all needed indices
+static void needed_file_range(const std::vector<bool> &need, size_t &start, size_t &count) {
+  const size_t n = need.size();
+  size_t gap = 0, best_gap = 0, best_end = 0; // longest run of unneeded indices
+  for (size_t i = 0; i < 2 * n && best_gap < n; ++i) {
+    gap = need[i % n] ? 0 : gap + 1;
+    if (gap > best_gap) {
+      best_gap = gap;
+      best_end = i + 1;
+    }
+  }
+  start = best_gap == n ? 0 : best_end % n;
+  count = n - best_gap;
+}
+
+/* Read the part of the epsilon-input-file grid of md that is needed to
+   interpolate epsilon in the chunks of s owned by this process (plus a
+   margin of two pixels), or the whole grid if s is NULL.  Each process
+   reads only its own hyperslabs, so the full grid is never replicated.
+   Nothing is read if the block already in memory suffices. */
+static void read_epsilon_file(material_data *md, const meep::structure *s) {
+  char *fname = new char[strlen(md->epsilon_file) + 1];
+  strcpy(fname, md->epsilon_file);
+  // parse epsilon-input-file as "fname.h5:dataname"
+  char *dataname = strrchr(fname, ':');
+  if (dataname) *(dataname++) = 0;
+
+  meep::h5file eps_file(fname, meep::h5file::READONLY, true);
+  eps_file.set_aggregators(0); // every process reads its own block
+  int rank; // rank < 3 is equivalent to singleton dims
+  size_t dims[3] = {1, 1, 1};
+  eps_file.read_size(dataname, &rank, dims, 3);
+  for (int i = rank; i < 3; ++i)
+    dims[i] = 1;
+
+  size_t start[3] = {0, 0, 0}, count[3] = {dims[0], dims[1], dims[2]};
+  bool have = md->epsilon_data != NULL;
+  for (int i = 0; i < 3; ++i)
+    have = have && md->epsilon_dims[i] == dims[i];
+  if (s) {
+    std::vector<bool> need[3];
+    for (int i = 0; i < 3; ++i)
+      need[i].assign(dims[i], false);
+    for (int ic = 0; ic < s->num_chunks; ++ic) {
+      if (!s->chunks[ic]->is_mine()) continue;
+      meep::volume v = s->chunks[ic]->gv.surroundings();
+      vector3 lo = file_coordinates(vec_to_vector3(v.get_min_corner()));
+      vector3 hi = file_coordinates(vec_to_vector3(v.get_max_corner()));
+      double lo_r[3] = {lo.x, lo.y, lo.z}, hi_r[3] = {hi.x, hi.y, hi.z};
+      double size[3] = {geometry_lattice.size.x, geometry_lattice.size.y,
+                        geometry_lattice.size.z};
+      for (int i = 0; i < 3; ++i) {
+        double margin = size[i] == 0 ? 0 : 2 * s->gv.inva / size[i];
+        mark_file_indices(lo_r[i] - margin, hi_r[i] + margin, need[i]);
+      }
+    }
+    for (int i = 0; i < 3; ++i) {
+      needed_file_range(need[i], start[i], count[i]);
+      for (size_t x = 0; have && x < dims[i]; ++x)
+        have = !need[i][x] || (x + dims[i] - md->epsilon_start[i]) % dims[i] < md->epsilon_count[i];
+    }
+  }
+  else
+    have = have && file_block_is_full(md);
+
+  if (!have) {
+    delete[] md->epsilon_data;
+    size_t N = count[0] * count[1] * count[2];
+    md->epsilon_data = N ? new meep::realnum[N] : NULL;
+    // a periodic range wraps around at most once, so the block is read
+    // as up to 2 contiguous hyperslabs per direction
+    for (int piece = 0; N && piece < 8; ++piece) {
+      size_t pstart[3], pcount[3], poffset[3], pN = 1;
+      for (int i = 0; i < 3; ++i) {
+        size_t first = std::min(count[i], dims[i] - start[i]);
+        bool second = (piece >> i) & 1;
+        pstart[i] = second ? 0 : start[i];
+        pcount[i] = second ? count[i] - first : first;
+        poffset[i] = second ? first : 0;
+        pN *= pcount[i];
+      }
+      if (!pN) continue;
+      meep::realnum *buf = new meep::realnum[pN];
+      eps_file.read_chunk(rank, pstart, pcount, buf);
+      for (size_t i = 0; i < pcount[0]; ++i)
+        for (size_t j = 0; j < pcount[1]; ++j)
+          memcpy(md->epsilon_data +
+                     ((i + poffset[0]) * count[1] + j + poffset[1]) * count[2] + poffset[2],
+                 buf + (i * pcount[1] + j) * pcount[2], pcount[2] * sizeof(meep::realnum));
+      delete[] buf;
+    }
+    for (int i = 0; i < 3; ++i) {
+      md->epsilon_dims[i] = dims[i];
+      md->epsilon_start[i] = start[i];
+      md->epsilon_count[i] = count[i];
+    }
+    if (meep::verbosity > 0)
+      master_printf("read in %zdx%zdx%zd epsilon-input-file \"%s\"\n", dims[0], dims[1], dims[2],
+                    md->epsilon_file);
+  }
+  delete[] fname;
+}
+
+static void add_file_materials(material_type m, std::vector<material_data *> &files) {
+  if (m && m->which_subclass == material_data::MATERIAL_FILE && m->epsilon_file &&
+      std::find(files.begin(), files.end(), m) == files.end())
+    files.push_back(m);
+}
+
+static void add_file_materials(geometric_object_list g, std::vector<material_data *> &files) {
+  for (int i = 0; i < g.num_items; ++i) {
+    add_file_materials((material_type)g.items[i].material, files);
+    if (g.items[i].which_subclass == geometric_object::COMPOUND_GEOMETRIC_OBJECT)
+      add_file_materials(g.items[i].subclass.compound_geometric_object_data->component_objects,
+                         files);
+  }
+}
+
+void read_epsilon_files(geometric_object_list g, material_type_list extra_materials,
+                        material_type _default_material, const meep::structure *s) {
+  std::vector<material_data *> files;
+  add_file_materials(_default_material, files);
+  add_file_materials(g, files);
+  for (int i = 0; i < extra_materials.num_items; ++i)
+    add_file_materials(extra_materials.items[i], files);
+  for (size_t i = 0; i < files.size(); ++i)
+    read_epsilon_file(files[i], s);
+}
+
 /******************************************************************************/
 /* Helpers from  libctl/utils/geom.c                                          */
 /******************************************************************************/
@@ -1645,6 +2351,11 @@ std::vector<meep::volume> fragment_stats::pml_3d_vols;
 std::vector<meep::volume> fragment_stats::absorber_vols;
 bool fragment_stats::split_chunks_evenly = false;
 bool fragment_stats::eps_averaging = false;
+int fragment_stats::fragment_pixels = 16;
+// default weights, obtained via linear regression on a dataset of random simulations
+double fragment_stats::cost_weights[fragment_stats::NUM_COST_WEIGHTS] = {
+    1.15061674e-04, 1.26843801e-04, 1.67029547e-04, 2.24790864e-04, 4.61260934e-05,
+    1.47283950e-04, 9.92955372e-05, 1.36901107e-03, 6.63939607e-04, 3.46518274e-04};
 
 static geom_box make_box_from_cell(vector3 cell_size) {
   double edgex = cell_size.x / 2;
@@ -1756,6 +2467,14 @@ void fragment_stats::update_stats_from_material(material_type mat, size_t pixels
   }
 }
 
+void fragment_stats::add_material_counts(const fragment_stats &f) {
+  num_anisotropic_eps_pixels += f.num_anisotropic_eps_pixels;
+  num_anisotropic_mu_pixels += f.num_anisotropic_mu_pixels;
+  num_nonlinear_pixels += f.num_nonlinear_pixels;
+  num_susceptibility_pixels += f.num_susceptibility_pixels;
+  num_nonzero_conductivity_pixels += f.num_nonzero_conductivity_pixels;
+}
+
 void fragment_stats::compute_stats() {
 
   if (geom.num_items == 0) {
@@ -1763,42 +2482,151 @@ void fragment_stats::compute_stats() {
     update_stats_from_material((material_type)default_material, num_pixels_in_box);
   }
 
-  for (int i = 0; i < geom.num_items; ++i) {
-    geometric_object *go = &geom.items[i];
-    double overlap = box_overlap_with_object(box, *go, tol, maxeval);
-
-    bool anisotropic_pixels_already_added = false;
-    if (eps_averaging) {
-      // If the object doesn't overlap the entire box, that implies that
-      // an object interface intercepts the box, which means we treat
-      // the entire box as anisotropic. This method could give some false
-      // positives if there is another object with the same material behind
-      // the current object, but in practice it is probably reasonable to
-      // assume that there is a material interface somwhere in the box so
-      // we won't worry about fancier edge-detection methods for now.
-      if (overlap != 1.0) {
-        anisotropic_pixels_already_added = true;
-        num_anisotropic_eps_pixels += num_pixels_in_box;
-        if (mu_not_1(go->material)) {
-          num_anisotropic_mu_pixels += num_pixels_in_box;
+  // the objects are independent, so each thread counts some of them,
+  // unless we are already one of the threads of compute_fragment_grid
+#ifdef HAVE_OPENMP
+#pragma omp parallel if (!omp_in_parallel())
+#endif
+  {
+    fragment_stats part(box);
+#ifdef HAVE_OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+    for (int i = 0; i < geom.num_items; ++i) {
+      geometric_object *go = &geom.items[i];
+      double overlap = box_overlap_with_object(box, *go, tol, maxeval);
+
+      bool anisotropic_pixels_already_added = false;
+      if (eps_averaging) {
+        // If the object doesn't overlap the entire box, that implies that
+        // an object interface intercepts the box, which means we treat
+        // the entire box as anisotropic. This method could give some false
+        // positives if there is another object with the same material behind
+        // the current object, but in practice it is probably reasonable to
+        // assume that there is a material interface somwhere in the box so
+        // we won't worry about fancier edge-detection methods for now.
+        if (overlap != 1.0) {
+          anisotropic_pixels_already_added = true;
+          part.num_anisotropic_eps_pixels += num_pixels_in_box;
+          if (mu_not_1(go->material)) {
+            part.num_anisotropic_mu_pixels += num_pixels_in_box;
+          }
         }
       }
-    }
 
-    // Count contributions from material of object
-    size_t pixels = (size_t)ceil(overlap * num_pixels_in_box);
-    if (pixels > 0) {
-      material_type mat = (material_type)go->material;
-      update_stats_from_material(mat, pixels, anisotropic_pixels_already_added);
+      // Count contributions from material of object
+      size_t pixels = (size_t)ceil(overlap * num_pixels_in_box);
+      if (pixels > 0) {
+        material_type mat = (material_type)go->material;
+        part.update_stats_from_material(mat, pixels, anisotropic_pixels_already_added);
+      }
+
+      // Count contributions from default_material
+      size_t default_material_pixels = num_pixels_in_box - pixels;
+      if (default_material_pixels > 0) {
+        part.update_stats_from_material((material_type)default_material, default_material_pixels,
+                                        anisotropic_pixels_already_added);
+      }
     }
+#ifdef HAVE_OPENMP
+#pragma omp critical(fragment_stats_compute)
+#endif
+    add_material_counts(part);
+  }
+}
+
+/* The fragment grid: material counts (in the order of add_material_counts)
+   for each of the n[0] x n[1] x n[2] fragments of size h[] tiling box. */
+namespace {
+const int num_material_counts = 5;
+struct fragment_grid_data {
+  geom_box box;
+  int n[3];
+  double h[3];
+  std::vector<double> counts;
+};
+fragment_grid_data fragment_grid;
+} // namespace
+
+void fragment_stats::clear_fragment_grid() { fragment_grid.counts.clear(); }
+
+void fragment_stats::compute_fragment_grid(const meep::grid_volume &gv) {
+  fragment_grid_data &g = fragment_grid;
+  g.box = gv2box(gv.surroundings());
+  double lo[3] = {g.box.low.x, g.box.low.y, g.box.low.z};
+  double hi[3] = {g.box.high.x, g.box.high.y, g.box.high.z};
+  size_t nfrag = 1;
+  for (int k = 0; k < 3; ++k) {
+    g.n[k] = std::max(1, int(ceil((hi[k] - lo[k]) * gv.a / fragment_pixels - 1e-9)));
+    g.h[k] = (hi[k] - lo[k]) / g.n[k];
+    nfrag *= g.n[k];
+  }
 
-    // Count contributions from default_material
-    size_t default_material_pixels = num_pixels_in_box - pixels;
-    if (default_material_pixels > 0) {
-      update_stats_from_material((material_type)default_material, default_material_pixels,
-                                 anisotropic_pixels_already_added);
+  // fragments are dealt out round-robin to the processes, and the
+  // fragments of each process are divided among its threads
+  std::vector<double> mine(nfrag * num_material_counts, 0.0);
+  const int nprocs = meep::count_processors(), me = meep::my_rank();
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (long f = me; f < long(nfrag); f += nprocs) {
+    const int i[3] = {int(f / (g.n[1] * g.n[2])), int((f / g.n[2]) % g.n[1]), int(f % g.n[2])};
+    double flo[3], fhi[3];
+    for (int k = 0; k < 3; ++k) {
+      flo[k] = lo[k] + i[k] * g.h[k];
+      fhi[k] = i[k] + 1 == g.n[k] ? hi[k] : flo[k] + g.h[k];
+    }
+    geom_box fbox = {{flo[0], flo[1], flo[2]}, {fhi[0], fhi[1], fhi[2]}};
+    fragment_stats fs(fbox);
+    fs.compute_stats();
+    double *c = &mine[f * num_material_counts];
+    c[0] = fs.num_anisotropic_eps_pixels;
+    c[1] = fs.num_anisotropic_mu_pixels;
+    c[2] = fs.num_nonlinear_pixels;
+    c[3] = fs.num_susceptibility_pixels;
+    c[4] = fs.num_nonzero_conductivity_pixels;
+  }
+  g.counts.resize(mine.size());
+  meep::sum_to_all(&mine[0], &g.counts[0], mine.size());
+}
+
+// interpolate the material counts of box from the fragment grid, assuming
+// that the counts are uniform within each fragment
+void fragment_stats::compute_stats_from_grid() {
+  const fragment_grid_data &g = fragment_grid;
+  double lo[3] = {g.box.low.x, g.box.low.y, g.box.low.z};
+  double blo[3] = {box.low.x, box.low.y, box.low.z}, bhi[3] = {box.high.x, box.high.y, box.high.z};
+  int i0[3], i1[3];
+  for (int k = 0; k < 3; ++k) {
+    if (g.h[k] > 0) {
+      i0[k] = std::max(0, int(floor((blo[k] - lo[k]) / g.h[k])));
+      i1[k] = std::min(g.n[k] - 1, int(floor((bhi[k] - lo[k]) / g.h[k])));
     }
+    else
+      i0[k] = i1[k] = 0;
   }
+  double sum[num_material_counts] = {0, 0, 0, 0, 0};
+  for (int ix = i0[0]; ix <= i1[0]; ++ix)
+    for (int iy = i0[1]; iy <= i1[1]; ++iy)
+      for (int iz = i0[2]; iz <= i1[2]; ++iz) {
+        const int i[3] = {ix, iy, iz};
+        double fraction = 1;
+        for (int k = 0; k < 3; ++k)
+          if (g.h[k] > 0) {
+            double flo = lo[k] + i[k] * g.h[k];
+            double len = std::min(bhi[k], flo + g.h[k]) - std::max(blo[k], flo);
+            fraction *= std::max(0.0, len) / g.h[k];
+          }
+        const double *c =
+            &g.counts[((size_t(ix) * g.n[1] + iy) * g.n[2] + iz) * num_material_counts];
+        for (int j = 0; j < num_material_counts; ++j)
+          sum[j] += fraction * c[j];
+      }
+  num_anisotropic_eps_pixels += size_t(sum[0] + 0.5);
+  num_anisotropic_mu_pixels += size_t(sum[1] + 0.5);
+  num_nonlinear_pixels += size_t(sum[2] + 0.5);
+  num_susceptibility_pixels += size_t(sum[3] + 0.5);
+  num_nonzero_conductivity_pixels += size_t(sum[4] + 0.5);
 }
 
 void fragment_stats::count_anisotropic_pixels(medium_struct *med, size_t pixels) {
@@ -1907,21 +2735,215 @@ void fragment_stats::compute_absorber_stats() {
 }
 
 void fragment_stats::compute() {
-  compute_stats();
+  if (fragment_grid.counts.empty())
+    compute_stats();
+  else
+    compute_stats_from_grid();
   compute_dft_stats();
   compute_pml_stats();
   compute_absorber_stats();
 }
 
-// Return the estimated time in seconds this fragment will take to run
-// based on a cost function obtained via linear regression on a dataset
-// of random simulations.
+// Return the estimated time this fragment will take to run, based on
+// a cost function linear in the pixel counts with weights cost_weights.
 double fragment_stats::cost() const {
-  return (num_anisotropic_eps_pixels * 1.15061674e-04 + num_anisotropic_mu_pixels * 1.26843801e-04 +
-          num_nonlinear_pixels * 1.67029547e-04 + num_susceptibility_pixels * 2.24790864e-04 +
-          num_nonzero_conductivity_pixels * 4.61260934e-05 + num_dft_pixels * 1.47283950e-04 +
-          num_1d_pml_pixels * 9.92955372e-05 + num_2d_pml_pixels * 1.36901107e-03 +
-          num_3d_pml_pixels * 6.63939607e-04 + num_pixels_in_box * 3.46518274e-04);
+  const double *w = cost_weights;
+  return (num_anisotropic_eps_pixels * w[ANISOTROPIC_EPS_COST] +
+          num_anisotropic_mu_pixels * w[ANISOTROPIC_MU_COST] +
+          num_nonlinear_pixels * w[NONLINEAR_COST] +
+          num_susceptibility_pixels * w[SUSCEPTIBILITY_COST] +
+          num_nonzero_conductivity_pixels * w[CONDUCTIVITY_COST] + num_dft_pixels * w[DFT_COST] +
+          num_1d_pml_pixels * w[PML_1D_COST] + num_2d_pml_pixels * w[PML_2D_COST] +
+          num_3d_pml_pixels * w[PML_3D_COST] + num_pixels_in_box * w[PIXEL_COST]);
+}
+
+/* Calibration of cost_weights: we time a few steps of a small 3d cell
+   filled with one kind of pixel at a time, and take the weight of each
+   kind to be its time per pixel per step beyond that of the plain
+   (isotropic, linear, non-PML) cell.  The weights are then in seconds per
+   time step, for the machine and number of processes we are running on. */
+
+namespace {
+enum calib_kind {
+  CALIB_PLAIN,
+  CALIB_ANISOTROPIC_EPS,
+  CALIB_ANISOTROPIC_MU,
+  CALIB_NONLINEAR,
+  CALIB_CONDUCTIVITY
+};
+
+class calib_material : public meep::material_function {
+public:
+  calib_kind kind;
+  calib_material(calib_kind k) : kind(k) {}
+  virtual double chi1p1(meep::field_type ft, const meep::vec &r) {
+    (void)r;
+    return ft == meep::E_stuff ? 2.0 : 1.0;
+  }
+  virtual bool has_mu() { return kind == CALIB_ANISOTROPIC_MU; }
+  // diagonal 1/2 and off-diagonal 1/10 (3 off-diagonal elements) for the anisotropic kinds
+  virtual void eff_chi1inv_row(meep::component c, double chi1inv_row[3], const meep::volume &v,
+                               double tol, int maxeval) {
+    (void)v;
+    (void)tol;
+    (void)maxeval;
+    const bool aniso = meep::type(c) == meep::E_stuff ? kind == CALIB_ANISOTROPIC_EPS
+                                                      : kind == CALIB_ANISOTROPIC_MU;
+    const double diag = meep::type(c) == meep::E_stuff ? 0.5 : (aniso ? 0.5 : 1.0);
+    for (int i = 0; i < 3; ++i)
+      chi1inv_row[i] = i == meep::component_index(c) ? diag : (aniso ? 0.1 : 0.0);
+  }
+  virtual bool has_conductivity(meep::component c) {
+    return kind == CALIB_CONDUCTIVITY && meep::type(c) == meep::D_stuff;
+  }
+  virtual double conductivity(meep::component c, const meep::vec &r) {
+    (void)c;
+    (void)r;
+    return 0.1;
+  }
+  virtual bool has_chi3(meep::component c) {
+    return kind == CALIB_NONLINEAR && meep::type(c) == meep::E_stuff;
+  }
+  virtual double chi3(meep::component c, const meep::vec &r) {
+    (void)c;
+    (void)r;
+    return 1e-3;
+  }
+  virtual void sigma_row(meep::component c, double sigrow[3], const meep::vec &r) {
+    (void)r;
+    for (int i = 0; i < 3; ++i)
+      sigrow[i] = i == meep::component_index(c) ? 1.0 : 0.0;
+  }
+};
+
+// time per step of a calibration simulation (the maximum over processes)
+double time_calib_steps(meep::structure &s, int steps, int num_dft_freqs) {
+  meep::fields f(&s);
+  const meep::volume v = s.user_volume.surroundings();
+  f.add_point_source(meep::Ez, meep::continuous_src_time(1.0), v.center());
+  if (num_dft_freqs > 0) f.add_dft(meep::Ex, v, 0.5, 1.5, num_dft_freqs);
+  for (int i = 0; i < 5; ++i) // warm up (and allocate any lazily allocated fields)
+    f.step();
+  const double t0 = meep::wall_time();
+  for (int i = 0; i < steps; ++i)
+    f.step();
+  return meep::max_to_all(meep::wall_time() - t0) / steps;
+}
+} // namespace
+
+void fragment_stats::calibrate_cost_weights(double resolution, int steps) {
+  using namespace meep;
+  const int saved_verbosity = verbosity;
+  const bool saved_split_chunks_evenly = split_chunks_evenly;
+  verbosity = 0;
+  split_chunks_evenly = true; // the cost model is not calibrated yet
+
+  const grid_volume gv = vol3d(1, 1, 1, resolution);
+  const double npixels = gv.nx() * gv.ny() * gv.nz();
+  const int num_dft_freqs = 10;
+  calib_material plain(CALIB_PLAIN), aniso_eps(CALIB_ANISOTROPIC_EPS),
+      aniso_mu(CALIB_ANISOTROPIC_MU), nonlinear(CALIB_NONLINEAR), conductive(CALIB_CONDUCTIVITY);
+  double t[NUM_COST_WEIGHTS];
+
+  {
+    structure s(gv, plain);
+    t[PIXEL_COST] = time_calib_steps(s, steps, 0);
+    t[DFT_COST] = time_calib_steps(s, steps, num_dft_freqs);
+  }
+  {
+    structure s(gv, aniso_eps);
+    t[ANISOTROPIC_EPS_COST] = time_calib_steps(s, steps, 0);
+  }
+  {
+    structure s(gv, aniso_mu);
+    t[ANISOTROPIC_MU_COST] = time_calib_steps(s, steps, 0);
+  }
+  {
+    structure s(gv, nonlinear);
+    t[NONLINEAR_COST] = time_calib_steps(s, steps, 0);
+  }
+  {
+    structure s(gv, plain);
+    s.add_susceptibility(plain, E_stuff, lorentzian_susceptibility(1.0, 0.1));
+    t[SUSCEPTIBILITY_COST] = time_calib_steps(s, steps, 0);
+  }
+  {
+    structure s(gv, conductive);
+    t[CONDUCTIVITY_COST] = time_calib_steps(s, steps, 0);
+  }
+  // PML filling the whole cell in 1, 2, and 3 directions
+  {
+    structure s(gv, plain, pml(0.5, X));
+    t[PML_1D_COST] = time_calib_steps(s, steps, 0);
+  }
+  {
+    structure s(gv, plain, pml(0.5, X) + pml(0.5, Y));
+    t[PML_2D_COST] = time_calib_steps(s, steps, 0);
+  }
+  {
+    structure s(gv, plain, pml(0.5));
+    t[PML_3D_COST] = time_calib_steps(s, steps, 0);
+  }
+
+  /* number of counted elements per pixel of each kind, as in the
+     count_*_pixels and compute_*_stats functions */
+  double counts[NUM_COST_WEIGHTS];
+  counts[ANISOTROPIC_EPS_COST] = counts[ANISOTROPIC_MU_COST] = 3; // off-diagonal elements
+  counts[NONLINEAR_COST] = 3;                                     // chi3 on Ex,Ey,Ez
+  counts[SUSCEPTIBILITY_COST] = 1;
+  counts[CONDUCTIVITY_COST] = 3;
+  counts[DFT_COST] = num_dft_freqs;
+  counts[PML_1D_COST] = counts[PML_2D_COST] = counts[PML_3D_COST] = 1;
+
+  cost_weights[PIXEL_COST] = t[PIXEL_COST] / npixels;
+  for (int i = 0; i < NUM_COST_WEIGHTS; ++i)
+    if (i != PIXEL_COST)
+      cost_weights[i] = std::max(0.0, t[i] - t[PIXEL_COST]) / (counts[i] * npixels);
+
+  verbosity = saved_verbosity;
+  split_chunks_evenly = saved_split_chunks_evenly;
+  if (verbosity > 0) {
+    master_printf("calibrated cost weights (s/step/pixel):");
+    for (int i = 0; i < NUM_COST_WEIGHTS; ++i)
+      master_printf(" %g", cost_weights[i]);
+    master_printf("\n");
+  }
+}
+
+bool fragment_stats::load_cost_weights(const char *filename) {
+  double w[NUM_COST_WEIGHTS];
+  bool ok = false;
+  if (meep::am_master()) {
+    FILE *f = fopen(filename, "r");
+    if (f) {
+      int i = 0;
+      while (i < NUM_COST_WEIGHTS && fscanf(f, "%lg", &w[i]) == 1)
+        ++i;
+      ok = i == NUM_COST_WEIGHTS;
+      fclose(f);
+    }
+  }
+  ok = meep::broadcast(0, ok);
+  if (ok) {
+    meep::broadcast(0, w, NUM_COST_WEIGHTS);
+    for (int i = 0; i < NUM_COST_WEIGHTS; ++i)
+      cost_weights[i] = w[i];
+  }
+  return ok;
+}
+
+bool fragment_stats::save_cost_weights(const char *filename) {
+  bool ok = true;
+  if (meep::am_master()) {
+    FILE *f = fopen(filename, "w");
+    ok = f != NULL;
+    if (f) {
+      for (int i = 0; i < NUM_COST_WEIGHTS; ++i)
+        fprintf(f, "%.10g\n", cost_weights[i]);
+      ok = fclose(f) == 0;
+    }
+  }
+  return meep::broadcast(0, ok);
 }
 
 void fragment_stats::print_stats() const {
@@ -75,6 +75,38 @@ struct fragment_stats {
   static bool split_chunks_evenly;
   static bool eps_averaging;
 
+  // weights of each kind of pixel in cost(), in the order of the counts below
+  enum cost_weight_index {
+    ANISOTROPIC_EPS_COST,
+    ANISOTROPIC_MU_COST,
+    NONLINEAR_COST,
+    SUSCEPTIBILITY_COST,
+    CONDUCTIVITY_COST,
+    DFT_COST,
+    PML_1D_COST,
+    PML_2D_COST,
+    PML_3D_COST,
+    PIXEL_COST,
+    NUM_COST_WEIGHTS
+  };
+  static double cost_weights[NUM_COST_WEIGHTS];
+
+  // fit cost_weights to the timings of small test simulations on this machine
+  static void calibrate_cost_weights(double resolution = 20, int steps = 50);
+  // read/write cost_weights from/to a text file (returns false on failure)
+  static bool load_cost_weights(const char *filename);
+  static bool save_cost_weights(const char *filename);
+
+  // Material pixel counts on a grid of fragments of fragment_pixels^3 pixels
+  // covering the cell.  compute_fragment_grid divides the fragments among the
+  // processes (and threads) and sums the results; while the grid is present,
+  // compute() interpolates the material counts of any box from it instead of
+  // recomputing the object overlaps, so that repeated get_cost calls during
+  // chunk splitting are cheap.  Collective.
+  static int fragment_pixels;
+  static void compute_fragment_grid(const meep::grid_volume &gv);
+  static void clear_fragment_grid();
+
   static bool has_non_medium_material();
   static void init_libctl(meep_geom::material_type default_mat, bool ensure_per,
                           meep::grid_volume *gv, vector3 cell_size, vector3 cell_center,
@@ -109,6 +141,8 @@ private:
   void update_stats_from_material(material_type mat, size_t pixels,
                                   bool anisotropic_pixels_already_added=false);
   void compute_stats();
+  void compute_stats_from_grid();
+  void add_material_counts(const fragment_stats &f);
   void count_anisotropic_pixels(medium_struct *med, size_t pixels);
   void count_nonlinear_pixels(medium_struct *med, size_t pixels);
   void count_susceptibility_pixels(medium_struct *med, size_t pixels);
@@ -170,9 +204,36 @@ void set_materials_from_geometry(meep::structure *s, geometric_object_list g,
                                  material_type _default_material = vacuum, absorber_list alist = 0,
                                  material_type_list extra_materials = material_type_list());
 
+// like set_materials_from_geometry, but only re-evaluates the materials
+// inside where (see structure::update_materials); susceptibilities are kept
+void update_materials_from_geometry(meep::structure *s, geometric_object_list g,
+                                    const meep::volume &where, vector3 center = make_vector3(),
+                                    bool use_anisotropic_averaging = true,
+                                    double tol = DEFAULT_SUBPIXEL_TOL,
+                                    int maxeval = DEFAULT_SUBPIXEL_MAXEVAL,
+                                    bool ensure_periodicity = false,
+                                    material_type _default_material = vacuum,
+                                    absorber_list alist = 0,
+                                    material_type_list extra_materials = material_type_list());
+
+// use an npoints^dims midpoint-rule stencil instead of adaptive cubature
+// for pixels without a single planar interface (0 restores the cubature)
+void set_fallback_stencil(int npoints);
+
+// reuse structure::dump files in dir (NULL to disable) for repeated
+// set_materials_from_geometry calls with identical inputs
+void set_structure_cache_dir(const char *dir);
+
 material_type make_dielectric(double epsilon);
 material_type make_user_material(user_material_func user_func, void *user_data, bool do_averaging);
+material_type make_user_batch_material(user_material_batch_func user_batch_func, void *user_data,
+                                       bool do_averaging);
 material_type make_file_material(const char *eps_input_file);
+// read the epsilon-input-file data of the file materials in g, extra_materials and
+// _default_material: only the part needed by this process's chunks of s, or all of
+// it if s is NULL.  Called automatically by set_materials_from_geometry.
+void read_epsilon_files(geometric_object_list g, material_type_list extra_materials,
+                        material_type _default_material, const meep::structure *s = NULL);
 
 vector3 vec_to_vector3(const meep::vec &pt);
 meep::vec vector3_to_vec(const vector3 v3);
@@ -203,6 +264,10 @@ meep::grid_volume set_geometry_from_GDSII(double resolution, const char *GDSIIFi
                                           double zsize = 0.0);
 geometric_object_list get_GDSII_prisms(material_type material, const char *GDSIIFile,
                                        int Layer = -1, double zmin = 0.0, double zmax = 0.0);
+geometric_object_list get_GDSII_prisms(material_type material, const char *GDSIIFile, int Layer,
+                                       double zmin, double zmax, const meep::volume &where);
+void rasterize_GDSII_layer(const char *GDSIIFile, int Layer, const meep::volume &where,
+                           double value, double *grid, int nx, int ny);
 geometric_object get_GDSII_prism(material_type material, const char *GDSIIFile, const char *Text,
                                  int Layer = -1, double zmin = 0.0, double zmax = 0.0);
 geometric_object get_GDSII_prism(material_type material, const char *GDSIIFile, int Layer,
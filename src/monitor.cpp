@@ -163,6 +163,91 @@ complex<double> fields_chunk::get_field(component c, const ivec &iloc) const {
     return 0.0;
 }
 
+field_probes::field_probes(const fields *f) : f(f), num_probes(0) {}
+
+size_t field_probes::add(component c, const vec &loc) {
+  if (is_derived(c) || c == Dielectric || c == Permeability || c == NO_COMPONENT)
+    abort("field_probes only supports field components");
+  ivec ilocs[8];
+  double w[8];
+  f->gv.interpolate(c, loc, ilocs, w);
+  complex<double> phase = 1.0;
+  if (f->gv.dim == D2 && loc.in_direction(Z) != 0) // special_kz handling
+    phase = std::polar(1.0, 2 * pi * f->beta * loc.in_direction(Z));
+  // same point location as fields::get_field(component, const ivec &)
+  for (int argh = 0; argh < 8 && w[argh]; argh++) {
+    ivec iloc = ilocs[argh];
+    complex<double> kphase = 1.0;
+    f->locate_point_in_user_volume(&iloc, &kphase);
+    bool found = false;
+    for (int sn = 0; sn < f->S.multiplicity() && !found; sn++)
+      for (int i = 0; i < f->num_chunks && !found; i++)
+        if (f->chunks[i]->gv.owns(f->S.transform(iloc, sn))) {
+          found = true;
+          if (!f->chunks[i]->is_mine()) continue;
+          term t;
+          t.probe = num_probes;
+          t.ichunk = i;
+          t.c = f->S.transform(c, sn);
+          t.idx = f->chunks[i]->gv.index(t.c, f->S.transform(iloc, sn));
+          t.w = w[argh] * f->S.phase_shift(c, sn) * kphase * phase;
+          terms.push_back(t);
+        }
+  }
+  return num_probes++;
+}
+
+void field_probes::get(complex<double> *values) const {
+  complex<double> *mine = new complex<double>[num_probes];
+  for (size_t i = 0; i < num_probes; ++i)
+    mine[i] = 0.0;
+  for (size_t n = 0; n < terms.size(); ++n) {
+    const term &t = terms[n];
+    // the component arrays may be allocated after add(), so look them up here
+    realnum *const *fc = f->chunks[t.ichunk]->f[t.c];
+    if (fc[0]) mine[t.probe] += t.w * (fc[1] ? getcm(fc, t.idx) : complex<double>(fc[0][t.idx]));
+  }
+  sum_to_all(mine, values, int(num_probes));
+  delete[] mine;
+}
+
+bool step_action::check(fields &f) {
+  if (f.t != last_t) {
+    last_t = f.t;
+    stopped = do_check(f);
+  }
+  return stopped;
+}
+
+fields_decay_check::fields_decay_check(component c, const vec &pt, double dt, double decay_by)
+    : c(c), pt(pt), dt(dt), decay_by(decay_by), max_abs(0), cur_max(0), t0(0) {}
+
+bool fields_decay_check::do_check(fields &f) {
+  double fabs = norm(f.get_field(c, pt));
+  cur_max = max(cur_max, fabs);
+  if (f.round_time() <= dt + t0) return false;
+  double old_cur = cur_max;
+  cur_max = 0;
+  t0 = f.round_time();
+  max_abs = max(max_abs, old_cur);
+  if (max_abs != 0 && verbosity > 0)
+    master_printf("field decay(t = %g): %g / %g = %g\n", f.time(), old_cur, max_abs,
+                  old_cur / max_abs);
+  return old_cur <= max_abs * decay_by;
+}
+
+probe_recorder::probe_recorder(const field_probes &probes, int every)
+    : probes(probes), every(every < 1 ? 1 : every) {}
+
+bool probe_recorder::do_check(fields &f) {
+  if (f.t % every == 0) {
+    times.push_back(f.time());
+    values.resize(values.size() + probes.size());
+    if (probes.size()) probes.get(&values[values.size() - probes.size()]);
+  }
+  return false;
+}
+
 double fields::get_chi1inv(component c, direction d, const ivec &origloc, double omega,
                            bool parallel) const {
   ivec iloc = origloc;
@@ -18,6 +18,9 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
 #include "meep.hpp"
 #include "config.h"
 
@@ -34,8 +37,135 @@ typedef complex<double> cdouble;
 
 namespace meep {
 
+/**************************************************************/
+/* cache of eigenmode solutions, see fields::mode_cache.  each */
+/* entry is a fixed-length array of doubles (the key and the   */
+/* scalar results, laid out as below) plus the MPB eigenvectors */
+/* H (empty if no mode was found).                             */
+/**************************************************************/
+enum {
+  EMC_HASH = 0,      // hash of the MPB dielectric (two 32-bit halves)
+  EMC_N = 2,         // MPB grid size
+  EMC_S = 5,         // size of the eigenmode volume
+  EMC_BAND = 8,      // band_num, parity, d, match_frequency, eigensolver_tol
+  EMC_KDIR = 13,     // direction of k, in which the frequency is matched
+  EMC_KGUESS = 16,   // initial k (reciprocal basis)
+  EMC_OMEGA = 19,    // requested frequency
+  EMC_K = 20,        // solution k (reciprocal basis)
+  EMC_KMATCH = 23,   // solution k along kdir
+  EMC_EIGVAL = 24,   // solution omega^2, or -1 if no mode was found
+  EMC_VGRP = 25,     // solution group velocity
+  EMC_META = 26
+};
+
+struct eigenmode_cache_entry {
+  double meta[EMC_META];
+  std::vector<double> H;
+};
+
+struct eigenmode_cache {
+  std::deque<eigenmode_cache_entry> entries; // oldest first
+
+  // the entry for exactly this solve, or else (if warm is non-NULL) the entry
+  // for the same mode at the nearest frequency
+  const eigenmode_cache_entry *lookup(const double *key,
+                                      const eigenmode_cache_entry **warm) const {
+    double dmin = infinity;
+    if (warm) *warm = NULL;
+    for (size_t i = 0; i < entries.size(); ++i) {
+      const double *m = entries[i].meta;
+      if (memcmp(m, key, EMC_KGUESS * sizeof(double))) continue;
+      if (!memcmp(m + EMC_KGUESS, key + EMC_KGUESS, (EMC_OMEGA + 1 - EMC_KGUESS) * sizeof(double)))
+        return &entries[i];
+      const double dist = fabs(m[EMC_OMEGA] - key[EMC_OMEGA]);
+      if (warm && !entries[i].H.empty() && dist < dmin) {
+        dmin = dist;
+        *warm = &entries[i];
+      }
+    }
+    return NULL;
+  }
+
+  void insert(const eigenmode_cache_entry &e, int max_entries) {
+    entries.push_back(e);
+    while (entries.size() > size_t(max_entries))
+      entries.pop_front();
+  }
+};
+
+void fields::clear_eigenmode_cache() {
+  delete mode_cache;
+  mode_cache = NULL;
+}
+
+void fields::save_eigenmode_cache(const char *filename) {
+  h5file file(filename, h5file::WRITE, true);
+  size_t n = mode_cache ? mode_cache->entries.size() : 0;
+  size_t dims[2] = {n, EMC_META};
+  double *meta = new double[n * EMC_META + 1];
+  for (size_t i = 0; i < n; ++i)
+    memcpy(meta + i * EMC_META, mode_cache->entries[i].meta, EMC_META * sizeof(double));
+  file.write("meta", 2, dims, meta, false);
+  delete[] meta;
+  for (size_t i = 0; i < n; ++i) {
+    std::vector<double> &H = mode_cache->entries[i].H;
+    if (H.empty()) continue;
+    char dataname[32];
+    snprintf(dataname, 32, "H%zd", i);
+    size_t len = H.size();
+    file.write(dataname, 1, &len, &H[0], false);
+  }
+}
+
+void fields::load_eigenmode_cache(const char *filename) {
+  h5file file(filename, h5file::READONLY, true);
+  int rank;
+  size_t dims[2] = {0, 0}, start[2] = {0, 0};
+  file.read_size("meta", &rank, dims, 2);
+  if (rank != 2 || dims[1] != EMC_META) abort("invalid eigenmode cache file %s", filename);
+  if (!mode_cache) mode_cache = new eigenmode_cache;
+  double *meta = new double[dims[0] * EMC_META + 1];
+  if (dims[0] > 0) file.read_chunk(2, start, dims, meta);
+  for (size_t i = 0; i < dims[0]; ++i) {
+    eigenmode_cache_entry e;
+    memcpy(e.meta, meta + i * EMC_META, EMC_META * sizeof(double));
+    if (e.meta[EMC_EIGVAL] >= 0) {
+      char dataname[32];
+      snprintf(dataname, 32, "H%zd", i);
+      int hrank;
+      size_t len = 0, zero = 0;
+      file.read_size(dataname, &hrank, &len, 1);
+      if (hrank != 1) abort("invalid eigenmode cache file %s", filename);
+      e.H.resize(len);
+      if (len > 0) file.read_chunk(1, &zero, &len, &e.H[0]);
+    }
+    if (!mode_cache->lookup(e.meta, NULL)) mode_cache->insert(e, eigenmode_cache_max);
+  }
+  delete[] meta;
+}
+
 #ifdef HAVE_MPB
 
+// 64-bit FNV-1a hash
+static uint64_t hash_bytes(const void *data, size_t n) {
+  const unsigned char *p = (const unsigned char *)data;
+  uint64_t h = 14695981039346656037ULL;
+  for (size_t i = 0; i < n; ++i)
+    h = (h ^ p[i]) * 1099511628211ULL;
+  return h;
+}
+
+/* set by get_eigenmode_coefficients while each process solves its own share
+   of the frequencies: get_eigenmode then runs MPB on the calling process only,
+   adds the solution to the mode cache (pointed to by entry) and returns NULL
+   without communicating.  epsmu = eps*mu at the center of eig_vol, computed
+   collectively beforehand, replaces get_eps/get_mu in the initial k guess. */
+static struct {
+  bool active;
+  double epsmu;
+  const eigenmode_cache_entry *entry;
+} presolve = {false, 0, NULL};
+
 typedef struct {
   const double *s, *o;
   double omega;
@@ -219,8 +349,94 @@ complex<double> eigenmode_amplitude(void *vedata, const vec &p, component c) {
 /***************************************************************/
 static eigenmode_data *global_eigenmode_data = 0;
 static component global_eigenmode_component;
-static complex<double> meep_mpb_A(const vec &p) {
-  return eigenmode_amplitude((void *)global_eigenmode_data, p, global_eigenmode_component);
+
+/* the interpolation along one MPB lattice direction in eigenmode_amplitude:
+   grid points x and x2 with weight w for x2, for coordinate pd (relative to
+   the center); pd is ignored (r = 0) if the direction is not in the grid */
+static void eigenmode_interp_1d(double pd, bool used, double s, int n, int *x, int *x2, double *w) {
+  double r = used ? pd / s + 0.5 : 0;
+  int i = int(r * n);
+  double di = r * n - i;
+  i = pmod(i, n);
+  *x = i;
+  *x2 = pmod((di >= 0.0 ? i + 1 : i - 1), n);
+  *w = fabs(di);
+}
+
+/* eigenmode_amplitude at all points of a box (see amplitude_box_function):
+   the trilinear weights and the Bloch phase are separable, so they are
+   computed once per row of the box rather than once per point. */
+static void meep_mpb_A_box(void *vedata, const vec &p0, const vec dp[3], const size_t n[3],
+                           complex<double> *A) {
+  eigenmode_data *edata = (eigenmode_data *)vedata;
+  if (!edata || !(edata->mdata)) abort("%s:%i: internal error", __FILE__, __LINE__);
+  component c = global_eigenmode_component;
+  if (c != Ex && c != Ey && c != Ez && c != Hx && c != Hy && c != Hz)
+    abort("invalid component in eigenmode_amplitude");
+  const complex<mpb_real> *data =
+      (const complex<mpb_real> *)(is_magnetic(c) ? edata->fft_data_H : edata->fft_data_E) +
+      (component_direction(c) - X);
+  vec p0c(p0 - edata->center);
+
+  // for each MPB lattice direction a, the box index k along which it varies
+  // (or -1), and the interpolation points, weights and phases along it
+  int kof[3] = {-1, -1, -1};
+  bool used[3] = {false, false, false};
+  double pd0[3] = {0, 0, 0}, step[3] = {0, 0, 0};
+  LOOP_OVER_DIRECTIONS(p0.dim, d) {
+    int a = d % 3;
+    used[a] = true;
+    pd0[a] = p0c.in_direction(d);
+    for (int k = 0; k < 3; ++k)
+      if (n[k] > 1 && dp[k].in_direction(d) != 0) {
+        kof[a] = k;
+        step[a] = dp[k].in_direction(d);
+      }
+  }
+  std::vector<int> x[3], x2[3];
+  std::vector<double> w[3];
+  std::vector<complex<double> > ph[3];
+  for (int a = 0; a < 3; ++a) {
+    size_t m = kof[a] >= 0 ? n[kof[a]] : 1;
+    x[a].resize(m);
+    x2[a].resize(m);
+    w[a].resize(m);
+    ph[a].resize(m);
+    for (size_t i = 0; i < m; ++i) {
+      double pd = pd0[a] + i * step[a];
+      eigenmode_interp_1d(pd, used[a], edata->s[a], edata->n[a], &x[a][i], &x2[a][i], &w[a][i]);
+      ph[a][i] = used[a] ? std::polar(1.0, TWOPI * edata->Gk[a] * pd) : 1.0;
+    }
+  }
+
+  int ny = edata->n[1], nz = edata->n[2];
+  bool amp_func = edata->amp_func != default_amp_func;
+  size_t i[3];
+  for (i[0] = 0; i[0] < n[0]; ++i[0])
+    for (i[1] = 0; i[1] < n[1]; ++i[1])
+      for (i[2] = 0; i[2] < n[2]; ++i[2]) {
+        size_t j[3];
+        for (int a = 0; a < 3; ++a)
+          j[a] = kof[a] >= 0 ? i[kof[a]] : 0;
+        int X0 = x[0][j[0]], X2 = x2[0][j[0]], Y0 = x[1][j[1]], Y2 = x2[1][j[1]];
+        int Z0 = x[2][j[2]], Z2 = x2[2][j[2]];
+        double dx = w[0][j[0]], dy = w[1][j[1]], dz = w[2][j[2]];
+#define D(x, y, z) (data[(((x)*ny + (y)) * nz + (z)) * 3])
+        complex<mpb_real> ret =
+            (((D(X0, Y0, Z0) * (1.0 - dx) + D(X2, Y0, Z0) * dx) * (1.0 - dy) +
+              (D(X0, Y2, Z0) * (1.0 - dx) + D(X2, Y2, Z0) * dx) * dy) *
+                 (1.0 - dz) +
+             ((D(X0, Y0, Z2) * (1.0 - dx) + D(X2, Y0, Z2) * dx) * (1.0 - dy) +
+              (D(X0, Y2, Z2) * (1.0 - dx) + D(X2, Y2, Z2) * dx) * dy) *
+                 dz);
+#undef D
+        complex<double> v = complex<double>(double(real(ret)), double(imag(ret))) *
+                            (ph[0][j[0]] * ph[1][j[1]] * ph[2][j[2]]);
+        if (amp_func)
+          v *= edata->amp_func(p0 + dp[0] * double(i[0]) + dp[1] * double(i[1]) +
+                               dp[2] * double(i[2]));
+        *A++ = v;
+      }
 }
 
 // compute axb = a cross b
@@ -380,6 +596,23 @@ void *fields::get_eigenmode(double omega_src, direction d, const volume where, c
 
   if (check_maxwell_dielectric(mdata, 0)) abort("invalid dielectric function for MPB");
 
+  // the cache key identifies the mode by the dielectric MPB sees and the solver inputs
+  eigenmode_cache_entry entry;
+  double *key = entry.meta;
+  uint64_t eps_hash = hash_bytes(mdata->eps_inv, sizeof(symmetric_matrix) * mdata->fft_output_size);
+  key[EMC_HASH] = double(eps_hash >> 32);
+  key[EMC_HASH + 1] = double(eps_hash & 0xffffffff);
+  for (int i = 0; i < 3; ++i) {
+    key[EMC_N + i] = n[i];
+    key[EMC_S + i] = s[i];
+  }
+  key[EMC_BAND] = band_num;
+  key[EMC_BAND + 1] = parity;
+  key[EMC_BAND + 2] = d;
+  key[EMC_BAND + 3] = match_frequency;
+  key[EMC_BAND + 4] = eigensolver_tol;
+  key[EMC_OMEGA] = omega_src;
+
   double kmatch;
   if (d == NO_DIRECTION) {
     for (int i = 0; i < 3; ++i)
@@ -400,7 +633,8 @@ void *fields::get_eigenmode(double omega_src, direction d, const volume where, c
   // which we automatically pick if kmatch == 0.
   if (match_frequency && kmatch == 0) {
     vec cen = eig_vol.center();
-    kmatch = omega_src * sqrt(get_eps(cen, omega_src) * get_mu(cen, omega_src));
+    kmatch = omega_src * sqrt(presolve.active ? presolve.epsmu
+                                              : get_eps(cen, omega_src) * get_mu(cen, omega_src));
     if (d == NO_DIRECTION) {
       for (int i = 0; i < 3; ++i)
         k[i] = dot_product(R[i], kdir) * kmatch; // kdir*kmatch in reciprocal basis
@@ -415,6 +649,34 @@ void *fields::get_eigenmode(double omega_src, direction d, const volume where, c
     if (verbosity > 1) master_printf("NEW KPOINT: %g, %g, %g\n", k[0], k[1], k[2]);
   }
 
+  for (int i = 0; i < 3; ++i) {
+    key[EMC_KDIR + i] = kdir[i];
+    key[EMC_KGUESS + i] = k[i];
+  }
+  const eigenmode_cache_entry *hit = NULL, *warm = NULL;
+  if (mode_cache && eigenmode_cache_max > 0) hit = mode_cache->lookup(key, &warm);
+  if (hit) {
+    if (presolve.active) return NULL;
+    if (verbosity > 0)
+      master_printf("MPB solution for omega=%g found in eigenmode cache\n", omega_src);
+    if (hit->meta[EMC_EIGVAL] < 0) { // no mode was found last time either
+      if (!user_mdata) destroy_maxwell_data(mdata);
+      return NULL;
+    }
+  }
+  else if (warm && match_frequency && warm->meta[EMC_VGRP] != 0) {
+    // first-order guess for k from the cached mode at the nearest frequency
+    kmatch = warm->meta[EMC_KMATCH] + (omega_src - warm->meta[EMC_OMEGA]) / warm->meta[EMC_VGRP];
+    if (d == NO_DIRECTION) {
+      for (int i = 0; i < 3; ++i)
+        k[i] = dot_product(R[i], kdir) * kmatch; // kdir*kmatch in reciprocal basis
+      if (gv.dim == D2) k[2] = beta;
+    }
+    else
+      k[d - X] = kmatch * R[d - X][d - X];
+    if (verbosity > 1) master_printf("CACHED KPOINT: %g, %g, %g\n", k[0], k[1], k[2]);
+  }
+
   set_maxwell_data_parity(mdata, parity);
   update_maxwell_data_k(mdata, k, G[0], G[1], G[2]);
 
@@ -427,9 +689,15 @@ void *fields::get_eigenmode(double omega_src, direction d, const volume where, c
   }
 
   evectmatrix H = create_evectmatrix(n[0] * n[1] * n[2], 2, band_num, local_N, N_start, alloc_N);
-  /* initialize H to pseudorandom values on the master process; on other
-     processes we get the value via broadcast() below */
-  if (am_master())
+  /* initialize H to the cached eigenvectors if possible, or else to pseudorandom
+     values on the master process; on other processes we get the value via
+     broadcast() below */
+  const eigenmode_cache_entry *start = hit ? hit : warm;
+  if (start && start->H.size() == size_t(2 * H.n * H.p))
+    memcpy(H.data, &start->H[0], start->H.size() * sizeof(double));
+  else if (hit)
+    abort("inconsistent eigenmode cache entry");
+  else if (am_master() || presolve.active)
     for (int i = 0; i < H.n * H.p; ++i) {
       ASSIGN_SCALAR(H.data[i], rand() * 1.0 / RAND_MAX, rand() * 1.0 / RAND_MAX);
     }
@@ -446,6 +714,10 @@ void *fields::get_eigenmode(double omega_src, direction d, const volume where, c
     constraints = evect_add_constraint(constraints, maxwell_zero_k_constraint, (void *)mdata);
 
   mpb_real vgrp; // Re( W[0]* (dTheta/dk) W[0] ) = group velocity
+  if (hit) {
+    eigvals[band_num - 1] = hit->meta[EMC_EIGVAL];
+    vgrp = hit->meta[EMC_VGRP];
+  }
 
   // track #times change in kmatch increases to detect non-convergence
   double dkmatch_prev = kmatch;
@@ -455,7 +727,7 @@ void *fields::get_eigenmode(double omega_src, direction d, const volume where, c
   /*- part 2: newton iteration loop with call to MPB on each step */
   /*-         until eigenmode converged to requested tolerance    */
   /*--------------------------------------------------------------*/
-  if (am_master()) do {
+  if ((am_master() || presolve.active) && !hit) do {
       eigensolver(H, eigvals, maxwell_operator, (void *)mdata,
 #if MPB_VERSION_MAJOR > 1 || (MPB_VERSION_MAJOR == 1 && MPB_VERSION_MINOR >= 6)
                   NULL, NULL, /* eventually, we can support mu here */
@@ -508,6 +780,13 @@ void *fields::get_eigenmode(double omega_src, direction d, const volume where, c
     } while (match_frequency &&
              fabs(sqrt(eigvals[band_num - 1]) - omega_src) > omega_src * match_tol);
 
+  if (hit) {
+    for (int i = 0; i < 3; ++i)
+      k[i] = hit->meta[EMC_K + i];
+    kmatch = hit->meta[EMC_KMATCH];
+    update_maxwell_data_k(mdata, k, G[0], G[1], G[2]);
+  }
+
   double eigval = eigvals[band_num - 1];
 
   // cleanup temporary storage
@@ -518,16 +797,37 @@ void *fields::get_eigenmode(double omega_src, direction d, const volume where, c
 
   /* We only run MPB eigensolver on the master process to avoid
      any possibility of inconsistent mode solutions (#568) */
-  eigval = broadcast(0, eigval);
-  broadcast(0, k, 3);
-  vgrp = broadcast(0, vgrp);
+  if (!presolve.active) {
+    eigval = broadcast(0, eigval);
+    broadcast(0, k, 3);
+    vgrp = broadcast(0, vgrp);
+    kmatch = broadcast(0, kmatch);
+    if (eigval >= 0) broadcast(0, (double *)H.data, 2 * H.n * H.p);
+  }
+
+  if (!hit && (eigenmode_cache_max > 0 || presolve.active)) {
+    for (int i = 0; i < 3; ++i)
+      key[EMC_K + i] = k[i];
+    key[EMC_KMATCH] = kmatch;
+    key[EMC_EIGVAL] = eigval < 0 ? -1 : eigval;
+    key[EMC_VGRP] = vgrp;
+    if (eigval >= 0) entry.H.assign((double *)H.data, (double *)H.data + 2 * H.n * H.p);
+    if (!mode_cache) mode_cache = new eigenmode_cache;
+    mode_cache->insert(entry, eigenmode_cache_max);
+    if (presolve.active) presolve.entry = &mode_cache->entries.back();
+  }
+
+  if (presolve.active) {
+    destroy_evectmatrix(H);
+    return NULL;
+  }
+
   if (eigval < 0) { // no mode found
     destroy_evectmatrix(H);
     if (!user_mdata) destroy_maxwell_data(mdata);
     return NULL;
   }
   if (!am_master()) update_maxwell_data_k(mdata, k, G[0], G[1], G[2]);
-  broadcast(0, (double *)H.data, 2 * H.n * H.p);
 
   if (!match_frequency) omega_src = sqrt(eigval);
 
@@ -650,8 +950,8 @@ vec get_k(void *vedata) {
 /* add_volume_source only if certain conditions are met        */
 /***************************************************************/
 void add_volume_source_check(component c, const src_time &src, const volume &where,
-                             cdouble A(const vec &), cdouble amp, fields *f, component c0,
-                             direction d, int parity) {
+                             amplitude_box_function A, void *A_data, cdouble amp, fields *f,
+                             component c0, direction d, int parity) {
   if (!f->gv.has_field(c)) return;
   if (c0 != Centered && c0 != c) return;
   if (component_direction(c) == d) return;
@@ -660,7 +960,7 @@ void add_volume_source_check(component c, const src_time &src, const volume &whe
     if ((parity & EVEN_Z_PARITY) && is_tm(c)) return;
     if ((parity & ODD_Z_PARITY) && !is_tm(c)) return;
   };
-  f->add_volume_source(c, src, where, A, amp);
+  f->add_volume_source(c, src, where, A, A_data, amp);
 }
 
 /***************************************************************/
@@ -720,14 +1020,18 @@ void fields::add_eigenmode_source(component c0, const src_time &src, direction d
   int np2 = (n + 2) % 3;
   // Kx = -Hy, Ky = Hx   (for d==Z)
   global_eigenmode_component = cH[np1];
-  add_volume_source_check(cE[np2], *src_mpb, where, meep_mpb_A, +1.0 * amp, this, c0, d, parity);
+  add_volume_source_check(cE[np2], *src_mpb, where, meep_mpb_A_box, global_eigenmode_data,
+                          +1.0 * amp, this, c0, d, parity);
   global_eigenmode_component = cH[np2];
-  add_volume_source_check(cE[np1], *src_mpb, where, meep_mpb_A, -1.0 * amp, this, c0, d, parity);
+  add_volume_source_check(cE[np1], *src_mpb, where, meep_mpb_A_box, global_eigenmode_data,
+                          -1.0 * amp, this, c0, d, parity);
   // Nx = +Ey, Ny = -Ex  (for d==Z)
   global_eigenmode_component = cE[np1];
-  add_volume_source_check(cH[np2], *src_mpb, where, meep_mpb_A, -1.0 * amp, this, c0, d, parity);
+  add_volume_source_check(cH[np2], *src_mpb, where, meep_mpb_A_box, global_eigenmode_data,
+                          -1.0 * amp, this, c0, d, parity);
   global_eigenmode_component = cE[np2];
-  add_volume_source_check(cH[np1], *src_mpb, where, meep_mpb_A, +1.0 * amp, this, c0, d, parity);
+  add_volume_source_check(cH[np1], *src_mpb, where, meep_mpb_A_box, global_eigenmode_data,
+                          +1.0 * amp, this, c0, d, parity);
 
   delete src_mpb;
   destroy_eigenmode_data((void *)global_eigenmode_data);
@@ -772,6 +1076,28 @@ void fields::get_eigenmode_coefficients(dft_flux flux, const volume &eig_vol, in
   // get_eigenmode will create mdata only once and then reuse it on each iteration of the loop
   maxwell_data *mdata = NULL;
 
+  // each eigensolve starts from the cached mode of the same band at the nearest
+  // frequency already solved, so the solutions of this call are kept in the
+  // mode cache until it returns, whatever eigenmode_cache_max is
+  int cache_max = eigenmode_cache_max;
+  int num_cached = mode_cache ? int(mode_cache->entries.size()) : 0;
+  eigenmode_cache_max = std::max(cache_max, num_cached + num_bands * num_freqs);
+
+  // with several processes, the frequencies after the first of each band are
+  // split into contiguous blocks, each solved by one process, and the solutions
+  // are shared through the cache before the loop below needs them
+  int np = count_processors();
+  bool split = eigenmode_split_freqs && np > 1 && num_freqs > 2;
+  double *epsmu = NULL;
+  if (split) {
+    vec cen = eig_vol.center();
+    epsmu = new double[num_freqs];
+    for (int nf = 0; nf < num_freqs; nf++) {
+      double freq = freq_min + nf * dfreq;
+      epsmu[nf] = get_eps(cen, freq) * get_mu(cen, freq);
+    }
+  }
+
   // loop over all bands and all frequencies
   for (int nb = 0; nb < num_bands; nb++) {
     for (int nf = 0; nf < num_freqs; nf++) {
@@ -779,6 +1105,40 @@ void fields::get_eigenmode_coefficients(dft_flux flux, const volume &eig_vol, in
       /*- call mpb to compute the eigenmode --------------------------*/
       /*--------------------------------------------------------------*/
       int band_num = bands[nb];
+      if (split && nf == 1) { // mdata now exists and the cache has a starting guess
+        int num_rest = num_freqs - 1;
+        std::vector<const eigenmode_cache_entry *> solved(num_rest, NULL);
+        presolve.active = true;
+        for (int i = 0; i < num_rest; i++) {
+          if (i * np / num_rest != my_rank()) continue;
+          double freq = freq_min + (i + 1) * dfreq;
+          double kdom[3];
+          if (user_kpoint_func) kpoint = user_kpoint_func(freq, band_num, user_kpoint_data);
+          presolve.epsmu = epsmu[i + 1];
+          presolve.entry = NULL;
+          am_now_working_on(MPBTime);
+          get_eigenmode(freq, d, flux.where, eig_vol, band_num, kpoint, match_frequency, parity,
+                        eig_resolution, eigensolver_tol, kdom, (void **)&mdata);
+          finished_working();
+          solved[i] = presolve.entry;
+        }
+        presolve.active = false;
+        for (int i = 0; i < num_rest; i++) {
+          int owner = i * np / num_rest;
+          eigenmode_cache_entry e;
+          if (!broadcast(owner, solved[i] != NULL)) continue;
+          if (owner == my_rank()) e = *solved[i];
+          broadcast(owner, e.meta, EMC_META);
+          size_t len = e.H.size();
+          broadcast(owner, &len, 1);
+          e.H.resize(len);
+          if (len > 0) broadcast(owner, &e.H[0], int(len));
+          if (owner != my_rank()) {
+            if (!mode_cache) mode_cache = new eigenmode_cache;
+            mode_cache->insert(e, eigenmode_cache_max);
+          }
+        }
+      }
       double freq = freq_min + nf * dfreq;
       double kdom[3];
       if (user_kpoint_func) kpoint = user_kpoint_func(freq, band_num, user_kpoint_data);
@@ -803,9 +1163,11 @@ void fields::get_eigenmode_coefficients(dft_flux flux, const volume &eig_vol, in
       /*--------------------------------------------------------------*/
       /*--------------------------------------------------------------*/
       /*--------------------------------------------------------------*/
+      // the modes of all bands share the H-field buffer of mdata, so each mode
+      // is projected as soon as it is computed, with both of its overlaps
+      // taken in one pass over the flux region
       cdouble mode_flux[2], mode_mode[2];
-      get_mode_flux_overlap(mode_data, flux, nf, mode_flux);
-      get_mode_mode_overlap(mode_data, mode_data, flux, mode_mode);
+      get_mode_overlaps(&mode_data, 1, flux, nf, mode_flux, mode_mode);
       cdouble cplus = 0.5 * (mode_flux[0] + mode_flux[1]);
       cdouble cminus = 0.5 * (mode_flux[0] - mode_flux[1]);
       cdouble normfac = 0.5 * (mode_mode[0] + mode_mode[1]); // = vgrp * flux_volume(flux)
@@ -817,6 +1179,12 @@ void fields::get_eigenmode_coefficients(dft_flux flux, const volume &eig_vol, in
     }
   }
   destroy_maxwell_data(mdata);
+  delete[] epsmu;
+
+  eigenmode_cache_max = cache_max;
+  if (mode_cache)
+    while (mode_cache->entries.size() > size_t(std::max(cache_max, 0)))
+      mode_cache->entries.pop_front();
 }
 
 /**************************************************************/
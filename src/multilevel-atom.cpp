@@ -17,6 +17,7 @@
 
 /* this file implements multilevel atomic materials for Meep */
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include "meep.hpp"
@@ -120,6 +121,8 @@ typedef struct {
   size_t sz_data;
   size_t ntot;
   realnum *GammaInv;                    // inv(1 + Gamma * dt / 2)
+  realnum *NN;                          // GammaInv * (1 - Gamma * dt / 2), LxL
+  realnum *NP;                          // GammaInv * alpha, LxT
   realnumP *P[NUM_FIELD_COMPONENTS][2]; // P[c][cmp][transition][i]
   realnumP *P_prev[NUM_FIELD_COMPONENTS][2];
   realnum *N;    // ntot x L array of centered grid populations N[i*L + level]
@@ -133,8 +136,9 @@ void *multilevel_susceptibility::new_internal_data(realnum *W[NUM_FIELD_COMPONEN
   FOR_COMPONENTS(c) DOCMP2 {
     if (needs_P(c, cmp, W)) num += 2 * gv.ntot();
   }
-  size_t sz = sizeof(multilevel_data) + sizeof(realnum) * (L * L + L + gv.ntot() * L + num * T - 1);
-  multilevel_data *d = (multilevel_data *)malloc(sz);
+  size_t sz = sizeof(multilevel_data) +
+              sizeof(realnum) * (2 * L * L + L * T + L + gv.ntot() * L + num * T - 1);
+  multilevel_data *d = (multilevel_data *)array_malloc(sz);
   memset(d, 0, sz);
   d->sz_data = sz;
   return (void *)d;
@@ -148,7 +152,7 @@ void multilevel_susceptibility::init_internal_data(realnum *W[NUM_FIELD_COMPONEN
   d->sz_data = sz_data;
   size_t ntot = d->ntot = gv.ntot();
 
-  /* d->data points to a big block of data that holds GammaInv, P,
+  /* d->data points to a big block of data that holds GammaInv, NN, NP, P,
      P_prev, Ntmp, and N.  We also initialize a bunch of convenience
      pointer in d to point to the corresponding data in d->data, so
      that we don't have to remember in other functions how d->data is
@@ -160,7 +164,26 @@ void multilevel_susceptibility::init_internal_data(realnum *W[NUM_FIELD_COMPONEN
       d->GammaInv[i * L + j] = (i == j) + Gamma[i * L + j] * dt / 2;
   if (!invert(d->GammaInv, L)) abort("multilevel_susceptibility: I + Gamma*dt/2 matrix singular");
 
-  realnum *P = d->data + L * L;
+  /* The population update N = GammaInv * [(I - Gamma*dt/2) * N + alpha * (E * dP terms)]
+     is done with the matrix products precomputed here, outside the grid loop */
+  d->NN = d->GammaInv + L * L;
+  d->NP = d->NN + L * L;
+  for (int i = 0; i < L; ++i) {
+    for (int j = 0; j < L; ++j) {
+      double sum = 0;
+      for (int k = 0; k < L; ++k)
+        sum += d->GammaInv[i * L + k] * ((k == j) - Gamma[k * L + j] * dt / 2);
+      d->NN[i * L + j] = sum;
+    }
+    for (int t = 0; t < T; ++t) {
+      double sum = 0;
+      for (int k = 0; k < L; ++k)
+        sum += d->GammaInv[i * L + k] * alpha[k * T + t];
+      d->NP[i * T + t] = sum;
+    }
+  }
+
+  realnum *P = d->NP + L * T;
   realnum *P_prev = P + ntot;
   FOR_COMPONENTS(c) DOCMP2 {
     if (needs_P(c, cmp, W)) {
@@ -191,18 +214,20 @@ void multilevel_susceptibility::delete_internal_data(void *data) const {
       delete[] d->P[c][cmp];
       delete[] d->P_prev[c][cmp];
     }
-    free(data);
+    array_free(data);
   }
 }
 
 void *multilevel_susceptibility::copy_internal_data(void *data) const {
   multilevel_data *d = (multilevel_data *)data;
   if (!d) return 0;
-  multilevel_data *dnew = (multilevel_data *)malloc(d->sz_data);
+  multilevel_data *dnew = (multilevel_data *)array_malloc(d->sz_data);
   memcpy(dnew, d, d->sz_data);
   size_t ntot = d->ntot;
   dnew->GammaInv = dnew->data;
-  realnum *P = dnew->data + L * L;
+  dnew->NN = dnew->GammaInv + L * L;
+  dnew->NP = dnew->NN + L * L;
+  realnum *P = dnew->NP + L * T;
   realnum *P_prev = P + ntot;
   FOR_COMPONENTS(c) DOCMP2 {
     if (d->P[c][cmp]) {
@@ -221,6 +246,20 @@ void *multilevel_susceptibility::copy_internal_data(void *data) const {
   return (void *)dnew;
 }
 
+// the whole data block: P, P_prev and the populations N (and the constant matrices)
+size_t multilevel_susceptibility::num_internal_data(void *data) const {
+  multilevel_data *d = (multilevel_data *)data;
+  return d ? (d->sz_data - offsetof(multilevel_data, data)) / sizeof(realnum) : 0;
+}
+
+void multilevel_susceptibility::dump_internal_data(void *data, realnum *buf) const {
+  memcpy(buf, ((multilevel_data *)data)->data, num_internal_data(data) * sizeof(realnum));
+}
+
+void multilevel_susceptibility::load_internal_data(void *data, const realnum *buf) const {
+  memcpy(((multilevel_data *)data)->data, buf, num_internal_data(data) * sizeof(realnum));
+}
+
 int multilevel_susceptibility::num_cinternal_notowned_needed(component c,
                                                              void *P_internal_data) const {
   multilevel_data *d = (multilevel_data *)P_internal_data;
@@ -235,6 +274,105 @@ realnum *multilevel_susceptibility::cinternal_notowned_ptr(int inotowned, compon
   return d->P[c][cmp][inotowned] + n;
 }
 
+#define MAX_STACK_LEVELS 32 // levels for which update_P can use a per-point stack array
+
+/* The populations N are only needed at the centered points adjacent to the
+   points where sigma != 0 (where they enter the P update below), so we
+   only need to update them in the union of the sigma boxes of the
+   polarization components, padded by one pixel.  Returns false if there are
+   no such points. */
+bool multilevel_susceptibility::population_box(const grid_volume &gv, const void *P_internal_data,
+                                               ivec &is, ivec &ie) const {
+  const multilevel_data *d = (const multilevel_data *)P_internal_data;
+  bool found = false;
+  FOR_COMPONENTS(c) {
+    ivec lo, hi;
+    if (d->P[c][0] && sigma[c][component_direction(c)] && owned_sigma_box(c, gv, lo, hi)) {
+      is = found ? min(is, lo) : lo;
+      ie = found ? max(ie, hi) : hi;
+      found = true;
+    }
+  }
+  if (!found) return false;
+  const ivec owned = gv.little_owned_corner(Centered);
+  is = max(owned, is - one_ivec(gv.dim) * 2);
+  ie = min(gv.big_corner(), ie + one_ivec(gv.dim) * 2);
+  LOOP_OVER_DIRECTIONS(gv.dim, dd) { // start on the Centered grid
+    if ((is.in_direction(dd) - owned.in_direction(dd)) % 2)
+      is.set_direction(dd, is.in_direction(dd) - 1);
+  }
+  return true;
+}
+
+// update the L populations at centered point i, using the scratch array Nold of length L
+void multilevel_susceptibility::update_N(ptrdiff_t i, realnum *Nold, const void *P_internal_data,
+                                         realnum *W[NUM_FIELD_COMPONENTS][2],
+                                         realnum *W_prev[NUM_FIELD_COMPONENTS][2],
+                                         const component cdot[3], const ptrdiff_t o1[3],
+                                         const ptrdiff_t o2[3], double dt) const {
+  const multilevel_data *d = (const multilevel_data *)P_internal_data;
+  realnum *N = d->N + i * L; // N at current point, to update
+  int idot;
+
+  // N = GammaInv * (I - Gamma * dt/2) * N
+  for (int l = 0; l < L; ++l)
+    Nold[l] = N[l];
+  for (int l1 = 0; l1 < L; ++l1) {
+    double sum = 0;
+    for (int l2 = 0; l2 < L; ++l2)
+      sum += d->NN[l1 * L + l2] * Nold[l2];
+    N[l1] = sum;
+  }
+
+  // compute E*8 at point i
+  double E8[3][2] = {{0.0, 0.0}, {0.0, 0.0}, {0.0, 0.0}};
+  for (idot = 0; idot < 3 && cdot[idot] != Dielectric; ++idot) {
+    const realnum *w = W[cdot[idot]][0], *wp = W_prev[cdot[idot]][0];
+    E8[idot][0] = w[i] + w[i + o1[idot]] + w[i + o2[idot]] + w[i + o1[idot] + o2[idot]] + wp[i] +
+                  wp[i + o1[idot]] + wp[i + o2[idot]] + wp[i + o1[idot] + o2[idot]];
+    if (W[cdot[idot]][1]) {
+      w = W[cdot[idot]][1];
+      wp = W_prev[cdot[idot]][1];
+      E8[idot][1] = w[i] + w[i + o1[idot]] + w[i + o2[idot]] + w[i + o1[idot] + o2[idot]] + wp[i] +
+                    wp[i + o1[idot]] + wp[i + o2[idot]] + wp[i + o1[idot] + o2[idot]];
+    }
+    else
+      E8[idot][1] = 0;
+  }
+
+  // N = N + GammaInv * alpha * E * dP
+  for (int t = 0; t < T; ++t) {
+    // compute 32 * E * dP and 64 * E * P at point i
+    double EdP32 = 0;
+    double EPave64 = 0;
+    double gperpdt = gamma[t] * pi * dt;
+    for (idot = 0; idot < 3 && cdot[idot] != Dielectric; ++idot) {
+      const realnum *p = d->P[cdot[idot]][0][t], *pp = d->P_prev[cdot[idot]][0][t];
+      realnum dP = p[i] + p[i + o1[idot]] + p[i + o2[idot]] + p[i + o1[idot] + o2[idot]] -
+                   (pp[i] + pp[i + o1[idot]] + pp[i + o2[idot]] + pp[i + o1[idot] + o2[idot]]);
+      realnum Pave2 = p[i] + p[i + o1[idot]] + p[i + o2[idot]] + p[i + o1[idot] + o2[idot]] +
+                      (pp[i] + pp[i + o1[idot]] + pp[i + o2[idot]] + pp[i + o1[idot] + o2[idot]]);
+      EdP32 += dP * E8[idot][0];
+      EPave64 += Pave2 * E8[idot][0];
+      if (d->P[cdot[idot]][1]) {
+        p = d->P[cdot[idot]][1][t];
+        pp = d->P_prev[cdot[idot]][1][t];
+        dP = p[i] + p[i + o1[idot]] + p[i + o2[idot]] + p[i + o1[idot] + o2[idot]] -
+             (pp[i] + pp[i + o1[idot]] + pp[i + o2[idot]] + pp[i + o1[idot] + o2[idot]]);
+        Pave2 = p[i] + p[i + o1[idot]] + p[i + o2[idot]] + p[i + o1[idot] + o2[idot]] +
+                (pp[i] + pp[i + o1[idot]] + pp[i + o2[idot]] + pp[i + o1[idot] + o2[idot]]);
+        EdP32 += dP * E8[idot][1];
+        EPave64 += Pave2 * E8[idot][1];
+      }
+    }
+    EdP32 *= 0.03125;    /* divide by 32 */
+    EPave64 *= 0.015625; /* divide by 64 (extra factor of 1/2 is from P_current + P_previous) */
+    const double dN = EdP32 + gperpdt * EPave64;
+    for (int l = 0; l < L; ++l)
+      N[l] += d->NP[l * T + t] * dN;
+  }
+}
+
 void multilevel_susceptibility::update_P(realnum *W[NUM_FIELD_COMPONENTS][2],
                                          realnum *W_prev[NUM_FIELD_COMPONENTS][2], double dt,
                                          const grid_volume &gv, void *P_internal_data) const {
@@ -253,73 +391,17 @@ void multilevel_susceptibility::update_P(realnum *W[NUM_FIELD_COMPONENTS][2],
     }
   }
 
-  // update N from W and P
-  realnum *GammaInv = d->GammaInv;
-  realnum *Ntmp = d->Ntmp;
-  LOOP_OVER_VOL_OWNED(gv, Centered, i) {
-    realnum *N = d->N + i * L; // N at current point, to update
-
-    // Ntmp = (I - Gamma * dt/2) * N
-    for (int l1 = 0; l1 < L; ++l1) {
-      Ntmp[l1] = 0;
-      for (int l2 = 0; l2 < L; ++l2) {
-        Ntmp[l1] += ((l1 == l2) - Gamma[l1 * L + l2] * dt2) * N[l2];
-      }
-    }
-
-    // compute E*8 at point i
-    double E8[3][2] = {{0.0, 0.0}, {0.0, 0.0}, {0.0, 0.0}};
-    for (idot = 0; idot < 3 && cdot[idot] != Dielectric; ++idot) {
-      realnum *w = W[cdot[idot]][0], *wp = W_prev[cdot[idot]][0];
-      E8[idot][0] = w[i] + w[i + o1[idot]] + w[i + o2[idot]] + w[i + o1[idot] + o2[idot]] + wp[i] +
-                    wp[i + o1[idot]] + wp[i + o2[idot]] + wp[i + o1[idot] + o2[idot]];
-      if (W[cdot[idot]][1]) {
-        w = W[cdot[idot]][1];
-        wp = W_prev[cdot[idot]][1];
-        E8[idot][1] = w[i] + w[i + o1[idot]] + w[i + o2[idot]] + w[i + o1[idot] + o2[idot]] +
-                      wp[i] + wp[i + o1[idot]] + wp[i + o2[idot]] + wp[i + o1[idot] + o2[idot]];
+  // update N from W and P, only near the points where sigma != 0 (see population_box)
+  ivec is, ie;
+  if (population_box(gv, d, is, ie)) {
+    if (L <= MAX_STACK_LEVELS) {
+      PLOOP_OVER_IVECS(gv, is, ie, i) {
+        realnum Nold[MAX_STACK_LEVELS];
+        update_N(i, Nold, d, W, W_prev, cdot, o1, o2, dt);
       }
-      else
-        E8[idot][1] = 0;
-    }
-
-    // Ntmp = Ntmp + alpha * E * dP
-    for (int t = 0; t < T; ++t) {
-      // compute 32 * E * dP and 64 * E * P at point i
-      double EdP32 = 0;
-      double EPave64 = 0;
-      double gperpdt = gamma[t] * pi * dt;
-      for (idot = 0; idot < 3 && cdot[idot] != Dielectric; ++idot) {
-        realnum *p = d->P[cdot[idot]][0][t], *pp = d->P_prev[cdot[idot]][0][t];
-        realnum dP = p[i] + p[i + o1[idot]] + p[i + o2[idot]] + p[i + o1[idot] + o2[idot]] -
-                     (pp[i] + pp[i + o1[idot]] + pp[i + o2[idot]] + pp[i + o1[idot] + o2[idot]]);
-        realnum Pave2 = p[i] + p[i + o1[idot]] + p[i + o2[idot]] + p[i + o1[idot] + o2[idot]] +
-                        (pp[i] + pp[i + o1[idot]] + pp[i + o2[idot]] + pp[i + o1[idot] + o2[idot]]);
-        EdP32 += dP * E8[idot][0];
-        EPave64 += Pave2 * E8[idot][0];
-        if (d->P[cdot[idot]][1]) {
-          p = d->P[cdot[idot]][1][t];
-          pp = d->P_prev[cdot[idot]][1][t];
-          dP = p[i] + p[i + o1[idot]] + p[i + o2[idot]] + p[i + o1[idot] + o2[idot]] -
-               (pp[i] + pp[i + o1[idot]] + pp[i + o2[idot]] + pp[i + o1[idot] + o2[idot]]);
-          Pave2 = p[i] + p[i + o1[idot]] + p[i + o2[idot]] + p[i + o1[idot] + o2[idot]] +
-                  (pp[i] + pp[i + o1[idot]] + pp[i + o2[idot]] + pp[i + o1[idot] + o2[idot]]);
-          EdP32 += dP * E8[idot][1];
-          EPave64 += Pave2 * E8[idot][1];
-        }
-      }
-      EdP32 *= 0.03125;    /* divide by 32 */
-      EPave64 *= 0.015625; /* divide by 64 (extra factor of 1/2 is from P_current + P_previous) */
-      for (int l = 0; l < L; ++l)
-        Ntmp[l] += alpha[l * T + t] * EdP32 + alpha[l * T + t] * gperpdt * EPave64;
-    }
-
-    // N = GammaInv * Ntmp
-    for (int l1 = 0; l1 < L; ++l1) {
-      N[l1] = 0;
-      for (int l2 = 0; l2 < L; ++l2)
-        N[l1] += GammaInv[l1 * L + l2] * Ntmp[l2];
     }
+    else // too many levels for a stack array: use the d->Ntmp scratch array, serially
+      LOOP_OVER_IVECS(gv, is, ie, i) { update_N(i, d->Ntmp, d, W, W_prev, cdot, o1, o2, dt); }
   }
 
   // each P is updated as a damped harmonic oscillator
@@ -362,9 +444,10 @@ void multilevel_susceptibility::update_P(realnum *W[NUM_FIELD_COMPONENTS][2],
           const realnum *w2 = W[c2][cmp];
           const realnum *s2 = w2 ? sigma[c][d2] : NULL;
 
+          ivec lo, hi; // P stays zero where sigma = 0
           if (s1 || s2) { abort("nondiagonal saturable gain is not yet supported"); }
-          else { // isotropic
-            LOOP_OVER_VOL_OWNED(gv, c, i) {
+          else if (owned_sigma_box(c, gv, lo, hi)) { // isotropic
+            PLOOP_OVER_IVECS(gv, lo, hi, i) {
               realnum pcur = p[i];
               const realnum *Ni = N + i * L;
               // dNi is population inversion for this transition
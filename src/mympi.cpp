@@ -18,6 +18,8 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#include <algorithm>
+#include <map>
 
 #include "meep.hpp"
 #include "config.h"
@@ -153,6 +155,22 @@ void send(int from, int to, double *data, int size) {
 #endif
 }
 
+void send(int from, int to, char *data, int size) {
+#ifdef HAVE_MPI
+  if (from == to) return;
+  if (size == 0) return;
+  const int me = my_rank();
+  if (from == me) MPI_Send(data, size, MPI_CHAR, to, 1, mycomm);
+  MPI_Status stat;
+  if (to == me) MPI_Recv(data, size, MPI_CHAR, from, 1, mycomm, &stat);
+#else
+  UNUSED(from);
+  UNUSED(to);
+  UNUSED(data);
+  UNUSED(size);
+#endif
+}
+
 #if MEEP_SINGLE
 void broadcast(int from, realnum *data, int size) {
 #ifdef HAVE_MPI
@@ -274,6 +292,70 @@ int max_to_all(int in) {
   return out;
 }
 
+reduction_batch::reduction_batch() : requests(NULL), started(false) {}
+
+reduction_batch::~reduction_batch() {
+  if (started) finish();
+}
+
+int reduction_batch::add_sum(double x) {
+  if (started) abort("reduction_batch::add_sum after start");
+  sums_in.push_back(x);
+  return int(sums_in.size()) - 1;
+}
+
+int reduction_batch::add_sum(complex<double> x) {
+  int i = add_sum(real(x));
+  add_sum(imag(x));
+  return i;
+}
+
+int reduction_batch::add_max(double x) {
+  if (started) abort("reduction_batch::add_max after start");
+  maxs_in.push_back(x);
+  return int(maxs_in.size()) - 1;
+}
+
+void reduction_batch::start() {
+  if (started) abort("reduction_batch::start called twice");
+  started = true;
+  sums = sums_in;
+  maxs = maxs_in;
+#if defined(HAVE_MPI) && MPI_VERSION >= 3
+  MPI_Request *reqs = new MPI_Request[2];
+  int n = 0;
+  if (!sums.empty())
+    MPI_Iallreduce(&sums_in[0], &sums[0], int(sums.size()), MPI_DOUBLE, MPI_SUM, mycomm,
+                   &reqs[n++]);
+  if (!maxs.empty())
+    MPI_Iallreduce(&maxs_in[0], &maxs[0], int(maxs.size()), MPI_DOUBLE, MPI_MAX, mycomm,
+                   &reqs[n++]);
+  for (; n < 2; ++n)
+    reqs[n] = MPI_REQUEST_NULL;
+  requests = (void *)reqs;
+#elif defined(HAVE_MPI)
+  if (!sums.empty())
+    MPI_Allreduce(&sums_in[0], &sums[0], int(sums.size()), MPI_DOUBLE, MPI_SUM, mycomm);
+  if (!maxs.empty())
+    MPI_Allreduce(&maxs_in[0], &maxs[0], int(maxs.size()), MPI_DOUBLE, MPI_MAX, mycomm);
+#endif
+}
+
+void reduction_batch::finish() {
+  if (!started) start();
+#if defined(HAVE_MPI) && MPI_VERSION >= 3
+  MPI_Request *reqs = (MPI_Request *)requests;
+  if (reqs) {
+    MPI_Waitall(2, reqs, MPI_STATUSES_IGNORE);
+    delete[] reqs;
+  }
+#endif
+  requests = NULL;
+  sums_in.clear();
+  maxs_in.clear();
+  started = false;
+}
+
 ivec max_to_all(const ivec &pt) {
   int in[5], out[5];
   for (int i = 0; i < 5; ++i)
@@ -335,6 +417,14 @@ void sum_to_master(const double *in, double *out, int size) {
 #endif
 }
 
+void sum_to_all(const float *in, float *out, int size) {
+#ifdef HAVE_MPI
+  MPI_Allreduce((void *)in, out, size, MPI_FLOAT, MPI_SUM, mycomm);
+#else
+  memcpy(out, in, sizeof(float) * size);
+#endif
+}
+
 void sum_to_all(const float *in, double *out, int size) {
   double *in2 = new double[size];
   for (int i = 0; i < size; ++i)
@@ -359,6 +449,122 @@ void sum_to_master(const complex<double> *in, complex<double> *out, int size) {
   sum_to_master((const double *)in, (double *)out, 2 * size);
 }
 
+/* Gathers the n (index, data) pairs of every process on the master, where
+   each index refers to a block of width values (data[width*i .. width*i+width-1]),
+   and either adds the blocks to out (sum) or stores them there.
+
+   The points are gathered in rounds of about GATHER_ROUND points in
+   total, so that the master's receive buffers (and the int counts of
+   MPI_Gatherv) stay bounded however large the output array is. */
+#define GATHER_ROUND (1 << 20)
+static void gather_blocks_to_master(const size_t *index, const double *data, size_t n, int width,
+                                    double *out, bool sum) {
+#ifdef HAVE_MPI
+  const int nprocs = count_processors();
+  const size_t per_proc = std::max(size_t(1), size_t(GATHER_ROUND / nprocs));
+  const size_t rounds = size_t(max_to_all(double((n + per_proc - 1) / per_proc)));
+  int *counts = NULL, *displs = NULL, *dcounts = NULL, *ddispls = NULL;
+  size_t *all_index = NULL;
+  double *all_data = NULL;
+  if (am_master()) {
+    counts = new int[nprocs];
+    displs = new int[nprocs];
+    dcounts = new int[nprocs];
+    ddispls = new int[nprocs];
+    all_index = new size_t[per_proc * nprocs];
+    all_data = new double[width * per_proc * nprocs];
+  }
+  MPI_Datatype size_type;
+  MPI_Type_contiguous(sizeof(size_t), MPI_BYTE, &size_type);
+  MPI_Type_commit(&size_type);
+  for (size_t round = 0, start = 0; round < rounds; ++round) {
+    size_t end = std::min(n, start + per_proc);
+    int count = int(end - start);
+    MPI_Gather(&count, 1, MPI_INT, counts, 1, MPI_INT, 0, mycomm);
+    int ntot = 0;
+    if (am_master())
+      for (int i = 0; i < nprocs; ++i) {
+        displs[i] = ntot;
+        dcounts[i] = width * counts[i];
+        ddispls[i] = width * displs[i];
+        ntot += counts[i];
+      }
+    MPI_Gatherv((void *)(index + start), count, size_type, all_index, counts, displs, size_type,
+                0, mycomm);
+    MPI_Gatherv((void *)(data + width * start), width * count, MPI_DOUBLE, all_data, dcounts,
+                ddispls, MPI_DOUBLE, 0, mycomm);
+    if (am_master())
+      for (int i = 0; i < ntot; ++i)
+        for (int k = 0; k < width; ++k)
+          if (sum)
+            out[width * all_index[i] + k] += all_data[width * i + k];
+          else
+            out[width * all_index[i] + k] = all_data[width * i + k];
+    start = end;
+  }
+  MPI_Type_free(&size_type);
+  if (am_master()) {
+    delete[] all_data;
+    delete[] all_index;
+    delete[] ddispls;
+    delete[] dcounts;
+    delete[] displs;
+    delete[] counts;
+  }
+#else
+  for (size_t i = 0; i < n; ++i)
+    for (int k = 0; k < width; ++k)
+      if (sum)
+        out[width * index[i] + k] += data[width * i + k];
+      else
+        out[width * index[i] + k] = data[width * i + k];
+#endif
+}
+
+/* Sets out[index[i]] = data[i] on the master for the n (index, data) pairs
+   of every process, so that values scattered over the processes can be
+   assembled without every process holding (and summing) the whole array.
+   out is only accessed on the master. */
+void gather_to_master(const size_t *index, const complex<double> *data, size_t n,
+                      complex<double> *out) {
+  gather_blocks_to_master(index, (const double *)data, n, 2, (double *)out, false);
+}
+
+/* Like gather_to_master, but each index refers to a block of width values
+   (data[width*i .. width*i+width-1]), and the blocks are added to out,
+   so that several processes may contribute to the same entry. */
+void gather_sum_to_master(const size_t *index, const double *data, size_t n, int width,
+                          double *out) {
+  gather_blocks_to_master(index, data, n, width, out, true);
+}
+
+/* Returns a newly allocated array, on every process, of the n values in
+   of all the processes concatenated in order of rank; ntot is set to its
+   length. */
+double *gather_to_all(const double *in, size_t n, size_t &ntot) {
+#ifdef HAVE_MPI
+  const int nprocs = count_processors();
+  int count = int(n);
+  int *counts = new int[nprocs], *displs = new int[nprocs];
+  MPI_Allgather(&count, 1, MPI_INT, counts, 1, MPI_INT, mycomm);
+  ntot = 0;
+  for (int i = 0; i < nprocs; ++i) {
+    displs[i] = int(ntot);
+    ntot += counts[i];
+  }
+  double *out = new double[ntot];
+  MPI_Allgatherv((void *)in, count, MPI_DOUBLE, out, counts, displs, MPI_DOUBLE, mycomm);
+  delete[] displs;
+  delete[] counts;
+  return out;
+#else
+  ntot = n;
+  double *out = new double[n];
+  memcpy(out, in, n * sizeof(double));
+  return out;
+#endif
+}
+
 long double sum_to_all(long double in) {
   long double out = in;
 #ifdef HAVE_MPI
@@ -515,6 +721,20 @@ int count_processors() {
 #endif
 }
 
+void process_nodes(int *node) {
+#ifdef HAVE_MPI
+  MPI_Comm nodecomm;
+  int rank, node_leader;
+  MPI_Comm_rank(mycomm, &rank);
+  MPI_Comm_split_type(mycomm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodecomm);
+  MPI_Allreduce(&rank, &node_leader, 1, MPI_INT, MPI_MIN, nodecomm);
+  MPI_Comm_free(&nodecomm);
+  MPI_Allgather(&node_leader, 1, MPI_INT, node, 1, MPI_INT, mycomm);
+#else
+  node[0] = 0;
+#endif
+}
+
 bool with_mpi() {
 #ifdef HAVE_MPI
   return true;
@@ -523,7 +743,86 @@ bool with_mpi() {
 #endif
 }
 
-void fields::boundary_communications(field_type ft) {
+/* Set up persistent send/receive requests for the comm_blocks of the
+   chunk pairs that actually exchange data, so that each
+   step_boundaries only has to start and wait for them.  This must be
+   redone whenever connect_the_chunks reallocates the comm_blocks.
+
+   Since step_boundaries may have several field types in flight at once,
+   note that the messages of each field type between a given pair of
+   processes are always started in the same order on both sides, so MPI's
+   non-overtaking rule matches them correctly even though the tags of
+   different field types overlap. */
+void fields::plan_boundary_communications() {
+  free_boundary_communications();
+  halo_stats.resize(NUM_FIELD_TYPES * count_processors() * NUM_HALO_STATS, 0.0);
+#ifdef HAVE_MPI
+  int *tagto = new int[count_processors()];
+  FOR_FIELD_TYPES(ft) {
+    int reqnum = 0;
+    for (int pair = 0; pair < num_chunks * num_chunks; pair++) {
+      const int j = pair % num_chunks, i = pair / num_chunks;
+      if (comm_size_tot(ft, pair) > 0 && chunks[i]->is_mine() != chunks[j]->is_mine()) reqnum++;
+    }
+    if (reqnum == 0) continue;
+    MPI_Request *reqs = new MPI_Request[reqnum];
+    reqnum = 0;
+    for (int i = 0; i < count_processors(); i++)
+      tagto[i] = 0;
+    for (int noti = 0; noti < num_chunks; noti++)
+      for (int j = 0; j < num_chunks; j++) {
+        const int i = (noti + j) % num_chunks;
+        const int pair = j + i * num_chunks;
+        const size_t comm_size = comm_size_tot(ft, pair);
+        if (comm_size > 0) {
+          if (comm_size > 2147483647) // MPI uses int for size to send/recv
+            abort("communications size too big for MPI");
+          const bool is_send = chunks[j]->is_mine() && !chunks[i]->is_mine();
+          const bool is_recv = chunks[i]->is_mine() && !chunks[j]->is_mine();
+          const int peer = is_send ? chunks[i]->n_proc() : chunks[j]->n_proc();
+          if (is_send)
+            MPI_Send_init(comm_blocks[ft][pair], (int)comm_size, MPI_REALNUM, peer, tagto[peer]++,
+                          mycomm, &reqs[reqnum++]);
+          if (is_recv)
+            MPI_Recv_init(comm_blocks[ft][pair], (int)comm_size, MPI_REALNUM, peer, tagto[peer]++,
+                          mycomm, &reqs[reqnum++]);
+          if (is_send || is_recv) {
+            comm_request_peer[ft].push_back(peer);
+            comm_request_bytes[ft].push_back(comm_size * sizeof(realnum));
+            comm_request_is_send[ft].push_back(is_send);
+          }
+        }
+      }
+    comm_requests[ft] = reqs;
+    num_comm_requests[ft] = reqnum;
+  }
+  delete[] tagto;
+#endif
+}
+
+void fields::free_boundary_communications() {
+  FOR_FIELD_TYPES(ft) {
+    if (comm_in_progress[ft]) abort("bug: chunks reconnected during boundary communications");
+#ifdef HAVE_MPI
+    MPI_Request *reqs = (MPI_Request *)comm_requests[ft];
+    int finalized = 0; // fields may outlive MPI, e.g. in Python
+    MPI_Finalized(&finalized);
+    if (!finalized)
+      for (int i = 0; i < num_comm_requests[ft]; i++)
+        MPI_Request_free(&reqs[i]);
+    delete[] reqs;
+#endif
+    comm_requests[ft] = NULL;
+    num_comm_requests[ft] = 0;
+    comm_request_peer[ft].clear();
+    comm_request_bytes[ft].clear();
+    comm_request_is_send[ft].clear();
+  }
+}
+
+/* Start the communications of the comm_blocks for field type ft, which
+   are waited for by finish_boundary_communications(ft). */
+void fields::start_boundary_communications(field_type ft) {
   // Communicate the data around!
 #if 0 // This is the blocking version, which should always be safe!
   for (int noti=0;noti<num_chunks;noti++)
@@ -536,38 +835,142 @@ void fields::boundary_communications(field_type ft) {
       }
     }
 #endif
+  if (comm_in_progress[ft]) abort("bug: boundary communications already in progress");
+  if (tracing) comm_start_time[ft] = wall_time();
 #ifdef HAVE_MPI
-  const int maxreq = num_chunks * num_chunks;
-  MPI_Request *reqs = new MPI_Request[maxreq];
-  MPI_Status *stats = new MPI_Status[maxreq];
-  int reqnum = 0;
-  int *tagto = new int[count_processors()];
-  for (int i = 0; i < count_processors(); i++)
-    tagto[i] = 0;
-  for (int noti = 0; noti < num_chunks; noti++)
-    for (int j = 0; j < num_chunks; j++) {
-      const int i = (noti + j) % num_chunks;
-      const int pair = j + i * num_chunks;
-      const size_t comm_size = comm_size_tot(ft, pair);
-      if (comm_size > 0) {
-        if (comm_size > 2147483647) // MPI uses int for size to send/recv
-          abort("communications size too big for MPI");
-        if (chunks[j]->is_mine() && !chunks[i]->is_mine())
-          MPI_Isend(comm_blocks[ft][pair], (int)comm_size, MPI_REALNUM, chunks[i]->n_proc(),
-                    tagto[chunks[i]->n_proc()]++, mycomm, &reqs[reqnum++]);
-        if (chunks[i]->is_mine() && !chunks[j]->is_mine())
-          MPI_Irecv(comm_blocks[ft][pair], (int)comm_size, MPI_REALNUM, chunks[j]->n_proc(),
-                    tagto[chunks[j]->n_proc()]++, mycomm, &reqs[reqnum++]);
+  if (num_comm_requests[ft] > 0)
+    MPI_Startall(num_comm_requests[ft], (MPI_Request *)comm_requests[ft]);
+#endif
+  comm_in_progress[ft] = true;
+}
+
+void fields::finish_boundary_communications(field_type ft) {
+  if (!comm_in_progress[ft]) abort("bug: finish_boundary_communications without start");
+  const double wait_start = wall_time();
+#ifdef HAVE_MPI
+  /* Equivalent to MPI_Waitall, except that the time spent waiting is
+     attributed to the peers: the time since the previous completion is
+     split evenly among the requests completed by each MPI_Waitsome. */
+  const int nreq = num_comm_requests[ft];
+  if (nreq > 0) {
+    int *done = new int[nreq];
+    int ndone = 0;
+    double last = wait_start;
+    for (int remaining = nreq; remaining > 0; remaining -= ndone) {
+      MPI_Waitsome(nreq, (MPI_Request *)comm_requests[ft], &ndone, done, MPI_STATUSES_IGNORE);
+      if (ndone == MPI_UNDEFINED) break; // all requests are inactive
+      const double now = wall_time();
+      for (int k = 0; k < ndone; k++) {
+        const int r = done[k];
+        double *st = &halo_stats[(ft * count_processors() + comm_request_peer[ft][r]) *
+                                 NUM_HALO_STATS];
+        st[comm_request_is_send[ft][r] ? HaloBytesSent : HaloBytesReceived] +=
+            comm_request_bytes[ft][r];
+        st[HaloMessages] += 1;
+        st[HaloWaitTime] += (now - last) / ndone;
       }
+      last = now;
     }
-  delete[] tagto;
-  if (reqnum > maxreq) abort("Too many requests!!!\n");
-  if (reqnum > 0) MPI_Waitall(reqnum, reqs, stats);
-  delete[] reqs;
-  delete[] stats;
-#else
-  (void)ft; // unused
+    delete[] done;
+  }
 #endif
+  comm_in_progress[ft] = false;
+
+  if (tracing) {
+    const double now = wall_time();
+    record_trace(trace_event::Wait, ft, wait_start, now);
+    std::map<int, size_t> peer_bytes; // one Exchange event per peer process
+    for (int pair = 0; pair < num_chunks * num_chunks; pair++) {
+      const int j = pair % num_chunks, i = pair / num_chunks;
+      if (chunks[i]->is_mine() != chunks[j]->is_mine())
+        peer_bytes[chunks[i]->is_mine() ? chunks[j]->n_proc() : chunks[i]->n_proc()] +=
+            comm_size_tot(ft, pair) * sizeof(realnum);
+    }
+    for (std::map<int, size_t>::const_iterator it = peer_bytes.begin(); it != peer_bytes.end();
+         ++it)
+      if (it->second > 0)
+        record_trace(trace_event::Exchange, ft, comm_start_time[ft], now, it->first, it->second);
+  }
+}
+
+void fields::reset_halo_stats() { std::fill(halo_stats.begin(), halo_stats.end(), 0.0); }
+
+void fields::print_halo_stats() {
+  const int np = count_processors();
+  // per process: bytes sent, bytes received, messages, wait time, and the peer waited for most
+  enum { SENT, RECEIVED, MESSAGES, WAIT, WORST_PEER, WORST_WAIT, NUM_COLUMNS };
+  std::vector<double> mine(np * NUM_COLUMNS, 0.0), all(np * NUM_COLUMNS, 0.0);
+  double *row = &mine[my_rank() * NUM_COLUMNS];
+  row[WORST_PEER] = -1;
+  for (int peer = 0; peer < np; peer++) {
+    double peer_wait = 0;
+    for (int ft = 0; ft < (int)halo_stats.size() / (np * NUM_HALO_STATS); ft++) {
+      const double *st = &halo_stats[(ft * np + peer) * NUM_HALO_STATS];
+      row[SENT] += st[HaloBytesSent];
+      row[RECEIVED] += st[HaloBytesReceived];
+      row[MESSAGES] += st[HaloMessages];
+      peer_wait += st[HaloWaitTime];
+    }
+    row[WAIT] += peer_wait;
+    if (peer_wait > row[WORST_WAIT]) {
+      row[WORST_WAIT] = peer_wait;
+      row[WORST_PEER] = peer;
+    }
+  }
+  sum_to_master(&mine[0], &all[0], np * NUM_COLUMNS);
+
+  const double MB = 1024.0 * 1024.0;
+  master_printf("Halo exchanges:\n");
+  for (int p = 0; p < np; p++) {
+    const double *r = &all[p * NUM_COLUMNS];
+    master_printf("    process %d: sent %g MB, received %g MB in %g messages, waited %g s", p,
+                  r[SENT] / MB, r[RECEIVED] / MB, r[MESSAGES], r[WAIT]);
+    if (r[WORST_PEER] >= 0)
+      master_printf(" (%g s for process %d)", r[WORST_WAIT], int(r[WORST_PEER]));
+    master_printf("\n");
+  }
+}
+
+std::vector<double> fields::get_comm_matrix() const {
+  // each process only knows the pairs involving its own chunks, so each
+  // pair is counted by the owner of the receiving chunk i
+  std::vector<double> mine(num_chunks * num_chunks, 0.0), bytes(num_chunks * num_chunks);
+  FOR_FIELD_TYPES(ft) {
+    for (int pair = 0; pair < num_chunks * num_chunks; pair++)
+      if (chunks[pair / num_chunks]->is_mine())
+        mine[pair] += comm_size_tot(ft, pair) * sizeof(realnum);
+  }
+  sum_to_all(&mine[0], &bytes[0], num_chunks * num_chunks);
+  return bytes;
+}
+
+void fields::print_comm_matrix_summary() const {
+  const std::vector<double> bytes = get_comm_matrix();
+  const int np = count_processors();
+  std::vector<double> local(np, 0.0), remote(np, 0.0);
+  std::vector<int> npairs(np, 0);
+  std::vector<char> is_peer(np * np, 0);
+  for (int pair = 0; pair < num_chunks * num_chunks; pair++) {
+    if (bytes[pair] == 0) continue;
+    const int pj = chunks[pair % num_chunks]->n_proc(), pi = chunks[pair / num_chunks]->n_proc();
+    if (pi == pj)
+      local[pi] += bytes[pair];
+    else {
+      remote[pj] += bytes[pair]; // counted as sent by the owner of chunk j
+      npairs[pj]++;
+      is_peer[pj * np + pi] = is_peer[pi * np + pj] = 1;
+    }
+  }
+  const double KB = 1024.0;
+  master_printf("Boundary data per time step (%d chunks):\n", num_chunks);
+  for (int p = 0; p < np; p++) {
+    int npeers = 0;
+    for (int q = 0; q < np; q++)
+      npeers += is_peer[p * np + q];
+    master_printf("    process %d: %g kB within the process, "
+                  "%g kB sent to %d peers (%d chunk pairs)\n",
+                  p, local[p] / KB, remote[p] / KB, npeers, npairs[p]);
+  }
 }
 
 // IO Routines...
@@ -635,38 +1038,41 @@ void master_fclose(FILE *f) {
    of code that should be executed by only one process at a time.
 
    They work by having each process wait for a message from the
-   previous process before starting.
+   previous process before starting.  With stride > 1, only every
+   stride-th process takes part (e.g. the HDF5 aggregator processes).
 
    Each critical section is passed an integer "tag"...ideally, this
    should be a unique identifier for each critical section so that
    messages from different critical sections don't get mixed up
    somehow. */
 
-void begin_critical_section(int tag) {
+void begin_critical_section(int tag, int stride) {
 #ifdef HAVE_MPI
   int process_rank;
   MPI_Comm_rank(mycomm, &process_rank);
-  if (process_rank > 0) { /* wait for a message before continuing */
+  if (process_rank >= stride) { /* wait for a message before continuing */
     MPI_Status status;
     int recv_tag = tag - 1; /* initialize to wrong value */
-    MPI_Recv(&recv_tag, 1, MPI_INT, process_rank - 1, tag, mycomm, &status);
+    MPI_Recv(&recv_tag, 1, MPI_INT, process_rank - stride, tag, mycomm, &status);
     if (recv_tag != tag) abort("invalid tag received in begin_critical_section");
   }
 #else
   UNUSED(tag);
+  UNUSED(stride);
 #endif
 }
 
-void end_critical_section(int tag) {
+void end_critical_section(int tag, int stride) {
 #ifdef HAVE_MPI
   int process_rank, num_procs;
   MPI_Comm_rank(mycomm, &process_rank);
   MPI_Comm_size(mycomm, &num_procs);
-  if (process_rank != num_procs - 1) { /* send a message to next process */
-    MPI_Send(&tag, 1, MPI_INT, process_rank + 1, tag, mycomm);
+  if (process_rank + stride < num_procs) { /* send a message to next process */
+    MPI_Send(&tag, 1, MPI_INT, process_rank + stride, tag, mycomm);
   }
 #else
   UNUSED(tag);
+  UNUSED(stride);
 #endif
 }
 
@@ -741,4 +1147,53 @@ int my_global_rank() {
 #endif
 }
 
+/* shared_counter: the counter lives in an MPI window on global process 0,
+   so that fetch-and-increment is a one-sided operation that does not
+   require the other processes to participate.  */
+
+bool shared_counter::supported() {
+#if defined(HAVE_MPI) && MPI_VERSION >= 3
+  return true;
+#else
+  return !with_mpi();
+#endif
+}
+
+shared_counter::shared_counter(int start) : value(start), win(NULL) {
+#if defined(HAVE_MPI) && MPI_VERSION >= 3
+  MPI_Win *w = new MPI_Win;
+  MPI_Win_create(&value, my_global_rank() == 0 ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL,
+                 MPI_COMM_WORLD, w);
+  win = (void *)w;
+#endif
+}
+
+shared_counter::~shared_counter() {
+#if defined(HAVE_MPI) && MPI_VERSION >= 3
+  MPI_Win *w = (MPI_Win *)win;
+  MPI_Win_free(w);
+  delete w;
+#endif
+}
+
+int shared_counter::next() {
+#if defined(HAVE_MPI) && MPI_VERSION >= 3
+  const int one = 1;
+  int old;
+  MPI_Win *w = (MPI_Win *)win;
+  MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, *w);
+  MPI_Fetch_and_op(&one, &old, MPI_INT, 0, 0, MPI_SUM, *w);
+  MPI_Win_unlock(0, *w);
+  return old;
+#else
+  if (with_mpi()) abort("shared_counter requires MPI-3");
+  return value++;
+#endif
+}
+
+int shared_counter::group_next() {
+  int n = am_master() ? next() : 0;
+  return broadcast(0, n);
+}
+
 } // namespace meep
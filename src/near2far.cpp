@@ -24,6 +24,10 @@
 #include <assert.h>
 #include "config.h"
 #include <math.h>
+#include <string.h>
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
@@ -33,7 +37,7 @@ dft_near2far::dft_near2far(dft_chunk *F_, double fmin, double fmax, int Nf, doub
                            const volume &where_, const direction periodic_d_[2],
                            const int periodic_n_[2], const double periodic_k_[2],
                            const double period_[2])
-    : Nfreq(Nf), F(F_), eps(eps_), mu(mu_), where(where_) {
+    : Nfreq(Nf), F(F_), eps(eps_), mu(mu_), where(where_), far_zone(false) {
   if (Nf <= 1) fmin = fmax = (fmin + fmax) * 0.5;
   freq_min = fmin;
   dfreq = Nf <= 1 ? 0.0 : (fmax - fmin) / (Nf - 1);
@@ -47,7 +51,7 @@ dft_near2far::dft_near2far(dft_chunk *F_, double fmin, double fmax, int Nf, doub
 
 dft_near2far::dft_near2far(const dft_near2far &f)
     : freq_min(f.freq_min), dfreq(f.dfreq), Nfreq(f.Nfreq), F(f.F), eps(f.eps), mu(f.mu),
-      where(f.where) {
+      where(f.where), far_zone(f.far_zone) {
   for (int i = 0; i < 2; ++i) {
     periodic_d[i] = f.periodic_d[i];
     periodic_n[i] = f.periodic_n[i];
@@ -94,9 +98,6 @@ void dft_near2far::scale_dfts(complex<double> scale) {
   if (F) F->scale_dft(scale);
 }
 
-typedef void (*greenfunc)(std::complex<double> *EH, const vec &x, double freq, double eps,
-                          double mu, const vec &x0, component c0, std::complex<double>);
-
 /* Given the field f0 correponding to current-source component c0 at
    x0, compute the E/H fields EH[6] (6 components) at x for a frequency
    freq in the homogeneous 3d medium eps and mu.
@@ -177,6 +178,35 @@ static std::complex<double> hankel(int n, double x) {
 }
 #endif /* !HAVE_LIBGSL */
 
+/* For kr >= HANKEL_ASYMPTOTIC_KR, we use the large-argument asymptotic
+   expansion of the Hankel function, whose terms up to order 1/x^6 already
+   give a relative error < 1e-9 for n <= 2, instead of the (much slower)
+   library Bessel functions. */
+#define HANKEL_ASYMPTOTIC_KR 40.0
+
+/* H_n(x) for n <= 2 given eix = exp(i(x - pi/4)), summing
+   sqrt(2/(pi x)) exp(i(x - n pi/2 - pi/4)) sum_k i^k a_k(n) / x^k
+   until the terms stop decreasing */
+static std::complex<double> hankel_asymptotic(int n, double x, std::complex<double> eix) {
+  const double mu = 4.0 * n * n;
+  std::complex<double> sum = 1.0, term = 1.0;
+  double last = 1.0;
+  for (int k = 1; k < 20; ++k) {
+    term *= std::complex<double>(0.0, (mu - (2 * k - 1) * (2 * k - 1)) / (8.0 * k * x));
+    double mag = abs(term);
+    if (mag > last || mag < 1e-16) break;
+    sum += term;
+    last = mag;
+  }
+  static const std::complex<double> minus_i_n[3] = {1.0, std::complex<double>(0, -1), -1.0};
+  return (sqrt(2 / (pi * x)) * eix * minus_i_n[n]) * sum;
+}
+
+static std::complex<double> hankel1(int n, double x) {
+  if (x >= HANKEL_ASYMPTOTIC_KR) return hankel_asymptotic(n, x, std::polar(1.0, x - 0.25 * pi));
+  return hankel(n, x);
+}
+
 /* like green3d, but 2d Green's functions */
 void green2d(std::complex<double> *EH, const vec &x, double freq, double eps, double mu,
              const vec &x0, component c0, std::complex<double> f0) {
@@ -191,8 +221,8 @@ void green2d(std::complex<double> *EH, const vec &x, double freq, double eps, do
   std::complex<double> ik = std::complex<double>(0.0, k);
   double kr = k * r;
   double Z = sqrt(mu / eps);
-  std::complex<double> H0 = hankel(0, kr) * f0;
-  std::complex<double> H1 = hankel(1, kr) * f0;
+  std::complex<double> H0 = hankel1(0, kr) * f0;
+  std::complex<double> H1 = hankel1(1, kr) * f0;
   std::complex<double> ikH1 = 0.25 * ik * H1;
 
   if (component_direction(c0) == meep::Z) {
@@ -214,7 +244,7 @@ void green2d(std::complex<double> *EH, const vec &x, double freq, double eps, do
     }
   }
   else { /* in-plane source */
-    std::complex<double> H2 = hankel(2, kr) * f0;
+    std::complex<double> H2 = hankel1(2, kr) * f0;
 
     vec p = zero_vec(rhat.dim);
     p.set_direction(component_direction(c0), 1);
@@ -245,15 +275,299 @@ void green2d(std::complex<double> *EH, const vec &x, double freq, double eps, do
   }
 }
 
+/* Far-zone (Fraunhofer) approximations of green3d and green2d, for |x| much
+   larger than both the wavelength and the extent of the near-field surface:
+   only the terms decaying as slowly as possible in r are kept, the direction
+   of x - x0 is replaced by that of x, and r = |x - x0| by |x| - rhat.x0 in
+   the phase (and by |x| elsewhere).  This avoids the Hankel functions in 2d
+   and most of the arithmetic in 3d, at a relative error of order
+   k D^2 / |x| for a near-field surface of size D. */
+void green3d_far(std::complex<double> *EH, const vec &x, double freq, double eps, double mu,
+                 const vec &x0, component c0, std::complex<double> f0) {
+  if (x.dim != D3) abort("wrong dimensionality in green3d_far");
+  double R = abs(x);
+  vec rhat = x / R;
+
+  double n = sqrt(eps * mu);
+  double k = 2 * pi * freq * n;
+  std::complex<double> expfac = f0 * polar(k * n / (4 * pi * R), k * (R - (rhat & x0)) + pi * 0.5);
+  double Z = sqrt(mu / eps);
+
+  vec p = zero_vec(rhat.dim);
+  p.set_direction(component_direction(c0), 1);
+  double pdotrhat = p & rhat;
+  vec rhatcrossp = vec(rhat.y() * p.z() - rhat.z() * p.y(), rhat.z() * p.x() - rhat.x() * p.z(),
+                       rhat.x() * p.y() - rhat.y() * p.x());
+
+  if (is_electric(c0)) {
+    expfac /= eps;
+
+    EH[0] = expfac * (p.x() - pdotrhat * rhat.x());
+    EH[1] = expfac * (p.y() - pdotrhat * rhat.y());
+    EH[2] = expfac * (p.z() - pdotrhat * rhat.z());
+
+    EH[3] = expfac * rhatcrossp.x() / Z;
+    EH[4] = expfac * rhatcrossp.y() / Z;
+    EH[5] = expfac * rhatcrossp.z() / Z;
+  }
+  else if (is_magnetic(c0)) {
+    expfac /= mu;
+
+    EH[0] = -expfac * rhatcrossp.x() * Z;
+    EH[1] = -expfac * rhatcrossp.y() * Z;
+    EH[2] = -expfac * rhatcrossp.z() * Z;
+
+    EH[3] = expfac * (p.x() - pdotrhat * rhat.x());
+    EH[4] = expfac * (p.y() - pdotrhat * rhat.y());
+    EH[5] = expfac * (p.z() - pdotrhat * rhat.z());
+  }
+  else
+    abort("unrecognized source type");
+}
+
+/* in 2d, H_n(kr) ~ sqrt(2/(pi kr)) exp(i(kr - n pi/2 - pi/4)), so that with
+   h = H_0: H_1 = -i h and H_2 = -h */
+void green2d_far(std::complex<double> *EH, const vec &x, double freq, double eps, double mu,
+                 const vec &x0, component c0, std::complex<double> f0) {
+  if (x.dim != D2) abort("wrong dimensionality in green2d_far");
+  double R = abs(x);
+  vec rhat = x / R;
+
+  double omega = 2 * pi * freq;
+  double k = omega * sqrt(eps * mu);
+  std::complex<double> h = f0 * polar(sqrt(2 / (pi * k * R)), k * (R - (rhat & x0)) - 0.25 * pi);
+  std::complex<double> kh = 0.25 * k * h; // = ik H_1 / 4
+
+  if (component_direction(c0) == meep::Z) {
+    if (is_electric(c0)) { // Ez source
+      EH[0] = EH[1] = 0.0;
+      EH[2] = (-0.25 * omega * mu) * h;
+
+      EH[3] = -rhat.y() * kh;
+      EH[4] = rhat.x() * kh;
+      EH[5] = 0.0;
+    }
+    else /* (is_magnetic(c0)) */ { // Hz source
+      EH[0] = rhat.y() * kh;
+      EH[1] = -rhat.x() * kh;
+      EH[2] = 0.0;
+
+      EH[3] = EH[4] = 0.0;
+      EH[5] = (-0.25 * omega * eps) * h;
+    }
+  }
+  else { /* in-plane source */
+    vec p = zero_vec(rhat.dim);
+    p.set_direction(component_direction(c0), 1);
+    double rhatcrossp = rhat.x() * p.y() - rhat.y() * p.x();
+
+    if (is_electric(c0)) { // Exy source
+      EH[0] = (rhat.y() * (rhatcrossp * omega * mu * 0.25)) * h;
+      EH[1] = -(rhat.x() * (rhatcrossp * omega * mu * 0.25)) * h;
+      EH[2] = 0.0;
+
+      EH[3] = EH[4] = 0.0;
+      EH[5] = -rhatcrossp * kh;
+    }
+    else /* (is_magnetic(c0)) */ { // Hxy source
+      EH[0] = EH[1] = 0.0;
+      EH[2] = rhatcrossp * kh;
+
+      EH[3] = (rhat.y() * (rhatcrossp * omega * eps * 0.25)) * h;
+      EH[4] = -(rhat.x() * (rhatcrossp * omega * eps * 0.25)) * h;
+      EH[5] = 0.0;
+    }
+  }
+}
+
+/* Frequency-batched versions of green3d/green2d (or of green3d_far/green2d_far
+   if far), for the nfreq frequencies freq0 + i*dfreq: EH[6*i ... 6*i+5] is
+   incremented by the fields from the source amplitude f0[i] * cphase.  The
+   geometry is computed only once per source, and exp(ikr) is computed by a
+   recurrence in frequency, restarted exactly every GREEN_RECURRENCE_RESTART
+   frequencies to keep the rounding errors from accumulating. */
+#define GREEN_RECURRENCE_RESTART 16
+
+static void green3d_freqs(std::complex<double> *EH, const vec &x, double freq0, double dfreq,
+                          int nfreq, double eps, double mu, const vec &x0, component c0,
+                          const std::complex<double> *f0, std::complex<double> cphase,
+                          bool far) {
+  vec rhat;
+  double r, rphase;
+  if (far) {
+    r = abs(x);
+    rhat = x / r;
+    rphase = r - (rhat & x0);
+  }
+  else {
+    rhat = x - x0;
+    r = abs(rhat);
+    rhat = rhat / r;
+    rphase = r;
+  }
+  if (rhat.dim != D3) abort("wrong dimensionality in green3d_freqs");
+  if (!is_electric(c0) && !is_magnetic(c0)) abort("unrecognized source type");
+
+  double n = sqrt(eps * mu);
+  double Z = sqrt(mu / eps);
+  double epsmu = is_electric(c0) ? eps : mu;
+
+  vec p = zero_vec(rhat.dim);
+  p.set_direction(component_direction(c0), 1);
+  double pdotrhat = p & rhat;
+  vec rhatcrossp = vec(rhat.y() * p.z() - rhat.z() * p.y(), rhat.z() * p.x() - rhat.x() * p.z(),
+                       rhat.x() * p.y() - rhat.y() * p.x());
+
+  std::complex<double> eikr, step = std::polar(1.0, 2 * pi * dfreq * n * rphase);
+  for (int i = 0; i < nfreq; ++i) {
+    double k = 2 * pi * (freq0 + i * dfreq) * n;
+    if (i % GREEN_RECURRENCE_RESTART == 0)
+      eikr = std::polar(1.0, k * rphase + pi * 0.5);
+    else
+      eikr *= step;
+    std::complex<double> expfac = (f0[i] * cphase) * eikr * (k * n / (4 * pi * r * epsmu));
+
+    std::complex<double> term1 = 1.0, term2 = -pdotrhat, term3 = 1.0;
+    if (!far) {
+      std::complex<double> ikr = std::complex<double>(0.0, k * r);
+      double ikr2 = -(k * r) * (k * r);
+      term1 = 1.0 - 1.0 / ikr + 1.0 / ikr2;
+      term2 = (-1.0 + 3.0 / ikr - 3.0 / ikr2) * pdotrhat;
+      term3 = (1.0 - 1.0 / ikr);
+    }
+    std::complex<double> A[3] = {expfac * (term1 * p.x() + term2 * rhat.x()),
+                                 expfac * (term1 * p.y() + term2 * rhat.y()),
+                                 expfac * (term1 * p.z() + term2 * rhat.z())};
+    std::complex<double> B[3] = {expfac * term3 * rhatcrossp.x(),
+                                 expfac * term3 * rhatcrossp.y(),
+                                 expfac * term3 * rhatcrossp.z()};
+
+    std::complex<double> *EHi = EH + 6 * i;
+    if (is_electric(c0))
+      for (int j = 0; j < 3; ++j) {
+        EHi[j] += A[j];
+        EHi[3 + j] += B[j] / Z;
+      }
+    else
+      for (int j = 0; j < 3; ++j) {
+        EHi[j] -= B[j] * Z;
+        EHi[3 + j] += A[j];
+      }
+  }
+}
+
+static void green2d_freqs(std::complex<double> *EH, const vec &x, double freq0, double dfreq,
+                          int nfreq, double eps, double mu, const vec &x0, component c0,
+                          const std::complex<double> *f0, std::complex<double> cphase,
+                          bool far) {
+  vec rhat;
+  double r, rphase;
+  if (far) {
+    r = abs(x);
+    rhat = x / r;
+    rphase = r - (rhat & x0);
+  }
+  else {
+    rhat = x - x0;
+    r = abs(rhat);
+    rhat = rhat / r;
+    rphase = r;
+  }
+  if (rhat.dim != D2) abort("wrong dimensionality in green2d_freqs");
+
+  double sqrt_epsmu = sqrt(eps * mu);
+  double Z = sqrt(mu / eps);
+  bool inplane = component_direction(c0) != meep::Z;
+  double inv_r = far ? 0.0 : 1.0 / r; // the 1/r terms are dropped in the far zone
+
+  vec p = zero_vec(rhat.dim);
+  if (inplane) p.set_direction(component_direction(c0), 1);
+  double pdotrhat = p & rhat;
+  double rhatcrossp = rhat.x() * p.y() - rhat.y() * p.x();
+
+  std::complex<double> eikr, step = std::polar(1.0, 2 * pi * dfreq * sqrt_epsmu * rphase);
+  for (int i = 0; i < nfreq; ++i) {
+    double omega = 2 * pi * (freq0 + i * dfreq);
+    double k = omega * sqrt_epsmu;
+    double kr = k * r;
+    if (i % GREEN_RECURRENCE_RESTART == 0)
+      eikr = std::polar(1.0, k * rphase - 0.25 * pi);
+    else
+      eikr *= step;
+
+    std::complex<double> f = f0[i] * cphase, H0, H1, H2;
+    if (far) {
+      H0 = sqrt(2 / (pi * kr)) * eikr;
+      H1 = std::complex<double>(0, -1) * H0;
+      H2 = -H0;
+    }
+    else if (kr >= HANKEL_ASYMPTOTIC_KR) {
+      H0 = hankel_asymptotic(0, kr, eikr);
+      H1 = hankel_asymptotic(1, kr, eikr);
+      if (inplane) H2 = hankel_asymptotic(2, kr, eikr);
+    }
+    else {
+      H0 = hankel(0, kr);
+      H1 = hankel(1, kr);
+      if (inplane) H2 = hankel(2, kr);
+    }
+    H0 *= f;
+    H1 *= f;
+    H2 *= f;
+    std::complex<double> ikH1 = 0.25 * std::complex<double>(0.0, k) * H1;
+
+    std::complex<double> *EHi = EH + 6 * i;
+    if (!inplane) {
+      if (is_electric(c0)) { // Ez source
+        EHi[2] += (-0.25 * omega * mu) * H0;
+        EHi[3] += -rhat.y() * ikH1;
+        EHi[4] += rhat.x() * ikH1;
+      }
+      else { // Hz source
+        EHi[0] += rhat.y() * ikH1;
+        EHi[1] += -rhat.x() * ikH1;
+        EHi[5] += (-0.25 * omega * eps) * H0;
+      }
+    }
+    else {
+      if (is_electric(c0)) { // Exy source
+        EHi[0] += -(rhat.x() * (pdotrhat * inv_r * 0.25 * Z)) * H1 +
+                  (rhat.y() * (rhatcrossp * omega * mu * 0.125)) * (H0 - H2);
+        EHi[1] += -(rhat.y() * (pdotrhat * inv_r * 0.25 * Z)) * H1 -
+                  (rhat.x() * (rhatcrossp * omega * mu * 0.125)) * (H0 - H2);
+        EHi[5] += -rhatcrossp * ikH1;
+      }
+      else { // Hxy source
+        EHi[2] += rhatcrossp * ikH1;
+        EHi[3] += -(rhat.x() * (pdotrhat * inv_r * 0.25 / Z)) * H1 +
+                  (rhat.y() * (rhatcrossp * omega * eps * 0.125)) * (H0 - H2);
+        EHi[4] += -(rhat.y() * (pdotrhat * inv_r * 0.25 / Z)) * H1 -
+                  (rhat.x() * (rhatcrossp * omega * eps * 0.125)) * (H0 - H2);
+      }
+    }
+  }
+}
+
+/* number of consecutive frequencies handled by each thread */
+static int green_freq_block(int Nfreq) {
+#ifdef HAVE_OPENMP
+  int nthreads = omp_get_max_threads();
+#else
+  int nthreads = 1;
+#endif
+  return (Nfreq + nthreads - 1) / nthreads;
+}
+
 void dft_near2far::farfield_lowlevel(std::complex<double> *EH, const vec &x) {
   if (x.dim != D3 && x.dim != D2) abort("only 2d or 3d far-field computation is supported");
-  greenfunc green = x.dim == D2 ? green2d : green3d;
+  const int block = green_freq_block(Nfreq), nblocks = (Nfreq + block - 1) / block;
 
   for (int i = 0; i < 6 * Nfreq; ++i)
     EH[i] = 0.0;
 
   for (dft_chunk *f = F; f; f = f->next_in_dft) {
     assert(Nfreq == f->Nomega);
+    f->flush_dft();
 
     component c0 = component(f->vc); /* equivalent source component */
 
@@ -261,9 +575,8 @@ void dft_near2far::farfield_lowlevel(std::complex<double> *EH, const vec &x) {
 #ifdef HAVE_OPENMP
 #pragma omp parallel for
 #endif
-    for (int i = 0; i < Nfreq; ++i) {
-      std::complex<double> EH6[6];
-      double freq = freq_min + i * dfreq;
+    for (int b = 0; b < nblocks; ++b) {
+      int ifreq = b * block, nf = std::min(block, Nfreq - ifreq);
       size_t idx_dft = 0;
       LOOP_OVER_IVECS(f->fc->gv, f->is, f->ie, idx) {
         IVEC_LOOP_LOC(f->fc->gv, x0);
@@ -278,9 +591,9 @@ void dft_near2far::farfield_lowlevel(std::complex<double> *EH, const vec &x) {
               xs.set_direction(periodic_d[1], x0.in_direction(periodic_d[1]) + i1 * period[1]);
             double phase = phase0 + i1 * periodic_k[1];
             std::complex<double> cphase = std::polar(1.0, phase);
-            green(EH6, x, freq, eps, mu, xs, c0, f->dft[Nfreq * idx_dft + i]);
-            for (int j = 0; j < 6; ++j)
-              EH[i * 6 + j] += EH6[j] * cphase;
+            (x.dim == D2 ? green2d_freqs : green3d_freqs)(
+                EH + 6 * ifreq, x, freq_min + ifreq * dfreq, dfreq, nf, eps, mu, xs, c0,
+                f->dft + Nfreq * idx_dft + ifreq, cphase, far_zone);
           }
         }
         idx_dft++;
@@ -299,8 +612,95 @@ std::complex<double> *dft_near2far::farfield(const vec &x) {
   return EH;
 }
 
-realnum *dft_near2far::get_farfields_array(const volume &where, int &rank, size_t *dims, size_t &N,
-                                           double resolution) {
+/* The near-field sources of all processes, flattened into records of
+   NEAR_SOURCE_HEADER doubles (the source position, after the symmetry
+   transformation and shift, and its component) followed by the real and
+   imaginary parts of its Nfreq DFT amplitudes.  With these, any process can
+   compute the far fields at any point, so that the far-field points can be
+   divided among the processes; the near-field data is usually much smaller
+   than a far-field grid. */
+#define NEAR_SOURCE_HEADER 4
+
+double *dft_near2far::gather_near_sources(size_t &nsources) {
+  const size_t stride = NEAR_SOURCE_HEADER + 2 * Nfreq;
+  size_t n = 0;
+  for (dft_chunk *f = F; f; f = f->next_in_dft)
+    n += f->N;
+
+  double *mine = new double[n * stride];
+  double *s = mine;
+  for (dft_chunk *f = F; f; f = f->next_in_dft) {
+    assert(Nfreq == f->Nomega);
+    f->flush_dft();
+    vec rshift(f->shift * (0.5 * f->fc->gv.inva));
+    size_t idx_dft = 0;
+    LOOP_OVER_IVECS(f->fc->gv, f->is, f->ie, idx) {
+      IVEC_LOOP_LOC(f->fc->gv, x0);
+      x0 = f->S.transform(x0, f->sn) + rshift;
+      s[0] = s[1] = s[2] = 0;
+      LOOP_OVER_DIRECTIONS(x0.dim, d) { s[d] = x0.in_direction(d); }
+      s[3] = f->vc;
+      for (int i = 0; i < Nfreq; ++i) {
+        s[NEAR_SOURCE_HEADER + 2 * i] = real(f->dft[Nfreq * idx_dft + i]);
+        s[NEAR_SOURCE_HEADER + 2 * i + 1] = imag(f->dft[Nfreq * idx_dft + i]);
+      }
+      s += stride;
+      idx_dft++;
+    }
+    assert(idx_dft == f->N);
+  }
+
+  size_t ntot;
+  double *sources = gather_to_all(mine, n * stride, ntot);
+  delete[] mine;
+  nsources = ntot / stride;
+  return sources;
+}
+
+/* like farfield_lowlevel, but summing over the sources returned by
+   gather_near_sources (so that no reduction over processes is needed) */
+void dft_near2far::farfield_from_sources(std::complex<double> *EH, const vec &x,
+                                         const double *sources, size_t nsources) {
+  if (x.dim != D3 && x.dim != D2) abort("only 2d or 3d far-field computation is supported");
+  const size_t stride = NEAR_SOURCE_HEADER + 2 * Nfreq;
+  const int block = green_freq_block(Nfreq), nblocks = (Nfreq + block - 1) / block;
+
+  for (int i = 0; i < 6 * Nfreq; ++i)
+    EH[i] = 0.0;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
+  for (int b = 0; b < nblocks; ++b) {
+    int ifreq = b * block, nf = std::min(block, Nfreq - ifreq);
+    for (size_t n = 0; n < nsources; ++n) {
+      const double *s = sources + n * stride;
+      vec x0(x.dim);
+      LOOP_OVER_DIRECTIONS(x.dim, d) { x0.set_direction(d, s[d]); }
+      component c0 = component(int(s[3]));
+      const std::complex<double> *f0 = (const std::complex<double> *)(s + NEAR_SOURCE_HEADER);
+      vec xs(x0);
+      for (int i0 = -periodic_n[0]; i0 <= periodic_n[0]; ++i0) {
+        if (periodic_d[0] != NO_DIRECTION)
+          xs.set_direction(periodic_d[0], x0.in_direction(periodic_d[0]) + i0 * period[0]);
+        double phase0 = i0 * periodic_k[0];
+        for (int i1 = -periodic_n[1]; i1 <= periodic_n[1]; ++i1) {
+          if (periodic_d[1] != NO_DIRECTION)
+            xs.set_direction(periodic_d[1], x0.in_direction(periodic_d[1]) + i1 * period[1]);
+          double phase = phase0 + i1 * periodic_k[1];
+          std::complex<double> cphase = std::polar(1.0, phase);
+          (x.dim == D2 ? green2d_freqs : green3d_freqs)(EH + 6 * ifreq, x,
+                                                        freq_min + ifreq * dfreq, dfreq, nf, eps,
+                                                        mu, xs, c0, f0 + ifreq, cphase, far_zone);
+        }
+      }
+    }
+  }
+}
+
+realnum *dft_near2far::get_farfields_chunk(const volume &where, int &rank, size_t *dims,
+                                           size_t &N, double resolution, size_t &point_start,
+                                           size_t &npoints) {
   /* compute output grid size etc. */
   double dx[3] = {0, 0, 0};
   direction dirs[3] = {X, Y, Z};
@@ -319,45 +719,51 @@ realnum *dft_near2far::get_farfields_array(const volume &where, int &rank, size_
 
   if (N * Nfreq < 1) return NULL; /* nothing to output */
 
-  /* 6 x 2 x N x Nfreq array of fields in row-major order */
-  realnum *EH = new realnum[6 * 2 * N * Nfreq];
-  realnum *EH_ = new realnum[6 * 2 * N * Nfreq]; // temp array for sum_to_all
+  /* divide the first non-singleton dimension among the processes */
+  int split = 0;
+  while (split < 2 && dims[split] == 1)
+    ++split;
+  size_t rowsize = 1;
+  for (int i = split + 1; i < 3; ++i)
+    rowsize *= dims[i];
+  size_t nrows = dims[split], nprocs = count_processors(), me = my_rank();
+  point_start = (nrows * me) / nprocs * rowsize;
+  npoints = (nrows * (me + 1)) / nprocs * rowsize - point_start;
 
-  /* fields for farfield_lowlevel for a single output point x */
+  size_t nsources;
+  double *sources = gather_near_sources(nsources);
+
+  /* 6 x 2 x npoints x Nfreq array of fields in row-major order */
+  realnum *EH = new realnum[6 * 2 * npoints * Nfreq];
+
+  /* fields for farfield_from_sources for a single output point x */
   std::complex<double> *EH1 = new std::complex<double>[6 * Nfreq];
 
   double start = wall_time();
-  size_t total_points = dims[0] * dims[1] * dims[2];
   size_t last_point = 0;
 
   vec x(where.dim);
-  for (size_t i0 = 0; i0 < dims[0]; ++i0) {
+  for (size_t ip = 0; ip < npoints; ++ip) {
+    size_t idx = point_start + ip;
+    size_t i0 = idx / (dims[1] * dims[2]), i1 = (idx / dims[2]) % dims[1], i2 = idx % dims[2];
     x.set_direction(dirs[0], where.in_direction_min(dirs[0]) + i0 * dx[0]);
-    for (size_t i1 = 0; i1 < dims[1]; ++i1) {
-      x.set_direction(dirs[1], where.in_direction_min(dirs[1]) + i1 * dx[1]);
-      for (size_t i2 = 0; i2 < dims[2]; ++i2) {
-        x.set_direction(dirs[2], where.in_direction_min(dirs[2]) + i2 * dx[2]);
-        double t;
-        if (verbosity > 0 && (t = wall_time()) > start + MEEP_MIN_OUTPUT_TIME) {
-          size_t this_point = (dims[1] * dims[2] * i0) + (dims[2] * i1) + i2 + 1;
-          master_printf("get_farfields_array working on point %zu of %zu (%d%% done), %g s/point\n",
-                        this_point, total_points, (int)((double)this_point / total_points * 100),
-                        (t - start) / (std::max(1, (int)(this_point - last_point))));
-          start = t;
-          last_point = this_point;
-        }
-        farfield_lowlevel(EH1, x);
-        if (verbosity > 0) all_wait(); // Allow consistent progress updates from master
-        ptrdiff_t idx = (i0 * dims[1] + i1) * dims[2] + i2;
-        for (int i = 0; i < Nfreq; ++i)
-          for (int k = 0; k < 6; ++k) {
-            EH_[((k * 2 + 0) * N + idx) * Nfreq + i] = real(EH1[i * 6 + k]);
-            EH_[((k * 2 + 1) * N + idx) * Nfreq + i] = imag(EH1[i * 6 + k]);
-          }
-      }
+    x.set_direction(dirs[1], where.in_direction_min(dirs[1]) + i1 * dx[1]);
+    x.set_direction(dirs[2], where.in_direction_min(dirs[2]) + i2 * dx[2]);
+    double t;
+    if (verbosity > 0 && (t = wall_time()) > start + MEEP_MIN_OUTPUT_TIME) {
+      master_printf("get_farfields_array working on point %zu of %zu (%d%% done), %g s/point\n",
+                    ip + 1, npoints, (int)((double)(ip + 1) / npoints * 100),
+                    (t - start) / (std::max(1, (int)(ip + 1 - last_point))));
+      start = t;
+      last_point = ip + 1;
     }
+    farfield_from_sources(EH1, x, sources, nsources);
+    for (int i = 0; i < Nfreq; ++i)
+      for (int k = 0; k < 6; ++k) {
+        EH[((k * 2 + 0) * npoints + ip) * Nfreq + i] = real(EH1[i * 6 + k]);
+        EH[((k * 2 + 1) * npoints + ip) * Nfreq + i] = imag(EH1[i * 6 + k]);
+      }
   }
-  sum_to_all(EH_, EH, 6 * 2 * N * Nfreq);
 
   /* collapse singleton dimensions */
   int ireduced = 0;
@@ -366,8 +772,28 @@ realnum *dft_near2far::get_farfields_array(const volume &where, int &rank, size_
   }
   rank = ireduced;
 
-  delete[] EH_;
   delete[] EH1;
+  delete[] sources;
+  return EH;
+}
+
+realnum *dft_near2far::get_farfields_array(const volume &where, int &rank, size_t *dims, size_t &N,
+                                           double resolution) {
+  size_t point_start, npoints;
+  realnum *EH_ = get_farfields_chunk(where, rank, dims, N, resolution, point_start, npoints);
+  if (!EH_) return NULL; /* nothing to output */
+
+  /* 6 x 2 x N x Nfreq array of fields in row-major order */
+  realnum *EH = new realnum[6 * 2 * N * Nfreq];
+  realnum *EH_all = new realnum[6 * 2 * N * Nfreq]; // temp array for sum_to_all
+  for (size_t i = 0; i < 6 * 2 * N * Nfreq; ++i)
+    EH_all[i] = 0;
+  for (int kr = 0; kr < 6 * 2; ++kr)
+    memcpy(EH_all + (kr * N + point_start) * Nfreq, EH_ + kr * npoints * Nfreq,
+           npoints * Nfreq * sizeof(realnum));
+  delete[] EH_;
+  sum_to_all(EH_all, EH, 6 * 2 * N * Nfreq);
+  delete[] EH_all;
   return EH;
 }
 
@@ -375,30 +801,47 @@ void dft_near2far::save_farfields(const char *fname, const char *prefix, const v
                                   double resolution) {
   size_t dims[4] = {1, 1, 1, 1};
   int rank = 0;
-  size_t N = 1;
+  size_t N = 1, point_start, npoints;
 
-  realnum *EH = get_farfields_array(where, rank, dims, N, resolution);
+  realnum *EH = get_farfields_chunk(where, rank, dims, N, resolution, point_start, npoints);
   if (!EH) return; /* nothing to output */
 
+  /* this process's hyperslab: a range of the first (collapsed) dimension,
+     or of nothing if there is only a single point */
+  size_t chunk_start[4] = {0, 0, 0, 0}, chunk_dims[4] = {1, 1, 1, 1};
+  for (int i = 0; i < rank; ++i)
+    chunk_dims[i] = dims[i];
+  if (rank > 0) {
+    size_t rowsize = N / dims[0];
+    chunk_start[0] = point_start / rowsize;
+    chunk_dims[0] = npoints / rowsize;
+  }
+  else if (npoints == 0)
+    chunk_dims[0] = 0;
+
   /* frequencies are the last dimension */
-  if (Nfreq > 1) dims[rank++] = Nfreq;
-
-  /* output to a file with one dataset per component & real/imag part */
-  if (am_master()) {
-    const int buflen = 1024;
-    static char filename[buflen];
-    snprintf(filename, buflen, "%s%s%s.h5", prefix ? prefix : "", prefix && prefix[0] ? "-" : "",
-             fname);
-    h5file ff(filename, h5file::WRITE, false);
-    component c[6] = {Ex, Ey, Ez, Hx, Hy, Hz};
-    char dataname[128];
-    for (int k = 0; k < 6; ++k)
-      for (int reim = 0; reim < 2; ++reim) {
-        snprintf(dataname, 128, "%s.%c", component_name(c[k]), "ri"[reim]);
-        ff.write(dataname, rank, dims, EH + (k * 2 + reim) * N * Nfreq);
-      }
+  if (Nfreq > 1) {
+    chunk_dims[rank] = npoints ? Nfreq : 0;
+    dims[rank++] = Nfreq;
   }
 
+  /* output to a file with one dataset per component & real/imag part,
+     each process writing its own far-field points */
+  const int buflen = 1024;
+  static char filename[buflen];
+  snprintf(filename, buflen, "%s%s%s.h5", prefix ? prefix : "", prefix && prefix[0] ? "-" : "",
+           fname);
+  h5file ff(filename, h5file::WRITE, true);
+  component c[6] = {Ex, Ey, Ez, Hx, Hy, Hz};
+  char dataname[128];
+  for (int k = 0; k < 6; ++k)
+    for (int reim = 0; reim < 2; ++reim) {
+      snprintf(dataname, 128, "%s.%c", component_name(c[k]), "ri"[reim]);
+      ff.create_data(dataname, rank, dims);
+      ff.write_chunk(rank, chunk_start, chunk_dims, EH + (k * 2 + reim) * npoints * Nfreq);
+      ff.done_writing_chunks();
+    }
+
   delete[] EH;
 }
 
@@ -19,6 +19,7 @@
 #include "config.h"
 
 #include "support/meep_mt.h"
+#include <stdint.h>
 #include <time.h>
 
 using namespace std;
@@ -26,27 +27,49 @@ using namespace std;
 namespace meep {
 
 static bool rand_inited = false;
+static unsigned long counter_seed = 0; // for counter_random_seed()
 
 static void init_rand(void) {
   if (!rand_inited) {
     rand_inited = true; // no infinite loop since rand_inited == true
     set_random_seed(time(NULL) * (1 + my_global_rank()));
+    counter_seed = time(NULL); // same on all processes (usually), unlike the MT seed
   }
 }
 
 void set_random_seed(unsigned long seed) {
   init_rand();
   meep_mt_init_genrand(seed);
+  counter_seed = seed;
 }
 
+unsigned long counter_random_seed() {
+  init_rand();
+  return counter_seed;
+}
+
+/* The Mersenne-twister state is global, so with OpenMP we must make sure
+   that only one thread at a time draws from it (e.g. if the
+   noisy_lorentzian_susceptibility is updated in several chunks at once). */
+
 int random_int(int a, int b) {
   init_rand();
-  return a + meep_mt_genrand_int32() % (b - a + 1);
+  unsigned long r;
+#ifdef HAVE_OPENMP
+#pragma omp critical(meep_random)
+#endif
+  r = meep_mt_genrand_int32();
+  return a + r % (b - a + 1);
 }
 
 double uniform_random(double a, double b) {
   init_rand();
-  return a + meep_mt_genrand_res53() * (b - a);
+  double r;
+#ifdef HAVE_OPENMP
+#pragma omp critical(meep_random)
+#endif
+  r = meep_mt_genrand_res53();
+  return a + r * (b - a);
 }
 
 double gaussian_random(double mean, double stddev) {
@@ -55,8 +78,13 @@ double gaussian_random(double mean, double stddev) {
   // see Knuth vol II algorithm P, sec. 3.4.1
   double v1, v2, s;
   do {
-    v1 = 2 * meep_mt_genrand_res53() - 1;
-    v2 = 2 * meep_mt_genrand_res53() - 1;
+#ifdef HAVE_OPENMP
+#pragma omp critical(meep_random)
+#endif
+    {
+      v1 = 2 * meep_mt_genrand_res53() - 1;
+      v2 = 2 * meep_mt_genrand_res53() - 1;
+    }
     s = v1 * v1 + v2 * v2;
   } while (s >= 1.0);
   if (s == 0) { return mean; }
@@ -65,4 +93,58 @@ double gaussian_random(double mean, double stddev) {
   }
 }
 
+/* Counter-based random numbers, using the Philox4x32-10 generator of
+   J. K. Salmon et al., "Parallel random numbers: as easy as 1, 2, 3,"
+   Proc. SC'11 (2011).  The output is a pure function of a 64-bit key
+   (usually made from counter_random_seed() and e.g. the time step) and a
+   128-bit counter, with no internal state, so the random numbers can be
+   generated in any order, e.g. by many threads at once or for each grid
+   point independent of how the cell is divided into chunks. */
+
+static inline void philox_round(uint32_t ctr[4], const uint32_t key[2]) {
+  const uint64_t p0 = uint64_t(0xD2511F53) * ctr[0];
+  const uint64_t p1 = uint64_t(0xCD9E8D57) * ctr[2];
+  const uint32_t c1 = ctr[1], c3 = ctr[3];
+  ctr[0] = uint32_t(p1 >> 32) ^ c1 ^ key[0];
+  ctr[1] = uint32_t(p1);
+  ctr[2] = uint32_t(p0 >> 32) ^ c3 ^ key[1];
+  ctr[3] = uint32_t(p0);
+}
+
+void counter_random(const uint32_t key[2], const uint32_t counter[4], uint32_t r[4]) {
+  uint32_t k[2] = {key[0], key[1]};
+  for (int i = 0; i < 4; ++i)
+    r[i] = counter[i];
+  for (int round = 0; round < 10; ++round) {
+    if (round > 0) {
+      k[0] += 0x9E3779B9;
+      k[1] += 0xBB67AE85;
+    }
+    philox_round(r, k);
+  }
+}
+
+// Box-Muller transform of the two uniform deviates in the 4 random words r
+static inline double philox_gaussian(const uint32_t r[4]) {
+  const double scale = 1.0 / 9007199254740992.0; // 2^-53
+  const double u1 = ((uint64_t(r[0] >> 5) << 26 | (r[1] >> 6)) + 1) * scale; // (0,1]
+  const double u2 = (uint64_t(r[2] >> 5) << 26 | (r[3] >> 6)) * scale;       // [0,1)
+  return sqrt(-2 * log(u1)) * cos(2 * pi * u2);
+}
+
+double counter_gaussian_random(const uint32_t key[2], const uint32_t counter[4], double mean,
+                               double stddev) {
+  uint32_t r[4];
+  counter_random(key, counter, r);
+  return mean + philox_gaussian(r) * stddev;
+}
+
+void counter_gaussian_randoms(const uint32_t key[2], const uint32_t counter[3], size_t n,
+                              double *g, double mean, double stddev) {
+  for (size_t i = 0; i < n; ++i) {
+    const uint32_t ctr[4] = {counter[0], counter[1], counter[2], uint32_t(i)};
+    g[i] = counter_gaussian_random(key, ctr, mean, stddev);
+  }
+}
+
 } // namespace meep
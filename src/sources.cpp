@@ -103,6 +103,11 @@ std::complex<double> gaussian_src_time::fourier_transform(const double f) {
   return width * polar(1.0, omega * peak_time) * exp(-0.5 * delta * delta);
 }
 
+double gaussian_src_time::max_frequency() const {
+  // |fourier_transform| falls below 1e-10 of its peak here
+  return fabs(freq) + sqrt(2 * log(1e10)) / (2 * pi * width);
+}
+
 bool gaussian_src_time::is_equal(const src_time &t) const {
   const gaussian_src_time *tp = dynamic_cast<const gaussian_src_time *>(&t);
   if (tp)
@@ -150,28 +155,96 @@ bool custom_src_time::is_equal(const src_time &t) const {
     return 0;
 }
 
+void custom_src_time::set_table(double t0, double dt, complex<double> *values, size_t n) {
+  if (n > 0 && !(dt > 0)) abort("custom_src_time table needs a positive time step\n");
+  table.assign(values, values + n);
+  table_t0 = t0;
+  table_dt = dt;
+}
+
+bool custom_src_time::table_lookup(double time, complex<double> &val) const {
+  if (table.empty()) return false;
+  const double k = (time - table_t0) / table_dt;
+  const double k0 = floor(k + 0.5);
+  // only times on the tabulated grid (up to rounding) are taken from the table
+  if (k0 < 0 || k0 >= table.size() || fabs(k - k0) > 1e-3) return false;
+  val = table[size_t(k0)];
+  return true;
+}
+
 /*********************************************************************/
 
-src_vol::src_vol(component cc, src_time *st, size_t n, ptrdiff_t *ind, complex<double> *amps) {
+size_t src_vol::generation = 0;
+
+src_vol::src_vol(component cc, src_time *st, size_t n_, ptrdiff_t *ind, complex<double> *amps) {
+  ++generation;
   c = cc;
   if (is_D(c)) c = direction_component(Ex, component_direction(c));
   if (is_B(c)) c = direction_component(Hx, component_direction(c));
   t = st;
   next = NULL;
-  npts = n;
+  npts = n_;
   index = ind;
   A = amps;
+  idx0 = 0;
+  n[0] = n[1] = 1;
+  n[2] = npts;
+  stride[0] = stride[1] = stride[2] = 0;
+  a[0] = a[1] = a[2] = NULL;
+}
+
+src_vol::src_vol(component cc, src_time *st, ptrdiff_t i0, const ptrdiff_t nbox[3],
+                 const ptrdiff_t sbox[3], complex<double> *amps) {
+  ++generation;
+  c = cc;
+  if (is_D(c)) c = direction_component(Ex, component_direction(c));
+  if (is_B(c)) c = direction_component(Hx, component_direction(c));
+  t = st;
+  next = NULL;
+  index = NULL;
+  A = amps;
+  idx0 = i0;
+  npts = 1;
+  for (int k = 0; k < 3; ++k) {
+    n[k] = nbox[k];
+    stride[k] = sbox[k];
+    npts *= n[k];
+    a[k] = NULL;
+  }
+  // only worth factoring if the factors are smaller than the full array
+  if (npts > size_t(n[0] + n[1] + n[2]) && factor_amplitudes()) {
+    delete[] A;
+    A = NULL;
+  }
 }
 
 src_vol::src_vol(const src_vol &sv) {
+  ++generation;
   c = sv.c;
   t = sv.t;
   npts = sv.npts;
-  index = new ptrdiff_t[npts];
-  A = new complex<double>[npts];
-  for (size_t j = 0; j < npts; j++) {
-    index[j] = sv.index[j];
-    A[j] = sv.A[j];
+  idx0 = sv.idx0;
+  index = NULL;
+  A = NULL;
+  for (int k = 0; k < 3; ++k) {
+    n[k] = sv.n[k];
+    stride[k] = sv.stride[k];
+    a[k] = NULL;
+    if (sv.a[k]) {
+      a[k] = new complex<double>[n[k]];
+      for (ptrdiff_t j = 0; j < n[k]; j++)
+        a[k][j] = sv.a[k][j];
+    }
+  }
+  if (sv.index) {
+    index = new ptrdiff_t[npts];
+    for (size_t j = 0; j < npts; j++)
+      index[j] = sv.index[j];
+  }
+  if (sv.A) {
+    A = new complex<double>[npts];
+    for (size_t j = 0; j < npts; j++)
+      A[j] = sv.A[j];
   }
   if (sv.next)
     next = new src_vol(*sv.next);
@@ -179,6 +252,85 @@ src_vol::src_vol(const src_vol &sv) {
     next = NULL;
 }
 
+/* Try to write the amplitudes of a box source as A_j = a[0][j1] * a[1][j2] * a[2][j3],
+   which holds for the usual plane-wave and Gaussian-beam profiles (the interpolation
+   weights at the box edges are products of per-direction weights as well).  The
+   factors are read off the lines through the largest amplitude and accepted only
+   if they reproduce every amplitude to within rounding error. */
+bool src_vol::factor_amplitudes() {
+  size_t jmax = 0;
+  double amax = 0;
+  for (size_t j = 0; j < npts; j++)
+    if (abs(A[j]) > amax) {
+      amax = abs(A[j]);
+      jmax = j;
+    }
+  if (amax == 0) return false;
+
+  const ptrdiff_t k3 = jmax % n[2], k2 = (jmax / n[2]) % n[1], k1 = jmax / (n[2] * n[1]);
+  const complex<double> pivot = A[jmax];
+  for (int k = 0; k < 3; ++k)
+    a[k] = new complex<double>[n[k]];
+  for (ptrdiff_t j1 = 0; j1 < n[0]; j1++)
+    a[0][j1] = A[(j1 * n[1] + k2) * n[2] + k3];
+  for (ptrdiff_t j2 = 0; j2 < n[1]; j2++)
+    a[1][j2] = A[(k1 * n[1] + j2) * n[2] + k3] / pivot;
+  for (ptrdiff_t j3 = 0; j3 < n[2]; j3++)
+    a[2][j3] = A[(k1 * n[1] + k2) * n[2] + j3] / pivot;
+
+  const double tol = 1e-12 * amax;
+  size_t j = 0;
+  for (ptrdiff_t j1 = 0; j1 < n[0]; j1++)
+    for (ptrdiff_t j2 = 0; j2 < n[1]; j2++) {
+      const complex<double> a12 = a[0][j1] * a[1][j2];
+      for (ptrdiff_t j3 = 0; j3 < n[2]; j3++, j++)
+        if (abs(A[j] - a12 * a[2][j3]) > tol) {
+          for (int k = 0; k < 3; ++k) {
+            delete[] a[k];
+            a[k] = NULL;
+          }
+          return false;
+        }
+    }
+  return true;
+}
+
+// inverse of factor_amplitudes, needed before adding non-separable amplitudes
+void src_vol::expand_amplitudes() {
+  if (A) return;
+  A = new complex<double>[npts];
+  for (size_t j = 0; j < npts; j++)
+    A[j] = amplitude(j);
+  for (int k = 0; k < 3; ++k) {
+    delete[] a[k];
+    a[k] = NULL;
+  }
+}
+
+namespace {
+struct src_vol_subtract {
+  realnum *fr, *fi;
+  const realnum *w;
+  complex<double> scale;
+  void operator()(ptrdiff_t i, complex<double> amp) {
+    complex<double> A = scale * amp;
+    if (w) A *= double(w[i]);
+    fr[i] -= real(A);
+    if (fi) fi[i] -= imag(A);
+  }
+};
+} // namespace
+
+void src_vol::subtract_from(realnum *fr, realnum *fi, complex<double> scale,
+                            const realnum *w) const {
+  src_vol_subtract op;
+  op.fr = fr;
+  op.fi = fi;
+  op.w = w;
+  op.scale = scale;
+  loop_over_points(op);
+}
+
 src_vol *src_vol::add_to(src_vol *others) {
   if (others) {
     if (*this == *others) {
@@ -186,10 +338,13 @@ src_vol *src_vol::add_to(src_vol *others) {
         abort("Cannot add grid_volume sources with different number of points\n");
       /* Compare all of the indices...if this ever becomes too slow,
          we can just compare the first and last indices. */
-      for (size_t j = 0; j < npts; j++) {
-        if (others->index[j] != index[j]) abort("Different indices\n");
-        others->A[j] += A[j];
-      }
+      if (index)
+        for (size_t j = 0; j < npts; j++)
+          if (others->index[j] != index[j]) abort("Different indices\n");
+      others->expand_amplitudes();
+      for (size_t j = 0; j < npts; j++)
+        others->A[j] += amplitude(j);
+      ++generation;
     }
     else
       others->next = add_to(others->next);
@@ -239,8 +394,19 @@ void fields::add_volume_source(component c, const src_time &src, const volume &w
   add_volume_source(c, src, where, one, amp);
 }
 
+// amplitude_box_function evaluating a pointwise amplitude function
+static void pointwise_amplitudes(void *A_, const vec &p0, const vec dp[3], const size_t n[3],
+                                 complex<double> *A) {
+  complex<double> (*f)(const vec &) = *(complex<double>(**)(const vec &))A_;
+  for (size_t i0 = 0; i0 < n[0]; ++i0)
+    for (size_t i1 = 0; i1 < n[1]; ++i1)
+      for (size_t i2 = 0; i2 < n[2]; ++i2)
+        *A++ = f(p0 + dp[0] * double(i0) + dp[1] * double(i1) + dp[2] * double(i2));
+}
+
 struct src_vol_chunkloop_data {
-  complex<double> (*A)(const vec &);
+  amplitude_box_function A;
+  void *A_data;
   complex<double> amp;
   src_time *src;
   vec center;
@@ -275,16 +441,28 @@ static void src_vol_chunkloop(fields_chunk *fc, int ichunk, component c, ivec is
   direction cd = component_direction(c);
 
   double inva = fc->gv.inva;
-  size_t idx_vol = 0;
+
+  // evaluate the amplitude function over the whole box at once, in loop order
+  ptrdiff_t nbox[3], sbox[3];
+  size_t nA[3];
+  vec dp[3];
+  for (int k = 0; k < 3; ++k) {
+    nbox[k] = (ie.yucky_val(k) - is.yucky_val(k)) / 2 + 1;
+    sbox[k] = fc->gv.stride(fc->gv.yucky_direction(k));
+    nA[k] = nbox[k];
+    dp[k] = zero_vec(fc->gv.dim);
+    if (nbox[k] > 1) dp[k].set_direction(fc->gv.yucky_direction(k), inva);
+  }
+  complex<double> *box_amps = new complex<double>[npts];
+  data->A(data->A_data, fc->gv[is] + shift * (0.5 * inva) - data->center, dp, nA, box_amps);
+
+  size_t idx_vol = 0, ibox = 0;
   LOOP_OVER_IVECS(fc->gv, is, ie, idx) {
+    complex<double> A = box_amps[ibox++];
     IVEC_LOOP_ILOC(fc->gv, iloc);
     if (!fc->gv.owns(iloc)) continue;
 
-    IVEC_LOOP_LOC(fc->gv, loc);
-    loc += shift * (0.5 * inva);
-
-    vec rel_loc = loc - data->center;
-    amps_array[idx_vol] = IVEC_LOOP_WEIGHT(s0, s1, e0, e1, 1) * amp * data->A(rel_loc);
+    amps_array[idx_vol] = IVEC_LOOP_WEIGHT(s0, s1, e0, e1, 1) * amp * A;
 
     /* for "D" sources, multiply by epsilon.  FIXME: this is not quite
        right because it doesn't handle non-diagonal chi1inv!
@@ -297,9 +475,17 @@ static void src_vol_chunkloop(fields_chunk *fc, int ichunk, component c, ivec is
     index_array[idx_vol++] = idx;
   }
 
+  delete[] box_amps;
   if (idx_vol > npts) abort("add_volume_source: computed wrong npts (%zd vs. %zd)", npts, idx_vol);
 
-  src_vol *tmp = new src_vol(c, data->src, idx_vol, index_array, amps_array);
+  src_vol *tmp;
+  if (idx_vol == npts && npts > 0) {
+    // every point of the box is owned, so store it as a box rather than an index list
+    tmp = new src_vol(c, data->src, index_array[0], nbox, sbox, amps_array);
+    delete[] index_array;
+  }
+  else
+    tmp = new src_vol(c, data->src, idx_vol, index_array, amps_array);
   field_type ft = is_magnetic(c) ? B_stuff : D_stuff;
   fc->sources[ft] = tmp->add_to(fc->sources[ft]);
 }
@@ -352,8 +538,8 @@ void fields::add_volume_source(component c, const src_time &src, const volume &w
   amp_file_dims[2] = dim3;
 
   size_t total_size = dim1 * dim2 * dim3;
-  amp_func_data_re = new double[total_size];
-  amp_func_data_im = new double[total_size];
+  amp_func_data_re = new realnum[total_size];
+  amp_func_data_im = new realnum[total_size];
 
   for (size_t i = 0; i < total_size; ++i) {
     amp_func_data_re[i] = real(arr[i]);
@@ -377,13 +563,13 @@ void fields::add_volume_source(component c, const src_time &src, const volume &w
   std::string dataset_im = std::string(dataset) + ".im";
 
   size_t re_dims[] = {1, 1, 1};
-  double *real_data = eps_file.read(dataset_re.c_str(), &rank, re_dims, 3);
+  realnum *real_data = eps_file.read(dataset_re.c_str(), &rank, re_dims, 3);
   if (verbosity > 0)
     master_printf("read in %zdx%zdx%zd amplitude function file \"%s:%s\"\n", re_dims[0], re_dims[1],
                   re_dims[2], filename, dataset_re.c_str());
 
   size_t im_dims[] = {1, 1, 1};
-  double *imag_data = eps_file.read(dataset_im.c_str(), &rank, im_dims, 3);
+  realnum *imag_data = eps_file.read(dataset_im.c_str(), &rank, im_dims, 3);
   if (verbosity > 0)
     master_printf("read in %zdx%zdx%zd amplitude function file \"%s:%s\"\n", im_dims[0], im_dims[1],
                   im_dims[2], filename, dataset_im.c_str());
@@ -409,6 +595,12 @@ void fields::add_volume_source(component c, const src_time &src, const volume &w
 
 void fields::add_volume_source(component c, const src_time &src, const volume &where_,
                                complex<double> A(const vec &), complex<double> amp) {
+  complex<double> (*f)(const vec &) = A ? A : one;
+  add_volume_source(c, src, where_, pointwise_amplitudes, (void *)&f, amp);
+}
+
+void fields::add_volume_source(component c, const src_time &src, const volume &where_,
+                               amplitude_box_function A, void *A_data, complex<double> amp) {
   volume where(where_); // make a copy to adjust size if necessary
   if (gv.dim != where.dim)
     abort("incorrect source grid_volume dimensionality in add_volume_source");
@@ -424,7 +616,8 @@ void fields::add_volume_source(component c, const src_time &src, const volume &w
   }
 
   src_vol_chunkloop_data data;
-  data.A = A ? A : one;
+  data.A = A;
+  data.A_data = A_data;
   data.amp = amp;
   LOOP_OVER_DIRECTIONS(gv.dim, d) {
     if (where.in_direction(d) == 0.0 && !nosize_direction(d)) // delta-fun
@@ -24,6 +24,10 @@
 
 #include "config.h"
 
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
 #define RESTRICT
 
 using namespace std;
@@ -31,8 +35,46 @@ using namespace std;
 namespace meep {
 
 void fields::step() {
+  const int save_synchronized_magnetic_fields = step_begin();
+
+  calc_sources(time()); // for B sources
+  step_db(B_stuff);
+  step_source(B_stuff);
+  step_boundaries(B_stuff);
+  calc_sources(time() + 0.5 * dt); // for integrated H sources
+  update_eh(H_stuff);
+  step_boundaries(WH_stuff);
+  update_pols(H_stuff);
+  step_boundaries_start(PH_stuff);
+  step_boundaries_start(H_stuff);
+  step_boundaries_finish(PH_stuff);
+  step_boundaries_finish(H_stuff);
+
+  if (fluxes) fluxes->update_half();
+
+  calc_sources(time() + 0.5 * dt); // for D sources
+  step_db(D_stuff);
+  step_source(D_stuff);
+  step_boundaries(D_stuff);
+  calc_sources(time() + dt); // for integrated E sources
+  update_eh(E_stuff);
+  step_boundaries(WE_stuff);
+  update_pols(E_stuff);
+  step_boundaries_start(PE_stuff);
+  step_boundaries_start(E_stuff);
+  step_boundaries_finish(PE_stuff);
+  step_boundaries_finish(E_stuff);
+
+  if (fluxes) fluxes->update();
+  step_end(save_synchronized_magnetic_fields);
+}
+
+/* The bookkeeping at the start of each time step, before the B update:
+   returns the magnetic-field synchronization count to be passed to
+   step_end, which restores it after the step. */
+int fields::step_begin() {
   // however many times the fields have been synched, we want to restore now
-  int save_synchronized_magnetic_fields = synchronized_magnetic_fields;
+  const int save_synchronized_magnetic_fields = synchronized_magnetic_fields;
   if (synchronized_magnetic_fields) {
     synchronized_magnetic_fields = 1; // reset synchronization count
     restore_magnetic_fields();
@@ -55,47 +97,213 @@ void fields::step() {
 
   phase_material();
 
-  // update cached conductivity-inverse array, if needed
-  for (int i = 0; i < num_chunks; i++)
+  // update cached conductivity-inverse and nonlinear-box data, if needed
+  for (int i = 0; i < num_chunks; i++) {
     chunks[i]->s->update_condinv();
+    chunks[i]->s->update_nonlinear_box();
+  }
 
-  calc_sources(time()); // for B sources
-  step_db(B_stuff);
-  step_source(B_stuff);
-  step_boundaries(B_stuff);
-  calc_sources(time() + 0.5 * dt); // for integrated H sources
-  update_eh(H_stuff);
-  step_boundaries(WH_stuff);
-  update_pols(H_stuff);
-  step_boundaries(PH_stuff);
-  step_boundaries(H_stuff);
-
-  if (fluxes) fluxes->update_half();
-
-  calc_sources(time() + 0.5 * dt); // for D sources
-  step_db(D_stuff);
-  step_source(D_stuff);
-  step_boundaries(D_stuff);
-  calc_sources(time() + dt); // for integrated E sources
-  update_eh(E_stuff);
-  step_boundaries(WE_stuff);
-  update_pols(E_stuff);
-  step_boundaries(PE_stuff);
-  step_boundaries(E_stuff);
+  return save_synchronized_magnetic_fields;
+}
 
-  if (fluxes) fluxes->update();
+void fields::step_end(int save_synchronized_magnetic_fields) {
   t += 1;
   update_dfts();
   finished_working();
 
+  // the fields are allocated lazily, so report the memory after the first step
+  if (t == 1 && verbosity > 0) print_memory_usage();
+
+  if (dft_checkpoint_fname &&
+      broadcast(0, wall_time() > last_dft_checkpoint_wall_time + dft_checkpoint_interval)) {
+    save_dft_checkpoint(dft_checkpoint_fname);
+    last_dft_checkpoint_wall_time = wall_time();
+  }
+
   // re-synch magnetic fields if they were previously synchronized
   if (save_synchronized_magnetic_fields) {
-    synchronize_magnetic_fields();
+    synchronize_magnetic_chunks(synched_chunks);
     synchronized_magnetic_fields = save_synchronized_magnetic_fields;
   }
 
-  if (!std::isfinite(get_field(D_EnergyDensity, gv.center(), false)))
-    abort("simulation fields are NaN or Inf");
+  if (nan_check_interval > 0 && t % nan_check_interval == 0)
+    for (int i = 0; i < num_chunks; i++)
+      if (chunks[i]->is_mine() && !chunks[i]->fields_are_finite())
+        abort("simulation fields are NaN or Inf");
+}
+
+int fields::run_steps(int nsteps, step_action **actions, int num_actions, double max_wall_time) {
+  double start = wall_time();
+  int n = 0, next_check = 1;
+  while (n < nsteps) {
+    step();
+    ++n;
+    bool stop = false;
+    for (int i = 0; i < num_actions; ++i) // evaluate all of them, as at each step
+      stop = actions[i]->check(*this) || stop;
+    if (stop) break;
+    // the master's clock decides, so the processes must agree on the steps
+    // at which it is read: the next check is scheduled about halfway to
+    // the estimated end of max_wall_time, at most doubling the steps so far
+    if (max_wall_time > 0 && n == next_check) {
+      int more = 0; // steps to the next check, or 0 to stop
+      if (am_master()) {
+        double elapsed = wall_time() - start;
+        if (elapsed < max_wall_time) {
+          double est = elapsed > 0 ? 0.5 * n * (max_wall_time - elapsed) / elapsed : n;
+          more = max(1, int(min(double(n), est)));
+        }
+      }
+      more = broadcast(0, more);
+      if (!more) break;
+      next_check = n + more;
+    }
+  }
+  return n;
+}
+
+fields_batch::fields_batch(fields **fs_, int num_fields_) : num_fields(num_fields_) {
+  if (num_fields < 1) abort("fields_batch needs at least one fields object");
+  fs = new fields *[num_fields];
+  for (int k = 0; k < num_fields; k++) {
+    fs[k] = fs_[k];
+    if (fs[k]->num_chunks != fs[0]->num_chunks || fs[k]->dt != fs[0]->dt)
+      abort("fields in a fields_batch must be created from the same structure");
+    for (int i = 0; i < fs[0]->num_chunks; i++)
+      if (fs[k]->chunks[i]->s != fs[0]->chunks[i]->s)
+        abort("fields in a fields_batch must share the same structure chunks");
+  }
+}
+
+/* The same sequence of updates as fields::step, where the chunk-local
+   sweeps (step_db, update_eh, update_pols) are interleaved over the
+   fields; the sources and boundary communications are per fields, since
+   they are independent of the material arrays. */
+void fields_batch::step() {
+  std::vector<int> save_synch(num_fields);
+  for (int k = 0; k < num_fields; k++)
+    save_synch[k] = fs[k]->step_begin();
+
+  for (int k = 0; k < num_fields; k++)
+    fs[k]->calc_sources(fs[k]->time()); // for B sources
+  update_chunks(STEP_DB, B_stuff);
+  for (int k = 0; k < num_fields; k++) {
+    fs[k]->step_source(B_stuff);
+    fs[k]->step_boundaries(B_stuff);
+    fs[k]->calc_sources(fs[k]->time() + 0.5 * fs[k]->dt); // for integrated H sources
+  }
+  update_chunks(UPDATE_EH, H_stuff);
+  for (int k = 0; k < num_fields; k++)
+    fs[k]->step_boundaries(WH_stuff);
+  update_chunks(UPDATE_POLS, H_stuff);
+  for (int k = 0; k < num_fields; k++) {
+    fields *f = fs[k];
+    f->step_boundaries_start(PH_stuff);
+    f->step_boundaries_start(H_stuff);
+    f->step_boundaries_finish(PH_stuff);
+    f->step_boundaries_finish(H_stuff);
+    if (f->fluxes) f->fluxes->update_half();
+    f->calc_sources(f->time() + 0.5 * f->dt); // for D sources
+  }
+
+  update_chunks(STEP_DB, D_stuff);
+  for (int k = 0; k < num_fields; k++) {
+    fs[k]->step_source(D_stuff);
+    fs[k]->step_boundaries(D_stuff);
+    fs[k]->calc_sources(fs[k]->time() + fs[k]->dt); // for integrated E sources
+  }
+  update_chunks(UPDATE_EH, E_stuff);
+  for (int k = 0; k < num_fields; k++)
+    fs[k]->step_boundaries(WE_stuff);
+  update_chunks(UPDATE_POLS, E_stuff);
+  for (int k = 0; k < num_fields; k++) {
+    fields *f = fs[k];
+    f->step_boundaries_start(PE_stuff);
+    f->step_boundaries_start(E_stuff);
+    f->step_boundaries_finish(PE_stuff);
+    f->step_boundaries_finish(E_stuff);
+    if (f->fluxes) f->fluxes->update();
+    f->step_end(save_synch[k]);
+  }
+}
+
+void fields_batch::run_steps(int nsteps) {
+  for (int n = 0; n < nsteps; ++n)
+    step();
+}
+
+bool fields_batch::parallel_chunk_loops() const { return fs[0]->parallel_chunk_loops(); }
+
+/* The interleaved sweeps: chunk i of every fields is updated by the same
+   thread, one after the other, while its structure_chunk is in cache.
+   Any newly allocated field components invalidate the chunk connections
+   of that fields only. */
+void fields_batch::update_chunks(chunk_update what, field_type ft) {
+  const int num_chunks = fs[0]->num_chunks;
+  std::vector<char> changed(size_t(num_chunks) * num_fields, 0); // [i*num_fields + k]
+  const bool thread_chunks = parallel_chunk_loops();
+  (void)thread_chunks; // unused without OpenMP
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) if (thread_chunks)
+#endif
+  for (int i = 0; i < num_chunks; i++)
+    if (fs[0]->chunks[i]->is_mine())
+      for (int k = 0; k < num_fields; k++) {
+        fields_chunk *fc = fs[k]->chunks[i];
+        const double t0 = wall_time();
+        step_phase phase = StepCurl;
+        switch (what) {
+          case STEP_DB: changed[i * num_fields + k] = fc->step_db(ft); break;
+          case UPDATE_EH:
+            changed[i * num_fields + k] = fc->update_eh(ft);
+            phase = StepConstitutive;
+            break;
+          case UPDATE_POLS:
+            changed[i * num_fields + k] = fc->update_pols(ft);
+            phase = StepPolarizations;
+            break;
+        }
+        const double dt_wall = wall_time() - t0;
+        fc->cost_time += dt_wall;
+        fc->phase_time[phase] += dt_wall;
+      }
+  for (int i = 0; i < num_chunks; i++)
+    for (int k = 0; k < num_fields; k++)
+      if (changed[i * num_fields + k]) fs[k]->chunk_connections_valid = false;
+}
+
+/* Whether all field values are finite.  This is a purely local check, so
+   step() can abort without communicating. */
+bool fields_chunk::fields_are_finite() const {
+  bool nonfinite = false;
+  size_t n = gv.ntot();
+  FOR_COMPONENTS(c) DOCMP2 {
+    const realnum *fc = f[c][cmp];
+    if (!fc) continue;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for reduction(|| : nonfinite)
+#endif
+    for (ptrdiff_t i = 0; i < ptrdiff_t(n); ++i)
+      nonfinite = nonfinite || !std::isfinite(fc[i]);
+    if (nonfinite) return false;
+  }
+  return true;
+}
+
+/* With OpenMP, the threads can either be divided among the chunks owned
+   by this process (in step_db, update_eh, and update_pols), or used within
+   the loops over each chunk (the PLOOP_* macros, e.g. in step_generic.cpp).
+   Threading over chunks has less overhead and synchronization, so we
+   prefer it whenever there are enough chunks to keep all threads busy. */
+bool fields::parallel_chunk_loops() const {
+#ifdef HAVE_OPENMP
+  int num_mine = 0;
+  for (int i = 0; i < num_chunks; i++)
+    if (chunks[i]->is_mine()) num_mine++;
+  return num_mine > 1 && num_mine >= omp_get_max_threads();
+#else
+  return false;
+#endif
 }
 
 void fields::phase_material() {
@@ -129,9 +337,24 @@ void fields_chunk::phase_material(int phasein_time) {
 }
 
 void fields::step_boundaries(field_type ft) {
+  step_boundaries_start(ft);
+  step_boundaries_finish(ft);
+}
+
+/* step_boundaries is split into two halves: the first half zeros the
+   metals, copies the outgoing data to the comm_blocks buffers and starts
+   the (non-blocking) communications, while the second half waits for the
+   communications and copies the incoming data into the fields.  This
+   lets us have the messages for independent field types (e.g. PE_stuff
+   and E_stuff) in flight at the same time, rather than waiting for
+   each in turn.  Any number of field types may be started before they
+   are finished, as long as nothing in between modifies those fields or
+   the chunk connections. */
+void fields::step_boundaries_start(field_type ft) {
   connect_chunks(); // re-connect if !chunk_connections_valid
 
   am_now_working_on(MpiTime);
+  const double t0 = wall_time();
 
   // Do the metals first!
   for (int i = 0; i < num_chunks; i++)
@@ -149,6 +372,11 @@ void fields::step_boundaries(field_type ft) {
       int wh[3] = {0, 0, 0};
       for (int i = 0; i < num_chunks; i++) {
         const int pair = j + i * num_chunks;
+        if (chunks[i]->is_mine()) { // copied directly below
+          for (int ip = 0; ip < 3; ip++)
+            wh[ip] += comm_sizes[ft][ip][pair];
+          continue;
+        }
         size_t n0 = 0;
         for (int ip = 0; ip < 3; ip++) {
           for (size_t n = 0; n < comm_sizes[ft][ip][pair]; n++)
@@ -158,7 +386,51 @@ void fields::step_boundaries(field_type ft) {
       }
     }
 
-  boundary_communications(ft);
+  start_boundary_communications(ft);
+
+  /* ...and, while the messages are in flight, copy the data between pairs
+     of chunks on this process directly.  (The Outgoing points are all
+     owned points and the Incoming points are all not-owned points, so
+     this cannot interfere with the copying to and from comm_blocks.) */
+  const bool thread_chunks = parallel_chunk_loops();
+  (void)thread_chunks; // unused without OpenMP
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) if (thread_chunks)
+#endif
+  for (int l = 0; l < num_local_connections[ft]; l++) {
+    const local_connection &lc = local_connections[ft][l];
+    const int pair = lc.j + lc.i * num_chunks;
+    connect_phase ip = CONNECT_PHASE;
+    realnum **in = chunks[lc.i]->connections[ft][ip][Incoming] + lc.incoming[ip];
+    realnum **out = chunks[lc.j]->connections[ft][ip][Outgoing] + lc.outgoing[ip];
+    const complex<realnum> *phase = chunks[lc.i]->connection_phases[ft] + lc.incoming[ip] / 2;
+    for (size_t n = 0; n < comm_sizes[ft][ip][pair]; n += 2) {
+      const double phr = real(phase[n / 2]);
+      const double phi = imag(phase[n / 2]);
+      const double outr = *out[n], outi = *out[n + 1];
+      *in[n] = phr * outr - phi * outi;
+      *in[n + 1] = phr * outi + phi * outr;
+    }
+    ip = CONNECT_NEGATE;
+    in = chunks[lc.i]->connections[ft][ip][Incoming] + lc.incoming[ip];
+    out = chunks[lc.j]->connections[ft][ip][Outgoing] + lc.outgoing[ip];
+    for (size_t n = 0; n < comm_sizes[ft][ip][pair]; ++n)
+      *in[n] = -*out[n];
+    ip = CONNECT_COPY;
+    in = chunks[lc.i]->connections[ft][ip][Incoming] + lc.incoming[ip];
+    out = chunks[lc.j]->connections[ft][ip][Outgoing] + lc.outgoing[ip];
+    for (size_t n = 0; n < comm_sizes[ft][ip][pair]; ++n)
+      *in[n] = *out[n];
+  }
+
+  boundary_times[ft] += wall_time() - t0;
+  finished_working();
+}
+
+void fields::step_boundaries_finish(field_type ft) {
+  am_now_working_on(MpiTime);
+  const double t0 = wall_time();
+  finish_boundary_communications(ft);
 
   // Finally, copy incoming data to the fields themselves, multiplying phases:
   for (int i = 0; i < num_chunks; i++)
@@ -166,6 +438,11 @@ void fields::step_boundaries(field_type ft) {
       int wh[3] = {0, 0, 0};
       for (int j = 0; j < num_chunks; j++) {
         const int pair = j + i * num_chunks;
+        if (chunks[j]->is_mine()) { // already copied by step_boundaries_start
+          for (int ip = 0; ip < 3; ip++)
+            wh[ip] += comm_sizes[ft][ip][pair];
+          continue;
+        }
         connect_phase ip = CONNECT_PHASE;
         for (size_t n = 0; n < comm_sizes[ft][ip][pair]; n += 2, wh[ip] += 2) {
           const double phr = real(chunks[i]->connection_phases[ft][wh[ip] / 2]);
@@ -186,14 +463,33 @@ void fields::step_boundaries(field_type ft) {
       }
     }
 
+  boundary_times[ft] += wall_time() - t0;
   finished_working();
 }
 
 void fields::step_source(field_type ft, bool including_integrated) {
   if (ft != D_stuff && ft != B_stuff) abort("only step_source(D/B) is okay");
+  double hw_start[MEEP_MAX_HW_COUNTERS + 1];
+  hw_phase_begin(hw_start);
   for (int i = 0; i < num_chunks; i++)
-    if (chunks[i]->is_mine()) chunks[i]->step_source(ft, including_integrated);
+    if (steps_chunk(i)) {
+      const double t0 = wall_time();
+      chunks[i]->step_source(ft, including_integrated);
+      const double dt_wall = wall_time() - t0;
+      chunks[i]->cost_time += dt_wall;
+      chunks[i]->phase_time[StepSources] += dt_wall;
+    }
+  hw_phase_end(hw_start, StepSources);
 }
+
+namespace {
+struct src_vol_recompute {
+  realnum *fe;
+  const realnum *fd, *u;
+  void operator()(ptrdiff_t i, complex<double>) { fe[i] = u ? double(fd[i]) * u[i] : fd[i]; }
+};
+} // namespace
+
 void fields_chunk::step_source(field_type ft, bool including_integrated) {
   if (doing_solve_cw && !including_integrated) return;
   for (src_vol *sv = sources[ft]; sv; sv = sv->next) {
@@ -201,20 +497,18 @@ void fields_chunk::step_source(field_type ft, bool including_integrated) {
     const realnum *cndinv = s->condinv[c][component_direction(sv->c)];
     if ((including_integrated || !sv->t->is_integrated) && f[c][0] &&
         ((ft == D_stuff && is_electric(sv->c)) || (ft == B_stuff && is_magnetic(sv->c)))) {
-      if (cndinv)
-        for (size_t j = 0; j < sv->npts; j++) {
-          const ptrdiff_t i = sv->index[j];
-          const complex<double> A = sv->current(j) * dt * double(cndinv[i]);
-          f[c][0][i] -= real(A);
-          if (!is_real) f[c][1][i] -= imag(A);
-        }
-      else
-        for (size_t j = 0; j < sv->npts; j++) {
-          const complex<double> A = sv->current(j) * dt;
-          const ptrdiff_t i = sv->index[j];
-          f[c][0][i] -= real(A);
-          if (!is_real) f[c][1][i] -= imag(A);
-        }
+      sv->subtract_from(f[c][0], is_real ? NULL : f[c][1], sv->t->current() * dt, cndinv);
+
+      // recompute E/H at the source points if step_db already updated them
+      const component ec = field_type_component(ft == D_stuff ? E_stuff : H_stuff, c);
+      const realnum *u = s->chi1inv[ec][component_direction(ec)];
+      DOCMP if (eh_fused[ec][cmp]) {
+        src_vol_recompute op;
+        op.fe = f[ec][cmp];
+        op.fd = f[c][cmp];
+        op.u = u;
+        sv->loop_over_points(op);
+      }
     }
   }
 }
@@ -22,6 +22,7 @@
 
 #include "meep.hpp"
 #include "meep_internals.hpp"
+#include "config.h"
 
 #define RESTRICT
 
@@ -30,9 +31,54 @@ using namespace std;
 namespace meep {
 
 void fields::step_db(field_type ft) {
+  bool changed = false;
+  double hw_start[MEEP_MAX_HW_COUNTERS + 1];
+  hw_phase_begin(hw_start);
+  const bool thread_chunks = parallel_chunk_loops();
+  (void)thread_chunks; // unused without OpenMP
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(|| : changed) if (thread_chunks)
+#endif
   for (int i = 0; i < num_chunks; i++)
-    if (chunks[i]->is_mine())
-      if (chunks[i]->step_db(ft)) chunk_connections_valid = false;
+    if (steps_chunk(i)) {
+      const double t0 = wall_time();
+      if (chunks[i]->step_db(ft)) changed = true;
+      const double dt_wall = wall_time() - t0;
+      chunks[i]->cost_time += dt_wall;
+      chunks[i]->phase_time[StepCurl] += dt_wall;
+    }
+  hw_phase_end(hw_start, StepCurl);
+  if (changed) chunk_connections_valid = false;
+}
+
+/* For lossless chunks, we can apply E = chi1inv * D (or H = B / mu) in
+   the same sweep as the curl update of D (or B), which saves a pass over
+   the D/B arrays.  This requires that the E/H update for component
+   dc is purely local and diagonal and that nothing else modifies D/B in
+   between (no integrated sources, PML, conductivity, polarizations,
+   nonlinearity or off-diagonal chi1inv, beta, or cylindrical r=0 special
+   cases).  Ordinary current sources are fine, since step_source then
+   recomputes E/H at the source points.  This
+   is cheap to check, so we check it on each step rather than caching it
+   in the step plan, since materials and sources may change at any time.
+   (If E and D share the same array, there is no E update at all.) */
+bool fields_chunk::can_fuse_eh(component dc, int cmp) const {
+  const field_type ft = type(dc);
+  const field_type ft_eh = ft == D_stuff ? E_stuff : H_stuff;
+  const component ec = field_type_component(ft_eh, dc);
+  if (doing_solve_cw || pol[ft_eh] || s->chiP[ft_eh]) return false;
+  for (src_vol *sv = sources[ft]; sv; sv = sv->next)
+    if (sv->t->is_integrated) return false;
+  if (gv.dim == Dcyl || (gv.dim == D2 && beta != 0)) return false;
+  if (!f[ec][cmp] || f[ec][cmp] == f[dc][cmp] || f_w[ec][cmp] || f_u[dc][cmp]) return false;
+  const direction d_ec = component_direction(ec);
+  if (s->sigsize[d_ec] > 1 || s->conductivity[dc][d_ec] || s->chi2[ec] || s->chi3[ec])
+    return false;
+  for (int k = 1; k <= 2; ++k) {
+    const direction d_k = cycle_direction(gv.dim, d_ec, k);
+    if (s->chi1inv[ec][d_k] && f[direction_component(dc, d_k)][cmp]) return false;
+  }
+  return true;
 }
 
 bool fields_chunk::step_db(field_type ft) {
@@ -59,12 +105,12 @@ bool fields_chunk::step_db(field_type ft) {
       realnum *the_f = f[cc][cmp];
 
       if (dsig != NO_DIRECTION && s->conductivity[cc][d_c] && !f_cond[cc][cmp]) {
-        f_cond[cc][cmp] = new realnum[gv.ntot()];
-        memset(f_cond[cc][cmp], 0, sizeof(realnum) * gv.ntot());
+        f_cond[cc][cmp] = arena->alloc();
+        array_fill(f_cond[cc][cmp], gv.ntot(), 0.0);
       }
       if (dsigu != NO_DIRECTION && !f_u[cc][cmp]) {
-        f_u[cc][cmp] = new realnum[gv.ntot()];
-        memcpy(f_u[cc][cmp], the_f, gv.ntot() * sizeof(realnum));
+        f_u[cc][cmp] = arena->alloc();
+        array_copy(f_u[cc][cmp], the_f, gv.ntot());
         allocated_u = true;
       }
 
@@ -91,7 +137,7 @@ bool fields_chunk::step_db(field_type ft) {
                and get the correct derivative.  (More precisely,
                the derivative and integral are replaced by differences
                and sums, but you get the idea). */
-            if (!f_rderiv_int) f_rderiv_int = new realnum[gv.ntot()];
+            if (!f_rderiv_int) f_rderiv_int = arena->alloc();
             double ir0 = gv.origin_r() * gv.a + 0.5 * gv.iyee_shift(c_p).in_direction(R);
             for (int iz = 0; iz <= gv.nz(); ++iz)
               f_rderiv_int[iz] = 0;
@@ -111,10 +157,17 @@ bool fields_chunk::step_db(field_type ft) {
           default: abort("bug - non-cylindrical field component in Dcyl");
         }
 
-      STEP_CURL(the_f, cc, f_p, f_m, stride_p, stride_m, gv, Courant, dsig, s->sig[dsig],
-                s->kap[dsig], s->siginv[dsig], f_u[cc][cmp], dsigu, s->sig[dsigu], s->kap[dsigu],
-                s->siginv[dsigu], dt, s->conductivity[cc][d_c], s->condinv[cc][d_c],
-                f_cond[cc][cmp]);
+      if (dsig == NO_DIRECTION && dsigu == NO_DIRECTION && can_fuse_eh(cc, cmp)) {
+        const component ec = field_type_component(ft == D_stuff ? E_stuff : H_stuff, cc);
+        STEP_FUSED_CURL(the_f, f[ec][cmp], cc, f_p, f_m, stride_p, stride_m, gv, Courant,
+                        s->chi1inv[ec][d_c]);
+        eh_fused[ec][cmp] = true;
+      }
+      else
+        STEP_CURL(the_f, cc, f_p, f_m, stride_p, stride_m, gv, Courant, dsig, s->sig[dsig],
+                  s->kap[dsig], s->siginv[dsig], f_u[cc][cmp], dsigu, s->sig[dsigu],
+                  s->kap[dsigu], s->siginv[dsigu], dt, s->conductivity[cc][d_c],
+                  s->condinv[cc][d_c], f_cond[cc][cmp]);
     }
   }
 
@@ -5,6 +5,27 @@
 #define DPR double *restrict
 #define RPR realnum *restrict
 
+/* On x86 with a compiler that supports function multiversioning, each
+   kernel below is compiled several times, for AVX-512, AVX2, and the
+   baseline instruction set, and the dynamic loader picks the best
+   version for the running CPU.  This lets the (unit-stride) inner
+   loops be vectorized with wide registers without building all of
+   Meep with -march=native.  Define MEEP_NO_SIMD_CLONES to disable. */
+#if defined(HAVE_TARGET_CLONES) && !defined(MEEP_NO_SIMD_CLONES)
+#define SIMD_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define SIMD_CLONES
+#endif
+
+/* The per-case loops are static templates that must be inlined into the
+   (multiversioned) functions that call them, so that each SIMD version of
+   a kernel gets its own copy of the loops. */
+#if defined(__GNUC__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
 /* These macros get into the guts of the LOOP_OVER_VOL loops to
    efficiently construct the index k into a PML sigma array.
    Basically, k needs to increment by 2 for each increment of one of
@@ -12,6 +33,8 @@
    and these macros define the relevant strides etc. for each loop.
    KSTRIDE_DEF defines the relevant strides etc. and goes outside the
    LOOP, wheras KDEF defines the k index and goes inside the LOOP. */
+/* (All of the loops in this file are PLOOP_* loops, which are divided
+   among OpenMP threads if Meep is compiled --with-openmp; see vec.hpp.) */
 #define KSTRIDE_DEF(dsig, k, corner)                                                               \
   const int k##0 = corner.in_direction(dsig) - gv.little_corner().in_direction(dsig);              \
   const int s##k##1 = gv.yucky_direction(0) == dsig ? 2 : 0;                                       \
@@ -64,6 +87,53 @@ namespace meep {
        df/dt = dfu/dt - sigma_u * f
    and fu replaces f in the equations above (fu += dt curl g etcetera).
 */
+
+/* The loop for each special case of step_curl is an instantiation of
+   this template, whose (compile-time) parameters say which terms of
+   the most general case are present: PML in the f update (dsig), the
+   fu auxiliary field (dsigu), conductivity, and the g2 derivative.
+   Since the parameters are constants, the compiler removes the unused
+   terms from each inner loop, which is what we used to do by hand with
+   a dozen copies of the loop.  (KSTRIDE_DEF is given a dummy direction
+   when dsig or dsigu are not used, in which case k or ku is unused.) */
+template <bool PML, bool PMLU, bool COND, bool G2>
+static ALWAYS_INLINE void curl_kernel(RPR f, component c, const RPR g1, const RPR g2,
+                                      ptrdiff_t s1, ptrdiff_t s2, const grid_volume &gv,
+                                      double dtdx, direction dsig, const DPR sig, const DPR kap,
+                                      const DPR siginv, RPR fu, direction dsigu, const DPR sigu,
+                                      const DPR kapu, const DPR siginvu, double dt, const RPR cnd,
+                                      const RPR cndinv, RPR fcnd) {
+  const direction dk = PML ? dsig : X, dku = PMLU ? dsigu : X;
+  KSTRIDE_DEF(dk, k, gv.little_owned_corner0(c));
+  KSTRIDE_DEF(dku, ku, gv.little_owned_corner0(c));
+  const double dt2 = dt * 0.5;
+#define THE_F (PMLU ? fu : f) // the field updated from curl g
+  PLOOP_OVER_VOL_OWNED0(gv, c, i) {
+    const realnum dg = G2 ? g1[i + s1] - g1[i] + g2[i] - g2[i + s2] : g1[i + s1] - g1[i];
+    const double fprev = PMLU ? fu[i] : 0;
+    if (PML && COND) {
+      DEF_k;
+      realnum fcnd_prev = fcnd[i];
+      fcnd[i] = ((1 - dt2 * cnd[i]) * fcnd[i] - dtdx * dg) * cndinv[i];
+      THE_F[i] = ((kap[k] - sig[k]) * THE_F[i] + (fcnd[i] - fcnd_prev)) * siginv[k];
+    }
+    else if (PML) {
+      DEF_k;
+      THE_F[i] = ((kap[k] - sig[k]) * THE_F[i] - dtdx * dg) * siginv[k];
+    }
+    else if (COND)
+      THE_F[i] = ((1 - dt2 * cnd[i]) * THE_F[i] - dtdx * dg) * cndinv[i];
+    else
+      THE_F[i] -= dtdx * dg;
+    if (PMLU) {
+      DEF_ku;
+      f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
+    }
+  }
+#undef THE_F
+}
+
+SIMD_CLONES
 void step_curl(RPR f, component c, const RPR g1, const RPR g2, ptrdiff_t s1,
                ptrdiff_t s2, // strides for g1/g2 shift
                const grid_volume &gv, double dtdx, direction dsig, const DPR sig, const DPR kap,
@@ -75,174 +145,72 @@ void step_curl(RPR f, component c, const RPR g1, const RPR g2, ptrdiff_t s1,
     dtdx = -dtdx; // need to flip derivative sign
   }
 
-  /* The following are a bunch of special cases of the "MOST GENERAL CASE"
-     loop below.  We make copies of the loop for each special case in
-     order to keep the innermost loop efficient.  This is especially
-     important because the non-PML cases are actually more common.
-     (The "right" way to do this is by partial evaluation of the
-      most general case, but that would require a code generator.) */
-
-  if (dsig == NO_DIRECTION) {    // no PML in f update
-    if (dsigu == NO_DIRECTION) { // no fu update
-      if (cnd) {
-        double dt2 = dt * 0.5;
-        if (g2) {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            f[i] = ((1 - dt2 * cnd[i]) * f[i] - dtdx * (g1[i + s1] - g1[i] + g2[i] - g2[i + s2])) *
-                   cndinv[i];
-          }
-        }
-        else {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            f[i] = ((1 - dt2 * cnd[i]) * f[i] - dtdx * (g1[i + s1] - g1[i])) * cndinv[i];
-          }
-        }
-      }
-      else { // no conductivity
-        if (g2) {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            f[i] -= dtdx * (g1[i + s1] - g1[i] + g2[i] - g2[i + s2]);
-          }
-        }
-        else {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) { f[i] -= dtdx * (g1[i + s1] - g1[i]); }
-        }
+#define CURL_KERNEL(PML, PMLU, COND, G2)                                                           \
+  curl_kernel<PML, PMLU, COND, G2>(f, c, g1, g2, s1, s2, gv, dtdx, dsig, sig, kap, siginv, fu,     \
+                                   dsigu, sigu, kapu, siginvu, dt, cnd, cndinv, fcnd);             \
+  break
+
+  switch ((dsig != NO_DIRECTION) * 8 + (dsigu != NO_DIRECTION) * 4 + (cnd != NULL) * 2 +
+          (g2 != NULL)) {
+    case 0: CURL_KERNEL(false, false, false, false);
+    case 1: CURL_KERNEL(false, false, false, true);
+    case 2: CURL_KERNEL(false, false, true, false);
+    case 3: CURL_KERNEL(false, false, true, true);
+    case 4: CURL_KERNEL(false, true, false, false);
+    case 5: CURL_KERNEL(false, true, false, true);
+    case 6: CURL_KERNEL(false, true, true, false);
+    case 7: CURL_KERNEL(false, true, true, true);
+    case 8: CURL_KERNEL(true, false, false, false);
+    case 9: CURL_KERNEL(true, false, false, true);
+    case 10: CURL_KERNEL(true, false, true, false);
+    case 11: CURL_KERNEL(true, false, true, true);
+    case 12: CURL_KERNEL(true, true, false, false);
+    case 13: CURL_KERNEL(true, true, false, true);
+    case 14: CURL_KERNEL(true, true, true, false);
+    case 15: CURL_KERNEL(true, true, true, true); //////// MOST GENERAL CASE ////////
+  }
+#undef CURL_KERNEL
+}
+
+/* fused version of step_curl followed by step_update_EDHB, for the
+   common lossless case with no PML, conductivity, nonlinearity, or
+   off-diagonal u: f += dt curl g as in step_curl (without any of the
+   PML or conductivity terms), and then fe = u * f (or fe = f if u is
+   NULL) in the same pass, so that f does not have to be read again. */
+SIMD_CLONES
+void step_fused_curl(RPR f, RPR fe, component c, const RPR g1, const RPR g2, ptrdiff_t s1,
+                     ptrdiff_t s2, const grid_volume &gv, double dtdx, const RPR u) {
+  if (!g1) { // swap g1 and g2
+    SWAP(const RPR, g1, g2);
+    SWAP(ptrdiff_t, s1, s2);
+    dtdx = -dtdx; // need to flip derivative sign
+  }
+
+  if (u) {
+    if (g2) {
+      PLOOP_OVER_VOL_OWNED0(gv, c, i) {
+        f[i] -= dtdx * (g1[i + s1] - g1[i] + g2[i] - g2[i + s2]);
+        fe[i] = double(f[i]) * u[i];
       }
     }
-    else { // fu update, no PML in f update
-      KSTRIDE_DEF(dsigu, ku, gv.little_owned_corner0(c));
-      if (cnd) {
-        double dt2 = dt * 0.5;
-        if (g2) {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            DEF_ku;
-            double fprev = fu[i];
-            fu[i] =
-                ((1 - dt2 * cnd[i]) * fprev - dtdx * (g1[i + s1] - g1[i] + g2[i] - g2[i + s2])) *
-                cndinv[i];
-            f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-          }
-        }
-        else {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            DEF_ku;
-            double fprev = fu[i];
-            fu[i] = ((1 - dt2 * cnd[i]) * fprev - dtdx * (g1[i + s1] - g1[i])) * cndinv[i];
-            f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-          }
-        }
-      }
-      else { // no conductivity
-        if (g2) {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            DEF_ku;
-            double fprev = fu[i];
-            fu[i] -= dtdx * (g1[i + s1] - g1[i] + g2[i] - g2[i + s2]);
-            f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-          }
-        }
-        else {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            DEF_ku;
-            double fprev = fu[i];
-            fu[i] -= dtdx * (g1[i + s1] - g1[i]);
-            f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-          }
-        }
+    else {
+      PLOOP_OVER_VOL_OWNED0(gv, c, i) {
+        f[i] -= dtdx * (g1[i + s1] - g1[i]);
+        fe[i] = double(f[i]) * u[i];
       }
     }
   }
-  else { /* PML in f update */
-    KSTRIDE_DEF(dsig, k, gv.little_owned_corner0(c));
-    if (dsigu == NO_DIRECTION) { // no fu update
-      if (cnd) {
-        double dt2 = dt * 0.5;
-        if (g2) {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            DEF_k;
-            realnum fcnd_prev = fcnd[i];
-            fcnd[i] =
-                ((1 - dt2 * cnd[i]) * fcnd[i] - dtdx * (g1[i + s1] - g1[i] + g2[i] - g2[i + s2])) *
-                cndinv[i];
-            f[i] = ((kap[k] - sig[k]) * f[i] + (fcnd[i] - fcnd_prev)) * siginv[k];
-          }
-        }
-        else {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            DEF_k;
-            realnum fcnd_prev = fcnd[i];
-            fcnd[i] = ((1 - dt2 * cnd[i]) * fcnd[i] - dtdx * (g1[i + s1] - g1[i])) * cndinv[i];
-            f[i] = ((kap[k] - sig[k]) * f[i] + (fcnd[i] - fcnd_prev)) * siginv[k];
-          }
-        }
-      }
-      else { // no conductivity (other than PML conductivity)
-        if (g2) {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            DEF_k;
-            f[i] = ((kap[k] - sig[k]) * f[i] - dtdx * (g1[i + s1] - g1[i] + g2[i] - g2[i + s2])) *
-                   siginv[k];
-          }
-        }
-        else {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            DEF_k;
-            f[i] = ((kap[k] - sig[k]) * f[i] - dtdx * (g1[i + s1] - g1[i])) * siginv[k];
-          }
-        }
+  else {
+    if (g2) {
+      PLOOP_OVER_VOL_OWNED0(gv, c, i) {
+        f[i] -= dtdx * (g1[i + s1] - g1[i] + g2[i] - g2[i + s2]);
+        fe[i] = f[i];
       }
     }
-    else { // fu update + PML in f update
-      KSTRIDE_DEF(dsigu, ku, gv.little_owned_corner0(c));
-      if (cnd) {
-        double dt2 = dt * 0.5;
-        if (g2) {
-          //////////////////// MOST GENERAL CASE //////////////////////
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            DEF_k;
-            DEF_ku;
-            double fprev = fu[i];
-            realnum fcnd_prev = fcnd[i];
-            fcnd[i] =
-                ((1 - dt2 * cnd[i]) * fcnd[i] - dtdx * (g1[i + s1] - g1[i] + g2[i] - g2[i + s2])) *
-                cndinv[i];
-            fu[i] = ((kap[k] - sig[k]) * fu[i] + (fcnd[i] - fcnd_prev)) * siginv[k];
-            f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-          }
-          /////////////////////////////////////////////////////////////
-        }
-        else {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            DEF_k;
-            DEF_ku;
-            double fprev = fu[i];
-            realnum fcnd_prev = fcnd[i];
-            fcnd[i] = ((1 - dt2 * cnd[i]) * fcnd[i] - dtdx * (g1[i + s1] - g1[i])) * cndinv[i];
-            fu[i] = ((kap[k] - sig[k]) * fu[i] + (fcnd[i] - fcnd_prev)) * siginv[k];
-            f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-          }
-        }
-      }
-      else { // no conductivity (other than PML conductivity)
-        if (g2) {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            DEF_k;
-            DEF_ku;
-            double fprev = fu[i];
-            fu[i] = ((kap[k] - sig[k]) * fu[i] - dtdx * (g1[i + s1] - g1[i] + g2[i] - g2[i + s2])) *
-                    siginv[k];
-            f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-          }
-        }
-        else {
-          LOOP_OVER_VOL_OWNED0(gv, c, i) {
-            DEF_k;
-            DEF_ku;
-            double fprev = fu[i];
-            fu[i] = ((kap[k] - sig[k]) * fu[i] - dtdx * (g1[i + s1] - g1[i])) * siginv[k];
-            f[i] = siginvu[ku] * ((kapu[ku] - sigu[ku]) * f[i] + fu[i] - fprev);
-          }
-        }
+    else {
+      PLOOP_OVER_VOL_OWNED0(gv, c, i) {
+        f[i] -= dtdx * (g1[i + s1] - g1[i]);
+        fe[i] = f[i];
       }
     }
   }
@@ -252,6 +220,7 @@ void step_curl(RPR f, component c, const RPR g1, const RPR g2, ptrdiff_t s1,
    and/or PML).  This is used in 2d calculations to add an exp(i beta z)
    time dependence, which gives an additional i \beta \hat{z} \times
    cross-product in the curl equations. */
+SIMD_CLONES
 void step_beta(RPR f, component c, const RPR g, const grid_volume &gv, double betadt,
                direction dsig, const DPR siginv, RPR fu, direction dsigu, const DPR siginvu,
                const RPR cndinv, RPR fcnd) {
@@ -262,7 +231,7 @@ void step_beta(RPR f, component c, const RPR g, const grid_volume &gv, double be
       KSTRIDE_DEF(dsigu, ku, gv.little_owned_corner0(c));
       if (cndinv) { // conductivity + PML
         //////////////////// MOST GENERAL CASE //////////////////////
-        LOOP_OVER_VOL_OWNED0(gv, c, i) {
+        PLOOP_OVER_VOL_OWNED0(gv, c, i) {
           DEF_k;
           DEF_ku;
           double df;
@@ -274,7 +243,7 @@ void step_beta(RPR f, component c, const RPR g, const grid_volume &gv, double be
         /////////////////////////////////////////////////////////////
       }
       else { // PML only
-        LOOP_OVER_VOL_OWNED0(gv, c, i) {
+        PLOOP_OVER_VOL_OWNED0(gv, c, i) {
           DEF_k;
           DEF_ku;
           double df;
@@ -285,7 +254,7 @@ void step_beta(RPR f, component c, const RPR g, const grid_volume &gv, double be
     }
     else {          // PML in f, no fu
       if (cndinv) { // conductivity + PML
-        LOOP_OVER_VOL_OWNED0(gv, c, i) {
+        PLOOP_OVER_VOL_OWNED0(gv, c, i) {
           DEF_k;
           double dfcnd = betadt * g[i] * cndinv[i];
           fcnd[i] += dfcnd;
@@ -293,7 +262,7 @@ void step_beta(RPR f, component c, const RPR g, const grid_volume &gv, double be
         }
       }
       else { // PML only
-        LOOP_OVER_VOL_OWNED0(gv, c, i) {
+        PLOOP_OVER_VOL_OWNED0(gv, c, i) {
           DEF_k;
           f[i] += betadt * g[i] * siginv[k];
         }
@@ -304,7 +273,7 @@ void step_beta(RPR f, component c, const RPR g, const grid_volume &gv, double be
     if (dsigu != NO_DIRECTION) { // fu, no PML in f
       KSTRIDE_DEF(dsigu, ku, gv.little_owned_corner0(c));
       if (cndinv) { // conductivity, no PML
-        LOOP_OVER_VOL_OWNED0(gv, c, i) {
+        PLOOP_OVER_VOL_OWNED0(gv, c, i) {
           DEF_ku;
           double df;
           fu[i] += (df = betadt * g[i] * cndinv[i]);
@@ -312,7 +281,7 @@ void step_beta(RPR f, component c, const RPR g, const grid_volume &gv, double be
         }
       }
       else { // no conductivity or PML
-        LOOP_OVER_VOL_OWNED0(gv, c, i) {
+        PLOOP_OVER_VOL_OWNED0(gv, c, i) {
           DEF_ku;
           double df;
           fu[i] += (df = betadt * g[i]);
@@ -322,10 +291,10 @@ void step_beta(RPR f, component c, const RPR g, const grid_volume &gv, double be
     }
     else {          // no PML, no fu
       if (cndinv) { // conductivity, no PML
-        LOOP_OVER_VOL_OWNED0(gv, c, i) { f[i] += betadt * g[i] * cndinv[i]; }
+        PLOOP_OVER_VOL_OWNED0(gv, c, i) { f[i] += betadt * g[i] * cndinv[i]; }
       }
       else { // no conductivity or PML
-        LOOP_OVER_VOL_OWNED0(gv, c, i) { f[i] += betadt * g[i]; }
+        PLOOP_OVER_VOL_OWNED0(gv, c, i) { f[i] += betadt * g[i]; }
       }
     }
   }
@@ -362,6 +331,96 @@ inline double calc_nonlinear_u(const double Dsqr, const double Di, const double
 
 */
 
+// stable averaging of offdiagonal components
+#define OFFDIAG(u, g, sx)                                                                          \
+  (0.25 * ((g[i] + g[i - sx]) * u[i] + (g[i + s] + g[(i + s) - sx]) * u[i + s]))
+
+/* As with curl_kernel, each special case of step_update_EDHB is an
+   instantiation of this template, with compile-time parameters for
+   PML (fw), the number (0-2) of off-diagonal u terms, the nonlinearity,
+   the number (0-2) of off-diagonal g terms in |g|^2 for the nonlinearity,
+   and whether u is non-NULL (if NULL, u = 1). */
+template <bool PMLW, int OFFD, bool NL, int NG, bool U>
+static ALWAYS_INLINE void update_kernel(RPR f, component fc, const grid_volume &gv, const RPR g,
+                                        const RPR g1, const RPR g2, const RPR u, const RPR u1,
+                                        const RPR u2, ptrdiff_t s, ptrdiff_t s1, ptrdiff_t s2,
+                                        const RPR chi2, const RPR chi3, RPR fw, direction dsigw,
+                                        const DPR sigw, const DPR kapw) {
+  const direction dkw = PMLW ? dsigw : X;
+  KSTRIDE_DEF(dkw, kw, gv.little_owned_corner0(fc));
+  PLOOP_OVER_VOL_OWNED(gv, fc, i) {
+    double fnew;
+    if (U) {
+      const double gs = g[i];
+      const double us = u[i];
+      fnew = OFFD == 2 ? gs * us + OFFDIAG(u1, g1, s1) + OFFDIAG(u2, g2, s2)
+                       : (OFFD == 1 ? gs * us + OFFDIAG(u1, g1, s1) : gs * us);
+      if (NL) {
+        const double g1s = NG >= 1 ? g1[i] + g1[i + s] + g1[i - s1] + g1[i + (s - s1)] : 0;
+        const double g2s = NG == 2 ? g2[i] + g2[i + s] + g2[i - s2] + g2[i + (s - s2)] : 0;
+        const double gsqr = NG == 2 ? gs * gs + 0.0625 * (g1s * g1s + g2s * g2s)
+                                    : (NG == 1 ? gs * gs + 0.0625 * (g1s * g1s) : gs * gs);
+        fnew *= calc_nonlinear_u(gsqr, gs, us, chi2[i], chi3[i]);
+      }
+    }
+    else
+      fnew = g[i];
+    if (PMLW) {
+      DEF_kw;
+      double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
+      fw[i] = fnew;
+      f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
+    }
+    else
+      f[i] = fnew;
+  }
+}
+
+template <bool PMLW>
+static ALWAYS_INLINE void update_kernels(RPR f, component fc, const grid_volume &gv, const RPR g,
+                                         const RPR g1, const RPR g2, const RPR u, const RPR u1,
+                                         const RPR u2, ptrdiff_t s, ptrdiff_t s1, ptrdiff_t s2,
+                                         const RPR chi2, const RPR chi3, RPR fw, direction dsigw,
+                                         const DPR sigw, const DPR kapw) {
+#define UPDATE_KERNEL(OFFD, NL, NG, U)                                                             \
+  update_kernel<PMLW, OFFD, NL, NG, U>(f, fc, gv, g, g1, g2, u, u1, u2, s, s1, s2, chi2, chi3, fw, \
+                                       dsigw, sigw, kapw)
+
+  if (u1 && u2) { // 3x3 off-diagonal u
+    if (chi3)
+      UPDATE_KERNEL(2, true, 2, true); //////// MOST GENERAL CASE ////////
+    else
+      UPDATE_KERNEL(2, false, 2, true);
+  }
+  else if (u1) { // 2x2 off-diagonal u
+    if (chi3)
+      UPDATE_KERNEL(1, true, 1, true);
+    else
+      UPDATE_KERNEL(1, false, 1, true);
+  }
+  else if (u2) { // 2x2 off-diagonal u
+    abort("bug - didn't swap off-diagonal terms!?");
+  }
+  else { // diagonal u
+    if (chi3) {
+      if (g1 && g2)
+        UPDATE_KERNEL(0, true, 2, true);
+      else if (g1)
+        UPDATE_KERNEL(0, true, 1, true);
+      else if (g2)
+        abort("bug - didn't swap off-diagonal terms!?");
+      else
+        UPDATE_KERNEL(0, true, 0, true);
+    }
+    else if (u)
+      UPDATE_KERNEL(0, false, 0, true);
+    else
+      UPDATE_KERNEL(0, false, 0, false);
+  }
+#undef UPDATE_KERNEL
+}
+
+SIMD_CLONES
 void step_update_EDHB(RPR f, component fc, const grid_volume &gv, const RPR g, const RPR g1,
                       const RPR g2, const RPR u, const RPR u1, const RPR u2, ptrdiff_t s,
                       ptrdiff_t s1, ptrdiff_t s2, const RPR chi2, const RPR chi3, RPR fw,
@@ -374,216 +433,98 @@ void step_update_EDHB(RPR f, component fc, const grid_volume &gv, const RPR g, c
     SWAP(ptrdiff_t, s1, s2);
   }
 
-  // stable averaging of offdiagonal components
-#define OFFDIAG(u, g, sx)                                                                          \
-  (0.25 * ((g[i] + g[i - sx]) * u[i] + (g[i + s] + g[(i + s) - sx]) * u[i + s]))
-
-  /* As with step_curl, these loops are all essentially copies
-     of the "MOST GENERAL CASE" loop with various terms thrown out. */
+  if (dsigw != NO_DIRECTION) // PML case (with fw)
+    update_kernels<true>(f, fc, gv, g, g1, g2, u, u1, u2, s, s1, s2, chi2, chi3, fw, dsigw, sigw,
+                         kapw);
+  else
+    update_kernels<false>(f, fc, gv, g, g1, g2, u, u1, u2, s, s1, s2, chi2, chi3, fw, dsigw, sigw,
+                          kapw);
+}
 
-  if (dsigw != NO_DIRECTION) { //////// PML case (with fw) /////////////
-    KSTRIDE_DEF(dsigw, kw, gv.little_owned_corner0(fc));
-    if (u1 && u2) { // 3x3 off-diagonal u
-      if (chi3) {
-        //////////////////// MOST GENERAL CASE //////////////////////
-        LOOP_OVER_VOL_OWNED(gv, fc, i) {
-          double g1s = g1[i] + g1[i + s] + g1[i - s1] + g1[i + (s - s1)];
-          double g2s = g2[i] + g2[i + s] + g2[i - s2] + g2[i + (s - s2)];
-          double gs = g[i];
-          double us = u[i];
-          DEF_kw;
-          double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-          fw[i] = (gs * us + OFFDIAG(u1, g1, s1) + OFFDIAG(u2, g2, s2)) *
-                  calc_nonlinear_u(gs * gs + 0.0625 * (g1s * g1s + g2s * g2s), gs, us, chi2[i],
-                                   chi3[i]);
-          f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-        }
-        /////////////////////////////////////////////////////////////
-      }
-      else {
-        LOOP_OVER_VOL_OWNED(gv, fc, i) {
-          double gs = g[i];
-          double us = u[i];
-          DEF_kw;
-          double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-          fw[i] = (gs * us + OFFDIAG(u1, g1, s1) + OFFDIAG(u2, g2, s2));
-          f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-        }
-      }
-    }
-    else if (u1) { // 2x2 off-diagonal u
-      if (chi3) {
-        LOOP_OVER_VOL_OWNED(gv, fc, i) {
-          double g1s = g1[i] + g1[i + s] + g1[i - s1] + g1[i + (s - s1)];
-          double gs = g[i];
-          double us = u[i];
-          DEF_kw;
-          double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-          fw[i] = (gs * us + OFFDIAG(u1, g1, s1)) *
-                  calc_nonlinear_u(gs * gs + 0.0625 * (g1s * g1s), gs, us, chi2[i], chi3[i]);
-          f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-        }
-      }
-      else {
-        LOOP_OVER_VOL_OWNED(gv, fc, i) {
-          double gs = g[i];
-          double us = u[i];
-          DEF_kw;
-          double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-          fw[i] = (gs * us + OFFDIAG(u1, g1, s1));
-          f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-        }
-      }
-    }
-    else if (u2) { // 2x2 off-diagonal u
-      abort("bug - didn't swap off-diagonal terms!?");
-    }
-    else { // diagonal u
-      if (chi3) {
-        if (g1 && g2) {
-          LOOP_OVER_VOL_OWNED(gv, fc, i) {
-            double g1s = g1[i] + g1[i + s] + g1[i - s1] + g1[i + (s - s1)];
-            double g2s = g2[i] + g2[i + s] + g2[i - s2] + g2[i + (s - s2)];
-            double gs = g[i];
-            double us = u[i];
-            DEF_kw;
-            double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-            fw[i] = (gs * us) * calc_nonlinear_u(gs * gs + 0.0625 * (g1s * g1s + g2s * g2s), gs, us,
-                                                 chi2[i], chi3[i]);
-            f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-          }
-        }
-        else if (g1) {
-          LOOP_OVER_VOL_OWNED(gv, fc, i) {
-            double g1s = g1[i] + g1[i + s] + g1[i - s1] + g1[i + (s - s1)];
-            double gs = g[i];
-            double us = u[i];
-            DEF_kw;
-            double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-            fw[i] = (gs * us) *
-                    calc_nonlinear_u(gs * gs + 0.0625 * (g1s * g1s), gs, us, chi2[i], chi3[i]);
-            f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-          }
-        }
-        else if (g2) {
-          abort("bug - didn't swap off-diagonal terms!?");
-        }
-        else {
-          LOOP_OVER_VOL_OWNED(gv, fc, i) {
-            double gs = g[i];
-            double us = u[i];
-            DEF_kw;
-            double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-            fw[i] = (gs * us) * calc_nonlinear_u(gs * gs, gs, us, chi2[i], chi3[i]);
-            f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-          }
-        }
-      }
-      else if (u) {
-        LOOP_OVER_VOL_OWNED(gv, fc, i) {
-          double gs = g[i];
-          double us = u[i];
-          DEF_kw;
-          double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-          fw[i] = (gs * us);
-          f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-        }
-      }
-      else {
-        LOOP_OVER_VOL_OWNED(gv, fc, i) {
-          DEF_kw;
-          double fwprev = fw[i], kapwkw = kapw[kw], sigwkw = sigw[kw];
-          fw[i] = g[i];
-          f[i] += (kapwkw + sigwkw) * fw[i] - (kapwkw - sigwkw) * fwprev;
-        }
-      }
+/* Apply the chi2/chi3 nonlinearity of step_update_EDHB only to the points of the box
+   is..ie, after f has been updated linearly (with chi2 = chi3 = NULL) over the whole
+   chunk: the linear update is recomputed in the box and multiplied by the
+   nonlinear factor, and in PML the auxiliary fw and f are corrected by the
+   difference.  Thus small Kerr regions in large chunks only cost their own points. */
+template <bool PMLW, int OFFD, int NG>
+static ALWAYS_INLINE void nonlinear_update_kernel(RPR f, const grid_volume &gv, const ivec &is,
+                                                  const ivec &ie, const RPR g, const RPR g1,
+                                                  const RPR g2, const RPR u, const RPR u1,
+                                                  const RPR u2, ptrdiff_t s, ptrdiff_t s1,
+                                                  ptrdiff_t s2, const RPR chi2, const RPR chi3,
+                                                  RPR fw, direction dsigw, const DPR sigw,
+                                                  const DPR kapw) {
+  const direction dkw = PMLW ? dsigw : X;
+  KSTRIDE_DEF(dkw, kw, is);
+  PLOOP_OVER_IVECS(gv, is, ie, i) {
+    const double gs = g[i];
+    const double us = u[i];
+    const double flin = OFFD == 2 ? gs * us + OFFDIAG(u1, g1, s1) + OFFDIAG(u2, g2, s2)
+                                  : (OFFD == 1 ? gs * us + OFFDIAG(u1, g1, s1) : gs * us);
+    const double g1s = NG >= 1 ? g1[i] + g1[i + s] + g1[i - s1] + g1[i + (s - s1)] : 0;
+    const double g2s = NG == 2 ? g2[i] + g2[i + s] + g2[i - s2] + g2[i + (s - s2)] : 0;
+    const double gsqr = NG == 2 ? gs * gs + 0.0625 * (g1s * g1s + g2s * g2s)
+                                : (NG == 1 ? gs * gs + 0.0625 * (g1s * g1s) : gs * gs);
+    const double fnew = flin * calc_nonlinear_u(gsqr, gs, us, chi2[i], chi3[i]);
+    if (PMLW) {
+      DEF_kw;
+      fw[i] = fnew;
+      f[i] += (kapw[kw] + sigw[kw]) * (fnew - flin);
     }
+    else
+      f[i] = fnew;
   }
-  else {            /////////////// no PML (no fw) ///////////////////
-    if (u1 && u2) { // 3x3 off-diagonal u
-      if (chi3) {
-        LOOP_OVER_VOL_OWNED(gv, fc, i) {
-          double g1s = g1[i] + g1[i + s] + g1[i - s1] + g1[i + (s - s1)];
-          double g2s = g2[i] + g2[i + s] + g2[i - s2] + g2[i + (s - s2)];
-          double gs = g[i];
-          double us = u[i];
-          f[i] = (gs * us + OFFDIAG(u1, g1, s1) + OFFDIAG(u2, g2, s2)) *
-                 calc_nonlinear_u(gs * gs + 0.0625 * (g1s * g1s + g2s * g2s), gs, us, chi2[i],
-                                  chi3[i]);
-        }
-      }
-      else {
-        LOOP_OVER_VOL_OWNED(gv, fc, i) {
-          double gs = g[i];
-          double us = u[i];
-          f[i] = (gs * us + OFFDIAG(u1, g1, s1) + OFFDIAG(u2, g2, s2));
-        }
-      }
-    }
-    else if (u1) { // 2x2 off-diagonal u
-      if (chi3) {
-        LOOP_OVER_VOL_OWNED(gv, fc, i) {
-          double g1s = g1[i] + g1[i + s] + g1[i - s1] + g1[i + (s - s1)];
-          double gs = g[i];
-          double us = u[i];
-          f[i] = (gs * us + OFFDIAG(u1, g1, s1)) *
-                 calc_nonlinear_u(gs * gs + 0.0625 * (g1s * g1s), gs, us, chi2[i], chi3[i]);
-        }
-      }
-      else {
-        LOOP_OVER_VOL_OWNED(gv, fc, i) {
-          double gs = g[i];
-          double us = u[i];
-          f[i] = (gs * us + OFFDIAG(u1, g1, s1));
-        }
-      }
-    }
-    else if (u2) { // 2x2 off-diagonal u
-      abort("bug - didn't swap off-diagonal terms!?");
-    }
-    else { // diagonal u
-      if (chi3) {
-        if (g1 && g2) {
-          LOOP_OVER_VOL_OWNED(gv, fc, i) {
-            double g1s = g1[i] + g1[i + s] + g1[i - s1] + g1[i + (s - s1)];
-            double g2s = g2[i] + g2[i + s] + g2[i - s2] + g2[i + (s - s2)];
-            double gs = g[i];
-            double us = u[i];
-            f[i] = (gs * us) * calc_nonlinear_u(gs * gs + 0.0625 * (g1s * g1s + g2s * g2s), gs, us,
-                                                chi2[i], chi3[i]);
-          }
-        }
-        else if (g1) {
-          LOOP_OVER_VOL_OWNED(gv, fc, i) {
-            double g1s = g1[i] + g1[i + s] + g1[i - s1] + g1[i + (s - s1)];
-            double gs = g[i];
-            double us = u[i];
-            f[i] = (gs * us) *
-                   calc_nonlinear_u(gs * gs + 0.0625 * (g1s * g1s), gs, us, chi2[i], chi3[i]);
-          }
-        }
-        else if (g2) {
-          abort("bug - didn't swap off-diagonal terms!?");
-        }
-        else {
-          LOOP_OVER_VOL_OWNED(gv, fc, i) {
-            double gs = g[i];
-            double us = u[i];
-            f[i] = (gs * us) * calc_nonlinear_u(gs * gs, gs, us, chi2[i], chi3[i]);
-          }
-        }
-      }
-      else if (u) {
-        LOOP_OVER_VOL_OWNED(gv, fc, i) {
-          double gs = g[i];
-          double us = u[i];
-          f[i] = (gs * us);
-        }
-      }
-      else
-        LOOP_OVER_VOL_OWNED(gv, fc, i) { f[i] = g[i]; }
-    }
+}
+
+template <bool PMLW>
+static ALWAYS_INLINE void nonlinear_update_kernels(RPR f, const grid_volume &gv, const ivec &is,
+                                                   const ivec &ie, const RPR g, const RPR g1,
+                                                   const RPR g2, const RPR u, const RPR u1,
+                                                   const RPR u2, ptrdiff_t s, ptrdiff_t s1,
+                                                   ptrdiff_t s2, const RPR chi2, const RPR chi3,
+                                                   RPR fw, direction dsigw, const DPR sigw,
+                                                   const DPR kapw) {
+#define NONLINEAR_UPDATE_KERNEL(OFFD, NG)                                                          \
+  nonlinear_update_kernel<PMLW, OFFD, NG>(f, gv, is, ie, g, g1, g2, u, u1, u2, s, s1, s2, chi2,    \
+                                          chi3, fw, dsigw, sigw, kapw)
+
+  if (u1 && u2)
+    NONLINEAR_UPDATE_KERNEL(2, 2);
+  else if (u1)
+    NONLINEAR_UPDATE_KERNEL(1, 1);
+  else if (u2)
+    abort("bug - didn't swap off-diagonal terms!?");
+  else if (g1 && g2)
+    NONLINEAR_UPDATE_KERNEL(0, 2);
+  else if (g1)
+    NONLINEAR_UPDATE_KERNEL(0, 1);
+  else if (g2)
+    abort("bug - didn't swap off-diagonal terms!?");
+  else
+    NONLINEAR_UPDATE_KERNEL(0, 0);
+#undef NONLINEAR_UPDATE_KERNEL
+}
+
+SIMD_CLONES
+void step_nonlinear_EDHB(RPR f, const grid_volume &gv, const ivec &is, const ivec &ie,
+                         const RPR g, const RPR g1, const RPR g2, const RPR u, const RPR u1,
+                         const RPR u2, ptrdiff_t s, ptrdiff_t s1, ptrdiff_t s2, const RPR chi2,
+                         const RPR chi3, RPR fw, direction dsigw, const DPR sigw,
+                         const DPR kapw) {
+  if (!f || !u || !chi3 || !(is <= ie)) return;
+
+  if ((!g1 && g2) || (g1 && g2 && !u1 && u2)) { /* swap g1 and g2 */
+    SWAP(const RPR, g1, g2);
+    SWAP(const RPR, u1, u2);
+    SWAP(ptrdiff_t, s1, s2);
   }
+
+  if (dsigw != NO_DIRECTION) // PML case (with fw)
+    nonlinear_update_kernels<true>(f, gv, is, ie, g, g1, g2, u, u1, u2, s, s1, s2, chi2, chi3, fw,
+                                   dsigw, sigw, kapw);
+  else
+    nonlinear_update_kernels<false>(f, gv, is, ie, g, g1, g2, u, u1, u2, s, s1, s2, chi2, chi3,
+                                    fw, dsigw, sigw, kapw);
 }
 
 } // namespace meep
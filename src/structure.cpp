@@ -19,6 +19,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <algorithm>
 
 #include "meep.hpp"
 #include "meep_internals.hpp"
@@ -75,49 +76,77 @@ structure::structure(const grid_volume &thegv, double eps(const vec &), const bo
   }
 }
 
-static std::vector<int> get_prime_factors(int n) {
-  int initial_n = n;
-  std::vector<int> result;
-
-  while (n % 2 == 0) {
-    result.push_back(2);
-    n /= 2;
-  }
-
-  for (int i = 3; i <= sqrt(n); i += 2) {
-    while (n % i == 0) {
-      result.push_back(i);
-      n /= i;
-    }
+// area of the face shared by two (non-overlapping) grid_volumes, 0 if they don't touch
+static size_t shared_face_area(const grid_volume &gv1, const grid_volume &gv2) {
+  const ivec lo1 = gv1.little_corner(), hi1 = gv1.big_corner();
+  const ivec lo2 = gv2.little_corner(), hi2 = gv2.big_corner();
+  int num_touching = 0;
+  size_t area = 1;
+  LOOP_OVER_DIRECTIONS(gv1.dim, d) {
+    const int lo = std::max(lo1.in_direction(d), lo2.in_direction(d));
+    const int hi = std::min(hi1.in_direction(d), hi2.in_direction(d));
+    if (hi == lo)
+      ++num_touching;
+    else if (hi < lo)
+      return 0;
+    else
+      area *= (hi - lo) / 2;
   }
-
-  if (n > 5) {
-    // If we end up with a prime number greater than 5, then start over with n -1 in order to get
-    // the largest number that is a multiple of 2, 3, or 5.
-    return get_prime_factors(initial_n - 1);
-  }
-  else if (n >= 2 && n <= 5) {
-    result.push_back(n);
-  }
-  return result;
+  return num_touching == 1 ? area : 0;
 }
 
-static void split_by_cost(std::vector<int> factors, grid_volume gvol,
-                          std::vector<grid_volume> &result) {
-
-  if (factors.size() == 0) {
-    result.push_back(gvol);
-    return;
+/* Choose the process of each chunk so that chunks that share large faces
+   (and hence communicate a lot) tend to be on the same node.  The number
+   of chunks given to each process is the same as for the default
+   (contiguous) assignment, but the chunks for the processes of each node
+   are grown greedily as a connected region of the chunk adjacency graph,
+   always adding the chunk with the largest shared area with the region.
+   If all processes are on one node, or each node has only one process,
+   this makes no difference and we return the default assignment. */
+static std::vector<int> choose_chunk_procs(const std::vector<grid_volume> &gvs) {
+  const int nchunks = gvs.size(), nprocs = count_processors();
+  std::vector<int> procs(nchunks);
+  for (int i = 0; i < nchunks; ++i)
+    procs[i] = i * nprocs / nchunks;
+
+  std::vector<int> node(nprocs);
+  process_nodes(&node[0]);
+  // processes on each node (indexed by the lowest process of the node)
+  std::vector<std::vector<int> > node_procs(nprocs);
+  for (int p = 0; p < nprocs; ++p)
+    node_procs[node[p]].push_back(p);
+  bool shared_node = false;
+  for (int p = 0; p < nprocs; ++p)
+    shared_node = shared_node || node_procs[p].size() > 1;
+  if (node_procs[0].size() == size_t(nprocs) || !shared_node) return procs;
+
+  std::vector<int> num_chunks_of(nprocs, 0);
+  for (int i = 0; i < nchunks; ++i)
+    num_chunks_of[procs[i]]++;
+
+  std::vector<bool> assigned(nchunks, false);
+  std::vector<double> weight(nchunks); // shared area with the current region
+  for (int n = 0; n < nprocs; ++n) {
+    if (node_procs[n].empty()) continue;
+    std::fill(weight.begin(), weight.end(), 0.0);
+    std::vector<int>::const_iterator p = node_procs[n].begin();
+    int left_for_p = num_chunks_of[*p];
+    while (p != node_procs[n].end()) {
+      if (left_for_p == 0) {
+        if (++p != node_procs[n].end()) left_for_p = num_chunks_of[*p];
+        continue;
+      }
+      int best = -1;
+      for (int i = 0; i < nchunks; ++i)
+        if (!assigned[i] && (best < 0 || weight[i] > weight[best])) best = i;
+      assigned[best] = true;
+      procs[best] = *p;
+      --left_for_p;
+      for (int i = 0; i < nchunks; ++i)
+        if (!assigned[i]) weight[i] += shared_face_area(gvs[best], gvs[i]);
+    }
   }
-
-  int n = factors.back();
-  factors.pop_back();
-
-  std::vector<grid_volume> new_gvs = gvol.split_into_n(n);
-  if (new_gvs.size() != (size_t)n)
-    abort("Error splitting by cost: expected %d grid_volumes but got %zu", n, new_gvs.size());
-  for (int i = 0; i < n; ++i)
-    split_by_cost(factors, new_gvs[i], result);
+  return procs;
 }
 
 void structure::choose_chunkdivision(const grid_volume &thegv, int desired_num_chunks,
@@ -173,40 +202,34 @@ void structure::choose_chunkdivision(const grid_volume &thegv, int desired_num_c
   // Next, add effort volumes for PML boundary regions:
   br.apply(this);
 
-  std::vector<int> prime_factors = get_prime_factors(desired_num_chunks);
-
-  // We may have to use a different number of chunks than the user requested
-  int adjusted_num_chunks = 1;
-  for (size_t i = 0, stop = prime_factors.size(); i < stop; ++i)
-    adjusted_num_chunks *= prime_factors[i];
-
   // Finally, create the chunks:
   num_chunks = 0;
-  chunks = new structure_chunk_ptr[adjusted_num_chunks * num_effort_volumes];
+  chunks = new structure_chunk_ptr[desired_num_chunks * num_effort_volumes];
   std::vector<grid_volume> chunk_volumes;
 
   bool by_cost = false;
   if (meep_geom::fragment_stats::resolution == 0 ||
       meep_geom::fragment_stats::has_non_medium_material() ||
       meep_geom::fragment_stats::split_chunks_evenly) {
-    if (verbosity > 0 && adjusted_num_chunks > 1)
-      master_printf("Splitting into %d chunks evenly\n", adjusted_num_chunks);
-    for (int i = 0; i < adjusted_num_chunks; i++) {
+    if (verbosity > 0 && desired_num_chunks > 1)
+      master_printf("Splitting into %d chunks evenly\n", desired_num_chunks);
+    for (int i = 0; i < desired_num_chunks; i++) {
       grid_volume vi =
-          gv.split_by_effort(adjusted_num_chunks, i, num_effort_volumes, effort_volumes, effort);
+          gv.split_by_effort(desired_num_chunks, i, num_effort_volumes, effort_volumes, effort);
       chunk_volumes.push_back(vi);
     }
   }
   else {
-    if (verbosity > 0 && adjusted_num_chunks > 1)
-      master_printf("Splitting into %d chunks by cost\n", adjusted_num_chunks);
-    split_by_cost(prime_factors, gv, chunk_volumes);
+    if (verbosity > 0 && desired_num_chunks > 1)
+      master_printf("Splitting into %d chunks by cost\n", desired_num_chunks);
+    gv.split_by_bisection(desired_num_chunks, chunk_volumes);
     by_cost = true;
   }
 
   // Break off PML regions into their own chunks
+  const std::vector<int> chunk_procs = choose_chunk_procs(chunk_volumes);
   for (size_t i = 0, stop = chunk_volumes.size(); i < stop; ++i) {
-    const int proc = i * count_processors() / adjusted_num_chunks;
+    const int proc = chunk_procs[i];
     for (int j = 0; j < num_effort_volumes; ++j) {
       grid_volume vc;
       if (chunk_volumes[i].intersect_with(effort_volumes[j], &vc)) {
@@ -368,9 +391,17 @@ structure::structure(const structure *s) : v(s->v) {
   gv = s->gv;
   S = s->S;
   user_volume = s->user_volume;
+  // share the chunks, which are then copied lazily by changing_chunks(),
+  // unless the original modifies its chunks in place (shared_chunks)
   chunks = new structure_chunk_ptr[num_chunks];
-  for (int i = 0; i < num_chunks; i++)
-    chunks[i] = new structure_chunk(s->chunks[i]);
+  for (int i = 0; i < num_chunks; i++) {
+    if (s->shared_chunks)
+      chunks[i] = new structure_chunk(s->chunks[i]);
+    else {
+      chunks[i] = s->chunks[i];
+      chunks[i]->refcount++;
+    }
+  }
   num_effort_volumes = s->num_effort_volumes;
   effort_volumes = new grid_volume[num_effort_volumes];
   effort = new double[num_effort_volumes];
@@ -390,9 +421,16 @@ structure::structure(const structure &s) : v(s.v) {
   gv = s.gv;
   S = s.S;
   user_volume = s.user_volume;
+  // share the chunks, which are then copied lazily by changing_chunks(),
+  // unless the original modifies its chunks in place (shared_chunks)
   chunks = new structure_chunk_ptr[num_chunks];
   for (int i = 0; i < num_chunks; i++) {
-    chunks[i] = new structure_chunk(s.chunks[i]);
+    if (s.shared_chunks)
+      chunks[i] = new structure_chunk(s.chunks[i]);
+    else {
+      chunks[i] = s.chunks[i];
+      chunks[i]->refcount++;
+    }
   }
   num_effort_volumes = s.num_effort_volumes;
   effort_volumes = new grid_volume[num_effort_volumes];
@@ -444,6 +482,47 @@ void structure::set_materials(material_function &mat, bool use_anisotropic_avera
   }
 }
 
+void structure::update_materials(material_function &mat, const volume &where,
+                                 bool use_anisotropic_averaging, double tol, int maxeval) {
+  // pad by a pixel, since averaging near the boundary of where sees its interior
+  volume padded(where);
+  LOOP_OVER_DIRECTIONS(where.dim, d) {
+    padded.set_direction_min(d, where.in_direction_min(d) - gv.inva);
+    padded.set_direction_max(d, where.in_direction_max(d) + gv.inva);
+  }
+  changing_chunks();
+  const bool has_mu = mat.has_mu();
+  for (int i = 0; i < num_chunks; i++) {
+    structure_chunk *sc = chunks[i];
+    if (!sc->is_mine()) continue;
+    const volume cv = sc->gv.surroundings();
+    bool overlaps = true;
+    LOOP_OVER_DIRECTIONS(gv.dim, d) {
+      if (cv.in_direction_min(d) > padded.in_direction_max(d) ||
+          cv.in_direction_max(d) < padded.in_direction_min(d))
+        overlaps = false;
+    }
+    if (!overlaps) continue;
+
+    FOR_ELECTRIC_COMPONENTS(c) {
+      sc->set_chi1inv(c, mat, use_anisotropic_averaging, tol, maxeval, &padded);
+    }
+    FOR_MAGNETIC_COMPONENTS(c) {
+      if (has_mu || sc->chi1inv[c][component_direction(c)])
+        sc->set_chi1inv(c, mat, use_anisotropic_averaging, tol, maxeval, &padded);
+    }
+    FOR_D_AND_B(c) {
+      direction d = component_direction(c);
+      if (mat.has_conductivity(c) || sc->conductivity[c][d])
+        sc->set_conductivity(c, mat, &padded);
+    }
+    FOR_E_AND_H(c) {
+      if (mat.has_chi3(c) || sc->chi3[c]) sc->set_chi3(c, mat, &padded);
+      if (mat.has_chi2(c) || sc->chi2[c]) sc->set_chi2(c, mat, &padded);
+    }
+  }
+}
+
 void structure::set_chi1inv(component c, material_function &eps, bool use_anisotropic_averaging,
                             double tol, int maxeval) {
   changing_chunks();
@@ -609,12 +688,12 @@ void structure::mix_with(const structure *oth, double f) {
 structure_chunk::~structure_chunk() {
   FOR_COMPONENTS(c) {
     FOR_DIRECTIONS(d) {
-      delete[] chi1inv[c][d];
-      delete[] conductivity[c][d];
-      delete[] condinv[c][d];
+      array_free(chi1inv[c][d]);
+      array_free(conductivity[c][d]);
+      array_free(condinv[c][d]);
     }
-    delete[] chi2[c];
-    delete[] chi3[c];
+    array_free(chi2[c]);
+    array_free(chi3[c]);
   }
   FOR_DIRECTIONS(d) {
     delete[] sig[d];
@@ -627,7 +706,7 @@ structure_chunk::~structure_chunk() {
 void structure_chunk::mix_with(const structure_chunk *n, double f) {
   FOR_COMPONENTS(c) FOR_DIRECTIONS(d) {
     if (!chi1inv[c][d] && n->chi1inv[c][d]) {
-      chi1inv[c][d] = new realnum[gv.ntot()];
+      chi1inv[c][d] = new_realnum_array(gv.ntot());
       trivial_chi1inv[c][d] = n->trivial_chi1inv[c][d];
       if (component_direction(c) == d) // diagonal components = 1 by default
         for (size_t i = 0; i < gv.ntot(); i++)
@@ -637,7 +716,7 @@ void structure_chunk::mix_with(const structure_chunk *n, double f) {
           chi1inv[c][d][i] = 0.0;
     }
     if (!conductivity[c][d] && n->conductivity[c][d]) {
-      conductivity[c][d] = new realnum[gv.ntot()];
+      conductivity[c][d] = new_realnum_array(gv.ntot());
       for (size_t i = 0; i < gv.ntot(); i++)
         conductivity[c][d][i] = 0.0;
     }
@@ -738,17 +817,36 @@ void structure_chunk::update_condinv() {
   FOR_COMPONENTS(c) {
     direction d = component_direction(c);
     if (conductivity[c][d]) {
-      if (!condinv[c][d]) condinv[c][d] = new realnum[gv.ntot()];
+      if (!condinv[c][d]) condinv[c][d] = new_realnum_array(gv.ntot());
       LOOP_OVER_VOL(gv, c, i) { condinv[c][d][i] = 1 / (1 + conductivity[c][d][i] * dt * 0.5); }
     }
     else if (condinv[c][d]) { // condinv not needed
-      delete[] condinv[c][d];
+      array_free(condinv[c][d]);
       condinv[c][d] = NULL;
     }
   }
   condinv_stale = false;
 }
 
+void structure_chunk::update_nonlinear_box() {
+  if (!nonlinear_box_stale || !is_mine()) return;
+  FOR_COMPONENTS(c) {
+    nonlinear_lo[c] = gv.little_corner();
+    nonlinear_hi[c] = nonlinear_lo[c] - one_ivec(gv.dim) * 2; // empty box
+    if (!chi3[c]) continue;
+    bool found = false;
+    LOOP_OVER_VOL_OWNED(gv, c, i) {
+      if (chi3[c][i] != 0 || chi2[c][i] != 0) {
+        IVEC_LOOP_ILOC(gv, here);
+        nonlinear_lo[c] = found ? min(nonlinear_lo[c], here) : here;
+        nonlinear_hi[c] = found ? max(nonlinear_hi[c], here) : here;
+        found = true;
+      }
+    }
+  }
+  nonlinear_box_stale = false;
+}
+
 structure_chunk::structure_chunk(const structure_chunk *o) : v(o->v) {
   refcount = 1;
 
@@ -777,7 +875,7 @@ structure_chunk::structure_chunk(const structure_chunk *o) : v(o->v) {
   cost = o->cost;
   FOR_COMPONENTS(c) {
     if (is_mine() && o->chi3[c]) {
-      chi3[c] = new realnum[gv.ntot()];
+      chi3[c] = new_realnum_array(gv.ntot());
       if (chi3[c] == NULL) abort("Out of memory!\n");
       for (size_t i = 0; i < gv.ntot(); i++)
         chi3[c][i] = o->chi3[c][i];
@@ -786,7 +884,7 @@ structure_chunk::structure_chunk(const structure_chunk *o) : v(o->v) {
       chi3[c] = NULL;
     }
     if (is_mine() && o->chi2[c]) {
-      chi2[c] = new realnum[gv.ntot()];
+      chi2[c] = new_realnum_array(gv.ntot());
       if (chi2[c] == NULL) abort("Out of memory!\n");
       for (size_t i = 0; i < gv.ntot(); i++)
         chi2[c][i] = o->chi2[c][i];
@@ -795,25 +893,32 @@ structure_chunk::structure_chunk(const structure_chunk *o) : v(o->v) {
       chi2[c] = NULL;
     }
   }
+  FOR_COMPONENTS(c) {
+    nonlinear_lo[c] = o->nonlinear_lo[c];
+    nonlinear_hi[c] = o->nonlinear_hi[c];
+  }
+  nonlinear_box_stale = o->nonlinear_box_stale;
   FOR_COMPONENTS(c) FOR_DIRECTIONS(d) { trivial_chi1inv[c][d] = true; }
   FOR_COMPONENTS(c) FOR_DIRECTIONS(d) {
     if (is_mine()) {
       trivial_chi1inv[c][d] = o->trivial_chi1inv[c][d];
       if (o->chi1inv[c][d]) {
-        chi1inv[c][d] = new realnum[gv.ntot()];
+        chi1inv[c][d] = new_realnum_array(gv.ntot());
         memcpy(chi1inv[c][d], o->chi1inv[c][d], gv.ntot() * sizeof(realnum));
       }
       else
         chi1inv[c][d] = NULL;
       if (o->conductivity[c][d]) {
-        conductivity[c][d] = new realnum[gv.ntot()];
+        conductivity[c][d] = new_realnum_array(gv.ntot());
         memcpy(conductivity[c][d], o->conductivity[c][d], gv.ntot() * sizeof(realnum));
-        condinv[c][d] = new realnum[gv.ntot()];
+        condinv[c][d] = new_realnum_array(gv.ntot());
         memcpy(condinv[c][d], o->condinv[c][d], gv.ntot() * sizeof(realnum));
       }
       else
         conductivity[c][d] = condinv[c][d] = NULL;
     }
+    else
+      chi1inv[c][d] = conductivity[c][d] = condinv[c][d] = NULL;
   }
   condinv_stale = o->condinv_stale;
   // Allocate the PML conductivity arrays:
@@ -828,11 +933,11 @@ structure_chunk::structure_chunk(const structure_chunk *o) : v(o->v) {
   // Copy over the PML conductivity arrays:
   if (is_mine()) FOR_DIRECTIONS(d) {
       if (o->sig[d]) {
-        sig[d] = new double[2 * gv.num_direction(d) + 1];
-        kap[d] = new double[2 * gv.num_direction(d) + 1];
-        siginv[d] = new double[2 * gv.num_direction(d) + 1];
         sigsize[d] = o->sigsize[d];
-        for (int i = 0; i < 2 * gv.num_direction(d) + 1; i++) {
+        sig[d] = new double[sigsize[d]];
+        kap[d] = new double[sigsize[d]];
+        siginv[d] = new double[sigsize[d]];
+        for (int i = 0; i < sigsize[d]; i++) {
           sig[d][i] = o->sig[d][i];
           kap[d][i] = o->kap[d][i];
           siginv[d][i] = o->siginv[d][i];
@@ -841,23 +946,26 @@ structure_chunk::structure_chunk(const structure_chunk *o) : v(o->v) {
     }
 }
 
-void structure_chunk::set_chi3(component c, material_function &epsilon) {
+void structure_chunk::set_chi3(component c, material_function &epsilon, const volume *where) {
   if (!is_mine() || !gv.has_field(c)) return;
   if (!is_electric(c) && !is_magnetic(c)) abort("only E or H can have chi3");
 
   epsilon.set_volume(gv.pad().surroundings());
 
   if (!chi1inv[c][component_direction(c)]) { // require chi1 if we have chi3
-    chi1inv[c][component_direction(c)] = new realnum[gv.ntot()];
+    chi1inv[c][component_direction(c)] = new_realnum_array(gv.ntot());
     for (size_t i = 0; i < gv.ntot(); ++i)
       chi1inv[c][component_direction(c)][i] = 1.0;
   }
 
-  if (!chi3[c]) chi3[c] = new realnum[gv.ntot()];
+  if (!chi3[c]) {
+    chi3[c] = new_realnum_array(gv.ntot());
+    if (where) memset(chi3[c], 0, gv.ntot() * sizeof(realnum));
+  }
   bool trivial = true;
   LOOP_OVER_VOL(gv, c, i) {
     IVEC_LOOP_LOC(gv, here);
-    chi3[c][i] = epsilon.chi3(c, here);
+    if (!where || where->contains(here)) chi3[c][i] = epsilon.chi3(c, here);
     trivial = trivial && (chi3[c][i] == 0.0);
   }
 
@@ -865,35 +973,39 @@ void structure_chunk::set_chi3(component c, material_function &epsilon) {
      chi2 be present if chi3 is, and vice versa */
   if (!chi2[c]) {
     if (!trivial) {
-      chi2[c] = new realnum[gv.ntot()];
+      chi2[c] = new_realnum_array(gv.ntot());
       memset(chi2[c], 0, gv.ntot() * sizeof(realnum)); // chi2 = 0
     }
     else { // no chi3, and chi2 is trivial (== 0), so delete
-      delete[] chi3[c];
+      array_free(chi3[c]);
       chi3[c] = NULL;
     }
   }
+  nonlinear_box_stale = true;
 
   epsilon.unset_volume();
 }
 
-void structure_chunk::set_chi2(component c, material_function &epsilon) {
+void structure_chunk::set_chi2(component c, material_function &epsilon, const volume *where) {
   if (!is_mine() || !gv.has_field(c)) return;
   if (!is_electric(c) && !is_magnetic(c)) abort("only E or H can have chi2");
 
   epsilon.set_volume(gv.pad().surroundings());
 
   if (!chi1inv[c][component_direction(c)]) { // require chi1 if we have chi2
-    chi1inv[c][component_direction(c)] = new realnum[gv.ntot()];
+    chi1inv[c][component_direction(c)] = new_realnum_array(gv.ntot());
     for (size_t i = 0; i < gv.ntot(); ++i)
       chi1inv[c][component_direction(c)][i] = 1.0;
   }
 
-  if (!chi2[c]) chi2[c] = new realnum[gv.ntot()];
+  if (!chi2[c]) {
+    chi2[c] = new_realnum_array(gv.ntot());
+    if (where) memset(chi2[c], 0, gv.ntot() * sizeof(realnum));
+  }
   bool trivial = true;
   LOOP_OVER_VOL(gv, c, i) {
     IVEC_LOOP_LOC(gv, here);
-    chi2[c][i] = epsilon.chi2(c, here);
+    if (!where || where->contains(here)) chi2[c][i] = epsilon.chi2(c, here);
     trivial = trivial && (chi2[c][i] == 0.0);
   }
 
@@ -901,19 +1013,20 @@ void structure_chunk::set_chi2(component c, material_function &epsilon) {
      chi3 be present if chi2 is, and vice versa */
   if (!chi3[c]) {
     if (!trivial) {
-      chi3[c] = new realnum[gv.ntot()];
+      chi3[c] = new_realnum_array(gv.ntot());
       memset(chi3[c], 0, gv.ntot() * sizeof(realnum)); // chi3 = 0
     }
     else { // no chi2, and chi3 is trivial (== 0), so delete
-      delete[] chi2[c];
+      array_free(chi2[c]);
       chi2[c] = NULL;
     }
   }
+  nonlinear_box_stale = true;
 
   epsilon.unset_volume();
 }
 
-void structure_chunk::set_conductivity(component c, material_function &C) {
+void structure_chunk::set_conductivity(component c, material_function &C, const volume *where) {
   if (!is_mine() || !gv.has_field(c)) return;
 
   C.set_volume(gv.pad().surroundings());
@@ -925,26 +1038,29 @@ void structure_chunk::set_conductivity(component c, material_function &C) {
   component c_C = is_electric(c) ? direction_component(Dx, c_d)
                                  : (is_magnetic(c) ? direction_component(Bx, c_d) : c);
   realnum *multby = is_electric(c) || is_magnetic(c) ? chi1inv[c][c_d] : 0;
-  if (!conductivity[c_C][c_d]) conductivity[c_C][c_d] = new realnum[gv.ntot()];
-  if (!conductivity[c_C][c_d]) abort("Memory allocation error.\n");
+  if (!conductivity[c_C][c_d]) {
+    conductivity[c_C][c_d] = new_realnum_array(gv.ntot());
+    if (!conductivity[c_C][c_d]) abort("Memory allocation error.\n");
+    if (where) memset(conductivity[c_C][c_d], 0, gv.ntot() * sizeof(realnum));
+  }
   bool trivial = true;
   realnum *cnd = conductivity[c_C][c_d];
   if (multby) {
     LOOP_OVER_VOL(gv, c_C, i) {
       IVEC_LOOP_LOC(gv, here);
-      cnd[i] = C.conductivity(c, here) * multby[i];
+      if (!where || where->contains(here)) cnd[i] = C.conductivity(c, here) * multby[i];
       trivial = trivial && (cnd[i] == 0.0);
     }
   }
   else {
     LOOP_OVER_VOL(gv, c_C, i) {
       IVEC_LOOP_LOC(gv, here);
-      cnd[i] = C.conductivity(c, here);
+      if (!where || where->contains(here)) cnd[i] = C.conductivity(c, here);
       trivial = trivial && (cnd[i] == 0.0);
     }
   }
   if (trivial) { // skip conductivity computations if conductivity == 0
-    delete[] conductivity[c_C][c_d];
+    array_free(conductivity[c_C][c_d]);
     conductivity[c_C][c_d] = NULL;
   }
   condinv_stale = true;
@@ -967,6 +1083,7 @@ structure_chunk::structure_chunk(const grid_volume &thegv, const volume &vol_lim
   // initialize materials arrays to NULL
   FOR_COMPONENTS(c) { chi3[c] = NULL; }
   FOR_COMPONENTS(c) { chi2[c] = NULL; }
+  nonlinear_box_stale = false;
   FOR_COMPONENTS(c) FOR_DIRECTIONS(d) {
     trivial_chi1inv[c][d] = true;
     chi1inv[c][d] = NULL;
@@ -1061,4 +1178,83 @@ std::vector<int> structure::get_chunk_owners() const {
   }
   return result;
 }
+
+void structure_chunk::memory_usage(double *bytes) const {
+  const double n = gv.ntot();
+  FOR_COMPONENTS(c) {
+    FOR_DIRECTIONS(d) {
+      if (chi1inv[c][d]) bytes[MemMaterials] += n * sizeof(realnum);
+      if (conductivity[c][d]) bytes[MemMaterials] += n * sizeof(realnum);
+      if (condinv[c][d]) bytes[MemMaterials] += n * sizeof(realnum);
+    }
+    if (chi2[c]) bytes[MemMaterials] += n * sizeof(realnum);
+    if (chi3[c]) bytes[MemMaterials] += n * sizeof(realnum);
+  }
+  FOR_DIRECTIONS(d) {
+    if (sig[d]) bytes[MemMaterials] += 3 * sigsize[d] * sizeof(double); // sig, kap, siginv
+  }
+  FOR_FIELD_TYPES(ft) {
+    for (const susceptibility *chi = chiP[ft]; chi; chi = chi->next)
+      FOR_COMPONENTS(c) FOR_DIRECTIONS(d) {
+        if (chi->sigma[c][d]) bytes[MemPolarizations] += chi->ntot * sizeof(realnum);
+      }
+  }
+}
+
+/* The fields arrays are predicted from the components of the grid, which
+   overestimates e.g. the components actually used by a 2d TM or TE
+   simulation.  H is assumed to share its array with B where mu is
+   trivial, as in fields_chunk::alloc_f.  Each susceptibility
+   is assumed to store two arrays (the current and previous P) per
+   component with a sigma, plus a D-P/B-P array. */
+std::vector<double> structure::estimate_memory_usage(bool is_real,
+                                                     const std::vector<volume> &dft_vols,
+                                                     const std::vector<int> &dft_sizes) const {
+  if (dft_vols.size() != dft_sizes.size())
+    abort("estimate_memory_usage needs a dft size for each dft volume");
+  const int np = count_processors();
+  const int ncmp = is_real ? 1 : 2;
+  std::vector<double> bytes_tmp(np * NUM_MEMORY_CATEGORIES, 0.0);
+  for (int i = 0; i < num_chunks; i++)
+    if (chunks[i]->is_mine()) {
+      const structure_chunk *sc = chunks[i];
+      double *bytes = &bytes_tmp[my_rank() * NUM_MEMORY_CATEGORIES];
+      sc->memory_usage(bytes);
+      const double n = sc->gv.ntot() * double(ncmp) * sizeof(realnum);
+      bool has_pml = false;
+      FOR_DIRECTIONS(d) { has_pml = has_pml || sc->sig[d]; }
+      FOR_COMPONENTS(c) {
+        if (!gv.has_field(c) || is_derived(c)) continue;
+        const field_type ft = type(c);
+        if (ft == D_stuff || ft == B_stuff) {
+          bytes[MemFields] += n;
+          if (has_pml) bytes[MemPML] += 2 * n; // f_u and f_cond
+        }
+        else if (ft == E_stuff || ft == H_stuff) {
+          bool trivial = true;
+          FOR_DIRECTIONS(d) {
+            trivial = trivial && (!sc->chi1inv[c][d] || sc->trivial_chi1inv[c][d]);
+          }
+          if (ft == E_stuff || !trivial) bytes[MemFields] += n;
+          if (has_pml) bytes[MemPML] += n; // f_w
+          if (sc->chiP[ft]) bytes[MemPolarizations] += n; // f_minus_p
+          for (const susceptibility *chi = sc->chiP[ft]; chi; chi = chi->next) {
+            bool has_sigma = false;
+            FOR_DIRECTIONS(d) { has_sigma = has_sigma || chi->sigma[c][d]; }
+            if (has_sigma) bytes[MemPolarizations] += 2 * n;
+          }
+        }
+      }
+      for (size_t k = 0; k < dft_vols.size(); ++k) {
+        if (!(sc->v && dft_vols[k])) continue;
+        const volume vi = sc->v & dft_vols[k];
+        double npts = 1;
+        LOOP_OVER_DIRECTIONS(vi.dim, d) { npts *= floor(vi.in_direction(d) * a + 0.5) + 1; }
+        bytes[MemDFT] += npts * dft_sizes[k] * sizeof(std::complex<double>);
+      }
+    }
+  std::vector<double> bytes(np * NUM_MEMORY_CATEGORIES);
+  sum_to_all(&bytes_tmp[0], &bytes[0], np * NUM_MEMORY_CATEGORIES);
+  return bytes;
+}
 } // namespace meep
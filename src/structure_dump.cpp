@@ -30,6 +30,14 @@ using namespace std;
 
 namespace meep {
 
+// The conductivity, chi2 and chi3 arrays of a chunk, indexed as
+// k = 0..4 (conductivity[c][k]), k = 5 (chi2[c]) and k = 6 (chi3[c]).
+#define NUM_EXTRA_ARRAYS 7
+static realnum *&extra_array(structure_chunk *chunk, int c, int k) {
+  if (k < 5) return chunk->conductivity[c][k];
+  return k == 5 ? chunk->chi2[c] : chunk->chi3[c];
+}
+
 // Write the parameters required to reconstruct the susceptibility (id, noise_amp (for noisy),
 // omega_0, gamma, no_omega_0_denominator)
 void structure::write_susceptibility_params(h5file *file, const char *dname, int EorH) {
@@ -55,7 +63,8 @@ void structure::write_susceptibility_params(h5file *file, const char *dname, int
 }
 
 void structure::dump_chunk_layout(const char *filename) {
-  // Write grid_volume info for each chunk so we can reconstruct chunk division from split_by_cost
+  // Write grid_volume info for each chunk so we can reconstruct the chunk division of
+  // split_by_bisection
   size_t sz = num_chunks * 3;
   realnum *origins = new realnum[sz];
   size_t *nums = new size_t[sz];
@@ -127,6 +136,47 @@ void structure::dump(const char *filename) {
           }
     }
 
+  // likewise for the conductivity, chi2 and chi3 arrays
+  {
+    const size_t nextra = num_chunks * NUM_FIELD_COMPONENTS * NUM_EXTRA_ARRAYS;
+    size_t *num_extra_ = new size_t[nextra];
+    memset(num_extra_, 0, sizeof(size_t) * nextra);
+    size_t my_nextra = 0;
+    for (int i = 0; i < num_chunks; i++)
+      if (chunks[i]->is_mine()) {
+        size_t ntot = chunks[i]->gv.ntot();
+        for (int c = 0; c < NUM_FIELD_COMPONENTS; ++c)
+          for (int k = 0; k < NUM_EXTRA_ARRAYS; ++k)
+            if (extra_array(chunks[i], c, k)) {
+              num_extra_[(i * NUM_FIELD_COMPONENTS + c) * NUM_EXTRA_ARRAYS + k] = ntot;
+              my_nextra += ntot;
+            }
+      }
+    size_t *num_extra = new size_t[nextra];
+    sum_to_master(num_extra_, num_extra, nextra);
+    delete[] num_extra_;
+
+    size_t my_extra_start = partial_sum_to_all(my_nextra) - my_nextra;
+    size_t nextra_total = sum_to_all(my_nextra);
+
+    size_t edims[3] = {(size_t)num_chunks, NUM_FIELD_COMPONENTS, NUM_EXTRA_ARRAYS};
+    file.create_data("num_extra", 3, edims);
+    if (am_master()) file.write_chunk(3, start, edims, num_extra);
+    delete[] num_extra;
+
+    file.create_data("extra", 1, &nextra_total);
+    for (int i = 0; i < num_chunks; i++)
+      if (chunks[i]->is_mine()) {
+        size_t ntot = chunks[i]->gv.ntot();
+        for (int c = 0; c < NUM_FIELD_COMPONENTS; ++c)
+          for (int k = 0; k < NUM_EXTRA_ARRAYS; ++k)
+            if (extra_array(chunks[i], c, k)) {
+              file.write_chunk(1, &my_extra_start, &ntot, extra_array(chunks[i], c, k));
+              my_extra_start += ntot;
+            }
+      }
+  }
+
   // Get the sizes of susceptibility lists for chiP[E_stuff] and chiP[H_stuff]
   // Since this info is copied to each chunk, we can just get it from the first chunk
   size_t num_sus[2] = {0, 0};
@@ -466,10 +516,22 @@ void structure::load_chunk_layout(const char *filename, boundary_region &br) {
 }
 
 void structure::load_chunk_layout(const std::vector<grid_volume> &gvs, boundary_region &br) {
+  std::vector<int> owners;
+  for (int i = 0; i < num_chunks; ++i)
+    owners.push_back(i * count_processors() / num_chunks);
+  load_chunk_layout(gvs, owners, br);
+}
+
+void structure::load_chunk_layout(const std::vector<grid_volume> &gvs,
+                                  const std::vector<int> &owners, boundary_region &br) {
+  if (gvs.size() != (size_t)num_chunks || owners.size() != (size_t)num_chunks)
+    abort("chunk mismatch in structure::load_chunk_layout");
   // Recreate the chunks with the new grid_volumes
   for (int i = 0; i < num_chunks; ++i) {
     if (chunks[i]->refcount-- <= 1) delete chunks[i];
-    int proc = i * count_processors() / num_chunks;
+    int proc = owners[i];
+    if (proc < 0 || proc >= count_processors())
+      abort("invalid owner %d of chunk %d in structure::load_chunk_layout", proc, i);
     chunks[i] = new structure_chunk(gvs[i], v, Courant, proc);
     br.apply(this, chunks[i]);
   }
@@ -506,12 +568,13 @@ void structure::load(const char *filename) {
         for (int d = 0; d < 5; ++d) {
           size_t n = num_chi1inv[(i * NUM_FIELD_COMPONENTS + c) * 5 + d];
           if (n == 0) {
-            delete[] chunks[i]->chi1inv[c][d];
+            array_free(chunks[i]->chi1inv[c][d]);
             chunks[i]->chi1inv[c][d] = NULL;
           }
           else {
             if (n != ntot) abort("grid size mismatch %zd vs %zd in structure::load", n, ntot);
-            chunks[i]->chi1inv[c][d] = new realnum[ntot];
+            array_free(chunks[i]->chi1inv[c][d]);
+            chunks[i]->chi1inv[c][d] = new_realnum_array(ntot);
             my_ntot += ntot;
           }
         }
@@ -534,6 +597,57 @@ void structure::load(const char *filename) {
             my_start += ntot;
           }
     }
+  delete[] num_chi1inv;
+
+  // conductivity, chi2 and chi3 (absent from files written by older versions)
+  if (file.dataset_exists("num_extra")) {
+    const size_t nextra = num_chunks * NUM_FIELD_COMPONENTS * NUM_EXTRA_ARRAYS;
+    size_t *num_extra = new size_t[nextra];
+    size_t _edims[3] = {(size_t)num_chunks, NUM_FIELD_COMPONENTS, NUM_EXTRA_ARRAYS};
+    file.read_size("num_extra", &rank, dims, 3);
+    if (rank != 3 || _edims[0] != dims[0] || _edims[1] != dims[1] || _edims[2] != dims[2])
+      abort("chunk mismatch in structure::load");
+    if (am_master()) file.read_chunk(3, start, dims, num_extra);
+    file.prevent_deadlock();
+    broadcast(0, num_extra, nextra);
+
+    size_t my_nextra = 0;
+    for (int i = 0; i < num_chunks; i++)
+      if (chunks[i]->is_mine()) {
+        size_t ntot = chunks[i]->gv.ntot();
+        for (int c = 0; c < NUM_FIELD_COMPONENTS; ++c)
+          for (int k = 0; k < NUM_EXTRA_ARRAYS; ++k) {
+            size_t n = num_extra[(i * NUM_FIELD_COMPONENTS + c) * NUM_EXTRA_ARRAYS + k];
+            realnum *&a = extra_array(chunks[i], c, k);
+            array_free(a);
+            a = NULL;
+            if (n != 0) {
+              if (n != ntot) abort("grid size mismatch %zd vs %zd in structure::load", n, ntot);
+              a = new_realnum_array(ntot);
+              my_nextra += ntot;
+            }
+          }
+      }
+    delete[] num_extra;
+
+    size_t my_extra_start = partial_sum_to_all(my_nextra) - my_nextra;
+    size_t nextra_total = sum_to_all(my_nextra);
+    file.read_size("extra", &rank, dims, 1);
+    if (rank != 1 || dims[0] != nextra_total) abort("inconsistent data size in structure::load");
+    for (int i = 0; i < num_chunks; i++)
+      if (chunks[i]->is_mine()) {
+        size_t ntot = chunks[i]->gv.ntot();
+        for (int c = 0; c < NUM_FIELD_COMPONENTS; ++c)
+          for (int k = 0; k < NUM_EXTRA_ARRAYS; ++k)
+            if (extra_array(chunks[i], c, k)) {
+              file.read_chunk(1, &my_extra_start, &ntot, extra_array(chunks[i], c, k));
+              my_extra_start += ntot;
+            }
+        chunks[i]->condinv_stale = true;
+        chunks[i]->nonlinear_box_stale = true;
+      }
+  }
+
   // Create susceptibilites from params datasets
   set_chiP_from_file(&file, "E_params", E_stuff);
   set_chiP_from_file(&file, "H_params", H_stuff);
@@ -655,6 +769,8 @@ void structure::load(const char *filename) {
                 sus->sigma[c][d] = new realnum[count];
                 sus->trivial_sigma[c][d] = false;
                 file.read_chunk(rank, &start, &count, sus->sigma[c][d]);
+                if (d == component_direction(component(c)))
+                  sus->set_sigma_box(component(c), chunks[i]->gv);
                 sus = sus->next;
                 start += count;
               }
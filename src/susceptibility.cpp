@@ -26,6 +26,7 @@
    array.  The meep::fields class is responsible for allocating P and
    sigma and passing them to susceptibility::update_P. */
 
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include "meep.hpp"
@@ -54,6 +55,34 @@ susceptibility *susceptibility::clone() const {
   return sus;
 }
 
+void susceptibility::set_sigma_box(component c, const grid_volume &gv) {
+  const realnum *s = sigma[c][component_direction(c)];
+  have_sigma_box[c] = true;
+  sigma_lo[c] = gv.big_corner() + one_ivec(gv.dim) * 2; // empty box
+  sigma_hi[c] = gv.little_corner() - one_ivec(gv.dim) * 2;
+  if (s) LOOP_OVER_VOL(gv, c, i) {
+      if (s[i] != 0) {
+        IVEC_LOOP_ILOC(gv, here);
+        sigma_lo[c] = min(sigma_lo[c], here);
+        sigma_hi[c] = max(sigma_hi[c], here);
+      }
+    }
+}
+
+bool susceptibility::owned_sigma_box(component c, const grid_volume &gv, ivec &is,
+                                     ivec &ie) const {
+  is = gv.little_owned_corner(c);
+  ie = gv.big_corner();
+  if (have_sigma_box[c]) {
+    is = max(is, sigma_lo[c]);
+    ie = min(ie, sigma_hi[c]);
+  }
+  LOOP_OVER_DIRECTIONS(gv.dim, d) {
+    if (is.in_direction(d) > ie.in_direction(d)) return false;
+  }
+  return true;
+}
+
 // generic base class definition.
 std::complex<double> susceptibility::chi1(double freq, double sigma) {
   (void)freq;
@@ -98,6 +127,7 @@ bool susceptibility::needs_W_notowned(component c, realnum *W[NUM_FIELD_COMPONEN
 typedef struct {
   size_t sz_data;
   size_t ntot;
+  uint32_t step; // number of update_P calls, for the noise of noisy_lorentzian_susceptibility
   realnum *P[NUM_FIELD_COMPONENTS][2];
   realnum *P_prev[NUM_FIELD_COMPONENTS][2];
   realnum data[1];
@@ -112,7 +142,7 @@ void *lorentzian_susceptibility::new_internal_data(realnum *W[NUM_FIELD_COMPONEN
     if (needs_P(c, cmp, W)) num += 2 * gv.ntot();
   }
   size_t sz = sizeof(lorentzian_data) + sizeof(realnum) * (num - 1);
-  lorentzian_data *d = (lorentzian_data *)malloc(sz);
+  lorentzian_data *d = (lorentzian_data *)array_malloc(sz);
   d->sz_data = sz;
   return (void *)d;
 }
@@ -137,10 +167,12 @@ void lorentzian_susceptibility::init_internal_data(realnum *W[NUM_FIELD_COMPONEN
   }
 }
 
+void lorentzian_susceptibility::delete_internal_data(void *data) const { array_free(data); }
+
 void *lorentzian_susceptibility::copy_internal_data(void *data) const {
   lorentzian_data *d = (lorentzian_data *)data;
   if (!d) return 0;
-  lorentzian_data *dnew = (lorentzian_data *)malloc(d->sz_data);
+  lorentzian_data *dnew = (lorentzian_data *)array_malloc(d->sz_data);
   memcpy(dnew, d, d->sz_data);
   size_t ntot = d->ntot;
   realnum *P = dnew->data;
@@ -156,6 +188,28 @@ void *lorentzian_susceptibility::copy_internal_data(void *data) const {
   return (void *)dnew;
 }
 
+// the P and P_prev arrays, followed by the step counter as two 16-bit halves
+// (exactly representable in any realnum)
+size_t lorentzian_susceptibility::num_internal_data(void *data) const {
+  lorentzian_data *d = (lorentzian_data *)data;
+  return d ? (d->sz_data - offsetof(lorentzian_data, data)) / sizeof(realnum) + 2 : 0;
+}
+
+void lorentzian_susceptibility::dump_internal_data(void *data, realnum *buf) const {
+  lorentzian_data *d = (lorentzian_data *)data;
+  size_t n = num_internal_data(data) - 2;
+  memcpy(buf, d->data, n * sizeof(realnum));
+  buf[n] = d->step & 0xffff;
+  buf[n + 1] = d->step >> 16;
+}
+
+void lorentzian_susceptibility::load_internal_data(void *data, const realnum *buf) const {
+  lorentzian_data *d = (lorentzian_data *)data;
+  size_t n = num_internal_data(data) - 2;
+  memcpy(d->data, buf, n * sizeof(realnum));
+  d->step = uint32_t(buf[n]) | (uint32_t(buf[n + 1]) << 16);
+}
+
 #if 0
 /* Return true if the discretized Lorentzian ODE is intrinsically unstable,
    i.e. if it corresponds to a filter with a pole z outside the unit circle.
@@ -199,7 +253,8 @@ void lorentzian_susceptibility::update_P(realnum *W[NUM_FIELD_COMPONENTS][2],
   FOR_COMPONENTS(c) DOCMP2 {
     if (d->P[c][cmp]) {
       const realnum *w = W[c][cmp], *s = sigma[c][component_direction(c)];
-      if (w && s) {
+      ivec lo, hi; // only need to update P where sigma != 0
+      if (w && s && owned_sigma_box(c, gv, lo, hi)) {
         realnum *p = d->P[c][cmp], *pp = d->P_prev[c][cmp];
 
         // directions/strides for offdiagonal terms, similar to update_eh
@@ -224,7 +279,7 @@ void lorentzian_susceptibility::update_P(realnum *W[NUM_FIELD_COMPONENTS][2],
           SWAP(const realnum *, s1, s2);
         }
         if (s1 && s2) { // 3x3 anisotropic
-          LOOP_OVER_VOL_OWNED(gv, c, i) {
+          PLOOP_OVER_IVECS(gv, lo, hi, i) {
             // s[i] != 0 check is a bit of a hack to work around
             // some instabilities that occur near the boundaries
             // of materials; see PR #666
@@ -238,7 +293,7 @@ void lorentzian_susceptibility::update_P(realnum *W[NUM_FIELD_COMPONENTS][2],
           }
         }
         else if (s1) { // 2x2 anisotropic
-          LOOP_OVER_VOL_OWNED(gv, c, i) {
+          PLOOP_OVER_IVECS(gv, lo, hi, i) {
             if (s[i] != 0) { // see above
               realnum pcur = p[i];
               p[i] = gamma1inv * (pcur * (2 - omega0dtsqr_denom) - gamma1 * pp[i] +
@@ -248,7 +303,7 @@ void lorentzian_susceptibility::update_P(realnum *W[NUM_FIELD_COMPONENTS][2],
           }
         }
         else { // isotropic
-          LOOP_OVER_VOL_OWNED(gv, c, i) {
+          PLOOP_OVER_IVECS(gv, lo, hi, i) {
             realnum pcur = p[i];
             p[i] = gamma1inv *
                    (pcur * (2 - omega0dtsqr_denom) - gamma1 * pp[i] + omega0dtsqr * (s[i] * w[i]));
@@ -279,6 +334,128 @@ void lorentzian_susceptibility::subtract_P(field_type ft,
   }
 }
 
+/* For materials fitted with several Lorentzian/Drude poles, calling
+   update_P and subtract_P for each pole in turn streams W (and D - P) over
+   the whole chunk once per pole.  Instead, update_P_poles timesteps all
+   of the poles in a single sweep for each component, reading W once per
+   point, and subtract_P_poles computes f_minus_p = D - sum(P) in a single
+   pass (also replacing the initial copy of D).  The arithmetic is identical
+   to update_P/subtract_P.  Only the isotropic case is fused: poles with
+   off-diagonal sigma are updated by their own update_P. */
+
+#define MAX_FUSED_POLES 8 // poles per sweep, sized so that coefficients fit in registers
+
+static bool lorentzian_isotropic(const susceptibility *s, realnum *W[NUM_FIELD_COMPONENTS][2],
+                                 const grid_volume &gv, const lorentzian_data *d) {
+  FOR_COMPONENTS(c) DOCMP2 {
+    if (d->P[c][cmp] && W[c][cmp] && s->sigma[c][component_direction(c)]) {
+      const direction dc = component_direction(c);
+      for (int k = 1; k <= 2; ++k) {
+        const direction dk = cycle_direction(gv.dim, dc, k);
+        if (W[direction_component(c, dk)][cmp] && s->sigma[c][dk]) return false;
+      }
+    }
+  }
+  return true;
+}
+
+void lorentzian_susceptibility::update_P_poles(int npoles,
+                                               const lorentzian_susceptibility *const *s,
+                                               void *const *P_internal_data,
+                                               realnum *W[NUM_FIELD_COMPONENTS][2],
+                                               realnum *W_prev[NUM_FIELD_COMPONENTS][2],
+                                               double dt, const grid_volume &gv) {
+  for (int n = 0; n < npoles;) {
+    int nfused = 0;
+    const lorentzian_susceptibility *fs[MAX_FUSED_POLES];
+    lorentzian_data *fd[MAX_FUSED_POLES];
+    for (; n < npoles && nfused < MAX_FUSED_POLES; ++n) {
+      lorentzian_data *d = (lorentzian_data *)P_internal_data[n];
+      if (lorentzian_isotropic(s[n], W, gv, d)) {
+        fs[nfused] = s[n];
+        fd[nfused++] = d;
+      }
+      else
+        s[n]->update_P(W, W_prev, dt, gv, d);
+    }
+
+    double gamma1inv[MAX_FUSED_POLES], gamma1[MAX_FUSED_POLES];
+    double omega0dtsqr[MAX_FUSED_POLES], ppcoef[MAX_FUSED_POLES];
+    for (int k = 0; k < nfused; ++k) {
+      const double omega2pi = 2 * pi * fs[k]->omega_0, g2pi = fs[k]->gamma * 2 * pi;
+      omega0dtsqr[k] = omega2pi * omega2pi * dt * dt;
+      gamma1inv[k] = 1 / (1 + g2pi * dt / 2);
+      gamma1[k] = (1 - g2pi * dt / 2);
+      ppcoef[k] = 2 - (fs[k]->no_omega_0_denominator ? 0 : omega0dtsqr[k]);
+    }
+
+    FOR_COMPONENTS(c) DOCMP2 {
+      const realnum *w = W[c][cmp];
+      if (!w) continue;
+      int np = 0;
+      realnum *p[MAX_FUSED_POLES], *pp[MAX_FUSED_POLES];
+      const realnum *sig[MAX_FUSED_POLES];
+      double g1inv[MAX_FUSED_POLES], g1[MAX_FUSED_POLES], o[MAX_FUSED_POLES], a[MAX_FUSED_POLES];
+      ivec lo, hi; // union of the sigma boxes of the poles (P stays 0 where sigma = 0)
+      for (int k = 0; k < nfused; ++k) {
+        ivec klo, khi;
+        if (fd[k]->P[c][cmp] && fs[k]->sigma[c][component_direction(c)] &&
+            fs[k]->owned_sigma_box(c, gv, klo, khi)) {
+          lo = np ? min(lo, klo) : klo;
+          hi = np ? max(hi, khi) : khi;
+          p[np] = fd[k]->P[c][cmp];
+          pp[np] = fd[k]->P_prev[c][cmp];
+          sig[np] = fs[k]->sigma[c][component_direction(c)];
+          g1inv[np] = gamma1inv[k];
+          g1[np] = gamma1[k];
+          o[np] = omega0dtsqr[k];
+          a[np++] = ppcoef[k];
+        }
+      }
+      if (np == 0) continue;
+      PLOOP_OVER_IVECS(gv, lo, hi, i) {
+        const realnum wi = w[i];
+        for (int k = 0; k < np; ++k) {
+          realnum pcur = p[k][i];
+          p[k][i] = g1inv[k] * (pcur * a[k] - g1[k] * pp[k][i] + o[k] * (sig[k][i] * wi));
+          pp[k][i] = pcur;
+        }
+      }
+    }
+  }
+}
+
+void lorentzian_susceptibility::subtract_P_poles(field_type ft, int npoles,
+                                                 void *const *P_internal_data,
+                                                 realnum *f[NUM_FIELD_COMPONENTS][2],
+                                                 realnum *f_minus_p[NUM_FIELD_COMPONENTS][2]) {
+  field_type ft2 = ft == E_stuff ? D_stuff : B_stuff; // for sources etc.
+  FOR_FT_COMPONENTS(ft, ec) if (f[ec][0]) {
+    component dc = field_type_component(ft2, ec);
+    DOCMP2 if (f_minus_p[dc][cmp] && f[dc][cmp]) {
+      const realnum *fd = f[dc][cmp];
+      realnum *fmp = f_minus_p[dc][cmp];
+      size_t ntot = 0;
+      for (int n0 = 0; n0 < npoles; n0 += MAX_FUSED_POLES) {
+        int np = 0;
+        const realnum *p[MAX_FUSED_POLES];
+        for (int n = n0; n < npoles && n < n0 + MAX_FUSED_POLES; ++n) {
+          lorentzian_data *d = (lorentzian_data *)P_internal_data[n];
+          ntot = d->ntot;
+          if (d->P[ec][cmp]) p[np++] = d->P[ec][cmp];
+        }
+        for (size_t i = 0; i < ntot; ++i) {
+          realnum fi = fd[i];
+          for (int k = 0; k < np; ++k)
+            fi -= p[k][i];
+          fmp[i] = fi;
+        }
+        fd = fmp; // subsequent groups of poles subtract from f_minus_p
+      }
+    }
+  }
+}
+
 int lorentzian_susceptibility::num_cinternal_notowned_needed(component c,
                                                              void *P_internal_data) const {
   lorentzian_data *d = (lorentzian_data *)P_internal_data;
@@ -324,14 +501,23 @@ void noisy_lorentzian_susceptibility::update_P(realnum *W[NUM_FIELD_COMPONENTS][
   const double amp = w2pi * noise_amp * sqrt(g2pi) * dt * dt / (1 + g2pi * dt / 2);
   /* for uniform random numbers in [-amp,amp] below, multiply amp by sqrt(3) */
 
+  /* The noise at each point is a counter-based random number determined by
+     the time step, the (global) grid point, and the component, so that it is
+     independent of the chunk layout and of the order of the loop (which can
+     therefore be multithreaded). */
+  const uint32_t key[2] = {uint32_t(counter_random_seed()), d->step++};
   FOR_COMPONENTS(c) DOCMP2 {
     if (d->P[c][cmp]) {
       const realnum *s = sigma[c][component_direction(c)];
       if (s) {
         realnum *p = d->P[c][cmp];
-        LOOP_OVER_VOL_OWNED(gv, c, i) { p[i] += gaussian_random(0, amp * sqrt(s[i])); }
-        // for uniform random numbers, use uniform_random(-1,1) * amp * sqrt(s[i])
-        // for gaussian random numbers, use gaussian_random(0, amp * sqrt(s[i]))
+        const uint32_t ckey = (uint32_t(get_id()) << 6) | (uint32_t(c) << 1) | uint32_t(cmp);
+        PLOOP_OVER_VOL_OWNED(gv, c, i) {
+          IVEC_LOOP_ILOC(gv, here);
+          const uint32_t ctr[4] = {uint32_t(here.yucky_val(0)), uint32_t(here.yucky_val(1)),
+                                   uint32_t(here.yucky_val(2)), ckey};
+          p[i] += counter_gaussian_random(key, ctr, 0, amp * sqrt(s[i]));
+        }
       }
     }
   }
@@ -384,7 +570,7 @@ void *gyrotropic_susceptibility::new_internal_data(realnum *W[NUM_FIELD_COMPONEN
     if (needs_P(c, cmp, W)) num += 6 * gv.ntot();
   }
   size_t sz = sizeof(gyrotropy_data) + sizeof(realnum) * (num - 1);
-  gyrotropy_data *d = (gyrotropy_data *)malloc(sz);
+  gyrotropy_data *d = (gyrotropy_data *)array_malloc(sz);
   d->sz_data = sz;
   return (void *)d;
 }
@@ -410,10 +596,12 @@ void gyrotropic_susceptibility::init_internal_data(realnum *W[NUM_FIELD_COMPONEN
   }
 }
 
+void gyrotropic_susceptibility::delete_internal_data(void *data) const { array_free(data); }
+
 void *gyrotropic_susceptibility::copy_internal_data(void *data) const {
   gyrotropy_data *d = (gyrotropy_data *)data;
   if (!d) return 0;
-  gyrotropy_data *dnew = (gyrotropy_data *)malloc(d->sz_data);
+  gyrotropy_data *dnew = (gyrotropy_data *)array_malloc(d->sz_data);
   memcpy(dnew, d, d->sz_data);
   realnum *p = dnew->data;
   FOR_COMPONENTS(c) DOCMP2 {
@@ -429,11 +617,25 @@ void *gyrotropic_susceptibility::copy_internal_data(void *data) const {
   return (void *)dnew;
 }
 
+size_t gyrotropic_susceptibility::num_internal_data(void *data) const {
+  gyrotropy_data *d = (gyrotropy_data *)data;
+  return d ? (d->sz_data - offsetof(gyrotropy_data, data)) / sizeof(realnum) : 0;
+}
+
+void gyrotropic_susceptibility::dump_internal_data(void *data, realnum *buf) const {
+  memcpy(buf, ((gyrotropy_data *)data)->data, num_internal_data(data) * sizeof(realnum));
+}
+
+void gyrotropic_susceptibility::load_internal_data(void *data, const realnum *buf) const {
+  memcpy(((gyrotropy_data *)data)->data, buf, num_internal_data(data) * sizeof(realnum));
+}
+
 bool gyrotropic_susceptibility::needs_P(component c, int cmp,
                                         realnum *W[NUM_FIELD_COMPONENTS][2]) const {
   if (!is_electric(c) && !is_magnetic(c)) return false;
   direction d0 = component_direction(c);
-  return (d0 == X || d0 == Y || d0 == Z) && sigma[c][d0] && W[c][cmp];
+  // trivial_sigma is the same on every chunk, so P exists on both sides of each chunk boundary
+  return (d0 == X || d0 == Y || d0 == Z) && !trivial_sigma[c][d0] && W[c][cmp];
 }
 
 // Similar to the OFFDIAG macro, but without averaging sigma.
@@ -447,136 +649,108 @@ void gyrotropic_susceptibility::update_P(realnum *W[NUM_FIELD_COMPONENTS][2],
   const double g2pidt = 2 * pi * gamma * dt;
   (void)W_prev; // unused;
 
-  switch (model) {
-    case GYROTROPIC_LORENTZIAN:
-    case GYROTROPIC_DRUDE: {
-      const double omega0dtsqr = omega2pidt * omega2pidt;
-      const double gamma1 = (1 - g2pidt / 2);
-      const double diag = 2 - (model == GYROTROPIC_DRUDE ? 0 : omega0dtsqr);
-      const double pt = pi * dt;
-
-      // Precalculate 3x3 matrix inverse, exploiting skew symmetry
-      const double gd = (1 + g2pidt / 2);
-      const double gx = pt * gyro_tensor[Y][Z];
-      const double gy = pt * gyro_tensor[Z][X];
-      const double gz = pt * gyro_tensor[X][Y];
-      const double invdet = 1.0 / gd / (gd * gd + gx * gx + gy * gy + gz * gz);
-      const double inv[3][3] = {{invdet * (gd * gd + gx * gx), invdet * (gx * gy + gd * gz),
-                                 invdet * (gx * gz - gd * gy)},
-                                {invdet * (gy * gx - gd * gz), invdet * (gd * gd + gy * gy),
-                                 invdet * (gy * gz + gd * gx)},
-                                {invdet * (gz * gx + gd * gy), invdet * (gz * gy - gd * gx),
-                                 invdet * (gd * gd + gz * gz)}};
-
-      FOR_COMPONENTS(c) DOCMP2 {
-        if (d->P[c][cmp][0]) {
-          const direction d0 = component_direction(c);
-          const realnum *w0 = W[c][cmp], *s = sigma[c][d0];
-
-          if (!w0 || !s || (d0 != X && d0 != Y && d0 != Z))
-            abort("gyrotropic media require 3D Cartesian fields\n");
-
-          const direction d1 = cycle_direction(gv.dim, d0, 1);
-          const direction d2 = cycle_direction(gv.dim, d0, 2);
-          const realnum *w1 = W[direction_component(c, d1)][cmp];
-          const realnum *w2 = W[direction_component(c, d2)][cmp];
-          realnum *p0 = d->P[c][cmp][d0], *pp0 = d->P_prev[c][cmp][d0];
-          realnum *p1 = d->P[c][cmp][d1], *pp1 = d->P_prev[c][cmp][d1];
-          realnum *p2 = d->P[c][cmp][d2], *pp2 = d->P_prev[c][cmp][d2];
-          const ptrdiff_t is = gv.stride(d0) * (is_magnetic(c) ? -1 : +1);
-          const ptrdiff_t is1 = gv.stride(d1) * (is_magnetic(c) ? -1 : +1);
-          const ptrdiff_t is2 = gv.stride(d2) * (is_magnetic(c) ? -1 : +1);
-          realnum r0, r1, r2;
-
-          if (!pp1 || !pp2) abort("gyrotropic media require 3D Cartesian fields\n");
-          if (sigma[c][d1] || sigma[c][d2])
-            abort("gyrotropic media do not support anisotropic sigma\n");
-
-          LOOP_OVER_VOL_OWNED(gv, c, i) {
-            r0 = diag * p0[i] - gamma1 * pp0[i] + omega0dtsqr * s[i] * w0[i] -
-                 pt * gyro_tensor[d0][d1] * pp1[i] - pt * gyro_tensor[d0][d2] * pp2[i];
-            r1 = diag * p1[i] - gamma1 * pp1[i] +
-                 (w1 ? omega0dtsqr * s[i] * OFFDIAGW(w1, is1, is) : 0) -
-                 pt * gyro_tensor[d1][d0] * pp0[i] - pt * gyro_tensor[d1][d2] * pp2[i];
-            r2 = diag * p2[i] - gamma1 * pp2[i] +
-                 (w2 ? omega0dtsqr * s[i] * OFFDIAGW(w2, is2, is) : 0) -
-                 pt * gyro_tensor[d2][d1] * pp1[i] - pt * gyro_tensor[d2][d0] * pp0[i];
+  // Precalculate 3x3 matrix inverse, exploiting skew symmetry
+  const bool saturated = model == GYROTROPIC_SATURATED;
+  const double pt = pi * dt;
+  const double gd = saturated ? 0.5 : (1 + g2pidt / 2);
+  const double gscale = saturated ? -0.5 * alpha : pt;
+  const double gx = gscale * gyro_tensor[Y][Z];
+  const double gy = gscale * gyro_tensor[Z][X];
+  const double gz = gscale * gyro_tensor[X][Y];
+  const double invdet = 1.0 / gd / (gd * gd + gx * gx + gy * gy + gz * gz);
+  const double inv[3][3] = {{invdet * (gd * gd + gx * gx), invdet * (gx * gy + gd * gz),
+                             invdet * (gx * gz - gd * gy)},
+                            {invdet * (gy * gx - gd * gz), invdet * (gd * gd + gy * gy),
+                             invdet * (gy * gz + gd * gx)},
+                            {invdet * (gz * gx + gd * gy), invdet * (gz * gy - gd * gx),
+                             invdet * (gd * gd + gz * gz)}};
+
+  FOR_COMPONENTS(c) DOCMP2 {
+    if (d->P[c][cmp][0]) {
+      const direction d0 = component_direction(c);
+      const realnum *w0 = W[c][cmp], *s = sigma[c][d0];
+
+      if (!w0 || (d0 != X && d0 != Y && d0 != Z))
+        abort("gyrotropic media require 3D Cartesian fields\n");
+      if (!s) continue; // sigma = 0 in this chunk, so P stays zero
+
+      const direction d1 = cycle_direction(gv.dim, d0, 1);
+      const direction d2 = cycle_direction(gv.dim, d0, 2);
+      const realnum *w1 = W[direction_component(c, d1)][cmp];
+      const realnum *w2 = W[direction_component(c, d2)][cmp];
+      realnum *p0 = d->P[c][cmp][d0], *pp0 = d->P_prev[c][cmp][d0];
+      realnum *p1 = d->P[c][cmp][d1], *pp1 = d->P_prev[c][cmp][d1];
+      realnum *p2 = d->P[c][cmp][d2], *pp2 = d->P_prev[c][cmp][d2];
+      const ptrdiff_t is = gv.stride(d0) * (is_magnetic(c) ? -1 : +1);
+      const ptrdiff_t is1 = gv.stride(d1) * (is_magnetic(c) ? -1 : +1);
+      const ptrdiff_t is2 = gv.stride(d2) * (is_magnetic(c) ? -1 : +1);
+
+      if (!pp1 || !pp2) abort("gyrotropic media require 3D Cartesian fields\n");
+      if (sigma[c][d1] || sigma[c][d2])
+        abort("gyrotropic media do not support anisotropic sigma\n");
+
+      // all three P components stay zero where sigma = 0, so only update the sigma box
+      ivec lo, hi;
+      if (!owned_sigma_box(c, gv, lo, hi)) continue;
+
+      // the bias and inverse matrices for this component ordering, held in registers
+      const double g01 = gyro_tensor[d0][d1], g02 = gyro_tensor[d0][d2];
+      const double g10 = gyro_tensor[d1][d0], g12 = gyro_tensor[d1][d2];
+      const double g20 = gyro_tensor[d2][d0], g21 = gyro_tensor[d2][d1];
+      const double i00 = inv[d0][d0], i01 = inv[d0][d1], i02 = inv[d0][d2];
+      const double i10 = inv[d1][d0], i11 = inv[d1][d1], i12 = inv[d1][d2];
+      const double i20 = inv[d2][d0], i21 = inv[d2][d1], i22 = inv[d2][d2];
+
+      switch (model) {
+        case GYROTROPIC_LORENTZIAN:
+        case GYROTROPIC_DRUDE: {
+          const double omega0dtsqr = omega2pidt * omega2pidt;
+          const double gamma1 = (1 - g2pidt / 2);
+          const double diag = 2 - (model == GYROTROPIC_DRUDE ? 0 : omega0dtsqr);
+
+          PLOOP_OVER_IVECS(gv, lo, hi, i) {
+            const double r0 = diag * p0[i] - gamma1 * pp0[i] + omega0dtsqr * s[i] * w0[i] -
+                              pt * g01 * pp1[i] - pt * g02 * pp2[i];
+            const double r1 = diag * p1[i] - gamma1 * pp1[i] +
+                              (w1 ? omega0dtsqr * s[i] * OFFDIAGW(w1, is1, is) : 0) -
+                              pt * g10 * pp0[i] - pt * g12 * pp2[i];
+            const double r2 = diag * p2[i] - gamma1 * pp2[i] +
+                              (w2 ? omega0dtsqr * s[i] * OFFDIAGW(w2, is2, is) : 0) -
+                              pt * g21 * pp1[i] - pt * g20 * pp0[i];
 
             pp0[i] = p0[i];
             pp1[i] = p1[i];
             pp2[i] = p2[i];
-            p0[i] = inv[d0][d0] * r0 + inv[d0][d1] * r1 + inv[d0][d2] * r2;
-            p1[i] = inv[d1][d0] * r0 + inv[d1][d1] * r1 + inv[d1][d2] * r2;
-            p2[i] = inv[d2][d0] * r0 + inv[d2][d1] * r1 + inv[d2][d2] * r2;
+            p0[i] = i00 * r0 + i01 * r1 + i02 * r2;
+            p1[i] = i10 * r0 + i11 * r1 + i12 * r2;
+            p2[i] = i20 * r0 + i21 * r1 + i22 * r2;
           }
-        }
-      }
-    } break;
-
-    case GYROTROPIC_SATURATED: {
-      const double dt2pi = 2 * pi * dt;
-
-      // Precalculate 3x3 matrix inverse, exploiting skew symmetry
-      const double gd = 0.5;
-      const double gx = -0.5 * alpha * gyro_tensor[Y][Z];
-      const double gy = -0.5 * alpha * gyro_tensor[Z][X];
-      const double gz = -0.5 * alpha * gyro_tensor[X][Y];
-      const double invdet = 1.0 / gd / (gd * gd + gx * gx + gy * gy + gz * gz);
-      const double inv[3][3] = {{invdet * (gd * gd + gx * gx), invdet * (gx * gy + gd * gz),
-                                 invdet * (gx * gz - gd * gy)},
-                                {invdet * (gy * gx - gd * gz), invdet * (gd * gd + gy * gy),
-                                 invdet * (gy * gz + gd * gx)},
-                                {invdet * (gz * gx + gd * gy), invdet * (gz * gy - gd * gx),
-                                 invdet * (gd * gd + gz * gz)}};
-
-      FOR_COMPONENTS(c) DOCMP2 {
-        if (d->P[c][cmp][0]) {
-          const direction d0 = component_direction(c);
-          const realnum *w0 = W[c][cmp], *s = sigma[c][d0];
-
-          if (!w0 || !s || (d0 != X && d0 != Y && d0 != Z))
-            abort("gyrotropic media require 3D Cartesian fields\n");
-
-          const direction d1 = cycle_direction(gv.dim, d0, 1);
-          const direction d2 = cycle_direction(gv.dim, d0, 2);
-          const realnum *w1 = W[direction_component(c, d1)][cmp];
-          const realnum *w2 = W[direction_component(c, d2)][cmp];
-          realnum *p0 = d->P[c][cmp][d0], *pp0 = d->P_prev[c][cmp][d0];
-          realnum *p1 = d->P[c][cmp][d1], *pp1 = d->P_prev[c][cmp][d1];
-          realnum *p2 = d->P[c][cmp][d2], *pp2 = d->P_prev[c][cmp][d2];
-          const ptrdiff_t is = gv.stride(d0) * (is_magnetic(c) ? -1 : +1);
-          const ptrdiff_t is1 = gv.stride(d1) * (is_magnetic(c) ? -1 : +1);
-          const ptrdiff_t is2 = gv.stride(d2) * (is_magnetic(c) ? -1 : +1);
-          realnum r0, r1, r2, q0, q1, q2;
-
-          if (!pp1 || !pp2) abort("gyrotropic media require 3D Cartesian fields\n");
-          if (sigma[c][d1] || sigma[c][d2])
-            abort("gyrotropic media do not support anisotropic sigma\n");
-
-          LOOP_OVER_VOL_OWNED(gv, c, i) {
-            q0 = -omega2pidt * p0[i] + 0.5 * alpha * pp0[i] + dt2pi * s[i] * w0[i];
-            q1 = -omega2pidt * p1[i] + 0.5 * alpha * pp1[i] +
-                 dt2pi * s[i] * (w1 ? OFFDIAGW(w1, is1, is) : 0);
-            q2 = -omega2pidt * p2[i] + 0.5 * alpha * pp2[i] +
-                 dt2pi * s[i] * (w2 ? OFFDIAGW(w2, is2, is) : 0);
-
-            r0 =
-                0.5 * pp0[i] - g2pidt * p0[i] + gyro_tensor[d0][d1] * q1 + gyro_tensor[d0][d2] * q2;
-            r1 =
-                0.5 * pp1[i] - g2pidt * p1[i] + gyro_tensor[d1][d2] * q2 + gyro_tensor[d1][d0] * q0;
-            r2 =
-                0.5 * pp2[i] - g2pidt * p2[i] + gyro_tensor[d2][d0] * q0 + gyro_tensor[d2][d1] * q1;
+        } break;
+
+        case GYROTROPIC_SATURATED: {
+          const double dt2pi = 2 * pi * dt;
+
+          PLOOP_OVER_IVECS(gv, lo, hi, i) {
+            const double q0 = -omega2pidt * p0[i] + 0.5 * alpha * pp0[i] + dt2pi * s[i] * w0[i];
+            const double q1 = -omega2pidt * p1[i] + 0.5 * alpha * pp1[i] +
+                              dt2pi * s[i] * (w1 ? OFFDIAGW(w1, is1, is) : 0);
+            const double q2 = -omega2pidt * p2[i] + 0.5 * alpha * pp2[i] +
+                              dt2pi * s[i] * (w2 ? OFFDIAGW(w2, is2, is) : 0);
+
+            const double r0 = 0.5 * pp0[i] - g2pidt * p0[i] + g01 * q1 + g02 * q2;
+            const double r1 = 0.5 * pp1[i] - g2pidt * p1[i] + g12 * q2 + g10 * q0;
+            const double r2 = 0.5 * pp2[i] - g2pidt * p2[i] + g20 * q0 + g21 * q1;
 
             pp0[i] = p0[i];
             pp1[i] = p1[i];
             pp2[i] = p2[i];
-            p0[i] = inv[d0][d0] * r0 + inv[d0][d1] * r1 + inv[d0][d2] * r2;
-            p1[i] = inv[d1][d0] * r0 + inv[d1][d1] * r1 + inv[d1][d2] * r2;
-            p2[i] = inv[d2][d0] * r0 + inv[d2][d1] * r1 + inv[d2][d2] * r2;
+            p0[i] = i00 * r0 + i01 * r1 + i02 * r2;
+            p1[i] = i10 * r0 + i11 * r1 + i12 * r2;
+            p2[i] = i20 * r0 + i21 * r1 + i22 * r2;
           }
-        }
+        } break;
       }
-    } break;
+    }
   }
 }
 
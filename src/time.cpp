@@ -15,15 +15,98 @@
 %  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 */
 
+#include <algorithm>
+#include <numeric>
+#include <string.h>
+
 #include "meep.hpp"
+#include "config.h"
+
+#ifdef HAVE_PAPI
+#include <papi.h>
+#endif
 
 using namespace std;
 
 namespace meep {
 
+/* With PAPI, the hardware counters below are read (on the calling thread)
+   whenever the time_sink changes and around each step_phase sweep, and
+   print_times reports the achieved instruction rate, flop rate, DRAM
+   bandwidth (estimated as 64 bytes per last-level cache miss) and
+   arithmetic intensity of each.  When OpenMP threads split the chunks,
+   only the master thread's share is counted, so the counts are most
+   meaningful with one thread per process. */
+enum { HwCycles, HwInstructions, HwLLCMisses, HwFlops, HwVectorInstructions, HwTime };
+#ifdef HAVE_PAPI
+static int hw_eventset = PAPI_NULL;
+static int hw_nevents = -1;                     // -1 before hw_init, 0 if unavailable
+static int hw_counter_index[MEEP_MAX_HW_COUNTERS]; // counter of each event in hw_eventset
+
+static bool hw_init() {
+  if (hw_nevents >= 0) return hw_nevents > 0;
+  hw_nevents = 0;
+  if (PAPI_library_init(PAPI_VER_CURRENT) != PAPI_VER_CURRENT) return false;
+  if (PAPI_create_eventset(&hw_eventset) != PAPI_OK) return false;
+  const int events[MEEP_MAX_HW_COUNTERS] = {PAPI_TOT_CYC, PAPI_TOT_INS, PAPI_L3_TCM,
+                                            MEEP_SINGLE ? PAPI_SP_OPS : PAPI_DP_OPS, PAPI_VEC_INS};
+  for (int k = 0; k < MEEP_MAX_HW_COUNTERS; ++k) // skip unavailable or conflicting events
+    if (PAPI_add_event(hw_eventset, events[k]) == PAPI_OK) hw_counter_index[hw_nevents++] = k;
+  if (hw_nevents > 0 && PAPI_start(hw_eventset) != PAPI_OK) hw_nevents = 0;
+  return hw_nevents > 0;
+}
+
+// the current counter values (0 for unavailable counters) and wall time
+static void hw_read(double *c) {
+  for (int k = 0; k < MEEP_MAX_HW_COUNTERS; ++k)
+    c[k] = 0;
+  long long vals[MEEP_MAX_HW_COUNTERS];
+  if (hw_init() && PAPI_read(hw_eventset, vals) == PAPI_OK)
+    for (int i = 0; i < hw_nevents; ++i)
+      c[hw_counter_index[i]] = double(vals[i]);
+  c[MEEP_MAX_HW_COUNTERS] = wall_time();
+}
+#endif
+
+void fields::hw_sink_switch(time_sink s) {
+#ifdef HAVE_PAPI
+  double c[MEEP_MAX_HW_COUNTERS + 1];
+  hw_read(c);
+  if (hw_last[MEEP_MAX_HW_COUNTERS] >= 0)
+    for (int k = 0; k <= MEEP_MAX_HW_COUNTERS; ++k)
+      hw_counts[s][k] += c[k] - hw_last[k];
+  for (int k = 0; k <= MEEP_MAX_HW_COUNTERS; ++k)
+    hw_last[k] = c[k];
+#else
+  (void)s;
+#endif
+}
+
+void fields::hw_phase_begin(double *start) {
+#ifdef HAVE_PAPI
+  hw_read(start);
+#else
+  (void)start;
+#endif
+}
+
+void fields::hw_phase_end(const double *start, step_phase p) {
+#ifdef HAVE_PAPI
+  double c[MEEP_MAX_HW_COUNTERS + 1];
+  hw_read(c);
+  for (int k = 0; k <= MEEP_MAX_HW_COUNTERS; ++k)
+    hw_counts[Other + 1 + p][k] += c[k] - start[k];
+#else
+  (void)start;
+  (void)p;
+#endif
+}
+
 void fields::finished_working() {
   double now = wall_time();
   if (last_wall_time >= 0) times_spent[working_on] += now - last_wall_time;
+  if (tracing) record_trace(trace_event::Phase, working_on, last_wall_time, now);
+  hw_sink_switch(working_on);
   last_wall_time = now;
   working_on = was_working_on[0];
   for (int i = 0; i < MEEP_TIMING_STACK_SZ - 1; ++i)
@@ -34,6 +117,8 @@ void fields::finished_working() {
 void fields::am_now_working_on(time_sink s) {
   double now = wall_time();
   if (last_wall_time >= 0) times_spent[working_on] += now - last_wall_time;
+  if (tracing) record_trace(trace_event::Phase, working_on, last_wall_time, now);
+  hw_sink_switch(working_on);
   last_wall_time = now;
   for (int i = MEEP_TIMING_STACK_SZ - 1; i > 0; --i)
     was_working_on[i] = was_working_on[i - 1];
@@ -47,6 +132,13 @@ void fields::reset_timers() {
   working_on = Other;
   for (int i = 0; i <= Other; ++i)
     times_spent[i] = 0;
+  for (int i = 0; i < NUM_FIELD_TYPES; ++i)
+    boundary_times[i] = 0;
+  for (int i = 0; i < Other + 1 + NUM_STEP_PHASES; ++i)
+    for (int k = 0; k <= MEEP_MAX_HW_COUNTERS; ++k)
+      hw_counts[i][k] = 0;
+  for (int k = 0; k <= MEEP_MAX_HW_COUNTERS; ++k)
+    hw_last[k] = -1;
   last_wall_time = -1;
   am_now_working_on(Other);
 }
@@ -121,6 +213,282 @@ void fields::print_times() {
     master_printf("\n");
     delete[] alltimes;
   }
+
+  print_hw_counters();
+}
+
+std::vector<double> fields::get_chunk_costs() {
+  double *costs_tmp = new double[num_chunks];
+  double *costs = new double[num_chunks];
+  for (int i = 0; i < num_chunks; ++i)
+    costs_tmp[i] = chunks[i]->is_mine() ? chunks[i]->cost_time : 0;
+  sum_to_all(costs_tmp, costs, num_chunks);
+  std::vector<double> result(costs, costs + num_chunks);
+  delete[] costs_tmp;
+  delete[] costs;
+  return result;
+}
+
+void fields::print_chunk_costs() {
+  const std::vector<double> costs = get_chunk_costs();
+  const int steps = t > 0 ? t : 1;
+  master_printf("\nChunk costs (s/step), predicted vs. measured:\n");
+  for (int i = 0; i < num_chunks; ++i)
+    master_printf("    chunk %d (process %d): %g vs. %g\n", i, chunks[i]->n_proc(),
+                  chunks[i]->s->cost, costs[i] / steps);
+  master_printf("\n");
+}
+
+std::vector<double> fields::get_step_times() {
+  const int n = num_chunks * NUM_STEP_PHASES;
+  double *times_tmp = new double[n];
+  double *times = new double[n];
+  for (int i = 0; i < num_chunks; ++i)
+    for (int p = 0; p < NUM_STEP_PHASES; ++p)
+      times_tmp[i * NUM_STEP_PHASES + p] = chunks[i]->is_mine() ? chunks[i]->phase_time[p] : 0;
+  sum_to_all(times_tmp, times, n);
+  std::vector<double> result(times, times + n);
+  delete[] times_tmp;
+  delete[] times;
+  return result;
+}
+
+std::vector<double> fields::get_boundary_times() {
+  const int n = count_processors() * NUM_FIELD_TYPES;
+  double *times_tmp = new double[n];
+  double *times = new double[n];
+  for (int i = 0; i < n; ++i)
+    times_tmp[i] = i / NUM_FIELD_TYPES == my_rank() ? boundary_times[i % NUM_FIELD_TYPES] : 0;
+  sum_to_all(times_tmp, times, n);
+  std::vector<double> result(times, times + n);
+  delete[] times_tmp;
+  delete[] times;
+  return result;
+}
+
+static const char *step_phase_name(int p) {
+  switch (p) {
+    case StepCurl: return "curl";
+    case StepConstitutive: return "constitutive";
+    case StepPolarizations: return "polarizations";
+    case StepSources: return "sources";
+    case StepDFTs: return "dfts";
+  }
+  return "unknown";
+}
+
+static const char *field_type_name(int ft) {
+  static const char *names[NUM_FIELD_TYPES] = {"E", "H", "D", "B", "PE", "PH", "WE", "WH"};
+  return names[ft];
+}
+
+/* Per-process min/mean/max of a quantity given per process, and the
+   imbalance max/mean (1 for a perfectly balanced load). */
+namespace {
+struct proc_stats {
+  double min, mean, max, imbalance;
+  proc_stats(const std::vector<double> &x) {
+    min = *std::min_element(x.begin(), x.end());
+    max = *std::max_element(x.begin(), x.end());
+    mean = std::accumulate(x.begin(), x.end(), 0.0) / x.size();
+    imbalance = mean > 0 ? max / mean : 1.0;
+  }
+};
+} // namespace
+
+/* The timings are gathered on all processes (so that this must be called
+   collectively) and written by the master process.  Each record is a
+   (kind, index, process, name, seconds) tuple, where kind is "chunk"
+   (a step_phase of one chunk), "boundary" (a field_type of step_boundaries
+   on one process), or "stats" (min/mean/max/imbalance over the processes
+   of a step_phase or boundary time, totalled over the chunks of each). */
+void fields::output_step_times(const char *fname) {
+  const std::vector<double> chunk_times = get_step_times();
+  const std::vector<double> bnd_times = get_boundary_times();
+  const int n = count_processors();
+
+  const size_t len = strlen(fname);
+  const bool json = len >= 5 && !strcmp(fname + len - 5, ".json");
+  FILE *f = master_fopen(fname, "w");
+  if (!f) abort("Unable to open step-timing output file %s\n", fname);
+
+  const char *fmt_rec = json ? "%s\n  {\"kind\": \"%s\", \"index\": %d, \"process\": %d, "
+                               "\"name\": \"%s\", \"seconds\": %g}"
+                             : "%s%s,%d,%d,%s,%g\n";
+  const char *sep = json ? "[" : "kind,index,process,name,seconds\n";
+  for (int i = 0; i < num_chunks; ++i)
+    for (int p = 0; p < NUM_STEP_PHASES; ++p) {
+      master_fprintf(f, fmt_rec, sep, "chunk", i, chunks[i]->n_proc(), step_phase_name(p),
+                     chunk_times[i * NUM_STEP_PHASES + p]);
+      sep = json ? "," : "";
+    }
+  for (int j = 0; j < n; ++j)
+    for (int ft = 0; ft < NUM_FIELD_TYPES; ++ft)
+      master_fprintf(f, fmt_rec, sep, "boundary", ft, j, field_type_name(ft),
+                     bnd_times[j * NUM_FIELD_TYPES + ft]);
+
+  const char *fmt_stats = json ? "%s\n  {\"kind\": \"stats\", \"index\": %d, \"process\": -1, "
+                                 "\"name\": \"%s:%s\", \"seconds\": %g}"
+                               : "%sstats,%d,-1,%s:%s,%g\n";
+  std::vector<double> per_proc(n);
+  for (int p = 0; p < NUM_STEP_PHASES + NUM_FIELD_TYPES; ++p) {
+    std::fill(per_proc.begin(), per_proc.end(), 0.0);
+    if (p < NUM_STEP_PHASES)
+      for (int i = 0; i < num_chunks; ++i)
+        per_proc[chunks[i]->n_proc()] += chunk_times[i * NUM_STEP_PHASES + p];
+    else
+      for (int j = 0; j < n; ++j)
+        per_proc[j] = bnd_times[j * NUM_FIELD_TYPES + p - NUM_STEP_PHASES];
+    const proc_stats st(per_proc);
+    const char *name =
+        p < NUM_STEP_PHASES ? step_phase_name(p) : field_type_name(p - NUM_STEP_PHASES);
+    master_fprintf(f, fmt_stats, sep, p, name, "min", st.min);
+    sep = json ? "," : "";
+    master_fprintf(f, fmt_stats, sep, p, name, "mean", st.mean);
+    master_fprintf(f, fmt_stats, sep, p, name, "max", st.max);
+    master_fprintf(f, fmt_stats, sep, p, name, "imbalance", st.imbalance);
+  }
+  if (json) master_fprintf(f, "\n]\n");
+  master_fclose(f);
+}
+
+namespace {
+struct cost_greater {
+  const std::vector<double> &costs;
+  cost_greater(const std::vector<double> &c) : costs(c) {}
+  bool operator()(int i, int j) const { return costs[i] > costs[j]; }
+};
+} // namespace
+
+/* Greedily assign the chunks, most expensive first, to the process with
+   the least total measured cost so far (the "LPT" heuristic, within 4/3
+   of the optimal maximum load).  Since the costs are summed to all
+   processes, every process computes the same assignment.  The result
+   can be passed, along with the current chunk volumes, to
+   structure::load_chunk_layout to rebalance a new structure/fields. */
+std::vector<int> fields::choose_chunk_owners() {
+  const std::vector<double> costs = get_chunk_costs();
+  const int n = count_processors();
+  std::vector<int> order(num_chunks), owners(num_chunks);
+  for (int i = 0; i < num_chunks; ++i)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), cost_greater(costs));
+  std::vector<double> load(n, 0.0), oldload(n, 0.0);
+  for (int k = 0; k < num_chunks; ++k) {
+    const int i = order[k];
+    oldload[chunks[i]->n_proc()] += costs[i];
+    int p = std::min_element(load.begin(), load.end()) - load.begin();
+    owners[i] = p;
+    load[p] += costs[i];
+  }
+  if (verbosity > 0 && n > 1) {
+    const double total = std::accumulate(load.begin(), load.end(), 0.0);
+    if (total > 0)
+      master_printf("chunk load imbalance (max/mean cost): %g -> %g\n",
+                    *std::max_element(oldload.begin(), oldload.end()) * n / total,
+                    *std::max_element(load.begin(), load.end()) * n / total);
+  }
+  return owners;
 }
 
+void fields::start_trace(size_t max_events) {
+  if (max_events == 0) abort("start_trace needs max_events > 0");
+  trace_events.resize(max_events);
+  trace_count = 0;
+  all_wait(); // so that the trace_t0 of all processes are (nearly) the same
+  trace_t0 = wall_time();
+  tracing = true;
+}
+
+void fields::stop_trace() { tracing = false; }
+
+void fields::record_trace(trace_event::kind_t kind, int what, double start, double end, int peer,
+                          size_t bytes) {
+  if (start < trace_t0 || end <= start) return; // before start_trace, or empty
+  trace_event &e = trace_events[trace_count++ % trace_events.size()];
+  e.kind = kind;
+  e.what = what;
+  e.peer = peer;
+  e.bytes = bytes;
+  e.start = start - trace_t0;
+  e.end = end - trace_t0;
+}
+
+/* Each process appends its events in turn, in the order they were
+   recorded (oldest first if the ring buffer wrapped), with pid = rank.
+   The phases and the exchanges are shown as separate threads, since the
+   exchanges overlap the phases that start and finish them. */
+void fields::output_trace(const char *fname) {
+  FILE *f = master_fopen(fname, "w");
+  if (!f) abort("Unable to open trace output file %s\n", fname);
+  master_fprintf(f, "{\"traceEvents\": [");
+  master_fclose(f);
+
+  begin_critical_section(2718);
+  f = fopen(fname, "a");
+  if (!f) abort("Unable to append to trace output file %s\n", fname);
+  const int rank = my_rank();
+  fprintf(f, "%s\n  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+             "\"args\": {\"name\": \"process %d\"}}",
+          rank ? "," : "", rank, rank);
+  const size_t n = std::min(trace_count, trace_events.size());
+  for (size_t k = 0; k < n; ++k) {
+    const trace_event &e = trace_events[(trace_count - n + k) % trace_events.size()];
+    const double ts = e.start * 1e6, dur = (e.end - e.start) * 1e6; // in microseconds
+    switch (e.kind) {
+      case trace_event::Phase:
+        fprintf(f, ",\n  {\"name\": \"%s\", \"cat\": \"phase\", \"ph\": \"X\", \"ts\": %.3f, "
+                   "\"dur\": %.3f, \"pid\": %d, \"tid\": 0}",
+                ts2n((time_sink)e.what), ts, dur, rank);
+        break;
+      case trace_event::Exchange:
+        fprintf(f, ",\n  {\"name\": \"exchange %s\", \"cat\": \"comm\", \"ph\": \"X\", "
+                   "\"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": 1, "
+                   "\"args\": {\"peer\": %d, \"bytes\": %zu}}",
+                field_type_name(e.what), ts, dur, rank, e.peer, e.bytes);
+        break;
+      case trace_event::Wait:
+        fprintf(f, ",\n  {\"name\": \"wait %s\", \"cat\": \"comm\", \"ph\": \"X\", \"ts\": %.3f, "
+                   "\"dur\": %.3f, \"pid\": %d, \"tid\": 2}",
+                field_type_name(e.what), ts, dur, rank);
+        break;
+    }
+  }
+  if (trace_count > trace_events.size())
+    fprintf(f, ",\n  {\"name\": \"%zu earlier events dropped\", \"ph\": \"i\", \"s\": \"p\", "
+               "\"ts\": 0, \"pid\": %d, \"tid\": 0}",
+            trace_count - trace_events.size(), rank);
+  fclose(f);
+  end_critical_section(2718);
+  all_wait();
+
+  f = master_fopen(fname, "a");
+  master_fprintf(f, "\n]}\n");
+  master_fclose(f);
+}
+
+void fields::print_hw_counters() {
+#ifdef HAVE_PAPI
+  const int nslots = Other + 1 + NUM_STEP_PHASES, nc = MEEP_MAX_HW_COUNTERS + 1;
+  std::vector<double> total(nslots * nc);
+  sum_to_master(&hw_counts[0][0], &total[0], nslots * nc);
+  if (!hw_init()) return;
+  const int np = count_processors();
+  master_printf("\nHardware counters (all processes):\n");
+  master_printf("    %21s  %8s %5s %8s %9s %9s %6s\n", "", "Ginstr/s", "IPC", "Gflop/s",
+                "DRAM GB/s", "flop/byte", "vec %");
+  for (int i = 0; i < nslots; ++i) {
+    const double *c = &total[i * nc];
+    const double t = c[HwTime] / np; // mean wall time over the processes
+    if (c[HwCycles] <= 0 || t <= 0) continue;
+    const double dram = c[HwLLCMisses] * 64; // bytes, assuming 64-byte cache lines
+    master_printf("    %21s: %8.3g %5.2f %8.3g %9.3g %9.3g %6.1f\n",
+                  i <= Other ? ts2n((time_sink)i) : step_phase_name(i - Other - 1),
+                  c[HwInstructions] / t * 1e-9, c[HwInstructions] / c[HwCycles],
+                  c[HwFlops] / t * 1e-9, dram / t * 1e-9, dram > 0 ? c[HwFlops] / dram : 0.0,
+                  c[HwInstructions] > 0 ? 100 * c[HwVectorInstructions] / c[HwInstructions] : 0.0);
+  }
+  master_printf("\n");
+#endif
+}
 } // namespace meep
@@ -19,6 +19,7 @@
 
 #include "meep.hpp"
 #include "meep_internals.hpp"
+#include "config.h"
 
 using namespace std;
 
@@ -26,10 +27,24 @@ namespace meep {
 
 void fields::update_eh(field_type ft, bool skip_w_components) {
   if (ft != E_stuff && ft != H_stuff) abort("update_eh only works with E/H");
+  bool changed = false;
+  double hw_start[MEEP_MAX_HW_COUNTERS + 1];
+  hw_phase_begin(hw_start);
+  const bool thread_chunks = parallel_chunk_loops();
+  (void)thread_chunks; // unused without OpenMP
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(|| : changed) if (thread_chunks)
+#endif
   for (int i = 0; i < num_chunks; i++)
-    if (chunks[i]->is_mine())
-      if (chunks[i]->update_eh(ft, skip_w_components))
-        chunk_connections_valid = false; // E/H allocated - reconnect chunks
+    if (steps_chunk(i)) {
+      const double t0 = wall_time();
+      if (chunks[i]->update_eh(ft, skip_w_components)) changed = true;
+      const double dt_wall = wall_time() - t0;
+      chunks[i]->cost_time += dt_wall;
+      chunks[i]->phase_time[StepConstitutive] += dt_wall;
+    }
+  hw_phase_end(hw_start, StepConstitutive);
+  if (changed) chunk_connections_valid = false; // E/H allocated - reconnect chunks
 }
 
 bool fields_chunk::needs_W_prev(component c) const {
@@ -61,10 +76,13 @@ bool fields_chunk::update_eh(field_type ft, bool skip_w_components) {
           need_fmp = need_fmp || p->s->needs_P(ec, cmp, f);
       }
       if (need_fmp) {
-        if (!f_minus_p[dc][cmp]) f_minus_p[dc][cmp] = new realnum[gv.ntot()];
+        if (!f_minus_p[dc][cmp]) {
+          f_minus_p[dc][cmp] = arena->alloc();
+          array_fill(f_minus_p[dc][cmp], gv.ntot(), 0.0); // first touch, see array_malloc
+        }
       }
       else if (f_minus_p[dc][cmp]) { // remove unneeded f_minus_p
-        delete[] f_minus_p[dc][cmp];
+        arena->free(f_minus_p[dc][cmp]);
         f_minus_p[dc][cmp] = 0;
       }
     }
@@ -85,16 +103,24 @@ bool fields_chunk::update_eh(field_type ft, bool skip_w_components) {
   //////////////////////////////////////////////////////////////////////////
   // First, initialize f_minus_p to D - P, if necessary
 
-  FOR_FT_COMPONENTS(ft, ec) if (f[ec][0]) {
-    component dc = field_type_component(ft2, ec);
-    DOCMP if (f_minus_p[dc][cmp]) {
-      realnum *fmp = f_minus_p[dc][cmp];
-      memcpy(fmp, f[dc][cmp], sizeof(realnum) * ntot);
+  std::vector<void *> pole_data; // Lorentzian poles are subtracted all at once
+  for (polarization_state *p = pol[ft]; p; p = p->next)
+    if (is_fused_pole(p)) pole_data.push_back(p->data);
+
+  if (!pole_data.empty())
+    lorentzian_susceptibility::subtract_P_poles(ft, int(pole_data.size()), &pole_data[0], f,
+                                                f_minus_p);
+  else
+    FOR_FT_COMPONENTS(ft, ec) if (f[ec][0]) {
+      component dc = field_type_component(ft2, ec);
+      DOCMP if (f_minus_p[dc][cmp]) {
+        realnum *fmp = f_minus_p[dc][cmp];
+        memcpy(fmp, f[dc][cmp], sizeof(realnum) * ntot);
+      }
     }
-  }
 
   for (polarization_state *p = pol[ft]; p; p = p->next)
-    if (p->data) p->s->subtract_P(ft, f_minus_p, p->data);
+    if (p->data && !is_fused_pole(p)) p->s->subtract_P(ft, f_minus_p, p->data);
 
   //////////////////////////////////////////////////////////////////////////
   // Next, subtract time-integrated sources (i.e. polarizations, not currents)
@@ -103,10 +129,7 @@ bool fields_chunk::update_eh(field_type ft, bool skip_w_components) {
     for (src_vol *sv = sources[ft2]; sv; sv = sv->next) {
       if (sv->t->is_integrated && f[sv->c][0] && ft == type(sv->c)) {
         component c = field_type_component(ft2, sv->c);
-        for (size_t j = 0; j < sv->npts; ++j) {
-          const complex<double> A = sv->dipole(j);
-          DOCMP { f_minus_p[c][cmp][sv->index[j]] -= (cmp) ? imag(A) : real(A); }
-        }
+        sv->subtract_from(f_minus_p[c][0], is_real ? NULL : f_minus_p[c][1], sv->t->dipole());
       }
     }
   }
@@ -138,15 +161,15 @@ bool fields_chunk::update_eh(field_type ft, bool skip_w_components) {
       // lazily allocate any E/H fields that are needed (H==B initially)
       if (f[ec][cmp] == f[dc][cmp] &&
           (s->chi1inv[ec][d_ec] || have_f_minus_p || dsigw != NO_DIRECTION)) {
-        f[ec][cmp] = new realnum[gv.ntot()];
-        memcpy(f[ec][cmp], f[dc][cmp], gv.ntot() * sizeof(realnum));
+        f[ec][cmp] = arena->alloc();
+        array_copy(f[ec][cmp], f[dc][cmp], gv.ntot());
         allocated_eh = true;
       }
 
       // lazily allocate W auxiliary field
       if (!f_w[ec][cmp] && dsigw != NO_DIRECTION) {
-        f_w[ec][cmp] = new realnum[gv.ntot()];
-        memcpy(f_w[ec][cmp], f[ec][cmp], gv.ntot() * sizeof(realnum));
+        f_w[ec][cmp] = arena->alloc();
+        array_copy(f_w[ec][cmp], f[ec][cmp], gv.ntot());
         if (needs_W_notowned(ec)) allocated_eh = true; // communication needed
       }
 
@@ -155,16 +178,29 @@ bool fields_chunk::update_eh(field_type ft, bool skip_w_components) {
 
       // save W field from this timestep in f_w_prev if needed by pols
       if (needs_W_prev(ec)) {
-        if (!f_w_prev[ec][cmp]) f_w_prev[ec][cmp] = new realnum[gv.ntot()];
-        memcpy(f_w_prev[ec][cmp], f_w[ec][cmp] ? f_w[ec][cmp] : f[ec][cmp],
-               sizeof(realnum) * gv.ntot());
+        if (!f_w_prev[ec][cmp]) f_w_prev[ec][cmp] = arena->alloc();
+        array_copy(f_w_prev[ec][cmp], f_w[ec][cmp] ? f_w[ec][cmp] : f[ec][cmp], gv.ntot());
+      }
+
+      if (eh_fused[ec][cmp]) { // already updated in step_db
+        eh_fused[ec][cmp] = false;
+        continue;
       }
 
-      if (f[ec][cmp] != f[dc][cmp])
-        STEP_UPDATE_EDHB(f[ec][cmp], ec, gv, dmp[dc][cmp], dmp[dc_1][cmp], dmp[dc_2][cmp],
-                         s->chi1inv[ec][d_ec], dmp[dc_1][cmp] ? s->chi1inv[ec][d_1] : NULL,
-                         dmp[dc_2][cmp] ? s->chi1inv[ec][d_2] : NULL, s_ec, s_1, s_2, s->chi2[ec],
-                         s->chi3[ec], f_w[ec][cmp], dsigw, s->sig[dsigw], s->kap[dsigw]);
+      if (f[ec][cmp] == f[dc][cmp]) continue;
+      const realnum *u1 = dmp[dc_1][cmp] ? s->chi1inv[ec][d_1] : NULL;
+      const realnum *u2 = dmp[dc_2][cmp] ? s->chi1inv[ec][d_2] : NULL;
+      // with a known nonlinear box, step linearly and then redo the box with chi2/chi3
+      const bool nl_box = s->chi3[ec] && !s->nonlinear_box_stale;
+      STEP_UPDATE_EDHB(f[ec][cmp], ec, gv, dmp[dc][cmp], dmp[dc_1][cmp], dmp[dc_2][cmp],
+                       s->chi1inv[ec][d_ec], u1, u2, s_ec, s_1, s_2, nl_box ? NULL : s->chi2[ec],
+                       nl_box ? NULL : s->chi3[ec], f_w[ec][cmp], dsigw, s->sig[dsigw],
+                       s->kap[dsigw]);
+      if (nl_box)
+        STEP_NONLINEAR_EDHB(f[ec][cmp], gv, s->nonlinear_lo[ec], s->nonlinear_hi[ec],
+                            dmp[dc][cmp], dmp[dc_1][cmp], dmp[dc_2][cmp], s->chi1inv[ec][d_ec],
+                            u1, u2, s_ec, s_1, s_2, s->chi2[ec], s->chi3[ec], f_w[ec][cmp],
+                            dsigw, s->sig[dsigw], s->kap[dsigw]);
     }
   }
 
@@ -28,9 +28,24 @@ using namespace std;
 namespace meep {
 
 void fields::update_pols(field_type ft) {
+  bool changed = false;
+  double hw_start[MEEP_MAX_HW_COUNTERS + 1];
+  hw_phase_begin(hw_start);
+  const bool thread_chunks = parallel_chunk_loops();
+  (void)thread_chunks; // unused without OpenMP
+#ifdef HAVE_OPENMP
+#pragma omp parallel for schedule(dynamic) reduction(|| : changed) if (thread_chunks)
+#endif
   for (int i = 0; i < num_chunks; i++)
-    if (chunks[i]->is_mine())
-      if (chunks[i]->update_pols(ft)) chunk_connections_valid = false;
+    if (chunks[i]->is_mine()) {
+      const double t0 = wall_time();
+      if (chunks[i]->update_pols(ft)) changed = true;
+      const double dt_wall = wall_time() - t0;
+      chunks[i]->cost_time += dt_wall;
+      chunks[i]->phase_time[StepPolarizations] += dt_wall;
+    }
+  hw_phase_end(hw_start, StepPolarizations);
+  if (changed) chunk_connections_valid = false;
 }
 
 bool fields_chunk::update_pols(field_type ft) {
@@ -39,6 +54,9 @@ bool fields_chunk::update_pols(field_type ft) {
   realnum *w[NUM_FIELD_COMPONENTS][2];
   FOR_COMPONENTS(c) DOCMP2 { w[c][cmp] = f_w[c][cmp] ? f_w[c][cmp] : f[c][cmp]; }
 
+  std::vector<const lorentzian_susceptibility *> poles;
+  std::vector<void *> pole_data;
+
   for (polarization_state *p = pol[ft]; p; p = p->next) {
 
     // Lazily allocate internal polarization data:
@@ -50,9 +68,17 @@ bool fields_chunk::update_pols(field_type ft) {
       }
     }
 
-    // Finally, timestep the polarizations:
-    p->s->update_P(w, f_w_prev, dt, gv, p->data);
+    // Finally, timestep the polarizations (Lorentzian poles all at once, below):
+    if (is_fused_pole(p)) {
+      poles.push_back((const lorentzian_susceptibility *)p->s);
+      pole_data.push_back(p->data);
+    }
+    else
+      p->s->update_P(w, f_w_prev, dt, gv, p->data);
   }
+  if (!poles.empty())
+    lorentzian_susceptibility::update_P_poles(int(poles.size()), &poles[0], &pole_data[0], w,
+                                              f_w_prev, dt, gv);
 
   return allocated_fields;
 }
@@ -173,6 +173,13 @@ volume::volume(const vec &pt) {
 volume::volume(const volume &vol)
     : dim(vol.dim), min_corner(vol.min_corner), max_corner(vol.max_corner) {}
 
+volume &volume::operator=(const volume &vol) {
+  dim = vol.dim;
+  min_corner = vol.min_corner;
+  max_corner = vol.max_corner;
+  return *this;
+}
+
 double volume::computational_volume() const {
   double vol = 1.0;
   LOOP_OVER_DIRECTIONS(dim, d) { vol *= in_direction(d); }
@@ -1107,6 +1114,63 @@ std::vector<grid_volume> grid_volume::split_into_n(int n) const {
   return result;
 }
 
+/* Split into n pieces of (nearly) equal get_cost() by recursive bisection,
+   appending them to result.  n may be any number (not just a product of
+   small primes).  At each level, the n pieces are divided into n/2 and
+   n - n/2 on either side of a plane, where for each direction the plane is
+   placed to balance the cost per piece, and the direction is chosen to
+   minimize that cost per piece plus the cost of communicating across the
+   plane (estimated as one pixel update per pixel in the plane).  This is
+   like building a k-d tree, and prefers compact chunks to thin slabs. */
+void grid_volume::split_by_bisection(int n, std::vector<grid_volume> &result) const {
+  if (size_t(n) > nowned_min())
+    abort("Cannot split %zd grid points into %d parts\n", nowned_min(), n);
+  if (n == 1) {
+    result.push_back(*this);
+    return;
+  }
+  const int n_low = n / 2, n_high = n - n_low;
+  const double pixel_cost = get_cost() / nowned_min();
+
+  double best_score = infinity;
+  int best_split_point = 0;
+  direction best_split_direction = NO_DIRECTION;
+  LOOP_OVER_DIRECTIONS(dim, d) {
+    size_t area = 1;
+    LOOP_OVER_DIRECTIONS(dim, dd) {
+      if (dd != d) area *= num_direction(dd);
+    }
+    // each side needs at least as many pixels as pieces
+    int first = (int)((n_low + area - 1) / area);
+    int last = num_direction(d) - (int)((n_high + area - 1) / area);
+    if (first > last) continue;
+    while (last - first > 1) { // bisection search for left_cost/n_low == right_cost/n_high
+      const int mid = (first + last) / 2;
+      const std::complex<double> costs = get_split_costs(d, mid);
+      if (real(costs) * n_high < imag(costs) * n_low)
+        first = mid;
+      else
+        last = mid;
+    }
+    for (int split_point = first; split_point <= last; ++split_point) {
+      const std::complex<double> costs = get_split_costs(d, split_point);
+      const double score = max(real(costs) / n_low, imag(costs) / n_high) + area * pixel_cost;
+      if (score < best_score) {
+        best_score = score;
+        best_split_point = split_point;
+        best_split_direction = d;
+      }
+    }
+  }
+  if (best_split_direction == NO_DIRECTION) abort("cannot bisect grid_volume into %d parts\n", n);
+
+  const int num_in_split_dir = num_direction(best_split_direction);
+  split_at_fraction(false, best_split_point, best_split_direction, num_in_split_dir)
+      .split_by_bisection(n_low, result);
+  split_at_fraction(true, best_split_point, best_split_direction, num_in_split_dir)
+      .split_by_bisection(n_high, result);
+}
+
 grid_volume grid_volume::split_at_fraction(bool want_high, int numer, int bestd,
                                            int bestlen) const {
 
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <meep.hpp>
+using namespace meep;
+
+/* allocate narrays arrays of n realnums from a chunk_arena: they must be
+   aligned and must not overlap, freed arrays must be reused, and the
+   blocks must not reserve much more than was asked for */
+static void check_arena(size_t n, int narrays) {
+  chunk_arena arena(n);
+  realnum **a = new realnum *[narrays];
+  for (int i = 0; i < narrays; ++i) {
+    a[i] = arena.alloc();
+    if ((uintptr_t)a[i] % 64)
+      abort("chunk_arena: array %d of %zd realnums is not aligned", i, n);
+    for (size_t j = 0; j < n; ++j)
+      a[i][j] = i;
+  }
+  for (int i = 0; i < narrays; ++i)
+    for (size_t j = 0; j < n; ++j)
+      if (a[i][j] != i) abort("chunk_arena: array %d of %zd realnums overlaps another", i, n);
+
+  // at most one cache line of padding per array, and 7 unused arrays
+  const size_t stride = n + 2 * 64 / sizeof(realnum);
+  if (arena.bytes() > (narrays + 7) * stride * sizeof(realnum))
+    abort("chunk_arena: %zd bytes reserved for %d arrays of %zd realnums", arena.bytes(), narrays,
+          n);
+
+  const size_t bytes = arena.bytes();
+  arena.free(a[narrays / 2]);
+  if (arena.alloc() != a[narrays / 2]) abort("chunk_arena: a freed array was not reused");
+  if (arena.bytes() != bytes) abort("chunk_arena: reusing a freed array allocated a new block");
+  delete[] a;
+}
+
+/* array_malloc returns aligned arrays, with and without huge pages (explicit
+   huge pages falling back to transparent ones if none are reserved), and
+   array_fill and array_copy set every element */
+static void check_array_alloc(huge_pages_mode mode) {
+  set_huge_pages(mode);
+  if (get_huge_pages() != mode)
+    abort("get_huge_pages: mode %d instead of %d", get_huge_pages(), mode);
+  const size_t sizes[] = {1, 1000, 100000, 3 * 1024 * 1024 / sizeof(realnum)};
+  for (int k = 0; k < 4; ++k) {
+    const size_t n = sizes[k];
+    realnum *a = new_realnum_array(n), *b = new_realnum_array(n);
+    if ((uintptr_t)a % 64 || (uintptr_t)b % 64)
+      abort("array_malloc: array of %zd realnums is not aligned with huge pages %d", n, mode);
+    array_fill(a, n, 0.5);
+    for (size_t j = 0; j < n; j += 1 + j / 7)
+      a[j] = j;
+    array_fill(b, n, -1);
+    array_copy(b, a, n);
+    for (size_t j = 0; j < n; ++j)
+      if (b[j] != a[j] || (a[j] != 0.5 && a[j] != j))
+        abort("array_fill/array_copy: wrong element %zd of %zd", j, n);
+    array_free(a);
+    array_free(b);
+  }
+  array_free(NULL);
+  set_huge_pages(NoHugePages);
+}
+
+int main(int argc, char **argv) {
+  initialize mpi(argc, argv);
+  verbosity = 0;
+  master_printf("Running chunk_arena tests...\n");
+  const size_t sizes[] = {1, 100, 1024, 4096, 100000};
+  for (int k = 0; k < 5; ++k)
+    for (int narrays = 1; narrays <= 40; narrays += 3)
+      check_arena(sizes[k], narrays);
+  check_array_alloc(NoHugePages);
+  check_array_alloc(TransparentHugePages);
+  check_array_alloc(ExplicitHugePages);
+  return 0;
+}
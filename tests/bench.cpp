@@ -15,300 +15,393 @@
 %  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
 */
 
+/* Performance benchmarks: a matrix of scenarios covering the main
+   features (1D/2D/3D/cylindrical, dispersive and nonlinear materials,
+   PML, DFT monitors, near-to-far transformation, solve_cw, subpixel
+   averaging and HDF5 output), each reporting its throughput in Mcell
+   updates per second, overall and for each step_phase, along with the
+   initialization time and peak memory.
+
+   usage: bench [--only <substring>] [--size <scale>] [--steps <n>] [--weak]
+                [--csv <file>] [--json <file>]
+
+   --size multiplies the linear size of every cell (default 1), --steps
+   sets the number of timed steps (default 200), and --weak grows the
+   cells in proportion to the number of processes (weak scaling) rather
+   than keeping them fixed (strong scaling).  The results are printed and,
+   optionally, written as CSV or JSON for tracking between releases. */
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
 
 #include <meep.hpp>
+#include "config.h"
+
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
 using namespace meep;
+using namespace std;
 
 double one(const vec &) { return 1.0; }
-static double width = 20.0;
-double bump(const vec &pt) { return (fabs(pt.z() - 50.0) > width) ? 1.0 : 12.0; }
+double bump(const vec &pt) { return (fabs(pt.z() - 50.0) > 20.0) ? 1.0 : 12.0; }
+double sphere(const vec &pt) { return abs(pt - vec(1.5, 1.5, 1.5)) < 1.0 ? 12.0 : 1.0; }
+
+struct bench_options {
+  double size;  // linear scale factor of the cells
+  int steps;    // number of timed steps
+  bool weak;    // weak scaling: cell volume proportional to the number of processes
+  const char *only;
+};
 
-struct bench {
-  double time; // In seconds.
-  double gridsteps;
+// the timings of one scenario
+struct bench_result {
+  const char *name;
+  double cells;       // number of grid points
+  int steps;          // number of timed time steps (0 if not a time-stepping benchmark)
+  double init_time;   // seconds to create the structure and fields
+  double time;        // seconds for the timed part
+  double phase_time[NUM_STEP_PHASES];
+  double boundary_time; // time in step_boundaries, mean over the processes
+  double peak_mb;       // peak resident memory, max over the processes
 };
 
-bench bench_periodic(const double rmax, const double zmax, double eps(const vec &)) {
-  const double a = 10.0;
-  const double gridpts = (zmax == 0.0) ? a * rmax : a * a * rmax * zmax;
-  const double ttot = 5.0 + 1e5 / gridpts;
-  const int m = 0;
+static double peak_memory_mb() {
+#if defined(HAVE_SYS_RESOURCE_H) && defined(HAVE_GETRUSAGE)
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) == 0) return max_to_all(ru.ru_maxrss / 1024.0); // KiB on Linux
+#endif
+  return 0;
+}
 
-  grid_volume gv = volcyl(rmax, zmax, a);
-  structure s(gv, eps);
-  fields f(&s, m);
-  f.use_bloch(0.0);
-  f.add_point_source(Ep, 0.7, 2.5, 0.0, 4.0, veccyl(0.5, 0.4), 1.0);
-  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, veccyl(0.401, 0.301), 1.0);
+// the linear scale factor along the first direction for weak scaling
+static double weak_factor(const bench_options &o) { return o.weak ? count_processors() : 1.0; }
 
-  double start = wall_time();
-  while (f.time() < ttot)
+/* Time o.steps steps of f after a few untimed ones (which allocate the
+   fields), taking the phase times from the difference of the chunk timers. */
+static void time_steps(fields &f, const bench_options &o, bench_result &r) {
+  for (int n = 0; n < 5; ++n)
+    f.step();
+  const vector<double> times0 = f.get_step_times();
+  const vector<double> bnd0 = f.get_boundary_times();
+  all_wait();
+  const double start = wall_time();
+  for (int n = 0; n < o.steps; ++n)
     f.step();
-  bench b;
-  b.time = (wall_time() - start);
-  b.gridsteps = ttot * a * 2 * gridpts;
-  // f.print_times();
-  return b;
+  all_wait();
+  r.time = wall_time() - start;
+  r.steps = o.steps;
+  r.cells = f.gv.ntot();
+  const vector<double> times1 = f.get_step_times();
+  const vector<double> bnd1 = f.get_boundary_times();
+  for (int p = 0; p < NUM_STEP_PHASES; ++p)
+    r.phase_time[p] = 0;
+  for (size_t i = 0; i < times1.size(); ++i)
+    r.phase_time[i % NUM_STEP_PHASES] += times1[i] - times0[i];
+  r.boundary_time = 0;
+  for (size_t i = 0; i < bnd1.size(); ++i)
+    r.boundary_time += (bnd1[i] - bnd0[i]) / count_processors();
 }
 
-bench bench_flux_1d(const double zmax, double eps(const vec &)) {
-  const double a = 10.0;
-  const double gridpts = a * zmax;
-  const double ttot = 10.0 + 1e5 / zmax;
-
-  grid_volume gv = volone(zmax, a);
-  structure s(gv, eps, pml(zmax / 6));
-
+static void bench_1d_flux(const bench_options &o, bench_result &r) {
+  const double zmax = 100.0 * o.size * weak_factor(o);
+  double t0 = wall_time();
+  structure s(volone(zmax, 20.0), bump, pml(zmax / 6));
   fields f(&s);
   f.use_real_fields();
   f.add_point_source(Ex, 0.7, 2.5, 0.0, 3.0, vec(zmax / 2 + 0.3), 1.0);
-  flux_vol *left = f.add_flux_plane(vec(zmax / 3.0), vec(zmax / 3.0));
-  flux_vol *right = f.add_flux_plane(vec(zmax * 2.0 / 3.0), vec(zmax * 2.0 / 3.0));
-
-  while (f.time() <= f.last_source_time())
-    f.step();
-
-  grid_volume mid = volone(zmax / 3, a);
-  mid.set_origin(vec(zmax / 3));
-  double flux_energy = 0.0;
-  double start = wall_time();
-  while (f.time() < ttot) {
-    f.step();
-    flux_energy += f.dt * (right->flux() - left->flux());
-  }
-  bench b;
-  b.time = (wall_time() - start);
-  b.gridsteps = ttot * a * 2 * gridpts;
-  // f.print_times();
-  return b;
+  f.add_flux_plane(vec(zmax / 3.0), vec(zmax / 3.0));
+  f.add_flux_plane(vec(zmax * 2.0 / 3.0), vec(zmax * 2.0 / 3.0));
+  r.init_time = wall_time() - t0;
+  time_steps(f, o, r);
 }
 
-bench bench_2d(const double xmax, const double ymax, double eps(const vec &)) {
-  const double a = 10.0;
-  const double gridpts = a * a * xmax * ymax;
-  const double ttot = 5.0 + 1e5 / gridpts;
-
-  grid_volume gv = voltwo(xmax, ymax, a);
-  structure s(gv, eps);
+static void bench_2d_tm(const bench_options &o, bench_result &r) {
+  const double L = 12.0 * o.size;
+  double t0 = wall_time();
+  structure s(voltwo(L * weak_factor(o), L, 10.0), one);
   fields f(&s);
   f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(0.401, 0.301));
-  f.add_point_source(Hz, 0.8, 0.7, 0.0, 4.0, vec(0.431, 0.2));
-
-  while (f.time() < f.last_source_time())
-    f.step();
-  const double tend = f.time() + ttot;
-  double start = wall_time();
-  while (f.time() < tend)
-    f.step();
-  bench b;
-  b.time = (wall_time() - start);
-  b.gridsteps = ttot * a * 2 * gridpts;
-  // f.print_times();
-  return b;
+  r.init_time = wall_time() - t0;
+  time_steps(f, o, r);
 }
 
-const double te_tm_2d_time = 2e5;
-
-bench bench_2d_tm_nonlinear(const double xmax, const double ymax, double eps(const vec &)) {
-  const double a = 10.0;
-  const double gridpts = a * a * xmax * ymax;
-  const double ttot = 5.0 + te_tm_2d_time / gridpts;
-
-  grid_volume gv = voltwo(xmax, ymax, a);
-  structure s(gv, eps);
-  s.set_chi3(eps);
+static void bench_2d_te_nonlinear(const bench_options &o, bench_result &r) {
+  const double L = 10.0 * o.size;
+  double t0 = wall_time();
+  structure s(voltwo(L * weak_factor(o), L, 10.0), one);
+  s.set_chi3(one);
   fields f(&s);
-  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(0.401, 0.301));
-
-  while (f.time() < f.last_source_time())
-    f.step();
-  const double tend = f.time() + ttot;
-  double start = wall_time();
-  while (f.time() < tend)
-    f.step();
-  bench b;
-  b.time = (wall_time() - start);
-  b.gridsteps = ttot * a * 2 * gridpts;
-  // f.print_times();
-  return b;
+  f.add_point_source(Ex, 0.8, 0.6, 0.0, 4.0, vec(0.401, 0.301));
+  f.add_point_source(Hz, 0.6, 0.6, 0.0, 4.0, vec(0.7, 0.5));
+  r.init_time = wall_time() - t0;
+  time_steps(f, o, r);
 }
 
-bench bench_2d_tm(const double xmax, const double ymax, double eps(const vec &)) {
-  const double a = 10.0;
-  const double gridpts = a * a * xmax * ymax;
-  const double ttot = 5.0 + te_tm_2d_time / gridpts;
+static void bench_cyl_periodic(const bench_options &o, bench_result &r) {
+  const double L = 12.0 * o.size;
+  double t0 = wall_time();
+  structure s(volcyl(L, L * weak_factor(o), 10.0), one);
+  fields f(&s, 1);
+  f.use_bloch(0.0);
+  f.add_point_source(Ep, 0.7, 2.5, 0.0, 4.0, veccyl(0.5, 0.4), 1.0);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, veccyl(0.401, 0.301), 1.0);
+  r.init_time = wall_time() - t0;
+  time_steps(f, o, r);
+}
 
-  grid_volume gv = voltwo(xmax, ymax, a);
-  structure s(gv, eps);
+static void bench_3d_vacuum(const bench_options &o, bench_result &r) {
+  const double L = 3.0 * o.size;
+  double t0 = wall_time();
+  structure s(vol3d(L * weak_factor(o), L, L, 10.0), one);
   fields f(&s);
-  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(0.401, 0.301));
-
-  while (f.time() < f.last_source_time())
-    f.step();
-  const double tend = f.time() + ttot;
-  double start = wall_time();
-  while (f.time() < tend)
-    f.step();
-  bench b;
-  b.time = (wall_time() - start);
-  b.gridsteps = ttot * a * 2 * gridpts;
-  // f.print_times();
-  return b;
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(L * .5, L * .5, L * .5));
+  r.init_time = wall_time() - t0;
+  time_steps(f, o, r);
 }
 
-bench bench_2d_te(const double xmax, const double ymax, double eps(const vec &)) {
-  const double a = 10.0;
-  const double gridpts = a * a * xmax * ymax;
-  const double ttot = 5.0 + te_tm_2d_time / gridpts;
-
-  grid_volume gv = voltwo(xmax, ymax, a);
-  structure s(gv, eps);
+static void bench_3d_dispersive(const bench_options &o, bench_result &r) {
+  const double L = 3.0 * o.size;
+  double t0 = wall_time();
+  structure s(vol3d(L * weak_factor(o), L, L, 10.0), one);
+  s.add_susceptibility(one, E_stuff, lorentzian_susceptibility(1.1, 1e-3));
+  s.add_susceptibility(one, E_stuff, lorentzian_susceptibility(0.3, 1e-2, true));
   fields f(&s);
-  f.add_point_source(Ex, 0.8, 0.6, 0.0, 4.0, vec(0.401, 0.301));
-  f.add_point_source(Hz, 0.6, 0.6, 0.0, 4.0, vec(0.7, 0.5));
-
-  while (f.time() < f.last_source_time())
-    f.step();
-  const double tend = f.time() + ttot;
-  double start = wall_time();
-  while (f.time() < tend)
-    f.step();
-  bench b;
-  b.time = (wall_time() - start);
-  b.gridsteps = ttot * a * 2 * gridpts;
-  // f.print_times();
-  return b;
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(L * .5, L * .5, L * .5));
+  r.init_time = wall_time() - t0;
+  time_steps(f, o, r);
 }
 
-bench bench_2d_te_nonlinear(const double xmax, const double ymax, double eps(const vec &)) {
-  const double a = 10.0;
-  const double gridpts = a * a * xmax * ymax;
-  const double ttot = 5.0 + te_tm_2d_time / gridpts;
-
-  grid_volume gv = voltwo(xmax, ymax, a);
-  structure s(gv, eps);
-  s.set_chi3(eps);
+static void bench_3d_pml(const bench_options &o, bench_result &r) {
+  const double L = 3.0 * o.size + 2.0; // PML is 1 thick on every side
+  double t0 = wall_time();
+  structure s(vol3d(L * weak_factor(o), L, L, 10.0), one, pml(1.0));
   fields f(&s);
-  f.add_point_source(Ex, 0.8, 0.6, 0.0, 4.0, vec(0.401, 0.301));
-  f.add_point_source(Hz, 0.6, 0.6, 0.0, 4.0, vec(0.7, 0.5));
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(L * .5, L * .5, L * .5));
+  r.init_time = wall_time() - t0;
+  time_steps(f, o, r);
+}
 
-  while (f.time() < f.last_source_time())
-    f.step();
-  const double tend = f.time() + ttot;
-  double start = wall_time();
-  while (f.time() < tend)
-    f.step();
-  bench b;
-  b.time = (wall_time() - start);
-  b.gridsteps = ttot * a * 2 * gridpts;
-  // f.print_times();
-  return b;
+static void bench_2d_dft(const bench_options &o, bench_result &r) {
+  const double L = 12.0 * o.size;
+  const double X = L * weak_factor(o);
+  double t0 = wall_time();
+  structure s(voltwo(X, L, 10.0), one, pml(1.0));
+  fields f(&s);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(X * .5, L * .5));
+  const double fcen = 0.8, df = 0.5;
+  const int nfreq = 200;
+  f.add_dft_flux_plane(volume(vec(1.5, 1.5), vec(X - 1.5, 1.5)), fcen - df, fcen + df, nfreq);
+  f.add_dft_flux_plane(volume(vec(1.5, L - 1.5), vec(X - 1.5, L - 1.5)), fcen - df, fcen + df,
+                       nfreq);
+  component cs[2] = {Ez, Hx};
+  f.add_dft_fields(cs, 2, volume(vec(1.5, 1.5), vec(X - 1.5, L - 1.5)), fcen - df, fcen + df, 10);
+  r.init_time = wall_time() - t0;
+  time_steps(f, o, r);
 }
 
-#define showbench(name, bb)                                                                        \
-  {                                                                                                \
-    bench b = bb;                                                                                  \
-    master_printf("bench:, %s, %g, %g\n", name, b.time, b.time * 1e6 / b.gridsteps);               \
+// includes the far-field computation (in the time but not the phases)
+static void bench_2d_near2far(const bench_options &o, bench_result &r) {
+  const double L = 8.0 * o.size;
+  const double X = L * weak_factor(o);
+  double t0 = wall_time();
+  structure s(voltwo(X, L, 10.0), one, pml(1.0));
+  fields f(&s);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(X * .5 + 0.1, L * .5 + 0.2));
+  // a closed box of four lines around the source
+  volume_list *right = new volume_list(volume(vec(X - 1.5, 1.5), vec(X - 1.5, L - 1.5)), Sx, +1.0);
+  volume_list *left = new volume_list(volume(vec(1.5, 1.5), vec(1.5, L - 1.5)), Sx, -1.0, right);
+  volume_list *top =
+      new volume_list(volume(vec(1.5, L - 1.5), vec(X - 1.5, L - 1.5)), Sy, +1.0, left);
+  volume_list vl(volume(vec(1.5, 1.5), vec(X - 1.5, 1.5)), Sy, -1.0, top);
+  dft_near2far n2f = f.add_dft_near2far(&vl, 0.6, 1.0, 10);
+  r.init_time = wall_time() - t0;
+  time_steps(f, o, r);
+  const double start = wall_time();
+  for (int i = 0; i < 20; ++i) {
+    const double phi = 2 * pi * i / 20;
+    delete[] n2f.farfield(vec(100 * cos(phi), 100 * sin(phi)));
   }
+  r.time += wall_time() - start;
+}
 
-// 3D benchmarks:
-
-inline double max(double a, double b) { return (a > b) ? a : b; }
+// not time stepping: the time is that of the solve_cw iterations
+static void bench_2d_solve_cw(const bench_options &o, bench_result &r) {
+  const double L = 6.0 * o.size;
+  double t0 = wall_time();
+  structure s(voltwo(L * weak_factor(o), L, 10.0), one, pml(1.0));
+  fields f(&s);
+  continuous_src_time src(0.8);
+  f.add_point_source(Ez, src, vec(L * .5 * weak_factor(o), L * .5));
+  r.init_time = wall_time() - t0;
+  const double start = wall_time();
+  f.solve_cw(1e-6, 10000, 10);
+  r.time = wall_time() - start;
+  r.cells = f.gv.ntot();
+}
 
-bench bench_3d_periodic(const double xmax, const double ymax, const double zmax,
-                        double eps(const vec &)) {
-  const double a = 10.0;
-  const double gridpts = a * a * a * max(xmax, 1 / a) * max(ymax, 1 / a) * max(zmax, 1 / a);
-  const double ttot = 5.0 + 1e5 / gridpts;
+// subpixel averaging of a 3D sphere: only the initialization is timed
+static void bench_3d_init(const bench_options &o, bench_result &r) {
+  double t0 = wall_time();
+  structure s(vol3d(3.0 * weak_factor(o), 3.0, 3.0, 20.0 * o.size), sphere, boundary_region(),
+              meep::identity(), 0, 0.5, true);
+  r.init_time = wall_time() - t0;
+  r.time = r.init_time;
+  r.cells = s.gv.ntot();
+}
 
-  grid_volume gv = vol3d(xmax, ymax, zmax, a);
-  structure s(gv, eps);
+// includes an HDF5 output of Ez every 10 steps (in the time but not the phases)
+static void bench_2d_hdf5(const bench_options &o, bench_result &r) {
+#ifdef HAVE_HDF5
+  const double L = 12.0 * o.size;
+  double t0 = wall_time();
+  structure s(voltwo(L * weak_factor(o), L, 10.0), one);
   fields f(&s);
-  if (xmax == 0) f.use_bloch(X, 0.0);
-  if (ymax == 0) f.use_bloch(Y, 0.0);
-  if (ymax == 0) f.use_bloch(Z, 0.0);
-  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(xmax * .5, ymax * .5, zmax * .5));
-
-  while (f.time() < f.last_source_time())
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(0.401, 0.301));
+  r.init_time = wall_time() - t0;
+  trash_output_directory("bench-out");
+  f.set_output_directory("bench-out");
+  h5file *file = f.open_h5file("bench-ez");
+  for (int n = 0; n < 5; ++n)
     f.step();
-  const double tend = f.time() + ttot;
-  double start = wall_time();
-  while (f.time() < tend)
+  all_wait();
+  const double start = wall_time();
+  for (int n = 0; n < o.steps; ++n) {
     f.step();
-  bench b;
-  b.time = (wall_time() - start);
-  b.gridsteps = ttot * a * 2 * gridpts;
-  // f.print_times();
-  return b;
+    if (n % 10 == 0) f.output_hdf5(Ez, f.total_volume(), file, true);
+  }
+  all_wait();
+  r.time = wall_time() - start;
+  delete file;
+  r.steps = o.steps;
+  r.cells = f.gv.ntot();
+#else
+  (void)o;
+  (void)r;
+#endif
 }
 
-bench bench_3d(const double xmax, const double ymax, const double zmax, double eps(const vec &)) {
-  const double a = 10.0;
-  const double gridpts = a * a * a * xmax * ymax * zmax;
-  const double ttot = 5.0 + 1e5 / gridpts;
+typedef void (*bench_function)(const bench_options &o, bench_result &r);
+struct scenario {
+  const char *name;
+  bench_function run;
+};
 
-  grid_volume gv = vol3d(xmax, ymax, zmax, a);
-  structure s(gv, eps);
-  fields f(&s);
-  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(xmax * .5, ymax * .5, zmax * .5));
+static const scenario scenarios[] = {
+    {"1d-flux", bench_1d_flux},
+    {"2d-tm", bench_2d_tm},
+    {"2d-te-nonlinear", bench_2d_te_nonlinear},
+    {"cyl-periodic", bench_cyl_periodic},
+    {"3d-vacuum", bench_3d_vacuum},
+    {"3d-dispersive", bench_3d_dispersive},
+    {"3d-pml", bench_3d_pml},
+    {"2d-dft", bench_2d_dft},
+    {"2d-near2far", bench_2d_near2far},
+    {"2d-solve-cw", bench_2d_solve_cw},
+    {"3d-init-subpixel", bench_3d_init},
+    {"2d-hdf5", bench_2d_hdf5},
+};
 
-  while (f.time() < f.last_source_time())
-    f.step();
-  const double tend = f.time() + ttot;
-  double start = wall_time();
-  while (f.time() < tend)
-    f.step();
-  bench b;
-  b.time = (wall_time() - start);
-  b.gridsteps = ttot * a * 2 * gridpts;
-  // f.print_times();
-  return b;
+static const char *phase_names[NUM_STEP_PHASES] = {"curl", "constitutive", "polarizations",
+                                                   "sources", "dfts"};
+
+// Mcell-updates per second of steps steps of cells grid points in time t
+static double mcups(double cells, int steps, double t) {
+  return t > 0 && steps > 0 ? cells * steps / t * 1e-6 : 0;
+}
+
+static void write_results(const vector<bench_result> &results, const char *fname, bool json) {
+  FILE *f = master_fopen(fname, "w");
+  if (!f) abort("Unable to open benchmark output file %s\n", fname);
+  if (json)
+    master_fprintf(f, "{\"processes\": %d, \"results\": [", count_processors());
+  else {
+    master_fprintf(f, "name,processes,cells,steps,init_s,time_s,mcups");
+    for (int p = 0; p < NUM_STEP_PHASES; ++p)
+      master_fprintf(f, ",%s_mcups", phase_names[p]);
+    master_fprintf(f, ",boundary_s,peak_mb\n");
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    const bench_result &r = results[i];
+    if (json) {
+      master_fprintf(f,
+                     "%s\n  {\"name\": \"%s\", \"cells\": %g, \"steps\": %d, \"init_s\": %g, "
+                     "\"time_s\": %g, \"mcups\": %g",
+                     i ? "," : "", r.name, r.cells, r.steps, r.init_time, r.time,
+                     mcups(r.cells, r.steps, r.time));
+      for (int p = 0; p < NUM_STEP_PHASES; ++p)
+        master_fprintf(f, ", \"%s_mcups\": %g", phase_names[p],
+                       mcups(r.cells, r.steps, r.phase_time[p]));
+      master_fprintf(f, ", \"boundary_s\": %g, \"peak_mb\": %g}", r.boundary_time, r.peak_mb);
+    }
+    else {
+      master_fprintf(f, "%s,%d,%g,%d,%g,%g,%g", r.name, count_processors(), r.cells, r.steps,
+                     r.init_time, r.time, mcups(r.cells, r.steps, r.time));
+      for (int p = 0; p < NUM_STEP_PHASES; ++p)
+        master_fprintf(f, ",%g", mcups(r.cells, r.steps, r.phase_time[p]));
+      master_fprintf(f, ",%g,%g\n", r.boundary_time, r.peak_mb);
+    }
+  }
+  if (json) master_fprintf(f, "\n]}\n");
+  master_fclose(f);
 }
 
 int main(int argc, char **argv) {
   initialize mpi(argc, argv);
   verbosity = 0;
-  master_printf("Benchmarking with %d processor%s...\n", count_processors(),
-                count_processors() > 1 ? "s" : "");
-
-  master_printf("bench:, test, total time (s), normalized time (s/Mgs)\n");
-
-  showbench("Periodic 6x4 ", bench_periodic(6.0, 4.0, one));
-  showbench("Periodic 12x1", bench_periodic(12.0, 1.0, one));
-  showbench("Periodic 1x12", bench_periodic(1.0, 12.0, one));
-  showbench("Periodic 12x0", bench_periodic(12.0, 0.0, one));
-  showbench("Periodic 12x12", bench_periodic(12.0, 12.0, one));
-
-  width = 20.0;
-  showbench("Flux 1D 100", bench_flux_1d(100.0, bump));
-  width = 10.0;
-  showbench("Flux 1D 100", bench_flux_1d(100.0, bump));
-  width = 300.0;
-  showbench("Flux 1D 100", bench_flux_1d(100.0, bump));
-
-  showbench("3D 1x1x10", bench_3d(1.0, 1.0, 10.0, one));
-  showbench("3D 10x1x1", bench_3d(10.0, 1.0, 1.0, one));
-  showbench("3D 1x1x1 ", bench_3d(1.0, 1.0, 1.0, one));
-  showbench("3D 3x3x3 ", bench_3d(3.0, 3.0, 3.0, one));
-  showbench("3D 10x3x0", bench_3d_periodic(10.0, 3.0, 0.0, one));
-  showbench("3D 0x3x10", bench_3d_periodic(0.0, 3.0, 10.0, one));
-
-  showbench("2D 6x4 ", bench_2d(6.0, 4.0, one));
-  showbench("2D 12x12 ", bench_2d(12.0, 12.0, one));
-  showbench("2D 12x12 ", bench_2d(12.0, 12.0, one));
-
-  showbench("2D TM 6x4 nonlinear ", bench_2d_tm_nonlinear(6.0, 4.0, one));
-  showbench("2D TM 6x4 ", bench_2d_tm(6.0, 4.0, one));
-  showbench("2D TM 12x12 ", bench_2d_tm(12.0, 12.0, one));
-
-  showbench("2D TE 2x2 nonlinear ", bench_2d_te_nonlinear(2.0, 2.0, one));
-  showbench("2D TE 2x2 ", bench_2d_te(2.0, 2.0, one));
-  showbench("2D TE 10x11 nonlinear ", bench_2d_te_nonlinear(10.0, 11.0, one));
-  showbench("2D TE 10x11 ", bench_2d_te(10.0, 11.0, one));
-
-  master_printf("\nnote: 1 Mgs = 1 million grid point time steps\n");
+
+  bench_options o;
+  o.size = 1.0;
+  o.steps = 200;
+  o.weak = false;
+  o.only = NULL;
+  const char *csv = NULL, *json = NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--weak"))
+      o.weak = true;
+    else if (i + 1 < argc && !strcmp(argv[i], "--only"))
+      o.only = argv[++i];
+    else if (i + 1 < argc && !strcmp(argv[i], "--size"))
+      o.size = atof(argv[++i]);
+    else if (i + 1 < argc && !strcmp(argv[i], "--steps"))
+      o.steps = atoi(argv[++i]);
+    else if (i + 1 < argc && !strcmp(argv[i], "--csv"))
+      csv = argv[++i];
+    else if (i + 1 < argc && !strcmp(argv[i], "--json"))
+      json = argv[++i];
+    else
+      abort("usage: bench [--only <substring>] [--size <scale>] [--steps <n>] [--weak] "
+            "[--csv <file>] [--json <file>]\n");
+  }
+  if (o.size <= 0 || o.steps < 1) abort("bench: --size and --steps must be positive\n");
+
+  master_printf("Benchmarking with %d processor%s (%s scaling)...\n", count_processors(),
+                count_processors() > 1 ? "s" : "", o.weak ? "weak" : "strong");
+  master_printf("bench:, test, cells, init time (s), time (s), Mcell-updates/s\n");
+
+  vector<bench_result> results;
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenario); ++i) {
+    if (o.only && !strstr(scenarios[i].name, o.only)) continue;
+    bench_result r;
+    memset(&r, 0, sizeof(r));
+    r.name = scenarios[i].name;
+    scenarios[i].run(o, r);
+    if (r.cells == 0) continue; // not available in this build (e.g. no HDF5)
+    r.peak_mb = peak_memory_mb();
+    master_printf("bench:, %s, %g, %g, %g, %g\n", r.name, r.cells, r.init_time, r.time,
+                  mcups(r.cells, r.steps, r.time));
+    results.push_back(r);
+  }
+
+  if (csv) write_results(results, csv, false);
+  if (json) write_results(results, json, true);
+
+  master_printf("\nnote: Mcell-updates/s = million grid points times time steps per second;\n"
+                "      the peak memory is cumulative over the scenarios\n");
 
   return 0;
 }
@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <meep.hpp>
+#include "bicgstab.hpp"
+using namespace meep;
+
+/* A nonsymmetric, diagonally dominant tridiagonal test matrix,
+   (Ax)_i = d_i x_i - 1.5 x_{i-1} - 0.5 x_{i+1}, with a diagonal d_i
+   that varies by several orders of magnitude.  Each process owns an
+   independent block, so the solver's reductions over processes are
+   exercised without needing communication in A. */
+typedef struct {
+  size_t n;
+  realnum *d;
+} tridiag;
+
+static void tridiag_op(const realnum *x, realnum *y, void *data_) {
+  tridiag *data = (tridiag *)data_;
+  for (size_t i = 0; i < data->n; ++i) {
+    y[i] = data->d[i] * x[i];
+    if (i > 0) y[i] -= 1.5 * x[i - 1];
+    if (i + 1 < data->n) y[i] -= 0.5 * x[i + 1];
+  }
+}
+
+// Jacobi preconditioner y = diag(A)^{-1} x
+static void jacobi_op(const realnum *x, realnum *y, void *data_) {
+  tridiag *data = (tridiag *)data_;
+  for (size_t i = 0; i < data->n; ++i)
+    y[i] = x[i] / data->d[i];
+}
+
+static double residual(tridiag *A, const realnum *x, const realnum *b) {
+  realnum *Ax = new realnum[A->n];
+  tridiag_op(x, Ax, A);
+  double r2 = 0, b2 = 0;
+  for (size_t i = 0; i < A->n; ++i) {
+    r2 += (Ax[i] - b[i]) * (Ax[i] - b[i]);
+    b2 += b[i] * b[i];
+  }
+  delete[] Ax;
+  return sqrt(sum_to_all(r2) / sum_to_all(b2));
+}
+
+/* solve Ax = b with BiCGSTAB(L) for a right-hand side of magnitude
+   bscale, and check the true residual */
+static int check_bicgstab(int L, bool precondition, double bscale) {
+  const size_t n = 500;
+  const double tol = sizeof(realnum) == sizeof(double) ? 1e-8 : 1e-4;
+  tridiag A;
+  A.n = n;
+  A.d = new realnum[n];
+  realnum *x = new realnum[n];
+  realnum *b = new realnum[n];
+  for (size_t i = 0; i < n; ++i) {
+    A.d[i] = 2.5 + pow(10.0, 3.0 * i / n);
+    b[i] = bscale * (1 + sin(0.1 * i + my_rank()));
+    x[i] = 0;
+  }
+
+  bicgstab_op M = precondition ? jacobi_op : NULL;
+  int iters = 10000;
+  ptrdiff_t nwork = bicgstabL(L, n, x, tridiag_op, &A, b, tol, &iters, NULL, true, M, &A);
+  realnum *work = new realnum[nwork];
+  ptrdiff_t ierr = bicgstabL(L, n, x, tridiag_op, &A, b, tol, &iters, work, true, M, &A);
+  double r = residual(&A, x, b);
+  master_printf("bicgstab L=%d%s |b|~%g: ierr=%d after %d iterations, residual %g\n", L,
+                precondition ? " (preconditioned)" : "", bscale, int(ierr), iters, r);
+
+  delete[] work;
+  delete[] b;
+  delete[] x;
+  delete[] A.d;
+  return ierr == 0 && r < 10 * tol;
+}
+
+int main(int argc, char **argv) {
+  initialize mpi(argc, argv);
+  verbosity = 0;
+  master_printf("Running BiCGSTAB(L) tests...\n");
+  const double big = sizeof(realnum) == sizeof(double) ? 1e100 : 1e10;
+  for (int L = 1; L <= 4; ++L)
+    for (int precondition = 0; precondition <= 1; ++precondition) {
+      if (!check_bicgstab(L, precondition, 1.0)) abort("bicgstab failed to converge");
+      if (!check_bicgstab(L, precondition, big)) abort("bicgstab failed for large |b|");
+    }
+  return 0;
+}
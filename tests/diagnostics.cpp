@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <meep.hpp>
+using namespace meep;
+
+double one(const vec &) { return 1.0; }
+
+double disk(const vec &pt) {
+  const double dx = pt.x() - 1.3, dy = pt.y() - 0.8;
+  return dx * dx + dy * dy < 0.35 * 0.35 ? 2.0 : 0.0;
+}
+
+// a Lorentzian disk on a 2d structure with PML, in several chunks
+void add_disk(structure &s) {
+  s.add_susceptibility(disk, E_stuff, lorentzian_susceptibility(0.3, 0.1));
+}
+
+const volume flux_plane(vec(2.2, 0.2), vec(2.2, 1.4));
+
+// the fields of s with a source and a flux plane, after nsteps time steps
+fields *make_fields(structure &s, int nsteps) {
+  fields *f = new fields(&s);
+  f->add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.299, 0.401), 1.0);
+  f->add_dft_flux_plane(flux_plane, 0.5, 1.0, 5);
+  for (int i = 0; i < nsteps; ++i)
+    f->step();
+  return f;
+}
+
+// count the lines of fname that contain s
+static int count_lines(const char *fname, const char *s) {
+  FILE *fp = fopen(fname, "r");
+  if (!fp) abort("cannot read %s", fname);
+  char line[1024];
+  int n = 0;
+  while (fgets(line, sizeof(line), fp))
+    if (strstr(line, s)) ++n;
+  fclose(fp);
+  return n;
+}
+
+/* the step_phase times of each chunk add up to its cost, each chunk spends
+   time in the curl and constitutive updates, and output_step_times writes
+   one record per chunk and phase and per process and field type */
+static void check_step_times(const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s(gv, one, pml(0.5), identity(), 3);
+  add_disk(s);
+  fields *f = make_fields(s, 50);
+
+  const std::vector<double> times = f->get_step_times(), costs = f->get_chunk_costs();
+  if (times.size() != size_t(f->num_chunks * NUM_STEP_PHASES))
+    abort("get_step_times: %zd times for %d chunks", times.size(), f->num_chunks);
+  double phase_total[NUM_STEP_PHASES] = {0, 0, 0, 0, 0};
+  for (int i = 0; i < f->num_chunks; ++i) {
+    double sum = 0;
+    for (int p = 0; p < NUM_STEP_PHASES; ++p) {
+      const double t = times[i * NUM_STEP_PHASES + p];
+      if (t < 0) abort("get_step_times: negative time %g in chunk %d", t, i);
+      sum += t;
+      phase_total[p] += t;
+    }
+    if (fabs(sum - costs[i]) > 1e-9 * costs[i])
+      abort("get_step_times: chunk %d phases add up to %g, not its cost %g", i, sum, costs[i]);
+    if (times[i * NUM_STEP_PHASES + StepCurl] <= 0 ||
+        times[i * NUM_STEP_PHASES + StepConstitutive] <= 0)
+      abort("get_step_times: no curl or constitutive time in chunk %d", i);
+  }
+  if (phase_total[StepPolarizations] <= 0 || phase_total[StepDFTs] <= 0)
+    abort("get_step_times: no polarization or DFT time");
+
+  char fname[256];
+  snprintf(fname, sizeof(fname), "%s/step_times.csv", mydirname);
+  f->output_step_times(fname);
+  if (am_master()) {
+    if (count_lines(fname, "chunk,") != f->num_chunks * NUM_STEP_PHASES ||
+        count_lines(fname, "boundary,") != count_processors() * NUM_FIELD_TYPES)
+      abort("output_step_times: wrong number of records in %s", fname);
+  }
+  delete f;
+}
+
+/* the trace holds the events recorded between start_trace and stop_trace,
+   and with a small ring buffer only the most recent ones */
+static void check_trace(const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s(gv, one, pml(0.5), identity(), 3);
+  add_disk(s);
+  fields *f = make_fields(s, 5);
+
+  char fname[256];
+  snprintf(fname, sizeof(fname), "%s/trace.json", mydirname);
+  f->start_trace();
+  for (int i = 0; i < 10; ++i)
+    f->step();
+  f->stop_trace();
+  f->output_trace(fname);
+  const int nevents = am_master() ? count_lines(fname, "\"ph\": \"X\"") : 0;
+  for (int i = 0; i < 10; ++i)
+    f->step();
+  f->output_trace(fname);
+  if (am_master()) {
+    if (count_lines(fname, "{\"traceEvents\": [") != 1 || count_lines(fname, "]}") != 1)
+      abort("output_trace: %s is not a trace-event file", fname);
+    if (count_lines(fname, "\"cat\": \"phase\"") < 10)
+      abort("output_trace: too few time-stepping phases in %s", fname);
+    if (count_lines(fname, "\"ph\": \"X\"") != nevents)
+      abort("output_trace: events were recorded after stop_trace");
+  }
+
+  f->start_trace(5);
+  for (int i = 0; i < 10; ++i)
+    f->step();
+  f->output_trace(fname);
+  if (am_master()) {
+    if (count_lines(fname, "\"ph\": \"X\"") != 5 * count_processors() ||
+        count_lines(fname, "earlier events dropped") != count_processors())
+      abort("output_trace: wrong number of events from a ring buffer of 5");
+  }
+  delete f;
+}
+
+/* memory_usage accounts every category of a run with PML, a
+   susceptibility, sources and a flux plane; the pre-flight estimate has the
+   same materials and bounds the fields, PML and polarization arrays */
+static void check_memory_usage() {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s(gv, one, pml(0.5), identity(), 3);
+  add_disk(s);
+  std::vector<volume> dft_vols(1, flux_plane);
+  std::vector<int> dft_sizes(1, 5 * 4); // 5 frequencies of Ey, Ez, Hy, Hz
+  const std::vector<double> est = s.estimate_memory_usage(false, dft_vols, dft_sizes);
+  if (est.size() != size_t(count_processors() * NUM_MEMORY_CATEGORIES))
+    abort("estimate_memory_usage: %zd entries for %d processes", est.size(), count_processors());
+  fields *f = make_fields(s, 5);
+
+  const std::vector<double> bytes = f->memory_usage();
+  if (bytes.size() != size_t(f->num_chunks * NUM_MEMORY_CATEGORIES))
+    abort("memory_usage: %zd entries for %d chunks", bytes.size(), f->num_chunks);
+  double total[NUM_MEMORY_CATEGORIES], est_total[NUM_MEMORY_CATEGORIES];
+  for (int m = 0; m < NUM_MEMORY_CATEGORIES; ++m) {
+    total[m] = est_total[m] = 0;
+    for (int i = 0; i < f->num_chunks; ++i) {
+      if (bytes[i * NUM_MEMORY_CATEGORIES + m] < 0) abort("memory_usage: negative count");
+      total[m] += bytes[i * NUM_MEMORY_CATEGORIES + m];
+    }
+    for (int p = 0; p < count_processors(); ++p)
+      est_total[m] += est[p * NUM_MEMORY_CATEGORIES + m];
+    if (total[m] <= 0) abort("memory_usage: nothing in category %d", m);
+  }
+  if (fabs(total[MemMaterials] - est_total[MemMaterials]) > 1e-9 * total[MemMaterials])
+    abort("estimate_memory_usage: %g bytes of materials, not %g", est_total[MemMaterials],
+          total[MemMaterials]);
+  const int bounded[3] = {MemFields, MemPML, MemPolarizations};
+  for (int k = 0; k < 3; ++k)
+    if (total[bounded[k]] > est_total[bounded[k]])
+      abort("estimate_memory_usage: %g bytes estimated for %g in category %d",
+            est_total[bounded[k]], total[bounded[k]], bounded[k]);
+  if (est_total[MemDFT] < 0.5 * total[MemDFT] || est_total[MemDFT] > 2 * total[MemDFT])
+    abort("estimate_memory_usage: %g dft bytes estimated for %g", est_total[MemDFT],
+          total[MemDFT]);
+  delete f;
+}
+
+/* get_comm_matrix has the boundary data of each pair of adjacent chunks,
+   which a Bloch-periodic direction adds to the diagonal, and the halo
+   exchanges between the processes add up */
+static void check_comm_matrix() {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s(gv, one, pml(0.5, X), identity(), 3);
+  add_disk(s);
+  fields *f = make_fields(s, 5);
+  const int n = f->num_chunks;
+  for (int bloch = 0; bloch < 2; ++bloch) {
+    if (bloch) {
+      f->use_bloch(Y, 0.3);
+      f->step();
+    }
+    const std::vector<double> bytes = f->get_comm_matrix();
+    if (bytes.size() != size_t(n * n))
+      abort("get_comm_matrix: %zd entries for %d chunks", bytes.size(), n);
+    for (int i = 0; i < n; ++i) {
+      double others = 0;
+      for (int j = 0; j < n; ++j) {
+        if (bytes[j + i * n] < 0) abort("get_comm_matrix: negative entry");
+        if ((bytes[j + i * n] > 0) != (bytes[i + j * n] > 0))
+          abort("get_comm_matrix: chunk %d sends to %d but not back", j, i);
+        if (j != i) others += bytes[j + i * n];
+      }
+      if (others <= 0) abort("get_comm_matrix: chunk %d receives no boundary data", i);
+      if ((bytes[i + i * n] > 0) != (bloch == 1))
+        abort("get_comm_matrix: chunk %d with%s Bloch boundaries has %g bytes to itself", i,
+              bloch ? "" : "out", bytes[i + i * n]);
+    }
+  }
+
+  const int np = count_processors();
+  f->reset_halo_stats();
+  std::vector<double> stats = f->get_halo_stats();
+  if (stats.size() != size_t(NUM_FIELD_TYPES * np * NUM_HALO_STATS))
+    abort("get_halo_stats: %zd entries for %d processes", stats.size(), np);
+  for (size_t k = 0; k < stats.size(); ++k)
+    if (stats[k] != 0) abort("get_halo_stats: nonzero after reset_halo_stats");
+  for (int i = 0; i < 5; ++i)
+    f->step();
+  stats = f->get_halo_stats();
+  double sent = 0, received = 0;
+  FOR_FIELD_TYPES(ft) {
+    for (int peer = 0; peer < np; ++peer) {
+      const double *st = &stats[(ft * np + peer) * NUM_HALO_STATS];
+      if (peer == my_rank() && (st[HaloBytesSent] != 0 || st[HaloMessages] != 0))
+        abort("get_halo_stats: messages from process %d to itself", peer);
+      sent += st[HaloBytesSent];
+      received += st[HaloBytesReceived];
+    }
+  }
+  if (sum_to_all(sent) != sum_to_all(received))
+    abort("get_halo_stats: %g bytes sent but %g received", sum_to_all(sent),
+          sum_to_all(received));
+  delete f;
+}
+
+int main(int argc, char **argv) {
+  initialize mpi(argc, argv);
+  verbosity = 0;
+  const char *mydirname = "diagnostics-out";
+  trash_output_directory(mydirname);
+  master_printf("Running diagnostics tests...\n");
+  check_step_times(mydirname);
+  check_trace(mydirname);
+  check_memory_usage();
+  check_comm_matrix();
+  return 0;
+}
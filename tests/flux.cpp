@@ -119,6 +119,344 @@ int split_1d(double eps(const vec &), int splitting) {
   return 1;
 }
 
+/* A DFT flux plane added after stepping must only accumulate from then on,
+   even if an identical plane added earlier already exists (the chunks of
+   the two planes may only share their DFT arrays while both are zero). */
+int late_dft_flux_1d(double eps(const vec &)) {
+  const double zmax = 15.0, a = 10.0, tlate = 20.0, ttot = 40.0;
+  const int Nfreq = 5;
+
+  grid_volume gv = volone(zmax, a);
+  structure s(gv, eps, pml(2.0));
+  fields f(&s), fref(&s);
+  f.use_real_fields();
+  fref.use_real_fields();
+  f.add_point_source(Ex, 0.25, 4.5, 0.0, 8.0, vec(zmax / 2 + 0.3), 1.0);
+  fref.add_point_source(Ex, 0.25, 4.5, 0.0, 8.0, vec(zmax / 2 + 0.3), 1.0);
+  volume where(vec(zmax * 0.25));
+  dft_flux early = f.add_dft_flux_plane(where, 0.2, 0.3, Nfreq);
+
+  while (f.time() < tlate) {
+    f.step();
+    fref.step();
+  }
+  dft_flux late = f.add_dft_flux_plane(where, 0.2, 0.3, Nfreq);
+  dft_flux lateref = fref.add_dft_flux_plane(where, 0.2, 0.3, Nfreq);
+  while (f.time() < ttot) {
+    f.step();
+    fref.step();
+  }
+
+  double *fe = early.flux(), *fl = late.flux(), *fr = lateref.flux();
+  const double tol = sizeof(realnum) == sizeof(float) ? 1e-4 : 1e-9;
+  int ok = 1;
+  for (int i = 0; i < Nfreq; ++i) {
+    ok = ok && compare(fl[i], fr[i], tol, 0, "Late flux");
+    if (fabs(fl[i] - fe[i]) <= tol * fabs(fe[i])) {
+      master_printf("Late flux %g equals the early flux\n", fl[i]);
+      ok = 0;
+    }
+  }
+  delete[] fe;
+  delete[] fl;
+  delete[] fr;
+  return ok;
+}
+
+/* DFT checkpoints saved every step while running must restore the DFT
+   (and the time step) of the last step into new fields with the same DFT */
+int dft_checkpoint_1d(double eps(const vec &)) {
+  const double zmax = 15.0, a = 10.0;
+  const int Nfreq = 5;
+  const char *dirname = "flux-out";
+  trash_output_directory(dirname);
+  const char *fname = "flux-out/dft-checkpoint.h5";
+
+  grid_volume gv = volone(zmax, a);
+  structure s(gv, eps, pml(2.0), identity(), 2);
+  fields f(&s), f1(&s);
+  f.add_point_source(Ex, 0.25, 4.5, 0.0, 8.0, vec(zmax / 2 + 0.3), 1.0);
+  f1.add_point_source(Ex, 0.25, 4.5, 0.0, 8.0, vec(zmax / 2 + 0.3), 1.0);
+  volume where(vec(zmax * 0.25));
+  dft_flux flux = f.add_dft_flux_plane(where, 0.2, 0.3, Nfreq);
+  dft_flux flux1 = f1.add_dft_flux_plane(where, 0.2, 0.3, Nfreq);
+  f.checkpoint_dfts(fname, 0.0);
+  while (f.time() < 20.0)
+    f.step();
+  f.checkpoint_dfts(NULL, 0.0);
+
+  int ok = 1;
+  if (f1.load_dft_checkpoint(fname) != f.t) {
+    master_printf("DFT checkpoint is not of the last time step %d\n", f.t);
+    ok = 0;
+  }
+  double *fl = flux.flux(), *fl1 = flux1.flux();
+  for (int i = 0; i < Nfreq; ++i)
+    if (fl1[i] != fl[i] || fl[i] == 0) {
+      master_printf("Checkpointed flux %g differs from %g\n", fl1[i], fl[i]);
+      ok = 0;
+    }
+  delete[] fl;
+  delete[] fl1;
+  return ok;
+}
+
+enum dft_option { DFT_PLAIN, DFT_LAZY, DFT_DECIMATED, DFT_FFT };
+
+/* DFT flux spectrum through a plane in a 2d cell, with the given DFT
+   option enabled before the flux plane is added (in vacuum, so that the
+   fields have decayed by the end and the decimated DFT is exact) */
+double *dft_option_fluxes_2d(dft_option opt, int Nfreq) {
+  grid_volume gv = voltwo(6.0, 4.0, 10.0);
+  structure s(gv, one, pml(1.0), identity(), 3);
+  fields f(&s);
+  f.use_real_fields();
+  f.add_point_source(Ez, 0.5, 3.5, 0.0, 8.0, vec(1.7, 1.9), 1.0);
+  if (opt == DFT_LAZY) f.use_lazy_dft_averaging();
+  if (opt == DFT_FFT) f.use_fft_dfts();
+  if (opt == DFT_DECIMATED) {
+    f.use_dft_decimation();
+    if (f.dft_decimation(0.6) < 2) abort("the DFT of a band-limited source was not decimated");
+  }
+  dft_flux flux = f.add_dft_flux_plane(volume(vec(4.8, 1.0), vec(4.8, 3.0)), 0.4, 0.6, Nfreq);
+  while (f.time() < f.last_source_time() + 20.0)
+    f.step();
+  return flux.flux();
+}
+
+/* the fluxes with a DFT option must match those of the plain DFT */
+int dft_option_flux_2d(dft_option opt, double tol) {
+  const int Nfreq = 7;
+  double *fl = dft_option_fluxes_2d(opt, Nfreq);
+  double *fl0 = dft_option_fluxes_2d(DFT_PLAIN, Nfreq);
+  int ok = 1;
+  for (int i = 0; i < Nfreq; ++i)
+    ok = ok && compare(fl[i], fl0[i], tol, 0, "DFT option flux");
+  delete[] fl;
+  delete[] fl0;
+  return ok;
+}
+
+/* the DFT of Ez over the whole cell, at more frequencies than one block of
+   the accumulation, must not depend on whether its megabytes are kept in
+   memory or in memory-mapped files */
+std::complex<double> *dft_fields_2d(const char *storage_dir, int Nfreq, size_t *n) {
+  grid_volume gv = voltwo(6.0, 4.0, 20.0);
+  structure s(gv, one, pml(1.0), identity(), 3);
+  fields f(&s);
+  f.add_point_source(Ez, 0.5, 3.5, 0.0, 8.0, vec(1.7, 1.9), 1.0);
+  set_dft_storage_dir(storage_dir);
+  component c = Ez;
+  dft_fields dft = f.add_dft_fields(&c, 1, gv.surroundings(), 0.4, 0.6, Nfreq);
+  set_dft_storage_dir(NULL);
+  while (f.time() < 20.0)
+    f.step();
+  int rank;
+  size_t dims[3];
+  std::complex<double> *a = f.get_dft_array(dft, Ez, Nfreq - 1, &rank, dims);
+  *n = 1;
+  for (int i = 0; i < rank; ++i)
+    *n *= dims[i];
+  std::complex<double> *b = f.get_dft_array(dft, Ez, 0, &rank, dims);
+  std::complex<double> *ab = new std::complex<double>[2 * *n];
+  for (size_t i = 0; i < *n; ++i) {
+    ab[i] = a[i];
+    ab[*n + i] = b[i];
+  }
+  delete[] a;
+  delete[] b;
+  return ab;
+}
+
+int dft_storage_2d() {
+  const int Nfreq = 70; // (121*81 points)*(70 frequencies)*(16 bytes): over 1 MB per chunk
+  size_t n, n0;
+  std::complex<double> *a = dft_fields_2d(".", Nfreq, &n);
+  std::complex<double> *a0 = dft_fields_2d(NULL, Nfreq, &n0);
+  int ok = n == n0;
+  double amax = 0;
+  for (size_t i = 0; ok && i < 2 * n; ++i) {
+    ok = a[i] == a0[i];
+    amax = std::max(amax, abs(a0[i]));
+  }
+  if (!ok) master_printf("DFT fields in memory-mapped files differ\n");
+  if (ok && amax == 0) {
+    master_printf("DFT fields are zero\n");
+    ok = 0;
+  }
+  delete[] a;
+  delete[] a0;
+  return ok;
+}
+
+/* flux_in_box and field_energy_in_box synchronize H only near their box;
+   they must give the same results as after a full synchronization, also
+   nested in a partial synchronization of another box, and the fields must
+   be restored exactly afterwards */
+int partial_sync_2d() {
+  grid_volume gv = voltwo(6.0, 4.0, 10.0);
+  structure s(gv, one, pml(1.0), identity(), 6);
+  fields f(&s), g(&s);
+  f.use_real_fields();
+  g.use_real_fields();
+  f.add_point_source(Ez, 0.5, 1.0, 0.0, 4.0, vec(1.7, 1.9), 1.0);
+  f.add_point_source(Hz, 0.6, 1.0, 0.0, 4.0, vec(4.3, 2.4), 1.0);
+  g.add_point_source(Ez, 0.5, 1.0, 0.0, 4.0, vec(1.7, 1.9), 1.0);
+  g.add_point_source(Hz, 0.6, 1.0, 0.0, 4.0, vec(4.3, 2.4), 1.0);
+  const volume plane(vec(3.3, 1.2), vec(3.3, 2.9)), box(vec(1.4, 1.1), vec(2.6, 3.0));
+  const volume small(vec(4.4, 1.6), vec(4.8, 2.2));
+  const vec pts[4] = {vec(1.0, 1.0), vec(3.3, 2.0), vec(4.61, 1.87), vec(5.2, 3.1)};
+  for (int step = 1; step <= 100; ++step) {
+    if (step % 25 == 0) {
+      g.synchronize_magnetic_fields();
+      const double flux0 = g.flux_in_box(X, plane), energy0 = g.field_energy_in_box(box);
+      g.restore_magnetic_fields();
+      if (!compare(f.flux_in_box(X, plane), flux0, 1e-12, 1e-15, "partially synched flux") ||
+          !compare(f.field_energy_in_box(box), energy0, 1e-12, 1e-15, "partially synched energy"))
+        return 0;
+      f.synchronize_magnetic_fields(small);
+      const double flux = f.flux_in_box(X, plane);
+      f.restore_magnetic_fields();
+      if (!compare(flux, flux0, 1e-12, 1e-15, "nested partially synched flux")) return 0;
+      for (int i = 0; i < 4; ++i)
+        FOR_COMPONENTS(c) {
+          if (gv.has_field(c) && f.get_field(c, pts[i]) != g.get_field(c, pts[i]))
+            abort("%s at (%g, %g) changed by a partial synchronization", component_name(c),
+                  pts[i].x(), pts[i].y());
+        }
+    }
+    f.step();
+    g.step();
+  }
+  return 1;
+}
+
+/* get_dft_gradient sums the products of the forward and adjoint electric
+   DFT fields on each process, with the forward fields kept after their
+   fields are deleted; it must give the sums over the arrays of
+   get_dft_array */
+int dft_gradient_2d() {
+  grid_volume gv = voltwo(6.0, 4.0, 10.0);
+  structure s(gv, one, pml(1.0), identity(), 3);
+  const volume design(vec(1.5, 1.0), vec(4.5, 2.8));
+  component cs[3] = {Ex, Ey, Ez};
+  const int Nfreq = 2, num_basis = 2, nf = 1;
+
+  fields *fwd = new fields(&s);
+  fields adj(&s);
+  fwd->add_point_source(Ez, 0.5, 1.0, 0.0, 4.0, vec(1.7, 1.9), 1.0);
+  fwd->add_point_source(Hz, 0.6, 1.0, 0.0, 4.0, vec(4.3, 2.4), 1.0);
+  adj.add_point_source(Ez, 0.5, 1.0, 0.0, 4.0, vec(3.1, 2.2), 1.0);
+  adj.add_point_source(Hz, 0.55, 1.0, 0.0, 4.0, vec(2.2, 1.4), 1.0);
+  dft_fields fwd_dft = fwd->add_dft_fields(cs, 3, design, 0.5, 0.6, Nfreq);
+  dft_fields adj_dft = adj.add_dft_fields(cs, 3, design, 0.5, 0.6, Nfreq);
+  while (fwd->time() < 15.0) {
+    fwd->step();
+    adj.step();
+  }
+
+  // expected gradient, with weights and basis functions depending on the
+  // index into the DFT arrays (which has the same range for each component)
+  std::complex<double> *arrays[2][3];
+  size_t n = 1;
+  for (int i = 0; i < 3; ++i) {
+    int rank;
+    size_t dims[3];
+    arrays[0][i] = fwd->get_dft_array(fwd_dft, cs[i], nf, &rank, dims);
+    arrays[1][i] = adj.get_dft_array(adj_dft, cs[i], nf, &rank, dims);
+    size_t ni = 1;
+    for (int r = 0; r < rank; ++r)
+      ni *= dims[r];
+    if (i == 0) n = ni;
+    if (rank != 2 || ni != n) abort("get_dft_array: %zd points of %s", ni, component_name(cs[i]));
+  }
+  std::vector<double> weights(n), basis(n * num_basis);
+  std::complex<double> grad0[num_basis] = {0, 0};
+  for (size_t k = 0; k < n; ++k) {
+    weights[k] = 1.0 + 0.01 * k;
+    basis[k * num_basis] = 1.0;
+    basis[k * num_basis + 1] = k % 7;
+    for (int i = 0; i < 3; ++i)
+      for (int b = 0; b < num_basis; ++b)
+        grad0[b] += weights[k] * arrays[0][i][k] * arrays[1][i][k] * basis[k * num_basis + b];
+  }
+  for (int i = 0; i < 3; ++i) {
+    delete[] arrays[0][i];
+    delete[] arrays[1][i];
+  }
+
+  dft_fields_local fwd_local(*fwd, fwd_dft);
+  delete fwd;
+  std::complex<double> grad[num_basis];
+  adj.get_dft_gradient(fwd_local, adj_dft, nf, &weights[0], int(n), &basis[0], num_basis, grad);
+  for (int b = 0; b < num_basis; ++b) {
+    if (abs(grad[b] - grad0[b]) > 1e-12 * abs(grad0[b]) || abs(grad0[b]) == 0) {
+      master_printf("gradient %d is %g%+gi instead of %g%+gi\n", b, real(grad[b]), imag(grad[b]),
+                    real(grad0[b]), imag(grad0[b]));
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// the gradient of fwd with the adjoint fields of the point sources in
+// the mask, as in dft_gradient_2d
+static void split_adjoint_gradient(structure &s, const dft_fields_local &fwd, int mask,
+                                   const std::vector<double> &weights,
+                                   const std::vector<double> &basis, std::complex<double> *grad) {
+  const volume design(vec(1.5, 1.0), vec(4.5, 2.8));
+  component cs[3] = {Ex, Ey, Ez};
+  fields adj(&s);
+  if (mask & 1) adj.add_point_source(Ez, 0.5, 1.0, 0.0, 4.0, vec(3.1, 2.2), 1.0);
+  if (mask & 2) adj.add_point_source(Hz, 0.55, 1.0, 0.0, 4.0, vec(2.2, 1.4), 1.0);
+  dft_fields adj_dft = adj.add_dft_fields(cs, 3, design, 0.5, 0.6, 2);
+  while (adj.time() < 15.0)
+    adj.step();
+  adj.get_dft_gradient(fwd, adj_dft, 1, &weights[0], int(weights.size()), &basis[0], 2, grad);
+}
+
+/* the gradient is linear in the adjoint sources, so the adjoint solves of
+   separate objective quantities (e.g. in different process groups) can be
+   added up */
+int dft_gradient_split_2d() {
+  grid_volume gv = voltwo(6.0, 4.0, 10.0);
+  structure s(gv, one, pml(1.0), identity(), 3);
+  const volume design(vec(1.5, 1.0), vec(4.5, 2.8));
+  component cs[3] = {Ex, Ey, Ez};
+
+  fields fwd(&s);
+  fwd.add_point_source(Ez, 0.5, 1.0, 0.0, 4.0, vec(1.7, 1.9), 1.0);
+  fwd.add_point_source(Hz, 0.6, 1.0, 0.0, 4.0, vec(4.3, 2.4), 1.0);
+  dft_fields fwd_dft = fwd.add_dft_fields(cs, 3, design, 0.5, 0.6, 2);
+  while (fwd.time() < 15.0)
+    fwd.step();
+  dft_fields_local fwd_local(fwd, fwd_dft);
+
+  int rank;
+  size_t dims[3];
+  delete[] fwd.get_dft_array(fwd_dft, Ez, 1, &rank, dims);
+  const size_t n = dims[0] * dims[1];
+  std::vector<double> weights(n), basis(2 * n);
+  for (size_t k = 0; k < n; ++k) {
+    weights[k] = 1.0 + 0.01 * k;
+    basis[2 * k] = 1.0;
+    basis[2 * k + 1] = k % 7;
+  }
+  std::complex<double> grad[3][2];
+  for (int mask = 1; mask <= 3; ++mask)
+    split_adjoint_gradient(s, fwd_local, mask, weights, basis, grad[mask - 1]);
+  for (int b = 0; b < 2; ++b) {
+    const std::complex<double> sum = grad[0][b] + grad[1][b];
+    if (abs(sum - grad[2][b]) > 1e-10 * abs(grad[2][b]) || abs(grad[0][b]) == 0 ||
+        abs(grad[1][b]) == 0) {
+      master_printf("gradient %d is %g%+gi from both sources, %g%+gi from each\n", b,
+                    real(grad[2][b]), imag(grad[2][b]), real(sum), imag(sum));
+      return 0;
+    }
+  }
+  return 1;
+}
+
 int cavity_1d(const double boxwidth, const double timewait, double eps(const vec &)) {
   const double zmax = 15.0;
   const double a = 10.0;
@@ -305,6 +643,23 @@ int main(int argc, char **argv) {
 
   attempt("Split flux plane split by 7...", split_1d(cavity, 7));
 
+  attempt("DFT flux plane added late...", late_dft_flux_1d(cavity));
+
+  attempt("DFT checkpoint...", dft_checkpoint_1d(cavity));
+
+  const double tol = sizeof(realnum) == sizeof(float) ? 1e-4 : 1e-10;
+  attempt("DFT flux with lazy averaging...", dft_option_flux_2d(DFT_LAZY, tol));
+  attempt("DFT flux with time decimation...", dft_option_flux_2d(DFT_DECIMATED, 100 * tol));
+  // the roundoff of the FFT is relative to the peak of the spectrum, not to each value
+  attempt("DFT flux transformed by FFT...", dft_option_flux_2d(DFT_FFT, 100 * tol));
+
+  attempt("DFT fields in memory-mapped files...", dft_storage_2d());
+
+  attempt("Flux and energy with partial synchronization...", partial_sync_2d());
+
+  attempt("Adjoint gradient from process-local DFT fields...", dft_gradient_2d());
+  attempt("Adjoint gradient summed over adjoint sources...", dft_gradient_split_2d());
+
   attempt("Cavity 1D 1.3 73", cavity_1d(1.3, 73.0, cavity));
   attempt("Cavity 1D 5.0   1", cavity_1d(5.0, 1.0, cavity));
   attempt("Cavity 1D 3.85 55", cavity_1d(3.85, 55.0, cavity));
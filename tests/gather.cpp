@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <meep.hpp>
+using namespace meep;
+
+/* gather_sum_to_master: every process contributes the entries i with
+   i % nprocs == rank, plus a share of entry 0, of an array long enough
+   to need several gather rounds; the master must end up with the sum */
+static void check_gather_sum(int width) {
+  const size_t N = 2500000;
+  const int nprocs = count_processors(), rank = my_rank();
+  size_t n = 0;
+  size_t *index = new size_t[N / nprocs + 2];
+  double *data = new double[width * (N / nprocs + 2)];
+  for (size_t i = rank; i < N; i += nprocs) {
+    index[n] = i;
+    for (int k = 0; k < width; ++k)
+      data[width * n + k] = i + 0.5 * k;
+    ++n;
+  }
+  index[n] = 0;
+  for (int k = 0; k < width; ++k)
+    data[width * n + k] = 1.0;
+  ++n;
+
+  double *out = NULL;
+  if (am_master()) {
+    out = new double[width * N];
+    for (size_t i = 0; i < width * N; ++i)
+      out[i] = 0;
+  }
+  gather_sum_to_master(index, data, n, width, out);
+  if (am_master()) {
+    for (size_t i = 0; i < N; ++i)
+      for (int k = 0; k < width; ++k) {
+        double expected = i + 0.5 * k + (i == 0 ? nprocs : 0);
+        if (out[width * i + k] != expected)
+          abort("gather_sum_to_master: entry %zd.%d is %g instead of %g", i, k,
+                out[width * i + k], expected);
+      }
+    delete[] out;
+  }
+  delete[] data;
+  delete[] index;
+}
+
+/* gather_to_master: every process sets the entries i with i % nprocs ==
+   rank, again over several gather rounds, into an array that is not
+   initialized beforehand */
+static void check_gather() {
+  const size_t N = 2500000;
+  const int nprocs = count_processors(), rank = my_rank();
+  size_t n = 0;
+  size_t *index = new size_t[N / nprocs + 1];
+  std::complex<double> *data = new std::complex<double>[N / nprocs + 1];
+  for (size_t i = rank; i < N; i += nprocs) {
+    index[n] = i;
+    data[n] = std::complex<double>(i, -0.5 * i);
+    ++n;
+  }
+
+  std::complex<double> *out = am_master() ? new std::complex<double>[N] : NULL;
+  gather_to_master(index, data, n, out);
+  if (am_master()) {
+    for (size_t i = 0; i < N; ++i)
+      if (out[i] != std::complex<double>(i, -0.5 * i))
+        abort("gather_to_master: entry %zd is %g%+gi instead of %g%+gi", i, real(out[i]),
+              imag(out[i]), double(i), -0.5 * i);
+    delete[] out;
+  }
+  delete[] data;
+  delete[] index;
+}
+
+double two_and_a_half(const vec &) { return 2.5; }
+
+/* an array slice of a uniform epsilon must have every point exactly once,
+   whether it is gathered onto the master or summed directly */
+static void check_slice(bool master_only) {
+  const double a = 10.0;
+  grid_volume gv = voltwo(3.0, 2.0, a);
+  structure s(gv, two_and_a_half, no_pml(), identity(), count_processors() + 1);
+  fields f(&s);
+  volume v(vec(0.0, 0.0), vec(3.0, 2.0));
+  size_t dims[3];
+  direction dirs[3];
+  int rank = f.get_array_slice_dimensions(v, dims, dirs);
+  size_t slice_size = 1;
+  for (int i = 0; i < rank; ++i)
+    slice_size *= dims[i];
+  double *slice = f.get_array_slice(v, Dielectric, 0, 0, master_only);
+  if (am_master() || !master_only) {
+    for (size_t i = 0; i < slice_size; ++i)
+      if (fabs(slice[i] - 2.5) > 1e-6)
+        abort("get_array_slice(master_only=%d): point %zd is %g instead of 2.5", master_only, i,
+              slice[i]);
+    delete[] slice;
+  }
+  else if (slice)
+    abort("get_array_slice(master_only=1) returned a slice on a non-master process");
+}
+
+/* the DFT array gathered from several chunks must match the one from a
+   single chunk, and with master_only it must only be on the master */
+static void check_dft_array() {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s(gv, two_and_a_half, no_pml(), identity(), count_processors() + 2);
+  structure s1(gv, two_and_a_half, no_pml(), identity(), 1);
+  fields f(&s), f1(&s1);
+  component c = Ez;
+  volume v(vec(0.0, 0.0), vec(3.0, 2.0));
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.299, 0.401), 1.0);
+  f1.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.299, 0.401), 1.0);
+  dft_fields dft = f.add_dft_fields(&c, 1, v, 0.8, 0.8, 1);
+  dft_fields dft1 = f1.add_dft_fields(&c, 1, v, 0.8, 0.8, 1);
+  while (f.time() < 10.0) {
+    f.step();
+    f1.step();
+  }
+
+  int rank, rank1;
+  size_t dims[3], dims1[3];
+  std::complex<double> *array = f.get_dft_array(dft, c, 0, &rank, dims);
+  std::complex<double> *array1 = f1.get_dft_array(dft1, c, 0, &rank1, dims1);
+  if (rank != 2 || rank1 != 2 || dims[0] != dims1[0] || dims[1] != dims1[1])
+    abort("get_dft_array: the dimensions depend on the chunks");
+  const size_t n = dims[0] * dims[1];
+  const double tol = sizeof(realnum) == sizeof(float) ? 1e-4 : 1e-10;
+  double maxabs = 0;
+  for (size_t i = 0; i < n; ++i)
+    maxabs = std::max(maxabs, abs(array1[i]));
+  if (maxabs == 0) abort("get_dft_array: the DFT is zero");
+  for (size_t i = 0; i < n; ++i)
+    if (abs(array[i] - array1[i]) > tol * maxabs)
+      abort("get_dft_array: point %zd is %g%+gi instead of %g%+gi", i, real(array[i]),
+            imag(array[i]), real(array1[i]), imag(array1[i]));
+
+  dft_chunk *chunklists[1] = {dft.chunks};
+  std::complex<double> *master_array = NULL;
+  direction dirs[3];
+  f.process_dft_component(chunklists, 1, 0, c, 0, &master_array, &rank, dims, dirs, 0, 0, Ex, 0,
+                          true, true);
+  if (am_master()) {
+    for (size_t i = 0; i < n; ++i)
+      if (master_array[i] != array[i])
+        abort("process_dft_component(master_only): point %zd differs from get_dft_array", i);
+    delete[] master_array;
+  }
+  else if (master_array)
+    abort("process_dft_component(master_only) returned an array on a non-master process");
+  delete[] array;
+  delete[] array1;
+}
+
+int main(int argc, char **argv) {
+  initialize mpi(argc, argv);
+  verbosity = 0;
+  master_printf("Running gather tests...\n");
+  check_gather_sum(1);
+  check_gather_sum(2);
+  check_gather();
+  check_slice(false);
+  check_slice(true);
+  check_dft_array();
+  return 0;
+}
@@ -350,6 +350,112 @@ bool check_2d_monitor(double eps(const vec &), double a, int splitting, symfunc
   return 1;
 }
 
+enum output_option {
+  OUTPUT_PLAIN,
+  OUTPUT_ASYNC,
+  OUTPUT_COMPRESSED,
+  OUTPUT_AGGREGATED,
+  OUTPUT_STRIDED,
+  OUTPUT_AVERAGED,
+  OUTPUT_BUFFERED,
+  OUTPUT_IRREDUCIBLE
+};
+
+/* three time slices of Ez in a 2d cell (with mirror symmetries if
+   symmetric), written by output_hdf5 with the given output option and
+   read back */
+realnum *output_2d(output_option opt, bool symmetric, const char *name, int *rank, size_t *dims) {
+  const grid_volume gv = vol2d(xsize, ysize, 10.0);
+  structure s(gv, funky_eps_2d, no_pml(), symmetric ? make_mirrorxy(gv) : identity(), 3);
+  fields f(&s);
+  f.use_real_fields();
+  f.add_point_source(Ez, 0.3, 2.0, 0.0, 1.0, gv.center(), 1.0, 1);
+  while (f.time() <= 3.0 && !interrupt)
+    f.step();
+
+  if (opt == OUTPUT_ASYNC) f.use_async_output(true, 2);
+  if (opt == OUTPUT_IRREDUCIBLE) f.set_output_irreducible();
+  if (opt == OUTPUT_STRIDED || opt == OUTPUT_AVERAGED)
+    f.set_output_stride(3, opt == OUTPUT_AVERAGED);
+  // with several processes, all but one ship their chunks to an aggregator
+  if (opt == OUTPUT_AGGREGATED) set_hdf5_aggregators(1);
+  h5file *file = f.open_h5file(name);
+  set_hdf5_aggregators(0);
+  if (opt == OUTPUT_COMPRESSED) {
+    const size_t chunk_dims[3] = {8, 5, 1};
+    file->set_chunking(3, chunk_dims);
+    file->set_compression(6);
+    file->use_collective_io();
+  }
+  // two slices are written when the second is appended, and one by the destructor
+  if (opt == OUTPUT_BUFFERED) file->set_append_buffer(2);
+  const volume where(vec(0.2, 0.2), vec(1.8, 1.8)); // symmetric about the center
+  for (int i = 0; i < 3; ++i) {
+    f.output_hdf5(Ez, where, file, true);
+    f.step();
+  }
+  delete file;
+  all_wait();
+
+  file = f.open_h5file(name, h5file::READONLY);
+  realnum *h5data = read_expanded_hdf5(file, "ez", rank, dims, 3);
+  file->prevent_deadlock(); // hackery
+  if (!h5data) abort("failed to read dataset %s:ez\n", name);
+  if (opt == OUTPUT_IRREDUCIBLE) { // about a quarter of the output is in the file
+    int r;
+    size_t d[3];
+    file->read_size("ez", &r, d, 3);
+    if (r != 3 || 2 * d[0] * d[1] > dims[0] * dims[1])
+      abort("%s:ez is not the irreducible part of the output\n", name);
+  }
+  delete file;
+  return h5data;
+}
+
+/* the output with an option must be the same as without it, or (with an
+   output stride of 3) every third point of it or its 3x3 block averages,
+   where the last blocks in each direction are only two points wide */
+bool check_2d_output(output_option opt, const char *name) {
+  int rank0, rank;
+  size_t dims0[3] = {1, 1, 1}, dims[3] = {1, 1, 1};
+  const bool symmetric = opt == OUTPUT_IRREDUCIBLE;
+  realnum *h5data0 = output_2d(OUTPUT_PLAIN, symmetric, "check_2d_output_plain", &rank0, dims0);
+  realnum *h5data = output_2d(opt, symmetric, name, &rank, dims);
+  if (rank != 3 || rank0 != 3) abort("incorrect rank (%d instead of 3) in %s\n", rank, name);
+  const size_t os = (opt == OUTPUT_STRIDED || opt == OUTPUT_AVERAGED) ? 3 : 1;
+  for (int i = 0; i < 3; ++i)
+    if (dims[i] != (i < 2 ? (dims0[i] - 1) / os + 1 : dims0[i]))
+      abort("incorrect dimensions in %s\n", name);
+
+  double maxabs = 0;
+  for (size_t i = 0; i < dims0[0] * dims0[1] * dims0[2]; ++i)
+    maxabs = std::max(maxabs, fabs(double(h5data0[i])));
+  const double tol = opt == OUTPUT_AVERAGED ? 1e-6 * maxabs : 0;
+
+  for (size_t i0 = 0; i0 < dims[0]; ++i0)
+    for (size_t i1 = 0; i1 < dims[1]; ++i1)
+      for (size_t i2 = 0; i2 < dims[2]; ++i2) {
+        double expected = 0;
+        if (opt == OUTPUT_AVERAGED) {
+          int n = 0;
+          for (size_t j0 = i0 * os; j0 < std::min((i0 + 1) * os, dims0[0]); ++j0)
+            for (size_t j1 = i1 * os; j1 < std::min((i1 + 1) * os, dims0[1]); ++j1, ++n)
+              expected += h5data0[(j0 * dims0[1] + j1) * dims0[2] + i2];
+          expected /= n;
+        }
+        else
+          expected = h5data0[(i0 * os * dims0[1] + i1 * os) * dims0[2] + i2];
+        const realnum val = h5data[(i0 * dims[1] + i1) * dims[2] + i2];
+        if (fabs(val - expected) > tol)
+          abort("Error in %s at (%zd,%zd,%zd): %g instead of %g\n", name, i0, i1, i2, val,
+                expected);
+      }
+  delete[] h5data;
+  delete[] h5data0;
+  master_printf("Passed %s\n", name);
+  return true;
+}
+
 int main(int argc, char **argv) {
   const double a = 10.0;
   initialize mpi(argc, argv);
@@ -442,6 +548,14 @@ int main(int argc, char **argv) {
               return 1;
           }
       }
+
+  if (!check_2d_output(OUTPUT_ASYNC, "check_2d_output_async")) return 1;
+  if (!check_2d_output(OUTPUT_COMPRESSED, "check_2d_output_compressed")) return 1;
+  if (!check_2d_output(OUTPUT_AGGREGATED, "check_2d_output_aggregated")) return 1;
+  if (!check_2d_output(OUTPUT_STRIDED, "check_2d_output_strided")) return 1;
+  if (!check_2d_output(OUTPUT_AVERAGED, "check_2d_output_averaged")) return 1;
+  if (!check_2d_output(OUTPUT_BUFFERED, "check_2d_output_buffered")) return 1;
+  if (!check_2d_output(OUTPUT_IRREDUCIBLE, "check_2d_output_irreducible")) return 1;
 #endif /* HAVE_HDF5 */
   return 0;
 }
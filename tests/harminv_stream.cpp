@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <meep.hpp>
+using namespace meep;
+using std::complex;
+
+#include "config.h"
+
+/* Two probes of the same two decaying modes a exp(-i 2 pi f t), with
+   different amplitudes: the decimated stream must keep about 6*(fmax-fmin)*dt
+   of the samples, and its analysis must return the modes themselves. */
+static void check_harminv_stream() {
+  const double dt = 0.05, fmin = 0.25, fmax = 0.45;
+  const complex<double> f[2] = {complex<double>(0.3, -0.001), complex<double>(0.4, -0.002)};
+  const complex<double> a[2][2] = {{1.0, complex<double>(0.3, 0.4)}, {0.5, -2.0}};
+  const int n = 20000;
+
+  harminv_stream hs(2, dt, fmin, fmax);
+  const int D = hs.decimation();
+  if (D != int(floor(1 / (6 * (fmax - fmin) * dt))))
+    abort("harminv_stream: decimation %d for a band width of %g", D, fmax - fmin);
+  for (int i = 0; i < n; ++i) {
+    complex<double> v[2] = {0, 0};
+    for (int p = 0; p < 2; ++p)
+      for (int k = 0; k < 2; ++k)
+        v[p] += a[p][k] * exp(complex<double>(0, -2 * pi) * f[k] * (i * dt));
+    hs.add(v);
+  }
+  if (hs.num_samples() > size_t(n / D) || hs.num_samples() < size_t(n / D) / 2)
+    abort("harminv_stream: %zd decimated samples of %d", hs.num_samples(), n);
+
+#ifdef HAVE_HARMINV
+  const int maxbands = 8;
+  int nmodes[2];
+  complex<double> amps[2 * maxbands];
+  double freq_re[2 * maxbands], freq_im[2 * maxbands];
+  hs.analyze(maxbands, nmodes, amps, freq_re, freq_im);
+  for (int p = 0; p < 2; ++p)
+    for (int k = 0; k < 2; ++k) {
+      int j = p * maxbands;
+      while (j < p * maxbands + nmodes[p] && fabs(freq_re[j] - real(f[k])) > 1e-6)
+        ++j;
+      if (j == p * maxbands + nmodes[p])
+        abort("harminv_stream: frequency %g not found for probe %d", real(f[k]), p);
+      if (fabs(freq_im[j] - imag(f[k])) > 1e-6)
+        abort("harminv_stream: decay rate %g instead of %g", freq_im[j], imag(f[k]));
+      if (abs(amps[j] - a[p][k]) > 1e-4 * abs(a[p][k]))
+        abort("harminv_stream: amplitude %g%+gi instead of %g%+gi", real(amps[j]),
+              imag(amps[j]), real(a[p][k]), imag(a[p][k]));
+    }
+#endif
+}
+
+int main(int argc, char **argv) {
+  initialize mpi(argc, argv);
+  verbosity = 0;
+  master_printf("Running harminv_stream tests...\n");
+  check_harminv_stream();
+  return 0;
+}
@@ -81,6 +81,32 @@ void harmonics(double freq, double chi2, double chi3, double J, double &A2, doub
   delete[] d3f;
 }
 
+double kerr_background = 0.0;
+double kerr_slab(const vec &pt) { return fabs(pt.y() - 1.5) < 0.3 ? the_value : kerr_background; }
+
+/* Ez at a few points after a strong pulse in a 2d cell with chi2 and chi3 in a slab that
+   extends into the PML, with a negligible chi3 outside the slab (so that the nonlinear
+   update covers the whole of every chunk) or none (so that it is restricted to the slab) */
+void kerr_slab_fields(double chi, double background, double *ez) {
+  grid_volume gv = voltwo(4.0, 3.0, 20);
+  the_value = 1.0;
+  structure s(gv, value, pml(0.75), identity(), 4);
+  the_value = 0.5 * chi;
+  kerr_background = 0.0;
+  s.set_chi2(kerr_slab);
+  the_value = chi;
+  kerr_background = background;
+  s.set_chi3(kerr_slab);
+
+  fields f(&s);
+  f.use_real_fields();
+  f.add_point_source(Ez, 0.8, 1.0, 0.0, 4.0, vec(0.5, 1.45), 1.0);
+  while (f.time() < 12)
+    f.step();
+  for (int i = 0; i < 8; ++i)
+    ez[i] = real(f.get_field(Ez, vec(0.3 + 0.45 * i, 1.15 + 0.1 * (i % 7))));
+}
+
 int different(double a, double a0, double thresh, const char *msg) {
   if (fabs(a - a0) > thresh * fabs(a0)) {
     master_printf("error: %s\n --- %g vs. %g (%g error > %g)\n", msg, a, a0,
@@ -99,6 +125,28 @@ int main(int argc, char **argv) {
   double a2, a3, a2_2, a3_2;
 
   double thresh = sizeof(realnum) == sizeof(float) ? 1e-4 : 1e-5;
+  double ez[8], ez_box[8], ez_lin[8];
+  kerr_slab_fields(2.5e-3, 1e-30, ez);
+  kerr_slab_fields(2.5e-3, 0.0, ez_box);
+  kerr_slab_fields(0.0, 0.0, ez_lin);
+  double ezmax = 0, nonlinear = 0;
+  for (int i = 0; i < 8; ++i) {
+    ezmax = max(ezmax, fabs(ez[i]));
+    nonlinear = max(nonlinear, fabs(ez[i] - ez_lin[i]));
+  }
+  for (int i = 0; i < 8; ++i) {
+    if (fabs(ez_box[i] - ez[i]) > 1e-2 * thresh * ezmax) {
+      master_printf("error: Kerr update restricted to the nonlinear slab\n --- Ez = %g vs. %g\n",
+                    ez_box[i], ez[i]);
+      return 1;
+    }
+  }
+  if (nonlinear < 1e-3 * ezmax) {
+    master_printf("error: too small a nonlinear effect (%g of %g) in the slab test\n", nonlinear,
+                  ezmax);
+    return 1;
+  }
+
   harmonics(freq, 0.27e-4, 1e-4, 1.0, a2, a3);
   if (different(a2, 9.80330e-07, thresh, "2nd harmonic mismatches known val")) return 1;
   if (different(a3, 9.97747e-07, thresh, "3rd harmonic mismatches known val")) return 1;
@@ -30,6 +30,28 @@ double two(const vec &) { return 2.0; }
 
 const int EHcomp[10] = {0, 1, 0, 1, 2, 3, 4, 3, 4, 5};
 
+// the (outward-weighted) surfaces of the square or cube of half-width L
+volume_list *near2far_box(ndim dim, double L) {
+  if (dim == D2)
+    return new volume_list(
+        volume(vec(-L, +L), vec(+L, +L)), Sy, 1.0,
+        new volume_list(
+            volume(vec(+L, +L), vec(+L, -L)), Sx, 1.0,
+            new volume_list(volume(vec(-L, -L), vec(+L, -L)), Sy, -1.0,
+                            new volume_list(volume(vec(-L, -L), vec(-L, +L)), Sx, -1.0))));
+  return new volume_list(
+      volume(vec(+L, -L, -L), vec(+L, +L, +L)), Sx, +1.,
+      new volume_list(
+          volume(vec(-L, -L, -L), vec(-L, +L, +L)), Sx, -1.,
+          new volume_list(
+              volume(vec(-L, +L, -L), vec(+L, +L, +L)), Sy, +1.,
+              new volume_list(
+                  volume(vec(-L, -L, -L), vec(+L, -L, +L)), Sy, -1.,
+                  new volume_list(volume(vec(-L, -L, +L), vec(+L, +L, +L)), Sz, +1.,
+                                  new volume_list(volume(vec(-L, -L, -L), vec(+L, +L, -L)),
+                                                  Sz, -1.))))));
+}
+
 int check_2d_3d(ndim dim, const double xmax, double a, component c0) {
   const double dpml = 1;
   if (dim != D2 && dim != D3) abort("2d or 3d required");
@@ -84,28 +106,9 @@ int check_2d_3d(ndim dim, const double xmax, double a, component c0) {
     }
   }
 
-  const double L = xmax / 4;
-  volume_list vl =
-      dim == D2
-          ? volume_list(
-                volume(vec(-L, +L), vec(+L, +L)), Sy, 1.0,
-                new volume_list(
-                    volume(vec(+L, +L), vec(+L, -L)), Sx, 1.0,
-                    new volume_list(volume(vec(-L, -L), vec(+L, -L)), Sy, -1.0,
-                                    new volume_list(volume(vec(-L, -L), vec(-L, +L)), Sx, -1.0))))
-          : volume_list(volume(vec(+L, -L, -L), vec(+L, +L, +L)), Sx, +1.,
-                        new volume_list(
-                            volume(vec(-L, -L, -L), vec(-L, +L, +L)), Sx, -1.,
-                            new volume_list(
-                                volume(vec(-L, +L, -L), vec(+L, +L, +L)), Sy, +1.,
-                                new volume_list(
-                                    volume(vec(-L, -L, -L), vec(+L, -L, +L)), Sy, -1.,
-                                    new volume_list(
-                                        volume(vec(-L, -L, +L), vec(+L, +L, +L)), Sz, +1.,
-                                        new volume_list(volume(vec(-L, -L, -L), vec(+L, +L, -L)),
-                                                        Sz, -1.))))));
-
-  dft_near2far n2f = f.add_dft_near2far(&vl, w, w, 1);
+  volume_list *vl = near2far_box(dim, xmax / 4);
+  dft_near2far n2f = f.add_dft_near2far(vl, w, w, 1);
+  delete vl;
   f.update_dfts();
   n2f.scale_dfts(sqrt(2 * pi) / f.dt); // cancel time-integration factor
 
@@ -148,6 +151,105 @@ int check_2d_3d(ndim dim, const double xmax, double a, component c0) {
   return 1;
 }
 
+/* relative difference of the far fields EH and EH0 (6 x Nfreq arrays) */
+double farfield_relerr(const complex<double> *EH, const complex<double> *EH0, int n) {
+  double diff = 0.0, dot = 0.0;
+  for (int i = 0; i < n; ++i) {
+    diff += norm(EH[i] - EH0[i]);
+    dot += norm(EH0[i]);
+  }
+  return sqrt(diff / dot);
+}
+
+/* far fields of a pulsed c0 source in 2d or 3d; far from the near-field
+   surface, the far-zone approximation must agree with the exact Green's
+   functions, the grid of far fields from get_farfields_array (whose
+   points are divided among the processes) must agree with farfield, and
+   the Green's functions batched over frequencies must agree with those of
+   single frequencies */
+int check_farfields(ndim dim, component c0) {
+  const double dpml = 1, xmax = 3, a = dim == D2 ? 20 : 8;
+  grid_volume gv = dim == D2 ? vol2d(xmax + 2 * dpml, xmax + 2 * dpml, a)
+                             : vol3d(xmax + 2 * dpml, xmax + 2 * dpml, xmax + 2 * dpml, a);
+  gv.center_origin();
+  if (!gv.has_field(c0)) return 1;
+  master_printf("TESTING %s FAR FIELDS FOR %s SOURCE...\n", dim == D2 ? "2D" : "3D",
+                component_name(c0));
+
+  structure s(gv, two, pml(dpml));
+  fields f(&s);
+  gaussian_src_time src(0.3, 0.1);
+  f.add_point_source(c0, src, zero_vec(dim));
+  volume_list *vl = near2far_box(dim, xmax / 4);
+  const int Nfreq = 20;
+  dft_near2far n2f = f.add_dft_near2far(vl, 0.25, 0.35, Nfreq);
+  const int Nsingle = 4, single[Nsingle] = {0, 7, 16, 19};
+  std::vector<dft_near2far> n2f_single;
+  for (int i = 0; i < Nsingle; ++i) {
+    const double freq = 0.25 + single[i] * 0.1 / (Nfreq - 1);
+    n2f_single.push_back(f.add_dft_near2far(vl, freq, freq, 1));
+  }
+  delete vl;
+  while (f.time() < f.last_source_time())
+    f.step();
+
+  const double R = 1e4;
+  vec x = dim == D2 ? vec(0.8 * R, 0.6 * R) : vec(0.48 * R, 0.6 * R, 0.64 * R);
+  complex<double> *EH = n2f.farfield(x);
+  n2f.far_zone = true;
+  complex<double> *EH_far = n2f.farfield(x);
+  n2f.far_zone = false;
+  double relerr = farfield_relerr(EH_far, EH, 6 * Nfreq);
+  master_printf("  FAR ZONE: relerr = %g\n", relerr);
+  delete[] EH_far;
+  delete[] EH;
+  if (relerr > 1e-3) return 0;
+
+  // a line of far-field points along the second direction
+  const double y0 = -0.5 * R, y1 = 0.5 * R;
+  vec x0 = x, x1 = x;
+  x0.set_direction(Y, y0);
+  x1.set_direction(Y, y1);
+  int rank = 0;
+  size_t dims[3] = {1, 1, 1}, N = 1;
+  realnum *EH_array = n2f.get_farfields_array(volume(x0, x1), rank, dims, N, 7.5 / R);
+  if (rank != 1 || N != 7) return 0;
+  complex<double> *EH_grid = new complex<double>[6 * Nfreq];
+  double maxerr = 0;
+  for (size_t i = 0; i < N; ++i) {
+    vec xi = x;
+    xi.set_direction(Y, y0 + i * (y1 - y0) / (N - 1));
+    EH = n2f.farfield(xi);
+    for (int k = 0; k < 6; ++k)
+      for (int j = 0; j < Nfreq; ++j)
+        EH_grid[j * 6 + k] = complex<double>(EH_array[((k * 2 + 0) * N + i) * Nfreq + j],
+                                             EH_array[((k * 2 + 1) * N + i) * Nfreq + j]);
+    maxerr = std::max(maxerr, farfield_relerr(EH_grid, EH, 6 * Nfreq));
+    delete[] EH;
+  }
+  delete[] EH_grid;
+  delete[] EH_array;
+  master_printf("  FARFIELDS ARRAY: relerr = %g\n", maxerr);
+  if (maxerr > (sizeof(realnum) == sizeof(float) ? 1e-6 : 1e-12)) return 0;
+
+  // near (in 3d, where there are no Hankel functions) and far points
+  maxerr = 0;
+  for (int ix = dim == D3 ? 0 : 1; ix < 2; ++ix) {
+    vec xi = ix ? x : x * (5.0 / R);
+    EH = n2f.farfield(xi);
+    for (int i = 0; i < Nsingle; ++i) {
+      complex<double> *EH1 = n2f_single[i].farfield(xi);
+      maxerr = std::max(maxerr, farfield_relerr(EH + 6 * single[i], EH1, 6));
+      delete[] EH1;
+    }
+    delete[] EH;
+  }
+  master_printf("  BATCHED FREQUENCIES: relerr = %g\n", maxerr);
+  if (maxerr > 1e-10) return 0;
+
+  return 1;
+}
+
 int main(int argc, char **argv) {
   initialize mpi(argc, argv);
 
@@ -155,6 +257,9 @@ int main(int argc, char **argv) {
 
   if (!check_2d_3d(D3, 4, a3d, Ez)) return 1;
   if (!check_2d_3d(D3, 4, a3d, Hz)) return 1;
+  if (!check_farfields(D3, Ez)) return 1;
+  if (!check_farfields(D2, Ez)) return 1;
+  if (!check_farfields(D2, Hz)) return 1;
 #ifdef HAVE_LIBGSL
   FOR_E_AND_H(c0) {
     if (!check_2d_3d(D2, 8, a2d, c0)) return 1;
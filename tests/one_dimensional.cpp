@@ -18,6 +18,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
+#include <math.h>
+#include <limits>
 
 #include <meep.hpp>
 using namespace meep;
@@ -149,6 +151,69 @@ int test_pattern(double eps(const vec &), int splitting, const char *mydirname)
   return 1;
 }
 
+double two(const vec &) { return 2.0; }
+double three(const vec &) { return 3.0; }
+
+/* A copy of a structure must not see later changes of the original, nor the
+   original those of the copy, whether or not the original modifies its
+   chunks in place for its fields (shared_chunks). */
+int test_structure_copy(int splitting, bool shared) {
+  grid_volume gv = volone(6.0, 10.0);
+  structure s(gv, one, no_pml(), identity(), splitting);
+  s.shared_chunks = shared;
+  fields f(&s);
+  structure copy(s);
+  const vec pt(2.0);
+
+  s.set_epsilon(two, false);
+  if (!compare(copy.get_eps(pt), 1.0, "Copy after changing the original")) return 0;
+  if (!compare(s.get_eps(pt), 2.0, "Changed original")) return 0;
+  copy.set_epsilon(three, false);
+  if (!compare(s.get_eps(pt), 2.0, "Original after changing the copy")) return 0;
+  if (!compare(copy.get_eps(pt), 3.0, "Changed copy")) return 0;
+  if (shared && !compare(f.get_eps(pt), 2.0, "Fields of the changed original")) return 0;
+  return 1;
+}
+
+/* fields_are_finite must accept fields that are huge but finite (whose sum
+   overflows), and reject a single NaN */
+int test_fields_are_finite(int splitting) {
+  grid_volume gv = volone(6.0, 10.0);
+  structure s(gv, one, no_pml(), identity(), splitting);
+  fields f(&s);
+  f.initialize_field(Hy, checkers);
+  f.step();
+
+  bool finite = true;
+  realnum *last = NULL;
+  for (int i = 0; i < f.num_chunks; i++)
+    if (f.chunks[i]->is_mine()) {
+      FOR_COMPONENTS(c) for (int cmp = 0; cmp < 2; ++cmp) {
+        realnum *fc = f.chunks[i]->f[c][cmp];
+        if (!fc) continue;
+        for (size_t j = 0; j < f.chunks[i]->gv.ntot(); ++j)
+          fc[j] = 0.9 * std::numeric_limits<realnum>::max();
+        last = fc;
+      }
+      finite = finite && f.chunks[i]->fields_are_finite();
+    }
+  if (!finite) {
+    master_printf("Huge finite fields are reported as not finite!\n");
+    return 0;
+  }
+  if (last) {
+    last[0] = NAN;
+    finite = true;
+    for (int i = 0; i < f.num_chunks; i++)
+      if (f.chunks[i]->is_mine()) finite = finite && f.chunks[i]->fields_are_finite();
+    if (finite) {
+      master_printf("A NaN field value is not detected!\n");
+      return 0;
+    }
+  }
+  return 1;
+}
+
 int main(int argc, char **argv) {
   initialize mpi(argc, argv);
   verbosity = 0;
@@ -160,5 +225,12 @@ int main(int argc, char **argv) {
 
   for (int s = 2; s < 7; s++)
     if (!test_simple_periodic(one, s, mydirname)) abort("error in test_simple_periodic\n");
+
+  for (int s = 1; s < 4; s++)
+    for (int shared = 0; shared < 2; shared++)
+      if (!test_structure_copy(s, shared)) abort("error in test_structure_copy\n");
+
+  for (int s = 1; s < 4; s++)
+    if (!test_fields_are_finite(s)) abort("error in test_fields_are_finite\n");
   return 0;
 }
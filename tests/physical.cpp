@@ -95,6 +95,75 @@ int radiating_3D(const double xmax) {
   return 1;
 }
 
+// fields with the point source of radiating_2D
+static fields *radiating_fields(structure &s, double xmax, double ymax) {
+  fields *f = new fields(&s);
+  continuous_src_time src(0.30);
+  f->add_point_source(Ez, src, vec(xmax / 2 - 2.0, ymax / 2));
+  return f;
+}
+
+static double rel_diff(complex<double> a, complex<double> b) { return abs(a - b) / abs(b); }
+
+/* the shifted preconditioner changes how solve_cw gets to the solution,
+   not the solution itself */
+int preconditioned_cw(const double xmax) {
+  const double ymax = 3.0;
+  grid_volume gv = voltwo(xmax, ymax, 10.0);
+  structure s(gv, one, pml(ymax / 3));
+  const vec p1(xmax / 2, ymax / 2), p2(xmax / 2 + 2.0, ymax / 2);
+
+  fields *f = radiating_fields(s, xmax, ymax);
+  if (!f->solve_cw(1e-8, 10000, 2)) return 0;
+  fields *g = radiating_fields(s, xmax, ymax);
+  if (!g->solve_cw(1e-8, 10000, 2, 4, 0.2)) return 0;
+  const double d = std::max(rel_diff(g->get_field(Ez, p1), f->get_field(Ez, p1)),
+                            rel_diff(g->get_field(Ez, p2), f->get_field(Ez, p2)));
+  master_printf("Preconditioned solution differs by %g\n", d);
+  delete f;
+  delete g;
+  return d < 1e-5;
+}
+
+typedef struct {
+  vec p;
+  std::vector<complex<double> > amps;
+} probe_data;
+
+static void record_probe(fields *f, int ifreq, void *data) {
+  probe_data *probe = (probe_data *)data;
+  if (size_t(ifreq) != probe->amps.size())
+    abort("solve_cw_multi: frequency %d out of order", ifreq);
+  probe->amps.push_back(f->get_field(Ez, probe->p));
+}
+
+/* solve_cw_multi gives the fields of a separate solve_cw at each
+   frequency, with the callback called once per frequency */
+int multi_frequency_cw(const double xmax) {
+  const double ymax = 3.0;
+  grid_volume gv = voltwo(xmax, ymax, 10.0);
+  structure s(gv, one, pml(ymax / 3));
+  const complex<double> freqs[4] = {0.28, 0.29, 0.30, 0.33};
+
+  probe_data probe;
+  probe.p = vec(xmax / 2 + 2.0, ymax / 2);
+  fields *f = radiating_fields(s, xmax, ymax);
+  if (!f->solve_cw_multi(1e-8, 10000, freqs, 4, 2, record_probe, &probe)) return 0;
+  delete f;
+  if (probe.amps.size() != 4) return 0;
+  for (int k = 0; k < 4; ++k) {
+    fields *g = radiating_fields(s, xmax, ymax);
+    if (!g->solve_cw(1e-8, 10000, freqs[k])) return 0;
+    const complex<double> amp = g->get_field(Ez, probe.p);
+    master_printf("Multi-frequency solution at %g differs by %g\n", real(freqs[k]),
+                  rel_diff(probe.amps[k], amp));
+    if (rel_diff(probe.amps[k], amp) > 1e-5) return 0;
+    if (k > 0 && rel_diff(probe.amps[k], probe.amps[0]) < 1e-2) return 0;
+    delete g;
+  }
+  return 1;
+}
+
 void attempt(const char *name, int allright) {
   if (allright)
     master_printf("Passed %s\n", name);
@@ -109,5 +178,7 @@ int main(int argc, char **argv) {
 
   attempt("radiating source should decay spatially as 1/sqrt(r) in 2D.", radiating_2D(8.0));
   attempt("radiating source should decay spatially as 1/r in 3D.", radiating_3D(7.0));
+  attempt("preconditioned solve_cw should give the same fields.", preconditioned_cw(8.0));
+  attempt("solve_cw_multi should match solve_cw at each frequency.", multi_frequency_cw(8.0));
   return 0;
 }
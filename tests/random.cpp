@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <meep.hpp>
+using namespace meep;
+
+/* Philox4x32-10 known-answer vectors from the Random123 distribution */
+static void check_counter_random() {
+  const uint32_t keys[3][2] = {{0, 0}, {0xffffffff, 0xffffffff}, {0xa4093822, 0x299f31d0}};
+  const uint32_t ctrs[3][4] = {{0, 0, 0, 0},
+                               {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff},
+                               {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}};
+  const uint32_t answers[3][4] = {{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8},
+                                  {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd},
+                                  {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}};
+  for (int k = 0; k < 3; ++k) {
+    uint32_t r[4];
+    counter_random(keys[k], ctrs[k], r);
+    for (int i = 0; i < 4; ++i)
+      if (r[i] != answers[k][i])
+        abort("counter_random: word %d of known answer %d is %08x instead of %08x", i, k, r[i],
+              answers[k][i]);
+  }
+}
+
+/* the bulk gaussian deviates must match the pointwise ones, and have the
+   right mean and standard deviation */
+static void check_counter_gaussian() {
+  const uint32_t key[2] = {uint32_t(counter_random_seed()), 17};
+  const uint32_t ctr[3] = {3, 1, 4};
+  const size_t n = 100000;
+  double *g = new double[n];
+  counter_gaussian_randoms(key, ctr, n, g, 1.0, 2.0);
+  double sum = 0, sum2 = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const uint32_t c[4] = {ctr[0], ctr[1], ctr[2], uint32_t(i)};
+    if (g[i] != counter_gaussian_random(key, c, 1.0, 2.0))
+      abort("counter_gaussian_randoms: deviate %zd differs from counter_gaussian_random", i);
+    sum += g[i];
+    sum2 += g[i] * g[i];
+  }
+  const double mean = sum / n, stddev = sqrt(sum2 / n - mean * mean);
+  master_printf("gaussian mean %g, standard deviation %g\n", mean, stddev);
+  // 5 standard errors
+  if (fabs(mean - 1.0) > 5 * 2.0 / sqrt(double(n))) abort("counter_gaussian_randoms: bad mean");
+  if (fabs(stddev - 2.0) > 5 * 2.0 / sqrt(2.0 * n))
+    abort("counter_gaussian_randoms: bad standard deviation");
+  delete[] g;
+}
+
+int main(int argc, char **argv) {
+  initialize mpi(argc, argv);
+  verbosity = 0;
+  master_printf("Running counter-based random number tests...\n");
+  set_random_seed(314159);
+  check_counter_random();
+  check_counter_gaussian();
+  return 0;
+}
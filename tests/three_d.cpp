@@ -232,6 +232,51 @@ int test_pml_splitting(double eps(const vec &), int splitting, const char *mydir
   return 1;
 }
 
+static double gyro_background = 0.0;
+double gyro_ball(const vec &pt) {
+  return abs(pt - vec(0.8, 0.5, 0.6)) < 0.3 ? 0.5 : gyro_background;
+}
+
+/* a gyrotropic ball, whose polarization update is restricted to its bounding box, against
+   the same ball on a negligible gyrotropic background (so that the update covers every
+   chunk), and against vacuum to see that the ball matters */
+int test_gyrotropic(int splitting, const char *mydirname) {
+  double a = 10.0;
+
+  grid_volume gv = vol3d(1.5, 1.0, 1.2, a);
+  structure s(gv, one, pml(0.3), identity(), splitting);
+  structure s1(gv, one, pml(0.3));
+  structure s0(gv, one, pml(0.3));
+  s.set_output_directory(mydirname);
+  s1.set_output_directory(mydirname);
+  s0.set_output_directory(mydirname);
+  const gyrotropic_susceptibility gyro(vec(0.1, 0.2, 0.9), 0.6, 0.05, 0.0);
+  gyro_background = 0.0;
+  s.add_susceptibility(gyro_ball, E_stuff, gyro);
+  gyro_background = 1e-20;
+  s1.add_susceptibility(gyro_ball, E_stuff, gyro);
+
+  master_printf("Testing a gyrotropic ball split into %d chunks...\n", splitting);
+  fields f(&s), f1(&s1), f0(&s0);
+  f.add_point_source(Ez, 0.8, 1.6, 0.0, 4.0, vec(0.499, 0.499, 0.501), 1.0);
+  f1.add_point_source(Ez, 0.8, 1.6, 0.0, 4.0, vec(0.499, 0.499, 0.501), 1.0);
+  f0.add_point_source(Ez, 0.8, 1.6, 0.0, 4.0, vec(0.499, 0.499, 0.501), 1.0);
+  while (f.time() < 10.0) {
+    f.step();
+    f1.step();
+    f0.step();
+    if (!approx_point(f, f1, vec(0.8, 0.5, 0.6))) return 0;
+    if (!approx_point(f, f1, vec(0.71, 0.4, 0.75))) return 0;
+    if (!approx_point(f, f1, vec(1.2, 0.8, 0.33))) return 0;
+  }
+  const vec p(0.9, 0.45, 0.55);
+  if (abs(f.get_field(Ex, p) - f0.get_field(Ex, p)) < 1e-3 * abs(f0.get_field(Ez, p))) {
+    master_printf("The gyrotropic ball has no effect on Ex\n");
+    return 0;
+  }
+  return 1;
+}
+
 int main(int argc, char **argv) {
   initialize mpi(argc, argv);
   verbosity = 0;
@@ -250,5 +295,8 @@ int main(int argc, char **argv) {
   for (int s = 2; s < 4; s++)
     if (!test_pml_splitting(one, s, mydirname)) abort("error in test_pml_splitting vacuum\n");
 
+  for (int s = 1; s < 4; s++)
+    if (!test_gyrotropic(s, mydirname)) abort("error in test_gyrotropic\n");
+
   return 0;
 }
@@ -111,6 +111,327 @@ int test_metal(double eps(const vec &), int splitting, const char *mydirname) {
   return 1;
 }
 
+double negligible(const vec &) { return 1e-30; }
+
+/* In lossless chunks, step_db applies E = chi1inv * D (and H = B/mu) in
+   the same sweep as the curl update.  A negligible conductivity makes
+   every component take the separate update_eh sweep instead, which must
+   give the same fields. */
+int test_fused(double eps(const vec &), int splitting, const char *mydirname) {
+  double a = 10.0;
+  double ttot = 17.0;
+
+  grid_volume gv = voltwo(3.0, 2.0, a);
+  structure s1(gv, eps, no_pml(), identity(), splitting);
+  structure s(gv, eps, no_pml(), identity(), splitting);
+  s.set_output_directory(mydirname);
+  s1.set_output_directory(mydirname);
+  FOR_ELECTRIC_COMPONENTS(c) if (gv.has_field(c)) s.set_conductivity(c, negligible);
+  FOR_MAGNETIC_COMPONENTS(c) if (gv.has_field(c)) s.set_conductivity(c, negligible);
+
+  master_printf("Fused E/H update test using %d chunks...\n", splitting);
+  fields f(&s);
+  f.add_point_source(Hz, 0.7, 2.5, 0.0, 4.0, vec(0.3, 0.5), 1.0);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.299, 0.401), 1.0);
+  fields f1(&s1);
+  f1.add_point_source(Hz, 0.7, 2.5, 0.0, 4.0, vec(0.3, 0.5), 1.0);
+  f1.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.299, 0.401), 1.0);
+  while (f.time() < ttot) {
+    f.step();
+    f1.step();
+    if (!compare_point(f, f1, vec(0.5, 0.01))) return 0;
+    if (!compare_point(f, f1, vec(0.46, 0.33))) return 0;
+    if (!compare_point(f, f1, vec(1.299, 0.401))) return 0;
+  }
+  if (!compare(f.field_energy(), f1.field_energy(), "   total energy")) return 0;
+  return 1;
+}
+
+/* step the same sources in structures s and s1, which should give identical
+   fields, and compare them */
+int compare_fields(structure &s, structure &s1) {
+  fields f(&s);
+  f.add_point_source(Hz, 0.7, 2.5, 0.0, 4.0, vec(0.3, 0.5), 1.0);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.299, 0.401), 1.0);
+  fields f1(&s1);
+  f1.add_point_source(Hz, 0.7, 2.5, 0.0, 4.0, vec(0.3, 0.5), 1.0);
+  f1.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.299, 0.401), 1.0);
+  while (f.time() < 17.0) {
+    f.step();
+    f1.step();
+    if (!compare_point(f, f1, vec(0.5, 0.01))) return 0;
+    if (!compare_point(f, f1, vec(0.46, 0.33))) return 0;
+    if (!compare_point(f, f1, vec(1.5, 1.0))) return 0;
+  }
+  if (!compare(f.field_energy(), f1.field_energy(), "   total energy")) return 0;
+  return 1;
+}
+
+/* Plain Lorentzian poles are stepped and subtracted together; a noisy
+   Lorentzian with zero noise goes through the separate per-pole path. */
+int test_poles(double eps(const vec &), int splitting, const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s1(gv, eps, no_pml(), identity(), splitting);
+  structure s(gv, eps, no_pml(), identity(), splitting);
+  s.set_output_directory(mydirname);
+  s1.set_output_directory(mydirname);
+
+  s.add_susceptibility(one, E_stuff, lorentzian_susceptibility(0.3, 0.1));
+  s.add_susceptibility(targets, E_stuff, lorentzian_susceptibility(0.9, 0.05));
+  s.add_susceptibility(one, E_stuff, lorentzian_susceptibility(1e-5, 0.2, true));
+  s1.add_susceptibility(one, E_stuff, noisy_lorentzian_susceptibility(0.0, 0.3, 0.1));
+  s1.add_susceptibility(targets, E_stuff, noisy_lorentzian_susceptibility(0.0, 0.9, 0.05));
+  s1.add_susceptibility(one, E_stuff, noisy_lorentzian_susceptibility(0.0, 1e-5, 0.2, true));
+
+  master_printf("Multiple Lorentzian poles test using %d chunks...\n", splitting);
+  return compare_fields(s, s1);
+}
+
+double disk(const vec &pt) {
+  const double dx = pt.x() - 1.3, dy = pt.y() - 0.8;
+  return dx * dx + dy * dy < 0.35 * 0.35 ? 2.0 : 0.0;
+}
+double disk_everywhere(const vec &pt) { return disk(pt) + 1e-30; }
+
+/* The polarization is only updated in the bounding box of the points where
+   sigma != 0; a negligible sigma everywhere else makes it update the whole
+   chunk, which must give the same fields. */
+int test_sigma_box(double eps(const vec &), int splitting, const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s1(gv, eps, no_pml(), identity(), splitting);
+  structure s(gv, eps, no_pml(), identity(), splitting);
+  s.set_output_directory(mydirname);
+  s1.set_output_directory(mydirname);
+
+  s.add_susceptibility(disk, E_stuff, lorentzian_susceptibility(0.3, 0.1));
+  s.add_susceptibility(disk, H_stuff, noisy_lorentzian_susceptibility(0.0, 0.5, 0.1));
+  s1.add_susceptibility(disk_everywhere, E_stuff, lorentzian_susceptibility(0.3, 0.1));
+  s1.add_susceptibility(disk_everywhere, H_stuff, noisy_lorentzian_susceptibility(0.0, 0.5, 0.1));
+
+  master_printf("Bounded susceptibility test using %d chunks...\n", splitting);
+  return compare_fields(s, s1);
+}
+
+/* Likewise for a pumped two-level atom, whose populations are updated in
+   the bounding box padded by one pixel. */
+int test_multilevel(double eps(const vec &), int splitting, const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s1(gv, eps, no_pml(), identity(), splitting);
+  structure s(gv, eps, no_pml(), identity(), splitting);
+  s.set_output_directory(mydirname);
+  s1.set_output_directory(mydirname);
+
+  // level 1 decays to level 0 (radiatively, at frequency 0.5) and is pumped from it
+  const double decay = 0.005, pump = 0.01, freq = 0.5;
+  const realnum Gamma[4] = {pump, -decay, -pump, decay};
+  const realnum N0[2] = {1.0, 0.0};
+  const realnum alpha[2] = {1 / (2 * pi * freq), -1 / (2 * pi * freq)};
+  const realnum omega[1] = {freq}, gamma[1] = {0.1};
+  const realnum sigmat[5] = {1.0, 1.0, 1.0, 1.0, 1.0};
+  multilevel_susceptibility atom(2, 1, Gamma, N0, alpha, omega, gamma, sigmat);
+  s.add_susceptibility(disk, E_stuff, atom);
+  s1.add_susceptibility(disk_everywhere, E_stuff, atom);
+
+  master_printf("Bounded multilevel atom test using %d chunks...\n", splitting);
+  return compare_fields(s, s1);
+}
+
+/* The noise of a noisy Lorentzian depends only on the seed, the time step and
+   the grid point, so it must not depend on the chunk layout. */
+int test_noise(double eps(const vec &), int splitting, const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s1(gv, eps);
+  structure s(gv, eps, no_pml(), identity(), splitting);
+  s.set_output_directory(mydirname);
+  s1.set_output_directory(mydirname);
+
+  noisy_lorentzian_susceptibility noisy(0.1, 0.5, 0.1); // the same id in both
+  s.add_susceptibility(disk, E_stuff, noisy);
+  s1.add_susceptibility(disk, E_stuff, noisy);
+
+  master_printf("Noisy Lorentzian test using %d chunks...\n", splitting);
+  return compare_fields(s, s1);
+}
+
+/* Modifying a copy of a structure copies its chunks, including the PML
+   profile tables; the copy must step just like a structure built from
+   scratch. */
+int test_pml_copy(double eps(const vec &), int splitting, const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s0(gv, eps, pml(1.0, X) + pml(1.0, Y, High), identity(), splitting);
+  structure s1(gv, eps, pml(1.0, X) + pml(1.0, Y, High), identity(), splitting);
+  structure s(s0);
+  s.set_output_directory(mydirname);
+  s1.set_output_directory(mydirname);
+
+  s.add_susceptibility(disk, E_stuff, lorentzian_susceptibility(0.3, 0.1));
+  s1.add_susceptibility(disk, E_stuff, lorentzian_susceptibility(0.3, 0.1));
+
+  master_printf("Copied pml structure test using %d chunks...\n", splitting);
+  return compare_fields(s, s1);
+}
+
+/* Measure the chunk costs, rebalance the chunk owners, and rebuild the
+   structure with the new owners, which must not change the fields. */
+int test_rebalance(double eps(const vec &), int splitting, const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s(gv, eps, no_pml(), identity(), splitting);
+  structure s1(gv, eps, no_pml(), identity(), splitting);
+  s.set_output_directory(mydirname);
+  s1.set_output_directory(mydirname);
+
+  master_printf("Chunk rebalancing test using %d chunks...\n", splitting);
+  fields f(&s);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.299, 0.401), 1.0);
+  for (int i = 0; i < 20; i++)
+    f.step();
+  const std::vector<double> costs = f.get_chunk_costs();
+  const std::vector<int> owners = f.choose_chunk_owners();
+  if (costs.size() != size_t(splitting) || owners.size() != size_t(splitting)) return 0;
+
+  // the greedy assignment is within one chunk of the mean load
+  std::vector<double> load(count_processors(), 0.0);
+  double total = 0, biggest = 0;
+  for (int i = 0; i < splitting; i++) {
+    if (costs[i] < 0 || owners[i] < 0 || owners[i] >= count_processors()) return 0;
+    load[owners[i]] += costs[i];
+    total += costs[i];
+    biggest = std::max(biggest, costs[i]);
+  }
+  if (total <= 0) return 0;
+  for (int p = 0; p < count_processors(); p++)
+    if (load[p] > total / count_processors() + biggest * (1 + 1e-12)) return 0;
+
+  std::vector<grid_volume> gvs;
+  for (int i = 0; i < splitting; i++)
+    gvs.push_back(s.chunks[i]->gv);
+  boundary_region br = no_pml();
+  s1.load_chunk_layout(gvs, owners, br);
+  s1.set_epsilon(eps, false);
+  for (int i = 0; i < splitting; i++)
+    if (s1.chunks[i]->n_proc() != owners[i]) return 0;
+  return compare_fields(s, s1);
+}
+
+/* A separable amplitude profile is stored as factors, and a slightly
+   non-separable one as a full array of amplitudes. */
+complex<double> separable_amp(const vec &p) {
+  return exp(-(p.x() - 0.2) * (p.x() - 0.2) / 0.1) * std::polar(1.0, 2.0 * p.y());
+}
+complex<double> nonseparable_amp(const vec &p) {
+  return separable_amp(p) * (1.0 + 1e-9 * p.x() * p.y());
+}
+// separable_amp, a box of grid points at a time
+void separable_amp_box(void *data, const vec &p0, const vec dp[3], const size_t n[3],
+                       complex<double> *A) {
+  (void)data;
+  for (size_t i0 = 0; i0 < n[0]; ++i0)
+    for (size_t i1 = 0; i1 < n[1]; ++i1)
+      for (size_t i2 = 0; i2 < n[2]; ++i2)
+        A[(i0 * n[1] + i1) * n[2] + i2] =
+            separable_amp(p0 + dp[0] * double(i0) + dp[1] * double(i1) + dp[2] * double(i2));
+}
+
+int test_volume_source(double eps(const vec &), int splitting, const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s1(gv, eps);
+  structure s(gv, eps, no_pml(), identity(), splitting);
+  s.set_output_directory(mydirname);
+  s1.set_output_directory(mydirname);
+
+  master_printf("Volume source test using %d chunks...\n", splitting);
+  fields f(&s), f1(&s1), f2(&s1), f3(&s);
+  const volume box(vec(0.45, 0.3), vec(1.75, 1.25)), line(vec(2.2, 0.2), vec(2.2, 1.7));
+  gaussian_src_time src(0.8, 0.6);
+  f.add_volume_source(Ez, src, box, separable_amp);
+  f.add_volume_source(Hx, src, line, separable_amp);
+  f1.add_volume_source(Ez, src, box, separable_amp);
+  f1.add_volume_source(Hx, src, line, separable_amp);
+  f2.add_volume_source(Ez, src, box, nonseparable_amp);
+  f2.add_volume_source(Hx, src, line, nonseparable_amp);
+  f3.add_volume_source(Ez, src, box, separable_amp_box, NULL, 1.0);
+  f3.add_volume_source(Hx, src, line, separable_amp_box, NULL, 1.0);
+
+  while (f.time() < 10.0) {
+    f.step();
+    f1.step();
+    f2.step();
+    f3.step();
+    if (!compare_point(f, f1, vec(0.5, 0.01))) return 0;
+    if (!compare_point(f, f1, vec(1.1, 0.8))) return 0;
+    if (!compare_point(f, f1, vec(2.5, 1.3))) return 0;
+    if (!compare_point(f3, f, vec(1.1, 0.8))) return 0;
+    if (!compare_point(f3, f, vec(2.5, 1.3))) return 0;
+  }
+  if (!compare(f.field_energy(), f1.field_energy(), "   total energy")) return 0;
+  const double e1 = f1.field_energy(), e2 = f2.field_energy();
+  if (fabs(e2 - e1) > 1e-6 * e1) {
+    master_printf("non-separable source energy %g instead of %g\n", e2, e1);
+    return 0;
+  }
+  return 1;
+}
+
+/* Continuing a run from a fields::dump must give exactly the same fields and
+   fluxes as the uninterrupted run, including the PML and polarization state. */
+int test_dump_restart(double eps(const vec &), int splitting, const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s(gv, eps, pml(0.5, X) + pml(0.5, Y, High), identity(), splitting);
+  s.set_output_directory(mydirname);
+  s.add_susceptibility(disk, E_stuff, lorentzian_susceptibility(0.3, 0.1));
+
+  master_printf("Dump/restart test using %d chunks...\n", splitting);
+  fields *fs[2];
+  dft_flux *fluxes[2];
+  for (int i = 0; i < 2; ++i) {
+    fs[i] = new fields(&s);
+    fs[i]->add_point_source(Hz, 0.7, 2.5, 0.0, 4.0, vec(0.3, 0.5), 1.0);
+    fs[i]->add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.299, 0.401), 1.0);
+    fluxes[i] = new dft_flux(
+        fs[i]->add_dft_flux_plane(volume(vec(2.2, 0.2), vec(2.2, 1.4)), 0.5, 1.0, 5));
+  }
+  fields &f = *fs[0], &f1 = *fs[1];
+
+  while (f.time() < 5.0)
+    f.step();
+  char fname[256];
+  snprintf(fname, sizeof(fname), "%s/dump_restart.h5", mydirname);
+  f.dump(fname);
+  f1.load(fname);
+  if (f1.time() != f.time()) {
+    master_printf("restarted at time %g instead of %g\n", f1.time(), f.time());
+    return 0;
+  }
+
+  int ok = 1;
+  while (ok && f.time() < 12.0) {
+    f.step();
+    f1.step();
+    const vec pts[3] = {vec(0.5, 0.01), vec(1.3, 0.8), vec(2.7, 1.9)};
+    for (int k = 0; k < 3; ++k)
+      for (int c = 0; c < NUM_FIELD_COMPONENTS; ++c)
+        if (gv.has_field(component(c)) &&
+            f.get_field(component(c), pts[k]) != f1.get_field(component(c), pts[k])) {
+          master_printf("%s differs at (%g,%g), time %g\n", component_name(component(c)),
+                        pts[k].x(), pts[k].y(), f.time());
+          ok = 0;
+        }
+  }
+  double *flux = fluxes[0]->flux(), *flux1 = fluxes[1]->flux();
+  for (int i = 0; ok && i < 5; ++i)
+    if (flux[i] != flux1[i] || flux[i] == 0) {
+      master_printf("flux %d differs: %g instead of %g\n", i, flux1[i], flux[i]);
+      ok = 0;
+    }
+  delete[] flux1;
+  delete[] flux;
+  for (int i = 0; i < 2; ++i) {
+    delete fluxes[i];
+    delete fs[i];
+  }
+  return ok;
+}
+
 int test_periodic(double eps(const vec &), int splitting, const char *mydirname) {
   double a = 10.0;
   double ttot = 17.0;
@@ -151,6 +472,160 @@ int test_periodic(double eps(const vec &), int splitting, const char *mydirname)
   return 1;
 }
 
+/* Fields stepped together by a fields_batch (sharing a structure, with
+   different sources and Bloch wavevectors) must evolve exactly as when
+   they are stepped one at a time. */
+int test_batch(double eps(const vec &), int splitting, const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s1(gv, eps, pml(0.5, X), identity(), splitting);
+  structure s(gv, eps, pml(0.5, X), identity(), splitting);
+  s.set_output_directory(mydirname);
+  s1.set_output_directory(mydirname);
+  s.add_susceptibility(disk, E_stuff, lorentzian_susceptibility(0.3, 0.1));
+  s1.add_susceptibility(disk, E_stuff, lorentzian_susceptibility(0.3, 0.1));
+
+  master_printf("Batched fields test using %d chunks...\n", splitting);
+  fields *fs[2] = {new fields(&s), new fields(&s)};
+  fields *fs1[2] = {new fields(&s1), new fields(&s1)};
+  for (int i = 0; i < 2; ++i) {
+    const vec k(0.0, i ? 0.7 : 0.2);
+    fs[i]->use_bloch(k);
+    fs1[i]->use_bloch(k);
+  }
+  fs[0]->add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.299, 0.401), 1.0);
+  fs1[0]->add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.299, 0.401), 1.0);
+  fs[1]->add_point_source(Hz, 0.7, 2.5, 0.0, 4.0, vec(2.3, 1.5), 1.0);
+  fs1[1]->add_point_source(Hz, 0.7, 2.5, 0.0, 4.0, vec(2.3, 1.5), 1.0);
+
+  fields_batch batch(fs, 2);
+  int ok = 1;
+  while (ok && fs[0]->time() < 10.0) {
+    batch.step();
+    for (int i = 0; i < 2; ++i) {
+      fs1[i]->step();
+      ok = ok && compare_point(*fs[i], *fs1[i], vec(0.5, 0.01)) &&
+           compare_point(*fs[i], *fs1[i], vec(1.3, 0.8)) &&
+           compare_point(*fs[i], *fs1[i], vec(2.46, 1.55));
+    }
+  }
+  for (int i = 0; ok && i < 2; ++i)
+    ok = compare(fs[i]->field_energy(), fs1[i]->field_energy(), "   total energy");
+  for (int i = 0; i < 2; ++i) {
+    delete fs[i];
+    delete fs1[i];
+  }
+  return ok;
+}
+
+/* Fields that are restarted (t = 0, zero_fields, and new sources), as for
+   the successive source terms of a Casimir computation, must evolve exactly
+   as new fields of the same structure with those sources. */
+int test_restart(double eps(const vec &), int splitting, const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s(gv, eps, pml(0.5), identity(), splitting);
+  s.set_output_directory(mydirname);
+  s.add_susceptibility(disk, E_stuff, lorentzian_susceptibility(0.3, 0.1));
+  s.set_conductivity(Dz, disk);
+
+  master_printf("Restarted fields test using %d chunks...\n", splitting);
+  fields f(&s), f1(&s);
+  f.use_bloch(vec(0.0, 0.3));
+  f1.use_bloch(vec(0.0, 0.3));
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.299, 0.401), 1.0);
+  while (f.time() < 7.0)
+    f.step();
+
+  f.t = 0;
+  f.zero_fields();
+  f.remove_sources();
+  f.add_point_source(Ez, 0.7, 2.5, 0.0, 4.0, vec(2.1, 1.3), 1.0);
+  f1.add_point_source(Ez, 0.7, 2.5, 0.0, 4.0, vec(2.1, 1.3), 1.0);
+  while (f.time() < 10.0) {
+    f.step();
+    f1.step();
+    if (!compare_point(f, f1, vec(0.5, 0.01))) return 0;
+    if (!compare_point(f, f1, vec(1.3, 0.8))) return 0;
+    if (!compare_point(f, f1, vec(2.46, 1.55))) return 0;
+  }
+  return compare(f.field_energy(), f1.field_energy(), "   total energy");
+}
+
+complex<double> field_value(const complex<double> *fields, const vec &loc, void *data) {
+  (void)loc;
+  (void)data;
+  return fields[0];
+}
+
+/* A loop over a volume that wraps around the cell is planned once, while
+   the fields still have another Bloch wavevector; the planned loop must use
+   the current Bloch phases. */
+int test_bloch_plans(double eps(const vec &), int splitting, const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s(gv, eps, no_pml(), identity(), splitting);
+  s.set_output_directory(mydirname);
+
+  master_printf("Bloch loop plan test using %d chunks...\n", splitting);
+  const volume wrap(vec(-0.5, -0.4), vec(0.7, 0.6));
+  const component c = Ez;
+  fields f(&s), f1(&s);
+  f.use_bloch(vec(0.3, 0.2));
+  f.integrate(1, &c, field_value, NULL, wrap);
+  f.use_bloch(vec(0.1, 0.7));
+  f1.use_bloch(vec(0.1, 0.7));
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(0.2, 0.3), 1.0);
+  f1.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(0.2, 0.3), 1.0);
+  while (f.time() < 10.0) {
+    f.step();
+    f1.step();
+    const complex<double> I = f.integrate(1, &c, field_value, NULL, wrap);
+    const complex<double> I1 = f1.integrate(1, &c, field_value, NULL, wrap);
+    if (abs(I - I1) > tol * abs(I1) && abs(I1) > thresh) {
+      master_printf("integral over the wrapped volume differs: %g%+gi instead of %g%+gi\n",
+                    real(I), imag(I), real(I1), imag(I1));
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* field_probes must return the same values as get_field, with a mirror
+   symmetry or (for points outside the cell) with Bloch-periodic fields */
+int test_probes(double eps(const vec &), int splitting, bool bloch, const char *mydirname) {
+  grid_volume gv = voltwo(3.0, 2.0, 10.0);
+  structure s(gv, eps, no_pml(), bloch ? identity() : mirror(Y, gv), splitting);
+  s.set_output_directory(mydirname);
+
+  master_printf("Field probes test (%s) using %d chunks...\n", bloch ? "Bloch" : "mirror",
+                splitting);
+  fields f(&s);
+  if (bloch) f.use_bloch(vec(0.1, 0.7));
+  field_probes probes(&f);
+  const component cs[3] = {Ez, Hx, Hy};
+  const vec pts[4] = {vec(0.5, 0.01), vec(1.33, 0.77), vec(2.46, 1.55),
+                      bloch ? vec(-0.7, 2.4) : vec(1.72, 1.98)};
+  for (int k = 0; k < 4; ++k)
+    for (int i = 0; i < 3; ++i)
+      probes.add(cs[i], pts[k]);
+  f.add_point_source(Ez, 0.8, 0.6, 0.0, 4.0, vec(1.299, 1.0), 1.0);
+
+  complex<double> values[12];
+  while (f.time() < 10.0) {
+    f.step();
+    probes.get(values);
+    for (int k = 0; k < 4; ++k)
+      for (int i = 0; i < 3; ++i) {
+        const complex<double> v = values[k * 3 + i], v1 = f.get_field(cs[i], pts[k]);
+        if (abs(v - v1) > tol * abs(v1) && abs(v1) > thresh) {
+          master_printf("probe of %s at (%g,%g) is %g%+gi instead of %g%+gi\n",
+                        component_name(cs[i]), pts[k].x(), pts[k].y(), real(v), imag(v),
+                        real(v1), imag(v1));
+          return 0;
+        }
+      }
+  }
+  return 1;
+}
+
 int test_periodic_tm(double eps(const vec &), int splitting, const char *mydirname) {
   double a = 10.0;
   double ttot = 17.0;
@@ -363,6 +838,48 @@ int main(int argc, char **argv) {
   // if (!test_periodic(one, 200, mydirname))
   //  abort("error in test_periodic targets\n");
 
+  for (int s = 1; s < 4; s++)
+    if (!test_fused(targets, s, mydirname)) abort("error in test_fused targets\n");
+
+  for (int s = 1; s < 4; s++)
+    if (!test_poles(one, s, mydirname)) abort("error in test_poles vacuum\n");
+
+  for (int s = 1; s < 5; s++)
+    if (!test_sigma_box(targets, s, mydirname)) abort("error in test_sigma_box targets\n");
+
+  for (int s = 1; s < 4; s++)
+    if (!test_multilevel(one, s, mydirname)) abort("error in test_multilevel vacuum\n");
+
+  set_random_seed(271828);
+  for (int s = 2; s < 5; s++)
+    if (!test_noise(targets, s, mydirname)) abort("error in test_noise targets\n");
+
+  for (int s = 1; s < 4; s++)
+    if (!test_pml_copy(one, s, mydirname)) abort("error in test_pml_copy vacuum\n");
+
+  for (int s = 2; s < 7; s += 2)
+    if (!test_rebalance(targets, s, mydirname)) abort("error in test_rebalance targets\n");
+
+  for (int s = 1; s < 5; s++)
+    if (!test_volume_source(targets, s, mydirname)) abort("error in test_volume_source targets\n");
+
+  for (int s = 1; s < 4; s++)
+    if (!test_dump_restart(targets, s, mydirname)) abort("error in test_dump_restart targets\n");
+
+  for (int s = 1; s < 4; s++)
+    if (!test_batch(targets, s, mydirname)) abort("error in test_batch targets\n");
+
+  for (int s = 1; s < 4; s++)
+    if (!test_restart(targets, s, mydirname)) abort("error in test_restart targets\n");
+
+  for (int s = 1; s < 4; s++)
+    if (!test_bloch_plans(targets, s, mydirname)) abort("error in test_bloch_plans targets\n");
+
+  for (int s = 1; s < 4; s++) {
+    if (!test_probes(targets, s, false, mydirname)) abort("error in test_probes targets\n");
+    if (!test_probes(targets, s, true, mydirname)) abort("error in test_probes targets\n");
+  }
+
   for (int s = 2; s < 4; s++)
     if (!test_periodic_tm(one, s, mydirname)) abort("error in test_periodic_tm vacuum\n");
 